@@ -3,7 +3,16 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/stats.h"
+#include "threads/thread.h"
+
+/* Number of buckets in a latency histogram.  Bucket I counts
+   requests that took from 2**I to 2**(I+1) - 1 CPU cycles, and
+   the last bucket also counts everything slower. */
+#define LATENCY_BUCKETS 40
 
 /* A block device. */
 struct block
@@ -17,8 +26,19 @@ struct block
     const struct block_operations *ops;  /* Driver operations. */
     void *aux;                          /* Extra data owned by driver. */
 
-    unsigned long long read_cnt;        /* Number of sectors read. */
-    unsigned long long write_cnt;       /* Number of sectors written. */
+    struct stats_counter read_cnt;      /* Number of sectors read. */
+    struct stats_counter write_cnt;     /* Number of sectors written. */
+    struct stats_counter flush_cnt;     /* Number of cache flushes. */
+
+    /* Queue statistics, protected by disabling interrupts. */
+    int in_flight;                      /* Requests under way. */
+    int max_in_flight;                  /* Most requests under way. */
+    int64_t busy_since;                 /* When in_flight became 1. */
+    int64_t busy_ticks;                 /* Ticks with requests under way. */
+
+    /* Service time histograms in CPU cycles, reads in [0] and
+       writes in [1], protected by disabling interrupts. */
+    unsigned latency[2][LATENCY_BUCKETS];
   };
 
 /* List of all block devices. */
@@ -113,6 +133,46 @@ check_sector (struct block *block, block_sector_t sector)
     }
 }
 
+/* Records the start of a request to BLOCK. */
+static void
+io_start (struct block *block)
+{
+  enum intr_level old_level = intr_disable ();
+  if (block->in_flight++ == 0)
+    block->busy_since = timer_ticks ();
+  if (block->in_flight > block->max_in_flight)
+    block->max_in_flight = block->in_flight;
+  intr_set_level (old_level);
+}
+
+/* Records the end of a request to BLOCK. */
+static void
+io_end (struct block *block)
+{
+  enum intr_level old_level = intr_disable ();
+  ASSERT (block->in_flight > 0);
+  if (--block->in_flight == 0)
+    block->busy_ticks += timer_ticks () - block->busy_since;
+  intr_set_level (old_level);
+}
+
+/* Records that a READ or write request to BLOCK that started
+   at time-stamp START has completed. */
+static void
+record_latency (struct block *block, bool read, uint64_t start)
+{
+  uint64_t cycles = timer_tsc () - start;
+  enum intr_level old_level;
+  int bucket;
+
+  for (bucket = 0; bucket < LATENCY_BUCKETS - 1 && cycles > 1; bucket++)
+    cycles >>= 1;
+
+  old_level = intr_disable ();
+  block->latency[read ? 0 : 1][bucket]++;
+  intr_set_level (old_level);
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -120,9 +180,14 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
+  uint64_t start = timer_tsc ();
+
   check_sector (block, sector);
+  io_start (block);
   block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  io_end (block);
+  record_latency (block, true, start);
+  stats_inc (&block->read_cnt);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +198,175 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
+  uint64_t start = timer_tsc ();
+
   check_sector (block, sector);
   ASSERT (block->type != BLOCK_FOREIGN);
+  io_start (block);
   block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  io_end (block);
+  record_latency (block, false, start);
+  stats_inc (&block->write_cnt);
+}
+
+/* Verifies that the CNT sectors starting at SECTOR are all
+   within BLOCK.  Panics if not. */
+static void
+check_sectors (struct block *block, block_sector_t sector, size_t cnt)
+{
+  if (cnt > 0)
+    {
+      check_sector (block, sector);
+      check_sector (block, sector + (cnt - 1));
+    }
+}
+
+/* Transfers CNT sectors starting at SECTOR between BLOCK and
+   BUFFER, in the direction READ gives, through the driver's
+   multi-sector operation if it has one, otherwise sector by
+   sector.  Does not update BLOCK's statistics. */
+static void
+driver_transfer (struct block *block, block_sector_t sector, size_t cnt,
+                 void *buffer_, bool read)
+{
+  uint8_t *buffer = buffer_;
+  size_t i;
+
+  if (read && block->ops->read_multiple != NULL)
+    block->ops->read_multiple (block->aux, sector, cnt, buffer);
+  else if (!read && block->ops->write_multiple != NULL)
+    block->ops->write_multiple (block->aux, sector, cnt, buffer);
+  else
+    for (i = 0; i < cnt; i++)
+      if (read)
+        block->ops->read (block->aux, sector + i,
+                          buffer + i * BLOCK_SECTOR_SIZE);
+      else
+        block->ops->write (block->aux, sector + i,
+                           buffer + i * BLOCK_SECTOR_SIZE);
+}
+
+/* Like driver_transfer(), but records the transfer in BLOCK's
+   queue statistics. */
+static void
+transfer (struct block *block, block_sector_t sector, size_t cnt,
+          void *buffer, bool read)
+{
+  uint64_t start = timer_tsc ();
+
+  io_start (block);
+  driver_transfer (block, sector, cnt, buffer, read);
+  io_end (block);
+  record_latency (block, read, start);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Drivers that support it move the sectors in a few
+   large requests; for others this is the same as CNT calls to
+   block_read().
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *buffer)
+{
+  check_sectors (block, sector, cnt);
+  transfer (block, sector, cnt, buffer, true);
+  stats_add (&block->read_cnt, cnt);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving the
+   data.  Drivers that support it move the sectors in a few
+   large requests; for others this is the same as CNT calls to
+   block_write().
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      size_t cnt, const void *buffer)
+{
+  check_sectors (block, sector, cnt);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  transfer (block, sector, cnt, (void *) buffer, false);
+  stats_add (&block->write_cnt, cnt);
+}
+
+/* Initializes request R for CNT sectors starting at SECTOR on
+   BLOCK, and sends it to the driver. */
+static void
+submit (struct block *block, block_sector_t sector, size_t cnt,
+        void *buffer, bool read, struct block_request *r)
+{
+  check_sectors (block, sector, cnt);
+  r->block = block;
+  r->disk = block;
+  r->sector = sector;
+  r->cnt = cnt;
+  r->buffer = buffer;
+  r->read = read;
+  r->async = true;
+  r->priority = thread_get_priority ();
+  r->time = timer_ticks ();
+  r->tsc = timer_tsc ();
+  r->done = false;
+  sema_init (&r->sema, 0);
+  io_start (block);
+  block_pass (block, r);
+}
+
+/* Starts reading CNT consecutive sectors starting at SECTOR from
+   BLOCK into BUFFER, which must have room for
+   CNT * BLOCK_SECTOR_SIZE bytes, and returns without waiting
+   for the data.  The caller must later call block_wait (R),
+   before it touches BUFFER.  Requests to different devices, and
+   on IDE to different channels, proceed at the same time. */
+void
+block_read_async (struct block *block, block_sector_t sector, size_t cnt,
+                  void *buffer, struct block_request *r)
+{
+  submit (block, sector, cnt, buffer, true, r);
+  stats_add (&block->read_cnt, cnt);
+}
+
+/* Starts writing CNT consecutive sectors starting at SECTOR to
+   BLOCK from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE
+   bytes, and returns without waiting for the write.  The caller
+   must later call block_wait (R), and must not change BUFFER
+   until then. */
+void
+block_write_async (struct block *block, block_sector_t sector, size_t cnt,
+                   const void *buffer, struct block_request *r)
+{
+  ASSERT (block->type != BLOCK_FOREIGN);
+  submit (block, sector, cnt, (void *) buffer, false, r);
+  stats_add (&block->write_cnt, cnt);
+}
+
+/* Waits for request R, made with block_read_async() or
+   block_write_async(), to complete. */
+void
+block_wait (struct block_request *r)
+{
+  sema_down (&r->sema);
+}
+
+/* Returns once every write to BLOCK that has completed is on
+   stable storage, not just in the device's write cache, which
+   makes it a barrier between those writes and any that follow.
+   Writes that are still under way are not covered.  Does nothing
+   for a device that has no write cache. */
+void
+block_flush (struct block *block)
+{
+  if (block->ops->flush == NULL)
+    return;
+  io_start (block);
+  block->ops->flush (block->aux);
+  io_end (block);
+  stats_inc (&block->flush_cnt);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,6 +390,27 @@ block_type (struct block *block)
   return block->type;
 }
 
+/* Prints BLOCK's histogram of the service times of reads, if
+   READ is true, or writes, listing only the nonempty buckets. */
+static void
+print_latency (struct block *block, bool read)
+{
+  const unsigned *latency = block->latency[read ? 0 : 1];
+  int i;
+
+  for (i = 0; i < LATENCY_BUCKETS; i++)
+    if (latency[i] != 0)
+      break;
+  if (i >= LATENCY_BUCKETS)
+    return;
+
+  printf ("  %s cycles:", read ? "read" : "write");
+  for (; i < LATENCY_BUCKETS; i++)
+    if (latency[i] != 0)
+      printf (" 2^%d:%u", i, latency[i]);
+  printf ("\n");
+}
+
 /* Prints statistics for each block device used for a Pintos role. */
 void
 block_print_stats (void)
@@ -171,9 +422,11 @@ block_print_stats (void)
       struct block *block = block_by_role[i];
       if (block != NULL)
         {
-          printf ("%s (%s): %llu reads, %llu writes\n",
+          printf ("%s (%s): max queue depth %d, busy %lld ticks\n",
                   block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
+                  block->max_in_flight, block->busy_ticks);
+          print_latency (block, true);
+          print_latency (block, false);
         }
     }
 }
@@ -198,8 +451,20 @@ block_register (const char *name, enum block_type type,
   block->size = size;
   block->ops = ops;
   block->aux = aux;
-  block->read_cnt = 0;
-  block->write_cnt = 0;
+  stats_set (&block->read_cnt, 0);
+  stats_set (&block->write_cnt, 0);
+  stats_set (&block->flush_cnt, 0);
+  stats_register (&block->read_cnt, block->name, "sectors_read",
+                  STATS_COUNTER);
+  stats_register (&block->write_cnt, block->name, "sectors_written",
+                  STATS_COUNTER);
+  stats_register (&block->flush_cnt, block->name, "flushes",
+                  STATS_COUNTER);
+  block->in_flight = 0;
+  block->max_in_flight = 0;
+  block->busy_since = 0;
+  block->busy_ticks = 0;
+  memset (block->latency, 0, sizeof block->latency);
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -221,3 +486,45 @@ list_elem_to_block (struct list_elem *list_elem)
           : NULL);
 }
 
+/* Sends request R on to BLOCK's driver.  A driver for a device
+   layered on top of BLOCK, such as a partition, may call this
+   from its submit operation after translating R's sector; R then
+   counts in BLOCK's statistics as well as its own device's, as a
+   synchronous request to the partition would.  Runs R
+   synchronously if the driver cannot take requests
+   asynchronously. */
+void
+block_pass (struct block *block, struct block_request *r)
+{
+  check_sectors (block, r->sector, r->cnt);
+  r->aux = block->aux;
+  if (block != r->block)
+    {
+      r->disk = block;
+      io_start (block);
+      stats_add (r->read ? &block->read_cnt : &block->write_cnt, r->cnt);
+    }
+  if (block->ops->submit != NULL)
+    block->ops->submit (block->aux, r);
+  else
+    {
+      driver_transfer (block, r->sector, r->cnt, r->buffer, r->read);
+      block_complete (r);
+    }
+}
+
+/* Called by the driver when request R has completed.  Wakes up
+   whoever waits for R in block_wait(). */
+void
+block_complete (struct block_request *r)
+{
+  io_end (r->block);
+  record_latency (r->block, r->read, r->tsc);
+  if (r->disk != r->block)
+    {
+      io_end (r->disk);
+      record_latency (r->disk, r->read, r->tsc);
+    }
+  r->done = true;
+  sema_up (&r->sema);
+}
@@ -3,6 +3,9 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include <rbtree.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,6 +56,39 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt,
+                          void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
+
+/* An asynchronous request.  The submitter provides the memory,
+   which must stay put until block_wait() returns.  The members
+   are for the block layer and drivers. */
+struct block_request
+  {
+    struct list_elem elem;      /* For the driver's use. */
+    struct rb_elem sort_elem;   /* For the driver's use. */
+    struct block *block;        /* Device the request was made to. */
+    struct block *disk;         /* Device it was passed down to. */
+    void *aux;                  /* Driver's AUX for the device. */
+    block_sector_t sector;      /* First sector, on the device. */
+    size_t cnt;                 /* Number of sectors. */
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    bool read;                  /* Read, or write? */
+    bool async;                 /* Made through block_*_async()? */
+    int priority;               /* Submitting thread's priority. */
+    int64_t time;               /* Timer ticks at submission. */
+    uint64_t tsc;               /* timer_tsc() at submission. */
+    bool done;                  /* Completed? */
+    struct semaphore sema;      /* Up'd on completion. */
+  };
+
+void block_read_async (struct block *, block_sector_t, size_t cnt, void *,
+                       struct block_request *);
+void block_write_async (struct block *, block_sector_t, size_t cnt,
+                        const void *, struct block_request *);
+void block_wait (struct block_request *);
+void block_flush (struct block *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
@@ -65,10 +101,30 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer CNT consecutive sectors in as few
+       requests as the driver can.  If null, the block layer
+       calls read or write once per sector instead. */
+    void (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            const void *buffer);
+
+    /* Optional.  Start request R and return without waiting for
+       it, calling block_complete (R) once it is done.  If null,
+       the block layer carries requests out synchronously. */
+    void (*submit) (void *aux, struct block_request *r);
+
+    /* Optional.  Return once every write the device has
+       acknowledged is on stable storage.  Null for devices that
+       acknowledge writes only once they are there. */
+    void (*flush) (void *aux);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+void block_pass (struct block *, struct block_request *);
+void block_complete (struct block_request *);
 
 #endif /* devices/block.h */
@@ -5,17 +5,56 @@
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/trace.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   If the channels belong to a PCI IDE controller that can act as
+   a bus master, as the PIIX controllers that QEMU and Bochs
+   emulate do, sectors are transferred by DMA: the controller
+   copies the data between the disk and memory by itself while
+   the requesting thread sleeps, instead of the CPU moving it
+   through the data port one word at a time.  Otherwise, or for
+   a buffer the controller cannot reach, the driver falls back to
+   PIO.
+
+   Requests for a channel wait in the channel's queue while the
+   channel is busy.  When a transfer completes, an elevator picks
+   the next request: one that has waited DEADLINE_TICKS or more,
+   if any, otherwise one from the highest-priority requester,
+   nearest to the head in C-LOOK order, that is, the next one at
+   or after the sector the last transfer ended at, wrapping
+   around to the lowest.  Queued requests for sectors adjacent to
+   the chosen one, in the same direction, are merged into the
+   same command.  Besides arrival order, for the deadlines, the
+   queue is kept in a red-black tree sorted by priority and then
+   position, so that picking a request and finding its neighbors
+   take logarithmic time.  Rather than a dispatcher thread, the
+   thread whose request was chosen drives the channel: it is
+   woken by the request's semaphore, runs the transfer, wakes the
+   threads whose requests were merged into it, and hands the
+   channel on to the next chosen request.
+
+   Asynchronous requests, from block_read_async() and
+   block_write_async(), have no thread waiting to drive them.
+   Each channel has a worker thread that the channel is handed
+   to for them instead.  The two channels thus transfer data at
+   the same time, while the submitters go on computing.  The two
+   disks on one channel share its command registers and take
+   turns. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
-#define reg_error(CHANNEL) ((CHANNEL)->reg_base + 1)    /* Error. */
+#define reg_error(CHANNEL) ((CHANNEL)->reg_base + 1)    /* Error (r/o). */
+#define reg_features(CHANNEL) reg_error (CHANNEL)       /* Features (w/o). */
 #define reg_nsect(CHANNEL) ((CHANNEL)->reg_base + 2)    /* Sector Count. */
 #define reg_lbal(CHANNEL) ((CHANNEL)->reg_base + 3)     /* LBA 0:7. */
 #define reg_lbam(CHANNEL) ((CHANNEL)->reg_base + 4)     /* LBA 15:8. */
@@ -30,10 +69,24 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
 
+/* Bus master IDE port addresses, for channels with DMA. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
+
+/* Bus Master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus Master Status Register bits. */
+#define BM_STA_ERROR 0x02       /* Transfer failed (write 1 to clear). */
+#define BM_STA_INTR 0x04        /* Device interrupted (write 1 to clear). */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +102,48 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+#define CMD_READ_SECTOR_EXT 0x24        /* READ SECTOR EXT. */
+#define CMD_WRITE_SECTOR_EXT 0x34       /* WRITE SECTOR EXT. */
+#define CMD_READ_DMA_EXT 0x25           /* READ DMA EXT. */
+#define CMD_WRITE_DMA_EXT 0x35          /* WRITE DMA EXT. */
+#define CMD_SET_FEATURES 0xef           /* SET FEATURES. */
+#define CMD_FLUSH_CACHE 0xe7            /* FLUSH CACHE. */
+#define CMD_FLUSH_CACHE_EXT 0xea        /* FLUSH CACHE EXT. */
+
+/* SET FEATURES subcommands, in the Features register. */
+#define FEAT_WRITE_CACHE_ON 0x02        /* Enable write cache. */
+
+/* Sectors that 28-bit commands can address.  Transfers that
+   reach past them take the 48-bit EXT commands, on disks that
+   support them. */
+#define LBA28_SECTORS (1u << 28)
+
+/* Physical region descriptor, which tells the bus master where
+   in physical memory to transfer data.  A region must not cross
+   a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address, word aligned. */
+    uint16_t size;              /* Bytes, even. */
+    uint16_t flags;             /* PRD_EOT in the last descriptor. */
+  };
+
+#define PRD_EOT 0x8000          /* End of table. */
+
+/* Most sectors moved by one command, and most requests merged
+   into one command.  Each request's buffer spans at most 64 kB,
+   so it needs at most two regions, if it straddles a 64 kB
+   boundary. */
+#define MAX_TRANSFER 128
+#define MAX_MERGE 8
+#define PRD_CNT (2 * MAX_MERGE)
+
+/* Timer ticks after which a queued request is served ahead of
+   the elevator order. */
+#define DEADLINE_TICKS 50
+
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +152,11 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    bool use_dma;               /* Transfer by DMA? */
+    bool lba48;                 /* Supports 48-bit addressing? */
+    bool write_cache;           /* Write cache on? */
+    block_sector_t capacity;    /* Size, from IDENTIFY DEVICE. */
+    char info[96];              /* Model and serial number. */
   };
 
 /* An ATA channel (aka controller).
@@ -67,11 +167,22 @@ struct channel
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
 
-    struct lock lock;           /* Must acquire to access the controller. */
+    struct lock lock;           /* Protects queues, busy and head. */
+    struct list queue;          /* Waiting struct block_requests. */
+    struct rb_tree sorted;      /* Same, in elevator order. */
+    bool busy;                  /* Is a transfer under way? */
+    uint64_t head;              /* Elevator position, from disk_pos(). */
+    struct semaphore worker_go; /* Up'd to hand the worker a request. */
+    struct block_request *worker_request; /* Request for the worker. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    uint16_t bm_base;           /* Bus master base port, 0 if no DMA. */
+    uint8_t bm_status;          /* Bus master status at last interrupt. */
+    struct prd prdt[PRD_CNT]    /* PRD table for the current transfer. */
+      __attribute__ ((aligned (sizeof (struct prd) * PRD_CNT)));
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -79,16 +190,35 @@ struct channel
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
 
+/* Time that the ATA standards give devices after a soft reset
+   before BSY must be valid, in milliseconds. */
+#define RESET_SETTLE_MS 2
+
+unsigned ide_timeout_ms = 30000;
+
+/* -ide-large: Use disks of 1 GB or more? */
+bool ide_large_disks;
+
 static struct block_operations ide_operations;
 
-static void reset_channel (struct channel *);
+static uint16_t find_bus_master (void);
+static bool reset_channel (struct channel *);
+static thread_func probe_channel;
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
+static void enable_write_cache (struct ata_disk *);
+static void register_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+/* Upped by each channel's probe thread when it finishes. */
+static struct semaphore probes_done;
+
+static bool select_sector (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
+static bool dma_transfer (struct ata_disk *, struct list *batch,
+                          block_sector_t, size_t cnt, bool read);
+static void flush_cache (struct ata_disk *);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
@@ -96,11 +226,14 @@ static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
 static void interrupt_handler (struct intr_frame *);
+static thread_func worker_thread;
+static rb_less_func request_less;
 
 /* Initialize the disk subsystem and detect disks. */
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -123,9 +256,17 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
-      lock_init (&c->lock);
+      lock_init_named (&c->lock, "ide");
+      list_init (&c->queue);
+      rb_init (&c->sorted, request_less, NULL);
+      c->busy = false;
+      c->head = 0;
+      sema_init (&c->worker_go, 0);
+      c->worker_request = NULL;
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
+      c->bm_status = 0;
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,37 +277,125 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->use_dma = false;
+          d->write_cache = false;
         }
 
-      /* Register interrupt handler. */
+      /* Register interrupt handler and start worker. */
       intr_register_ext (c->irq, interrupt_handler, c->name);
+      thread_create (c->name, PRI_MAX, worker_thread, c);
+    }
 
-      /* Reset hardware. */
-      reset_channel (c);
+  /* Probe the channels at the same time, since most of the work
+     is waiting for the hardware to settle, then register the
+     disks in order, so that they are numbered the same way from
+     boot to boot. */
+  sema_init (&probes_done, 0);
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    {
+      char name[16];
 
-      /* Distinguish ATA hard disks from other devices. */
-      if (check_device_type (&c->devices[0]))
-        check_device_type (&c->devices[1]);
+      snprintf (name, sizeof name, "%s-probe", channels[chan_no].name);
+      thread_create (name, PRI_DEFAULT, probe_channel, &channels[chan_no]);
+    }
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    sema_down (&probes_done);
+
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    {
+      int dev_no;
 
-      /* Read hard disk identity information. */
       for (dev_no = 0; dev_no < 2; dev_no++)
-        if (c->devices[dev_no].is_ata)
-          identify_ata_device (&c->devices[dev_no]);
+        {
+          struct ata_disk *d = &channels[chan_no].devices[dev_no];
+          if (d->is_ata)
+            register_ata_device (d);
+        }
     }
 }
+
+/* Resets channel C_ and identifies the disks on it, then ups
+   probes_done. */
+static void
+probe_channel (void *c_) 
+{
+  struct channel *c = c_;
+  int dev_no;
+
+  /* Reset hardware, and distinguish ATA hard disks from other
+     devices. */
+  if (reset_channel (c) && check_device_type (&c->devices[0]))
+    check_device_type (&c->devices[1]);
+
+  /* Read hard disk identity information. */
+  for (dev_no = 0; dev_no < 2; dev_no++)
+    if (c->devices[dev_no].is_ata)
+      {
+        identify_ata_device (&c->devices[dev_no]);
+        if (c->devices[dev_no].is_ata)
+          enable_write_cache (&c->devices[dev_no]);
+      }
+
+  sema_up (&probes_done);
+}
 
 /* Disk detection and identification. */
 
 static char *descramble_ata_string (char *, int size);
 
+/* Looks on PCI bus 0 for an IDE controller that can be a bus
+   master, enables bus mastering on it, and returns the base port
+   of its bus master registers, of which the first channel's come
+   first and the second channel's 8 bytes later.  Returns 0 if
+   there is no such controller. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t class, bar;
+
+        if ((pci_read_config (dev, func, PCI_REG_ID) & 0xffff) == 0xffff)
+          continue;
+
+        /* Class 1 (mass storage), subclass 1 (IDE), with bit 7 of
+           the programming interface set if it can be a bus
+           master. */
+        class = pci_read_config (dev, func, PCI_REG_CLASS);
+        if ((class >> 16) != 0x0101 || !(class & 0x8000))
+          continue;
+
+        /* BAR4 holds the bus master registers' I/O port base. */
+        bar = pci_read_config (dev, func, 0x20);
+        if (!(bar & 1) || (bar & ~3u) == 0)
+          continue;
+
+        /* Turn on I/O space access and bus mastering. */
+        pci_write_config (dev, func, PCI_REG_COMMAND,
+                          pci_read_config (dev, func, PCI_REG_COMMAND)
+                          | PCI_CMD_IO | PCI_CMD_MASTER);
+        return bar & ~3u;
+      }
+  return 0;
+}
+
 /* Resets an ATA channel and waits for any devices present on it
-   to finish the reset. */
-static void
+   to finish the reset.  Returns false, without waiting, if no
+   device is attached. */
+static bool
 reset_channel (struct channel *c) 
 {
   bool present[2];
   int dev_no;
 
+  /* Nothing drives the bus of an empty channel, so its status
+     register floats to 0xff. */
+  if (inb (reg_status (c)) == 0xff)
+    return false;
+
   /* The ATA reset sequence depends on which devices are present,
      so we start by detecting device presence. */
   for (dev_no = 0; dev_no < 2; dev_no++)
@@ -187,6 +416,8 @@ reset_channel (struct channel *c)
       present[dev_no] = (inb (reg_nsect (c)) == 0x55
                          && inb (reg_lbal (c)) == 0xaa);
     }
+  if (!present[0] && !present[1])
+    return false;
 
   /* Issue soft reset sequence, which selects device 0 as a side effect.
      Also enable interrupts. */
@@ -196,7 +427,9 @@ reset_channel (struct channel *c)
   timer_usleep (10);
   outb (reg_ctl (c), 0);
 
-  timer_msleep (150);
+  /* Devices must be given RESET_SETTLE_MS to raise BSY, which
+     wait_while_busy() then polls for them to drop. */
+  timer_msleep (RESET_SETTLE_MS);
 
   /* Wait for device 0 to clear BSY. */
   if (present[0]) 
@@ -208,10 +441,10 @@ reset_channel (struct channel *c)
   /* Wait for device 1 to clear BSY. */
   if (present[1])
     {
-      int i;
+      unsigned i;
 
       select_device (&c->devices[1]);
-      for (i = 0; i < 3000; i++) 
+      for (i = 0; i < ide_timeout_ms / 10; i++) 
         {
           if (inb (reg_nsect (c)) == 1 && inb (reg_lbal (c)) == 1)
             break;
@@ -219,6 +452,7 @@ reset_channel (struct channel *c)
         }
       wait_while_busy (&c->devices[1]);
     }
+  return true;
 }
 
 /* Checks whether device D is an ATA disk and sets D's is_ata
@@ -254,17 +488,16 @@ check_device_type (struct ata_disk *d)
 }
 
 /* Sends an IDENTIFY DEVICE command to disk D and reads the
-   response.  Registers the disk with the block device
-   layer. */
+   response into D's capacity and info, for
+   register_ata_device().  Clears D's is_ata if the disk is not
+   to be used. */
 static void
 identify_ata_device (struct ata_disk *d) 
 {
   struct channel *c = d->channel;
   char id[BLOCK_SECTOR_SIZE];
-  block_sector_t capacity;
+  uint64_t capacity;
   char *model, *serial;
-  char extra_info[128];
-  struct block *block;
 
   ASSERT (d->is_ata);
 
@@ -281,20 +514,36 @@ identify_ata_device (struct ata_disk *d)
     }
   input_sector (c, id);
 
-  /* Calculate capacity.
+  /* Word 49 bit 8 says whether the disk supports DMA. */
+  d->use_dma = c->bm_base != 0 && (*(uint16_t *) &id[49 * 2] & 0x100) != 0;
+
+  /* Word 82 bit 5 says whether the disk has a write cache. */
+  d->write_cache = (*(uint16_t *) &id[82 * 2] & 0x20) != 0;
+
+  /* Word 83 bit 10 says whether the disk supports 48-bit
+     addressing, in which case words 100 to 103 give its size,
+     and otherwise words 60 and 61 do.  Block sector numbers are
+     32 bits, so anything past that is out of reach.
      Read model name and serial number. */
-  capacity = *(uint32_t *) &id[60 * 2];
+  d->lba48 = (*(uint16_t *) &id[83 * 2] & 0x400) != 0;
+  if (d->lba48)
+    capacity = *(uint64_t *) &id[100 * 2];
+  else
+    capacity = *(uint32_t *) &id[60 * 2];
+  if (capacity > UINT32_MAX)
+    capacity = UINT32_MAX;
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
-  snprintf (extra_info, sizeof extra_info,
+  snprintf (d->info, sizeof d->info,
             "model \"%s\", serial \"%s\"", model, serial);
 
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
      allow access to those, we're less likely to scribble on
-     someone's important data.  You can disable this check by
-     hand if you really want to do so. */
-  if (capacity >= 1024 * 1024 * 1024 / BLOCK_SECTOR_SIZE)
+     someone's important data.  The -ide-large option disables
+     this check. */
+  if (capacity >= 1024 * 1024 * 1024 / BLOCK_SECTOR_SIZE
+      && !ide_large_disks)
     {
       printf ("%s: ignoring ", d->name);
       print_human_readable_size (capacity * 512);
@@ -302,9 +551,38 @@ identify_ata_device (struct ata_disk *d)
       d->is_ata = false;
       return;
     }
+  d->capacity = capacity;
+}
+
+/* Turns on disk D's write cache, if identify_ata_device() found
+   that it has one, so that writes complete once the disk has the
+   data rather than once the data is on the medium.  Durability
+   then depends on flushing the cache, through block_flush(), at
+   the points where it matters.  Clears D's write_cache if the
+   disk refuses. */
+static void
+enable_write_cache (struct ata_disk *d)
+{
+  struct channel *c = d->channel;
+
+  if (!d->write_cache)
+    return;
+  select_device_wait (d);
+  outb (reg_features (c), FEAT_WRITE_CACHE_ON);
+  issue_pio_command (c, CMD_SET_FEATURES);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  d->write_cache = (inb (reg_status (c)) & STA_ERR) == 0;
+}
+
+/* Registers disk D, as identified by identify_ata_device(), with
+   the block layer and scans its partitions. */
+static void
+register_ata_device (struct ata_disk *d) 
+{
+  struct block *block;
 
-  /* Register. */
-  block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
+  block = block_register (d->name, BLOCK_RAW, d->info, d->capacity,
                           &ide_operations, d);
   partition_scan (block);
 }
@@ -337,6 +615,456 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
+/* Reads the CNT sectors starting at SEC_NO from disk D by PIO,
+   into the buffers of the requests in BATCH, which cover those
+   sectors in order.  Takes an interrupt for each sector. */
+static void
+pio_read (struct ata_disk *d, struct list *batch, block_sector_t sec_no,
+          size_t cnt)
+{
+  struct channel *c = d->channel;
+  struct list_elem *e;
+  size_t i;
+
+  if (select_sector (d, sec_no, cnt))
+    issue_pio_command (c, CMD_READ_SECTOR_EXT);
+  else
+    issue_pio_command (c, CMD_READ_SECTOR_RETRY);
+  for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      for (i = 0; i < r->cnt; i++)
+        {
+          sema_down (&c->completion_wait);
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                   d->name, r->sector + i);
+          input_sector (c, (uint8_t *) r->buffer + i * BLOCK_SECTOR_SIZE);
+        }
+    }
+}
+
+/* Writes the CNT sectors starting at SEC_NO to disk D by PIO,
+   from the buffers of the requests in BATCH, which cover those
+   sectors in order.  Takes an interrupt for each sector. */
+static void
+pio_write (struct ata_disk *d, struct list *batch, block_sector_t sec_no,
+           size_t cnt)
+{
+  struct channel *c = d->channel;
+  struct list_elem *e;
+  size_t i;
+
+  if (select_sector (d, sec_no, cnt))
+    issue_pio_command (c, CMD_WRITE_SECTOR_EXT);
+  else
+    issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
+  for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      for (i = 0; i < r->cnt; i++)
+        {
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, r->sector + i);
+          output_sector (c, (uint8_t *) r->buffer + i * BLOCK_SECTOR_SIZE);
+          sema_down (&c->completion_wait);
+        }
+    }
+}
+
+/* Returns the position of the sectors of request R in C-LOOK
+   order, in which all of a channel's master disk comes before
+   its slave disk. */
+static uint64_t
+disk_pos (const struct block_request *r)
+{
+  const struct ata_disk *d = r->aux;
+  return ((uint64_t) d->dev_no << 32) + r->sector;
+}
+
+/* Returns true if request A comes before request B in the
+   elevator order of the channel's sorted queue: higher priority
+   first, then in C-LOOK order. */
+static bool
+request_less (const struct rb_elem *a_, const struct rb_elem *b_,
+              void *aux UNUSED)
+{
+  const struct block_request *a = rb_entry (a_, struct block_request,
+                                            sort_elem);
+  const struct block_request *b = rb_entry (b_, struct block_request,
+                                            sort_elem);
+
+  if (a->priority != b->priority)
+    return a->priority > b->priority;
+  return disk_pos (a) < disk_pos (b);
+}
+
+/* Last position, from disk_pos(), on a channel: the last sector
+   of its second device. */
+#define POS_MAX (((uint64_t) 1 << 32) | UINT32_MAX)
+
+/* Sets up KEY, for searching C's sorted queue, as a request of
+   priority PRIORITY at position POS, which must not exceed
+   POS_MAX. */
+static void
+make_key (struct channel *c, struct block_request *key, int priority,
+          uint64_t pos)
+{
+  int dev_no = pos >> 32;
+
+  ASSERT (pos <= POS_MAX);
+  key->aux = &c->devices[dev_no];
+  key->sector = pos;
+  key->priority = priority;
+}
+
+/* Adds request R to the end of C's queue. */
+static void
+enqueue (struct channel *c, struct block_request *r)
+{
+  list_push_back (&c->queue, &r->elem);
+  rb_insert (&c->sorted, &r->sort_elem);
+}
+
+/* Removes request R from C's queue. */
+static void
+dequeue (struct channel *c, struct block_request *r)
+{
+  list_remove (&r->elem);
+  rb_remove (&c->sorted, &r->sort_elem);
+}
+
+/* Returns the request in C's queue, which must not be empty,
+   that the elevator serves next. */
+static struct block_request *
+pick_request (struct channel *c)
+{
+  struct block_request *oldest, *top, key;
+  struct rb_elem *e;
+
+  ASSERT (!list_empty (&c->queue));
+
+  /* The queue is in arrival order, so if any request has expired,
+     the first one has. */
+  oldest = list_entry (list_front (&c->queue), struct block_request, elem);
+  if (timer_ticks () >= oldest->time + DEADLINE_TICKS)
+    return oldest;
+
+  /* Take the highest-priority request at or after the head, or
+     wrap around to the lowest-positioned one of that priority,
+     which comes first in the sorted queue. */
+  top = rb_entry (rb_begin (&c->sorted), struct block_request, sort_elem);
+  make_key (c, &key, top->priority, c->head);
+  e = rb_lower_bound (&c->sorted, &key.sort_elem);
+  if (e != rb_end (&c->sorted)
+      && rb_entry (e, struct block_request, sort_elem)->priority
+         == top->priority)
+    return rb_entry (e, struct block_request, sort_elem);
+  return top;
+}
+
+/* Returns true if queued request Q can be merged into request R,
+   whose batch covers CNT sectors. */
+static bool
+can_merge (const struct block_request *q, const struct block_request *r,
+           size_t cnt)
+{
+  return q->aux == r->aux && q->read == r->read && q->cnt > 0
+         && cnt + q->cnt <= MAX_TRANSFER;
+}
+
+/* Returns a request in C's queue that can be merged into request
+   R, whose batch covers the CNT sectors starting at FIRST, and
+   that starts right after the batch, setting *AFTER to true, or
+   ends right before it, setting *AFTER to false.  Returns a null
+   pointer if there is none.
+
+   The sorted queue keeps each priority's requests together, in
+   position order, so this looks for a neighbor on each side
+   within each priority present. */
+static struct block_request *
+find_adjacent (struct channel *c, const struct block_request *r,
+               block_sector_t first, size_t cnt, bool *after)
+{
+  uint64_t dev_pos = disk_pos (r) - r->sector;
+  struct rb_elem *group = rb_begin (&c->sorted);
+
+  while (group != rb_end (&c->sorted))
+    {
+      int priority = rb_entry (group, struct block_request,
+                               sort_elem)->priority;
+      struct block_request key;
+      struct rb_elem *e;
+
+      /* Requests starting at FIRST + CNT. */
+      make_key (c, &key, priority, dev_pos + first + cnt);
+      for (e = rb_lower_bound (&c->sorted, &key.sort_elem);
+           e != rb_end (&c->sorted); e = rb_next (e))
+        {
+          struct block_request *q = rb_entry (e, struct block_request,
+                                              sort_elem);
+          if (request_less (&key.sort_elem, e, NULL))
+            break;
+          if (can_merge (q, r, cnt))
+            {
+              *after = true;
+              return q;
+            }
+        }
+
+      /* Requests ending at FIRST, which start no more than the
+         room left in the batch before it. */
+      make_key (c, &key, priority, dev_pos + first);
+      e = rb_lower_bound (&c->sorted, &key.sort_elem);
+      for (e = e != rb_end (&c->sorted) ? rb_prev (e) : rb_last (&c->sorted);
+           e != NULL; e = rb_prev (e))
+        {
+          struct block_request *q = rb_entry (e, struct block_request,
+                                              sort_elem);
+          if (q->priority != priority || q->aux != r->aux
+              || q->sector + (MAX_TRANSFER - cnt) < first)
+            break;
+          if (q->sector + q->cnt == first && can_merge (q, r, cnt))
+            {
+              *after = false;
+              return q;
+            }
+        }
+
+      /* Skip to the next lower priority. */
+      make_key (c, &key, priority, POS_MAX);
+      group = rb_upper_bound (&c->sorted, &key.sort_elem);
+    }
+  return NULL;
+}
+
+/* Moves requests from C's queue into BATCH, which holds request
+   R only, while they are for sectors right before or right after
+   those BATCH covers, on the same disk in the same direction,
+   and the batch stays within MAX_TRANSFER sectors and MAX_MERGE
+   requests.  Keeps BATCH in sector order.  Stores the first
+   sector covered into *SECTORP and returns the number of
+   sectors. */
+static size_t
+merge_requests (struct channel *c, struct list *batch,
+                struct block_request *r, block_sector_t *sectorp)
+{
+  block_sector_t first = r->sector;
+  size_t cnt = r->cnt;
+  size_t merged;
+
+  for (merged = 1; merged < MAX_MERGE; merged++)
+    {
+      bool after;
+      struct block_request *q = find_adjacent (c, r, first, cnt, &after);
+
+      if (q == NULL)
+        break;
+      dequeue (c, q);
+      if (after)
+        list_push_back (batch, &q->elem);
+      else
+        {
+          list_push_front (batch, &q->elem);
+          first = q->sector;
+        }
+      cnt += q->cnt;
+    }
+
+  *sectorp = first;
+  return cnt;
+}
+
+/* Marks request Q, which was carried out on behalf of request
+   R, done, and wakes up whoever waits for it. */
+static void
+finish_request (struct block_request *q, struct block_request *r)
+{
+  if (q->async)
+    block_complete (q);
+  else
+    {
+      q->done = true;
+      if (q != r)
+        sema_up (&q->sema);
+    }
+}
+
+/* Gives C, which is busy, to the request the elevator picks
+   next, or makes C idle if no request is waiting.  C's lock must
+   be held. */
+static void
+hand_off (struct channel *c)
+{
+  struct block_request *next;
+
+  ASSERT (c->busy);
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  if (list_empty (&c->queue))
+    {
+      c->busy = false;
+      return;
+    }
+
+  next = pick_request (c);
+  dequeue (c, next);
+  if (next->async)
+    {
+      c->worker_request = next;
+      sema_up (&c->worker_go);
+    }
+  else
+    sema_up (&next->sema);
+}
+
+/* Runs request R on its channel, merging adjacent queued
+   requests into the same command, then hands the channel to the
+   next request, if any.  R belongs to the current thread, or is
+   asynchronous and the current thread is the channel's worker.
+   The channel must be busy on R's behalf and its lock must be
+   held; the lock is released during the transfer. */
+static void
+run_request (struct block_request *r)
+{
+  struct ata_disk *d = r->aux;
+  struct channel *c = d->channel;
+  struct list batch;
+  block_sector_t sec_no;
+  uint64_t pos;
+  uint32_t size;
+  size_t cnt;
+
+  ASSERT (c->busy);
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  if (r->cnt == 0)
+    {
+      lock_release (&c->lock);
+      flush_cache (d);
+      lock_acquire (&c->lock);
+      finish_request (r, r);
+      hand_off (c);
+      return;
+    }
+
+  list_init (&batch);
+  list_push_back (&batch, &r->elem);
+  cnt = merge_requests (c, &batch, r, &sec_no);
+  pos = disk_pos (r) - r->sector + sec_no;
+  size = cnt | (r->read ? 0 : TRACE_IO_WRITE);
+  c->head = pos + cnt;
+  lock_release (&c->lock);
+
+  trace (TRACE_IO, TRACE_IO_ISSUE, pos, size);
+
+  if (!d->use_dma || !dma_transfer (d, &batch, sec_no, cnt, r->read))
+    {
+      if (r->read)
+        pio_read (d, &batch, sec_no, cnt);
+      else
+        pio_write (d, &batch, sec_no, cnt);
+    }
+  trace (TRACE_IO, TRACE_IO_DONE, pos, size);
+
+  lock_acquire (&c->lock);
+  while (!list_empty (&batch))
+    finish_request (list_entry (list_pop_front (&batch),
+                                struct block_request, elem), r);
+  hand_off (c);
+}
+
+/* Transfers the CNT sectors starting at SEC_NO of disk D, at
+   most MAX_TRANSFER, into BUFFER if READ is true or from BUFFER
+   otherwise, waiting in the channel's queue if the channel is
+   busy.  A CNT of 0 flushes the disk's write cache instead. */
+static void
+submit_request (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+                uint8_t *buffer, bool read)
+{
+  struct channel *c = d->channel;
+  struct block_request r;
+
+  ASSERT (cnt <= MAX_TRANSFER);
+
+  r.block = NULL;
+  r.disk = NULL;
+  r.aux = d;
+  r.sector = sec_no;
+  r.cnt = cnt;
+  r.buffer = buffer;
+  r.read = read;
+  r.async = false;
+  r.priority = thread_get_priority ();
+  r.time = timer_ticks ();
+  r.done = false;
+  sema_init (&r.sema, 0);
+
+  lock_acquire (&c->lock);
+  if (c->busy)
+    {
+      /* Sleep until another thread's transfer included R or the
+         channel was handed to R. */
+      enqueue (c, &r);
+      lock_release (&c->lock);
+      sema_down (&r.sema);
+      lock_acquire (&c->lock);
+    }
+  else
+    c->busy = true;
+  if (!r.done)
+    run_request (&r);
+  lock_release (&c->lock);
+}
+
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes.  Each
+   run of up to MAX_TRANSFER sectors takes a single request.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                   void *buffer_)
+{
+  struct ata_disk *d = d_;
+  uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_TRANSFER ? cnt : MAX_TRANSFER;
+
+      submit_request (d, sec_no, n, buffer, true);
+      sec_no += n;
+      cnt -= n;
+      buffer += n * BLOCK_SECTOR_SIZE;
+    }
+}
+
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes.  Returns
+   after the disk has acknowledged receiving the data.  Each run
+   of up to MAX_TRANSFER sectors takes a single request.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                    const void *buffer_)
+{
+  struct ata_disk *d = d_;
+  const uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_TRANSFER ? cnt : MAX_TRANSFER;
+
+      submit_request (d, sec_no, n, (uint8_t *) buffer, false);
+      sec_no += n;
+      cnt -= n;
+      buffer += n * BLOCK_SECTOR_SIZE;
+    }
+}
+
 /* Reads sector SEC_NO from disk D into BUFFER, which must have
    room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to disks, so external
@@ -344,16 +1072,7 @@ descramble_ata_string (char *string, int size)
 static void
 ide_read (void *d_, block_sector_t sec_no, void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  ide_read_multiple (d_, sec_no, 1, buffer);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -363,46 +1082,126 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
    per-disk locking is unneeded. */
 static void
 ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multiple (d_, sec_no, 1, buffer);
+}
+
+/* Queues request R for disk D and returns without waiting for
+   it.  R is carried out by the channel's worker thread, or
+   merged into another request.  A request for more than
+   MAX_TRANSFER sectors is carried out before returning. */
+static void
+ide_submit (void *d_, struct block_request *r)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+
+  if (r->cnt > MAX_TRANSFER)
+    {
+      if (r->read)
+        ide_read_multiple (d, r->sector, r->cnt, r->buffer);
+      else
+        ide_write_multiple (d, r->sector, r->cnt, r->buffer);
+      block_complete (r);
+      return;
+    }
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  if (c->busy)
+    enqueue (c, r);
+  else
+    {
+      c->busy = true;
+      c->worker_request = r;
+      sema_up (&c->worker_go);
+    }
   lock_release (&c->lock);
 }
 
+/* Worker thread for channel C_, which drives C_ for the
+   asynchronous requests handed to it. */
+static void
+worker_thread (void *c_)
+{
+  struct channel *c = c_;
+
+  for (;;)
+    {
+      sema_down (&c->worker_go);
+      lock_acquire (&c->lock);
+      run_request (c->worker_request);
+      lock_release (&c->lock);
+    }
+}
+
+/* Returns once disk D has written the contents of its write
+   cache to the medium.  Waits its turn in the channel's queue
+   like a transfer. */
+static void
+ide_flush (void *d_)
+{
+  struct ata_disk *d = d_;
+
+  if (d->write_cache)
+    submit_request (d, 0, 0, NULL, false);
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple,
+    ide_submit,
+    ide_flush
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
-static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+   writes SEC_NO and the number of sectors CNT, from 1 to 256, to
+   the disk's sector selection registers.  (We use LBA mode.)
+   Returns true if the transfer needs 48-bit addressing, in which
+   case the caller must issue an EXT command, false if a 28-bit
+   command will do.
+
+   In 48-bit mode each register is a two-byte FIFO: the first
+   write supplies the high-order byte and the second the
+   low-order one. */
+static bool
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
-  ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= 256);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  if (sec_no > LBA28_SECTORS - cnt)
+    {
+      ASSERT (d->lba48);
+      outb (reg_nsect (c), cnt >> 8);
+      outb (reg_lbal (c), sec_no >> 24);
+      outb (reg_lbam (c), 0);
+      outb (reg_lbah (c), 0);
+      outb (reg_nsect (c), cnt & 0xff);
+      outb (reg_lbal (c), sec_no);
+      outb (reg_lbam (c), sec_no >> 8);
+      outb (reg_lbah (c), sec_no >> 16);
+      outb (reg_device (c),
+            DEV_MBS | DEV_LBA | (d->dev_no == 1 ? DEV_DEV : 0));
+      return true;
+    }
+
+  outb (reg_nsect (c), cnt & 0xff);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
   outb (reg_device (c),
         DEV_MBS | DEV_LBA | (d->dev_no == 1 ? DEV_DEV : 0) | (sec_no >> 24));
+  return false;
 }
 
 /* Writes COMMAND to channel C and prepares for receiving a
-   completion interrupt. */
+   completion interrupt.  Also used for the DMA commands, which
+   complete the same way. */
 static void
 issue_pio_command (struct channel *c, uint8_t command) 
 {
@@ -430,6 +1229,90 @@ output_sector (struct channel *c, const void *sector)
   outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
 }
 
+/* Has disk D write its write cache to the medium, sleeping until
+   it interrupts.  Panics on a disk error, like the transfers. */
+static void
+flush_cache (struct ata_disk *d)
+{
+  struct channel *c = d->channel;
+
+  select_device_wait (d);
+  issue_pio_command (c, d->lba48 ? CMD_FLUSH_CACHE_EXT : CMD_FLUSH_CACHE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if (inb (reg_status (c)) & STA_ERR)
+    PANIC ("%s: cache flush failed", d->name);
+}
+
+/* Transfers the CNT sectors starting at SEC_NO of disk D by DMA,
+   into the buffers of the requests in BATCH if READ is true or
+   from them otherwise, sleeping until the controller interrupts.
+   The requests must cover the sectors in order.
+   Returns false without doing anything if the controller cannot
+   reach one of the buffers, in which case the caller should use
+   PIO.  Panics on a disk error, like the PIO paths. */
+static bool
+dma_transfer (struct ata_disk *d, struct list *batch, block_sector_t sec_no,
+              size_t cnt, bool read)
+{
+  struct channel *c = d->channel;
+  uint8_t direction = read ? BM_CMD_READ : 0;
+  struct list_elem *e;
+  int i = 0;
+
+  for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (!is_kernel_vaddr (r->buffer) || ((uintptr_t) r->buffer & 1) != 0)
+        return false;
+    }
+
+  /* Describe the buffers, each of which is physically contiguous
+     like all kernel memory, splitting them at 64 kB boundaries.
+     A size of 0 in a descriptor stands for 64 kB. */
+  for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      uintptr_t phys = vtop (r->buffer);
+      size_t left = r->cnt * BLOCK_SECTOR_SIZE;
+
+      while (left > 0)
+        {
+          size_t size = 0x10000 - (phys & 0xffff);
+          if (size > left)
+            size = left;
+
+          ASSERT (i < PRD_CNT);
+          c->prdt[i].addr = phys;
+          c->prdt[i].size = size & 0xffff;
+          c->prdt[i].flags = 0;
+          i++;
+          phys += size;
+          left -= size;
+        }
+    }
+  c->prdt[i - 1].flags = PRD_EOT;
+
+  /* Program the bus master, clearing stale status, then start
+     the command and the transfer. */
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c), BM_STA_ERROR | BM_STA_INTR);
+  if (select_sector (d, sec_no, cnt))
+    issue_pio_command (c, read ? CMD_READ_DMA_EXT : CMD_WRITE_DMA_EXT);
+  else
+    issue_pio_command (c, read ? CMD_READ_DMA : CMD_WRITE_DMA);
+  outb (reg_bm_command (c), direction | BM_CMD_START);
+
+  sema_down (&c->completion_wait);
+  outb (reg_bm_command (c), direction);
+
+  if ((c->bm_status & BM_STA_ERROR) || (inb (reg_status (c)) & STA_ERR))
+    PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+           d->name, read ? "read" : "write", sec_no);
+  return true;
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
@@ -452,17 +1335,17 @@ wait_until_idle (const struct ata_disk *d)
   printf ("%s: idle timeout\n", d->name);
 }
 
-/* Wait up to 30 seconds for disk D to clear BSY,
-   and then return the status of the DRQ bit.
+/* Wait up to ide_timeout_ms, 30 seconds by default, for disk D
+   to clear BSY, and then return the status of the DRQ bit.
    The ATA standards say that a disk may take as long as that to
    complete its reset. */
 static bool
 wait_while_busy (const struct ata_disk *d) 
 {
   struct channel *c = d->channel;
-  int i;
+  unsigned i;
   
-  for (i = 0; i < 3000; i++)
+  for (i = 0; i < ide_timeout_ms / 10; i++)
     {
       if (i == 700)
         printf ("%s: busy, waiting...", d->name);
@@ -514,6 +1397,12 @@ interrupt_handler (struct intr_frame *f)
         if (c->expecting_interrupt) 
           {
             inb (reg_status (c));               /* Acknowledge interrupt. */
+            if (c->bm_base != 0)
+              {
+                /* Record and acknowledge bus master status. */
+                c->bm_status = inb (reg_bm_status (c));
+                outb (reg_bm_status (c), BM_STA_INTR);
+              }
             sema_up (&c->completion_wait);      /* Wake up waiter. */
           }
         else
@@ -1,6 +1,14 @@
 #ifndef DEVICES_IDE_H
 #define DEVICES_IDE_H
 
+#include <stdbool.h>
+
+/* -ide-timeout: Longest wait for a busy disk, in milliseconds. */
+extern unsigned ide_timeout_ms;
+
+/* -ide-large: Use disks of 1 GB or more? */
+extern bool ide_large_disks;
+
 void ide_init (void);
 
 #endif /* devices/ide.h */
@@ -1,16 +1,49 @@
 #include "devices/input.h"
 #include <debug.h>
+#include <stdio.h>
+#include <string.h>
 #include "devices/intq.h"
 #include "devices/serial.h"
+#include "threads/synch.h"
 
 /* Stores keys from the keyboard and serial port. */
 static struct intq buffer;
+static uint8_t buffer_data[INTQ_BUFSIZE];
+
+/* If true, input_read() reads a line at a time, echoing keys as
+   they are typed and letting the user edit the line, as a
+   terminal in canonical mode does.  If false, it returns keys
+   exactly as they arrive. */
+bool input_canonical;
+
+/* Editing keys in canonical mode. */
+#define KEY_EOF 0x04            /* Ctrl+D: end the line as is. */
+#define KEY_BS 0x08             /* Backspace: erase a key. */
+#define KEY_KILL 0x15           /* Ctrl+U: erase the line. */
+#define KEY_DEL 0x7f            /* Delete: same as backspace. */
+
+/* Longest line in canonical mode.  A line that reaches this
+   length ends there. */
+#define LINE_MAX 256
+
+/* Line being typed, or read, in canonical mode. */
+static uint8_t line[LINE_MAX];
+static size_t line_len;         /* Bytes in LINE. */
+static size_t line_ofs;         /* Bytes already read from LINE. */
+static bool line_done;          /* Line ended, being read? */
+
+/* Serializes readers in input_read(). */
+static struct lock read_lock;
+
+static size_t read_raw (uint8_t *, size_t);
+static size_t read_line (uint8_t *, size_t);
 
 /* Initializes the input buffer. */
 void
 input_init (void) 
 {
-  intq_init (&buffer);
+  intq_init (&buffer, buffer_data, sizeof buffer_data);
+  lock_init_named (&read_lock, "input");
 }
 
 /* Adds a key to the input buffer.
@@ -41,6 +74,24 @@ input_getc (void)
   return key;
 }
 
+/* Reads up to SIZE bytes of input into BUF and returns the
+   number read, waiting only until there is some input to read,
+   not until there are SIZE bytes.  Reads a line at a time, with
+   echo and editing, if input_canonical is true; in that case,
+   returns 0 if the user ends an empty line with Ctrl+D. */
+size_t
+input_read (uint8_t *buf, size_t size) 
+{
+  size_t n;
+
+  if (size == 0)
+    return 0;
+  lock_acquire (&read_lock);
+  n = input_canonical ? read_line (buf, size) : read_raw (buf, size);
+  lock_release (&read_lock);
+  return n;
+}
+
 /* Returns true if the input buffer is full,
    false otherwise.
    Interrupts must be off. */
@@ -50,3 +101,81 @@ input_full (void)
   ASSERT (intr_get_level () == INTR_OFF);
   return intq_full (&buffer);
 }
+
+/* Waits for a key and then reads it and up to SIZE - 1 more of
+   the keys already in the input buffer into BUF.  Returns the
+   number of keys read. */
+static size_t
+read_raw (uint8_t *buf, size_t size) 
+{
+  enum intr_level old_level;
+  size_t n;
+
+  old_level = intr_disable ();
+  buf[0] = intq_getc (&buffer);
+  n = 1 + intq_getn (&buffer, buf + 1, size - 1);
+  serial_notify ();
+  intr_set_level (old_level);
+  return n;
+}
+
+/* Reads up to SIZE bytes of the current line into BUF, first
+   waiting for the user to type it, if necessary, with echo and
+   editing.  Returns the number of bytes read. */
+static size_t
+read_line (uint8_t *buf, size_t size) 
+{
+  size_t n;
+
+  while (!line_done) 
+    {
+      uint8_t key = input_getc ();
+
+      switch (key) 
+        {
+        case '\r':
+        case '\n':
+          line[line_len++] = '\n';
+          putchar ('\n');
+          line_done = true;
+          break;
+
+        case KEY_EOF:
+          line_done = true;
+          break;
+
+        case KEY_BS:
+        case KEY_DEL:
+          if (line_len > 0)
+            {
+              line_len--;
+              printf ("\b \b");
+            }
+          break;
+
+        case KEY_KILL:
+          for (; line_len > 0; line_len--)
+            printf ("\b \b");
+          break;
+
+        default:
+          line[line_len++] = key;
+          putchar (key);
+          if (line_len == LINE_MAX)
+            line_done = true;
+          break;
+        }
+    }
+
+  n = line_len - line_ofs;
+  if (n > size)
+    n = size;
+  memcpy (buf, line + line_ofs, n);
+  line_ofs += n;
+  if (line_ofs == line_len)
+    {
+      line_len = line_ofs = 0;
+      line_done = false;
+    }
+  return n;
+}
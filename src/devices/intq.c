@@ -2,33 +2,35 @@
 #include <debug.h>
 #include "threads/thread.h"
 
-static int next (int pos);
 static void wait (struct intq *q, struct thread **waiter);
 static void signal (struct intq *q, struct thread **waiter);
 
-/* Initializes interrupt queue Q. */
+/* Initializes interrupt queue Q to hold its data in the SIZE
+   bytes at BUF, which must outlive Q.  SIZE must be a power of 2,
+   and Q can hold SIZE bytes at once. */
 void
-intq_init (struct intq *q) 
+intq_init (struct intq *q, uint8_t *buf, int size) 
 {
-  lock_init (&q->lock);
+  ASSERT (buf != NULL);
+  ASSERT (size > 1);
+
+  lock_init_named (&q->lock, "intq");
   q->not_full = q->not_empty = NULL;
-  q->head = q->tail = 0;
+  ring_init (&q->ring, buf, 1, size);
 }
 
 /* Returns true if Q is empty, false otherwise. */
 bool
 intq_empty (const struct intq *q) 
 {
-  ASSERT (intr_get_level () == INTR_OFF);
-  return q->head == q->tail;
+  return ring_empty (&q->ring);
 }
 
 /* Returns true if Q is full, false otherwise. */
 bool
 intq_full (const struct intq *q) 
 {
-  ASSERT (intr_get_level () == INTR_OFF);
-  return next (q->head) == q->tail;
+  return ring_full (&q->ring);
 }
 
 /* Removes a byte from Q and returns it.
@@ -39,17 +41,19 @@ intq_getc (struct intq *q)
 {
   uint8_t byte;
   
-  ASSERT (intr_get_level () == INTR_OFF);
-  while (intq_empty (q)) 
+  while (ring_pop (&q->ring, &byte, 1) == 0) 
     {
+      enum intr_level old_level;
+
       ASSERT (!intr_context ());
       lock_acquire (&q->lock);
-      wait (q, &q->not_empty);
+      old_level = intr_disable ();
+      if (intq_empty (q))
+        wait (q, &q->not_empty);
+      intr_set_level (old_level);
       lock_release (&q->lock);
     }
   
-  byte = q->buf[q->tail];
-  q->tail = next (q->tail);
   signal (q, &q->not_full);
   return byte;
 }
@@ -60,29 +64,37 @@ intq_getc (struct intq *q)
 void
 intq_putc (struct intq *q, uint8_t byte) 
 {
-  ASSERT (intr_get_level () == INTR_OFF);
-  while (intq_full (q))
+  while (ring_push (&q->ring, &byte, 1) == 0)
     {
+      enum intr_level old_level;
+
       ASSERT (!intr_context ());
       lock_acquire (&q->lock);
-      wait (q, &q->not_full);
+      old_level = intr_disable ();
+      if (intq_full (q))
+        wait (q, &q->not_full);
+      intr_set_level (old_level);
       lock_release (&q->lock);
     }
 
-  q->buf[q->head] = byte;
-  q->head = next (q->head);
   signal (q, &q->not_empty);
 }
-
-/* Returns the position after POS within an intq. */
-static int
-next (int pos) 
+
+/* Removes up to MAX bytes from Q, as many as it holds, into BUF,
+   without sleeping.  Returns the number of bytes removed. */
+size_t
+intq_getn (struct intq *q, uint8_t *buf, size_t max) 
 {
-  return (pos + 1) % INTQ_BUFSIZE;
-}
+  size_t cnt = ring_pop (&q->ring, buf, max);
 
+  if (cnt > 0)
+    signal (q, &q->not_full);
+  return cnt;
+}
+
 /* WAITER must be the address of Q's not_empty or not_full
-   member.  Waits until the given condition is true. */
+   member.  Waits until the given condition is true.  Interrupts
+   must be off. */
 static void
 wait (struct intq *q UNUSED, struct thread **waiter) 
 {
@@ -98,17 +110,19 @@ wait (struct intq *q UNUSED, struct thread **waiter)
 /* WAITER must be the address of Q's not_empty or not_full
    member, and the associated condition must be true.  If a
    thread is waiting for the condition, wakes it up and resets
-   the waiting thread. */
+   the waiting thread.  Turns interrupts off only if there is a
+   waiter, which cannot start waiting once the condition holds. */
 static void
 signal (struct intq *q UNUSED, struct thread **waiter) 
 {
-  ASSERT (intr_get_level () == INTR_OFF);
-  ASSERT ((waiter == &q->not_empty && !intq_empty (q))
-          || (waiter == &q->not_full && !intq_full (q)));
-
-  if (*waiter != NULL) 
+  if (*(struct thread *volatile *) waiter != NULL) 
     {
-      thread_unblock (*waiter);
-      *waiter = NULL;
+      enum intr_level old_level = intr_disable ();
+      if (*waiter != NULL)
+        {
+          thread_unblock (*waiter);
+          *waiter = NULL;
+        }
+      intr_set_level (old_level);
     }
 }
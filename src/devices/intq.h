@@ -1,15 +1,21 @@
 #ifndef DEVICES_INTQ_H
 #define DEVICES_INTQ_H
 
+#include <ring.h>
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 
 /* An "interrupt queue", a circular buffer shared between
    kernel threads and external interrupt handlers.
 
-   Interrupt queue functions can be called from kernel threads or
-   from external interrupt handlers.  Except for intq_init(),
-   interrupts must be off in either case.
+   The bytes themselves are kept in a single-producer,
+   single-consumer ring from lib/kernel/ring.h, so adding or
+   removing a byte needs no interrupt masking as long as one
+   context adds bytes and one removes them.  Callers that share
+   an end of the queue among several threads keep them apart by
+   turning interrupts off, as the serial and input drivers do.
+   The queue itself turns interrupts off only to sleep until it
+   is no longer empty or full, and to wake a thread so sleeping.
 
    The interrupt queue has the structure of a "monitor".  Locks
    and condition variables from threads/synch.h cannot be used in
@@ -17,8 +23,9 @@
    protect kernel threads from one another, not from interrupt
    handlers. */
 
-/* Queue buffer size, in bytes. */
-#define INTQ_BUFSIZE 64
+/* Default queue buffer size, in bytes.  A queue's size may be
+   any power of 2. */
+#define INTQ_BUFSIZE 256
 
 /* A circular queue of bytes. */
 struct intq
@@ -29,15 +36,14 @@ struct intq
     struct thread *not_empty;   /* Thread waiting for not-empty condition. */
 
     /* Queue. */
-    uint8_t buf[INTQ_BUFSIZE];  /* Buffer. */
-    int head;                   /* New data is written here. */
-    int tail;                   /* Old data is read here. */
+    struct ring ring;           /* Bytes in the queue. */
   };
 
-void intq_init (struct intq *);
+void intq_init (struct intq *, uint8_t *buf, int size);
 bool intq_empty (const struct intq *);
 bool intq_full (const struct intq *);
 uint8_t intq_getc (struct intq *);
 void intq_putc (struct intq *, uint8_t);
+size_t intq_getn (struct intq *, uint8_t *buf, size_t max);
 
 #endif /* devices/intq.h */
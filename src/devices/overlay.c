@@ -0,0 +1,215 @@
+#include "devices/overlay.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/stats.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Copy-on-write overlay of the file system device.
+
+   With the -overlay kernel option, overlay_init() puts a block
+   device named "overlay" in front of the device chosen for the
+   file system role and casts it in that role instead.  The
+   overlay reads through to the device underneath, its base,
+   until a sector is written; the write goes to a copy of the
+   sector's page, in memory from the user pool, and later reads
+   of the page come from the copy.  The base is never written, so
+   any number of runs can start from the same pre-populated disk
+   image, as quickly as from a pristine one, and all their
+   changes vanish at power off.
+
+   Copies are kept a page, SECTORS_PER_PAGE sectors, at a time.
+   The first write to a page that does not cover all of it reads
+   the rest from the base.  The copies are found through a
+   two-level table, whose top level has an entry for each
+   LEAF_CNT pages of the device and whose leaves, a page each,
+   are allocated only for the parts of the device that have been
+   written, so that a large, mostly unchanged disk costs little
+   memory.
+
+   There is nowhere for a write to go once memory runs out, so
+   the kernel panics then. */
+
+/* Sectors in a page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Entries in a leaf of the table. */
+#define LEAF_CNT (PGSIZE / sizeof (uint8_t *))
+
+/* -overlay: Keep file system writes in memory? */
+bool overlay_filesys;
+
+/* The overlay. */
+static struct block *base;      /* Device underneath. */
+static block_sector_t base_size; /* Its size in sectors. */
+static struct lock overlay_lock; /* Protects the table and copies. */
+static uint8_t ***leaves;       /* Top level of the table. */
+static struct stats_counter copy_cnt;   /* Pages copied. */
+
+static const struct block_operations overlay_operations;
+
+/* If -overlay was given, registers the overlay of the file
+   system device and makes it the file system device.  Must be
+   called after the file system device is located. */
+void
+overlay_init (void)
+{
+  size_t leaf_cnt;
+  char info[32];
+  struct block *overlay;
+
+  if (!overlay_filesys)
+    return;
+  base = block_get_role (BLOCK_FILESYS);
+  if (base == NULL)
+    PANIC ("-overlay: no file system device");
+  base_size = block_size (base);
+
+  lock_init_named (&overlay_lock, "overlay");
+  leaf_cnt = DIV_ROUND_UP (DIV_ROUND_UP (base_size, SECTORS_PER_PAGE),
+                           LEAF_CNT);
+  leaves = calloc (leaf_cnt, sizeof *leaves);
+  if (leaves == NULL)
+    PANIC ("-overlay: out of memory");
+  stats_register (&copy_cnt, "overlay", "pages", STATS_GAUGE);
+
+  snprintf (info, sizeof info, "copy-on-write over %s", block_name (base));
+  overlay = block_register ("overlay", BLOCK_FILESYS, info, base_size,
+                            &overlay_operations, NULL);
+  printf ("%s: using %s\n", block_type_name (BLOCK_FILESYS),
+          block_name (overlay));
+  block_set_role (BLOCK_FILESYS, overlay);
+}
+
+/* Returns the slot in the table for the copy of the page that
+   holds SECTOR, or a null pointer if there is none and CREATE is
+   false. */
+static uint8_t **
+copy_slot (block_sector_t sector, bool create)
+{
+  size_t page = sector / SECTORS_PER_PAGE;
+  uint8_t ***leaf = &leaves[page / LEAF_CNT];
+
+  if (*leaf == NULL)
+    {
+      if (!create)
+        return NULL;
+      *leaf = palloc_get_page (PAL_ZERO);
+      if (*leaf == NULL)
+        PANIC ("overlay: out of memory for table");
+    }
+  return &(*leaf)[page % LEAF_CNT];
+}
+
+/* Returns the copy of the page that holds SECTOR, or a null
+   pointer if it has not been written. */
+static uint8_t *
+get_copy (block_sector_t sector)
+{
+  uint8_t **slot = copy_slot (sector, false);
+  return slot != NULL ? *slot : NULL;
+}
+
+/* Reads CNT sectors starting at SECTOR into BUFFER, from the
+   copies where there are any and otherwise from the base, in as
+   few requests to the base as the copies allow. */
+static void
+overlay_read_multiple (void *aux UNUSED, block_sector_t sector, size_t cnt,
+                       void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+
+  lock_acquire (&overlay_lock);
+  while (cnt > 0)
+    {
+      size_t ofs = sector % SECTORS_PER_PAGE;
+      size_t chunk = SECTORS_PER_PAGE - ofs;
+      uint8_t *copy = get_copy (sector);
+
+      if (chunk > cnt)
+        chunk = cnt;
+      if (copy != NULL)
+        memcpy (buffer, copy + ofs * BLOCK_SECTOR_SIZE,
+                chunk * BLOCK_SECTOR_SIZE);
+      else
+        {
+          /* Take in the following pages too, up to a copy. */
+          while (chunk < cnt && get_copy (sector + chunk) == NULL)
+            chunk += (cnt - chunk < SECTORS_PER_PAGE
+                      ? cnt - chunk : SECTORS_PER_PAGE);
+          block_read_multiple (base, sector, chunk, buffer);
+        }
+      buffer += chunk * BLOCK_SECTOR_SIZE;
+      sector += chunk;
+      cnt -= chunk;
+    }
+  lock_release (&overlay_lock);
+}
+
+/* Writes CNT sectors from BUFFER starting at SECTOR, into copies
+   of their pages, making a copy of each page that has none. */
+static void
+overlay_write_multiple (void *aux UNUSED, block_sector_t sector, size_t cnt,
+                        const void *buffer_)
+{
+  const uint8_t *buffer = buffer_;
+
+  lock_acquire (&overlay_lock);
+  while (cnt > 0)
+    {
+      size_t ofs = sector % SECTORS_PER_PAGE;
+      size_t chunk = SECTORS_PER_PAGE - ofs;
+      uint8_t **slot = copy_slot (sector, true);
+
+      if (chunk > cnt)
+        chunk = cnt;
+      if (*slot == NULL)
+        {
+          block_sector_t first = sector - ofs;
+          size_t page_sectors = (base_size - first < SECTORS_PER_PAGE
+                                 ? base_size - first : SECTORS_PER_PAGE);
+          uint8_t *copy = palloc_get_page (PAL_USER);
+
+          if (copy == NULL)
+            PANIC ("overlay: out of memory after %zu pages",
+                   (size_t) stats_get (&copy_cnt));
+          if (chunk < page_sectors)
+            block_read_multiple (base, first, page_sectors, copy);
+          *slot = copy;
+          stats_inc (&copy_cnt);
+        }
+      memcpy (*slot + ofs * BLOCK_SECTOR_SIZE, buffer,
+              chunk * BLOCK_SECTOR_SIZE);
+      buffer += chunk * BLOCK_SECTOR_SIZE;
+      sector += chunk;
+      cnt -= chunk;
+    }
+  lock_release (&overlay_lock);
+}
+
+static void
+overlay_read (void *aux, block_sector_t sector, void *buffer)
+{
+  overlay_read_multiple (aux, sector, 1, buffer);
+}
+
+static void
+overlay_write (void *aux, block_sector_t sector, const void *buffer)
+{
+  overlay_write_multiple (aux, sector, 1, buffer);
+}
+
+static const struct block_operations overlay_operations =
+  {
+    overlay_read,
+    overlay_write,
+    overlay_read_multiple,
+    overlay_write_multiple,
+    NULL,
+    NULL,
+  };
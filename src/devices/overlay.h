@@ -0,0 +1,14 @@
+#ifndef DEVICES_OVERLAY_H
+#define DEVICES_OVERLAY_H
+
+#include <stdbool.h>
+
+/* Copy-on-write overlay of the file system device.  See
+   overlay.c for details. */
+
+/* -overlay: Keep file system writes in memory? */
+extern bool overlay_filesys;
+
+void overlay_init (void);
+
+#endif /* devices/overlay.h */
@@ -0,0 +1,25 @@
+#include "devices/pci.h"
+#include "threads/io.h"
+
+/* PCI configuration space access ports. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Returns the 32-bit register at byte offset REG in the PCI
+   configuration space of function FUNC of device DEV on bus 0. */
+uint32_t
+pci_read_config (int dev, int func, int reg)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Sets the 32-bit register at byte offset REG in the PCI
+   configuration space of function FUNC of device DEV on bus 0 to
+   VALUE. */
+void
+pci_write_config (int dev, int func, int reg, uint32_t value)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  outl (PCI_CONFIG_DATA, value);
+}
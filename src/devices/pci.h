@@ -0,0 +1,22 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdint.h>
+
+/* PCI configuration space access, for bus 0 only. */
+
+/* Configuration space registers, as byte offsets. */
+#define PCI_REG_ID 0x00         /* Vendor ID, then device ID. */
+#define PCI_REG_COMMAND 0x04    /* Command (low half). */
+#define PCI_REG_CLASS 0x08      /* Revision, interface, class. */
+#define PCI_REG_BAR0 0x10       /* First base address register. */
+#define PCI_REG_IRQ 0x3c        /* Interrupt line (low byte). */
+
+/* Command register bits. */
+#define PCI_CMD_IO 0x1          /* Respond to I/O space accesses. */
+#define PCI_CMD_MASTER 0x4      /* May be a bus master. */
+
+uint32_t pci_read_config (int dev, int func, int reg);
+void pci_write_config (int dev, int func, int reg, uint32_t value);
+
+#endif /* devices/pci.h */
@@ -11,9 +11,6 @@
 #define PIT_PORT_CONTROL          0x43                /* Control port. */
 #define PIT_PORT_COUNTER(CHANNEL) (0x40 + (CHANNEL))  /* Counter port. */
 
-/* PIT cycles per second. */
-#define PIT_HZ 1193180
-
 /* Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
 
@@ -45,12 +42,19 @@
 void
 pit_configure_channel (int channel, int mode, int frequency)
 {
-  uint16_t count;
-  enum intr_level old_level;
-
-  ASSERT (channel == 0 || channel == 2);
   ASSERT (mode == 2 || mode == 3);
 
+  pit_configure_channel_count (channel, mode,
+                               pit_frequency_to_count (frequency));
+}
+
+/* Returns the PIT counter value that yields FREQUENCY periods
+   per second, where 0 stands for the maximum count of 65536. */
+uint16_t
+pit_frequency_to_count (int frequency)
+{
+  uint16_t count;
+
   /* Convert FREQUENCY to a PIT counter value.  The PIT has a
      clock that runs at PIT_HZ cycles per second.  We must
      translate FREQUENCY into a number of these cycles. */
@@ -73,6 +77,21 @@ pit_configure_channel (int channel, int mode, int frequency)
     }
   else
     count = (PIT_HZ + frequency / 2) / frequency;
+  return count;
+}
+
+/* Configures CHANNEL in MODE, as for pit_configure_channel(),
+   but with the raw counter value COUNT, where 0 stands for
+   65536.  Channel 0 in mode 2 with a count of several timer
+   periods lets the timer skip ticks while the CPU is idle. */
+void
+pit_configure_channel_count (int channel, int mode, uint16_t count)
+{
+  enum intr_level old_level;
+
+  ASSERT (channel == 0 || channel == 2);
+  ASSERT (mode == 2 || mode == 3);
+  ASSERT (count != 1);
 
   /* Configure the PIT mode and load its counters. */
   old_level = intr_disable ();
@@ -81,3 +100,23 @@ pit_configure_channel (int channel, int mode, int frequency)
   outb (PIT_PORT_COUNTER (channel), count >> 8);
   intr_set_level (old_level);
 }
+
+/* Returns the current value of CHANNEL's down-counter, latched
+   so that both bytes come from the same instant.  A reading of
+   0 stands for 65536. */
+unsigned
+pit_read_count (int channel)
+{
+  enum intr_level old_level;
+  uint8_t low, high;
+
+  ASSERT (channel == 0 || channel == 2);
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, channel << 6);
+  low = inb (PIT_PORT_COUNTER (channel));
+  high = inb (PIT_PORT_COUNTER (channel));
+  intr_set_level (old_level);
+
+  return ((high << 8) | low) != 0 ? (unsigned) ((high << 8) | low) : 65536;
+}
@@ -3,6 +3,12 @@
 
 #include <stdint.h>
 
+/* PIT cycles per second. */
+#define PIT_HZ 1193180
+
 void pit_configure_channel (int channel, int mode, int frequency);
+void pit_configure_channel_count (int channel, int mode, uint16_t count);
+uint16_t pit_frequency_to_count (int frequency);
+unsigned pit_read_count (int channel);
 
 #endif /* devices/pit.h */
@@ -0,0 +1,186 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Block devices backed by memory.
+
+   The -ramdisk=ROLE:KB[,ROLE:KB]... kernel option asks for a
+   RAM disk of KB kB for each given ROLE, "filesys", "scratch" or
+   "swap".  ramdisk_init() registers each one, named
+   "ram-ROLE", ahead of the IDE disks, so that it takes its role
+   unless another device is named for it explicitly.
+
+   A RAM disk is made of zeroed pages from the user pool, which
+   need not be contiguous, so a transfer is a memcpy() per page
+   and never sleeps.  Its contents are lost at power off: a file
+   system on one must be formatted with -f at every boot.  Having
+   no latency at all, a RAM disk also gives a baseline for file
+   system benchmarks. */
+
+/* Sectors in a page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* A RAM disk. */
+struct ramdisk
+  {
+    char name[16];              /* "ram-ROLE". */
+    size_t page_cnt;            /* Number of pages. */
+    uint8_t **pages;            /* PAGE_CNT pages of data. */
+  };
+
+/* RAM disk sizes picked by ramdisk_select(), in kB, indexed by
+   role. */
+static unsigned disk_kb[BLOCK_ROLE_CNT];
+
+static const struct block_operations ramdisk_operations;
+
+/* Picks the comma-separated ROLE:KB pairs in DISKS for
+   ramdisk_init() to create.  Returns false if one of them is
+   not a valid role and size. */
+bool
+ramdisk_select (const char *disks)
+{
+  char buf[64];
+  char *disk, *save_ptr;
+
+  if (disks == NULL)
+    return false;
+  strlcpy (buf, disks, sizeof buf);
+  for (disk = strtok_r (buf, ",", &save_ptr); disk != NULL;
+       disk = strtok_r (NULL, ",", &save_ptr))
+    {
+      char *kb = strchr (disk, ':');
+      enum block_type role;
+
+      if (kb == NULL || atoi (kb + 1) <= 0)
+        return false;
+      *kb++ = '\0';
+      for (role = BLOCK_FILESYS; role < BLOCK_ROLE_CNT; role++)
+        if (!strcmp (disk, block_type_name (role)))
+          break;
+      if (role >= BLOCK_ROLE_CNT)
+        return false;
+      disk_kb[role] = atoi (kb);
+    }
+  return true;
+}
+
+/* Creates a RAM disk of KB kB for ROLE and registers it with the
+   block layer. */
+static void
+create_ramdisk (enum block_type role, unsigned kb)
+{
+  struct ramdisk *d = malloc (sizeof *d);
+  size_t i;
+
+  if (d == NULL)
+    PANIC ("out of memory for RAM disk");
+  snprintf (d->name, sizeof d->name, "ram-%s", block_type_name (role));
+  d->page_cnt = DIV_ROUND_UP ((size_t) kb * 1024, PGSIZE);
+  d->pages = palloc_get_multiple (PAL_ASSERT,
+                                  DIV_ROUND_UP (d->page_cnt
+                                                * sizeof *d->pages,
+                                                PGSIZE));
+  for (i = 0; i < d->page_cnt; i++)
+    {
+      d->pages[i] = palloc_get_page (PAL_USER | PAL_ZERO);
+      if (d->pages[i] == NULL)
+        PANIC ("%s: out of memory after %zu of %zu pages",
+               d->name, i, d->page_cnt);
+    }
+
+  block_register (d->name, role, "RAM disk",
+                  d->page_cnt * SECTORS_PER_PAGE, &ramdisk_operations, d);
+}
+
+/* Creates the RAM disks picked by ramdisk_select().  Must be
+   called after the page allocator is initialized, and before the
+   IDE disks are probed so that the RAM disks come first. */
+void
+ramdisk_init (void)
+{
+  enum block_type role;
+
+  for (role = 0; role < BLOCK_ROLE_CNT; role++)
+    if (disk_kb[role] != 0)
+      create_ramdisk (role, disk_kb[role]);
+}
+
+/* Returns the address of SECTOR in D. */
+static uint8_t *
+sector_addr (const struct ramdisk *d, block_sector_t sector)
+{
+  return (d->pages[sector / SECTORS_PER_PAGE]
+          + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/* Copies CNT sectors starting at SECTOR of RAM disk D_ into
+   BUFFER. */
+static void
+ramdisk_read_multiple (void *d_, block_sector_t sector, size_t cnt,
+                       void *buffer_)
+{
+  const struct ramdisk *d = d_;
+  uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      size_t chunk = SECTORS_PER_PAGE - sector % SECTORS_PER_PAGE;
+      if (chunk > cnt)
+        chunk = cnt;
+      memcpy (buffer, sector_addr (d, sector), chunk * BLOCK_SECTOR_SIZE);
+      buffer += chunk * BLOCK_SECTOR_SIZE;
+      sector += chunk;
+      cnt -= chunk;
+    }
+}
+
+/* Copies CNT sectors from BUFFER to RAM disk D_, starting at
+   SECTOR. */
+static void
+ramdisk_write_multiple (void *d_, block_sector_t sector, size_t cnt,
+                        const void *buffer_)
+{
+  const struct ramdisk *d = d_;
+  const uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      size_t chunk = SECTORS_PER_PAGE - sector % SECTORS_PER_PAGE;
+      if (chunk > cnt)
+        chunk = cnt;
+      memcpy (sector_addr (d, sector), buffer, chunk * BLOCK_SECTOR_SIZE);
+      buffer += chunk * BLOCK_SECTOR_SIZE;
+      sector += chunk;
+      cnt -= chunk;
+    }
+}
+
+static void
+ramdisk_read (void *d, block_sector_t sector, void *buffer)
+{
+  ramdisk_read_multiple (d, sector, 1, buffer);
+}
+
+static void
+ramdisk_write (void *d, block_sector_t sector, const void *buffer)
+{
+  ramdisk_write_multiple (d, sector, 1, buffer);
+}
+
+static const struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    ramdisk_read_multiple,
+    ramdisk_write_multiple,
+    NULL,
+    NULL,
+  };
@@ -0,0 +1,11 @@
+#ifndef DEVICES_RAMDISK_H
+#define DEVICES_RAMDISK_H
+
+#include <stdbool.h>
+
+/* RAM disks.  See ramdisk.c for details. */
+
+bool ramdisk_select (const char *disks);
+void ramdisk_init (void);
+
+#endif /* devices/ramdisk.h */
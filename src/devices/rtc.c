@@ -1,5 +1,6 @@
 #include "devices/rtc.h"
 #include <stdio.h>
+#include "threads/interrupt.h"
 #include "threads/io.h"
 
 /* This code is an interface to the MC146818A-compatible real
@@ -28,14 +29,24 @@
 
 /* Register A. */
 #define RTCSA_UIP	0x80	/* Set while time update in progress. */
+#define RTCSA_RATE	0x0f	/* Periodic interrupt rate select. */
 
 /* Register B. */
 #define	RTCSB_SET	0x80	/* Disables update to let time be set. */
+#define RTCSB_PIE	0x40	/* Periodic interrupt enable. */
 #define RTCSB_DM	0x04	/* 0 = BCD time format, 1 = binary format. */
 #define RTCSB_24HR	0x02    /* 0 = 12-hour format, 1 = 24-hour format. */
 
+/* Frequency of the RTC's time base, in Hz. */
+#define RTC_BASE_HZ 32768u
+
+/* Called by each periodic interrupt. */
+static intr_handler_func *periodic_handler;
+
 static int bcd_to_bin (uint8_t);
 static uint8_t cmos_read (uint8_t index);
+static void cmos_write (uint8_t index, uint8_t);
+static intr_handler_func rtc_interrupt;
 
 /* Returns number of seconds since Unix epoch of January 1,
    1970. */
@@ -95,6 +106,43 @@ rtc_get_time (void)
   return time;
 }
 
+/* Starts the RTC interrupting periodically, at the highest rate
+   it supports, between 2 and 8192 Hz, that is no more than HZ,
+   and has each interrupt call HANDLER.  Returns the rate in
+   Hz. */
+unsigned
+rtc_start_periodic (unsigned hz, intr_handler_func *handler)
+{
+  enum intr_level old_level;
+  int rate;
+
+  /* Rate select R, from 3 to 15, gives RTC_BASE_HZ >> (R - 1). */
+  for (rate = 3; rate < 15 && (RTC_BASE_HZ >> (rate - 1)) > hz; rate++)
+    continue;
+
+  periodic_handler = handler;
+  intr_register_ext (0x28, rtc_interrupt, "RTC");
+
+  /* An interrupt handler that reads CMOS between our selecting a
+     register and reading it would pick another register. */
+  old_level = intr_disable ();
+  cmos_write (RTC_REG_A, (cmos_read (RTC_REG_A) & ~RTCSA_RATE) | rate);
+  cmos_write (RTC_REG_B, cmos_read (RTC_REG_B) | RTCSB_PIE);
+  cmos_read (RTC_REG_C);
+  intr_set_level (old_level);
+
+  return RTC_BASE_HZ >> (rate - 1);
+}
+
+/* RTC interrupt handler.  Reading register C acknowledges the
+   interrupt; the RTC raises no more until it is read. */
+static void
+rtc_interrupt (struct intr_frame *f)
+{
+  cmos_read (RTC_REG_C);
+  periodic_handler (f);
+}
+
 /* Returns the integer value of the given BCD byte. */
 static int
 bcd_to_bin (uint8_t x)
@@ -110,3 +158,11 @@ cmos_read (uint8_t index)
   outb (CMOS_REG_SET, index);
   return inb (CMOS_REG_IO);
 }
+
+/* Writes byte DATA to the CMOS register with the given INDEX. */
+static void
+cmos_write (uint8_t index, uint8_t data)
+{
+  outb (CMOS_REG_SET, index);
+  outb (CMOS_REG_IO, data);
+}
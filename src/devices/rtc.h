@@ -1,8 +1,11 @@
 #ifndef RTC_H
 #define RTC_H
 
+#include "threads/interrupt.h"
+
 typedef unsigned long time_t;
 
 time_t rtc_get_time (void);
+unsigned rtc_start_periodic (unsigned hz, intr_handler_func *);
 
 #endif
@@ -37,6 +37,16 @@
 #define IER_RECV 0x01           /* Interrupt when data received. */
 #define IER_XMIT 0x02           /* Interrupt when transmit finishes. */
 
+/* FIFO Control Register bits. */
+#define FCR_ENABLE 0x01         /* Enable the receive and transmit FIFOs. */
+#define FCR_CLEAR_RECV 0x02     /* Clear the receive FIFO. */
+#define FCR_CLEAR_XMIT 0x04     /* Clear the transmit FIFO. */
+
+/* Size of the 16550A's transmit FIFO, in bytes.  When THRE is set
+   the FIFO is empty, so this many bytes may be written to THR
+   without checking LSR in between. */
+#define XMIT_FIFO_SIZE 16
+
 /* Line Control Register bits. */
 #define LCR_N81 0x03            /* No parity, 8 data bits, 1 stop bit. */
 #define LCR_DLAB 0x80           /* Divisor Latch Access Bit (DLAB). */
@@ -51,11 +61,17 @@
 /* Transmission mode. */
 static enum { UNINIT, POLL, QUEUE } mode;
 
-/* Data to be transmitted. */
+/* Data to be transmitted.  Much larger than the default interrupt
+   queue, so that a burst of console output can be queued without
+   waiting for the port, which at 9.6 kbps drains only about 1,000
+   bytes a second. */
+#define TXQ_BUFSIZE 4096
 static struct intq txq;
+static uint8_t txq_data[TXQ_BUFSIZE];
 
 static void set_serial (int bps);
 static void putc_poll (uint8_t);
+static void putc_queue (uint8_t, enum intr_level);
 static void write_ier (void);
 static intr_handler_func serial_interrupt;
 
@@ -68,10 +84,11 @@ init_poll (void)
 {
   ASSERT (mode == UNINIT);
   outb (IER_REG, 0);                    /* Turn off all interrupts. */
-  outb (FCR_REG, 0);                    /* Disable FIFO. */
+  outb (FCR_REG, FCR_ENABLE | FCR_CLEAR_RECV | FCR_CLEAR_XMIT);
+                                        /* Enable and reset FIFOs. */
   set_serial (9600);                    /* 9.6 kbps, N-8-1. */
   outb (MCR_REG, MCR_OUT2);             /* Required to enable interrupts. */
-  intq_init (&txq);
+  intq_init (&txq, txq_data, sizeof txq_data);
   mode = POLL;
 } 
 
@@ -112,23 +129,39 @@ serial_putc (uint8_t byte)
     {
       /* Otherwise, queue a byte and update the interrupt enable
          register. */
-      if (old_level == INTR_OFF && intq_full (&txq)) 
-        {
-          /* Interrupts are off and the transmit queue is full.
-             If we wanted to wait for the queue to empty,
-             we'd have to reenable interrupts.
-             That's impolite, so we'll send a character via
-             polling instead. */
-          putc_poll (intq_getc (&txq)); 
-        }
-
-      intq_putc (&txq, byte); 
+      putc_queue (byte, old_level);
       write_ier ();
     }
   
   intr_set_level (old_level);
 }
 
+/* Sends the N bytes in BUFFER to the serial port.  Equivalent to
+   calling serial_putc() for each byte, but disables interrupts
+   and updates the interrupt enable register only once for the
+   whole buffer. */
+void
+serial_putbuf (const char *buffer, size_t n) 
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (mode != QUEUE)
+    {
+      if (mode == UNINIT)
+        init_poll ();
+      while (n-- > 0)
+        putc_poll (*buffer++);
+    }
+  else
+    {
+      while (n-- > 0)
+        putc_queue (*buffer++, old_level);
+      write_ier ();
+    }
+
+  intr_set_level (old_level);
+}
+
 /* Flushes anything in the serial buffer out the port in polling
    mode. */
 void
@@ -193,6 +226,38 @@ write_ier (void)
   outb (IER_REG, ier);
 }
 
+/* Adds BYTE to the transmit queue.  OLD_LEVEL is the interrupt
+   level before the caller disabled interrupts.  Interrupts must
+   be off and the port must be in QUEUE mode. */
+static void
+putc_queue (uint8_t byte, enum intr_level old_level) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (mode == QUEUE);
+
+  if (intq_full (&txq)) 
+    {
+      if (old_level == INTR_OFF)
+        {
+          /* Interrupts are off and the transmit queue is full.
+             If we wanted to wait for the queue to empty,
+             we'd have to reenable interrupts.
+             That's impolite, so we'll send a character via
+             polling instead. */
+          putc_poll (intq_getc (&txq)); 
+        }
+      else
+        {
+          /* intq_putc() will sleep until the interrupt handler
+             makes room, so make sure the transmit interrupt is
+             enabled. */
+          write_ier ();
+        }
+    }
+
+  intq_putc (&txq, byte); 
+}
+
 /* Polls the serial port until it's ready,
    and then transmits BYTE. */
 static void
@@ -218,10 +283,17 @@ serial_interrupt (struct intr_frame *f UNUSED)
   while (!input_full () && (inb (LSR_REG) & LSR_DR) != 0)
     input_putc (inb (RBR_REG));
 
-  /* As long as we have a byte to transmit, and the hardware is
-     ready to accept a byte for transmission, transmit a byte. */
-  while (!intq_empty (&txq) && (inb (LSR_REG) & LSR_THRE) != 0) 
-    outb (THR_REG, intq_getc (&txq));
+  /* If the hardware is ready to accept bytes for transmission,
+     its transmit FIFO is empty, so fill it from the queue. */
+  if ((inb (LSR_REG) & LSR_THRE) != 0)
+    {
+      uint8_t buf[XMIT_FIFO_SIZE];
+      size_t cnt = intq_getn (&txq, buf, sizeof buf);
+      size_t i;
+
+      for (i = 0; i < cnt; i++)
+        outb (THR_REG, buf[i]);
+    }
 
   /* Update interrupt enable register based on queue status. */
   write_ier ();
@@ -5,14 +5,23 @@
 #include "devices/serial.h"
 #include "devices/timer.h"
 #include "threads/io.h"
+#include "threads/kmem.h"
+#include "threads/malloc.h"
+#include "threads/stats.h"
+#include "threads/profile.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
-#ifdef USERPROG
-#include "userprog/exception.h"
-#endif
+#include "threads/trace.h"
 #ifdef FILESYS
 #include "devices/block.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/share.h"
+#include "vm/swap.h"
+#endif
 
 /* Keyboard control register port. */
 #define CONTROL_REG 0x64
@@ -57,6 +66,7 @@ void
 shutdown_reboot (void)
 {
   printf ("Rebooting...\n");
+  console_flush ();
 
     /* See [kbd] for details on how to program the keyboard
      * controller. */
@@ -94,9 +104,12 @@ shutdown_power_off (void)
   filesys_done ();
 #endif
 
+  trace_dump ();
+  profile_print ();
   print_stats ();
 
   printf ("Powering off...\n");
+  console_flush ();
   serial_flush ();
 
   /* This is a special power-off sequence supported by Bochs and
@@ -118,13 +131,21 @@ static void
 print_stats (void)
 {
   timer_print_stats ();
+  stats_print ();
   thread_print_stats ();
+#ifdef LOCK_STATS
+  lock_print_stats ();
+#endif
+  kmem_print_stats ();
+  malloc_print_stats ();
+#ifdef VM
+  frame_print_stats ();
+  share_print_stats ();
+  swap_print_stats ();
+#endif
 #ifdef FILESYS
   block_print_stats ();
+  cache_print_stats ();
 #endif
-  console_print_stats ();
   kbd_print_stats ();
-#ifdef USERPROG
-  exception_print_stats ();
-#endif
 }
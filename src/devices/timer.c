@@ -3,19 +3,18 @@
 #include <inttypes.h>
 #include <round.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "devices/pit.h"
 #include "threads/interrupt.h"
+#include "threads/profile.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
   
 /* See [8254] for hardware details of the 8254 timer chip. */
 
-#if TIMER_FREQ < 19
-#error 8254 timer requires TIMER_FREQ >= 19
-#endif
-#if TIMER_FREQ > 1000
-#error TIMER_FREQ <= 1000 recommended
-#endif
+/* Timer interrupts per second.
+   Controlled by kernel command-line option "-hz". */
+int timer_freq = TIMER_FREQ_DEFAULT;
 
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
@@ -24,37 +23,214 @@ static int64_t ticks;
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
-/* List of sleeping threads */
-struct list sleeping_threads_list;
+/* Nanoseconds per second. */
+#define NSEC_PER_SEC 1000000000
+
+/* Ticks over which timer_calibrate() times the TSC. */
+#define TSC_CALIBRATE_TICKS 4
+
+/* Loops that timer_calibrate() times to derive loops_per_tick
+   from the TSC rate, and how many times it does so. */
+#define LOOP_CALIBRATE_LOOPS (1u << 16)
+#define LOOP_CALIBRATE_TRIES 3
+
+/* -lpt: loops_per_tick reported by an earlier boot, or 0 to
+   calibrate it. */
+unsigned timer_lpt;
+
+/* TSC cycles per second, measured against the timer by
+   timer_calibrate(), or 0 until then, and the TSC when
+   timer_init() ran.  The TSC is assumed to run at a constant
+   rate, as it does on the simulators and on any recent CPU. */
+static uint64_t tsc_hz;
+static uint64_t tsc_base;
+
+/* Sleeping threads are kept in a hierarchical timing wheel, in
+   the style of the classic BSD and Linux timer wheels.  Level 0
+   has one slot per tick for the next WHEEL_L0_SIZE ticks; each
+   higher level has WHEEL_LN_SIZE slots, each covering a whole
+   turn of the level below.  Inserting a sleeper is O(1), and a
+   tick only looks at the level-0 slot for that tick.  When a
+   level wraps around, the next slot of the level above is
+   "cascaded" down, which costs O(1) amortised per sleeper.
+   Other timed waits (see sema_down_timeout()) share the wheel
+   through struct timer_event. */
+#define WHEEL_L0_BITS 8
+#define WHEEL_LN_BITS 6
+#define WHEEL_L0_SIZE (1 << WHEEL_L0_BITS)
+#define WHEEL_LN_SIZE (1 << WHEEL_LN_BITS)
+#define WHEEL_LEVELS 5          /* Level 0 plus 4 upper levels. */
+
+/* Maximum distance into the future that the wheel can hold.
+   Later deadlines are parked at the far end and re-filed when
+   they cascade down. */
+#define WHEEL_MAX_DELTA \
+  (((int64_t) 1 << (WHEEL_L0_BITS + (WHEEL_LEVELS - 1) * WHEEL_LN_BITS)) - 1)
+
+static struct list wheel_l0[WHEEL_L0_SIZE];
+static struct list wheel_ln[WHEEL_LEVELS - 1][WHEEL_LN_SIZE];
+
+/* Next tick whose slot has not yet been processed. */
+static int64_t wheel_next;
+
+/* If false (default), the timer interrupts TIMER_FREQ times per
+   second at all times.
+   If true, the idle thread stops the periodic tick until the
+   next sleeping thread is due.
+   Controlled by kernel command-line option "-tickless". */
+bool timer_tickless;
+
+/* PIT counts per timer tick. */
+static unsigned pit_counts_per_tick;
+
+/* Number of ticks the next timer interrupt stands for, if the
+   PIT has been reprogrammed away from one interrupt per tick,
+   or 0 if it is running periodically. */
+static unsigned pit_skip_ticks;
+static unsigned pit_skip_counts;  /* PIT counts programmed for them. */
+
+/* -timer-slack: Each new thread's timer slack, in ticks.  A
+   thread that sleeps until tick T with slack S may be woken at
+   any tick from T to T + S.  Such windows are rounded to ticks
+   that many of them share, so that sleepers with overlapping
+   windows are woken together, in one pass over one slot, and a
+   tickless idle CPU wakes up once for them instead of once
+   each. */
+int64_t timer_default_slack;
+
+/* Ticks that the timer softirq has yet to pass to thread_tick(). */
+static unsigned unticked;
 
 static intr_handler_func timer_interrupt;
+static softirq_func timer_softirq;
+static void calibrate_loops_by_tsc (void);
+static void calibrate_loops_by_ticks (void);
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
-static bool compare_ticks (const struct list_elem *a,
-                              const struct list_elem *b,
-                              void *aux UNUSED);
+static void wheel_insert (struct timer_event *);
+static void wheel_cascade (int level, int index);
+static int64_t wheel_next_expiry (int64_t limit);
 static void wake_up_sleeping_threads (void);
+static timer_event_func wake_sleeper;
+static void pit_skip (unsigned tick_cnt, unsigned counts);
+
+/* Sets the timer frequency to HZ, given as a decimal string.
+   Returns false if HZ is not a number from TIMER_FREQ_MIN to
+   TIMER_FREQ_MAX.  Must be called before timer_init(). */
+bool
+timer_select_freq (const char *hz) 
+{
+  int freq = hz != NULL ? atoi (hz) : 0;
+
+  if (freq < TIMER_FREQ_MIN || freq > TIMER_FREQ_MAX)
+    return false;
+  timer_freq = freq;
+  return true;
+}
+
+/* Returns TICKS, an interval in ticks at TIMER_FREQ_DEFAULT, in
+   ticks at the actual TIMER_FREQ, rounded up. */
+int64_t
+timer_scale_ticks (int64_t ticks) 
+{
+  return DIV_ROUND_UP (ticks * TIMER_FREQ, TIMER_FREQ_DEFAULT);
+}
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void
 timer_init (void) 
 {
+  tsc_base = timer_tsc ();
   pit_configure_channel (0, 2, TIMER_FREQ);
+  pit_counts_per_tick = pit_frequency_to_count (TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
-  list_init (&sleeping_threads_list);
+  intr_register_softirq (SOFTIRQ_TIMER, timer_softirq);
+
+  int i, j;
+  for (i = 0; i < WHEEL_L0_SIZE; i++)
+    list_init (&wheel_l0[i]);
+  for (i = 0; i < WHEEL_LEVELS - 1; i++)
+    for (j = 0; j < WHEEL_LN_SIZE; j++)
+      list_init (&wheel_ln[i][j]);
+  wheel_next = ticks + 1;
 }
 
-/* Calibrates loops_per_tick, used to implement brief delays. */
+/* Calibrates the TSC, which timer_ns() and brief delays use from
+   then on, and loops_per_tick, used to implement brief delays if
+   the TSC does not work.
+
+   Timing the TSC takes a few ticks.  loops_per_tick is then
+   derived from how many cycles a fixed number of loops takes,
+   unless -lpt gave it, which is much quicker than searching for
+   the number of loops that fits in one tick; that search is left
+   for when the TSC does not run. */
 void
 timer_calibrate (void) 
 {
-  unsigned high_bit, test_bit;
+  uint64_t start, cycles;
+  int64_t t;
 
   ASSERT (intr_get_level () == INTR_ON);
   printf ("Calibrating timer...  ");
+  start = timer_tsc ();
+
+  /* Count TSC cycles from one tick boundary to another. */
+  t = timer_ticks ();
+  while (timer_ticks () == t)
+    barrier ();
+  cycles = timer_tsc ();
+  t += 1 + TSC_CALIBRATE_TICKS;
+  while (timer_ticks () < t)
+    barrier ();
+  tsc_hz = (timer_tsc () - cycles) * TIMER_FREQ / TSC_CALIBRATE_TICKS;
+
+  if (timer_lpt != 0)
+    loops_per_tick = timer_lpt;
+  else if (tsc_hz != 0)
+    calibrate_loops_by_tsc ();
+  else
+    calibrate_loops_by_ticks ();
+
+  printf ("%'"PRIu64" loops/s (-lpt=%u)",
+          (uint64_t) loops_per_tick * TIMER_FREQ, loops_per_tick);
+  if (tsc_hz != 0)
+    printf (", TSC at %'"PRIu64" Hz, in %"PRIu64" ms.\n", tsc_hz,
+            (timer_tsc () - start) * 1000 / tsc_hz);
+  else
+    printf (", no TSC.\n");
+}
+
+/* Sets loops_per_tick from the fewest TSC cycles that
+   LOOP_CALIBRATE_LOOPS loops take in LOOP_CALIBRATE_TRIES tries,
+   leaving out tries that an interrupt slowed down. */
+static void
+calibrate_loops_by_tsc (void) 
+{
+  uint64_t best = UINT64_MAX;
+  int i;
+
+  for (i = 0; i < LOOP_CALIBRATE_TRIES; i++)
+    {
+      uint64_t start = timer_tsc ();
+      busy_wait (LOOP_CALIBRATE_LOOPS);
+      start = timer_tsc () - start;
+      if (start != 0 && start < best)
+        best = start;
+    }
+  loops_per_tick = LOOP_CALIBRATE_LOOPS * tsc_hz / TIMER_FREQ / best;
+  if (loops_per_tick == 0)
+    loops_per_tick = 1;
+}
+
+/* Sets loops_per_tick by finding the most loops that run within
+   one timer tick. */
+static void
+calibrate_loops_by_ticks (void) 
+{
+  unsigned high_bit, test_bit;
 
   /* Approximate loops_per_tick as the largest power-of-two
      still less than one timer tick. */
@@ -70,8 +246,6 @@ timer_calibrate (void)
   for (test_bit = high_bit >> 1; test_bit != high_bit >> 10; test_bit >>= 1)
     if (!too_many_loops (high_bit | test_bit))
       loops_per_tick |= test_bit;
-
-  printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
 }
 
 /* Returns the number of timer ticks since the OS booted. */
@@ -84,6 +258,24 @@ timer_ticks (void)
   return t;
 }
 
+/* Returns the number of nanoseconds since the timer was
+   initialized, at the resolution of the TSC once
+   timer_calibrate() has run and of timer ticks before. */
+uint64_t
+timer_ns (void) 
+{
+  uint64_t cycles;
+
+  if (tsc_hz == 0)
+    return timer_ticks () * (NSEC_PER_SEC / TIMER_FREQ);
+
+  /* Dividing before multiplying would lose precision, and
+     multiplying first would overflow after a few seconds. */
+  cycles = timer_tsc () - tsc_base;
+  return (cycles / tsc_hz * NSEC_PER_SEC
+          + cycles % tsc_hz * NSEC_PER_SEC / tsc_hz);
+}
+
 /* Returns the number of timer ticks elapsed since THEN, which
    should be a value once returned by timer_ticks(). */
 int64_t
@@ -97,39 +289,182 @@ timer_elapsed (int64_t then)
 void
 timer_sleep (int64_t ticks) 
 {
-  struct lock lk;
-  lock_init (&lk);
-  lock_acquire (&lk);
-
-  struct sleeping_thread current_thread;
-  current_thread.wake_time = timer_ticks () + ticks;
+  struct timer_event event;
+  struct semaphore sema;
+  enum intr_level old_level;
 
   ASSERT (intr_get_level () == INTR_ON);
 
-  sema_init(&current_thread.sema, 0);
+  if (ticks <= 0)
+    return;
+
+  sema_init (&sema, 0);
+
+  /* The wheel is also updated by the timer interrupt, so the
+     insertion must be atomic with respect to it. */
+  old_level = intr_disable ();
+  timer_event_schedule (&event,
+                        timer_slacken (timer_ticks () + ticks,
+                                       thread_current ()->timer_slack),
+                        wake_sleeper, &sema);
+  sema_down (&sema);
+  intr_set_level (old_level);
+}
+
+/* Timer event function for timer_sleep(). */
+static void
+wake_sleeper (void *sema)
+{
+  sema_up (sema);
+}
+
+/* Returns the tick from WAKE_TIME to WAKE_TIME + SLACK that has
+   the most low-order zero bits.  Deadlines whose windows overlap
+   tend to round to the same tick this way, without any search
+   of the wheel: the rounded tick depends only on the window. */
+int64_t
+timer_slacken (int64_t wake_time, int64_t slack)
+{
+  uint64_t limit, mask;
+  int bit;
+
+  if (slack <= 0)
+    return wake_time;
+
+  /* Find the highest bit in which LIMIT differs from the tick
+     just before the window, which is set in LIMIT, and clear the
+     bits below it: clearing that one too would go below the
+     window. */
+  limit = wake_time + slack;
+  mask = limit ^ (wake_time - 1);
+  for (bit = 63; !(mask & ((uint64_t) 1 << bit)); bit--)
+    continue;
+  return limit & ~(((uint64_t) 1 << bit) - 1);
+}
+
+/* Sets the current thread's timer slack to TICKS, so that
+   timer_sleep() may wake it up to TICKS ticks late if that lets
+   it wake along with other threads. */
+void
+timer_set_slack (int64_t ticks)
+{
+  ASSERT (ticks >= 0);
+  thread_current ()->timer_slack = ticks;
+}
 
-  list_insert_ordered (&sleeping_threads_list,
-                       &current_thread.elem,
-                       &compare_ticks,
-                       NULL);
-  sema_down(&current_thread.sema);
+/* Returns the current thread's timer slack, in ticks. */
+int64_t
+timer_get_slack (void)
+{
+  return thread_current ()->timer_slack;
+}
 
-  lock_release(&lk);
+/* Arranges for FUNC to be called with AUX from the timer
+   interrupt at tick WAKE_TIME, or at the next tick if WAKE_TIME
+   has already passed.  EVENT must stay valid until FUNC has been
+   called or timer_event_cancel() has returned.  May be called
+   from an interrupt handler. */
+void
+timer_event_schedule (struct timer_event *event, int64_t wake_time,
+                      timer_event_func *func, void *aux)
+{
+  enum intr_level old_level;
+
+  ASSERT (event != NULL);
+  ASSERT (func != NULL);
+
+  event->wake_time = wake_time;
+  event->func = func;
+  event->aux = aux;
+
+  old_level = intr_disable ();
+  event->pending = true;
+  wheel_insert (event);
+  intr_set_level (old_level);
 }
 
-/* Compare less function for sleeping threads to help order
- * according to wake up time */
+/* Removes EVENT from the timer if it has not yet fired.  Returns
+   true if EVENT was still pending, false if its function has
+   already been called. */
 bool
-compare_ticks (const struct list_elem *a,
-               const struct list_elem *b,
-               void *aux UNUSED)
+timer_event_cancel (struct timer_event *event)
+{
+  enum intr_level old_level;
+  bool was_pending;
+
+  ASSERT (event != NULL);
+
+  old_level = intr_disable ();
+  was_pending = event->pending;
+  if (was_pending)
+    {
+      list_remove (&event->elem);
+      event->pending = false;
+    }
+  intr_set_level (old_level);
+
+  return was_pending;
+}
+
+/* Files EVENT in the wheel slot for its wake_time, relative to
+   the next tick to be processed.  Interrupts must be off. */
+static void
+wheel_insert (struct timer_event *s)
+{
+  int64_t expires = s->wake_time;
+  int64_t delta;
+  int level;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (expires < wheel_next)
+    expires = wheel_next;
+  delta = expires - wheel_next;
+
+  if (delta < WHEEL_L0_SIZE)
+    {
+      list_push_back (&wheel_l0[expires & (WHEEL_L0_SIZE - 1)], &s->elem);
+      return;
+    }
+
+  if (delta > WHEEL_MAX_DELTA)
+    expires = wheel_next + WHEEL_MAX_DELTA;
+  for (level = 1; level < WHEEL_LEVELS - 1; level++)
+    if (delta < (int64_t) 1 << (WHEEL_L0_BITS + level * WHEEL_LN_BITS))
+      break;
+
+  int shift = WHEEL_L0_BITS + (level - 1) * WHEEL_LN_BITS;
+  list_push_back (&wheel_ln[level - 1][(expires >> shift)
+                                       & (WHEEL_LN_SIZE - 1)],
+                  &s->elem);
+}
+
+/* Moves every event in slot INDEX of upper LEVEL (1-based) down
+   to the lower levels. */
+static void
+wheel_cascade (int level, int index)
 {
-  struct sleeping_thread *a_sleeping;
-  struct sleeping_thread *b_sleeping;
-  a_sleeping = list_entry (a, struct sleeping_thread, elem);
-  b_sleeping = list_entry (b, struct sleeping_thread, elem);
+  struct list *slot = &wheel_ln[level - 1][index];
 
-  return a_sleeping->wake_time < b_sleeping->wake_time;
+  while (!list_empty (slot))
+    wheel_insert (list_entry (list_pop_front (slot),
+                              struct timer_event, elem));
+}
+
+/* Returns the earliest tick, no later than LIMIT, at which the
+   wheel has work to do: a level-0 slot with sleepers in it, or a
+   level-0 wrap-around that cascades the level above.  Scans at
+   most one level-0 slot per tick up to LIMIT. */
+static int64_t
+wheel_next_expiry (int64_t limit)
+{
+  int64_t t;
+
+  for (t = wheel_next; t < limit; t++)
+    if ((t & (WHEEL_L0_SIZE - 1)) == 0
+        || !list_empty (&wheel_l0[t & (WHEEL_L0_SIZE - 1)]))
+      return t;
+  return limit;
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -202,41 +537,153 @@ timer_print_stats (void)
   printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
 }
 
-/* Timer interrupt handler. */
-static void
-timer_interrupt (struct intr_frame *args UNUSED)
+/* Called by the idle thread, with interrupts off, just before
+   it halts the CPU.  In tickless mode, reprograms the PIT so that
+   the next timer interrupt arrives when the earliest sleeping
+   thread is due, instead of at the next tick.  The skip is
+   capped so that it does not step over an MLFQS once-per-second
+   recalculation or the start of a throttled EDF thread's next
+   period, and by the range of the PIT's 16-bit counter
+   (about 55 ms); after a capped skip the idle thread simply
+   halts again for the rest. */
+void
+timer_idle_enter (void)
 {
-  ticks++;
-  wake_up_sleeping_threads ();
-  thread_tick ();
+  int64_t skip;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!timer_tickless || pit_skip_ticks != 0)
+    return;
+
+  skip = 65536 / pit_counts_per_tick;
+  if (thread_mlfqs && skip > TIMER_FREQ - ticks % TIMER_FREQ)
+    skip = TIMER_FREQ - ticks % TIMER_FREQ;
+  if (skip > thread_edf_next_release () - ticks)
+    skip = thread_edf_next_release () - ticks;
+  skip = wheel_next_expiry (ticks + skip) - ticks;
+
+  if (skip > 1)
+    pit_skip (skip, skip * pit_counts_per_tick);
 }
 
-/* Iterates through list of sleeping threads and unblocks threads
- * if OS ticks is greater than thread wake_time */
+/* Called when the idle thread stops running, with interrupts
+   off.  If an interrupt other than the timer woke the CPU in the
+   middle of a skip, credits the whole ticks that have already
+   elapsed and programs the PIT to interrupt once more at the
+   next tick boundary, after which it runs periodically again. */
 void
-wake_up_sleeping_threads ()
+timer_idle_exit (void)
 {
-  struct list_elem *current_elem;
-  struct sleeping_thread *current_thread;
+  unsigned elapsed;
 
-  enum intr_level old_level = intr_disable ();
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  /* If the skip has expired, the pending timer interrupt will
+     account for it. */
+  if (pit_skip_ticks <= 1 || intr_is_pending (0x20))
+    return;
 
-  //Iterate through the list to wake all threads which have finished sleeping
-  while(!list_empty (&sleeping_threads_list))
-  {
-    current_elem = list_pop_front (&sleeping_threads_list);
-    current_thread = list_entry (current_elem, struct sleeping_thread, elem);
+  elapsed = pit_skip_counts - pit_read_count (0);
+  ticks += elapsed / pit_counts_per_tick;
+  thread_credit_idle_ticks (elapsed / pit_counts_per_tick);
+  pit_skip (1, pit_counts_per_tick - elapsed % pit_counts_per_tick);
+}
 
-    if (current_thread->wake_time <= ticks)
+/* Programs the PIT so that the next timer interrupt arrives
+   after COUNTS PIT cycles and stands for TICK_CNT ticks. */
+static void
+pit_skip (unsigned tick_cnt, unsigned counts)
+{
+  if (counts < 2)
+    counts = 2;
+  pit_skip_ticks = tick_cnt;
+  pit_skip_counts = counts;
+  pit_configure_channel_count (0, 2, counts);
+}
+
+/* Timer interrupt handler. */
+static void
+timer_interrupt (struct intr_frame *args)
+{
+  if (pit_skip_ticks != 0)
     {
-      sema_up (&current_thread->sema);
+      /* Catch up with the ticks that were skipped and go back to
+         one interrupt per tick. */
+      ticks += pit_skip_ticks;
+      thread_credit_idle_ticks (pit_skip_ticks - 1);
+      pit_skip_ticks = 0;
+      pit_configure_channel_count (0, 2, pit_counts_per_tick);
     }
-    else
+  else
+    ticks++;
+  unticked++;
+  intr_raise_softirq (SOFTIRQ_TIMER);
+  profile_tick (args);
+}
+
+/* The deferred half of the timer interrupt: fires the timer
+   events that have come due and runs the scheduler's tick.  If
+   timer interrupts arrived while the softirq could not run, it
+   runs the scheduler's tick once for each of them, passing each
+   the number of its own tick, so that work due at a particular
+   tick, such as the once-a-second recalculation of the BSD
+   scheduler, is not done twice or skipped. */
+static void
+timer_softirq (void) 
+{
+  enum intr_level old_level;
+
+  wake_up_sleeping_threads ();
+
+  old_level = intr_disable ();
+  for (; unticked > 0; unticked--)
+    thread_tick (ticks - unticked + 1);
+  intr_set_level (old_level);
+}
+
+/* Advances the timing wheel up to the current tick, firing every
+   event whose slot comes due.  Normally this processes exactly
+   one slot, but after a tickless skip it catches up with each
+   skipped tick in turn, letting interrupts in between slots. */
+static void
+wake_up_sleeping_threads (void)
+{
+  enum intr_level old_level = intr_disable ();
+
+  while (wheel_next <= ticks)
     {
-      list_push_front (&sleeping_threads_list, current_elem);
-      break;
+      intr_set_level (old_level);
+      intr_disable ();
+
+      int index = wheel_next & (WHEEL_L0_SIZE - 1);
+      struct list *slot;
+
+      /* On wrap-around, refill level 0 (and, if they wrapped
+         too, the levels above it) from the next upper slot. */
+      if (index == 0)
+        {
+          int level;
+          for (level = 1; level < WHEEL_LEVELS; level++)
+            {
+              int shift = WHEEL_L0_BITS + (level - 1) * WHEEL_LN_BITS;
+              int upper = (wheel_next >> shift) & (WHEEL_LN_SIZE - 1);
+              wheel_cascade (level, upper);
+              if (upper != 0)
+                break;
+            }
+        }
+
+      slot = &wheel_l0[index];
+      while (!list_empty (slot))
+        {
+          struct timer_event *e
+            = list_entry (list_pop_front (slot), struct timer_event, elem);
+          e->pending = false;
+          e->func (e->aux);
+        }
+      wheel_next++;
     }
-  }
 
   intr_set_level (old_level);
 }
@@ -306,6 +753,16 @@ real_time_sleep (int64_t num, int32_t denom)
 static void
 real_time_delay (int64_t num, int32_t denom)
 {
+  if (tsc_hz != 0 && num > 0)
+    {
+      /* Spin until the TSC has advanced far enough. */
+      uint64_t end = (timer_tsc () + num / denom * tsc_hz
+                      + num % denom * tsc_hz / denom);
+      while (timer_tsc () < end)
+        barrier ();
+      return;
+    }
+
   /* Scale the numerator and denominator down by 1000 to avoid
      the possibility of overflow. */
   ASSERT (denom % 1000 == 0);
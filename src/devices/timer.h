@@ -2,26 +2,68 @@
 #define DEVICES_TIMER_H
 
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <list.h>
+#include <tsc.h>
 #include "threads/synch.h"
 
-/* Number of timer interrupts per second. */
-#define TIMER_FREQ 100
+/* Number of timer interrupts per second, TIMER_FREQ_DEFAULT
+   unless set otherwise with -hz.  Intervals that the kernel
+   tunes in ticks are given for the default rate and scaled with
+   timer_scale_ticks(). */
+#define TIMER_FREQ timer_freq
+#define TIMER_FREQ_DEFAULT 100
+#define TIMER_FREQ_MIN 19       /* Slowest rate of the 8254. */
+#define TIMER_FREQ_MAX 1000
+extern int timer_freq;
 
-/* Struct for sleeping thread */
-struct sleeping_thread
+/* Function called by the timer softirq when a timer event comes
+   due.  It runs with interrupts off and must not sleep. */
+typedef void timer_event_func (void *aux);
+
+/* A deadline registered with the timer, usually embedded in a
+   structure on the waiting thread's stack. */
+struct timer_event
 {
-  int64_t wake_time;     /* Time to wake up thread */
-  struct semaphore sema; /* Semaphore for blocking and unblocking threads */
-  struct list_elem elem; /* Elem for traversing list of sleeping threads */
+  int64_t wake_time;     /* Tick at which to call func */
+  timer_event_func *func; /* Function to call */
+  void *aux;             /* Argument for func */
+  bool pending;          /* True while in the timing wheel */
+  struct list_elem elem; /* Elem in a timing wheel slot */
 };
 
+/* Tickless idle. */
+extern bool timer_tickless;
+
+/* -lpt: Delay loops per tick, from an earlier boot. */
+extern unsigned timer_lpt;
+
+/* -timer-slack: Each new thread's timer slack, in ticks. */
+extern int64_t timer_default_slack;
+
+bool timer_select_freq (const char *);
+int64_t timer_scale_ticks (int64_t ticks);
+
 void timer_init (void);
 void timer_calibrate (void);
 
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+
 int64_t timer_ticks (void);
 int64_t timer_elapsed (int64_t);
+uint64_t timer_ns (void);
+
+/* Deadlines. */
+void timer_event_schedule (struct timer_event *, int64_t wake_time,
+                           timer_event_func *, void *aux);
+bool timer_event_cancel (struct timer_event *);
+int64_t timer_slacken (int64_t wake_time, int64_t slack);
+
+/* Timer slack of the current thread. */
+void timer_set_slack (int64_t ticks);
+int64_t timer_get_slack (void);
 
 /* Sleep and yield the CPU to other threads. */
 void timer_sleep (int64_t ticks);
@@ -36,4 +78,13 @@ void timer_ndelay (int64_t nanoseconds);
 
 void timer_print_stats (void);
 
+/* Returns the processor's time-stamp counter, which counts CPU
+   cycles.  Finer grained than timer_ticks(), for measuring short
+   intervals. */
+static inline uint64_t
+timer_tsc (void)
+{
+  return rdtsc ();
+}
+
 #endif /* devices/timer.h */
@@ -1,5 +1,6 @@
 #include "devices/vga.h"
 #include <round.h>
+#include <debug.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <string.h>
@@ -14,23 +15,37 @@
 #define COL_CNT 80
 #define ROW_CNT 25
 
+/* Number of rows that fit in the 32 kB of text-mode video memory.
+   Only ROW_CNT of them are displayed at a time, starting at row
+   TOP. */
+#define MEM_ROW_CNT (0x8000 / (COL_CNT * 2))
+
 /* Current cursor position.  (0,0) is in the upper left corner of
    the display. */
 static size_t cx, cy;
 
+/* First row of video memory shown on the display.  Scrolling
+   advances TOP and reprograms the display's start address
+   instead of moving the whole screen, so the text is only copied
+   back to the start of video memory once every MEM_ROW_CNT -
+   ROW_CNT lines. */
+static size_t top;
+
 /* Attribute value for gray text on a black background. */
 #define GRAY_ON_BLACK 0x07
 
 /* Framebuffer.  See [FREEVGA] under "VGA Text Mode Operation".
-   The character at (x,y) is fb[y][x][0].
-   The attribute at (x,y) is fb[y][x][1]. */
+   The character at (x,y) on the display is fb[top + y][x][0].
+   The attribute at (x,y) is fb[top + y][x][1]. */
 static uint8_t (*fb)[COL_CNT][2];
 
 static void clear_row (size_t y);
 static void cls (void);
 static void newline (void);
 static void move_cursor (void);
+static void move_display (void);
 static void find_cursor (size_t *x, size_t *y);
+static void putc_at_cursor (int c, enum intr_level old_level);
 
 /* Initializes the VGA text display. */
 static void
@@ -41,6 +56,8 @@ init (void)
   if (!inited)
     {
       fb = ptov (0xb8000);
+      top = 0;
+      move_display ();
       find_cursor (&cx, &cy);
       inited = true; 
     }
@@ -56,7 +73,41 @@ vga_putc (int c)
   enum intr_level old_level = intr_disable ();
 
   init ();
-  
+  putc_at_cursor (c, old_level);
+
+  /* Update display position and cursor position. */
+  move_display ();
+  move_cursor ();
+
+  intr_set_level (old_level);
+}
+
+/* Writes the N characters in BUFFER to the VGA text display, as
+   vga_putc() would, but scrolls the display and moves the
+   hardware cursor only once at the end. */
+void
+vga_putbuf (const char *buffer, size_t n)
+{
+  enum intr_level old_level = intr_disable ();
+
+  init ();
+  while (n-- > 0)
+    putc_at_cursor (*buffer++, old_level);
+  move_display ();
+  move_cursor ();
+
+  intr_set_level (old_level);
+}
+
+/* Writes C into the framebuffer at the cursor and advances the
+   cursor, without scrolling the display or moving the hardware
+   cursor.  Interrupts must be off.  OLD_LEVEL is the interrupt
+   level to restore while beeping. */
+static void
+putc_at_cursor (int c, enum intr_level old_level)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
   switch (c) 
     {
     case '\n':
@@ -89,17 +140,12 @@ vga_putc (int c)
       break;
       
     default:
-      fb[cy][cx][0] = c;
-      fb[cy][cx][1] = GRAY_ON_BLACK;
+      fb[top + cy][cx][0] = c;
+      fb[top + cy][cx][1] = GRAY_ON_BLACK;
       if (++cx >= COL_CNT)
         newline ();
       break;
     }
-
-  /* Update cursor position. */
-  move_cursor ();
-
-  intr_set_level (old_level);
 }
 
 /* Clears the screen and moves the cursor to the upper left. */
@@ -115,7 +161,7 @@ cls (void)
   move_cursor ();
 }
 
-/* Clears row Y to spaces. */
+/* Clears row Y of the display to spaces. */
 static void
 clear_row (size_t y) 
 {
@@ -123,14 +169,15 @@ clear_row (size_t y)
 
   for (x = 0; x < COL_CNT; x++)
     {
-      fb[y][x][0] = ' ';
-      fb[y][x][1] = GRAY_ON_BLACK;
+      fb[top + y][x][0] = ' ';
+      fb[top + y][x][1] = GRAY_ON_BLACK;
     }
 }
 
 /* Advances the cursor to the first column in the next line on
    the screen.  If the cursor is already on the last line on the
-   screen, scrolls the screen upward one line. */
+   screen, scrolls the screen upward one line.  The display does
+   not show the scroll until move_display() is called. */
 static void
 newline (void)
 {
@@ -139,7 +186,15 @@ newline (void)
   if (cy >= ROW_CNT)
     {
       cy = ROW_CNT - 1;
-      memmove (&fb[0], &fb[1], sizeof fb[0] * (ROW_CNT - 1));
+      if (top + ROW_CNT >= MEM_ROW_CNT)
+        {
+          /* Out of video memory below the display.  Copy the
+             rows that stay on screen back to the start. */
+          memmove (&fb[0], &fb[top + 1], sizeof fb[0] * (ROW_CNT - 1));
+          top = 0;
+        }
+      else
+        top++;
       clear_row (ROW_CNT - 1);
     }
 }
@@ -149,11 +204,22 @@ static void
 move_cursor (void) 
 {
   /* See [FREEVGA] under "Manipulating the Text-mode Cursor". */
-  uint16_t cp = cx + COL_CNT * cy;
+  uint16_t cp = cx + COL_CNT * (top + cy);
   outw (0x3d4, 0x0e | (cp & 0xff00));
   outw (0x3d4, 0x0f | (cp << 8));
 }
 
+/* Sets the display's start address so that it shows ROW_CNT rows
+   starting at row TOP of video memory. */
+static void
+move_display (void) 
+{
+  /* See [FREEVGA] under "CRT Controller Registers". */
+  uint16_t start = COL_CNT * top;
+  outw (0x3d4, 0x0c | (start & 0xff00));
+  outw (0x3d4, 0x0d | (start << 8));
+}
+
 /* Reads the current hardware cursor position into (*X,*Y). */
 static void
 find_cursor (size_t *x, size_t *y) 
@@ -0,0 +1,426 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Driver for virtio block devices on the PCI bus, as QEMU
+   emulates them with `-drive if=virtio', through the legacy
+   (virtio 0.9.5) I/O port interface.  It complies with the
+   "Virtio PCI Card Specification", version 0.9.5, as far as a
+   single request queue and no optional features go.
+
+   The driver and the device share a virtqueue in memory: a table
+   of descriptors, each pointing to a buffer, a ring of
+   descriptor chains that the driver makes available to the
+   device, and a ring of chains that the device has used.  Each
+   request is a chain of three descriptors, for its header, its
+   data and the status byte the device writes back.  Submitting
+   a request fills in a free slot's chain, adds it to the
+   available ring and writes the queue notify register, a single
+   trap to the host however many sectors the request moves, and
+   the device transfers the data straight to or from the
+   request's buffer.  Up to SLOT_CNT requests are in flight at
+   once, and the device completes them in any order; the
+   interrupt handler walks the used ring and completes each one
+   with block_complete().
+
+   Buffers are kernel virtual addresses, which map physical
+   memory in one piece, so a buffer needs only one descriptor
+   however long it is. */
+
+/* PCI vendor and device ID of a legacy virtio block device. */
+#define VIRTIO_VENDOR 0x1af4
+#define VIRTIO_BLK_DEVICE 0x1001
+
+/* Legacy virtio registers, as offsets from the I/O port base in
+   BAR0. */
+#define VIRTIO_GUEST_FEATURES 0x04      /* 32 bits. */
+#define VIRTIO_QUEUE_PFN 0x08           /* 32 bits: page number. */
+#define VIRTIO_QUEUE_SIZE 0x0c          /* 16 bits, read-only. */
+#define VIRTIO_QUEUE_SELECT 0x0e        /* 16 bits. */
+#define VIRTIO_QUEUE_NOTIFY 0x10        /* 16 bits. */
+#define VIRTIO_STATUS 0x12              /* 8 bits. */
+#define VIRTIO_ISR 0x13                 /* 8 bits, cleared on read. */
+#define VIRTIO_BLK_CAPACITY 0x14        /* 64 bits, in sectors. */
+
+/* Device status bits. */
+#define STATUS_ACKNOWLEDGE 0x01 /* Guest found the device. */
+#define STATUS_DRIVER 0x02      /* Guest has a driver for it. */
+#define STATUS_DRIVER_OK 0x04   /* Driver is ready. */
+#define STATUS_FAILED 0x80      /* Driver gave up on the device. */
+
+/* ISR status bit for a used ring update. */
+#define ISR_QUEUE 0x01
+
+/* Virtqueue descriptor. */
+struct vring_desc
+  {
+    uint64_t addr;              /* Physical address of buffer. */
+    uint32_t len;               /* Bytes in buffer. */
+    uint16_t flags;             /* VRING_DESC_F_*. */
+    uint16_t next;              /* Next descriptor, with F_NEXT. */
+  };
+
+#define VRING_DESC_F_NEXT 1     /* Chain continues at NEXT. */
+#define VRING_DESC_F_WRITE 2    /* Device writes buffer. */
+
+/* Ring of chains made available to the device, by the index of
+   the head descriptor. */
+struct vring_avail
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where the next entry goes. */
+    uint16_t ring[];
+  };
+
+/* A chain the device has used. */
+struct vring_used_elem
+  {
+    uint32_t id;                /* Head descriptor. */
+    uint32_t len;               /* Bytes written. */
+  };
+
+/* Ring of chains used by the device. */
+struct vring_used
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where the next entry goes. */
+    struct vring_used_elem ring[];
+  };
+
+/* Alignment of the used ring in a legacy virtqueue. */
+#define VRING_ALIGN PGSIZE
+
+/* Request header, read by the device. */
+struct virtio_blk_req
+  {
+    uint32_t type;              /* VIRTIO_BLK_T_*. */
+    uint32_t reserved;
+    uint64_t sector;            /* First sector. */
+  };
+
+#define VIRTIO_BLK_T_IN 0       /* Read. */
+#define VIRTIO_BLK_T_OUT 1      /* Write. */
+
+/* Status written back by the device. */
+#define VIRTIO_BLK_S_OK 0
+
+/* Requests in flight at once on a device, each using three
+   descriptors. */
+#define SLOT_CNT 32
+
+/* Most devices used. */
+#define DISK_CNT 4
+
+/* A request in flight. */
+struct slot
+  {
+    struct virtio_blk_req req;  /* Header. */
+    volatile uint8_t status;    /* Status from the device. */
+    bool busy;                  /* In use? */
+    block_sector_t sector;      /* First sector, for errors. */
+    bool read;                  /* Read, or write? */
+    struct block_request *r;    /* Asynchronous request, or null. */
+    struct semaphore *done;     /* Up'd on completion if R is null. */
+  };
+
+/* A virtio block device. */
+struct virtio_disk
+  {
+    char name[8];               /* "vda", "vdb", ... */
+    uint16_t base;              /* I/O port base. */
+    uint8_t irq;                /* Interrupt line. */
+    uint16_t queue_size;        /* Entries in each ring. */
+    struct vring_desc *desc;    /* Descriptor table. */
+    volatile struct vring_avail *avail; /* Available ring. */
+    volatile struct vring_used *used;   /* Used ring. */
+    uint16_t last_used;         /* Used ring entries handled. */
+    size_t slot_cnt;            /* Usable entries in SLOTS. */
+    struct slot slots[SLOT_CNT];
+    struct semaphore free_slots;  /* Number of free slots. */
+  };
+
+static struct virtio_disk disks[DISK_CNT];
+static size_t disk_cnt;
+
+static const struct block_operations virtio_operations;
+static intr_handler_func virtio_interrupt;
+static bool setup_device (struct virtio_disk *, int dev, int func);
+
+/* Finds the virtio block devices on PCI bus 0, sets them up, and
+   registers them and their partitions with the block layer. */
+void
+virtio_blk_init (void)
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8 && disk_cnt < DISK_CNT; func++)
+      {
+        uint32_t id = pci_read_config (dev, func, PCI_REG_ID);
+        struct virtio_disk *d = &disks[disk_cnt];
+        struct block *block;
+
+        if ((id & 0xffff) != VIRTIO_VENDOR
+            || (id >> 16) != VIRTIO_BLK_DEVICE)
+          continue;
+
+        snprintf (d->name, sizeof d->name, "vd%c", 'a' + (int) disk_cnt);
+        if (!setup_device (d, dev, func))
+          continue;
+        disk_cnt++;
+
+        block = block_register (d->name, BLOCK_RAW, "virtio",
+                                inl (d->base + VIRTIO_BLK_CAPACITY),
+                                &virtio_operations, d);
+        partition_scan (block);
+      }
+}
+
+/* Resets virtio block device D, function FUNC of device DEV on
+   PCI bus 0, sets up its request queue and its interrupt, and
+   tells it the driver is ready.  Returns false, and leaves D
+   unused, if the device cannot be used. */
+static bool
+setup_device (struct virtio_disk *d, int dev, int func)
+{
+  uint32_t bar = pci_read_config (dev, func, PCI_REG_BAR0);
+  size_t avail_size, used_ofs, size, i;
+  int vec_no;
+  uint8_t *queue;
+
+  d->irq = pci_read_config (dev, func, PCI_REG_IRQ) & 0xff;
+  if (!(bar & 1) || d->irq >= 16)
+    {
+      printf ("%s: no I/O ports or interrupt line, ignoring\n", d->name);
+      return false;
+    }
+  d->base = bar & ~3u;
+  pci_write_config (dev, func, PCI_REG_COMMAND,
+                    pci_read_config (dev, func, PCI_REG_COMMAND)
+                    | PCI_CMD_IO | PCI_CMD_MASTER);
+
+  /* Reset the device, then acknowledge it and accept none of its
+     optional features. */
+  outb (d->base + VIRTIO_STATUS, 0);
+  outb (d->base + VIRTIO_STATUS, STATUS_ACKNOWLEDGE);
+  outb (d->base + VIRTIO_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+  outl (d->base + VIRTIO_GUEST_FEATURES, 0);
+
+  /* Lay out queue 0: descriptors, then the available ring, then,
+     at the next page boundary, the used ring. */
+  outw (d->base + VIRTIO_QUEUE_SELECT, 0);
+  d->queue_size = inw (d->base + VIRTIO_QUEUE_SIZE);
+  if (d->queue_size < 3)
+    {
+      outb (d->base + VIRTIO_STATUS, STATUS_FAILED);
+      printf ("%s: no request queue, ignoring\n", d->name);
+      return false;
+    }
+  avail_size = sizeof *d->avail + (d->queue_size + 1) * sizeof (uint16_t);
+  used_ofs = ROUND_UP (d->queue_size * sizeof *d->desc + avail_size,
+                       VRING_ALIGN);
+  size = used_ofs + sizeof *d->used
+         + d->queue_size * sizeof (struct vring_used_elem)
+         + sizeof (uint16_t);
+  queue = palloc_get_multiple (PAL_ASSERT | PAL_ZERO,
+                               DIV_ROUND_UP (size, PGSIZE));
+  d->desc = (struct vring_desc *) queue;
+  d->avail = (struct vring_avail *) (queue
+                                     + d->queue_size * sizeof *d->desc);
+  d->used = (struct vring_used *) (queue + used_ofs);
+  d->last_used = 0;
+
+  d->slot_cnt = d->queue_size / 3 < SLOT_CNT ? d->queue_size / 3 : SLOT_CNT;
+  for (i = 0; i < d->slot_cnt; i++)
+    d->slots[i].busy = false;
+  sema_init (&d->free_slots, d->slot_cnt);
+
+  /* Disks may share an interrupt line; one handler serves them
+     all. */
+  vec_no = 0x20 + d->irq;
+  for (i = 0; i < disk_cnt; i++)
+    if (disks[i].irq == d->irq)
+      break;
+  if (i >= disk_cnt)
+    intr_register_ext (vec_no, virtio_interrupt, "virtio-blk");
+
+  outl (d->base + VIRTIO_QUEUE_PFN, vtop (queue) / PGSIZE);
+  outb (d->base + VIRTIO_STATUS,
+        STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+  return true;
+}
+
+/* Starts a request to read or write, according to READ, CNT
+   sectors starting at SECTOR on D from or into BUFFER.  When it
+   completes, the interrupt handler calls block_complete (R) if R
+   is non-null, otherwise ups DONE. */
+static void
+start_request (struct virtio_disk *d, block_sector_t sector, size_t cnt,
+               void *buffer, bool read, struct block_request *r,
+               struct semaphore *done)
+{
+  enum intr_level old_level;
+  struct vring_desc *desc;
+  struct slot *s;
+  size_t i;
+
+  ASSERT (is_kernel_vaddr (buffer));
+  ASSERT (cnt > 0);
+
+  sema_down (&d->free_slots);
+  old_level = intr_disable ();
+  for (i = 0; d->slots[i].busy; i++)
+    ASSERT (i + 1 < d->slot_cnt);
+  s = &d->slots[i];
+  s->busy = true;
+  s->sector = sector;
+  s->read = read;
+  s->r = r;
+  s->done = done;
+  s->req.type = read ? VIRTIO_BLK_T_IN : VIRTIO_BLK_T_OUT;
+  s->req.reserved = 0;
+  s->req.sector = sector;
+  s->status = 0xff;
+
+  desc = &d->desc[i * 3];
+  desc[0].addr = vtop (&s->req);
+  desc[0].len = sizeof s->req;
+  desc[0].flags = VRING_DESC_F_NEXT;
+  desc[0].next = i * 3 + 1;
+  desc[1].addr = vtop (buffer);
+  desc[1].len = cnt * BLOCK_SECTOR_SIZE;
+  desc[1].flags = VRING_DESC_F_NEXT | (read ? VRING_DESC_F_WRITE : 0);
+  desc[1].next = i * 3 + 2;
+  desc[2].addr = vtop ((const void *) &s->status);
+  desc[2].len = 1;
+  desc[2].flags = VRING_DESC_F_WRITE;
+  desc[2].next = 0;
+
+  /* The device must see the chain before the new index, and the
+     index before the notification. */
+  d->avail->ring[d->avail->idx % d->queue_size] = i * 3;
+  barrier ();
+  d->avail->idx++;
+  barrier ();
+  outw (d->base + VIRTIO_QUEUE_NOTIFY, 0);
+  intr_set_level (old_level);
+}
+
+/* Reads or writes, according to READ, CNT sectors starting at
+   SECTOR on D from or into BUFFER, and waits until the device is
+   done. */
+static void
+transfer (struct virtio_disk *d, block_sector_t sector, size_t cnt,
+          void *buffer, bool read)
+{
+  struct semaphore done;
+
+  sema_init (&done, 0);
+  start_request (d, sector, cnt, buffer, read, NULL, &done);
+  sema_down (&done);
+}
+
+/* Completes the requests that D has used since last time. */
+static void
+complete_requests (struct virtio_disk *d)
+{
+  while (d->last_used != d->used->idx)
+    {
+      volatile struct vring_used_elem *u;
+      struct slot *s;
+
+      barrier ();
+      u = &d->used->ring[d->last_used % d->queue_size];
+      s = &d->slots[u->id / 3];
+      d->last_used++;
+      if (s->status != VIRTIO_BLK_S_OK)
+        PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+               d->name, s->read ? "read" : "write", s->sector);
+
+      s->busy = false;
+      if (s->r != NULL)
+        block_complete (s->r);
+      else
+        sema_up (s->done);
+      sema_up (&d->free_slots);
+    }
+}
+
+/* Virtio block interrupt handler, for every disk on the
+   interrupt line that F came in on. */
+static void
+virtio_interrupt (struct intr_frame *f)
+{
+  size_t i;
+
+  for (i = 0; i < disk_cnt; i++)
+    {
+      struct virtio_disk *d = &disks[i];
+
+      /* Reading the ISR status acknowledges the interrupt. */
+      if (0x20 + d->irq == (int) f->vec_no
+          && (inb (d->base + VIRTIO_ISR) & ISR_QUEUE))
+        complete_requests (d);
+    }
+}
+
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void
+virtio_read (void *d, block_sector_t sec_no, void *buffer)
+{
+  transfer (d, sec_no, 1, buffer, true);
+}
+
+/* Writes sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes. */
+static void
+virtio_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  transfer (d, sec_no, 1, (void *) buffer, false);
+}
+
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   in one request. */
+static void
+virtio_read_multiple (void *d, block_sector_t sec_no, size_t cnt,
+                      void *buffer)
+{
+  transfer (d, sec_no, cnt, buffer, true);
+}
+
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   in one request. */
+static void
+virtio_write_multiple (void *d, block_sector_t sec_no, size_t cnt,
+                       const void *buffer)
+{
+  transfer (d, sec_no, cnt, (void *) buffer, false);
+}
+
+/* Starts request R on disk D and returns without waiting. */
+static void
+virtio_submit (void *d, struct block_request *r)
+{
+  start_request (d, r->sector, r->cnt, r->buffer, r->read, r, NULL);
+}
+
+static const struct block_operations virtio_operations =
+  {
+    virtio_read,
+    virtio_write,
+    virtio_read_multiple,
+    virtio_write_multiple,
+    virtio_submit,
+    NULL
+  };
@@ -0,0 +1,8 @@
+#ifndef DEVICES_VIRTIO_BLK_H
+#define DEVICES_VIRTIO_BLK_H
+
+/* Virtio block devices.  See virtio-blk.c for details. */
+
+void virtio_blk_init (void);
+
+#endif /* devices/virtio-blk.h */
@@ -0,0 +1,136 @@
+/* bench-create.c
+
+   Measures how fast files can be created, listed and removed in
+   one directory.  Listing is timed with readdir(), one name per
+   call, with getdents(), a buffer full per call, and with
+   getdents_stat(), which also reports each entry's length and
+   type. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "bench.h"
+
+/* Files in existence at once, few enough for any root
+   directory. */
+#define FILE_CNT 10
+
+/* Number of times to create and remove them all. */
+#define ROUND_CNT 10
+
+/* Ways to list a directory. */
+enum list_mode
+  {
+    LIST_READDIR,               /* readdir(). */
+    LIST_GETDENTS,              /* getdents(). */
+    LIST_STAT                   /* getdents_stat(). */
+  };
+
+/* Lists the root directory open as FD from its start, as MODE
+   says.  Returns the number of entries seen. */
+static int
+list_root (int fd, enum list_mode mode)
+{
+  int cnt = 0;
+
+  seek (fd, 0);
+  if (mode == LIST_STAT)
+    {
+      struct dirent_stat entries[32];
+      int n;
+
+      while ((n = getdents_stat (fd, entries, sizeof entries)) > 0)
+        cnt += n;
+    }
+  else if (mode == LIST_GETDENTS)
+    {
+      struct dirent entries[64];
+      int n;
+
+      while ((n = getdents (fd, entries, sizeof entries)) > 0)
+        cnt += n;
+    }
+  else
+    {
+      char name[READDIR_MAX_LEN + 1];
+
+      while (readdir (fd, name))
+        cnt++;
+    }
+  return cnt;
+}
+
+int
+main (void)
+{
+  unsigned long long create_cycles = 0, remove_cycles = 0;
+  unsigned long long readdir_cycles = 0, getdents_cycles = 0;
+  unsigned long long stat_cycles = 0;
+  char names[FILE_CNT][16];
+  int round, i, root;
+
+  for (i = 0; i < FILE_CNT; i++)
+    snprintf (names[i], sizeof names[i], "bench-%d", i);
+  root = open ("/");
+  if (root < 0)
+    {
+      printf ("/: open failed\n");
+      return EXIT_FAILURE;
+    }
+
+  for (round = 0; round < ROUND_CNT; round++)
+    {
+      unsigned long long start = rdtsc ();
+      for (i = 0; i < FILE_CNT; i++)
+        if (!create (names[i], 0))
+          {
+            printf ("%s: create failed\n", names[i]);
+            return EXIT_FAILURE;
+          }
+      create_cycles += rdtsc () - start;
+
+      start = rdtsc ();
+      if (list_root (root, LIST_READDIR) < FILE_CNT)
+        {
+          printf ("/: readdir missed entries\n");
+          return EXIT_FAILURE;
+        }
+      readdir_cycles += rdtsc () - start;
+
+      start = rdtsc ();
+      if (list_root (root, LIST_GETDENTS) < FILE_CNT)
+        {
+          printf ("/: getdents missed entries\n");
+          return EXIT_FAILURE;
+        }
+      getdents_cycles += rdtsc () - start;
+
+      start = rdtsc ();
+      if (list_root (root, LIST_STAT) < FILE_CNT)
+        {
+          printf ("/: getdents_stat missed entries\n");
+          return EXIT_FAILURE;
+        }
+      stat_cycles += rdtsc () - start;
+
+      start = rdtsc ();
+      for (i = 0; i < FILE_CNT; i++)
+        if (!remove (names[i]))
+          {
+            printf ("%s: remove failed\n", names[i]);
+            return EXIT_FAILURE;
+          }
+      remove_cycles += rdtsc () - start;
+    }
+
+  bench_report ("bench-create", "create",
+                create_cycles / (ROUND_CNT * FILE_CNT), "cycles");
+  bench_report ("bench-create", "list-readdir",
+                readdir_cycles / ROUND_CNT, "cycles");
+  bench_report ("bench-create", "list-getdents",
+                getdents_cycles / ROUND_CNT, "cycles");
+  bench_report ("bench-create", "list-stat",
+                stat_cycles / ROUND_CNT, "cycles");
+  bench_report ("bench-create", "remove",
+                remove_cycles / (ROUND_CNT * FILE_CNT), "cycles");
+  return EXIT_SUCCESS;
+}
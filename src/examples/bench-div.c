@@ -0,0 +1,46 @@
+/* bench-div.c
+
+   Measures 64-bit division, which GCC compiles into calls to
+   __udivdi3() and friends in lib/arithmetic.c, in CPU cycles per
+   division, for divisors and quotients of different sizes. */
+
+#include <syscall.h>
+#include "bench.h"
+
+/* Number of divisions for each case. */
+#define DIV_CNT 100000
+
+/* Keeps the divisions from being optimized away. */
+static volatile unsigned long long sink;
+
+/* Reports the cycles per division of N + I by D, for each I
+   below DIV_CNT, as METRIC. */
+static void
+measure (const char *metric, unsigned long long n, unsigned long long d)
+{
+  unsigned long long start;
+  unsigned long long sum = 0;
+  unsigned i;
+
+  start = rdtsc ();
+  for (i = 0; i < DIV_CNT; i++)
+    sum += (n + i) / d;
+  sink = sum;
+  bench_report ("bench-div", metric, (rdtsc () - start) / DIV_CNT,
+                "cycles");
+}
+
+int
+main (void)
+{
+  /* 32-bit divisor and quotient, as in most timer conversions. */
+  measure ("div-64/32-small", 3000000000ULL, 1000000007ULL);
+
+  /* 32-bit divisor, 64-bit quotient, as in printing a 64-bit
+     number in decimal. */
+  measure ("div-64/32-large", 123456789012345ULL, 10);
+
+  /* 64-bit divisor. */
+  measure ("div-64/64", 1ULL << 62, (1ULL << 40) + 12345);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,38 @@
+/* bench-exec.c
+
+   Measures the time to start a process with exec() and wait()
+   for it to exit.  The process is another copy of this program,
+   told by its argument to exit at once. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "bench.h"
+
+/* Number of processes to start. */
+#define EXEC_CNT 20
+
+int
+main (int argc, char *argv[])
+{
+  unsigned long long start;
+  int i;
+
+  if (argc > 1 && !strcmp (argv[1], "child"))
+    return EXIT_SUCCESS;
+
+  start = rdtsc ();
+  for (i = 0; i < EXEC_CNT; i++)
+    {
+      pid_t pid = exec ("bench-exec child");
+      if (pid == PID_ERROR)
+        {
+          printf ("bench-exec: exec failed\n");
+          return EXIT_FAILURE;
+        }
+      wait (pid);
+    }
+  bench_report ("bench-exec", "exec-wait",
+                (rdtsc () - start) / EXEC_CNT, "cycles");
+  return EXIT_SUCCESS;
+}
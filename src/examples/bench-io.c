@@ -0,0 +1,90 @@
+/* bench-io.c
+
+   Measures file read and write bandwidth, sequential and at
+   random offsets, for several buffer sizes, in CPU cycles per
+   kB.  Uses the file named on the command line, "bench.dat" by
+   default, which it creates and removes.  With -d, the file is
+   accessed with direct I/O, bypassing the buffer cache. */
+
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "bench.h"
+
+/* Size of the file. */
+#define FILE_SIZE (256 * 1024)
+
+/* Largest buffer size. */
+#define BUF_MAX (64 * 1024)
+
+static char buf[BUF_MAX];
+
+/* Reads or writes, according to WRITE, FILE_SIZE bytes of FD in
+   blocks of SIZE bytes, in order if RANDOM is false and at
+   random block offsets otherwise, and reports the cycles per kB
+   under a metric named after the access.  Returns false if a
+   transfer fails. */
+static bool
+measure (int fd, unsigned size, bool write_, bool random)
+{
+  unsigned blocks = FILE_SIZE / size;
+  unsigned long long start;
+  char metric[32];
+  unsigned i;
+
+  start = rdtsc ();
+  seek (fd, 0);
+  for (i = 0; i < blocks; i++)
+    {
+      int n;
+
+      if (random)
+        seek (fd, random_ulong () % blocks * size);
+      n = write_ ? write (fd, buf, size) : read (fd, buf, size);
+      if (n != (int) size)
+        {
+          printf ("bench-io: %s failed\n", write_ ? "write" : "read");
+          return false;
+        }
+    }
+
+  snprintf (metric, sizeof metric, "%s-%s-%u",
+            random ? "random" : "seq", write_ ? "write" : "read", size);
+  bench_report ("bench-io", metric,
+                (rdtsc () - start) * 1024 / FILE_SIZE, "cycles/kB");
+  return true;
+}
+
+int
+main (int argc, char *argv[])
+{
+  static const unsigned sizes[] = {512, 4096, 16384, BUF_MAX};
+  bool direct = argc > 1 && !strcmp (argv[1], "-d");
+  const char *name = argc > 1 + direct ? argv[1 + direct] : "bench.dat";
+  bool ok = true;
+  unsigned i;
+  int fd;
+
+  fd = bench_create_file (name, FILE_SIZE);
+  if (fd < 0)
+    return EXIT_FAILURE;
+  if (direct && !direct_io (fd, true))
+    {
+      printf ("bench-io: direct I/O not available\n");
+      close (fd);
+      remove (name);
+      return EXIT_FAILURE;
+    }
+
+  random_init (0);
+  for (i = 0; ok && i < sizeof sizes / sizeof *sizes; i++)
+    ok = (measure (fd, sizes[i], true, false)
+          && measure (fd, sizes[i], false, false)
+          && measure (fd, sizes[i], false, true)
+          && measure (fd, sizes[i], true, true));
+
+  close (fd);
+  remove (name);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
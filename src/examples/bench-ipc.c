@@ -0,0 +1,81 @@
+/* bench-ipc.c
+
+   Measures the round trip of a local RPC with ipc_call(): the
+   time for a call to another process to be received and replied
+   to.  The server is another copy of this program, told by its
+   argument to answer calls until it gets one with QUIT in its
+   first word. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "bench.h"
+
+/* Number of round trips to time. */
+#define CALL_CNT 1000
+
+/* First word of the call that ends the server. */
+#define QUIT 0xffffffff
+
+/* Answers each call with its first word plus 1. */
+static int
+serve (void)
+{
+  struct ipc_msg msg;
+
+  for (;;)
+    {
+      tid_t client = ipc_receive (&msg);
+      bool quit;
+
+      if (client == TID_ERROR)
+        return EXIT_FAILURE;
+      quit = msg.words[0] == QUIT;
+      msg.words[0]++;
+      ipc_reply (client, &msg);
+      if (quit)
+        return EXIT_SUCCESS;
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+  struct ipc_msg msg;
+  unsigned long long start;
+  pid_t pid;
+  unsigned i;
+
+  if (argc > 1 && !strcmp (argv[1], "server"))
+    return serve ();
+
+  pid = exec ("bench-ipc server");
+  if (pid == PID_ERROR)
+    {
+      printf ("bench-ipc: exec failed\n");
+      return EXIT_FAILURE;
+    }
+
+  /* Calls fail until the server first waits to receive. */
+  memset (&msg, 0, sizeof msg);
+  while (!ipc_call (pid, &msg))
+    continue;
+
+  start = rdtsc ();
+  for (i = 0; i < CALL_CNT; i++)
+    {
+      msg.words[0] = i;
+      if (!ipc_call (pid, &msg) || msg.words[0] != i + 1)
+        {
+          printf ("bench-ipc: call failed\n");
+          return EXIT_FAILURE;
+        }
+    }
+  bench_report ("bench-ipc", "round-trip",
+                (rdtsc () - start) / CALL_CNT, "cycles");
+
+  msg.words[0] = QUIT;
+  ipc_call (pid, &msg);
+  wait (pid);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,81 @@
+/* bench-mmap.c
+
+   Measures the cost of the page faults that bring in the pages
+   of a memory-mapped file, against reading pages already in
+   memory, and the cost of reading the whole file in at mmap()
+   time with MAP_POPULATE instead.  Uses the file named on the
+   command line, "bench.dat" by default, which it creates and
+   removes. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "bench.h"
+
+#define PAGE_SIZE 4096
+
+/* Pages in the file. */
+#define PAGE_CNT 64
+
+/* Where to map the file. */
+#define MAP_BASE ((char *) 0x10000000)
+
+/* Reads one byte from each page of the mapping and returns the
+   cycles it took. */
+static unsigned long long
+touch_pages (void)
+{
+  volatile char *p = MAP_BASE;
+  unsigned long long start = rdtsc ();
+  int i;
+
+  for (i = 0; i < PAGE_CNT; i++)
+    (void) p[i * PAGE_SIZE];
+  return rdtsc () - start;
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *name = argc > 1 ? argv[1] : "bench.dat";
+  unsigned long long faulting, resident, populate, start;
+  mapid_t map;
+  int fd;
+
+  fd = bench_create_file (name, PAGE_CNT * PAGE_SIZE);
+  if (fd < 0)
+    return EXIT_FAILURE;
+
+  map = mmap (fd, MAP_BASE);
+  if (map == MAP_FAILED)
+    {
+      printf ("bench-mmap: mmap failed; is VM enabled?\n");
+      close (fd);
+      remove (name);
+      return EXIT_FAILURE;
+    }
+  faulting = touch_pages ();
+  resident = touch_pages ();
+  munmap (map);
+
+  start = rdtsc ();
+  map = mmap_flags (fd, MAP_BASE, MAP_POPULATE);
+  populate = rdtsc () - start;
+  if (map != MAP_FAILED)
+    {
+      populate += touch_pages ();
+      munmap (map);
+      bench_report ("bench-mmap", "populated-read", populate / PAGE_CNT,
+                    "cycles/page");
+    }
+
+  bench_report ("bench-mmap", "first-read", faulting / PAGE_CNT,
+                "cycles/page");
+  bench_report ("bench-mmap", "later-read", resident / PAGE_CNT,
+                "cycles/page");
+  bench_report ("bench-mmap", "fault", (faulting - resident) / PAGE_CNT,
+                "cycles/page");
+
+  close (fd);
+  remove (name);
+  return EXIT_SUCCESS;
+}
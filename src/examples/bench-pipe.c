@@ -0,0 +1,108 @@
+/* bench-pipe.c
+
+   Measures pipe bandwidth, in CPU cycles per kB, for several
+   buffer sizes.  A second thread writes into the pipe while the
+   main thread reads from it.  Page-aligned writes of whole pages
+   are read straight out of the writer's buffer by the kernel. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include <thread.h>
+#include "bench.h"
+
+/* Bytes sent through the pipe for each buffer size. */
+#define TOTAL_SIZE (1024 * 1024)
+
+/* Largest buffer size. */
+#define BUF_MAX (64 * 1024)
+
+static char wbuf[BUF_MAX] __attribute__ ((aligned (4096)));
+static char rbuf[BUF_MAX] __attribute__ ((aligned (4096)));
+
+/* What the writer thread does. */
+struct writer
+  {
+    int fd;                     /* Write end of the pipe. */
+    unsigned size;              /* Bytes per write. */
+    bool ok;                    /* All writes complete? */
+  };
+
+/* Writes TOTAL_SIZE bytes into the pipe in writes of W->size
+   bytes. */
+static void
+write_all (void *w_)
+{
+  struct writer *w = w_;
+  unsigned done;
+
+  w->ok = true;
+  for (done = 0; done < TOTAL_SIZE; done += w->size)
+    if (write (w->fd, wbuf, w->size) != (int) w->size)
+      {
+        w->ok = false;
+        break;
+      }
+}
+
+/* Sends TOTAL_SIZE bytes through a new pipe, written and read
+   SIZE bytes at a time, and reports the cycles per kB.  Returns
+   false if anything fails. */
+static bool
+measure (unsigned size)
+{
+  struct writer w;
+  struct uthread t;
+  unsigned long long start;
+  unsigned done;
+  char metric[32];
+  int fds[2];
+
+  if (!pipe (fds))
+    {
+      printf ("bench-pipe: pipe failed\n");
+      return false;
+    }
+  w.fd = fds[1];
+  w.size = size;
+
+  start = rdtsc ();
+  if (!uthread_create (&t, write_all, &w))
+    {
+      printf ("bench-pipe: thread creation failed\n");
+      close (fds[0]);
+      close (fds[1]);
+      return false;
+    }
+  for (done = 0; done < TOTAL_SIZE; )
+    {
+      int n = read (fds[0], rbuf, size);
+      if (n <= 0)
+        break;
+      done += n;
+    }
+  uthread_join (&t);
+
+  close (fds[0]);
+  close (fds[1]);
+  if (!w.ok || done != TOTAL_SIZE)
+    {
+      printf ("bench-pipe: transfer failed\n");
+      return false;
+    }
+  snprintf (metric, sizeof metric, "pipe-%u", size);
+  bench_report ("bench-pipe", metric,
+                (rdtsc () - start) * 1024 / TOTAL_SIZE, "cycles/kB");
+  return true;
+}
+
+int
+main (void)
+{
+  static const unsigned sizes[] = {512, 4096, 16384, BUF_MAX};
+  bool ok = true;
+  unsigned i;
+
+  for (i = 0; ok && i < sizeof sizes / sizeof *sizes; i++)
+    ok = measure (sizes[i]);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,43 @@
+/* bench-printf.c
+
+   Measures snprintf(), in CPU cycles per call, for a few common
+   formats, from plain %d and %s, which __vprintf() handles
+   without parsing a full conversion, to conversions with a
+   width and 64-bit values. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "bench.h"
+
+/* Number of calls for each case. */
+#define CALL_CNT 20000
+
+static char buf[64];
+
+/* Reports the cycles per call of snprintf() with FORMAT and ARG,
+   which may use the loop counter I, as METRIC. */
+#define MEASURE(METRIC, FORMAT, ARG)                                    \
+  do                                                                    \
+    {                                                                   \
+      unsigned long long start = rdtsc ();                              \
+      unsigned i;                                                       \
+                                                                        \
+      for (i = 0; i < CALL_CNT; i++)                                    \
+        snprintf (buf, sizeof buf, FORMAT, ARG);                        \
+      bench_report ("bench-printf", METRIC,                             \
+                    (rdtsc () - start) / CALL_CNT, "cycles");           \
+    }                                                                   \
+  while (0)
+
+int
+main (void)
+{
+  MEASURE ("printf-d-small", "%d", 42 + i);
+  MEASURE ("printf-d-large", "%d", -1234567890 + (int) i);
+  MEASURE ("printf-u", "%u", 4000000000u + i);
+  MEASURE ("printf-s", "%s", "hello, world");
+  MEASURE ("printf-width", "%10d", 123456 + i);
+  MEASURE ("printf-lld", "%lld", 123456789012345LL + i);
+  MEASURE ("printf-x", "%x", 0xdeadbeefu + i);
+  return EXIT_SUCCESS;
+}
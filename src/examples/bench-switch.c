@@ -0,0 +1,65 @@
+/* bench-switch.c
+
+   Measures the cost of waking a thread and switching to it, in
+   CPU cycles.  Two threads of this process take turns through a
+   word in memory: each sets the word to hand the turn over,
+   wakes the other with futex_wake(), and sleeps in futex_wait()
+   until the turn comes back.  Each handoff is one wakeup and one
+   context switch, so the time per handoff is dominated by the
+   scheduler's work on the two threads' struct thread. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include <thread.h>
+#include "bench.h"
+
+/* Number of round trips to time. */
+#define ROUND_CNT 1000
+
+/* Whose turn it is: 0 for the main thread, 1 for the other. */
+static int turn;
+
+/* Waits for the turn of thread SELF, then passes it on. */
+static void
+take_turns (int self, unsigned cnt)
+{
+  unsigned i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      while (turn != self)
+        futex_wait (&turn, !self);
+      turn = !self;
+      futex_wake (&turn, 1);
+    }
+}
+
+/* What the other thread does. */
+static void
+partner (void *aux UNUSED)
+{
+  take_turns (1, ROUND_CNT + 1);
+}
+
+int
+main (void)
+{
+  unsigned long long start;
+  struct uthread t;
+
+  if (!uthread_create (&t, partner, NULL))
+    {
+      printf ("bench-switch: thread creation failed\n");
+      return EXIT_FAILURE;
+    }
+
+  /* The first round trip gets the partner going. */
+  take_turns (0, 1);
+  start = rdtsc ();
+  take_turns (0, ROUND_CNT);
+  bench_report ("bench-switch", "handoff",
+                (rdtsc () - start) / (2 * ROUND_CNT), "cycles");
+
+  uthread_join (&t);
+  return EXIT_SUCCESS;
+}
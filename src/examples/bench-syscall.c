@@ -0,0 +1,25 @@
+/* bench-syscall.c
+
+   Measures the latency of a system call that does no work. */
+
+#include <syscall.h>
+#include "bench.h"
+
+/* Number of system calls. */
+#define CALL_CNT 10000
+
+int
+main (void)
+{
+  unsigned long long start;
+  int i;
+
+  /* Telling the position of a file that is not open is about as
+     little as a system call can do. */
+  start = rdtsc ();
+  for (i = 0; i < CALL_CNT; i++)
+    tell (-1);
+  bench_report ("bench-syscall", "null-syscall",
+                (rdtsc () - start) / CALL_CNT, "cycles");
+  return EXIT_SUCCESS;
+}
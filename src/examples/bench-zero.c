@@ -0,0 +1,109 @@
+/* bench-zero.c
+
+   Measures what the kernel's zeroing and copying of whole pages
+   costs, in CPU cycles: the page faults themselves, and the cache
+   misses that they leave behind for the process that faulted.
+   It first times a read of a small working set that sits in the
+   cache, then faults in fresh heap pages, which the kernel
+   zeroes, and times the working set again.  A forked child does
+   the same with copy-on-write faults, which copy pages.  The
+   more of the working set that zeroing and copying evict, the
+   slower the second read. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "bench.h"
+
+#define PAGE_SIZE 4096
+
+/* Size of the working set, and the stride at which to read it,
+   one cache line. */
+#define WORKING_SIZE (32 * 1024)
+#define LINE_SIZE 64
+
+/* Pages to fault in. */
+#define PAGE_CNT 64
+
+static char working[WORKING_SIZE];
+
+/* Reads a byte from each line of the working set and returns the
+   cycles it took. */
+static unsigned long long
+sweep (void)
+{
+  volatile char *p = working;
+  unsigned long long start = rdtsc ();
+  int i;
+
+  for (i = 0; i < WORKING_SIZE; i += LINE_SIZE)
+    (void) p[i];
+  return rdtsc () - start;
+}
+
+/* Writes a byte to each of the PAGE_CNT pages at PAGES and
+   returns the cycles it took. */
+static unsigned long long
+touch_pages (char *pages)
+{
+  unsigned long long start = rdtsc ();
+  int i;
+
+  for (i = 0; i < PAGE_CNT; i++)
+    pages[i * PAGE_SIZE] = 1;
+  return rdtsc () - start;
+}
+
+/* Times faulting in the pages at PAGES, and a sweep of the
+   working set before and after, and reports them under METRIC. */
+static void
+measure (char *pages, const char *metric)
+{
+  unsigned long long before, faults, after;
+  char name[32];
+
+  sweep ();
+  before = sweep ();
+  faults = touch_pages (pages);
+  after = sweep ();
+
+  snprintf (name, sizeof name, "%s-fault", metric);
+  bench_report ("bench-zero", name, faults / PAGE_CNT, "cycles/page");
+  bench_report ("bench-zero", "sweep", before, "cycles");
+  snprintf (name, sizeof name, "sweep-after-%s", metric);
+  bench_report ("bench-zero", name, after, "cycles");
+}
+
+int
+main (void)
+{
+  char *pages;
+  pid_t pid;
+
+  /* Give the working set frames of its own. */
+  memset (working, 1, sizeof working);
+
+  pages = sbrk (PAGE_CNT * PAGE_SIZE);
+  if (pages == (char *) -1)
+    {
+      printf ("bench-zero: sbrk failed; is VM enabled?\n");
+      return EXIT_FAILURE;
+    }
+  measure (pages, "zero");
+
+  /* The child's writes copy the pages it shares with its parent.
+     Its working set is shared too, but it only reads it. */
+  pid = fork ();
+  if (pid == 0)
+    {
+      measure (pages, "copy");
+      return EXIT_SUCCESS;
+    }
+  else if (pid == PID_ERROR)
+    {
+      printf ("bench-zero: fork failed\n");
+      return EXIT_FAILURE;
+    }
+  wait (pid);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,27 @@
+#include "bench.h"
+#include <stdio.h>
+#include <syscall.h>
+
+/* Prints the result of METRIC measured by PROGRAM, VALUE in
+   UNIT. */
+void
+bench_report (const char *program, const char *metric,
+              unsigned long long value, const char *unit)
+{
+  printf ("%s %s %llu %s\n", program, metric, value, unit);
+}
+
+/* Creates file NAME, SIZE bytes long, replacing any file by that
+   name, and opens it.  Returns the file descriptor, or -1 if
+   either fails. */
+int
+bench_create_file (const char *name, unsigned size)
+{
+  remove (name);
+  if (!create (name, size))
+    {
+      printf ("%s: create failed\n", name);
+      return -1;
+    }
+  return open (name);
+}
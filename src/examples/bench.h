@@ -0,0 +1,15 @@
+#ifndef EXAMPLES_BENCH_H
+#define EXAMPLES_BENCH_H
+
+#include <tsc.h>
+
+/* Helpers for the bench-* programs, which measure the kernel
+   from user space in CPU cycles.  Each result goes on a line of
+   its own, "PROGRAM METRIC VALUE UNIT", for scripts to compare
+   between kernels. */
+
+void bench_report (const char *program, const char *metric,
+                   unsigned long long value, const char *unit);
+int bench_create_file (const char *name, unsigned size);
+
+#endif /* examples/bench.h */
@@ -0,0 +1,19 @@
+/* stats.c
+
+   Prints the kernel's statistics, as the kernel prints them at
+   shutdown. */
+
+#include <stdio.h>
+#include <syscall.h>
+
+int
+main (void)
+{
+  struct stats_entry entry;
+  unsigned i;
+
+  for (i = 0; stats_read (i, &entry); i++)
+    printf ("%s %llu%s\n", entry.name, entry.value,
+            entry.gauge ? " (gauge)" : "");
+  return EXIT_SUCCESS;
+}
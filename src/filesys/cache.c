@@ -0,0 +1,892 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <list.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "threads/work.h"
+
+/* Buffer cache.
+
+   Keeps the CACHE_SIZE most useful sectors in memory, keyed by
+   block device and sector number.  All file system reads and
+   writes go through the cache; writes only mark an entry dirty,
+   and dirty entries reach the disk when they are evicted, when
+   the flush job runs every CACHE_FLUSH_TICKS ticks, through
+   cache_sync() for an explicit sync, or from cache_flush() at
+   shutdown.  Flushes write sectors in ascending order.
+
+   Victims come from the free list of unused entries first, and
+   otherwise from the replacement policy that -cache=POLICY
+   picks:
+
+      - "clock", the default, sweeps a hand over the entries and
+        takes the first one not used since the hand last passed.
+
+      - "2q" keeps newly cached sectors in a FIFO queue, A1in,
+        and only sectors used again after dropping out of it in
+        an LRU queue, Am.  A1out remembers the sectors that
+        recently left A1in, without their data.  A sector that
+        is read only once, as in a long sequential scan, passes
+        through A1in without pushing the working set in Am out
+        of the cache.
+
+   cache_lock protects the mapping from sectors to entries and
+   each entry's bookkeeping.  An entry's own lock protects its
+   data and covers the disk read that fills it, so that a miss
+   on one sector does not hold up hits on others.  An entry with
+   a nonzero pin count is in use and is never evicted.  No disk
+   access happens under cache_lock: a dirty victim is pinned and
+   written back under its own lock only, and is taken over only
+   if it is still unused and clean afterward.
+
+   cache_readahead() queues a sector for the read-ahead job, which
+   loads it into the cache in the background so that a sequential
+   reader finds it there by the time it gets to it.  Both jobs run
+   on the shared worker threads of threads/work.c.
+
+   The journal holds each metadata sector that a transaction
+   changes with cache_hold() until the transaction is committed.
+   A held entry is pinned, and is not written back even when
+   dirty, so that no uncommitted change reaches its home
+   location. */
+
+/* Number of cached sectors. */
+#define CACHE_SIZE 64
+
+/* Timer ticks between write-behind passes of the flush
+   job. */
+#define CACHE_FLUSH_TICKS (5 * TIMER_FREQ)
+
+/* Maximum number of queued read-ahead requests.  Requests made
+   while the queue is full are dropped. */
+#define READAHEAD_QUEUE_SIZE 64
+
+/* Most sectors that cache_read_multiple() reads with one request.
+   Small next to CACHE_SIZE, since their entries stay pinned until
+   the read is done. */
+#define CACHE_RUN_MAX (CACHE_SIZE / 8)
+
+/* A cached sector. */
+struct cache_entry
+  {
+    struct block *block;        /* Device, or null if entry unused. */
+    block_sector_t sector;      /* Sector on BLOCK. */
+    bool loaded;                /* Data has been read or fully written. */
+    bool dirty;                 /* Data differs from disk. */
+    bool accessed;              /* Used since the clock hand last passed. */
+    bool in_am;                 /* In 2Q's Am queue, not A1in? */
+    int pin_cnt;                /* Number of threads using the entry. */
+    int hold_cnt;               /* Number of cache_hold()s, also pins. */
+    struct lock lock;           /* Protects data, loaded and dirty. */
+    uint8_t *data;              /* BLOCK_SECTOR_SIZE bytes of data. */
+    struct list_elem elem;      /* In free list or a 2Q queue. */
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct lock cache_lock;          /* Protects mapping. */
+static struct wait_queue cache_unpinned; /* Woken when a pin drops. */
+static struct list free_entries;        /* Entries with null block. */
+
+/* A replacement policy.  Each function is called with cache_lock
+   held, on entries that are not on the free list. */
+struct cache_policy
+  {
+    const char *name;
+
+    /* Returns an unpinned entry to evict, or a null pointer if
+       all are pinned.  The entry stays where it is until
+       evict() is called on it. */
+    struct cache_entry *(*victim) (void);
+
+    void (*insert) (struct cache_entry *); /* E now caches a sector. */
+    void (*touch) (struct cache_entry *);  /* E was used. */
+    void (*evict) (struct cache_entry *);  /* E's sector is evicted. */
+    void (*forget) (struct cache_entry *); /* E's sector is dropped. */
+  };
+
+static const struct cache_policy clock_policy, twoq_policy;
+static const struct cache_policy *policy = &clock_policy;
+
+/* A queued read-ahead request. */
+struct readahead_req
+  {
+    struct block *block;        /* Device. */
+    block_sector_t sector;      /* Sector to load. */
+  };
+
+/* Read-ahead queue, a ring buffer protected by readahead_lock. */
+static struct readahead_req readahead_queue[READAHEAD_QUEUE_SIZE];
+static size_t readahead_head;           /* Index of oldest request. */
+static size_t readahead_cnt;            /* Number of requests. */
+static struct lock readahead_lock;
+
+/* Statistics. */
+static long long hit_cnt, miss_cnt, writeback_cnt, readahead_load_cnt;
+static long long ghost_hit_cnt;
+
+/* Background jobs. */
+static struct work flush_work, readahead_work;
+static work_func flush_job, readahead_job;
+
+/* Makes the cache use the replacement policy named NAME, "clock"
+   or "2q".  Returns false if there is no such policy.  Must be
+   called before cache_init(). */
+bool
+cache_select_policy (const char *name)
+{
+  static const struct cache_policy *policies[] =
+    {&clock_policy, &twoq_policy};
+  size_t i;
+
+  for (i = 0; i < sizeof policies / sizeof *policies; i++)
+    if (name != NULL && !strcmp (name, policies[i]->name))
+      {
+        policy = policies[i];
+        return true;
+      }
+  return false;
+}
+
+/* Initializes the buffer cache and starts its flush job. */
+void
+cache_init (void)
+{
+  size_t per_page = PGSIZE / BLOCK_SECTOR_SIZE;
+  uint8_t *page = NULL;
+  size_t i;
+
+  lock_init_adaptive (&cache_lock, "cache");
+  wait_queue_init (&cache_unpinned);
+  list_init (&free_entries);
+  lock_init_named (&readahead_lock, "readahead");
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      if (i % per_page == 0)
+        page = palloc_get_page (PAL_ASSERT);
+      e->block = NULL;
+      e->pin_cnt = e->hold_cnt = 0;
+      e->loaded = e->dirty = e->accessed = false;
+      lock_init_named (&e->lock, "cache-entry");
+      e->data = page + (i % per_page) * BLOCK_SECTOR_SIZE;
+      list_push_back (&free_entries, &e->elem);
+    }
+
+  work_init (&flush_work, flush_job, NULL);
+  work_init (&readahead_work, readahead_job, NULL);
+  work_queue_delayed (&flush_work, CACHE_FLUSH_TICKS);
+}
+
+/* Writes entry E back to disk if it is dirty.  E's lock must be
+   held. */
+static void
+cache_writeback (struct cache_entry *e)
+{
+  ASSERT (lock_held_by_current_thread (&e->lock));
+
+  if (e->dirty)
+    {
+      block_write (e->block, e->sector, e->data);
+      e->dirty = false;
+      writeback_cnt++;
+    }
+}
+
+/* Returns the entry for SECTOR on BLOCK, or a null pointer if
+   it is not cached.  cache_lock must be held. */
+static struct cache_entry *
+cache_lookup (struct block *block, block_sector_t sector)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].block == block && cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Returns the entry for SECTOR on BLOCK, pinned, picking and
+   clearing a victim if it is not cached.  The entry's data may
+   not be loaded yet.  If every entry is in use, waits for one to
+   come free if WAIT is true, and otherwise returns a null
+   pointer. */
+static struct cache_entry *
+cache_get (struct block *block, block_sector_t sector, bool wait)
+{
+  struct cache_entry *e;
+  bool woken = false;
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      /* Already cached?  Then the entry that a wakeup was for
+         goes unused, so pass the wakeup on to the next
+         waiter. */
+      e = cache_lookup (block, sector);
+      if (e != NULL)
+        {
+          e->pin_cnt++;
+          hit_cnt++;
+          if (woken)
+            wait_queue_wake (&cache_unpinned, &cache_lock);
+          lock_release (&cache_lock);
+          return e;
+        }
+
+      if (!list_empty (&free_entries))
+        e = list_entry (list_pop_front (&free_entries),
+                        struct cache_entry, elem);
+      else
+        {
+          e = policy->victim ();
+          if (e == NULL && !wait)
+            {
+              lock_release (&cache_lock);
+              return NULL;
+            }
+          else if (e == NULL)
+            {
+              /* Every entry is in use.  Wait for one to come
+                 free, then look again, since another thread may
+                 have cached SECTOR meanwhile.  The wait is
+                 exclusive, since each unpin frees at most one
+                 entry for one waiter. */
+              wait_queue_wait (&cache_unpinned, &cache_lock, true);
+              woken = true;
+              continue;
+            }
+
+          /* Write a dirty victim back.  The pin keeps anyone else
+             from evicting it meanwhile, and its old sector stays
+             mapped to it, so that nobody reads that sector from
+             disk before the data gets there.  Start over if the
+             entry got used again or SECTOR got cached while
+             cache_lock was released. */
+          if (e->dirty)
+            {
+              e->pin_cnt++;
+              lock_release (&cache_lock);
+              lock_acquire (&e->lock);
+              cache_writeback (e);
+              lock_release (&e->lock);
+              lock_acquire (&cache_lock);
+              if (--e->pin_cnt > 0 || e->dirty
+                  || cache_lookup (block, sector) != NULL)
+                {
+                  if (e->pin_cnt == 0)
+                    wait_queue_wake (&cache_unpinned, &cache_lock);
+                  continue;
+                }
+            }
+          policy->evict (e);
+        }
+
+      e->block = block;
+      e->sector = sector;
+      e->loaded = false;
+      e->pin_cnt = 1;
+      policy->insert (e);
+      miss_cnt++;
+      lock_release (&cache_lock);
+      return e;
+    }
+}
+
+/* Marks entry E used and drops the pin taken by cache_get(). */
+static void
+cache_put (struct cache_entry *e)
+{
+  lock_acquire (&cache_lock);
+  policy->touch (e);
+  if (--e->pin_cnt == 0)
+    wait_queue_wake (&cache_unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Reads SIZE bytes starting at byte OFS of SECTOR on BLOCK into
+   BUFFER. */
+void
+cache_read_at (struct block *block, block_sector_t sector, void *buffer,
+               size_t ofs, size_t size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (block, sector, true);
+  lock_acquire (&e->lock);
+  if (!e->loaded)
+    {
+      block_read (block, sector, e->data);
+      e->loaded = true;
+    }
+  memcpy (buffer, e->data + ofs, size);
+  lock_release (&e->lock);
+  cache_put (e);
+}
+
+/* Reads the SECTOR_CNT consecutive sectors starting at SECTOR on
+   BLOCK into BUFFER.  A sector that is cached is copied out of
+   the cache.  A run of up to CACHE_RUN_MAX that are not is read
+   from disk with a single request straight into BUFFER, and then
+   copied into the cache.  The run's entries are mapped and
+   locked before the read, as cache_read_at() does for one
+   sector, so that nobody else loads them meanwhile, and so that
+   a write to one of them waits and is not lost.
+
+   Only the run's first entry is waited for.  The run ends at the
+   first later entry that would mean waiting, for a free entry or
+   for another thread's lock on it, since that thread may itself
+   be waiting for an entry of this run. */
+void
+cache_read_multiple (struct block *block, block_sector_t sector,
+                     size_t sector_cnt, void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+
+  while (sector_cnt > 0)
+    {
+      struct cache_entry *run[CACHE_RUN_MAX];
+      struct cache_entry *e;
+      size_t cnt, i;
+
+      e = cache_get (block, sector, true);
+      lock_acquire (&e->lock);
+      if (e->loaded)
+        {
+          memcpy (buffer, e->data, BLOCK_SECTOR_SIZE);
+          lock_release (&e->lock);
+          cache_put (e);
+          cnt = 1;
+        }
+      else
+        {
+          run[0] = e;
+          for (cnt = 1; cnt < sector_cnt && cnt < CACHE_RUN_MAX; cnt++)
+            {
+              e = cache_get (block, sector + cnt, false);
+              if (e == NULL)
+                break;
+              if (!lock_try_acquire (&e->lock))
+                {
+                  cache_put (e);
+                  break;
+                }
+              if (e->loaded)
+                {
+                  lock_release (&e->lock);
+                  cache_put (e);
+                  break;
+                }
+              run[cnt] = e;
+            }
+
+          block_read_multiple (block, sector, cnt, buffer);
+          for (i = 0; i < cnt; i++)
+            {
+              memcpy (run[i]->data, buffer + i * BLOCK_SECTOR_SIZE,
+                      BLOCK_SECTOR_SIZE);
+              run[i]->loaded = true;
+              lock_release (&run[i]->lock);
+              cache_put (run[i]);
+            }
+        }
+
+      sector += cnt;
+      buffer += cnt * BLOCK_SECTOR_SIZE;
+      sector_cnt -= cnt;
+    }
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR on BLOCK starting at
+   byte OFS.  The sector is read in first unless the write covers
+   all of it. */
+void
+cache_write_at (struct block *block, block_sector_t sector,
+                const void *buffer, size_t ofs, size_t size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (block, sector, true);
+  lock_acquire (&e->lock);
+  if (!e->loaded)
+    {
+      if (size < BLOCK_SECTOR_SIZE)
+        block_read (block, sector, e->data);
+      e->loaded = true;
+    }
+  memcpy (e->data + ofs, buffer, size);
+  e->dirty = true;
+  lock_release (&e->lock);
+  cache_put (e);
+}
+
+/* Reads SECTOR on BLOCK into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (struct block *block, block_sector_t sector, void *buffer)
+{
+  cache_read_at (block, sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER to SECTOR on
+   BLOCK. */
+void
+cache_write (struct block *block, block_sector_t sector, const void *buffer)
+{
+  cache_write_at (block, sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Asks the read-ahead job to load SECTOR on BLOCK into the
+   cache.  Returns without waiting. */
+void
+cache_readahead (struct block *block, block_sector_t sector)
+{
+  lock_acquire (&readahead_lock);
+  if (readahead_cnt < READAHEAD_QUEUE_SIZE)
+    {
+      struct readahead_req *r
+        = &readahead_queue[(readahead_head + readahead_cnt)
+                           % READAHEAD_QUEUE_SIZE];
+      r->block = block;
+      r->sector = sector;
+      readahead_cnt++;
+    }
+  lock_release (&readahead_lock);
+  work_queue (&readahead_work);
+}
+
+/* Writes SECTOR on BLOCK back if it is cached and dirty, then
+   frees its cache entry for reuse before any other, unless the
+   entry is in use or held. */
+void
+cache_drop (struct block *block, block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = cache_lookup (block, sector);
+  if (e == NULL || e->pin_cnt > 0 || e->hold_cnt > 0)
+    {
+      lock_release (&cache_lock);
+      return;
+    }
+  if (e->dirty)
+    {
+      e->pin_cnt++;
+      lock_release (&cache_lock);
+      lock_acquire (&e->lock);
+      cache_writeback (e);
+      lock_release (&e->lock);
+      lock_acquire (&cache_lock);
+      if (--e->pin_cnt == 0)
+        wait_queue_wake (&cache_unpinned, &cache_lock);
+    }
+  if (e->pin_cnt == 0 && !e->dirty && e->block == block
+      && e->sector == sector)
+    {
+      policy->forget (e);
+      e->block = NULL;
+      list_push_front (&free_entries, &e->elem);
+    }
+  lock_release (&cache_lock);
+}
+
+/* Copies SECTOR_CNT sectors from BUFFER into whichever of the
+   SECTOR_CNT sectors starting at SECTOR on BLOCK are cached, and
+   marks them clean, without caching the others.  For direct I/O,
+   which calls it just before writing BUFFER to those sectors
+   itself, so that the cache stays coherent with the disk and a
+   writeback already under way cannot land after the new data. */
+void
+cache_update (struct block *block, block_sector_t sector,
+              size_t sector_cnt, const void *buffer_)
+{
+  const uint8_t *buffer = buffer_;
+  size_t i;
+
+  for (i = 0; i < sector_cnt; i++)
+    {
+      struct cache_entry *e;
+
+      lock_acquire (&cache_lock);
+      e = cache_lookup (block, sector + i);
+      if (e != NULL)
+        e->pin_cnt++;
+      lock_release (&cache_lock);
+      if (e == NULL)
+        continue;
+
+      lock_acquire (&e->lock);
+      memcpy (e->data, buffer + i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE);
+      e->loaded = true;
+      e->dirty = false;
+      lock_release (&e->lock);
+
+      lock_acquire (&cache_lock);
+      if (--e->pin_cnt == 0)
+        wait_queue_wake (&cache_unpinned, &cache_lock);
+      lock_release (&cache_lock);
+    }
+}
+
+/* Keeps SECTOR on BLOCK in the cache, and keeps it from being
+   written back, until a matching call to cache_unhold(). */
+void
+cache_hold (struct block *block, block_sector_t sector)
+{
+  struct cache_entry *e = cache_get (block, sector, true);
+
+  lock_acquire (&cache_lock);
+  e->hold_cnt++;
+  lock_release (&cache_lock);
+}
+
+/* Releases a hold on SECTOR on BLOCK taken by cache_hold(). */
+void
+cache_unhold (struct block *block, block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = cache_lookup (block, sector);
+  ASSERT (e != NULL && e->hold_cnt > 0);
+  e->hold_cnt--;
+  policy->touch (e);
+  if (--e->pin_cnt == 0)
+    wait_queue_wake (&cache_unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Orders cache entries by device, then by sector number. */
+static int
+compare_entries (const void *a_, const void *b_)
+{
+  const struct cache_entry *a = *(struct cache_entry *const *) a_;
+  const struct cache_entry *b = *(struct cache_entry *const *) b_;
+
+  if (a->block != b->block)
+    return a->block < b->block ? -1 : 1;
+  return a->sector < b->sector ? -1 : a->sector > b->sector;
+}
+
+/* Writes back the dirty entries for sectors FIRST through LAST
+   on BLOCK, or every dirty entry if BLOCK is null, in ascending
+   sector order so that runs of adjacent sectors go to the disk
+   back to back.  Held entries stay dirty. */
+static void
+cache_flush_range (struct block *block, block_sector_t first,
+                   block_sector_t last)
+{
+  struct cache_entry *dirty[CACHE_SIZE];
+  size_t dirty_cnt = 0;
+  size_t i;
+
+  /* Pin the dirty entries so they stay put while we write. */
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      if (e->block != NULL && e->dirty && e->hold_cnt == 0
+          && (block == NULL
+              || (e->block == block
+                  && e->sector >= first && e->sector <= last)))
+        {
+          e->pin_cnt++;
+          dirty[dirty_cnt++] = e;
+        }
+    }
+  lock_release (&cache_lock);
+
+  qsort (dirty, dirty_cnt, sizeof *dirty, compare_entries);
+  for (i = 0; i < dirty_cnt; i++)
+    {
+      lock_acquire (&dirty[i]->lock);
+      cache_writeback (dirty[i]);
+      lock_release (&dirty[i]->lock);
+    }
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < dirty_cnt; i++)
+    if (--dirty[i]->pin_cnt == 0)
+      wait_queue_wake (&cache_unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Writes every dirty entry back to disk. */
+void
+cache_flush (void)
+{
+  cache_flush_range (NULL, 0, 0);
+}
+
+/* Writes back any dirty cached sectors among the SECTOR_CNT
+   sectors starting at SECTOR on BLOCK.  Returns once they are on
+   disk. */
+void
+cache_sync (struct block *block, block_sector_t sector, size_t sector_cnt)
+{
+  ASSERT (block != NULL);
+
+  if (sector_cnt > 0)
+    cache_flush_range (block, sector, sector + sector_cnt - 1);
+}
+
+/* Orders sector numbers in ascending order. */
+static int
+compare_sectors (const void *a_, const void *b_)
+{
+  block_sector_t a = *(const block_sector_t *) a_;
+  block_sector_t b = *(const block_sector_t *) b_;
+
+  return a < b ? -1 : a > b;
+}
+
+/* Stores the numbers of up to MAX sectors of BLOCK that are
+   cached into SECTORS, in ascending order, and returns the number
+   stored. */
+size_t
+cache_list (struct block *block, block_sector_t sectors[], size_t max)
+{
+  size_t cnt = 0;
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE && cnt < max; i++)
+    if (cache[i].block == block && cache[i].loaded)
+      sectors[cnt++] = cache[i].sector;
+  lock_release (&cache_lock);
+
+  qsort (sectors, cnt, sizeof *sectors, compare_sectors);
+  return cnt;
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Cache: %s policy, %lld hits, %lld misses, %lld writebacks, "
+          "%lld read ahead\n", policy->name,
+          hit_cnt, miss_cnt, writeback_cnt, readahead_load_cnt);
+  if (policy == &twoq_policy)
+    printf ("Cache: %lld misses on sectors in A1out\n", ghost_hit_cnt);
+}
+
+/* Clock policy. */
+
+/* Next entry the clock hand looks at. */
+static size_t clock_hand;
+
+/* Runs the clock: two sweeps clear every accessed bit, so an
+   unpinned entry turns up unless all are pinned. */
+static struct cache_entry *
+clock_victim (void)
+{
+  size_t i;
+
+  for (i = 0; i < 2 * CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+
+      clock_hand = (clock_hand + 1) % CACHE_SIZE;
+      if (e->block == NULL || e->pin_cnt > 0)
+        continue;
+      if (!e->accessed)
+        return e;
+      e->accessed = false;
+    }
+  return NULL;
+}
+
+static void
+clock_insert (struct cache_entry *e)
+{
+  e->accessed = false;
+}
+
+static void
+clock_touch (struct cache_entry *e)
+{
+  e->accessed = true;
+}
+
+static void
+clock_forget (struct cache_entry *e UNUSED)
+{
+}
+
+static const struct cache_policy clock_policy =
+  {"clock", clock_victim, clock_insert, clock_touch, clock_forget,
+   clock_forget};
+
+/* 2Q policy. */
+
+/* Entries A1in may take up before its oldest are evicted ahead
+   of Am's, and sectors remembered in A1out, as suggested by
+   Johnson and Shasha. */
+#define A1IN_MAX (CACHE_SIZE / 4)
+#define A1OUT_SIZE (CACHE_SIZE / 2)
+
+static struct clist a1in = CLIST_INITIALIZER (a1in);
+static struct list am = LIST_INITIALIZER (am);
+
+/* A1out, a ring of recently evicted sectors. */
+static struct
+  {
+    struct block *block;
+    block_sector_t sector;
+  }
+a1out[A1OUT_SIZE];
+static size_t a1out_next;
+
+/* Returns the oldest unpinned entry in QUEUE, or a null pointer
+   if there is none. */
+static struct cache_entry *
+twoq_oldest (struct list *queue)
+{
+  struct list_elem *e;
+
+  for (e = list_rbegin (queue); e != list_rend (queue); e = list_prev (e))
+    {
+      struct cache_entry *ce = list_entry (e, struct cache_entry, elem);
+      if (ce->pin_cnt == 0)
+        return ce;
+    }
+  return NULL;
+}
+
+static struct cache_entry *
+twoq_victim (void)
+{
+  struct cache_entry *e = NULL;
+
+  if (clist_size (&a1in) > A1IN_MAX)
+    e = twoq_oldest (clist_list (&a1in));
+  if (e == NULL)
+    e = twoq_oldest (&am);
+  if (e == NULL)
+    e = twoq_oldest (clist_list (&a1in));
+  return e;
+}
+
+/* Puts E in Am if its sector is in A1out, otherwise in A1in. */
+static void
+twoq_insert (struct cache_entry *e)
+{
+  size_t i;
+
+  for (i = 0; i < A1OUT_SIZE; i++)
+    if (a1out[i].block == e->block && a1out[i].sector == e->sector)
+      {
+        a1out[i].block = NULL;
+        ghost_hit_cnt++;
+        e->in_am = true;
+        list_push_front (&am, &e->elem);
+        return;
+      }
+  e->in_am = false;
+  clist_push_front (&a1in, &e->elem);
+}
+
+/* Moves E to the front of Am if it is there.  Uses while in A1in
+   do not count, since they are usually a single access split
+   over several calls. */
+static void
+twoq_touch (struct cache_entry *e)
+{
+  if (e->in_am)
+    {
+      list_remove (&e->elem);
+      list_push_front (&am, &e->elem);
+    }
+}
+
+/* Takes E out of its queue. */
+static void
+twoq_forget (struct cache_entry *e)
+{
+  if (e->in_am)
+    list_remove (&e->elem);
+  else
+    clist_remove (&a1in, &e->elem);
+}
+
+/* Takes E out of its queue, remembering its sector in A1out if
+   it came from A1in. */
+static void
+twoq_evict (struct cache_entry *e)
+{
+  if (!e->in_am)
+    {
+      a1out[a1out_next].block = e->block;
+      a1out[a1out_next].sector = e->sector;
+      a1out_next = (a1out_next + 1) % A1OUT_SIZE;
+    }
+  twoq_forget (e);
+}
+
+static const struct cache_policy twoq_policy =
+  {"2q", twoq_victim, twoq_insert, twoq_touch, twoq_evict, twoq_forget};
+
+/* Writes dirty entries back, then runs again CACHE_FLUSH_TICKS
+   ticks later, so that a crash loses at most that much work. */
+static void
+flush_job (void *aux UNUSED)
+{
+  cache_flush ();
+  work_queue_delayed (&flush_work, CACHE_FLUSH_TICKS);
+}
+
+/* Loads queued read-ahead sectors into the cache, until none are
+   left. */
+static void
+readahead_job (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct readahead_req r;
+      struct cache_entry *e;
+
+      lock_acquire (&readahead_lock);
+      if (readahead_cnt == 0)
+        {
+          lock_release (&readahead_lock);
+          return;
+        }
+      r = readahead_queue[readahead_head];
+      readahead_head = (readahead_head + 1) % READAHEAD_QUEUE_SIZE;
+      readahead_cnt--;
+      lock_release (&readahead_lock);
+
+      /* Skip sectors that are cached already, rather than
+         counting a hit that no reader asked for. */
+      lock_acquire (&cache_lock);
+      e = cache_lookup (r.block, r.sector);
+      lock_release (&cache_lock);
+      if (e != NULL)
+        continue;
+
+      e = cache_get (r.block, r.sector, true);
+      lock_acquire (&e->lock);
+      if (!e->loaded)
+        {
+          block_read (r.block, r.sector, e->data);
+          e->loaded = true;
+          readahead_load_cnt++;
+        }
+      lock_release (&e->lock);
+      cache_put (e);
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+bool cache_select_policy (const char *name);
+void cache_init (void);
+void cache_flush (void);
+void cache_sync (struct block *, block_sector_t, size_t sector_cnt);
+void cache_print_stats (void);
+size_t cache_list (struct block *, block_sector_t sectors[], size_t max);
+
+void cache_read (struct block *, block_sector_t, void *buffer);
+void cache_write (struct block *, block_sector_t, const void *buffer);
+void cache_read_at (struct block *, block_sector_t, void *buffer,
+                    size_t ofs, size_t size);
+void cache_read_multiple (struct block *, block_sector_t, size_t sector_cnt,
+                          void *buffer);
+void cache_write_at (struct block *, block_sector_t, const void *buffer,
+                     size_t ofs, size_t size);
+void cache_readahead (struct block *, block_sector_t);
+void cache_drop (struct block *, block_sector_t);
+void cache_update (struct block *, block_sector_t, size_t sector_cnt,
+                   const void *buffer);
+void cache_hold (struct block *, block_sector_t);
+void cache_unhold (struct block *, block_sector_t);
+
+#endif /* filesys/cache.h */
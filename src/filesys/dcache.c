@@ -0,0 +1,248 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/kmem.h"
+#include "threads/rcu.h"
+#include "threads/synch.h"
+
+/* Directory entry cache.
+
+   Remembers the result of recent directory lookups, keyed by the
+   sector of the directory's inode and the name looked up, so
+   that resolving the same path again needs no directory scan.
+   An entry whose child is 0 is negative: it records that the
+   name does not exist.  Sector 0 holds the free map's inode, so
+   it is never the child of a directory.
+
+   The cache holds at most DCACHE_SIZE entries.  When it is full,
+   an entry is evicted by the clock algorithm: lookups mark the
+   entries they find referenced, and eviction passes over
+   referenced entries, clearing the mark, to the first that is
+   not.  Directory code must call dcache_invalidate() whenever it
+   adds or removes a name, and dcache_invalidate_dir() when a
+   directory may be going away, since its sector could later be
+   reused.
+
+   Every path component goes through dcache_lookup(), so lookups
+   take no lock and write nothing but the referenced mark of the
+   entry they find.  Entries are found through a fixed array of
+   hash chains, which lookups follow within an RCU read-side
+   critical section (see threads/rcu.c).  Insertions and removals
+   are serialized by dcache_lock.  An entry is linked into its
+   chain only once it is filled in, is never changed in place
+   except for its child, and is freed after a grace period once
+   it has been unlinked. */
+
+/* Maximum number of cached entries. */
+#define DCACHE_SIZE 128
+
+/* Number of hash chains. */
+#define DCACHE_BUCKETS 64
+
+/* A cached lookup result. */
+struct dentry
+  {
+    struct dentry *next;                /* Next in chain. */
+    struct list_elem clock_elem;        /* Element in clock_list. */
+    struct rcu_head rcu;                /* For freeing. */
+    block_sector_t parent;              /* Directory inode sector. */
+    block_sector_t child;               /* Inode sector of NAME, or 0. */
+    bool referenced;                    /* Found since the clock
+                                           hand passed? */
+    char name[NAME_MAX + 1];            /* Name looked up. */
+  };
+
+static struct dentry *buckets[DCACHE_BUCKETS]; /* Hash chains. */
+static struct list clock_list;          /* All entries, oldest at
+                                           the back. */
+static size_t dentry_cnt;               /* Number of entries. */
+static struct lock dcache_lock;         /* Serializes writers. */
+static struct kmem_cache *dentry_cache; /* Allocates entries. */
+
+static rcu_func free_dentry;
+
+/* Initializes the directory entry cache. */
+void
+dcache_init (void)
+{
+  list_init (&clock_list);
+  lock_init_named (&dcache_lock, "dcache");
+  dentry_cache = kmem_cache_create ("dentry", sizeof (struct dentry), 0,
+                                    NULL, NULL);
+  if (dentry_cache == NULL)
+    PANIC ("Can't create dentry cache.");
+}
+
+/* Returns the chain for NAME in the directory at PARENT. */
+static struct dentry **
+bucket (block_sector_t parent, const char *name)
+{
+  return &buckets[(hash_string (name) ^ hash_int (parent))
+                  % DCACHE_BUCKETS];
+}
+
+/* Returns the entry for NAME in the directory at PARENT, or a
+   null pointer if there is none.  The caller must hold
+   dcache_lock or be in an RCU read-side critical section. */
+static struct dentry *
+find (block_sector_t parent, const char *name)
+{
+  struct dentry *d;
+
+  for (d = rcu_dereference (*bucket (parent, name)); d != NULL;
+       d = rcu_dereference (d->next))
+    if (d->parent == parent && !strcmp (d->name, name))
+      return d;
+  return NULL;
+}
+
+/* Looks up NAME in the directory whose inode is at PARENT.
+   Returns true and stores the child's inode sector in *CHILD if
+   the result is cached, where 0 means that NAME does not exist.
+   Returns false if the cache knows nothing about NAME. */
+bool
+dcache_lookup (block_sector_t parent, const char *name,
+               block_sector_t *child)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return false;
+
+  rcu_read_lock ();
+  d = find (parent, name);
+  if (d != NULL)
+    {
+      d->referenced = true;
+      *child = d->child;
+    }
+  rcu_read_unlock ();
+
+  return d != NULL;
+}
+
+/* Unlinks entry D from the cache and frees it once no lookup
+   can be looking at it.  dcache_lock must be held. */
+static void
+discard (struct dentry *d)
+{
+  struct dentry **dp;
+
+  ASSERT (lock_held_by_current_thread (&dcache_lock));
+
+  for (dp = bucket (d->parent, d->name); *dp != d; dp = &(*dp)->next)
+    ASSERT (*dp != NULL);
+  rcu_assign_pointer (*dp, d->next);
+  list_remove (&d->clock_elem);
+  dentry_cnt--;
+  call_rcu (&d->rcu, free_dentry);
+}
+
+/* Discards an entry that has not been found since the clock hand
+   last passed it.  dcache_lock must be held. */
+static void
+evict (void)
+{
+  for (;;)
+    {
+      struct dentry *d = list_entry (list_back (&clock_list),
+                                     struct dentry, clock_elem);
+      if (!d->referenced)
+        {
+          discard (d);
+          return;
+        }
+      d->referenced = false;
+      list_remove (&d->clock_elem);
+      list_push_front (&clock_list, &d->clock_elem);
+    }
+}
+
+/* Records that NAME in the directory at PARENT refers to the
+   inode at CHILD, or does not exist if CHILD is 0. */
+void
+dcache_insert (block_sector_t parent, const char *name,
+               block_sector_t child)
+{
+  struct dentry **chain;
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = find (parent, name);
+  if (d != NULL)
+    {
+      d->child = child;
+      d->referenced = true;
+      lock_release (&dcache_lock);
+      return;
+    }
+
+  if (dentry_cnt >= DCACHE_SIZE)
+    evict ();
+  d = kmem_cache_alloc (dentry_cache);
+  if (d == NULL)
+    {
+      lock_release (&dcache_lock);
+      return;
+    }
+  d->parent = parent;
+  d->child = child;
+  d->referenced = false;
+  strlcpy (d->name, name, sizeof d->name);
+
+  chain = bucket (parent, name);
+  d->next = *chain;
+  rcu_assign_pointer (*chain, d);
+  list_push_front (&clock_list, &d->clock_elem);
+  dentry_cnt++;
+  lock_release (&dcache_lock);
+}
+
+/* Forgets anything cached about NAME in the directory at
+   PARENT. */
+void
+dcache_invalidate (block_sector_t parent, const char *name)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = find (parent, name);
+  if (d != NULL)
+    discard (d);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets every entry for names in the directory at DIR. */
+void
+dcache_invalidate_dir (block_sector_t dir)
+{
+  struct list_elem *e, *next;
+
+  lock_acquire (&dcache_lock);
+  for (e = list_begin (&clock_list); e != list_end (&clock_list); e = next)
+    {
+      struct dentry *d = list_entry (e, struct dentry, clock_elem);
+
+      next = list_next (e);
+      if (d->parent == dir)
+        discard (d);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Frees the entry containing HEAD, once a grace period has
+   passed since it was discarded. */
+static void
+free_dentry (struct rcu_head *head)
+{
+  kmem_cache_free (dentry_cache, rcu_entry (head, struct dentry, rcu));
+}
@@ -2,8 +2,11 @@
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/kmem.h"
 #include "threads/malloc.h"
 
 /* A directory. */
@@ -21,12 +24,134 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
-/* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+/* Directories come in two formats, told apart by the
+   INODE_DIR_HASHED inode flag.
+
+   A linear directory is an array of dir_entry structures that is
+   searched from the start.
+
+   A hashed directory is an array of one-sector buckets.  A name
+   belongs in bucket name_hash(NAME) % BUCKET_CNT.  Each bucket
+   starts with a header followed by ENTRIES_PER_BUCKET entries.
+   When a bucket is full, dir_add() sets its overflow flag and
+   probes the following buckets, and lookups follow the same
+   path, so a lookup only goes past a bucket whose overflow flag
+   is set.  Removing an entry leaves the flag set.  The directory
+   file is sparse, so buckets that were never used take no disk
+   space.
+
+   Lookups that miss the directory entry cache, dir_add(),
+   dir_remove() and dir_readdir() hold the directory inode's
+   lock (see inode_lock()), so that two threads cannot add the
+   same name or take the same free slot, and so that an entry
+   read from disk is not put in the cache after a concurrent
+   change has invalidated it there.  Directories thus serialize
+   only with themselves.
+
+   dir_add() checks that the name is unused and finds a free slot
+   in a single pass, reading a sector's worth of entries at a
+   time, and skips the check altogether when the directory entry
+   cache already knows whether the name exists.  In a linear
+   directory, where the pass would otherwise run to the end, it
+   also uses hints kept in the directory's in-memory inode (see
+   inode_dir_hint()): the offset before which no entry is free,
+   which lets an add of a name known to be unused start there, and
+   the number of entries in use, learned from a pass that reaches
+   the end, which lets a pass stop once it has seen them all.
+   dir_add() and dir_remove() keep both up to date. */
+
+/* Header of a hashed directory bucket. */
+struct dir_bucket
+  {
+    uint32_t overflowed;                /* Ever been full on dir_add()? */
+  };
+
+/* Number of entries in a hashed directory bucket. */
+#define ENTRIES_PER_BUCKET                                  \
+  ((BLOCK_SECTOR_SIZE - sizeof (struct dir_bucket))         \
+   / sizeof (struct dir_entry))
+
+/* Minimum number of buckets in a hashed directory. */
+#define MIN_BUCKET_CNT 64
+
+/* Fowler-Noll-Vo hash constants, for 32-bit word sizes. */
+#define FNV_32_PRIME 16777619u
+#define FNV_32_BASIS 2166136261u
+
+/* Returns the hash that places NAME in a hashed directory.  This
+   is part of the on-disk format, so it stays the FNV-1 hash that
+   hash_string() originally computed, whatever hash_string() does
+   now. */
+static unsigned
+name_hash (const char *name_)
+{
+  const unsigned char *name = (const unsigned char *) name_;
+  unsigned hash = FNV_32_BASIS;
+
+  while (*name != '\0')
+    hash = (hash * FNV_32_PRIME) ^ *name++;
+  return hash;
+}
+
+/* Caches for open directories, and for the buckets that
+   dir_readdir_batch() reads. */
+static struct kmem_cache *dir_cache;
+static struct kmem_cache *bucket_cache;
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  dir_cache = kmem_cache_create ("dir", sizeof (struct dir), 0, NULL, NULL);
+  bucket_cache = kmem_cache_create ("dir-bucket", BLOCK_SECTOR_SIZE, 0,
+                                    NULL, NULL);
+  if (dir_cache == NULL || bucket_cache == NULL)
+    PANIC ("Can't create directory cache.");
+}
+
+/* Creates a hashed directory with space for at least ENTRY_CNT
+   entries in the given SECTOR.  Returns true if successful,
+   false on failure. */
 bool
 dir_create (block_sector_t sector, size_t entry_cnt)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  size_t bucket_cnt = DIV_ROUND_UP (entry_cnt, ENTRIES_PER_BUCKET);
+
+  if (bucket_cnt < MIN_BUCKET_CNT)
+    bucket_cnt = MIN_BUCKET_CNT;
+  return inode_create (sector, bucket_cnt * BLOCK_SECTOR_SIZE,
+                       INODE_DIR | INODE_DIR_HASHED | INODE_METADATA);
+}
+
+/* Returns true if DIR is in the hashed format. */
+static bool
+is_hashed (const struct dir *dir)
+{
+  return (inode_flags (dir->inode) & INODE_DIR_HASHED) != 0;
+}
+
+/* Returns the number of buckets in hashed directory DIR. */
+static size_t
+bucket_cnt (const struct dir *dir)
+{
+  return inode_length (dir->inode) / BLOCK_SECTOR_SIZE;
+}
+
+/* Returns the byte offset of entry IDX in bucket BUCKET. */
+static off_t
+bucket_entry_ofs (size_t bucket, size_t idx)
+{
+  return (bucket * BLOCK_SECTOR_SIZE + sizeof (struct dir_bucket)
+          + idx * sizeof (struct dir_entry));
+}
+
+/* Reads the header of bucket BUCKET of DIR into *B.  Returns
+   true if successful. */
+static bool
+read_bucket (const struct dir *dir, size_t bucket, struct dir_bucket *b)
+{
+  return inode_read_at (dir->inode, b, sizeof *b,
+                        bucket * BLOCK_SECTOR_SIZE) == sizeof *b;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -34,7 +159,7 @@ dir_create (block_sector_t sector, size_t entry_cnt)
 struct dir *
 dir_open (struct inode *inode) 
 {
-  struct dir *dir = calloc (1, sizeof *dir);
+  struct dir *dir = kmem_cache_alloc (dir_cache);
   if (inode != NULL && dir != NULL)
     {
       dir->inode = inode;
@@ -44,7 +169,7 @@ dir_open (struct inode *inode)
   else
     {
       inode_close (inode);
-      free (dir);
+      kmem_cache_free (dir_cache, dir);
       return NULL; 
     }
 }
@@ -72,7 +197,7 @@ dir_close (struct dir *dir)
   if (dir != NULL)
     {
       inode_close (dir->inode);
-      free (dir);
+      kmem_cache_free (dir_cache, dir);
     }
 }
 
@@ -98,6 +223,37 @@ lookup (const struct dir *dir, const char *name,
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  if (is_hashed (dir))
+    {
+      size_t cnt = bucket_cnt (dir);
+      size_t first = name_hash (name) % cnt;
+      size_t n, i;
+
+      for (n = 0; n < cnt; n++)
+        {
+          size_t bucket = (first + n) % cnt;
+          struct dir_bucket b;
+
+          for (i = 0; i < ENTRIES_PER_BUCKET; i++)
+            {
+              ofs = bucket_entry_ofs (bucket, i);
+              if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+                return false;
+              if (e.in_use && !strcmp (name, e.name))
+                {
+                  if (ep != NULL)
+                    *ep = e;
+                  if (ofsp != NULL)
+                    *ofsp = ofs;
+                  return true;
+                }
+            }
+          if (!read_bucket (dir, bucket, &b) || !b.overflowed)
+            break;
+        }
+      return false;
+    }
+
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
     if (e.in_use && !strcmp (name, e.name)) 
@@ -120,18 +276,142 @@ dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
   struct dir_entry e;
+  block_sector_t parent, child;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  parent = inode_get_inumber (dir->inode);
+  if (!dcache_lookup (parent, name, &child))
+    {
+      inode_lock (dir->inode);
+      child = lookup (dir, name, &e, NULL) ? e.inode_sector : 0;
+      dcache_insert (parent, name, child);
+      inode_unlock (dir->inode);
+    }
 
+  *inode = child != 0 ? inode_open (child) : NULL;
   return *inode != NULL;
 }
 
+/* Checks that NAME is not in hashed directory DIR, unless ABSENT
+   says that it is known not to be, and finds the first free slot
+   along NAME's probe sequence, in one pass over the sequence's
+   buckets, each read whole into BUF, a sector-sized buffer.
+   Stores the slot's byte offset in *OFSP.  Sets the overflow
+   flag of each full bucket before the slot.  Returns true if
+   successful, false if NAME is in DIR, DIR is full, or a disk
+   error occurs. */
+static bool
+find_hashed_slot (struct dir *dir, const char *name, bool absent,
+                  void *buf, off_t *ofsp)
+{
+  struct dir_bucket *b = buf;
+  struct dir_entry *entries = (struct dir_entry *) (b + 1);
+  size_t cnt = bucket_cnt (dir);
+  size_t first = name_hash (name) % cnt;
+  bool found = false;
+  size_t n, i;
+
+  for (n = 0; n < cnt; n++)
+    {
+      size_t bucket = (first + n) % cnt;
+
+      if (inode_read_at (dir->inode, buf, BLOCK_SECTOR_SIZE,
+                         bucket * BLOCK_SECTOR_SIZE) != BLOCK_SECTOR_SIZE)
+        return false;
+      for (i = 0; i < ENTRIES_PER_BUCKET; i++)
+        if (!entries[i].in_use)
+          {
+            if (!found)
+              *ofsp = bucket_entry_ofs (bucket, i);
+            found = true;
+          }
+        else if (!absent && !strcmp (name, entries[i].name))
+          return false;
+
+      /* Lookups of NAME go no further than a bucket that has never
+         overflowed. */
+      if (!b->overflowed)
+        absent = true;
+      if (found && absent)
+        return true;
+      if (!found && !b->overflowed)
+        {
+          b->overflowed = true;
+          if (inode_write_at (dir->inode, b, sizeof *b,
+                              bucket * BLOCK_SECTOR_SIZE) != sizeof *b)
+            return false;
+        }
+    }
+  return found;
+}
+
+/* Checks that NAME is not in linear directory DIR, unless ABSENT
+   says that it is known not to be, and finds its first free
+   slot, or the end of the file if none is free, in one pass,
+   reading ENTRIES_PER_BUCKET entries at a time into BUF, a
+   sector-sized buffer.  Stores the slot's byte offset in *OFSP.
+   Returns true if successful, false if NAME is in DIR or a disk
+   error occurs. */
+static bool
+find_linear_slot (struct dir *dir, const char *name, bool absent,
+                  void *buf, off_t *ofsp)
+{
+  struct inode_dir_hint *hint = inode_dir_hint (dir->inode);
+  struct dir_entry *entries = buf;
+  off_t start = absent ? hint->free_ofs : 0;
+  int seen = 0;
+  bool found = false;
+
+  for (;;)
+    {
+      size_t cnt, i;
+
+      /* inode_read_at() will only return a short read at end of
+         file.  Otherwise, we'd need to verify that we didn't get
+         a short read due to something intermittent such as low
+         memory. */
+      cnt = inode_read_at (dir->inode, entries,
+                           ENTRIES_PER_BUCKET * sizeof *entries,
+                           start) / sizeof *entries;
+      for (i = 0; i < cnt; i++)
+        if (!entries[i].in_use)
+          {
+            if (!found)
+              *ofsp = start + i * sizeof *entries;
+            found = true;
+          }
+        else
+          {
+            seen++;
+            if (!absent && !strcmp (name, entries[i].name))
+              return false;
+          }
+      start += cnt * sizeof *entries;
+
+      if (cnt < ENTRIES_PER_BUCKET)
+        {
+          /* End of file.  A pass from the start has counted every
+             entry. */
+          if (!found)
+            *ofsp = start;
+          if (!absent)
+            hint->entry_cnt = seen;
+          return true;
+        }
+      if (!absent && hint->entry_cnt >= 0 && seen >= hint->entry_cnt)
+        {
+          /* Every entry from here on is free. */
+          if (!found)
+            *ofsp = start;
+          return true;
+        }
+      if (found && absent)
+        return true;
+    }
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
@@ -141,8 +421,12 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  struct inode_dir_hint *hint;
   struct dir_entry e;
-  off_t ofs;
+  block_sector_t child;
+  void *buf;
+  bool absent;
+  off_t ofs = 0;
   bool success = false;
 
   ASSERT (dir != NULL);
@@ -152,29 +436,40 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
-    goto done;
+  buf = kmem_cache_alloc (bucket_cache);
+  if (buf == NULL)
+    return false;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  /* Find a free slot, checking on the way that NAME is not in
+     use, unless the entry cache knows. */
+  inode_lock (dir->inode);
+  hint = inode_dir_hint (dir->inode);
+  absent = dcache_lookup (inode_get_inumber (dir->inode), name, &child);
+  if (absent && child != 0)
+    goto done;
+  if (is_hashed (dir)
+      ? !find_hashed_slot (dir, name, absent, buf, &ofs)
+      : !find_linear_slot (dir, name, absent, buf, &ofs))
+    goto done;
 
   /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
+  if (success)
+    {
+      /* OFS was the first free slot, in a linear directory. */
+      if (!is_hashed (dir))
+        hint->free_ofs = ofs + sizeof e;
+      if (hint->entry_cnt >= 0)
+        hint->entry_cnt++;
+    }
 
  done:
+  inode_unlock (dir->inode);
+  kmem_cache_free (bucket_cache, buf);
   return success;
 }
 
@@ -184,6 +479,7 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
+  struct inode_dir_hint *hint;
   struct dir_entry e;
   struct inode *inode = NULL;
   bool success = false;
@@ -193,6 +489,7 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (name != NULL);
 
   /* Find directory entry. */
+  inode_lock (dir->inode);
   if (!lookup (dir, name, &e, &ofs))
     goto done;
 
@@ -201,16 +498,26 @@ dir_remove (struct dir *dir, const char *name)
   if (inode == NULL)
     goto done;
 
-  /* Erase directory entry. */
+  /* Erase directory entry.  The removed inode may be a
+     directory whose sector gets reused, so forget its entries
+     too. */
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
+  dcache_invalidate_dir (e.inode_sector);
+  hint = inode_dir_hint (dir->inode);
+  if (ofs < hint->free_ofs)
+    hint->free_ofs = ofs;
+  if (hint->entry_cnt > 0)
+    hint->entry_cnt--;
 
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  inode_unlock (dir->inode);
   inode_close (inode);
   return success;
 }
@@ -221,16 +528,135 @@ dir_remove (struct dir *dir, const char *name)
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
-  struct dir_entry e;
+  struct dir_record r;
+
+  if (dir_readdir_batch (dir, &r, 1) == 0)
+    return false;
+  strlcpy (name, r.name, NAME_MAX + 1);
+  return true;
+}
+
+/* Reads up to CNT entries in use from DIR into RECORDS, going on
+   from where the last read stopped, and returns the number
+   read, which is 0 at the end of DIR.  Each inode_read_at()
+   takes a whole bucket or, in a linear directory, as many
+   entries as a bucket holds, instead of a single entry. */
+size_t
+dir_readdir_batch (struct dir *dir, struct dir_record *records,
+                   size_t cnt)
+{
+  struct dir_entry *entries;
+  size_t done = 0;
+
+  entries = kmem_cache_alloc (bucket_cache);
+  if (entries == NULL)
+    return 0;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  inode_lock (dir->inode);
+  while (done < cnt)
     {
-      dir->pos += sizeof e;
-      if (e.in_use)
+      off_t start = dir->pos;
+      size_t entry_cnt, i;
+
+      /* In a hashed directory, start at the first entry of the
+         bucket that DIR->pos is in, past its header, and skip
+         over the slack at the end of each bucket. */
+      if (is_hashed (dir))
         {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
-        } 
+          off_t sector_ofs = dir->pos % BLOCK_SECTOR_SIZE;
+
+          if (sector_ofs >= bucket_entry_ofs (0, ENTRIES_PER_BUCKET))
+            {
+              dir->pos += BLOCK_SECTOR_SIZE - sector_ofs;
+              continue;
+            }
+          start = dir->pos - sector_ofs + sizeof (struct dir_bucket);
+          if (dir->pos < start)
+            dir->pos = start;
+        }
+
+      entry_cnt = inode_read_at (dir->inode, entries,
+                                 ENTRIES_PER_BUCKET * sizeof *entries,
+                                 start) / sizeof *entries;
+      for (i = (dir->pos - start) / sizeof *entries;
+           i < entry_cnt && done < cnt; i++)
+        {
+          dir->pos = start + (i + 1) * sizeof *entries;
+          if (entries[i].in_use)
+            {
+              records[done].inode_sector = entries[i].inode_sector;
+              strlcpy (records[done].name, entries[i].name,
+                       sizeof records[done].name);
+              done++;
+            }
+        }
+      if (entry_cnt < ENTRIES_PER_BUCKET)
+        break;
     }
-  return false;
+  inode_unlock (dir->inode);
+
+  kmem_cache_free (bucket_cache, entries);
+  return done;
+}
+
+/* Reads up to CNT entries in use from DIR into RECORDS, as
+   dir_readdir_batch() does, along with the length of each one's
+   inode and whether it is a directory, and returns the number
+   read.  The inodes of all the entries read are brought into the
+   buffer cache together, in order of sector, before any of them
+   is looked at.  Returns -1 if memory allocation fails. */
+int
+dir_readdir_stat (struct dir *dir, struct dir_stat_record *records,
+                  size_t cnt)
+{
+  struct dir_record *batch;
+  block_sector_t *sectors;
+  size_t done, i;
+
+  if (cnt == 0)
+    return 0;
+  batch = malloc (cnt * sizeof *batch);
+  sectors = malloc (cnt * sizeof *sectors);
+  if (batch == NULL || sectors == NULL)
+    {
+      free (batch);
+      free (sectors);
+      return -1;
+    }
+
+  done = dir_readdir_batch (dir, batch, cnt);
+  for (i = 0; i < done; i++)
+    sectors[i] = batch[i].inode_sector;
+  inode_prefetch (sectors, done);
+
+  for (i = 0; i < done; i++)
+    {
+      struct dir_stat_record *r = &records[i];
+      unsigned flags;
+
+      r->inode_sector = batch[i].inode_sector;
+      inode_stat (r->inode_sector, &r->length, &flags);
+      r->is_dir = (flags & INODE_DIR) != 0;
+      strlcpy (r->name, batch[i].name, sizeof r->name);
+    }
+
+  free (batch);
+  free (sectors);
+  return done;
+}
+
+/* Sets the position from which DIR's entries are next read to
+   POS, which should come from dir_tell(). */
+void
+dir_seek (struct dir *dir, off_t pos)
+{
+  ASSERT (pos >= 0);
+  dir->pos = pos;
+}
+
+/* Returns the position from which DIR's entries are next read. */
+off_t
+dir_tell (const struct dir *dir)
+{
+  return dir->pos;
 }
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include "devices/block.h"
+#include "filesys/off_t.h"
 
 /* Maximum length of a file name component.
    This is the traditional UNIX maximum length.
@@ -13,6 +14,27 @@
 
 struct inode;
 
+/* An entry in use, as read by dir_readdir_batch().  Matches
+   `struct dirent' in lib/user/syscall.h. */
+struct dir_record
+  {
+    block_sector_t inode_sector;        /* Sector number of header. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+  };
+
+/* An entry in use with facts about its inode, as read by
+   dir_readdir_stat().  Matches `struct dirent_stat' in
+   lib/user/syscall.h. */
+struct dir_stat_record
+  {
+    block_sector_t inode_sector;        /* Sector number of header. */
+    off_t length;                       /* Inode's length in bytes. */
+    bool is_dir;                        /* Is it a directory? */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+  };
+
+void dir_init (void);
+
 /* Opening and closing directories. */
 bool dir_create (block_sector_t sector, size_t entry_cnt);
 struct dir *dir_open (struct inode *);
@@ -26,5 +48,9 @@ bool dir_lookup (const struct dir *, const char *name, struct inode **);
 bool dir_add (struct dir *, const char *name, block_sector_t);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+size_t dir_readdir_batch (struct dir *, struct dir_record *, size_t cnt);
+int dir_readdir_stat (struct dir *, struct dir_stat_record *, size_t cnt);
+void dir_seek (struct dir *, off_t);
+off_t dir_tell (const struct dir *);
 
 #endif /* filesys/directory.h */
@@ -1,44 +1,119 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include "devices/block.h"
 #include "filesys/inode.h"
-#include "threads/malloc.h"
+#include "filesys/pipe.h"
+#include "threads/kmem.h"
 
-/* An open file. */
+/* Read-ahead window, in sectors.  The window opens at
+   READAHEAD_MIN sectors when file_read() continues where the
+   previous read stopped, doubles with each further sequential
+   read up to READAHEAD_MAX, and closes after a read from
+   anywhere else.  After FADV_SEQUENTIAL advice the window stays
+   at READAHEAD_MAX whatever the reads do, and after FADV_RANDOM
+   it stays closed. */
+#define READAHEAD_MIN 4
+#define READAHEAD_MAX 32
+
+/* An open file, or an end of a pipe, if INODE is null. */
 struct file 
   {
-    struct inode *inode;        /* File's inode. */
+    struct inode *inode;        /* File's inode, or null. */
+    struct pipe *pipe;          /* Pipe, if INODE is null. */
+    bool writer;                /* Write end of PIPE? */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    bool direct;                /* Bypass the buffer cache? */
+    enum file_advice advice;    /* FADV_NORMAL, _SEQUENTIAL or _RANDOM. */
+    off_t ra_next;              /* Position a sequential read starts at. */
+    off_t ra_end;               /* End of bytes already read ahead. */
+    int ra_window;              /* Read-ahead window in sectors. */
   };
 
+/* Cache for open files. */
+static struct kmem_cache *file_cache;
+
+/* Initializes the file module. */
+void
+file_init (void)
+{
+  file_cache = kmem_cache_create ("file", sizeof (struct file), 0,
+                                  NULL, NULL);
+  if (file_cache == NULL)
+    PANIC ("Can't create file cache.");
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
 struct file *
 file_open (struct inode *inode) 
 {
-  struct file *file = calloc (1, sizeof *file);
+  struct file *file = kmem_cache_alloc (file_cache);
   if (inode != NULL && file != NULL)
     {
       file->inode = inode;
+      file->pipe = NULL;
+      file->writer = false;
       file->pos = 0;
       file->deny_write = false;
+      file->direct = false;
+      file->advice = FADV_NORMAL;
+      file->ra_next = 0;
+      file->ra_end = 0;
+      file->ra_window = 0;
       return file;
     }
   else
     {
       inode_close (inode);
-      free (file);
+      kmem_cache_free (file_cache, file);
       return NULL; 
     }
 }
 
-/* Opens and returns a new file for the same inode as FILE.
-   Returns a null pointer if unsuccessful. */
+/* Returns a new file for the write end of PIPE if WRITER, for
+   its read end otherwise, taking over a reference to that end
+   that the caller has already counted with pipe_reopen() or
+   pipe_create().  Returns a null pointer if an allocation
+   fails, in which case the caller still has the reference. */
+struct file *
+file_open_pipe (struct pipe *pipe, bool writer)
+{
+  struct file *file = kmem_cache_alloc (file_cache);
+
+  if (file != NULL)
+    {
+      file->inode = NULL;
+      file->pipe = pipe;
+      file->writer = writer;
+      file->pos = 0;
+      file->deny_write = false;
+      file->direct = false;
+      file->advice = FADV_NORMAL;
+      file->ra_next = 0;
+      file->ra_end = 0;
+      file->ra_window = 0;
+    }
+  return file;
+}
+
+/* Opens and returns a new file for the same inode, or the same
+   end of the same pipe, as FILE.  Returns a null pointer if
+   unsuccessful. */
 struct file *
 file_reopen (struct file *file) 
 {
-  return file_open (inode_reopen (file->inode));
+  struct file *new;
+
+  if (file->pipe == NULL)
+    return file_open (inode_reopen (file->inode));
+
+  pipe_reopen (file->pipe, file->writer);
+  new = file_open_pipe (file->pipe, file->writer);
+  if (new == NULL)
+    pipe_close (file->pipe, file->writer);
+  return new;
 }
 
 /* Closes FILE. */
@@ -47,29 +122,166 @@ file_close (struct file *file)
 {
   if (file != NULL)
     {
-      file_allow_write (file);
-      inode_close (file->inode);
-      free (file); 
+      if (file->pipe != NULL)
+        pipe_close (file->pipe, file->writer);
+      else
+        {
+          file_allow_write (file);
+          inode_close (file->inode);
+        }
+      kmem_cache_free (file_cache, file);
     }
 }
 
-/* Returns the inode encapsulated by FILE. */
+/* Returns true if FILE is an end of a pipe. */
+bool
+file_is_pipe (struct file *file)
+{
+  return file->pipe != NULL;
+}
+
+/* Returns the inode encapsulated by FILE, or a null pointer if
+   FILE is an end of a pipe. */
 struct inode *
 file_get_inode (struct file *file) 
 {
   return file->inode;
 }
 
+/* Turns direct I/O for FILE on if DIRECT is true, off otherwise.
+   With direct I/O, FILE's reads and writes move whole sectors
+   between the caller's buffer and the disk without going through
+   the buffer cache and without read-ahead (see
+   inode_read_direct()). */
+void
+file_set_direct (struct file *file, bool direct)
+{
+  ASSERT (file != NULL);
+  file->direct = direct;
+}
+
+/* Applies ADVICE about how FILE will be accessed, for the SIZE
+   bytes starting at OFFSET where that matters.  FADV_NORMAL,
+   FADV_SEQUENTIAL and FADV_RANDOM set FILE's read-ahead policy
+   for the whole file.  FADV_WILLNEED starts reading the range
+   into the buffer cache in the background, and FADV_DONTNEED
+   writes the range's cached sectors back and drops them from the
+   cache. */
+void
+file_advise (struct file *file, off_t offset, off_t size,
+             enum file_advice advice)
+{
+  ASSERT (file != NULL);
+  ASSERT (offset >= 0 && size >= 0);
+
+  if (file->pipe != NULL)
+    return;
+  switch (advice)
+    {
+    case FADV_NORMAL:
+    case FADV_SEQUENTIAL:
+    case FADV_RANDOM:
+      file->advice = advice;
+      file->ra_window = 0;
+      break;
+    case FADV_WILLNEED:
+      inode_readahead (file->inode, offset, size);
+      break;
+    case FADV_DONTNEED:
+      inode_drop (file->inode, offset, size);
+      break;
+    }
+}
+
+/* Reads SIZE bytes from FILE into BUFFER at FILE_OFS, directly if
+   FILE is set up for direct I/O.  A pipe has no offsets, so
+   reading one at an offset reads nothing. */
+static off_t
+read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
+{
+  if (file->pipe != NULL)
+    return 0;
+  return (file->direct
+          ? inode_read_direct (file->inode, buffer, size, file_ofs)
+          : inode_read_at (file->inode, buffer, size, file_ofs));
+}
+
+/* Writes SIZE bytes from BUFFER into FILE at FILE_OFS, directly
+   if FILE is set up for direct I/O.  Writing a pipe at an offset
+   writes nothing. */
+static off_t
+write_at (struct file *file, const void *buffer, off_t size,
+          off_t file_ofs)
+{
+  if (file->pipe != NULL)
+    return 0;
+  return (file->direct
+          ? inode_write_direct (file->inode, buffer, size, file_ofs)
+          : inode_write_at (file->inode, buffer, size, file_ofs));
+}
+
+/* Updates FILE's read-ahead window after a read that started at
+   START and left FILE's position just past the bytes read, and
+   queues read-ahead for the sectors the window covers beyond
+   that position. */
+static void
+file_readahead (struct file *file, off_t start)
+{
+  off_t end;
+
+  if (file->advice == FADV_RANDOM)
+    return;
+  if (file->advice == FADV_SEQUENTIAL)
+    file->ra_window = READAHEAD_MAX;
+  else if (start == file->ra_next)
+    {
+      file->ra_window *= 2;
+      if (file->ra_window < READAHEAD_MIN)
+        file->ra_window = READAHEAD_MIN;
+      if (file->ra_window > READAHEAD_MAX)
+        file->ra_window = READAHEAD_MAX;
+    }
+  else
+    {
+      file->ra_window = 0;
+      file->ra_end = file->pos;
+      return;
+    }
+
+  end = file->pos + file->ra_window * BLOCK_SECTOR_SIZE;
+  if (file->ra_end < file->pos)
+    file->ra_end = file->pos;
+  if (end > file->ra_end)
+    {
+      inode_readahead (file->inode, file->ra_end, end - file->ra_end);
+      file->ra_end = end;
+    }
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at the file's current position.
    Returns the number of bytes actually read,
    which may be less than SIZE if end of file is reached.
-   Advances FILE's position by the number of bytes read. */
+   Advances FILE's position by the number of bytes read.
+
+   For the read end of a pipe, waits until there is something to
+   read and returns what there is, or 0 at end of file.  Reading
+   the write end returns 0. */
 off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
-  off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  off_t start = file->pos;
+  off_t bytes_read;
+
+  if (file->pipe != NULL)
+    return file->writer ? 0 : pipe_read (file->pipe, buffer, size);
+
+  bytes_read = read_at (file, buffer, size, start);
+
   file->pos += bytes_read;
+  if (!file->direct)
+    file_readahead (file, start);
+  file->ra_next = file->pos;
   return bytes_read;
 }
 
@@ -81,7 +293,7 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) 
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  return read_at (file, buffer, size, file_ofs);
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
@@ -90,11 +302,20 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
    which may be less than SIZE if end of file is reached.
    (Normally we'd grow the file in that case, but file growth is
    not yet implemented.)
-   Advances FILE's position by the number of bytes read. */
+   Advances FILE's position by the number of bytes read.
+
+   For the write end of a pipe, waits for room for all of BUFFER,
+   writing less only if the read end is closed.  Writing the read
+   end returns 0. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
 {
-  off_t bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
+  off_t bytes_written;
+
+  if (file->pipe != NULL)
+    return file->writer ? pipe_write (file->pipe, buffer, size) : 0;
+
+  bytes_written = write_at (file, buffer, size, file->pos);
   file->pos += bytes_written;
   return bytes_written;
 }
@@ -110,7 +331,17 @@ off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
                off_t file_ofs) 
 {
-  return inode_write_at (file->inode, buffer, size, file_ofs);
+  return write_at (file, buffer, size, file_ofs);
+}
+
+/* Writes FILE's data that is still in the buffer cache out to
+   disk, returning once it is there. */
+void
+file_sync (struct file *file)
+{
+  ASSERT (file != NULL);
+  if (file->pipe == NULL)
+    inode_sync (file->inode);
 }
 
 /* Prevents write operations on FILE's underlying inode
@@ -119,7 +350,7 @@ void
 file_deny_write (struct file *file) 
 {
   ASSERT (file != NULL);
-  if (!file->deny_write) 
+  if (!file->deny_write && file->pipe == NULL) 
     {
       file->deny_write = true;
       inode_deny_write (file->inode);
@@ -140,11 +371,13 @@ file_allow_write (struct file *file)
     }
 }
 
-/* Returns the size of FILE in bytes. */
+/* Returns the size of FILE in bytes, or -1 for a pipe. */
 off_t
 file_length (struct file *file) 
 {
   ASSERT (file != NULL);
+  if (file->pipe != NULL)
+    return -1;
   return inode_length (file->inode);
 }
 
@@ -1,14 +1,31 @@
 #ifndef FILESYS_FILE_H
 #define FILESYS_FILE_H
 
+#include <stdbool.h>
 #include "filesys/off_t.h"
 
 struct inode;
+struct pipe;
+
+/* Advice for file_advise().  Matches `enum fadvise_advice' in
+   lib/user/syscall.h. */
+enum file_advice
+  {
+    FADV_NORMAL,                /* No particular pattern. */
+    FADV_SEQUENTIAL,            /* Read from start to end. */
+    FADV_RANDOM,                /* Read in no particular order. */
+    FADV_WILLNEED,              /* Range will be read soon. */
+    FADV_DONTNEED               /* Range will not be read again soon. */
+  };
+
+void file_init (void);
 
 /* Opening and closing files. */
 struct file *file_open (struct inode *);
+struct file *file_open_pipe (struct pipe *, bool writer);
 struct file *file_reopen (struct file *);
 void file_close (struct file *);
+bool file_is_pipe (struct file *);
 struct inode *file_get_inode (struct file *);
 
 /* Reading and writing. */
@@ -17,6 +34,14 @@ off_t file_read_at (struct file *, void *, off_t size, off_t start);
 off_t file_write (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
 
+/* Bypassing the buffer cache, and advice on using it. */
+void file_set_direct (struct file *, bool direct);
+void file_advise (struct file *, off_t offset, off_t size,
+                  enum file_advice);
+
+/* Forcing writes to disk. */
+void file_sync (struct file *);
+
 /* Preventing writes. */
 void file_deny_write (struct file *);
 void file_allow_write (struct file *);
@@ -2,14 +2,21 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
+#include "filesys/tmpfs.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
 
+/* -crash: Leave the journal unapplied at power off? */
+bool filesys_crash;
+
 static void do_format (void);
 
 /* Initializes the file system module.
@@ -21,39 +28,71 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
   inode_init ();
+  file_init ();
+  dir_init ();
+  dcache_init ();
   free_map_init ();
+  tmpfs_init ();
+  journal_init (format);
 
   if (format) 
     do_format ();
 
   free_map_open ();
+  journal_start ();
 }
 
 /* Shuts down the file system module, writing any unwritten data
-   to disk. */
+   to disk.  With -crash, only commits the journal and writes
+   nothing home, as if the power failed just after the commit,
+   so that the next boot has to replay the journal to see the
+   changes: a test of replay. */
 void
 filesys_done (void) 
 {
+  if (filesys_crash)
+    {
+      journal_commit ();
+      return;
+    }
+  inode_reclaim ();
   free_map_close ();
+  journal_done ();
+  cache_flush ();
+  block_flush (fs_device);
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
-   or if internal memory allocation fails. */
+   or if internal memory allocation fails.
+   A NAME that starts with TMPFS_PREFIX creates a file in memory
+   only (see tmpfs.c), as it does for filesys_open() and
+   filesys_remove(). */
 bool
 filesys_create (const char *name, off_t initial_size) 
 {
   block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
+  struct dir *dir;
+  bool success;
+
+  if (tmpfs_name (name) != NULL)
+    return tmpfs_create (tmpfs_name (name), initial_size);
+
+  journal_begin ();
+  dir = dir_open_root ();
+  success = (dir != NULL
+             && (free_map_allocate (1, &inode_sector)
+                 || (inode_reclaim ()
+                     && free_map_allocate (1, &inode_sector)))
+             && inode_create (inode_sector, initial_size, 0)
+             && dir_add (dir, name, inode_sector));
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
   dir_close (dir);
+  journal_end ();
 
   return success;
 }
@@ -62,13 +101,22 @@ filesys_create (const char *name, off_t initial_size)
    Returns the new file if successful or a null pointer
    otherwise.
    Fails if no file named NAME exists,
-   or if an internal memory allocation fails. */
+   or if an internal memory allocation fails.
+   NAME "/" opens the root directory itself, for reading its
+   entries. */
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = dir_open_root ();
+  struct dir *dir;
   struct inode *inode = NULL;
 
+  if (!strcmp (name, "/"))
+    return file_open (inode_open (ROOT_DIR_SECTOR));
+  if (tmpfs_name (name) != NULL)
+    return file_open (tmpfs_open (tmpfs_name (name)));
+
+  dir = dir_open_root ();
+
   if (dir != NULL)
     dir_lookup (dir, name, &inode);
   dir_close (dir);
@@ -83,9 +131,17 @@ filesys_open (const char *name)
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  struct dir *dir;
+  bool success;
+
+  if (tmpfs_name (name) != NULL)
+    return tmpfs_remove (tmpfs_name (name));
+
+  journal_begin ();
+  dir = dir_open_root ();
+  success = dir != NULL && dir_remove (dir, name);
   dir_close (dir); 
+  journal_end ();
 
   return success;
 }
@@ -99,5 +155,7 @@ do_format (void)
   if (!dir_create (ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
   free_map_close ();
+  cache_flush ();
+  block_flush (fs_device);
   printf ("done.\n");
 }
@@ -7,9 +7,13 @@
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
+#define JOURNAL_SECTOR 2        /* First sector of the journal. */
 
 /* Block device that contains the file system. */
-struct block *fs_device;
+extern struct block *fs_device;
+
+/* -crash: Leave the journal unapplied at power off? */
+extern bool filesys_crash;
 
 void filesys_init (bool format);
 void filesys_done (void);
@@ -1,52 +1,514 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <rbtree.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/kmem.h"
+#include "threads/stats.h"
+#include "threads/synch.h"
+
+/* Free map.
+
+   The bitmap, one bit per sector, is what goes to disk.  Alongside
+   it, and always updated with it, an index in memory records each
+   run of free sectors as an extent, in two trees: one by starting
+   sector, to find the run at or after a hint and to merge a
+   released run with its neighbours, and one by length, for a
+   best-fit search.  Allocating CNT sectors thus takes O(log n) in
+   the number of runs, instead of a bitmap scan that may cross
+   much of the disk to find a long enough run.
+
+   Each extent takes a little memory.  If none is left when
+   allocating from the middle of a run splits it, the smaller
+   piece is left out of the index.  Its sectors stay free in the
+   bitmap, but are not allocated again until the index is rebuilt
+   at the next mount. */
+
+/* A run of free sectors. */
+struct free_extent
+  {
+    struct rb_elem start_elem;  /* Element in by_start. */
+    struct rb_elem size_elem;   /* Element in by_size. */
+    block_sector_t start;       /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+  };
+
+/* Extents looked at after a hint before falling back to the best
+   fit anywhere. */
+#define NEAR_PROBES 8
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct rb_tree by_start;      /* Free extents by start. */
+static struct rb_tree by_size;       /* Free extents by length. */
+static struct lock free_map_lock;    /* Protects the above. */
+static block_sector_t free_map_cursor; /* Where free_map_allocate()
+                                          resumes scanning. */
+
+static struct kmem_cache *extent_cache;
+
+/* Free sectors, and how they are fragmented. */
+static struct stats_counter free_sector_cnt;
+static struct stats_counter extent_cnt;
+static struct stats_counter largest_extent;
+
+static rb_less_func start_less, size_less;
+static void index_build (void);
 
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
-  free_map = bitmap_create (block_size (fs_device));
+  free_map = bitmap_create_summarized (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  extent_cache = kmem_cache_create ("free_extent",
+                                    sizeof (struct free_extent), 0,
+                                    NULL, NULL);
+  if (extent_cache == NULL)
+    PANIC ("can't create free extent cache");
+  lock_init_named (&free_map_lock, "free-map");
+  rb_init (&by_start, start_less, NULL);
+  rb_init (&by_size, size_less, NULL);
+  stats_register (&free_sector_cnt, "free_map", "free", STATS_GAUGE);
+  stats_register (&extent_cnt, "free_map", "extents", STATS_GAUGE);
+  stats_register (&largest_extent, "free_map", "largest", STATS_GAUGE);
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  index_build ();
+}
+
+/* Orders free extents by start. */
+static bool
+start_less (const struct rb_elem *a_, const struct rb_elem *b_,
+            void *aux UNUSED)
+{
+  const struct free_extent *a = rb_entry (a_, struct free_extent,
+                                          start_elem);
+  const struct free_extent *b = rb_entry (b_, struct free_extent,
+                                          start_elem);
+
+  return a->start < b->start;
+}
+
+/* Orders free extents by length, then by start. */
+static bool
+size_less (const struct rb_elem *a_, const struct rb_elem *b_,
+           void *aux UNUSED)
+{
+  const struct free_extent *a = rb_entry (a_, struct free_extent,
+                                          size_elem);
+  const struct free_extent *b = rb_entry (b_, struct free_extent,
+                                          size_elem);
+
+  return a->cnt < b->cnt || (a->cnt == b->cnt && a->start < b->start);
+}
+
+/* Updates the largest_extent statistic. */
+static void
+update_largest (void)
+{
+  struct rb_elem *e = rb_last (&by_size);
+
+  stats_set (&largest_extent,
+             e != NULL ? rb_entry (e, struct free_extent, size_elem)->cnt
+                       : 0);
+}
+
+/* Adds an extent for the CNT sectors at START to the index, not
+   merging it with any neighbour.  If no memory is left, the
+   sectors are left out of the index. */
+static void
+index_add (block_sector_t start, size_t cnt)
+{
+  struct free_extent *x;
+
+  if (cnt == 0)
+    return;
+  x = kmem_cache_alloc (extent_cache);
+  if (x == NULL)
+    return;
+  x->start = start;
+  x->cnt = cnt;
+  rb_insert (&by_start, &x->start_elem);
+  rb_insert (&by_size, &x->size_elem);
+  stats_inc (&extent_cnt);
+  stats_add (&free_sector_cnt, cnt);
+}
+
+/* Removes extent X from the index and frees it. */
+static void
+index_delete (struct free_extent *x)
+{
+  rb_remove (&by_start, &x->start_elem);
+  rb_remove (&by_size, &x->size_elem);
+  stats_sub (&extent_cnt, 1);
+  stats_sub (&free_sector_cnt, x->cnt);
+  kmem_cache_free (extent_cache, x);
+}
+
+/* Changes extent X to cover the CNT sectors at START, which must
+   lie between its neighbours. */
+static void
+index_resize (struct free_extent *x, block_sector_t start, size_t cnt)
+{
+  rb_remove (&by_size, &x->size_elem);
+  stats_sub (&free_sector_cnt, x->cnt);
+  x->start = start;
+  x->cnt = cnt;
+  rb_insert (&by_size, &x->size_elem);
+  stats_add (&free_sector_cnt, cnt);
+}
+
+/* Returns the first extent that ends after SECTOR, or a null
+   pointer if there is none. */
+static struct free_extent *
+index_find (block_sector_t sector)
+{
+  struct free_extent key;
+  struct rb_elem *e;
+
+  key.start = sector;
+  e = rb_upper_bound (&by_start, &key.start_elem);
+  if (e != rb_begin (&by_start))
+    {
+      struct rb_elem *prev = e != rb_end (&by_start)
+                             ? rb_prev (e) : rb_last (&by_start);
+      struct free_extent *x = rb_entry (prev, struct free_extent,
+                                        start_elem);
+      if (x->start + x->cnt > sector)
+        return x;
+    }
+  return e != rb_end (&by_start)
+         ? rb_entry (e, struct free_extent, start_elem) : NULL;
+}
+
+/* Takes the CNT sectors at START out of the index, trimming or
+   splitting the extents they overlap. */
+static void
+index_take (block_sector_t start, size_t cnt)
+{
+  block_sector_t end = start + cnt;
+  struct free_extent *x;
+
+  while ((x = index_find (start)) != NULL && x->start < end)
+    {
+      block_sector_t x_end = x->start + x->cnt;
+
+      if (x->start >= start && x_end <= end)
+        index_delete (x);
+      else if (x->start >= start)
+        index_resize (x, end, x_end - end);
+      else
+        {
+          /* X begins before the range: keep its head in X and
+             give the tail, if any, an extent of its own. */
+          index_resize (x, x->start, start - x->start);
+          if (x_end > end)
+            {
+              index_add (end, x_end - end);
+              break;
+            }
+        }
+    }
+  update_largest ();
+}
+
+/* Puts the CNT free sectors at START back into the index, merged
+   with the extents just before and after them. */
+static void
+index_give (block_sector_t start, size_t cnt)
+{
+  struct free_extent *next = index_find (start);
+  struct rb_elem *e = (next != NULL ? rb_prev (&next->start_elem)
+                       : rb_last (&by_start));
+  struct free_extent *prev = (e != NULL
+                              ? rb_entry (e, struct free_extent, start_elem)
+                              : NULL);
+
+  if (next != NULL && next->start != start + cnt)
+    next = NULL;
+  if (prev != NULL && prev->start + prev->cnt != start)
+    prev = NULL;
+
+  if (prev != NULL && next != NULL)
+    {
+      size_t total = prev->cnt + cnt + next->cnt;
+      index_delete (next);
+      index_resize (prev, prev->start, total);
+    }
+  else if (prev != NULL)
+    index_resize (prev, prev->start, prev->cnt + cnt);
+  else if (next != NULL)
+    index_resize (next, start, cnt + next->cnt);
+  else
+    index_add (start, cnt);
+  update_largest ();
+}
+
+/* Discards the index and builds it again from the bitmap. */
+static void
+index_build (void)
+{
+  size_t size = bitmap_size (free_map);
+  size_t start = 0;
+
+  while (!rb_empty (&by_start))
+    index_delete (rb_entry (rb_begin (&by_start), struct free_extent,
+                            start_elem));
+  while (start < size)
+    {
+      size_t end;
+
+      start = bitmap_scan (free_map, start, 1, false);
+      if (start == BITMAP_ERROR)
+        break;
+      end = bitmap_scan (free_map, start, 1, true);
+      if (end == BITMAP_ERROR)
+        end = size;
+      index_add (start, end - start);
+      start = end;
+    }
+  update_largest ();
+}
+
+/* Marks the CNT sectors at START used in memory. */
+static void
+mark_used (block_sector_t start, size_t cnt)
+{
+  bitmap_set_multiple (free_map, start, cnt, true);
+  index_take (start, cnt);
+}
+
+/* Marks the CNT sectors at START free in memory. */
+static void
+mark_free (block_sector_t start, size_t cnt)
+{
+  bitmap_set_multiple (free_map, start, cnt, false);
+  index_give (start, cnt);
+}
+
+/* Writes the part of the free map that covers the CNT sectors
+   starting at SECTOR to the free map file, if it is open.  Only
+   the bitmap words that hold those sectors' bits are written,
+   normally within a single sector of the file, and the write
+   goes to the buffer cache, which gets it to disk later, or at
+   the latest when filesys_done() flushes the cache.  Returns
+   true if successful, false otherwise.  free_map_lock must be
+   held. */
+static bool
+write_back (block_sector_t sector, size_t cnt)
+{
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+
+  return (free_map_file == NULL
+          || bitmap_write_range (free_map, free_map_file, sector, cnt));
+}
+
+/* Marks CNT consecutive free sectors as used in memory only and
+   returns the first of them, or BITMAP_ERROR if not enough
+   consecutive sectors were available.  Takes the first run that
+   fits among the NEAR_PROBES at or after START, or else the
+   smallest run that fits anywhere.  free_map_lock must be
+   held. */
+static block_sector_t
+scan_from (block_sector_t start, size_t cnt)
+{
+  struct free_extent *x, key;
+  struct rb_elem *e;
+  int probes;
+
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+
+  /* A run containing START, or one of the next few. */
+  x = index_find (start);
+  for (probes = 0; x != NULL && probes < NEAR_PROBES; probes++)
+    {
+      block_sector_t first = x->start > start ? x->start : start;
+
+      if (x->start + x->cnt >= first + cnt)
+        {
+          mark_used (first, cnt);
+          return first;
+        }
+      e = rb_next (&x->start_elem);
+      x = e != rb_end (&by_start)
+          ? rb_entry (e, struct free_extent, start_elem) : NULL;
+    }
+
+  /* Best fit. */
+  key.cnt = cnt;
+  key.start = 0;
+  e = rb_lower_bound (&by_size, &key.size_elem);
+  if (e == rb_end (&by_size))
+    return BITMAP_ERROR;
+  x = rb_entry (e, struct free_extent, size_elem);
+  start = x->start;
+  mark_used (start, cnt);
+  return start;
+}
+
+/* Allocates the first CNT consecutive free sectors at or after
+   START, wrapping around to the start of the disk if there are
+   none, and returns the first of them, or BITMAP_ERROR if not
+   enough consecutive sectors were available or if the free_map
+   file could not be written.  free_map_lock must be held. */
+static block_sector_t
+allocate_from (block_sector_t start, size_t cnt)
+{
+  block_sector_t sector = scan_from (start, cnt);
+
+  if (sector != BITMAP_ERROR && !write_back (sector, cnt))
+    {
+      mark_free (sector, cnt);
+      sector = BITMAP_ERROR;
+    }
+  return sector;
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP.  The search is next-fit: it resumes
+   where the previous call to this function left off, so that
+   successive calls spread out over the disk.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available or if the free_map file could not be
+   written. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  block_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  sector = allocate_from (free_map_cursor, cnt);
+  if (sector != BITMAP_ERROR)
+    free_map_cursor = sector + cnt;
+  lock_release (&free_map_lock);
+  if (sector != BITMAP_ERROR)
+    *sectorp = sector;
+  return sector != BITMAP_ERROR;
+}
+
+/* Allocates CNT consecutive sectors from the free map, as close
+   after sector HINT as possible, and stores the first into
+   *SECTORP.  Passing the sector of a file's inode or the last
+   sector allocated to the file as HINT keeps the file's sectors
+   together.  Does not move free_map_allocate()'s cursor.
+   Returns true if successful, false if not enough consecutive
+   sectors were available or if the free_map file could not be
+   written. */
+bool
+free_map_allocate_near (block_sector_t hint, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  block_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  sector = allocate_from (hint, cnt);
+  lock_release (&free_map_lock);
+  if (sector != BITMAP_ERROR)
+    *sectorp = sector;
+  return sector != BITMAP_ERROR;
+}
+
+/* Allocates the CNT consecutive sectors starting at SECTOR, if
+   they are all free.
+   Returns true if successful, false if any of them was in use or
+   if the free_map file could not be written. */
+bool
+free_map_allocate_at (block_sector_t sector, size_t cnt)
+{
+  bool success = false;
+
+  lock_acquire (&free_map_lock);
+  if (sector + cnt <= bitmap_size (free_map)
+      && !bitmap_any (free_map, sector, cnt))
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      mark_used (sector, cnt);
+      if (write_back (sector, cnt))
+        success = true;
+      else
+        mark_free (sector, cnt);
     }
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Reserves CNT consecutive sectors as close after sector HINT as
+   possible and stores the first into *SECTORP.  Reserved sectors
+   are taken out of the free map in memory, so nothing else gets
+   them, but they are recorded as used on disk only once claimed
+   with free_map_claim().  Unclaimed ones must be given back with
+   free_map_release().  Returns true if successful, false if not
+   enough consecutive sectors were available. */
+bool
+free_map_reserve (block_sector_t hint, size_t cnt, block_sector_t *sectorp)
+{
+  block_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  sector = scan_from (hint, cnt);
+  lock_release (&free_map_lock);
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Records the CNT reserved sectors starting at SECTOR as used in
+   the free map file.  Returns true if successful, false if the
+   free map file could not be written. */
+bool
+free_map_claim (block_sector_t sector, size_t cnt)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  ASSERT (bitmap_all (free_map, sector, cnt));
+  success = write_back (sector, cnt);
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Makes CNT sectors starting at SECTOR available for use.  Must
+   be called between journal_begin() and journal_end(). */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  journal_revoke (sector, cnt);
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  mark_free (sector, cnt);
+  write_back (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Makes the CNT runs of sectors in RUNS available for use, all
+   at once, under a single acquisition of the free map's lock.
+   Only the words of the free map that hold the runs' bits are
+   written, so the current journal operation logs each sector of
+   the free map file that the runs touch, and no other; see
+   FREE_MAP_SECTOR_BITS.  Must be called between journal_begin()
+   and journal_end(). */
+void
+free_map_release_runs (const struct free_map_run *runs, size_t cnt)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    journal_revoke (runs[i].start, runs[i].cnt);
+
+  lock_acquire (&free_map_lock);
+  for (i = 0; i < cnt; i++)
+    {
+      const struct free_map_run *r = &runs[i];
+
+      ASSERT (bitmap_all (free_map, r->start, r->cnt));
+      mark_free (r->start, r->cnt);
+      write_back (r->start, r->cnt);
+    }
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,6 +520,9 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  lock_acquire (&free_map_lock);
+  index_build ();
+  lock_release (&free_map_lock);
 }
 
 /* Writes the free map to disk and closes the free map file. */
@@ -72,14 +537,43 @@ free_map_close (void)
 void
 free_map_create (void) 
 {
+  struct file *file;
+  struct rb_elem *e;
+  size_t used_cnt;
+
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map),
+                     INODE_METADATA))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  /* Write bitmap to file.  The file starts out as a hole, so the
+     first write allocates its sectors.  It runs before
+     free_map_file is set, so that those allocations do not
+     write the free map again from inside free_map_allocate(),
+     and the second write records them.  From then on writing
+     the free map never allocates.
+
+     Only the second write's head needs writing: the bits in the
+     free run that reaches the end of the disk, nearly all of them
+     on a fresh disk, were clear the first time and still are. */
+  file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_write (free_map, free_map_file))
+  if (!bitmap_write (free_map, file))
+    PANIC ("can't write free map");
+  free_map_file = file;
+
+  lock_acquire (&free_map_lock);
+  used_cnt = bitmap_size (free_map);
+  e = rb_last (&by_start);
+  if (e != NULL)
+    {
+      struct free_extent *tail = rb_entry (e, struct free_extent,
+                                           start_elem);
+      if (tail->start + tail->cnt == used_cnt)
+        used_cnt = tail->start;
+    }
+  if (!write_back (0, used_cnt))
     PANIC ("can't write free map");
+  lock_release (&free_map_lock);
 }
@@ -5,6 +5,18 @@
 #include <stddef.h>
 #include "devices/block.h"
 
+/* Sectors whose bits share one sector of the free map file.
+   Releasing sectors logs each such sector that their bits lie
+   in. */
+#define FREE_MAP_SECTOR_BITS (BLOCK_SECTOR_SIZE * 8)
+
+/* A run of consecutive sectors, for free_map_release_runs(). */
+struct free_map_run
+  {
+    block_sector_t start;       /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+  };
+
 void free_map_init (void);
 void free_map_read (void);
 void free_map_create (void);
@@ -12,6 +24,11 @@ void free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+bool free_map_allocate_near (block_sector_t hint, size_t, block_sector_t *);
+bool free_map_allocate_at (block_sector_t, size_t);
+bool free_map_reserve (block_sector_t hint, size_t, block_sector_t *);
+bool free_map_claim (block_sector_t, size_t);
 void free_map_release (block_sector_t, size_t);
+void free_map_release_runs (const struct free_map_run *, size_t cnt);
 
 #endif /* filesys/free-map.h */
@@ -0,0 +1,146 @@
+#include "filesys/hibernate.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "threads/malloc.h"
+
+/* Warm-start snapshot of the buffer cache.
+
+   A job that runs the kernel afresh starts with an empty buffer
+   cache, and every sector its first file system operations touch
+   is a miss.  The "hibernate" action records which sectors of
+   the file system device are cached, in an image at the start of
+   the swap device, and powers off.  Each later boot that finds a
+   valid image there reads those sectors back into the cache, in
+   ascending order and with one request per run of consecutive
+   sectors, before any action runs, and keeps the swap slots that
+   hold the image out of use, so that the image serves every
+   later boot until the next "hibernate".  Saving may overwrite a
+   swap slot in use, but the kernel powers off straight after,
+   and swapped pages do not outlive it anyway.
+
+   The image records sector numbers, not their contents, so it
+   cannot go stale: a sector changed since the snapshot is read
+   as it is now.  Memory, and the state of the devices and the
+   threads, are not saved; the kernel boots as usual, and the
+   snapshot only spares the warm-up of the cache. */
+
+/* Identifies an image. */
+#define IMAGE_MAGIC 0x48494245
+
+/* Sector numbers that fit in an image. */
+#define IMAGE_SECTOR_CNT (BLOCK_SECTOR_SIZE / sizeof (block_sector_t) - 3)
+
+/* Most sectors read with one request on resume. */
+#define RESUME_RUN_MAX 16
+
+/* The image, in sector 0 of the swap device.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct image
+  {
+    uint32_t magic;                     /* IMAGE_MAGIC. */
+    block_sector_t fs_size;             /* Size of the file system
+                                           device, in sectors. */
+    uint32_t sector_cnt;                /* Number of sectors. */
+    block_sector_t sectors[IMAGE_SECTOR_CNT]; /* In ascending order. */
+  };
+
+/* Sectors of the swap device that a valid image occupies, or 0. */
+static block_sector_t image_size;
+
+/* Returns the swap device, or a null pointer if there is none. */
+static struct block *
+image_device (void)
+{
+  return block_get_role (BLOCK_SWAP);
+}
+
+/* Records the sectors of the file system device in the buffer
+   cache in an image on the swap device, after writing back the
+   dirty ones.  Returns true if successful, false if there is no
+   swap device or memory allocation fails. */
+bool
+hibernate_save (void)
+{
+  struct block *swap = image_device ();
+  struct image *image;
+
+  ASSERT (sizeof *image == BLOCK_SECTOR_SIZE);
+
+  if (swap == NULL || block_size (swap) < 1)
+    {
+      printf ("hibernate: no swap device\n");
+      return false;
+    }
+  image = calloc (1, sizeof *image);
+  if (image == NULL)
+    return false;
+
+  cache_flush ();
+  image->magic = IMAGE_MAGIC;
+  image->fs_size = block_size (fs_device);
+  image->sector_cnt = cache_list (fs_device, image->sectors,
+                                  IMAGE_SECTOR_CNT);
+  block_write (swap, 0, image);
+  printf ("hibernate: %"PRIu32" cached sectors saved to %s\n",
+          image->sector_cnt, block_name (swap));
+
+  free (image);
+  return true;
+}
+
+/* If the swap device holds a valid image for the file system
+   device, reads the sectors it lists into the buffer cache.  Must
+   be called after the file system is initialized. */
+void
+hibernate_resume (void)
+{
+  struct block *swap = image_device ();
+  struct image *image;
+  uint8_t *buffer;
+  size_t i;
+
+  if (swap == NULL || block_size (swap) < 1)
+    return;
+  image = malloc (sizeof *image);
+  buffer = malloc (RESUME_RUN_MAX * BLOCK_SECTOR_SIZE);
+  if (image == NULL || buffer == NULL)
+    goto done;
+
+  block_read (swap, 0, image);
+  if (image->magic != IMAGE_MAGIC
+      || image->fs_size != block_size (fs_device)
+      || image->sector_cnt > IMAGE_SECTOR_CNT)
+    goto done;
+  image_size = 1;
+
+  for (i = 0; i < image->sector_cnt; )
+    {
+      block_sector_t first = image->sectors[i];
+      size_t run = 1;
+
+      if (first >= image->fs_size)
+        break;
+      while (++i < image->sector_cnt && run < RESUME_RUN_MAX
+             && image->sectors[i] == first + run)
+        run++;
+      cache_read_multiple (fs_device, first, run, buffer);
+    }
+  printf ("hibernate: %"PRIu32" cached sectors restored from %s\n",
+          image->sector_cnt, block_name (swap));
+
+ done:
+  free (buffer);
+  free (image);
+}
+
+/* Returns the number of sectors at the start of the swap device
+   that hold a valid image, which swap must not use, or 0 if
+   there is no image. */
+block_sector_t
+hibernate_image_size (void)
+{
+  return image_size;
+}
@@ -0,0 +1,14 @@
+#ifndef FILESYS_HIBERNATE_H
+#define FILESYS_HIBERNATE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Warm-start snapshot of the buffer cache.  See hibernate.c for
+   details. */
+
+bool hibernate_save (void);
+void hibernate_resume (void);
+block_sector_t hibernate_image_size (void);
+
+#endif /* filesys/hibernate.h */
@@ -1,23 +1,96 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
+#include "filesys/tmpfs.h"
+#include "threads/kmem.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/work.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of extents in an on-disk inode. */
+#define EXTENT_CNT 60
+
+/* Bytes of file data that fit in the inode itself. */
+#define INLINE_SIZE (BLOCK_SECTOR_SIZE - 3 * sizeof (uint32_t))
+
+/* Flag set in an inode_disk whose data is inline.  Kept out of
+   the INODE_* flags that inode_flags() reports. */
+#define INODE_INLINE 0x80000000u
+
+/* Most whole sectors that inode_read_at() reads in one request
+   through the cache. */
+#define READ_RUN_MAX 16
+
+/* Sectors in the first and the largest window an open inode
+   reserves for its next data sectors. */
+#define RESERVE_MIN 8
+#define RESERVE_MAX 64
+
+/* Number of sector numbers in an index block. */
+#define PTRS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* A run of COUNT consecutive sectors starting at START. */
+struct extent
+  {
+    block_sector_t start;               /* First sector. */
+    uint32_t count;                     /* Number of sectors. */
+  };
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   The first `extent_sectors' sectors of the file are mapped by up
+   to EXTENT_CNT extents, in file order, so that a file laid out
+   in a few contiguous runs needs no index blocks at all.  Once
+   the extents are used up, further sectors go through the
+   indirect block, which holds PTRS_PER_SECTOR sector numbers,
+   and then the doubly indirect block, which holds the sector
+   numbers of PTRS_PER_SECTOR more indirect blocks.  Sector 0 is
+   the free map's inode, so 0 marks an index block that has not
+   been allocated.
+
+   Files are sparse: inode_create() allocates no data sectors, and
+   a sector is allocated only when it is first written.  Until
+   then it is a hole, which reads back as zeros without any disk
+   access.  A hole is a sector past the extents whose index entry
+   or index block is 0.
+
+   A file no bigger than INLINE_SIZE bytes keeps its data in the
+   inode sector itself, in place of the sector map, and has
+   INODE_INLINE set in `flags'.  Reading or writing it then takes
+   no disk access beyond the inode, which is already in memory.
+   The first write that takes the file past INLINE_SIZE moves the
+   data out to a data sector and clears the flag; a file never
+   goes back to being inline. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t flags;                     /* INODE_* flags. */
+    union
+      {
+        struct
+          {
+            uint32_t extent_cnt;        /* Number of extents in use. */
+            uint32_t extent_sectors;    /* Sectors mapped by extents. */
+            block_sector_t indirect;    /* Indirect block, or 0. */
+            block_sector_t doubly_indirect; /* Doubly indirect, or 0. */
+            struct extent extents[EXTENT_CNT]; /* Runs of data sectors. */
+            uint32_t unused[1];         /* Not used. */
+          };
+        uint8_t inline_data[INLINE_SIZE]; /* Data, if INODE_INLINE. */
+      };
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -31,46 +104,815 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
+    struct list_elem removed_elem;      /* Element in removed_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct rwlock rwlock;               /* Protects data, deny_write_cnt. */
+    struct lock lock;                   /* Held by inode_lock(). */
+    unsigned mod_cnt;                   /* Incremented by each write. */
+    block_sector_t rsv_start;           /* Reserved window's next sector. */
+    size_t rsv_cnt;                     /* Sectors left in the window. */
+    size_t rsv_size;                    /* Size of the next window. */
+    size_t reclaim_pos;                 /* Progress of reclaiming. */
+    struct tmpfs_file *mem;             /* tmpfs file, or null. */
+    struct inode_dir_hint dir_hint;     /* For directory.c. */
     struct inode_disk data;             /* Inode content. */
   };
 
+/* Locking.
+
+   open_inodes_lock protects the open_inodes table and each
+   inode's open_cnt.  An inode's rwlock protects its `data',
+   that is, its length and its map from file sectors to disk
+   sectors, along with deny_write_cnt and the size of the
+   reserved window.  Lookups in the map hold
+   it for reading and changes to the map hold it for writing.
+   It is never held while file data is copied to or from the
+   buffer cache, whose entries have locks of their own, so
+   reads and writes of a file run in parallel with each other
+   except while a write allocates sectors or extends the file.
+   Disk sectors are never unmapped while an inode is open, so a
+   sector looked up under the lock stays valid after it is
+   released.
+
+   window_lock protects every inode's reserved window itself,
+   since inode_reclaim() may take the window of an inode that
+   another thread is writing.  It is taken after reclaim_lock and
+   open_inodes_lock and before the free map's lock.
+
+   Changes to an inode and its index blocks, and to the data of
+   an INODE_METADATA inode, go through the journal.  Each change
+   is a journal operation of its own unless the caller has begun
+   one, and the operation is begun before the rwlock is taken
+   (see journal_begin()).  Other file data bypasses the journal.
+
+   The inode's other lock is not used by this module at all.
+   Callers take it through inode_lock() to make a sequence of
+   operations on one inode atomic, the way the directory code
+   does when it checks for a name before adding it. */
+
+/* A sector of zeros. */
+static char zeros[BLOCK_SECTOR_SIZE];
+
+/* Protects every inode's rsv_start and rsv_cnt. */
+static struct lock window_lock;
+
+/* Returns entry IDX of the index block in SECTOR. */
+static block_sector_t
+index_get (block_sector_t sector, size_t idx)
+{
+  block_sector_t entry;
+
+  ASSERT (idx < PTRS_PER_SECTOR);
+  cache_read_at (fs_device, sector, &entry, idx * sizeof entry, sizeof entry);
+  return entry;
+}
+
+/* Sets entry IDX of the index block in SECTOR to ENTRY. */
+static void
+index_set (block_sector_t sector, size_t idx, block_sector_t entry)
+{
+  ASSERT (idx < PTRS_PER_SECTOR);
+  journal_write_at (sector, &entry, idx * sizeof entry, sizeof entry);
+}
+
+/* Returns the disk sector holding sector FILE_SECTOR of the file
+   described by DISK_INODE, or 0 if that sector is a hole. */
+static block_sector_t
+file_sector_to_sector (const struct inode_disk *disk_inode,
+                       size_t file_sector)
+{
+  block_sector_t index;
+
+  if (file_sector < disk_inode->extent_sectors)
+    {
+      const struct extent *e;
+
+      for (e = disk_inode->extents; file_sector >= e->count; e++)
+        file_sector -= e->count;
+      return e->start + file_sector;
+    }
+
+  file_sector -= disk_inode->extent_sectors;
+  if (file_sector < PTRS_PER_SECTOR)
+    return (disk_inode->indirect != 0
+            ? index_get (disk_inode->indirect, file_sector)
+            : 0);
+
+  file_sector -= PTRS_PER_SECTOR;
+  if (file_sector >= PTRS_PER_SECTOR * PTRS_PER_SECTOR
+      || disk_inode->doubly_indirect == 0)
+    return 0;
+  index = index_get (disk_inode->doubly_indirect,
+                     file_sector / PTRS_PER_SECTOR);
+  return index != 0 ? index_get (index, file_sector % PTRS_PER_SECTOR) : 0;
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
+   within INODE, or 0 if POS lies in a hole, which reads as
+   zeros.
    Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   POS.  INODE's rwlock must be held. */
 static block_sector_t
 byte_to_sector (const struct inode *inode, off_t pos) 
 {
   ASSERT (inode != NULL);
   if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+    return file_sector_to_sector (&inode->data, pos / BLOCK_SECTOR_SIZE);
   else
     return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Stores into *SECTORP the sector that byte_to_sector() returns
+   for POS within INODE, and returns the number of bytes in INODE
+   from POS to its end.  Takes INODE's rwlock for reading. */
+static off_t
+lookup_sector (struct inode *inode, off_t pos, block_sector_t *sectorp)
+{
+  off_t left;
+
+  rwlock_acquire_read (&inode->rwlock);
+  *sectorp = byte_to_sector (inode, pos);
+  left = inode->data.length - pos;
+  rwlock_release_read (&inode->rwlock);
+  return left;
+}
+
+/* Writes SIZE bytes from BUFFER into data sector SECTOR of INODE
+   starting at byte OFS, through the journal if INODE holds
+   metadata. */
+static void
+data_write_at (const struct inode *inode, block_sector_t sector,
+               const void *buffer, size_t ofs, size_t size)
+{
+  if (inode->data.flags & INODE_METADATA)
+    journal_write_at (sector, buffer, ofs, size);
+  else
+    cache_write_at (fs_device, sector, buffer, ofs, size);
+}
+
+/* Allocates a sector as close after HINT as possible and stores
+   its number in *SECTORP.  If INDEX is true, the sector is to be
+   an index block and is zeroed through the journal.  Returns
+   true if successful, false if the disk is full. */
+static bool
+allocate_sector (block_sector_t hint, block_sector_t *sectorp, bool index)
+{
+  if (!free_map_allocate_near (hint, 1, sectorp)
+      && !(inode_reclaim () && free_map_allocate_near (hint, 1, sectorp)))
+    return false;
+  if (index)
+    journal_write (*sectorp, zeros);
+  return true;
+}
+
+/* Takes SECTOR for INODE if it is the next sector of INODE's
+   reserved window, and returns true if so.  window_lock must be
+   held. */
+static bool
+take_reserved (struct inode *inode, block_sector_t sector)
+{
+  ASSERT (lock_held_by_current_thread (&window_lock));
+
+  if (inode->rsv_cnt == 0 || inode->rsv_start != sector
+      || !free_map_claim (sector, 1))
+    return false;
+  inode->rsv_start++;
+  inode->rsv_cnt--;
+  return true;
+}
+
+/* Takes SECTOR for INODE if it is the next sector of INODE's
+   reserved window, and returns true if so. */
+static bool
+claim_reserved (struct inode *inode, block_sector_t sector)
+{
+  bool success;
+
+  lock_acquire (&window_lock);
+  success = take_reserved (inode, sector);
+  lock_release (&window_lock);
+  return success;
+}
+
+/* Gives back the unclaimed sectors of INODE's reserved window. */
+static void
+release_window (struct inode *inode)
+{
+  block_sector_t start;
+  size_t cnt;
+
+  lock_acquire (&window_lock);
+  start = inode->rsv_start;
+  cnt = inode->rsv_cnt;
+  inode->rsv_cnt = 0;
+  lock_release (&window_lock);
+
+  if (cnt > 0)
+    free_map_release (start, cnt);
+}
+
+/* Allocates a data sector for INODE as close after HINT as
+   possible and stores its number in *SECTORP.  Returns true if
+   successful, false if the disk is full.
+
+   A regular file takes its data sectors from a window of
+   consecutive sectors that it reserves in the free map ahead of
+   the sector it needs, starting with RESERVE_MIN sectors and
+   doubling each time, up to RESERVE_MAX.  As long as the file is
+   written in order, each new sector is the next one in the
+   window, so files written at the same time by different
+   threads each come out contiguous instead of interleaved.  The
+   window is given back when the inode is closed, or earlier by
+   inode_reclaim() if the disk runs out of free sectors while it
+   is open. */
+static bool
+allocate_data_sector (struct inode *inode, block_sector_t hint,
+                      block_sector_t *sectorp)
+{
+  block_sector_t start;
+  size_t cnt;
+
+  if (claim_reserved (inode, hint))
+    {
+      *sectorp = hint;
+      return true;
+    }
+  if (inode->data.flags & INODE_METADATA)
+    return allocate_sector (hint, sectorp, false);
+
+  release_window (inode);
+  for (cnt = inode->rsv_size; cnt > 1; cnt /= 2)
+    if (free_map_reserve (hint, cnt, &start))
+      {
+        bool success;
+
+        lock_acquire (&window_lock);
+        inode->rsv_start = start;
+        inode->rsv_cnt = cnt;
+        success = take_reserved (inode, start);
+        lock_release (&window_lock);
+        if (inode->rsv_size < RESERVE_MAX)
+          inode->rsv_size *= 2;
+        if (success)
+          {
+            *sectorp = start;
+            return true;
+          }
+        release_window (inode);
+        return false;
+      }
+  return allocate_sector (hint, sectorp, false);
+}
+
+/* Writes DATA, BLOCK_SECTOR_SIZE bytes, or zeros if DATA is
+   null, into SECTOR, which has just been allocated to INODE and
+   is not mapped yet.  If DIRECT is true, DATA goes straight to
+   the disk, as inode_write_direct() writes it, and is there on
+   return.  Otherwise it goes to the buffer cache, and unless
+   INODE's data is journaled, the sector is written back before
+   the mapping is committed. */
+static void
+fill_sector (struct inode *inode, block_sector_t sector, const void *data,
+             bool direct)
+{
+  if (direct)
+    {
+      ASSERT (data != NULL);
+      cache_update (fs_device, sector, 1, data);
+      block_write (fs_device, sector, data);
+      return;
+    }
+  data_write_at (inode, sector, data != NULL ? data : zeros, 0,
+                 BLOCK_SECTOR_SIZE);
+  if (!(inode->data.flags & INODE_METADATA))
+    journal_order (sector);
+}
+
+/* Allocates a sector for sector FILE_SECTOR of INODE, which must
+   be a hole, and fills it with DATA, BLOCK_SECTOR_SIZE bytes, or
+   with zeros if DATA is null, through the buffer cache or, if
+   DIRECT is true, straight to the disk.  If another writer
+   filled the hole meanwhile, writes DATA, if not null, into the
+   sector it allocated instead.  Returns the sector, or 0 if the
+   disk is full or FILE_SECTOR is past the largest size the inode
+   can map.
+
+   A sector that directly follows the extents is appended to
+   them, extending the last extent in place when the next disk
+   sector is free, as long as no sector has been mapped through
+   the index blocks yet (that would renumber the indexed
+   sectors).  Any other sector goes through the index blocks,
+   which are allocated as needed.  New sectors are placed right
+   after the disk sector of the previous file sector, or after
+   the inode itself, when that space is free or in the inode's
+   reserved window, so that a file written from start to end
+   comes out contiguous and close to its inode.  The new sector
+   holds its data before it is mapped, and its data reaches the
+   disk before the mapping does, so that neither a concurrent
+   reader nor the file after a crash ever sees what the sector
+   held before it was allocated.  INODE's rwlock must not be
+   held, and neither may any lock that a journal operation in
+   progress could need. */
+static block_sector_t
+inode_fill_hole (struct inode *inode, size_t file_sector, const void *data,
+                 bool direct)
+{
+  struct inode_disk *disk_inode = &inode->data;
+  block_sector_t sector, index, hint;
+  size_t idx;
+
+  journal_begin ();
+  rwlock_acquire_write (&inode->rwlock);
+
+  /* Another writer may have filled the hole meanwhile. */
+  sector = file_sector_to_sector (disk_inode, file_sector);
+  if (sector != 0)
+    {
+      if (direct)
+        {
+          cache_update (fs_device, sector, 1, data);
+          block_write (fs_device, sector, data);
+        }
+      else if (data != NULL)
+        data_write_at (inode, sector, data, 0, BLOCK_SECTOR_SIZE);
+      goto done;
+    }
+
+  /* Place new sectors after the previous file sector. */
+  hint = (file_sector > 0
+          ? file_sector_to_sector (disk_inode, file_sector - 1)
+          : 0);
+  hint = (hint != 0 ? hint : inode->sector) + 1;
+
+  if (file_sector == disk_inode->extent_sectors
+      && disk_inode->indirect == 0 && disk_inode->doubly_indirect == 0)
+    {
+      struct extent *e = (disk_inode->extent_cnt > 0
+                          ? &disk_inode->extents[disk_inode->extent_cnt - 1]
+                          : NULL);
+
+      if (e != NULL
+          && (claim_reserved (inode, e->start + e->count)
+              || free_map_allocate_at (e->start + e->count, 1)))
+        {
+          sector = e->start + e->count;
+          fill_sector (inode, sector, data, direct);
+          e->count++;
+          disk_inode->extent_sectors++;
+          goto done;
+        }
+      if (disk_inode->extent_cnt < EXTENT_CNT)
+        {
+          if (allocate_data_sector (inode, hint, &sector))
+            {
+              fill_sector (inode, sector, data, direct);
+              e = &disk_inode->extents[disk_inode->extent_cnt++];
+              e->start = sector;
+              e->count = 1;
+              disk_inode->extent_sectors++;
+            }
+          goto done;
+        }
+    }
+
+  if (file_sector < disk_inode->extent_sectors)
+    goto done;
+  idx = file_sector - disk_inode->extent_sectors;
+  if (idx < PTRS_PER_SECTOR)
+    {
+      if (disk_inode->indirect == 0
+          && !allocate_sector (hint, &disk_inode->indirect, true))
+        goto done;
+      index = disk_inode->indirect;
+    }
+  else
+    {
+      size_t l1;
+
+      idx -= PTRS_PER_SECTOR;
+      if (idx >= PTRS_PER_SECTOR * PTRS_PER_SECTOR
+          || (disk_inode->doubly_indirect == 0
+              && !allocate_sector (hint, &disk_inode->doubly_indirect, true)))
+        goto done;
+
+      l1 = idx / PTRS_PER_SECTOR;
+      idx %= PTRS_PER_SECTOR;
+      index = index_get (disk_inode->doubly_indirect, l1);
+      if (index == 0)
+        {
+          if (!allocate_sector (hint, &index, true))
+            goto done;
+          index_set (disk_inode->doubly_indirect, l1, index);
+        }
+    }
+  if (allocate_data_sector (inode, hint, &sector))
+    {
+      fill_sector (inode, sector, data, direct);
+      index_set (index, idx, sector);
+    }
+  else
+    sector = 0;
+
+ done:
+  journal_write (inode->sector, disk_inode);
+  rwlock_release_write (&inode->rwlock);
+  journal_end ();
+  return sector;
+}
+
+/* Cache for in-memory inodes. */
+static struct kmem_cache *inode_cache;
+
+/* Removed inodes.
+
+   The last close of a removed inode does not free its sectors
+   itself, which for a big file means reading every index block
+   and updating the free map over and over, but queues the inode
+   on removed_inodes for the reclaim job on the work queue, and
+   returns at once.  The job takes the inode's sectors apart into
+   runs, merging consecutive ones, and releases them in batches
+   with free_map_release_runs().  The space thus comes free
+   shortly after the close.  An allocation that finds the disk
+   full, and filesys_done(), reclaim what is queued at once
+   rather than wait for the job.  The inode's own sector stays
+   allocated until the rest is reclaimed, so it cannot be reused
+   in the meantime.
+
+   Releasing sectors logs every sector of the free map file that
+   holds their bits, so a batch is limited to RECLAIM_MAP_SECTORS
+   of those as well as to RECLAIM_RUNS runs, and each batch is a
+   journal operation of its own that reserves as many credits.  A
+   big or fragmented file thus takes several operations, and the
+   inode being reclaimed keeps track of how far it has got, so
+   that a crash in between leaks the rest of its sectors at worst.
+   When reclaiming is nested in an operation of the caller, as
+   when an allocation finds the disk full, each batch adds to that
+   operation's reservation, and reclaiming stops early if the
+   running transaction has no room for it.
+
+   reclaim_lock serializes reclaiming and protects the batch and
+   the inode being reclaimed; removed_inodes has a lock of its
+   own, so that closing never waits for a reclaim in progress. */
+
+/* Runs of sectors released at a time. */
+#define RECLAIM_RUNS 64
+
+/* Sectors of the free map file that a batch may change. */
+#define RECLAIM_MAP_SECTORS 7
+
+static struct list removed_inodes = LIST_INITIALIZER (removed_inodes);
+static struct lock removed_lock;        /* Protects removed_inodes. */
+static struct lock reclaim_lock;        /* Held while reclaiming. */
+static struct inode *reclaiming;        /* Inode partly reclaimed. */
+static struct free_map_run pending;     /* Run taken but not batched. */
+static bool have_pending;               /* Is `pending' valid? */
+static struct free_map_run runs[RECLAIM_RUNS]; /* Batch of runs. */
+static size_t run_cnt;                  /* Runs in the batch. */
+static size_t map_sectors[RECLAIM_MAP_SECTORS]; /* Free map sectors
+                                                   the batch changes. */
+static size_t map_cnt;                  /* Entries in map_sectors. */
+static struct work reclaim_work;        /* The reclaim job. */
+
+static work_func reclaim_job;
+static bool reclaim_windows (void);
+
+/* Returns true if sector S of the free map file is among those
+   the batch changes. */
+static bool
+batch_has_map_sector (size_t s)
+{
+  size_t i;
+
+  for (i = 0; i < map_cnt; i++)
+    if (map_sectors[i] == s)
+      return true;
+  return false;
+}
+
+/* Adds the CNT sectors starting at START to the batch of sectors
+   to release and returns true, or returns false if that would
+   take the batch past RECLAIM_RUNS runs or RECLAIM_MAP_SECTORS
+   sectors of the free map file.  reclaim_lock must be held. */
+static bool
+batch_add (block_sector_t start, size_t cnt)
+{
+  size_t first = start / FREE_MAP_SECTOR_BITS;
+  size_t last = (start + cnt - 1) / FREE_MAP_SECTOR_BITS;
+  size_t new_cnt = 0;
+  bool merge;
+  size_t s;
+
+  ASSERT (lock_held_by_current_thread (&reclaim_lock));
+  ASSERT (cnt > 0);
+  ASSERT (last - first < RECLAIM_MAP_SECTORS);
+
+  for (s = first; s <= last; s++)
+    if (!batch_has_map_sector (s))
+      new_cnt++;
+  merge = (run_cnt > 0
+           && runs[run_cnt - 1].start + runs[run_cnt - 1].cnt == start);
+  if (map_cnt + new_cnt > RECLAIM_MAP_SECTORS
+      || (!merge && run_cnt == RECLAIM_RUNS))
+    return false;
+
+  for (s = first; s <= last; s++)
+    if (!batch_has_map_sector (s))
+      map_sectors[map_cnt++] = s;
+  if (merge)
+    runs[run_cnt - 1].cnt += cnt;
+  else
+    {
+      runs[run_cnt].start = start;
+      runs[run_cnt].cnt = cnt;
+      run_cnt++;
+    }
+  return true;
+}
+
+/* Releases the batch and empties it.  Returns true if it was
+   not empty.  reclaim_lock must be held, within a journal
+   operation that has RECLAIM_MAP_SECTORS credits to spare. */
+static bool
+batch_release (void)
+{
+  bool any = run_cnt > 0;
+
+  ASSERT (lock_held_by_current_thread (&reclaim_lock));
+
+  free_map_release_runs (runs, run_cnt);
+  run_cnt = map_cnt = 0;
+  return any;
+}
+
+/* Index entries of the doubly indirect block's index blocks,
+   each followed by the index block itself, for take_run(). */
+#define DOUBLY_POSITIONS (PTRS_PER_SECTOR * (PTRS_PER_SECTOR + 1))
+
+/* Position of take_run() once it has taken the inode's own
+   sector. */
+#define RECLAIM_DONE SIZE_MAX
+
+/* Takes the next run of sectors to release from INODE, which is
+   being reclaimed, into *RUN and returns true, or returns false
+   if none is left.  A run never crosses from one sector of the
+   free map file into the next.  The extents go first, from the
+   end, then each index block right after the sectors it points
+   to, and last the inode's own sector.  INODE keeps track of
+   what has been taken: its extents shrink, its index block
+   pointers are cleared once their blocks are taken, and
+   reclaim_pos counts the entries of the current index block, or
+   of the doubly indirect block's index blocks, dealt with so far.
+   reclaim_lock must be held. */
+static bool
+take_run (struct inode *inode, struct free_map_run *run)
+{
+  struct inode_disk *d = &inode->data;
+
+  ASSERT (lock_held_by_current_thread (&reclaim_lock));
+
+  if (inode->reclaim_pos == RECLAIM_DONE)
+    return false;
+  run->cnt = 1;
+
+  if (!(d->flags & INODE_INLINE))
+    {
+      while (d->extent_cnt > 0)
+        {
+          struct extent *e = &d->extents[d->extent_cnt - 1];
+          block_sector_t end = e->start + e->count;
+
+          if (e->count == 0)
+            {
+              d->extent_cnt--;
+              continue;
+            }
+          run->start = ROUND_DOWN (end - 1, FREE_MAP_SECTOR_BITS);
+          if (run->start < e->start)
+            run->start = e->start;
+          run->cnt = end - run->start;
+          e->count -= run->cnt;
+          return true;
+        }
+
+      if (d->indirect != 0)
+        {
+          while (inode->reclaim_pos < PTRS_PER_SECTOR)
+            {
+              run->start = index_get (d->indirect, inode->reclaim_pos++);
+              if (run->start != 0)
+                return true;
+            }
+          run->start = d->indirect;
+          d->indirect = 0;
+          inode->reclaim_pos = 0;
+          return true;
+        }
+
+      if (d->doubly_indirect != 0)
+        {
+          while (inode->reclaim_pos < DOUBLY_POSITIONS)
+            {
+              size_t l1 = inode->reclaim_pos / (PTRS_PER_SECTOR + 1);
+              size_t l2 = inode->reclaim_pos % (PTRS_PER_SECTOR + 1);
+              block_sector_t index = index_get (d->doubly_indirect, l1);
+
+              if (index == 0)
+                {
+                  inode->reclaim_pos = (l1 + 1) * (PTRS_PER_SECTOR + 1);
+                  continue;
+                }
+              inode->reclaim_pos++;
+              run->start = (l2 < PTRS_PER_SECTOR
+                            ? index_get (index, l2) : index);
+              if (run->start != 0)
+                return true;
+            }
+          run->start = d->doubly_indirect;
+          d->doubly_indirect = 0;
+          return true;
+        }
+    }
+
+  run->start = inode->sector;
+  inode->reclaim_pos = RECLAIM_DONE;
+  return true;
+}
+
+/* Releases one batch of the sectors of the inodes on
+   removed_inodes in a journal operation of its own, or in the
+   caller's if it has begun one, and frees the inodes finished.
+   Returns true if any sectors were released, false if there were
+   none or the caller's operation had no room for more. */
+static bool
+reclaim_batch (void)
+{
+  struct list finished = LIST_INITIALIZER (finished);
+  bool any;
+
+  if (!journal_begin_credits (RECLAIM_MAP_SECTORS))
+    return false;
+  lock_acquire (&reclaim_lock);
+  for (;;)
+    {
+      if (!have_pending)
+        {
+          if (reclaiming == NULL)
+            {
+              lock_acquire (&removed_lock);
+              if (!list_empty (&removed_inodes))
+                reclaiming = list_entry (list_pop_front (&removed_inodes),
+                                         struct inode, removed_elem);
+              lock_release (&removed_lock);
+              if (reclaiming == NULL)
+                break;
+            }
+          if (!take_run (reclaiming, &pending))
+            {
+              list_push_back (&finished, &reclaiming->removed_elem);
+              reclaiming = NULL;
+              continue;
+            }
+          have_pending = true;
+        }
+      if (!batch_add (pending.start, pending.cnt))
+        break;
+      have_pending = false;
+    }
+  any = batch_release ();
+  lock_release (&reclaim_lock);
+  journal_end ();
+
+  while (!list_empty (&finished))
+    kmem_cache_free (inode_cache,
+                     list_entry (list_pop_front (&finished), struct inode,
+                                 removed_elem));
+  return any;
+}
+
+/* Frees the sectors of every inode on removed_inodes now, as far
+   as the journal allows.  Returns true if there were any. */
+static bool
+reclaim_removed (void)
+{
+  bool any = false;
+
+  while (reclaim_batch ())
+    any = true;
+  return any;
+}
+
+/* Frees the sectors of every inode on removed_inodes now, and
+   gives back the reserved windows of the open inodes, for when
+   the free map has no sectors left.  Returns true if any sectors
+   were freed. */
+bool
+inode_reclaim (void)
+{
+  bool removed = reclaim_removed ();
+  bool windows = reclaim_windows ();
+
+  return removed || windows;
+}
+
+/* The reclaim job.  Open inodes keep their windows. */
+static void
+reclaim_job (void *aux UNUSED)
+{
+  reclaim_removed ();
+}
+
+/* Open inodes, indexed by sector, so that opening a single
+   inode twice returns the same `struct inode'. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
+
+/* Gives back the reserved window of every open inode, so that a
+   disk that has run out of free sectors can still use the ones
+   that open files have reserved but not yet written.  The windows
+   go back in batches, each in a journal operation of its own, as
+   reclaim_batch() releases a removed inode's sectors, so that no
+   batch logs more of the free map than it reserved credits for,
+   however far apart the windows are.  An inode whose window is
+   taken simply reserves a new one, or allocates sector by sector,
+   the next time it grows.  Returns true if any window was given
+   back. */
+static bool
+reclaim_windows (void)
+{
+  bool any = false;
+  bool more;
+
+  do
+    {
+      struct hash_iterator i;
+
+      if (!journal_begin_credits (RECLAIM_MAP_SECTORS))
+        break;
+      more = false;
+      lock_acquire (&reclaim_lock);
+      lock_acquire (&open_inodes_lock);
+      lock_acquire (&window_lock);
+      hash_first (&i, &open_inodes);
+      while (hash_next (&i))
+        {
+          struct inode *inode = hash_entry (hash_cur (&i), struct inode,
+                                            elem);
+
+          if (inode->rsv_cnt > 0)
+            {
+              if (!batch_add (inode->rsv_start, inode->rsv_cnt))
+                {
+                  more = true;
+                  break;
+                }
+              inode->rsv_cnt = 0;
+            }
+        }
+      lock_release (&window_lock);
+      lock_release (&open_inodes_lock);
+      if (batch_release ())
+        any = true;
+      lock_release (&reclaim_lock);
+      journal_end ();
+    }
+  while (more);
+  return any;
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("Can't create open inode table.");
+  lock_init_named (&open_inodes_lock, "open-inodes");
+  lock_init_named (&window_lock, "inode-windows");
+  lock_init_named (&removed_lock, "removed-inodes");
+  lock_init_named (&reclaim_lock, "inode-reclaim");
+  work_init (&reclaim_work, reclaim_job, NULL);
+  inode_cache = kmem_cache_create ("inode", sizeof (struct inode),
+                                   KMEM_CACHE_LINE, NULL, NULL);
+  if (inode_cache == NULL)
+    PANIC ("Can't create inode cache.");
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The data starts out as one hole, so no data sectors
+   are allocated or written, and is inline in the inode if LENGTH
+   is small enough.  FLAGS is a combination of INODE_*
+   flags that is recorded in the inode for its users.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, unsigned flags)
 {
   struct inode_disk *disk_inode = NULL;
   bool success = false;
@@ -84,22 +926,13 @@ inode_create (block_sector_t sector, off_t length)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
+      disk_inode->flags = flags;
+      if (length <= (off_t) INLINE_SIZE)
+        disk_inode->flags |= INODE_INLINE;
+      journal_write (sector, disk_inode);
+      success = true; 
       free (disk_inode);
     }
   return success;
@@ -111,33 +944,89 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  key.sector = sector;
+  lock_acquire (&open_inodes_lock);
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      return inode; 
     }
+  lock_release (&open_inodes_lock);
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = kmem_cache_alloc (inode_cache);
   if (inode == NULL)
     return NULL;
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize, reading the inode without holding
+     open_inodes_lock so that opening one inode does not wait for
+     the disk on behalf of another. */
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->mod_cnt = 0;
+  inode->rsv_cnt = 0;
+  inode->rsv_size = RESERVE_MIN;
+  inode->mem = NULL;
+  inode->dir_hint.free_ofs = 0;
+  inode->dir_hint.entry_cnt = -1;
+  rwlock_init (&inode->rwlock);
+  lock_init_named (&inode->lock, "inode");
+  cache_read (fs_device, inode->sector, &inode->data);
+
+  /* Publish the inode, unless another thread opened it
+     meanwhile. */
+  lock_acquire (&open_inodes_lock);
+  e = hash_insert (&open_inodes, &inode->elem);
+  if (e != NULL)
+    {
+      kmem_cache_free (inode_cache, inode);
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+    }
+  lock_release (&open_inodes_lock);
+  return inode;
+}
+
+/* Returns a new inode, with inode number INUMBER, for tmpfs file
+   MEM, whose data it reads and writes through the tmpfs module
+   rather than the disk.  Such an inode is not in open_inodes,
+   since only tmpfs opens it by anything but reopening, and once
+   it is closed by its last opener, tmpfs_free(MEM) is called.
+   Returns a null pointer if memory allocation fails. */
+struct inode *
+inode_open_mem (struct tmpfs_file *mem, block_sector_t inumber)
+{
+  struct inode *inode = kmem_cache_alloc (inode_cache);
+  if (inode == NULL)
+    return NULL;
+
+  inode->sector = inumber;
+  inode->open_cnt = 1;
+  inode->deny_write_cnt = 0;
+  inode->removed = false;
+  inode->mod_cnt = 0;
+  inode->rsv_cnt = 0;
+  inode->rsv_size = RESERVE_MIN;
+  inode->mem = mem;
+  inode->dir_hint.free_ofs = 0;
+  inode->dir_hint.entry_cnt = -1;
+  rwlock_init (&inode->rwlock);
+  lock_init_named (&inode->lock, "inode");
+
+  /* An empty sector map, so that read-ahead and dropping cached
+     sectors find nothing to do. */
+  memset (&inode->data, 0, sizeof inode->data);
+  inode->data.magic = INODE_MAGIC;
   return inode;
 }
 
@@ -146,7 +1035,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -163,25 +1056,45 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode) 
 {
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
+  lock_acquire (&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+  if (last && inode->mem == NULL)
+    hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  if (last && inode->mem != NULL)
+    {
+      tmpfs_free (inode->mem);
+      kmem_cache_free (inode_cache, inode);
+    }
+  else if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
+      /* Give back the reserved window, and leave the blocks of
+         a removed inode to the reclaim job. */
+      if (inode->rsv_cnt > 0)
         {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          journal_begin ();
+          release_window (inode);
+          journal_end ();
         }
 
-      free (inode); 
+      if (inode->removed)
+        {
+          inode->reclaim_pos = 0;
+          lock_acquire (&removed_lock);
+          list_push_back (&removed_inodes, &inode->removed_elem);
+          lock_release (&removed_lock);
+          work_queue (&reclaim_work);
+        }
+      else
+        kmem_cache_free (inode_cache, inode);
     }
 }
 
@@ -194,6 +1107,29 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Returns the number of whole sectors of INODE, up to
+   READ_RUN_MAX, that lie within the SIZE bytes starting at
+   OFFSET, which is at the start of data sector FIRST, and that
+   follow FIRST consecutively on disk. */
+static size_t
+whole_sector_run (struct inode *inode, off_t offset, off_t size,
+                  block_sector_t first)
+{
+  size_t cnt;
+
+  for (cnt = 1; cnt < READ_RUN_MAX
+         && size >= (off_t) (cnt + 1) * BLOCK_SECTOR_SIZE; cnt++)
+    {
+      block_sector_t sector;
+
+      if (lookup_sector (inode, offset + cnt * BLOCK_SECTOR_SIZE, &sector)
+          < BLOCK_SECTOR_SIZE
+          || sector != first + cnt)
+        break;
+    }
+  return cnt;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
@@ -202,16 +1138,34 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+
+  if (inode->mem != NULL)
+    return tmpfs_read_at (inode->mem, buffer, size, offset);
+
+  /* Inline data is copied straight out of the inode. */
+  rwlock_acquire_read (&inode->rwlock);
+  if (inode->data.flags & INODE_INLINE)
+    {
+      if (offset < inode->data.length)
+        {
+          bytes_read = inode->data.length - offset;
+          if (bytes_read > size)
+            bytes_read = size;
+          memcpy (buffer, inode->data.inline_data + offset, bytes_read);
+        }
+      rwlock_release_read (&inode->rwlock);
+      return bytes_read;
+    }
+  rwlock_release_read (&inode->rwlock);
 
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left = lookup_sector (inode, offset, &sector_idx);
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -220,59 +1174,159 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
+      /* Read whole sectors that follow each other on disk
+         together, so that those missing from the cache take a
+         single request. */
+      if (sector_idx != 0 && chunk_size == BLOCK_SECTOR_SIZE)
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          size_t cnt = whole_sector_run (inode, offset, size, sector_idx);
+          cache_read_multiple (fs_device, sector_idx, cnt,
+                               buffer + bytes_read);
+          chunk_size = cnt * BLOCK_SECTOR_SIZE;
         }
-      
+      else if (sector_idx != 0)
+        cache_read_at (fs_device, sector_idx, buffer + bytes_read,
+                       sector_ofs, chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
+
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
 
   return bytes_read;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
-   Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
-off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
-                off_t offset) 
+/* Moves the inline data of INODE, whose rwlock must be held for
+   writing, out to a newly allocated data sector, and turns the
+   inode's data area back into an empty sector map.  Returns
+   false if the disk is full.  Unless the data is journaled, the
+   sector is written to disk before the inode that points to it
+   can be committed, so that the data is never lost. */
+static bool
+inode_move_inline (struct inode *inode)
 {
-  const uint8_t *buffer = buffer_;
-  off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  struct inode_disk *disk_inode = &inode->data;
+  block_sector_t sector = 0;
 
-  if (inode->deny_write_cnt)
+  if (disk_inode->length > 0)
+    {
+      if (!allocate_sector (inode->sector + 1, &sector, false))
+        return false;
+      data_write_at (inode, sector, zeros, 0, BLOCK_SECTOR_SIZE);
+      data_write_at (inode, sector, disk_inode->inline_data, 0,
+                     disk_inode->length);
+      if (!(disk_inode->flags & INODE_METADATA))
+        cache_sync (fs_device, sector, 1);
+    }
+
+  memset (disk_inode->inline_data, 0, sizeof disk_inode->inline_data);
+  disk_inode->flags &= ~INODE_INLINE;
+  if (sector != 0)
+    {
+      disk_inode->extent_cnt = 1;
+      disk_inode->extent_sectors = 1;
+      disk_inode->extents[0].start = sector;
+      disk_inode->extents[0].count = 1;
+    }
+  journal_write (inode->sector, disk_inode);
+  return true;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE at OFFSET if INODE's
+   data is inline and stays within INLINE_SIZE, making the inode
+   longer as needed, and returns the number of bytes written.  If
+   the write would go past INLINE_SIZE, moves the data out of the
+   inode first.  Returns -1 if the write is left for the sector
+   map to handle. */
+static off_t
+inode_write_inline (struct inode *inode, const void *buffer, off_t size,
+                    off_t offset)
+{
+  struct inode_disk *disk_inode = &inode->data;
+  off_t written = -1;
+
+  journal_begin ();
+  rwlock_acquire_write (&inode->rwlock);
+  if (disk_inode->flags & INODE_INLINE)
+    {
+      if (offset + size <= (off_t) INLINE_SIZE)
+        {
+          memcpy (disk_inode->inline_data + offset, buffer, size);
+          if (offset + size > disk_inode->length)
+            disk_inode->length = offset + size;
+          journal_write (inode->sector, disk_inode);
+          written = size;
+        }
+      else if (!inode_move_inline (inode))
+        written = 0;
+    }
+  rwlock_release_write (&inode->rwlock);
+  journal_end ();
+  return written;
+}
+
+/* Gets INODE ready for a write of SIZE bytes from BUFFER at
+   OFFSET: fails it if writes are denied, carries it out if
+   INODE's data is inline, and otherwise makes INODE long enough
+   for it.  Returns the number of bytes written, which is 0 if the
+   write failed, or -1 if the sectors remain to be written. */
+static off_t
+inode_prepare_write (struct inode *inode, const void *buffer, off_t size,
+                     off_t offset)
+{
+  off_t bytes_written;
+  bool denied, extend;
+
+  rwlock_acquire_read (&inode->rwlock);
+  denied = inode->deny_write_cnt > 0;
+  extend = offset + size > inode->data.length;
+  rwlock_release_read (&inode->rwlock);
+  if (denied)
     return 0;
+  if (inode->mem != NULL)
+    return tmpfs_write_at (inode->mem, buffer, size, offset);
+
+  bytes_written = inode_write_inline (inode, buffer, size, offset);
+  if (bytes_written >= 0)
+    return bytes_written;
+
+  if (extend)
+    {
+      journal_begin ();
+      rwlock_acquire_write (&inode->rwlock);
+      if (offset + size > inode->data.length)
+        {
+          inode->data.length = offset + size;
+          journal_write (inode->sector, &inode->data);
+        }
+      rwlock_release_write (&inode->rwlock);
+      journal_end ();
+    }
+  return -1;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, which must be long
+   enough, starting at OFFSET, through the buffer cache.  Returns
+   the number of bytes actually written, which may be less than
+   SIZE if the disk fills up. */
+static off_t
+inode_write_cached (struct inode *inode, const uint8_t *buffer, off_t size,
+                    off_t offset)
+{
+  off_t bytes_written = 0;
 
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      bool written;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left = lookup_sector (inode, offset, &sector_idx);
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -281,49 +1335,325 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      /* Fill a hole with the chunk if it covers the whole sector,
+         and otherwise with zeros to write the chunk over. */
+      written = false;
+      if (sector_idx == 0)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          written = chunk_size == BLOCK_SECTOR_SIZE;
+          sector_idx = inode_fill_hole (inode, offset / BLOCK_SECTOR_SIZE,
+                                        written ? buffer + bytes_written
+                                        : NULL, false);
+          if (sector_idx == 0)
+            break;
         }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
 
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      /* The cache reads the sector in first unless the chunk
+         covers all of it. */
+      if (!written)
+        data_write_at (inode, sector_idx, buffer + bytes_written,
+                       sector_ofs, chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+  return bytes_written;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+   Returns the number of bytes actually written, which may be
+   less than SIZE if the disk fills up or an error occurs.
+   A write past end of file extends the inode, leaving any gap
+   as a hole. */
+off_t
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
+                off_t offset) 
+{
+  off_t bytes_written = inode_prepare_write (inode, buffer, size, offset);
+
+  if (bytes_written < 0)
+    bytes_written = inode_write_cached (inode, buffer, size, offset);
 
+  /* Count the write once it is complete, so that anyone who
+     cached something from the inode before this point sees that
+     it may be out of date. */
+  if (bytes_written > 0)
+    inode->mod_cnt++;
   return bytes_written;
 }
 
+/* Direct I/O.
+
+   inode_read_direct() and inode_write_direct() move the whole
+   sectors of a transfer straight between BUFFER and the disk,
+   each run of sectors that are consecutive on disk in a single
+   request, without bringing them into the buffer cache, so that
+   streaming a large file does not push everything else out of
+   it.  The partial sectors at either end, and all of an inline
+   file or of metadata, still go through the cache.  A direct
+   read first writes back any dirty cached copies of its sectors,
+   and a direct write updates any cached copies, so the two kinds
+   of I/O see each other's data.
+
+   A direct write fills a hole a sector at a time, writing the
+   sector's data to the disk before the sector is mapped, so that
+   neither a concurrent reader nor the file after a crash sees
+   what the sector held before.  Only sectors already allocated
+   go to the disk in runs. */
+
+/* Returns true if INODE's data may bypass the buffer cache. */
+static bool
+inode_direct_ok (struct inode *inode)
+{
+  bool ok;
+
+  if (inode->mem != NULL)
+    return false;
+  rwlock_acquire_read (&inode->rwlock);
+  ok = !(inode->data.flags & (INODE_INLINE | INODE_METADATA));
+  rwlock_release_read (&inode->rwlock);
+  return ok;
+}
+
+/* Returns the number of bytes from OFFSET to the next sector
+   boundary, but no more than SIZE. */
+static off_t
+bytes_to_boundary (off_t size, off_t offset)
+{
+  off_t head = (BLOCK_SECTOR_SIZE - offset % BLOCK_SECTOR_SIZE)
+               % BLOCK_SECTOR_SIZE;
+  return head < size ? head : size;
+}
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at position
+   OFFSET, like inode_read_at(), but bypassing the buffer cache
+   for whole sectors. */
+off_t
+inode_read_direct (struct inode *inode, void *buffer_, off_t size,
+                   off_t offset)
+{
+  uint8_t *buffer = buffer_;
+  off_t head = bytes_to_boundary (size, offset);
+  off_t bytes_read;
+
+  if (!inode_direct_ok (inode) || size - head < BLOCK_SECTOR_SIZE)
+    return inode_read_at (inode, buffer, size, offset);
+
+  bytes_read = inode_read_at (inode, buffer, head, offset);
+  if (bytes_read < head)
+    return bytes_read;
+
+  while (size - bytes_read >= BLOCK_SECTOR_SIZE)
+    {
+      off_t pos = offset + bytes_read;
+      block_sector_t first, sector;
+      size_t cnt;
+
+      /* Find a run of sectors that are consecutive on disk, or
+         of holes, that lie wholly within the file. */
+      if (lookup_sector (inode, pos, &first) < BLOCK_SECTOR_SIZE)
+        break;
+      for (cnt = 1;
+           size - bytes_read >= (off_t) (cnt + 1) * BLOCK_SECTOR_SIZE;
+           cnt++)
+        if (lookup_sector (inode, pos + cnt * BLOCK_SECTOR_SIZE, &sector)
+            < BLOCK_SECTOR_SIZE
+            || sector != (first != 0 ? first + cnt : 0))
+          break;
+
+      if (first != 0)
+        {
+          cache_sync (fs_device, first, cnt);
+          block_read_multiple (fs_device, first, cnt, buffer + bytes_read);
+        }
+      else
+        memset (buffer + bytes_read, 0, cnt * BLOCK_SECTOR_SIZE);
+      bytes_read += cnt * BLOCK_SECTOR_SIZE;
+    }
+
+  return bytes_read + inode_read_at (inode, buffer + bytes_read,
+                                     size - bytes_read,
+                                     offset + bytes_read);
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET,
+   like inode_write_at(), but bypassing the buffer cache for
+   whole sectors. */
+off_t
+inode_write_direct (struct inode *inode, const void *buffer_, off_t size,
+                    off_t offset)
+{
+  const uint8_t *buffer = buffer_;
+  off_t head = bytes_to_boundary (size, offset);
+  off_t bytes_written = inode_prepare_write (inode, buffer, size, offset);
+
+  if (bytes_written >= 0)
+    goto done;
+  if (!inode_direct_ok (inode) || size - head < BLOCK_SECTOR_SIZE)
+    {
+      bytes_written = inode_write_cached (inode, buffer, size, offset);
+      goto done;
+    }
+
+  bytes_written = inode_write_cached (inode, buffer, head, offset);
+  if (bytes_written < head)
+    goto done;
+
+  while (size - bytes_written >= BLOCK_SECTOR_SIZE)
+    {
+      off_t pos = offset + bytes_written;
+      block_sector_t first, sector;
+      size_t cnt;
+
+      /* Fill a hole with its data, which is on disk before the
+         sector is mapped. */
+      lookup_sector (inode, pos, &first);
+      if (first == 0)
+        {
+          if (inode_fill_hole (inode, pos / BLOCK_SECTOR_SIZE,
+                               buffer + bytes_written, true) == 0)
+            goto done;
+          bytes_written += BLOCK_SECTOR_SIZE;
+          continue;
+        }
+
+      /* Write a run of sectors that are consecutive on disk in a
+         single request. */
+      for (cnt = 1;
+           size - bytes_written >= (off_t) (cnt + 1) * BLOCK_SECTOR_SIZE;
+           cnt++)
+        {
+          lookup_sector (inode, pos + cnt * BLOCK_SECTOR_SIZE, &sector);
+          if (sector != first + cnt)
+            break;
+        }
+
+      cache_update (fs_device, first, cnt, buffer + bytes_written);
+      block_write_multiple (fs_device, first, cnt, buffer + bytes_written);
+      bytes_written += cnt * BLOCK_SECTOR_SIZE;
+    }
+
+  bytes_written += inode_write_cached (inode, buffer + bytes_written,
+                                       size - bytes_written,
+                                       offset + bytes_written);
+
+ done:
+  if (bytes_written > 0)
+    inode->mod_cnt++;
+  return bytes_written;
+}
+
+/* Queues the sectors holding SIZE bytes of INODE starting at
+   OFFSET for background reading into the buffer cache.  Bytes
+   past the end of INODE, and inline data, which is already in
+   memory, are ignored. */
+void
+inode_readahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+
+  rwlock_acquire_read (&inode->rwlock);
+  if (end > inode->data.length)
+    end = inode->data.length;
+  if (inode->data.flags & INODE_INLINE)
+    end = 0;
+
+  offset = offset / BLOCK_SECTOR_SIZE * BLOCK_SECTOR_SIZE;
+  for (; offset < end; offset += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, offset);
+      if (sector != 0)
+        cache_readahead (fs_device, sector);
+    }
+  rwlock_release_read (&inode->rwlock);
+}
+
+/* Writes back the sectors holding SIZE bytes of INODE starting at
+   OFFSET, if they are dirty in the buffer cache, and drops them
+   from the cache, except those in use at the moment.  Bytes past
+   the end of INODE, and inline data, are ignored. */
+void
+inode_drop (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+
+  rwlock_acquire_read (&inode->rwlock);
+  if (end > inode->data.length)
+    end = inode->data.length;
+  if (inode->data.flags & INODE_INLINE)
+    end = 0;
+
+  offset = offset / BLOCK_SECTOR_SIZE * BLOCK_SECTOR_SIZE;
+  for (; offset < end; offset += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, offset);
+      if (sector != 0)
+        cache_drop (fs_device, sector);
+    }
+  rwlock_release_read (&inode->rwlock);
+}
+
+/* Writes any of INODE's sectors that are dirty in the buffer
+   cache to disk, returning once they are there, past the disk's
+   write cache.  Commits the journal first, so that those holding
+   metadata may be written. */
+void
+inode_sync (struct inode *inode)
+{
+  const struct inode_disk *disk_inode = &inode->data;
+  size_t sectors;
+  size_t i;
+
+  if (inode->mem != NULL)
+    return;
+  journal_commit ();
+  rwlock_acquire_read (&inode->rwlock);
+  if (disk_inode->flags & INODE_INLINE)
+    {
+      cache_sync (fs_device, inode->sector, 1);
+      rwlock_release_read (&inode->rwlock);
+      block_flush (fs_device);
+      return;
+    }
+  sectors = bytes_to_sectors (disk_inode->length);
+  for (i = 0; i < disk_inode->extent_cnt; i++)
+    cache_sync (fs_device, disk_inode->extents[i].start,
+                disk_inode->extents[i].count);
+  for (i = disk_inode->extent_sectors; i < sectors; i++)
+    {
+      block_sector_t sector = file_sector_to_sector (disk_inode, i);
+      if (sector != 0)
+        cache_sync (fs_device, sector, 1);
+    }
+
+  if (disk_inode->indirect != 0)
+    cache_sync (fs_device, disk_inode->indirect, 1);
+  if (disk_inode->doubly_indirect != 0)
+    {
+      for (i = 0; i < PTRS_PER_SECTOR; i++)
+        {
+          block_sector_t index = index_get (disk_inode->doubly_indirect, i);
+          if (index != 0)
+            cache_sync (fs_device, index, 1);
+        }
+      cache_sync (fs_device, disk_inode->doubly_indirect, 1);
+    }
+  cache_sync (fs_device, inode->sector, 1);
+  rwlock_release_read (&inode->rwlock);
+  block_flush (fs_device);
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Re-enables writes to INODE.
@@ -332,14 +1662,166 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
 off_t
 inode_length (const struct inode *inode)
 {
+  if (inode->mem != NULL)
+    return tmpfs_length (inode->mem);
   return inode->data.length;
 }
+
+/* Acquires INODE's lock, sleeping until it is available.  The
+   lock keeps no state of this module consistent; it is there
+   for callers that need several operations on INODE to happen
+   atomically. */
+void
+inode_lock (struct inode *inode)
+{
+  lock_acquire (&inode->lock);
+}
+
+/* Releases INODE's lock, which the current thread must hold. */
+void
+inode_unlock (struct inode *inode)
+{
+  lock_release (&inode->lock);
+}
+
+/* Returns the hints that the directory module keeps in INODE,
+   which is a directory.  The caller must hold INODE's lock. */
+struct inode_dir_hint *
+inode_dir_hint (struct inode *inode)
+{
+  ASSERT (lock_held_by_current_thread (&inode->lock));
+  return &inode->dir_hint;
+}
+
+/* Returns a count that changes whenever INODE's data is written,
+   for as long as INODE stays open.  Something derived from the
+   data is still up to date if the count has not changed since
+   before it was derived. */
+unsigned
+inode_mod_cnt (const struct inode *inode)
+{
+  return inode->mod_cnt;
+}
+
+/* Returns true if INODE has been removed, so that it will be
+   deleted when its last opener closes it. */
+bool
+inode_is_removed (const struct inode *inode)
+{
+  return inode->removed;
+}
+
+/* Returns the INODE_* flags INODE was created with. */
+unsigned
+inode_flags (const struct inode *inode)
+{
+  return inode->data.flags & ~INODE_INLINE;
+}
+
+/* Orders sector numbers in ascending order. */
+static int
+compare_sectors (const void *a_, const void *b_)
+{
+  block_sector_t a = *(const block_sector_t *) a_;
+  block_sector_t b = *(const block_sector_t *) b_;
+
+  return a < b ? -1 : a > b;
+}
+
+/* Reads the inodes at the CNT SECTORS into the buffer cache,
+   sorting SECTORS in place, so that looking at many inodes, such
+   as those of all the entries of a directory listing, sweeps
+   across the disk once with a request per run of consecutive
+   sectors instead of seeking for each inode in turn.  Does
+   nothing if memory allocation fails, since the inodes will
+   simply be read when they are needed. */
+void
+inode_prefetch (block_sector_t sectors[], size_t cnt)
+{
+  uint8_t *buffer;
+  size_t i;
+
+  if (cnt == 0)
+    return;
+  buffer = malloc (READ_RUN_MAX * BLOCK_SECTOR_SIZE);
+  if (buffer == NULL)
+    return;
+
+  qsort (sectors, cnt, sizeof *sectors, compare_sectors);
+  for (i = 0; i < cnt; )
+    {
+      block_sector_t first = sectors[i];
+      size_t run = 1;
+
+      /* Take in the sectors that continue the run, and any
+         duplicates of its last one. */
+      while (++i < cnt && sectors[i] - first <= run && run < READ_RUN_MAX)
+        run = sectors[i] - first + 1;
+      cache_read_multiple (fs_device, first, run, buffer);
+    }
+  free (buffer);
+}
+
+/* Stores the length and the INODE_* flags of the inode at SECTOR
+   into *LENGTH and *FLAGS, from the in-memory inode if it is open
+   and otherwise from its sector in the buffer cache, without
+   opening it. */
+void
+inode_stat (block_sector_t sector, off_t *length, unsigned *flags)
+{
+  struct inode key;
+  struct hash_elem *e;
+  uint32_t disk_flags;
+
+  key.sector = sector;
+  lock_acquire (&open_inodes_lock);
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
+    {
+      struct inode *inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+
+      *length = inode_length (inode);
+      *flags = inode_flags (inode);
+      inode_close (inode);
+      return;
+    }
+  lock_release (&open_inodes_lock);
+
+  cache_read_at (fs_device, sector, length,
+                 offsetof (struct inode_disk, length), sizeof *length);
+  cache_read_at (fs_device, sector, &disk_flags,
+                 offsetof (struct inode_disk, flags), sizeof disk_flags);
+  *flags = disk_flags & ~INODE_INLINE;
+}
+
+/* Returns a hash value for inode E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, elem);
+  return hash_int (inode->sector);
+}
+
+/* Returns true if inode A precedes inode B. */
+static bool
+inode_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct inode *a = hash_entry (a_, struct inode, elem);
+  const struct inode *b = hash_entry (b_, struct inode, elem);
+
+  return a->sector < b->sector;
+}
@@ -2,22 +2,53 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
 
 struct bitmap;
+struct tmpfs_file;
+
+/* Inode flags. */
+#define INODE_DIR_HASHED 0x1    /* Directory in hashed format. */
+#define INODE_METADATA 0x2      /* Data is journaled. */
+#define INODE_DIR 0x4           /* Directory. */
+
+/* What the directory module remembers about a directory in its
+   in-memory inode, under inode_lock().  See directory.c. */
+struct inode_dir_hint
+  {
+    off_t free_ofs;             /* No free entry lies before this. */
+    int entry_cnt;              /* Entries in use, or -1 if unknown. */
+  };
 
 void inode_init (void);
-bool inode_create (block_sector_t, off_t);
+bool inode_create (block_sector_t, off_t, unsigned flags);
 struct inode *inode_open (block_sector_t);
+struct inode *inode_open_mem (struct tmpfs_file *, block_sector_t inumber);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
+bool inode_reclaim (void);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+off_t inode_read_direct (struct inode *, void *, off_t size, off_t offset);
+off_t inode_write_direct (struct inode *, const void *, off_t size,
+                          off_t offset);
+void inode_readahead (struct inode *, off_t offset, off_t size);
+void inode_prefetch (block_sector_t sectors[], size_t cnt);
+void inode_stat (block_sector_t, off_t *length, unsigned *flags);
+void inode_drop (struct inode *, off_t offset, off_t size);
+void inode_sync (struct inode *);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+unsigned inode_flags (const struct inode *);
+unsigned inode_mod_cnt (const struct inode *);
+bool inode_is_removed (const struct inode *);
+void inode_lock (struct inode *);
+void inode_unlock (struct inode *);
+struct inode_dir_hint *inode_dir_hint (struct inode *);
 
 #endif /* filesys/inode.h */
@@ -0,0 +1,725 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <hash.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/palloc.h"
+#include "threads/stats.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "threads/work.h"
+
+/* Metadata journal.
+
+   Every change to file system metadata, that is, to inodes,
+   index blocks, directories and the free map, is written to the
+   buffer cache as usual but also logged in the journal, a
+   region of JOURNAL_SECTOR_CNT sectors at JOURNAL_SECTOR, before
+   any of it may reach its home location.  The changes of all
+   threads accumulate in one running transaction, which the
+   commit job writes to the journal every JOURNAL_COMMIT_TICKS
+   ticks in a single sequential write: a descriptor sector
+   listing the sectors logged, an image of each of them, and a
+   commit sector with a checksum of the rest.  After a crash,
+   journal_init() replays the transactions whose commit sector
+   checks out, which puts back every metadata change made up to
+   the last commit and none made after it.
+
+   An operation that must be atomic, such as creating a file,
+   runs between journal_begin() and journal_end(), which nest.
+   A transaction is only closed while no operation is in
+   progress, so that it holds either all of an operation or none
+   of it.  journal_begin() must therefore be called before any
+   file system lock is acquired, since the commit that it may
+   wait for waits in turn for every operation in progress to
+   finish.
+
+   Each operation reserves JOURNAL_OP_CREDITS sectors of the
+   running transaction when it begins, and logging a sector uses
+   up one of them.  An operation begins only once the sectors
+   logged and the credits still reserved leave room for its own,
+   waiting for operations in progress to end or committing the
+   transaction if they do not, so that operations running
+   together cannot fill a transaction between them.  An
+   operation that logs more sectors than it reserved draws on
+   whatever room is left.  Work that logs many sectors, such as
+   freeing a big file, must instead split itself into operations
+   that each reserve what they need with journal_begin_credits().
+
+   The buffer cache keeps each logged sector pinned and does not
+   write it back until the transaction that last changed it is
+   committed.  The disk may cache writes, so a commit flushes it
+   with block_flush() before letting any sector go home, and a
+   checkpoint flushes it before the journal starts over.  After
+   that the sector is an ordinary dirty entry that reaches its
+   home location whenever the cache gets around to it; that is
+   the checkpoint.  Only when the journal runs out
+   of room does the commit that fills it flush the cache, and
+   then the journal starts over at its beginning under a new
+   sequence number, which invalidates the old transactions.
+
+   A logged sector that is freed and reused for file data, which
+   is not logged, must not have its old image replayed over the
+   new data.  Freeing such a sector therefore records a
+   revocation in the running transaction, and replay skips an
+   image of a sector revoked by the same transaction or a later
+   one.
+
+   File data is not journaled, but a data sector newly allocated
+   to a file is written back before the transaction that maps it
+   is committed, so that the file never shows, even after a
+   crash, what the sector held before.  The file system code
+   writes the sector's new contents to the buffer cache before it
+   maps the sector, and lists the sector with journal_order();
+   the commit writes back every sector listed in its transaction,
+   and flushes the disk, before writing the transaction itself.
+   After a crash, a file may still hold old data of its own in a
+   sector rewritten since the last commit. */
+
+/* Timer ticks between commits. */
+#define JOURNAL_COMMIT_TICKS (TIMER_FREQ / 2)
+
+/* Most sectors logged by one transaction. */
+#define JOURNAL_TXN_MAX 22
+
+/* An operation that begins while the running transaction has
+   this many sectors commits it first. */
+#define JOURNAL_TXN_SOFT 8
+
+/* Sectors of the running transaction reserved by an operation. */
+#define JOURNAL_OP_CREDITS 7
+
+/* An operation that begins must leave room below JOURNAL_TXN_MAX
+   for a transaction that has reached JOURNAL_TXN_SOFT. */
+#if JOURNAL_CREDITS_MAX > JOURNAL_TXN_MAX - JOURNAL_TXN_SOFT
+#error JOURNAL_CREDITS_MAX is too big
+#endif
+
+/* Sector entries in a descriptor. */
+#define DESC_ENTRY_CNT ((BLOCK_SECTOR_SIZE - 4 * sizeof (uint32_t)) \
+                        / sizeof (block_sector_t))
+
+/* Most data sectors ordered before one transaction.  Further
+   ones are written back at once. */
+#define JOURNAL_ORDERED_MAX 128
+
+/* Most revocations in one transaction. */
+#define JOURNAL_REVOKE_MAX (DESC_ENTRY_CNT - JOURNAL_TXN_MAX)
+
+/* First sector after the journal. */
+#define JOURNAL_END (JOURNAL_SECTOR + JOURNAL_SECTOR_CNT)
+
+/* Magic numbers. */
+#define HEADER_MAGIC 0x4a524e4c         /* "JRNL". */
+#define DESC_MAGIC 0x4a444553           /* "JDES". */
+#define COMMIT_MAGIC 0x4a434d54         /* "JCMT". */
+
+/* Journal header, the sector at JOURNAL_SECTOR.  Transactions
+   follow it, numbered from SEQ up. */
+struct journal_header
+  {
+    uint32_t magic;                     /* HEADER_MAGIC. */
+    uint32_t seq;                       /* Number of first transaction. */
+    uint32_t unused[126];               /* Not used. */
+  };
+
+/* First sector of a transaction. */
+struct journal_desc
+  {
+    uint32_t magic;                     /* DESC_MAGIC. */
+    uint32_t seq;                       /* Transaction number. */
+    uint32_t cnt;                       /* Number of sectors logged. */
+    uint32_t revoke_cnt;                /* Number of sectors revoked. */
+    block_sector_t sectors[DESC_ENTRY_CNT]; /* CNT logged sectors, then
+                                               REVOKE_CNT revoked. */
+  };
+
+/* Last sector of a transaction, after its CNT images. */
+struct journal_commit_block
+  {
+    uint32_t magic;                     /* COMMIT_MAGIC. */
+    uint32_t seq;                       /* Transaction number. */
+    uint32_t checksum;                  /* hash_bytes() of descriptor
+                                           and images. */
+    uint32_t unused[125];               /* Not used. */
+  };
+
+/* Sectors in a transaction of the largest size. */
+#define TXN_SECTORS (JOURNAL_TXN_MAX + 2)
+
+/* True once journal_start() has been called.  Until then
+   metadata goes straight to the buffer cache, as it does while
+   formatting. */
+static bool enabled;
+
+/* journal_lock protects the running transaction and the
+   operation counts.  An operation may begin only while
+   `committing' is false; a commit sets it and waits for
+   `active_cnt' to drop to 0. */
+static struct lock journal_lock;
+static struct condition journal_idle;   /* Signaled when idle. */
+static struct condition journal_open;   /* Signaled when committed. */
+static struct condition journal_credit; /* Signaled when an operation
+                                           ends. */
+static size_t active_cnt;               /* Operations in progress. */
+static size_t reserved_cnt;             /* Credits of operations in
+                                           progress, not yet used. */
+static bool committing;                 /* Operations held off? */
+
+/* The running transaction: sectors logged and sectors revoked. */
+static block_sector_t running[JOURNAL_TXN_MAX];
+static size_t running_cnt;
+static block_sector_t revoked[JOURNAL_REVOKE_MAX];
+static size_t revoke_cnt;
+static bool revoke_overflow;            /* Revocations were lost? */
+
+/* Data sectors to write back before the running transaction. */
+static block_sector_t ordered[JOURNAL_ORDERED_MAX];
+static size_t ordered_cnt;
+
+/* commit_lock serializes commits and protects the rest. */
+static struct lock commit_lock;
+static uint8_t *commit_buf;             /* TXN_SECTORS sectors. */
+static block_sector_t next_pos;         /* Where the next one goes. */
+static uint32_t next_seq;               /* Number of the next one. */
+
+/* Data sectors to write back before the transaction being
+   committed.  Protected by commit_lock. */
+static block_sector_t commit_ordered[JOURNAL_ORDERED_MAX];
+
+/* Sectors logged since the journal last started over, which
+   need a revocation when freed.  Also accessed by
+   journal_revoke() under journal_lock; changed only with
+   `committing' set. */
+static block_sector_t logged[JOURNAL_SECTOR_CNT];
+static size_t logged_cnt;
+
+/* Statistics. */
+static struct stats_counter commit_cnt, logged_sector_cnt;
+static struct stats_counter checkpoint_cnt, revoke_stat;
+
+/* Commit job. */
+static struct work commit_work;
+static work_func commit_job;
+
+static void write_header (uint32_t seq);
+static void replay (void);
+
+/* Initializes the journal.  If FORMAT is true, reserves its
+   sectors in the free map, which must not have been written
+   yet, and writes an empty journal; otherwise replays the
+   committed transactions on the disk.  Must be called after the
+   buffer cache is initialized but before anything reads the
+   file system. */
+void
+journal_init (bool format)
+{
+  lock_init_named (&journal_lock, "journal");
+  cond_init (&journal_idle);
+  cond_init (&journal_open);
+  cond_init (&journal_credit);
+  lock_init_named (&commit_lock, "journal-commit");
+  commit_buf = palloc_get_multiple (PAL_ASSERT,
+                                    DIV_ROUND_UP (TXN_SECTORS
+                                                  * BLOCK_SECTOR_SIZE,
+                                                  PGSIZE));
+  work_init (&commit_work, commit_job, NULL);
+
+  next_pos = JOURNAL_SECTOR + 1;
+  next_seq = 1;
+  if (format)
+    {
+      if (!free_map_allocate_at (JOURNAL_SECTOR, JOURNAL_SECTOR_CNT))
+        PANIC ("file system device too small for journal");
+      write_header (next_seq);
+    }
+  else
+    replay ();
+
+  stats_register (&commit_cnt, "journal", "commits", STATS_COUNTER);
+  stats_register (&logged_sector_cnt, "journal", "sectors", STATS_COUNTER);
+  stats_register (&checkpoint_cnt, "journal", "checkpoints",
+                  STATS_COUNTER);
+  stats_register (&revoke_stat, "journal", "revokes", STATS_COUNTER);
+}
+
+/* Starts journaling metadata changes and committing them. */
+void
+journal_start (void)
+{
+  enabled = true;
+  work_queue_delayed (&commit_work, JOURNAL_COMMIT_TICKS);
+}
+
+/* Writes a header for a journal whose first transaction is
+   number SEQ, emptying it. */
+static void
+write_header (uint32_t seq)
+{
+  struct journal_header *h = (struct journal_header *) commit_buf;
+
+  memset (h, 0, sizeof *h);
+  h->magic = HEADER_MAGIC;
+  h->seq = seq;
+  block_write (fs_device, JOURNAL_SECTOR, h);
+}
+
+/* Returns true if transaction SEQ at sector POS of the journal is
+   complete, reading it into commit_buf. */
+static bool
+read_transaction (block_sector_t pos, uint32_t seq)
+{
+  struct journal_desc *d = (struct journal_desc *) commit_buf;
+  struct journal_commit_block *c;
+
+  if (pos + 2 > JOURNAL_END)
+    return false;
+  block_read (fs_device, pos, d);
+  if (d->magic != DESC_MAGIC || d->seq != seq
+      || d->cnt > JOURNAL_TXN_MAX || d->revoke_cnt > JOURNAL_REVOKE_MAX
+      || pos + d->cnt + 2 > JOURNAL_END)
+    return false;
+
+  block_read_multiple (fs_device, pos + 1, d->cnt + 1,
+                       commit_buf + BLOCK_SECTOR_SIZE);
+  c = (struct journal_commit_block *)
+    (commit_buf + (d->cnt + 1) * BLOCK_SECTOR_SIZE);
+  return (c->magic == COMMIT_MAGIC && c->seq == seq
+          && c->checksum == hash_bytes (commit_buf,
+                                        (d->cnt + 1) * BLOCK_SECTOR_SIZE));
+}
+
+/* Returns true if SECTOR is revoked by one of the CNT
+   descriptors in DESCS. */
+static bool
+is_revoked (const struct journal_desc *descs, size_t cnt,
+            block_sector_t sector)
+{
+  size_t i, j;
+
+  for (i = 0; i < cnt; i++)
+    for (j = 0; j < descs[i].revoke_cnt; j++)
+      if (descs[i].sectors[descs[i].cnt + j] == sector)
+        return true;
+  return false;
+}
+
+/* Writes the committed transactions in the journal to their home
+   locations, then empties the journal. */
+static void
+replay (void)
+{
+  enum { DESC_PAGES = DIV_ROUND_UP (JOURNAL_SECTOR_CNT / 2
+                                    * BLOCK_SECTOR_SIZE, PGSIZE) };
+  struct journal_header *h = (struct journal_header *) commit_buf;
+  struct journal_desc *descs;
+  block_sector_t pos;
+  size_t txn_cnt, i, j;
+  uint32_t seq;
+
+  block_read (fs_device, JOURNAL_SECTOR, h);
+  if (h->magic != HEADER_MAGIC)
+    PANIC ("file system has no journal; reformat with -f");
+  seq = h->seq;
+
+  /* Find the committed transactions and keep their
+     descriptors. */
+  descs = palloc_get_multiple (PAL_ASSERT, DESC_PAGES);
+  pos = JOURNAL_SECTOR + 1;
+  for (txn_cnt = 0; read_transaction (pos, seq + txn_cnt); txn_cnt++)
+    {
+      memcpy (&descs[txn_cnt], commit_buf, sizeof *descs);
+      pos += descs[txn_cnt].cnt + 2;
+    }
+
+  /* Write each image home, oldest first, unless the sector was
+     revoked by its own transaction or a later one. */
+  pos = JOURNAL_SECTOR + 1;
+  for (i = 0; i < txn_cnt; i++)
+    {
+      const struct journal_desc *d = &descs[i];
+
+      read_transaction (pos, seq + i);
+      for (j = 0; j < d->cnt; j++)
+        if (!is_revoked (d, txn_cnt - i, d->sectors[j]))
+          block_write (fs_device, d->sectors[j],
+                       commit_buf + (j + 1) * BLOCK_SECTOR_SIZE);
+      pos += d->cnt + 2;
+    }
+  palloc_free_multiple (descs, DESC_PAGES);
+  block_flush (fs_device);
+  if (txn_cnt > 0)
+    printf ("Journal: replayed %zu transactions.\n", txn_cnt);
+
+  /* Skip a number, since a torn transaction may still carry
+     SEQ + TXN_CNT at the start of the journal. */
+  next_seq = seq + txn_cnt + 1;
+  write_header (next_seq);
+}
+
+/* Begins an operation whose metadata changes must be committed
+   all together, reserving JOURNAL_OP_CREDITS sectors of the
+   running transaction for it.  Calls nest; only the outermost
+   counts.  May wait for other operations or for a commit, so no
+   file system lock may be held. */
+void
+journal_begin (void)
+{
+  journal_begin_credits (JOURNAL_OP_CREDITS);
+}
+
+/* Begins an operation as journal_begin() does, but reserves
+   CREDITS sectors for it, at most JOURNAL_CREDITS_MAX.  A nested
+   call adds CREDITS to the enclosing operation's reservation,
+   for work that logs sectors the enclosing operation did not
+   plan for.  It cannot wait for room, since any commit it waited
+   for would wait in turn for the enclosing operation to end, so
+   it returns false at once, having begun nothing, if the running
+   transaction is too full.  Otherwise returns true. */
+bool
+journal_begin_credits (size_t credits)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (credits <= JOURNAL_CREDITS_MAX);
+
+  if (t->journal_depth > 0)
+    {
+      bool room;
+
+      lock_acquire (&journal_lock);
+      room = (!enabled
+              || running_cnt + reserved_cnt + credits <= JOURNAL_TXN_MAX);
+      if (room)
+        {
+          t->journal_depth++;
+          t->journal_credits += credits;
+          reserved_cnt += credits;
+        }
+      lock_release (&journal_lock);
+      return room;
+    }
+
+  t->journal_depth++;
+  lock_acquire (&journal_lock);
+  for (;;)
+    {
+      if (committing)
+        cond_wait (&journal_open, &journal_lock);
+      else if (enabled && running_cnt >= JOURNAL_TXN_SOFT)
+        {
+          lock_release (&journal_lock);
+          journal_commit ();
+          lock_acquire (&journal_lock);
+        }
+      else if (enabled && (running_cnt + reserved_cnt + credits
+                           > JOURNAL_TXN_MAX))
+        {
+          /* Only reservations can fill the transaction below
+             JOURNAL_TXN_SOFT, so wait for one to be given up. */
+          ASSERT (reserved_cnt > 0);
+          cond_wait (&journal_credit, &journal_lock);
+        }
+      else
+        break;
+    }
+  active_cnt++;
+  t->journal_credits = credits;
+  reserved_cnt += credits;
+  lock_release (&journal_lock);
+  return true;
+}
+
+/* Ends an operation begun with journal_begin(). */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  reserved_cnt -= t->journal_credits;
+  t->journal_credits = 0;
+  cond_broadcast (&journal_credit, &journal_lock);
+  if (--active_cnt == 0)
+    cond_signal (&journal_idle, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Returns the index of SECTOR among the CNT sectors in ARRAY, or
+   CNT if it is not there. */
+static size_t
+find_sector (const block_sector_t *array, size_t cnt, block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    if (array[i] == sector)
+      break;
+  return i;
+}
+
+/* Adds SECTOR to the running transaction, holding it in the
+   buffer cache until the transaction is committed, and using up
+   one of the current operation's credits. */
+static void
+journal_add (block_sector_t sector)
+{
+  struct thread *t = thread_current ();
+  size_t i;
+
+  ASSERT (t->journal_depth > 0);
+
+  lock_acquire (&journal_lock);
+  if (find_sector (running, running_cnt, sector) == running_cnt)
+    {
+      if (t->journal_credits > 0)
+        {
+          t->journal_credits--;
+          reserved_cnt--;
+        }
+      else if (running_cnt + reserved_cnt >= JOURNAL_TXN_MAX)
+        PANIC ("journal transaction overflow");
+      running[running_cnt++] = sector;
+      cache_hold (fs_device, sector);
+    }
+
+  /* Logging the sector again supersedes any revocation of it,
+     even one made since it was first logged in this
+     transaction. */
+  i = find_sector (revoked, revoke_cnt, sector);
+  if (i < revoke_cnt)
+    revoked[i] = revoked[--revoke_cnt];
+  lock_release (&journal_lock);
+}
+
+/* Writes SIZE bytes from BUFFER into metadata sector SECTOR
+   starting at byte OFS, as part of the current operation. */
+void
+journal_write_at (block_sector_t sector, const void *buffer, size_t ofs,
+                  size_t size)
+{
+  if (enabled)
+    journal_add (sector);
+  cache_write_at (fs_device, sector, buffer, ofs, size);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER to metadata sector
+   SECTOR, as part of the current operation. */
+void
+journal_write (block_sector_t sector, const void *buffer)
+{
+  journal_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Notes that data sector SECTOR, which is not journaled, has
+   just been allocated and written to the buffer cache, and is
+   about to be mapped by the current operation, so that it must
+   reach the disk before the running transaction does.  Writes it
+   back at once if the transaction has too many such sectors
+   already. */
+void
+journal_order (block_sector_t sector)
+{
+  bool listed = false;
+
+  if (!enabled)
+    return;
+
+  lock_acquire (&journal_lock);
+  if (ordered_cnt < JOURNAL_ORDERED_MAX)
+    {
+      ordered[ordered_cnt++] = sector;
+      listed = true;
+    }
+  lock_release (&journal_lock);
+  if (!listed)
+    cache_sync (fs_device, sector, 1);
+}
+
+/* Adds SECTOR to the running transaction's revocations, if
+   needed.  journal_lock must be held. */
+static void
+revoke_sector (block_sector_t sector)
+{
+  if (find_sector (revoked, revoke_cnt, sector) < revoke_cnt)
+    return;
+  if (revoke_cnt < JOURNAL_REVOKE_MAX)
+    {
+      revoked[revoke_cnt++] = sector;
+      stats_inc (&revoke_stat);
+    }
+  else
+    revoke_overflow = true;
+}
+
+/* Notes that the CNT sectors starting at SECTOR are being freed
+   by the current operation, so that no image of them logged
+   before is replayed once they are reused. */
+void
+journal_revoke (block_sector_t sector, size_t cnt)
+{
+  size_t i;
+
+  if (!enabled)
+    return;
+
+  lock_acquire (&journal_lock);
+  for (i = 0; i < logged_cnt; i++)
+    if (logged[i] - sector < cnt)
+      revoke_sector (logged[i]);
+  for (i = 0; i < running_cnt; i++)
+    if (running[i] - sector < cnt)
+      revoke_sector (running[i]);
+  lock_release (&journal_lock);
+}
+
+/* Lets operations begin again after a commit. */
+static void
+open_journal (void)
+{
+  lock_acquire (&journal_lock);
+  committing = false;
+  cond_broadcast (&journal_open, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Writes the whole buffer cache back, so that nothing in the
+   journal is needed any more, and starts the journal over.
+   commit_lock must be held, with no transaction running. */
+static void
+checkpoint (void)
+{
+  cache_flush ();
+  block_flush (fs_device);
+  write_header (next_seq);
+  block_flush (fs_device);
+  next_pos = JOURNAL_SECTOR + 1;
+  logged_cnt = 0;
+  revoke_overflow = false;
+  stats_inc (&checkpoint_cnt);
+}
+
+/* Commits the running transaction, returning once it is in the
+   journal on disk.  No operation may be in progress in the
+   calling thread. */
+void
+journal_commit (void)
+{
+  struct journal_desc *d = (struct journal_desc *) commit_buf;
+  struct journal_commit_block *c;
+  size_t commit_ordered_cnt;
+  bool full;
+  size_t i;
+
+  if (!enabled)
+    return;
+
+  lock_acquire (&commit_lock);
+  lock_acquire (&journal_lock);
+  if (running_cnt == 0 && revoke_cnt == 0)
+    {
+      lock_release (&journal_lock);
+      lock_release (&commit_lock);
+      return;
+    }
+
+  /* Close the transaction once the operations in it are done. */
+  committing = true;
+  while (active_cnt > 0)
+    cond_wait (&journal_idle, &journal_lock);
+  memset (d, 0, sizeof *d);
+  d->magic = DESC_MAGIC;
+  d->seq = next_seq;
+  d->cnt = running_cnt;
+  d->revoke_cnt = revoke_cnt;
+  memcpy (d->sectors, running, running_cnt * sizeof *running);
+  memcpy (d->sectors + running_cnt, revoked, revoke_cnt * sizeof *revoked);
+  memcpy (commit_ordered, ordered, ordered_cnt * sizeof *ordered);
+  commit_ordered_cnt = ordered_cnt;
+  running_cnt = revoke_cnt = ordered_cnt = 0;
+  lock_release (&journal_lock);
+
+  /* Take the images while no operation can change them, and
+     remember the sectors for journal_revoke(). */
+  for (i = 0; i < d->cnt; i++)
+    {
+      cache_read (fs_device, d->sectors[i],
+                  commit_buf + (i + 1) * BLOCK_SECTOR_SIZE);
+      if (find_sector (logged, logged_cnt, d->sectors[i]) == logged_cnt)
+        logged[logged_cnt++] = d->sectors[i];
+    }
+  c = (struct journal_commit_block *)
+    (commit_buf + (d->cnt + 1) * BLOCK_SECTOR_SIZE);
+  memset (c, 0, sizeof *c);
+  c->magic = COMMIT_MAGIC;
+  c->seq = next_seq;
+  c->checksum = hash_bytes (commit_buf, (d->cnt + 1) * BLOCK_SECTOR_SIZE);
+
+  /* If this transaction leaves no room for the largest one, keep
+     operations off until the journal has started over, since a
+     checkpoint must not write back changes that are not
+     committed.  Otherwise let the next transaction fill up
+     while this one goes to disk. */
+  full = (next_pos + d->cnt + 2 + TXN_SECTORS > JOURNAL_END
+          || revoke_overflow);
+  if (!full)
+    open_journal ();
+
+  /* The data that the transaction maps goes first. */
+  for (i = 0; i < commit_ordered_cnt; i++)
+    cache_sync (fs_device, commit_ordered[i], 1);
+  if (commit_ordered_cnt > 0)
+    block_flush (fs_device);
+
+  block_write_multiple (fs_device, next_pos, d->cnt + 2, commit_buf);
+  block_flush (fs_device);
+  next_pos += d->cnt + 2;
+  next_seq++;
+  stats_inc (&commit_cnt);
+  stats_add (&logged_sector_cnt, d->cnt);
+
+  /* The sectors may now go home. */
+  for (i = 0; i < d->cnt; i++)
+    cache_unhold (fs_device, d->sectors[i]);
+
+  if (full)
+    {
+      checkpoint ();
+      open_journal ();
+    }
+  lock_release (&commit_lock);
+}
+
+/* Commits the running transaction and empties the journal, so
+   that the next boot has nothing to replay. */
+void
+journal_done (void)
+{
+  if (!enabled)
+    return;
+
+  journal_commit ();
+  lock_acquire (&commit_lock);
+  checkpoint ();
+  lock_release (&commit_lock);
+}
+
+/* Commits the running transaction, then runs again
+   JOURNAL_COMMIT_TICKS ticks later. */
+static void
+commit_job (void *aux UNUSED)
+{
+  journal_commit ();
+  work_queue_delayed (&commit_work, JOURNAL_COMMIT_TICKS);
+}
@@ -0,0 +1,30 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Metadata journal.  See journal.c for details. */
+
+/* Sectors reserved for the journal, starting at JOURNAL_SECTOR. */
+#define JOURNAL_SECTOR_CNT 128
+
+/* Most sectors that journal_begin_credits() may reserve. */
+#define JOURNAL_CREDITS_MAX 14
+
+void journal_init (bool format);
+void journal_start (void);
+void journal_done (void);
+
+void journal_begin (void);
+bool journal_begin_credits (size_t credits);
+void journal_end (void);
+void journal_write_at (block_sector_t, const void *, size_t ofs,
+                       size_t size);
+void journal_write (block_sector_t, const void *);
+void journal_order (block_sector_t);
+void journal_revoke (block_sector_t, size_t cnt);
+void journal_commit (void);
+
+#endif /* filesys/journal.h */
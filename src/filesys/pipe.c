@@ -0,0 +1,290 @@
+#include "filesys/pipe.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Pipes.
+
+   A pipe carries bytes from the files open on its write end to
+   those open on its read end, in memory, without any block I/O.
+   pipe_create() returns one file for each end, which file.c
+   passes reads and writes on to here; file_reopen() gives
+   another file for the same end, so that forked and spawned
+   processes can share the pipe, and the pipe is freed once the
+   last file for either end is closed.
+
+   Data is buffered in a ring of PIPE_PAGES pages.  A read takes
+   whatever is there, up to what it asked for, waiting only if
+   the pipe is empty, and reads 0 bytes once it is empty and no
+   write end is open.  A write waits for room until all of it is
+   in the pipe, and stops short once no read end is open.
+
+   Readers and writers sleep on exclusive wait queues, so that
+   new data or new room wakes one of them, not all of them.  A
+   reader that leaves data behind wakes the next reader, and a
+   writer that leaves room wakes the next writer.
+
+   A write of a page or more into an empty pipe is not copied
+   into the ring.  The writer posts its own buffer, which
+   do_write() in userprog/syscall.c has pinned in memory, and
+   waits while readers copy straight out of it, so that the data
+   is copied once rather than twice.  Other writers wait until
+   the readers have taken all of it.
+
+   All of a pipe's state is protected by its lock. */
+
+/* Number of pages in a pipe's ring. */
+#define PIPE_PAGES 4
+
+/* Number of bytes a pipe's ring holds. */
+#define PIPE_SIZE (PIPE_PAGES * PGSIZE)
+
+/* A pipe. */
+struct pipe
+  {
+    struct lock lock;           /* Protects the members below. */
+    struct wait_queue readable; /* Readers waiting for data. */
+    struct wait_queue writable; /* Writers waiting for room. */
+    struct wait_queue drained;  /* Writer waiting for DIRECT to be
+                                   read. */
+    uint8_t *pages[PIPE_PAGES]; /* The ring. */
+    size_t start;               /* Ring offset of the first byte. */
+    size_t used;                /* Bytes in the ring. */
+    const uint8_t *direct;      /* Writer's buffer being read, or
+                                   null. */
+    size_t direct_left;         /* Bytes of DIRECT not yet read. */
+    int readers;                /* Files open on the read end. */
+    int writers;                /* Files open on the write end. */
+  };
+
+static void pipe_free (struct pipe *);
+
+/* Creates a new, empty pipe and stores files open on its read
+   and write ends in *READ_END and *WRITE_END.  Returns true if
+   successful, false if memory is not available. */
+bool
+pipe_create (struct file **read_end, struct file **write_end)
+{
+  struct pipe *p;
+  size_t i;
+
+  p = calloc (1, sizeof *p);
+  if (p == NULL)
+    return false;
+  for (i = 0; i < PIPE_PAGES; i++)
+    {
+      p->pages[i] = palloc_get_page (0);
+      if (p->pages[i] == NULL)
+        {
+          pipe_free (p);
+          return false;
+        }
+    }
+  lock_init_named (&p->lock, "pipe");
+  wait_queue_init (&p->readable);
+  wait_queue_init (&p->writable);
+  wait_queue_init (&p->drained);
+  p->readers = p->writers = 1;
+
+  /* Closing an end that could not be opened lets the pipe be
+     freed with the other. */
+  *read_end = file_open_pipe (p, false);
+  if (*read_end == NULL)
+    {
+      pipe_close (p, false);
+      pipe_close (p, true);
+      return false;
+    }
+  *write_end = file_open_pipe (p, true);
+  if (*write_end == NULL)
+    {
+      file_close (*read_end);
+      pipe_close (p, true);
+      return false;
+    }
+  return true;
+}
+
+/* Frees pipe P and its ring. */
+static void
+pipe_free (struct pipe *p)
+{
+  size_t i;
+
+  for (i = 0; i < PIPE_PAGES; i++)
+    palloc_free_page (p->pages[i]);
+  free (p);
+}
+
+/* Records that another file is open on P's write end if WRITER,
+   on its read end otherwise. */
+void
+pipe_reopen (struct pipe *p, bool writer)
+{
+  lock_acquire (&p->lock);
+  if (writer)
+    p->writers++;
+  else
+    p->readers++;
+  lock_release (&p->lock);
+}
+
+/* Records that a file open on P's write end if WRITER, on its
+   read end otherwise, has been closed.  Closing the last file on
+   an end wakes everyone waiting on the other, and closing the
+   last file on both frees P. */
+void
+pipe_close (struct pipe *p, bool writer)
+{
+  bool unused;
+
+  lock_acquire (&p->lock);
+  if (writer)
+    {
+      ASSERT (p->writers > 0);
+      if (--p->writers == 0)
+        wait_queue_wake_all (&p->readable, &p->lock);
+    }
+  else
+    {
+      ASSERT (p->readers > 0);
+      if (--p->readers == 0)
+        {
+          wait_queue_wake_all (&p->writable, &p->lock);
+          wait_queue_wake_all (&p->drained, &p->lock);
+        }
+    }
+  unused = p->readers == 0 && p->writers == 0;
+  lock_release (&p->lock);
+
+  if (unused)
+    pipe_free (p);
+}
+
+/* Copies SIZE bytes starting at ring offset OFS in P into
+   BUFFER. */
+static void
+ring_get (struct pipe *p, size_t ofs, uint8_t *buffer, size_t size)
+{
+  while (size > 0)
+    {
+      size_t page_ofs = ofs % PGSIZE;
+      size_t chunk = PGSIZE - page_ofs < size ? PGSIZE - page_ofs : size;
+
+      memcpy (buffer, p->pages[ofs / PGSIZE] + page_ofs, chunk);
+      ofs = (ofs + chunk) % PIPE_SIZE;
+      buffer += chunk;
+      size -= chunk;
+    }
+}
+
+/* Copies SIZE bytes from BUFFER into P's ring starting at ring
+   offset OFS. */
+static void
+ring_put (struct pipe *p, size_t ofs, const uint8_t *buffer, size_t size)
+{
+  while (size > 0)
+    {
+      size_t page_ofs = ofs % PGSIZE;
+      size_t chunk = PGSIZE - page_ofs < size ? PGSIZE - page_ofs : size;
+
+      memcpy (p->pages[ofs / PGSIZE] + page_ofs, buffer, chunk);
+      ofs = (ofs + chunk) % PIPE_SIZE;
+      buffer += chunk;
+      size -= chunk;
+    }
+}
+
+/* Reads up to SIZE bytes from pipe P into BUFFER, waiting for
+   data if P is empty.  Returns the number of bytes read, which
+   is 0 only if P is empty and no write end is open. */
+off_t
+pipe_read (struct pipe *p, void *buffer, off_t size)
+{
+  size_t n = 0;
+
+  ASSERT (size >= 0);
+
+  lock_acquire (&p->lock);
+  while (p->used == 0 && p->direct == NULL && p->writers > 0)
+    wait_queue_wait (&p->readable, &p->lock, true);
+
+  if (p->used > 0)
+    {
+      n = p->used < (size_t) size ? p->used : (size_t) size;
+      ring_get (p, p->start, buffer, n);
+      p->start = (p->start + n) % PIPE_SIZE;
+      p->used -= n;
+      wait_queue_wake (&p->writable, &p->lock);
+    }
+  else if (p->direct != NULL)
+    {
+      n = p->direct_left < (size_t) size ? p->direct_left : (size_t) size;
+      memcpy (buffer, p->direct, n);
+      p->direct += n;
+      p->direct_left -= n;
+      if (p->direct_left == 0)
+        {
+          p->direct = NULL;
+          wait_queue_wake (&p->drained, &p->lock);
+        }
+    }
+
+  if (p->used > 0 || p->direct != NULL)
+    wait_queue_wake (&p->readable, &p->lock);
+  lock_release (&p->lock);
+  return n;
+}
+
+/* Writes SIZE bytes from BUFFER into pipe P, waiting for room as
+   necessary.  Returns the number of bytes written, which is less
+   than SIZE only if no read end is open. */
+off_t
+pipe_write (struct pipe *p, const void *buffer_, off_t size)
+{
+  const uint8_t *buffer = buffer_;
+  size_t done = 0;
+
+  ASSERT (size >= 0);
+
+  lock_acquire (&p->lock);
+  while (done < (size_t) size)
+    {
+      size_t left = size - done;
+      size_t n;
+
+      while (p->readers > 0 && (p->direct != NULL || p->used == PIPE_SIZE))
+        wait_queue_wait (&p->writable, &p->lock, true);
+      if (p->readers == 0)
+        break;
+
+      if (p->used == 0 && left >= PGSIZE)
+        {
+          /* Have the readers copy out of BUFFER directly. */
+          p->direct = buffer + done;
+          p->direct_left = left;
+          wait_queue_wake (&p->readable, &p->lock);
+          while (p->direct != NULL && p->readers > 0)
+            wait_queue_wait (&p->drained, &p->lock, true);
+          done += left - p->direct_left;
+          p->direct = NULL;
+          p->direct_left = 0;
+          continue;
+        }
+
+      n = PIPE_SIZE - p->used < left ? PIPE_SIZE - p->used : left;
+      ring_put (p, (p->start + p->used) % PIPE_SIZE, buffer + done, n);
+      p->used += n;
+      done += n;
+      wait_queue_wake (&p->readable, &p->lock);
+    }
+
+  if (p->readers > 0 && p->direct == NULL && p->used < PIPE_SIZE)
+    wait_queue_wake (&p->writable, &p->lock);
+  lock_release (&p->lock);
+  return done;
+}
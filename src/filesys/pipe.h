@@ -0,0 +1,20 @@
+#ifndef FILESYS_PIPE_H
+#define FILESYS_PIPE_H
+
+#include <stdbool.h>
+#include "filesys/off_t.h"
+
+/* In-memory pipes.  See pipe.c for details. */
+
+struct file;
+struct pipe;
+
+bool pipe_create (struct file **read_end, struct file **write_end);
+
+/* For file.c. */
+void pipe_reopen (struct pipe *, bool writer);
+void pipe_close (struct pipe *, bool writer);
+off_t pipe_read (struct pipe *, void *, off_t size);
+off_t pipe_write (struct pipe *, const void *, off_t size);
+
+#endif /* filesys/pipe.h */
@@ -0,0 +1,443 @@
+#include "filesys/tmpfs.h"
+#include <debug.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "filesys/inode.h"
+#include "threads/kmem.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/stats.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/swap.h"
+#endif
+
+/* Memory-only file system.
+
+   Files whose names start with TMPFS_PREFIX live in memory only,
+   without any block I/O, for short-lived files such as the spill
+   files of a sort that are deleted as soon as they have been
+   read back.  They are reached through filesys_create(),
+   filesys_open() and filesys_remove() like any other file, which
+   pass such names on here; the rest of the name, which must be a
+   valid file name, is looked up in a flat list of tmpfs files.
+
+   Each file has an in-memory inode, made by inode_open_mem(),
+   that stays open from the file's creation until its removal,
+   so that opening a file by name can never race with its last
+   close.  inode.c passes reads and writes of the inode on to
+   tmpfs_read_at() and tmpfs_write_at(), and once the last
+   opener closes a removed file, calls tmpfs_free() to release
+   its data.
+
+   A file's data is an array of pages from the user pool, indexed
+   by page number within the file, in which a null entry is a
+   hole that reads back as zeros.  In a kernel with VM, at most
+   RESIDENT_MAX pages, or fewer if the user pool runs out, are in
+   memory at once, and beyond that the least recently used page
+   of any tmpfs file goes to swap to make room, to be read back
+   when it is next used.  Without VM, or once swap is full, a
+   write that needs a page that cannot be had writes no further.
+
+   All of the module's state, including the data of every file,
+   is protected by tmpfs_lock. */
+
+/* Most pages of file data kept in memory at once. */
+#define RESIDENT_MAX 64
+
+/* A page of file data. */
+struct tmpfs_page
+  {
+    struct list_elem lru_elem;  /* Element in `lru', if resident. */
+    void *kpage;                /* Data, or null if swapped out. */
+#ifdef VM
+    size_t slot;                /* Swap slot, if swapped out. */
+#endif
+  };
+
+/* A tmpfs file. */
+struct tmpfs_file
+  {
+    struct list_elem elem;      /* Element in `files'. */
+    char name[NAME_MAX + 1];    /* Name, without TMPFS_PREFIX. */
+    struct inode *inode;        /* In-memory inode. */
+    off_t length;               /* File size in bytes. */
+    struct tmpfs_page **pages;  /* Data pages; null entries are holes. */
+    size_t page_cnt;            /* Number of entries in PAGES. */
+  };
+
+static struct list files;       /* All tmpfs files not yet removed. */
+static struct list lru;         /* Resident pages, least recently used
+                                   first. */
+static size_t resident_cnt;     /* Number of pages in LRU. */
+static block_sector_t next_inumber; /* Next inode number to assign. */
+static struct lock tmpfs_lock;
+
+static struct kmem_cache *file_cache;
+static struct kmem_cache *page_cache;
+
+/* Statistics. */
+static struct stats_counter resident_stat;  /* Pages in memory. */
+static struct stats_counter swapped_stat;   /* Pages in swap. */
+static struct stats_counter swap_out_cnt;   /* Pages written to swap. */
+
+/* Initializes the tmpfs module, with no files. */
+void
+tmpfs_init (void)
+{
+  list_init (&files);
+  list_init (&lru);
+  lock_init_named (&tmpfs_lock, "tmpfs");
+  next_inumber = 0xf0000000;
+  file_cache = kmem_cache_create ("tmpfs-file", sizeof (struct tmpfs_file),
+                                  0, NULL, NULL);
+  page_cache = kmem_cache_create ("tmpfs-page", sizeof (struct tmpfs_page),
+                                  0, NULL, NULL);
+  if (file_cache == NULL || page_cache == NULL)
+    PANIC ("Can't create tmpfs caches.");
+  stats_register (&resident_stat, "tmpfs", "resident", STATS_GAUGE);
+  stats_register (&swapped_stat, "tmpfs", "swapped", STATS_GAUGE);
+  stats_register (&swap_out_cnt, "tmpfs", "swap_out", STATS_COUNTER);
+}
+
+/* If NAME names a tmpfs file, returns the part of NAME that
+   follows TMPFS_PREFIX, otherwise a null pointer. */
+const char *
+tmpfs_name (const char *name)
+{
+  const char *p;
+
+  for (p = TMPFS_PREFIX; *p != '\0'; p++, name++)
+    if (*name != *p)
+      return NULL;
+  return name;
+}
+
+/* Returns the tmpfs file named NAME, or a null pointer.  The
+   caller must hold tmpfs_lock. */
+static struct tmpfs_file *
+lookup (const char *name)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&files); e != list_end (&files); e = list_next (e))
+    {
+      struct tmpfs_file *tf = list_entry (e, struct tmpfs_file, elem);
+      if (!strcmp (tf->name, name))
+        return tf;
+    }
+  return NULL;
+}
+
+/* Creates a tmpfs file named NAME, which must be the result of
+   tmpfs_name(), with INITIAL_SIZE bytes of zeros, taking no
+   memory for them until they are written.  Returns true if
+   successful, false if NAME is not a valid file name, a file
+   named NAME already exists, or memory allocation fails. */
+bool
+tmpfs_create (const char *name, off_t initial_size)
+{
+  struct tmpfs_file *tf = NULL;
+  bool success = false;
+
+  ASSERT (initial_size >= 0);
+
+  if (*name == '\0' || strlen (name) > NAME_MAX || strchr (name, '/'))
+    return false;
+
+  lock_acquire (&tmpfs_lock);
+  if (lookup (name) == NULL
+      && (tf = kmem_cache_alloc (file_cache)) != NULL)
+    {
+      strlcpy (tf->name, name, sizeof tf->name);
+      tf->length = initial_size;
+      tf->pages = NULL;
+      tf->page_cnt = 0;
+      tf->inode = inode_open_mem (tf, next_inumber);
+      if (tf->inode != NULL)
+        {
+          next_inumber++;
+          list_push_back (&files, &tf->elem);
+          success = true;
+        }
+      else
+        kmem_cache_free (file_cache, tf);
+    }
+  lock_release (&tmpfs_lock);
+  return success;
+}
+
+/* Opens the tmpfs file named NAME, which must be the result of
+   tmpfs_name(), and returns its inode, or a null pointer if
+   there is no such file. */
+struct inode *
+tmpfs_open (const char *name)
+{
+  struct tmpfs_file *tf;
+  struct inode *inode = NULL;
+
+  lock_acquire (&tmpfs_lock);
+  tf = lookup (name);
+  if (tf != NULL)
+    inode = inode_reopen (tf->inode);
+  lock_release (&tmpfs_lock);
+  return inode;
+}
+
+/* Removes the tmpfs file named NAME, which must be the result of
+   tmpfs_name().  Its data lasts until its last opener closes it.
+   Returns true if successful, false if there is no such file. */
+bool
+tmpfs_remove (const char *name)
+{
+  struct tmpfs_file *tf;
+
+  lock_acquire (&tmpfs_lock);
+  tf = lookup (name);
+  if (tf != NULL)
+    list_remove (&tf->elem);
+  lock_release (&tmpfs_lock);
+
+  /* Drop the reference that creation took, outside tmpfs_lock,
+     since closing the last one calls tmpfs_free(). */
+  if (tf != NULL)
+    inode_close (tf->inode);
+  return tf != NULL;
+}
+
+/* Returns a page of the user pool to hold file data, making room
+   by sending the least recently used tmpfs page to swap if
+   RESIDENT_MAX pages are already resident or the pool is empty.
+   Returns a null pointer if that is impossible. */
+static void *
+get_kpage (void)
+{
+  void *kpage = NULL;
+
+#ifdef VM
+  if (resident_cnt < RESIDENT_MAX)
+#endif
+    kpage = palloc_get_page (PAL_USER);
+#ifdef VM
+  if (kpage == NULL && !list_empty (&lru))
+    {
+      struct tmpfs_page *victim = list_entry (list_front (&lru),
+                                              struct tmpfs_page, lru_elem);
+      size_t slot = swap_alloc ();
+
+      if (slot == SWAP_ERROR)
+        return NULL;
+      swap_write (slot, victim->kpage);
+      kpage = victim->kpage;
+      victim->kpage = NULL;
+      victim->slot = slot;
+      list_remove (&victim->lru_elem);
+      resident_cnt--;
+      stats_sub (&resident_stat, 1);
+      stats_inc (&swapped_stat);
+      stats_inc (&swap_out_cnt);
+    }
+#endif
+  return kpage;
+}
+
+/* Marks P, which must be resident, as the most recently used
+   page. */
+static void
+touch (struct tmpfs_page *p)
+{
+  list_remove (&p->lru_elem);
+  list_push_back (&lru, &p->lru_elem);
+}
+
+/* Makes P resident, reading it back from swap if necessary, and
+   returns its data, or a null pointer if no page is available to
+   hold it. */
+static void *
+page_data (struct tmpfs_page *p)
+{
+  if (p->kpage == NULL)
+    {
+#ifdef VM
+      void *kpage = get_kpage ();
+      if (kpage == NULL)
+        return NULL;
+      swap_read (p->slot, kpage);
+      swap_free (p->slot);
+      p->kpage = kpage;
+      list_push_back (&lru, &p->lru_elem);
+      resident_cnt++;
+      stats_inc (&resident_stat);
+      stats_sub (&swapped_stat, 1);
+#else
+      NOT_REACHED ();
+#endif
+    }
+  else
+    touch (p);
+  return p->kpage;
+}
+
+/* Returns the data of page IDX of TF, allocating a zeroed page
+   for a hole.  Returns a null pointer if memory or swap is
+   exhausted. */
+static void *
+page_data_for_write (struct tmpfs_file *tf, size_t idx)
+{
+  struct tmpfs_page *p;
+
+  if (idx >= tf->page_cnt)
+    {
+      size_t new_cnt = tf->page_cnt * 2;
+      struct tmpfs_page **pages;
+
+      if (new_cnt < idx + 1)
+        new_cnt = idx + 1;
+      pages = realloc (tf->pages, new_cnt * sizeof *pages);
+      if (pages == NULL)
+        return NULL;
+      memset (pages + tf->page_cnt, 0,
+              (new_cnt - tf->page_cnt) * sizeof *pages);
+      tf->pages = pages;
+      tf->page_cnt = new_cnt;
+    }
+
+  if (tf->pages[idx] != NULL)
+    return page_data (tf->pages[idx]);
+
+  p = kmem_cache_alloc (page_cache);
+  if (p == NULL)
+    return NULL;
+  p->kpage = get_kpage ();
+  if (p->kpage == NULL)
+    {
+      kmem_cache_free (page_cache, p);
+      return NULL;
+    }
+  memset (p->kpage, 0, PGSIZE);
+  list_push_back (&lru, &p->lru_elem);
+  resident_cnt++;
+  stats_inc (&resident_stat);
+  tf->pages[idx] = p;
+  return p->kpage;
+}
+
+/* Reads SIZE bytes from TF into BUFFER, starting at OFFSET.
+   Returns the number of bytes actually read, which may be less
+   than SIZE if end of file is reached or a swapped-out page
+   cannot be brought back. */
+off_t
+tmpfs_read_at (struct tmpfs_file *tf, void *buffer_, off_t size,
+               off_t offset)
+{
+  uint8_t *buffer = buffer_;
+  off_t bytes_read = 0;
+
+  lock_acquire (&tmpfs_lock);
+  if (offset < tf->length && size > tf->length - offset)
+    size = tf->length - offset;
+  while (size > 0 && offset < tf->length)
+    {
+      size_t idx = offset / PGSIZE;
+      size_t page_ofs = offset % PGSIZE;
+      off_t chunk_size = PGSIZE - page_ofs;
+      if (chunk_size > size)
+        chunk_size = size;
+
+      if (idx < tf->page_cnt && tf->pages[idx] != NULL)
+        {
+          uint8_t *kpage = page_data (tf->pages[idx]);
+          if (kpage == NULL)
+            break;
+          memcpy (buffer + bytes_read, kpage + page_ofs, chunk_size);
+        }
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
+
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_read += chunk_size;
+    }
+  lock_release (&tmpfs_lock);
+  return bytes_read;
+}
+
+/* Writes SIZE bytes from BUFFER into TF, starting at OFFSET, and
+   extends TF if that goes past its end.  Returns the number of
+   bytes actually written, which may be less than SIZE if memory
+   and swap run out. */
+off_t
+tmpfs_write_at (struct tmpfs_file *tf, const void *buffer_, off_t size,
+                off_t offset)
+{
+  const uint8_t *buffer = buffer_;
+  off_t bytes_written = 0;
+
+  lock_acquire (&tmpfs_lock);
+  while (size > 0)
+    {
+      size_t idx = offset / PGSIZE;
+      size_t page_ofs = offset % PGSIZE;
+      off_t chunk_size = PGSIZE - page_ofs;
+      uint8_t *kpage;
+      if (chunk_size > size)
+        chunk_size = size;
+
+      kpage = page_data_for_write (tf, idx);
+      if (kpage == NULL)
+        break;
+      memcpy (kpage + page_ofs, buffer + bytes_written, chunk_size);
+
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_written += chunk_size;
+    }
+  if (offset > tf->length && bytes_written > 0)
+    tf->length = offset;
+  lock_release (&tmpfs_lock);
+  return bytes_written;
+}
+
+/* Returns the length of TF in bytes. */
+off_t
+tmpfs_length (const struct tmpfs_file *tf)
+{
+  return tf->length;
+}
+
+/* Frees TF and its data, once it has been removed and its inode
+   closed by its last opener. */
+void
+tmpfs_free (struct tmpfs_file *tf)
+{
+  size_t i;
+
+  lock_acquire (&tmpfs_lock);
+  for (i = 0; i < tf->page_cnt; i++)
+    {
+      struct tmpfs_page *p = tf->pages[i];
+      if (p == NULL)
+        continue;
+      if (p->kpage != NULL)
+        {
+          list_remove (&p->lru_elem);
+          palloc_free_page (p->kpage);
+          resident_cnt--;
+          stats_sub (&resident_stat, 1);
+        }
+#ifdef VM
+      else
+        {
+          swap_free (p->slot);
+          stats_sub (&swapped_stat, 1);
+        }
+#endif
+      kmem_cache_free (page_cache, p);
+    }
+  lock_release (&tmpfs_lock);
+
+  free (tf->pages);
+  kmem_cache_free (file_cache, tf);
+}
@@ -0,0 +1,29 @@
+#ifndef FILESYS_TMPFS_H
+#define FILESYS_TMPFS_H
+
+#include <stdbool.h>
+#include "filesys/off_t.h"
+
+/* Memory-only file system under TMPFS_PREFIX.  See tmpfs.c for
+   details. */
+
+/* Names of tmpfs files start with this. */
+#define TMPFS_PREFIX "/tmp/"
+
+struct inode;
+struct tmpfs_file;
+
+void tmpfs_init (void);
+const char *tmpfs_name (const char *);
+bool tmpfs_create (const char *name, off_t initial_size);
+struct inode *tmpfs_open (const char *name);
+bool tmpfs_remove (const char *name);
+
+/* For inode.c. */
+off_t tmpfs_read_at (struct tmpfs_file *, void *, off_t size, off_t offset);
+off_t tmpfs_write_at (struct tmpfs_file *, const void *, off_t size,
+                      off_t offset);
+off_t tmpfs_length (const struct tmpfs_file *);
+void tmpfs_free (struct tmpfs_file *);
+
+#endif /* filesys/tmpfs.h */
@@ -19,119 +19,136 @@
    much less mysterious. */
 
 /* Uses x86 DIVL instruction to divide 64-bit N by 32-bit D to
-   yield a 32-bit quotient.  Returns the quotient.
+   yield a 32-bit quotient and remainder.  Stores the remainder
+   in *R and returns the quotient.
    Traps with a divide error (#DE) if the quotient does not fit
    in 32 bits. */
 static inline uint32_t
-divl (uint64_t n, uint32_t d)
+divl (uint64_t n, uint32_t d, uint32_t *r)
 {
   uint32_t n1 = n >> 32;
   uint32_t n0 = n;
-  uint32_t q, r;
+  uint32_t q;
 
   asm ("divl %4"
-       : "=d" (r), "=a" (q)
+       : "=d" (*r), "=a" (q)
        : "0" (n1), "1" (n0), "rm" (d));
 
   return q;
 }
 
 /* Returns the number of leading zero bits in X,
-   which must be nonzero. */
-static int
+   which must be nonzero.  GCC turns this into the x86 BSR
+   instruction. */
+static inline int
 nlz (uint32_t x) 
 {
-  /* This technique is portable, but there are better ways to do
-     it on particular systems.  With sufficiently new enough GCC,
-     you can use __builtin_clz() to take advantage of GCC's
-     knowledge of how to do it.  Or you can use the x86 BSR
-     instruction directly. */
-  int n = 0;
-  if (x <= 0x0000FFFF)
-    {
-      n += 16;
-      x <<= 16; 
-    }
-  if (x <= 0x00FFFFFF)
-    {
-      n += 8;
-      x <<= 8; 
-    }
-  if (x <= 0x0FFFFFFF)
-    {
-      n += 4;
-      x <<= 4;
-    }
-  if (x <= 0x3FFFFFFF)
-    {
-      n += 2;
-      x <<= 2; 
-    }
-  if (x <= 0x7FFFFFFF)
-    n++;
-  return n;
+  return __builtin_clz (x);
 }
 
-/* Divides unsigned 64-bit N by unsigned 64-bit D and returns the
-   quotient. */
+/* Divides unsigned 64-bit N by unsigned 64-bit D, stores the
+   remainder in *R, and returns the quotient. */
 static uint64_t
-udiv64 (uint64_t n, uint64_t d)
+udivmod64 (uint64_t n, uint64_t d, uint64_t *r)
 {
   if ((d >> 32) == 0) 
     {
-      /* Proof of correctness:
-
-         Let n, d, b, n1, and n0 be defined as in this function.
-         Let [x] be the "floor" of x.  Let T = b[n1/d].  Assume d
-         nonzero.  Then:
-             [n/d] = [n/d] - T + T
-                   = [n/d - T] + T                         by (1) below
-                   = [(b*n1 + n0)/d - T] + T               by definition of n
-                   = [(b*n1 + n0)/d - dT/d] + T
-                   = [(b(n1 - d[n1/d]) + n0)/d] + T
-                   = [(b[n1 % d] + n0)/d] + T,             by definition of %
-         which is the expression calculated below.
-
-         (1) Note that for any real x, integer i: [x] + i = [x + i].
-
-         To prevent divl() from trapping, [(b[n1 % d] + n0)/d] must
-         be less than b.  Assume that [n1 % d] and n0 take their
-         respective maximum values of d - 1 and b - 1:
-                 [(b(d - 1) + (b - 1))/d] < b
-             <=> [(bd - 1)/d] < b
-             <=> [b - 1/d] < b
-         which is a tautology.
-
-         Therefore, this code is correct and will not trap. */
-      uint64_t b = 1ULL << 32;
       uint32_t n1 = n >> 32;
       uint32_t n0 = n; 
       uint32_t d0 = d;
+      uint32_t q1, q0, r0;
 
-      return divl (b * (n1 % d0) + n0, d0) + b * (n1 / d0); 
+      if (n1 < d0)
+        {
+          /* The quotient fits in 32 bits, which is the common
+             case, so a single DIVL does it. */
+          q1 = 0;
+          q0 = divl (n, d0, &r0);
+        }
+      else 
+        {
+          /* Proof of correctness:
+
+             Let n, d, b, n1, and n0 be defined as in this
+             function.  Let [x] be the "floor" of x.  Let
+             T = b[n1/d].  Assume d nonzero.  Then:
+                 [n/d] = [n/d] - T + T
+                       = [n/d - T] + T                     by (1) below
+                       = [(b*n1 + n0)/d - T] + T           by definition of n
+                       = [(b*n1 + n0)/d - dT/d] + T
+                       = [(b(n1 - d[n1/d]) + n0)/d] + T
+                       = [(b[n1 % d] + n0)/d] + T,         by definition of %
+             which is the expression calculated below, and the
+             remainder of the second division is n % d.
+
+             (1) Note that for any real x, integer i: [x] + i = [x + i].
+
+             To prevent divl() from trapping, [(b[n1 % d] + n0)/d]
+             must be less than b.  Assume that [n1 % d] and n0
+             take their respective maximum values of d - 1 and
+             b - 1:
+                     [(b(d - 1) + (b - 1))/d] < b
+                 <=> [(bd - 1)/d] < b
+                 <=> [b - 1/d] < b
+             which is a tautology.
+
+             Therefore, this code is correct and will not trap. */
+          uint32_t r1;
+
+          q1 = divl (n1, d0, &r1);
+          q0 = divl ((uint64_t) r1 << 32 | n0, d0, &r0);
+        }
+      *r = r0;
+      return (uint64_t) q1 << 32 | q0;
+    }
+  else if (n < d)
+    {
+      *r = n;
+      return 0;
     }
   else 
     {
       /* Based on the algorithm and proof available from
-         http://www.hackersdelight.org/revisions.pdf. */
-      if (n < d)
-        return 0;
-      else 
+         http://www.hackersdelight.org/revisions.pdf.  Shifting D
+         left until its top bit is set makes its high word a
+         divisor whose quotient, from one DIVL, is the true
+         quotient or one more, so at most one correction is
+         needed. */
+      uint32_t d1 = d >> 32;
+      int s = nlz (d1);
+      uint32_t unused;
+      uint64_t q = divl (n >> 1, (d << s) >> 32, &unused) >> (31 - s);
+
+      q--;
+      *r = n - q * d;
+      if (*r >= d)
         {
-          uint32_t d1 = d >> 32;
-          int s = nlz (d1);
-          uint64_t q = divl (n >> 1, (d << s) >> 32) >> (31 - s);
-          return n - (q - 1) * d < d ? q - 1 : q; 
+          q++;
+          *r -= d;
         }
+      return q;
     }
 }
 
+/* Divides unsigned 64-bit N by unsigned 64-bit D and returns the
+   quotient. */
+static uint64_t
+udiv64 (uint64_t n, uint64_t d)
+{
+  uint64_t r;
+
+  return udivmod64 (n, d, &r);
+}
+
 /* Divides unsigned 64-bit N by unsigned 64-bit D and returns the
    remainder. */
-static uint32_t
+static uint64_t
 umod64 (uint64_t n, uint64_t d)
 {
-  return n - d * udiv64 (n, d);
+  uint64_t r;
+
+  udivmod64 (n, d, &r);
+  return r;
 }
 
 /* Divides signed 64-bit N by signed 64-bit D and returns the
@@ -146,11 +163,14 @@ sdiv64 (int64_t n, int64_t d)
 }
 
 /* Divides signed 64-bit N by signed 64-bit D and returns the
-   remainder. */
-static int32_t
+   remainder, which has the sign of N. */
+static int64_t
 smod64 (int64_t n, int64_t d)
 {
-  return n - d * sdiv64 (n, d);
+  uint64_t n_abs = n >= 0 ? (uint64_t) n : -(uint64_t) n;
+  uint64_t d_abs = d >= 0 ? (uint64_t) d : -(uint64_t) d;
+  uint64_t r_abs = umod64 (n_abs, d_abs);
+  return n >= 0 ? (int64_t) r_abs : -(int64_t) r_abs;
 }
 
 /* These are the routines that GCC calls. */
@@ -23,11 +23,24 @@ typedef unsigned long elem_type;
 
 /* From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
-   simulates an array of bits. */
+   simulates an array of bits.
+
+   A bitmap made by bitmap_create_summarized() also has a summary,
+   another array of bits with one bit for each element of BITS,
+   which is set if any of the bits in the element is false.
+   Every change to the bitmap updates the summary, so that
+   finding a false bit in a nearly full bitmap takes a read of a
+   summary element and of the element it points to, instead of a
+   read of every full element in between.  The summary is not
+   stored by bitmap_write().  Nor is it updated in the same
+   atomic step as the bits, so a summarized bitmap needs a lock
+   of its user's around every change, even those that are
+   otherwise atomic. */
 struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
     elem_type *bits;    /* Elements that represent bits. */
+    elem_type *summary; /* Non-full elements, or null. */
   };
 
 /* Returns the index of the element that contains the bit
@@ -46,6 +59,15 @@ bit_mask (size_t bit_idx)
   return (elem_type) 1 << (bit_idx % ELEM_BITS);
 }
 
+/* Returns an elem_type with the N bits starting at bit OFS
+   turned on.  OFS + N must not exceed ELEM_BITS. */
+static inline elem_type
+run_mask (size_t ofs, size_t n) 
+{
+  return (n == ELEM_BITS ? (elem_type) -1
+          : (((elem_type) 1 << n) - 1) << ofs);
+}
+
 /* Returns the number of elements required for BIT_CNT bits. */
 static inline size_t
 elem_cnt (size_t bit_cnt)
@@ -69,6 +91,76 @@ last_mask (const struct bitmap *b)
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Brings the summary bit for element IDX of B's bits up to date,
+   if B has a summary. */
+static inline void
+update_summary (struct bitmap *b, size_t idx) 
+{
+  if (b->summary != NULL)
+    {
+      elem_type used = (idx == elem_cnt (b->bit_cnt) - 1
+                        ? last_mask (b) : (elem_type) -1);
+
+      if ((b->bits[idx] & used) != used)
+        b->summary[elem_idx (idx)] |= bit_mask (idx);
+      else
+        b->summary[elem_idx (idx)] &= ~bit_mask (idx);
+    }
+}
+
+/* Returns the index of the first element of B's bits at or after
+   IDX, and before LIMIT, that the summary says has a false bit, or
+   LIMIT if there is none.  B must have a summary. */
+static size_t
+find_nonfull (const struct bitmap *b, size_t idx, size_t limit) 
+{
+  size_t sidx = elem_idx (idx);
+  elem_type bits;
+
+  if (idx >= limit)
+    return limit;
+  bits = b->summary[sidx] & ((elem_type) -1 << (idx % ELEM_BITS));
+  while (bits == 0)
+    {
+      if (++sidx >= elem_cnt (limit))
+        return limit;
+      bits = b->summary[sidx];
+    }
+  idx = sidx * ELEM_BITS + __builtin_ctzl (bits);
+  return idx < limit ? idx : limit;
+}
+
+/* Returns the index of the first bit in B at or after START,
+   and before END, that is set to VALUE, or END if there is none.
+   Looks at a whole element at a time, skipping over elements
+   with no such bit, and finds the bit within an element with a
+   single bit-scan instruction. */
+static size_t
+find_bit (const struct bitmap *b, size_t start, size_t end, bool value) 
+{
+  elem_type flip = value ? 0 : (elem_type) -1;
+  size_t idx = elem_idx (start);
+  elem_type bits;
+
+  if (start >= end)
+    return end;
+
+  /* Turn the bits we want into 1s, and drop those before START. */
+  bits = (b->bits[idx] ^ flip) & ((elem_type) -1 << (start % ELEM_BITS));
+  while (bits == 0)
+    {
+      if (!value && b->summary != NULL)
+        idx = find_nonfull (b, idx + 1, elem_cnt (end));
+      else
+        idx++;
+      if (idx >= elem_cnt (end))
+        return end;
+      bits = b->bits[idx] ^ flip;
+    }
+  start = idx * ELEM_BITS + __builtin_ctzl (bits);
+  return start < end ? start : end;
+}
+
 /* Creation and destruction. */
 
 /* Initializes B to be a bitmap of BIT_CNT bits
@@ -82,6 +174,7 @@ bitmap_create (size_t bit_cnt)
   if (b != NULL)
     {
       b->bit_cnt = bit_cnt;
+      b->summary = NULL;
       b->bits = malloc (byte_cnt (bit_cnt));
       if (b->bits != NULL || bit_cnt == 0)
         {
@@ -93,6 +186,30 @@ bitmap_create (size_t bit_cnt)
   return NULL;
 }
 
+/* Like bitmap_create(), but gives the bitmap a summary, which
+   makes finding false bits in it faster for large, mostly true
+   bitmaps, such as allocation maps, at the cost of a little
+   memory and a little time for each change.  Changes to the
+   bitmap are not atomic, so the caller must serialize them, as
+   with a lock. */
+struct bitmap *
+bitmap_create_summarized (size_t bit_cnt) 
+{
+  struct bitmap *b = bitmap_create (bit_cnt);
+  if (b != NULL)
+    {
+      b->summary = calloc (elem_cnt (elem_cnt (bit_cnt)) + 1,
+                           sizeof *b->summary);
+      if (b->summary == NULL)
+        {
+          bitmap_destroy (b);
+          return NULL;
+        }
+      bitmap_set_all (b, false);
+    }
+  return b;
+}
+
 /* Creates and returns a bitmap with BIT_CNT bits in the
    BLOCK_SIZE bytes of storage preallocated at BLOCK.
    BLOCK_SIZE must be at least bitmap_needed_bytes(BIT_CNT). */
@@ -105,6 +222,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 
   b->bit_cnt = bit_cnt;
   b->bits = (elem_type *) (b + 1);
+  b->summary = NULL;
   bitmap_set_all (b, false);
   return b;
 }
@@ -125,6 +243,7 @@ bitmap_destroy (struct bitmap *b)
 {
   if (b != NULL) 
     {
+      free (b->summary);
       free (b->bits);
       free (b);
     }
@@ -153,7 +272,8 @@ bitmap_set (struct bitmap *b, size_t idx, bool value)
     bitmap_reset (b, idx);
 }
 
-/* Atomically sets the bit numbered BIT_IDX in B to true. */
+/* Atomically sets the bit numbered BIT_IDX in B to true.  Not
+   atomic if B has a summary; see bitmap_create_summarized(). */
 void
 bitmap_mark (struct bitmap *b, size_t bit_idx) 
 {
@@ -164,9 +284,11 @@ bitmap_mark (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the OR instruction in [IA32-v2b]. */
   asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  update_summary (b, idx);
 }
 
-/* Atomically sets the bit numbered BIT_IDX in B to false. */
+/* Atomically sets the bit numbered BIT_IDX in B to false.  Not
+   atomic if B has a summary; see bitmap_create_summarized(). */
 void
 bitmap_reset (struct bitmap *b, size_t bit_idx) 
 {
@@ -177,11 +299,13 @@ bitmap_reset (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the AND instruction in [IA32-v2a]. */
   asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+  update_summary (b, idx);
 }
 
 /* Atomically toggles the bit numbered IDX in B;
    that is, if it is true, makes it false,
-   and if it is false, makes it true. */
+   and if it is false, makes it true.  Not atomic if B has a
+   summary; see bitmap_create_summarized(). */
 void
 bitmap_flip (struct bitmap *b, size_t bit_idx) 
 {
@@ -192,6 +316,7 @@ bitmap_flip (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the XOR instruction in [IA32-v2b]. */
   asm ("xorl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  update_summary (b, idx);
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -224,8 +349,25 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  /* Sets the bits an element at a time, so that each element is
+     written and its summary bit brought up to date once. */
+  for (i = start; i < start + cnt; ) 
+    {
+      size_t idx = elem_idx (i);
+      size_t ofs = i % ELEM_BITS;
+      size_t n = start + cnt - i;
+      elem_type mask;
+
+      if (n > ELEM_BITS - ofs)
+        n = ELEM_BITS - ofs;
+      mask = run_mask (ofs, n);
+      if (value)
+        asm ("orl %1, %0" : "+m" (b->bits[idx]) : "r" (mask) : "cc");
+      else
+        asm ("andl %1, %0" : "+m" (b->bits[idx]) : "r" (~mask) : "cc");
+      update_summary (b, idx);
+      i += n;
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -251,16 +393,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_bit (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -292,20 +429,31 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   Alternately finds the next bit set to VALUE, which may start a
+   group, and the next bit after it that is not, which ends the
+   group, a word at a time, so that the time taken depends on the
+   number of words and of groups passed, not on CNT. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt) 
+  if (cnt == 0)
+    return start;
+  while (cnt <= b->bit_cnt - start)
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t end;
+
+      start = find_bit (b, start, b->bit_cnt - cnt + 1, value);
+      if (start > b->bit_cnt - cnt)
+        break;
+      end = find_bit (b, start, start + cnt, !value);
+      if (end == start + cnt)
+        return start;
+      start = end;
     }
   return BITMAP_ERROR;
 }
@@ -326,6 +474,88 @@ bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value)
   return idx;
 }
 
+/* Atomically sets the bits in MASK of element IDX of B to true,
+   if they are all false, and returns true, or returns false if
+   any of them is true.  Changes to the element's other bits
+   between the test and the update make it try again, instead of
+   being lost. */
+static bool
+claim_elem (struct bitmap *b, size_t idx, elem_type mask) 
+{
+  elem_type old = *(volatile elem_type *) &b->bits[idx];
+
+  for (;;)
+    {
+      elem_type seen;
+
+      if (old & mask)
+        return false;
+      asm volatile ("lock cmpxchgl %2, %1"
+                    : "=a" (seen), "+m" (b->bits[idx])
+                    : "r" (old | mask), "0" (old)
+                    : "cc", "memory");
+      if (seen == old)
+        break;
+      old = seen;
+    }
+  update_summary (b, idx);
+  return true;
+}
+
+/* Sets the CNT bits starting at START in B to true if they are
+   all false, and returns true, or returns false if any of them
+   is true.  Each element's bits are tested and set in a single
+   atomic step, without any lock, so two callers can never both
+   take the same bit.  If a later element's bits are found
+   taken, the earlier ones are given back, so a run that spans
+   elements is claimed all or not at all, although another
+   caller may briefly see part of it set.  If B has a summary,
+   none of this holds unless callers take a lock. */
+bool
+bitmap_try_claim (struct bitmap *b, size_t start, size_t cnt) 
+{
+  size_t i;
+
+  ASSERT (b != NULL);
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (start + cnt <= b->bit_cnt);
+
+  for (i = start; i < start + cnt; ) 
+    {
+      size_t ofs = i % ELEM_BITS;
+      size_t n = start + cnt - i;
+
+      if (n > ELEM_BITS - ofs)
+        n = ELEM_BITS - ofs;
+      if (!claim_elem (b, elem_idx (i), run_mask (ofs, n)))
+        {
+          bitmap_set_multiple (b, start, i - start, false);
+          return false;
+        }
+      i += n;
+    }
+  return true;
+}
+
+/* Finds the first group of CNT consecutive false bits in B at or
+   after START, sets them all to true with bitmap_try_claim(), and
+   returns the index of the first bit in the group.  If another
+   caller takes part of the group first, looks again.  If there
+   is no such group, returns BITMAP_ERROR.  Unlike
+   bitmap_scan_and_flip(), safe to call concurrently without a
+   lock. */
+size_t
+bitmap_claim (struct bitmap *b, size_t start, size_t cnt) 
+{
+  for (;;)
+    {
+      size_t idx = bitmap_scan (b, start, cnt, false);
+      if (idx == BITMAP_ERROR || bitmap_try_claim (b, idx, cnt))
+        return idx;
+      start = idx;
+    }
+}
+
 /* File input and output. */
 
 #ifdef FILESYS
@@ -345,8 +575,12 @@ bitmap_read (struct bitmap *b, struct file *file)
   if (b->bit_cnt > 0) 
     {
       off_t size = byte_cnt (b->bit_cnt);
+      size_t i;
+
       success = file_read_at (file, b->bits, size, 0) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+      for (i = 0; i < elem_cnt (b->bit_cnt); i++)
+        update_summary (b, i);
     }
   return success;
 }
@@ -359,6 +593,30 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the part of B that holds the CNT bits starting at START
+   to FILE, which must already hold B as written by
+   bitmap_write().  Only the elements containing those bits are
+   written.  Return true if successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t start, size_t cnt)
+{
+  off_t ofs, end;
+
+  ASSERT (b != NULL);
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (cnt <= b->bit_cnt - start);
+
+  if (cnt == 0)
+    return true;
+  ofs = elem_idx (start) * sizeof (elem_type);
+  end = (elem_idx (start + cnt - 1) + 1) * sizeof (elem_type);
+  if (end > (off_t) byte_cnt (b->bit_cnt))
+    end = byte_cnt (b->bit_cnt);
+  return file_write_at (file, (const char *) b->bits + ofs, end - ofs, ofs)
+         == end - ofs;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
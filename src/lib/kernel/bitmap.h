@@ -9,6 +9,7 @@
 
 /* Creation and destruction. */
 struct bitmap *bitmap_create (size_t bit_cnt);
+struct bitmap *bitmap_create_summarized (size_t bit_cnt);
 struct bitmap *bitmap_create_in_buf (size_t bit_cnt, void *, size_t byte_cnt);
 size_t bitmap_buf_size (size_t bit_cnt);
 void bitmap_destroy (struct bitmap *);
@@ -36,6 +37,8 @@ bool bitmap_all (const struct bitmap *, size_t start, size_t cnt);
 #define BITMAP_ERROR SIZE_MAX
 size_t bitmap_scan (const struct bitmap *, size_t start, size_t cnt, bool);
 size_t bitmap_scan_and_flip (struct bitmap *, size_t start, size_t cnt, bool);
+bool bitmap_try_claim (struct bitmap *, size_t start, size_t cnt);
+size_t bitmap_claim (struct bitmap *, size_t start, size_t cnt);
 
 /* File input and output. */
 #ifdef FILESYS
@@ -43,6 +46,8 @@ struct file;
 size_t bitmap_file_size (const struct bitmap *);
 bool bitmap_read (struct bitmap *, struct file *);
 bool bitmap_write (const struct bitmap *, struct file *);
+bool bitmap_write_range (const struct bitmap *, struct file *,
+                         size_t start, size_t cnt);
 #endif
 
 /* Debugging. */
@@ -1,14 +1,32 @@
 #include <console.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/serial.h"
 #include "devices/vga.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/stats.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 
 static void vprintf_helper (char, void *);
 static void putchar_have_lock (uint8_t c);
+static void putbuf_have_lock (const char *, size_t);
+static void log_append (const char *, size_t);
+static void log_drain (void);
+static thread_func log_thread;
+
+/* Output buffered by vprintf() for a single call.  Characters
+   are collected here and written to the serial port and the vga
+   display a buffer at a time. */
+#define VPRINTF_BUFSIZE 64
+struct vprintf_aux
+  {
+    char buf[VPRINTF_BUFSIZE];  /* Characters not yet written. */
+    size_t len;                 /* Number of characters in buf. */
+    int char_cnt;               /* Characters formatted so far. */
+  };
 
 /* The console lock.
    Both the vga and serial layers do their own locking, so it's
@@ -57,30 +75,92 @@ static bool use_console_lock;
 static int console_lock_depth;
 
 /* Number of characters written to console. */
-static int64_t write_cnt;
+static struct stats_counter write_cnt;
+
+/* Asynchronous kernel log.
+
+   With -async-console, once console_start() has run, output does
+   not go straight to the serial port and the vga display.  It is
+   appended instead to log_buf, a ring of LOG_SIZE bytes, with
+   interrupts disabled only for the copy, and a thread at PRI_MIN
+   writes it out to the devices.  A thread that prints thus waits
+   neither for the serial port, which at 9600 bps takes about a
+   millisecond a character, nor for a lower-priority thread that
+   is printing: the console lock is still taken, to keep printf()
+   calls from mixing their output, but only for as long as the
+   formatting and the copy take.  The drainer holds log_lock, not
+   the console lock, while it writes.
+
+   A thread that finds the ring full writes it out itself, so that
+   output stays in order and is never dropped; an interrupt
+   handler, which cannot wait, writes what does not fit straight
+   to the devices.  console_flush() writes out what is buffered,
+   for use before the machine powers off, and console_panic()
+   returns the console to synchronous output, because a panic may
+   never let the drainer run again. */
+#define LOG_SIZE 16384                  /* Power of 2. */
+static char log_buf[LOG_SIZE];
+static size_t log_head;                 /* Bytes appended, ever. */
+static size_t log_tail;                 /* Bytes written out, ever. */
+static struct lock log_lock;            /* Held while writing out. */
+static struct semaphore log_ready;      /* Upped to wake the drainer. */
+static bool log_wakeup;                 /* log_ready upped, not downed. */
+static bool log_async;                  /* Appending to log_buf? */
+
+/* -async-console: Write console output from a thread? */
+bool console_async;
 
 /* Enable console locking. */
 void
 console_init (void) 
 {
-  lock_init (&console_lock);
+  lock_init_named (&console_lock, "console");
+  stats_register (&write_cnt, "console", "chars", STATS_COUNTER);
   use_console_lock = true;
 }
 
-/* Notifies the console that a kernel panic is underway,
-   which warns it to avoid trying to take the console lock from
-   now on. */
+/* If -async-console was given, starts the thread that writes out
+   the kernel log and begins buffering console output.  Must be
+   called after the thread system is started. */
 void
-console_panic (void) 
+console_start (void) 
 {
-  use_console_lock = false;
+  if (!console_async)
+    return;
+  lock_init_named (&log_lock, "console-log");
+  sema_init (&log_ready, 0);
+  if (thread_create ("console", PRI_MIN, log_thread, NULL) == TID_ERROR)
+    PANIC ("-async-console: cannot create thread");
+  log_async = true;
 }
 
-/* Prints console statistics. */
+/* Writes any buffered console output to the devices, waiting
+   until it is written.  Does nothing unless console output is
+   being buffered. */
 void
-console_print_stats (void) 
+console_flush (void) 
 {
-  printf ("Console: %lld characters output\n", write_cnt);
+  if (log_async && !intr_context ())
+    {
+      lock_acquire (&log_lock);
+      log_drain ();
+      lock_release (&log_lock);
+    }
+}
+
+/* Notifies the console that a kernel panic is underway,
+   which warns it to avoid trying to take the console lock from
+   now on, and writes out buffered output so that the panic
+   message follows it. */
+void
+console_panic (void) 
+{
+  use_console_lock = false;
+  if (log_async)
+    {
+      log_async = false;
+      log_drain ();
+    }
 }
 
 /* Acquires the console lock. */
@@ -125,13 +205,17 @@ console_locked_by_current_thread (void)
 int
 vprintf (const char *format, va_list args) 
 {
-  int char_cnt = 0;
+  struct vprintf_aux aux;
+
+  aux.len = 0;
+  aux.char_cnt = 0;
 
   acquire_console ();
-  __vprintf (format, args, vprintf_helper, &char_cnt);
+  __vprintf (format, args, vprintf_helper, &aux);
+  putbuf_have_lock (aux.buf, aux.len);
   release_console ();
 
-  return char_cnt;
+  return aux.char_cnt;
 }
 
 /* Writes string S to the console, followed by a new-line
@@ -140,8 +224,7 @@ int
 puts (const char *s) 
 {
   acquire_console ();
-  while (*s != '\0')
-    putchar_have_lock (*s++);
+  putbuf_have_lock (s, strlen (s));
   putchar_have_lock ('\n');
   release_console ();
 
@@ -153,8 +236,7 @@ void
 putbuf (const char *buffer, size_t n) 
 {
   acquire_console ();
-  while (n-- > 0)
-    putchar_have_lock (*buffer++);
+  putbuf_have_lock (buffer, n);
   release_console ();
 }
 
@@ -171,11 +253,17 @@ putchar (int c)
 
 /* Helper function for vprintf(). */
 static void
-vprintf_helper (char c, void *char_cnt_) 
+vprintf_helper (char c, void *aux_) 
 {
-  int *char_cnt = char_cnt_;
-  (*char_cnt)++;
-  putchar_have_lock (c);
+  struct vprintf_aux *aux = aux_;
+
+  aux->char_cnt++;
+  if (aux->len >= sizeof aux->buf)
+    {
+      putbuf_have_lock (aux->buf, aux->len);
+      aux->len = 0;
+    }
+  aux->buf[aux->len++] = c;
 }
 
 /* Writes C to the vga display and serial port.
@@ -185,7 +273,120 @@ static void
 putchar_have_lock (uint8_t c) 
 {
   ASSERT (console_locked_by_current_thread ());
-  write_cnt++;
+  stats_inc (&write_cnt);
+  if (log_async)
+    {
+      char ch = c;
+      log_append (&ch, 1);
+      return;
+    }
   serial_putc (c);
   vga_putc (c);
 }
+
+/* Writes the N characters in BUFFER to the vga display and
+   serial port, each in a single operation.
+   The caller has already acquired the console lock if
+   appropriate. */
+static void
+putbuf_have_lock (const char *buffer, size_t n) 
+{
+  ASSERT (console_locked_by_current_thread ());
+  if (n == 0)
+    return;
+  stats_add (&write_cnt, n);
+  if (log_async)
+    {
+      log_append (buffer, n);
+      return;
+    }
+  serial_putbuf (buffer, n);
+  vga_putbuf (buffer, n);
+}
+
+/* Appends the N characters in BUFFER to the kernel log and makes
+   sure the drainer will write them out.  Writes them out itself
+   if the log fills up. */
+static void
+log_append (const char *buffer, size_t n) 
+{
+  while (n > 0)
+    {
+      enum intr_level old_level = intr_disable ();
+      size_t space = LOG_SIZE - (log_head - log_tail);
+      size_t chunk = n < space ? n : space;
+      size_t ofs = log_head % LOG_SIZE;
+      size_t first = chunk < LOG_SIZE - ofs ? chunk : LOG_SIZE - ofs;
+      bool wake = chunk > 0 && !log_wakeup;
+
+      memcpy (log_buf + ofs, buffer, first);
+      memcpy (log_buf, buffer + first, chunk - first);
+      log_head += chunk;
+      if (wake)
+        log_wakeup = true;
+      intr_set_level (old_level);
+      if (wake)
+        sema_up (&log_ready);
+
+      buffer += chunk;
+      n -= chunk;
+      if (n > 0)
+        {
+          if (intr_context () || !use_console_lock)
+            {
+              serial_putbuf (buffer, n);
+              vga_putbuf (buffer, n);
+              return;
+            }
+          console_flush ();
+        }
+    }
+}
+
+/* Writes the contents of the kernel log to the devices, until it
+   is empty.  The caller must hold log_lock, unless a panic is
+   underway.  Characters between log_tail and log_head are not
+   overwritten until log_tail passes them, so they can be written
+   out with interrupts on. */
+static void
+log_drain (void) 
+{
+  for (;;)
+    {
+      enum intr_level old_level = intr_disable ();
+      size_t ofs = log_tail % LOG_SIZE;
+      size_t n = log_head - log_tail;
+      intr_set_level (old_level);
+
+      if (n == 0)
+        break;
+      if (n > LOG_SIZE - ofs)
+        n = LOG_SIZE - ofs;
+      serial_putbuf (log_buf + ofs, n);
+      vga_putbuf (log_buf + ofs, n);
+
+      old_level = intr_disable ();
+      log_tail += n;
+      intr_set_level (old_level);
+    }
+}
+
+/* Drainer thread: writes out the kernel log whenever something
+   is appended to it. */
+static void
+log_thread (void *aux UNUSED) 
+{
+  for (;;)
+    {
+      enum intr_level old_level;
+
+      sema_down (&log_ready);
+      old_level = intr_disable ();
+      log_wakeup = false;
+      intr_set_level (old_level);
+
+      lock_acquire (&log_lock);
+      log_drain ();
+      lock_release (&log_lock);
+    }
+}
@@ -1,8 +1,14 @@
 #ifndef __LIB_KERNEL_CONSOLE_H
 #define __LIB_KERNEL_CONSOLE_H
 
+#include <stdbool.h>
+
+/* -async-console: Write console output from a thread? */
+extern bool console_async;
+
 void console_init (void);
+void console_start (void);
+void console_flush (void);
 void console_panic (void);
-void console_print_stats (void);
 
 #endif /* lib/kernel/console.h */
@@ -0,0 +1,116 @@
+#include "crc32.h"
+#include <debug.h>
+
+/* CRC-32C, the CRC with the Castagnoli polynomial, as used by
+   iSCSI and ext4 and computed by the SSE4.2 crc32 instruction.
+   Its bits are taken least significant first, so its polynomial
+   is written reflected, and the register is complemented before
+   and after, so that leading and trailing zero bytes change the
+   result.
+
+   Without SSE4.2, the checksum is computed by "slicing by 8":
+   entry N of table K is the CRC of byte N followed by K zero
+   bytes, so that the CRC of 8 bytes at once is the exclusive-or
+   of 8 lookups, one per byte, none of which depends on another.
+   A byte at a time, every lookup waits for the one before.
+
+   The tables take 8 kB and are computed by crc32c_init() at
+   boot, which takes much less time than reading them from disk
+   as part of the kernel image would. */
+
+/* The Castagnoli polynomial, reflected. */
+#define POLYNOMIAL 0x82f63b78
+
+/* CPUID function 1 ECX bit for SSE4.2. */
+#define CPUID_SSE42 (1u << 20)
+
+static uint32_t tables[8][256];
+static bool have_hw;
+
+/* Computes the tables and checks for the crc32 instruction. */
+void
+crc32c_init (void)
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+  unsigned n, k;
+
+  for (n = 0; n < 256; n++)
+    {
+      uint32_t crc = n;
+      int bit;
+
+      for (bit = 0; bit < 8; bit++)
+        crc = (crc >> 1) ^ (crc & 1 ? POLYNOMIAL : 0);
+      tables[0][n] = crc;
+    }
+  for (n = 0; n < 256; n++)
+    for (k = 1; k < 8; k++)
+      tables[k][n] = ((tables[k - 1][n] >> 8)
+                      ^ tables[0][tables[k - 1][n] & 0xff]);
+
+  asm ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  have_hw = (ecx & CPUID_SSE42) != 0;
+}
+
+/* Returns true if crc32c() uses the crc32 instruction. */
+bool
+crc32c_hw_present (void)
+{
+  return have_hw;
+}
+
+/* Returns CRC extended over the SIZE bytes at BUF, using the
+   tables only. */
+uint32_t
+crc32c_sw (uint32_t crc, const void *buf, size_t size)
+{
+  const uint8_t *p = buf;
+
+  ASSERT (tables[0][1] != 0);
+
+  crc = ~crc;
+  for (; size > 0 && (uintptr_t) p % 4 != 0; size--)
+    crc = (crc >> 8) ^ tables[0][(crc ^ *p++) & 0xff];
+  for (; size >= 8; size -= 8, p += 8)
+    {
+      uint32_t one = *(const uint32_t *) p ^ crc;
+      uint32_t two = *(const uint32_t *) (p + 4);
+
+      crc = (tables[7][one & 0xff]
+             ^ tables[6][(one >> 8) & 0xff]
+             ^ tables[5][(one >> 16) & 0xff]
+             ^ tables[4][one >> 24]
+             ^ tables[3][two & 0xff]
+             ^ tables[2][(two >> 8) & 0xff]
+             ^ tables[1][(two >> 16) & 0xff]
+             ^ tables[0][two >> 24]);
+    }
+  for (; size > 0; size--)
+    crc = (crc >> 8) ^ tables[0][(crc ^ *p++) & 0xff];
+  return ~crc;
+}
+
+/* Returns CRC extended over the SIZE bytes at BUF with the crc32
+   instruction, 4 bytes at a time. */
+static uint32_t
+crc32c_hw (uint32_t crc, const void *buf, size_t size)
+{
+  const uint8_t *p = buf;
+
+  crc = ~crc;
+  for (; size > 0 && (uintptr_t) p % 4 != 0; size--)
+    asm ("crc32b %1, %0" : "+r" (crc) : "rm" (*p++));
+  for (; size >= 4; size -= 4, p += 4)
+    asm ("crc32l %1, %0" : "+r" (crc) : "rm" (*(const uint32_t *) p));
+  for (; size > 0; size--)
+    asm ("crc32b %1, %0" : "+r" (crc) : "rm" (*p++));
+  return ~crc;
+}
+
+/* Returns CRC extended over the SIZE bytes at BUF, with the crc32
+   instruction if the CPU has it and otherwise with the tables. */
+uint32_t
+crc32c (uint32_t crc, const void *buf, size_t size)
+{
+  return have_hw ? crc32c_hw (crc, buf, size) : crc32c_sw (crc, buf, size);
+}
@@ -0,0 +1,18 @@
+#ifndef __LIB_KERNEL_CRC32_H
+#define __LIB_KERNEL_CRC32_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* CRC-32C (Castagnoli) checksums.  See crc32.c for details.
+
+   To checksum data in pieces, pass 0 as CRC for the first piece
+   and the previous result for each later one. */
+
+void crc32c_init (void);
+uint32_t crc32c (uint32_t crc, const void *, size_t);
+uint32_t crc32c_sw (uint32_t crc, const void *, size_t);
+bool crc32c_hw_present (void);
+
+#endif /* lib/kernel/crc32.h */
@@ -6,6 +6,7 @@
    See hash.h for basic information. */
 
 #include "hash.h"
+#include <string.h>
 #include "../debug.h"
 #include "threads/malloc.h"
 
@@ -13,8 +14,13 @@
         list_entry(LIST_ELEM, struct hash_elem, list_elem)
 
 static struct list *find_bucket (struct hash *, struct hash_elem *);
+static struct hash_elem *lookup (struct hash *, struct hash_elem *,
+                                 struct list **bucket);
 static struct hash_elem *find_elem (struct hash *, struct list *,
                                     struct hash_elem *);
+static struct list *next_bucket (struct hash *, struct list *);
+static void clear_buckets (struct hash *, struct list *, size_t cnt,
+                           hash_action_func *);
 static void insert_elem (struct hash *, struct list *, struct hash_elem *);
 static void remove_elem (struct hash *, struct hash_elem *);
 static void rehash (struct hash *);
@@ -28,6 +34,9 @@ hash_init (struct hash *h,
   h->elem_cnt = 0;
   h->bucket_cnt = 4;
   h->buckets = malloc (sizeof *h->buckets * h->bucket_cnt);
+  h->old_bucket_cnt = 0;
+  h->old_buckets = NULL;
+  h->migrate_idx = 0;
   h->hash = hash;
   h->less = less;
   h->aux = aux;
@@ -53,22 +62,14 @@ hash_init (struct hash *h,
 void
 hash_clear (struct hash *h, hash_action_func *destructor) 
 {
-  size_t i;
-
-  for (i = 0; i < h->bucket_cnt; i++) 
+  clear_buckets (h, h->buckets, h->bucket_cnt, destructor);
+  if (h->old_buckets != NULL) 
     {
-      struct list *bucket = &h->buckets[i];
-
-      if (destructor != NULL) 
-        while (!list_empty (bucket)) 
-          {
-            struct list_elem *list_elem = list_pop_front (bucket);
-            struct hash_elem *hash_elem = list_elem_to_hash_elem (list_elem);
-            destructor (hash_elem, h->aux);
-          }
-
-      list_init (bucket); 
-    }    
+      clear_buckets (h, h->old_buckets + h->migrate_idx,
+                     h->old_bucket_cnt - h->migrate_idx, destructor);
+      free (h->old_buckets);
+      h->old_buckets = NULL;
+    }
 
   h->elem_cnt = 0;
 }
@@ -89,6 +90,7 @@ hash_destroy (struct hash *h, hash_action_func *destructor)
   if (destructor != NULL)
     hash_clear (h, destructor);
   free (h->buckets);
+  free (h->old_buckets);
 }
 
 /* Inserts NEW into hash table H and returns a null pointer, if
@@ -98,8 +100,8 @@ hash_destroy (struct hash *h, hash_action_func *destructor)
 struct hash_elem *
 hash_insert (struct hash *h, struct hash_elem *new)
 {
-  struct list *bucket = find_bucket (h, new);
-  struct hash_elem *old = find_elem (h, bucket, new);
+  struct list *bucket;
+  struct hash_elem *old = lookup (h, new, &bucket);
 
   if (old == NULL) 
     insert_elem (h, bucket, new);
@@ -114,8 +116,8 @@ hash_insert (struct hash *h, struct hash_elem *new)
 struct hash_elem *
 hash_replace (struct hash *h, struct hash_elem *new) 
 {
-  struct list *bucket = find_bucket (h, new);
-  struct hash_elem *old = find_elem (h, bucket, new);
+  struct list *bucket;
+  struct hash_elem *old = lookup (h, new, &bucket);
 
   if (old != NULL)
     remove_elem (h, old);
@@ -131,7 +133,9 @@ hash_replace (struct hash *h, struct hash_elem *new)
 struct hash_elem *
 hash_find (struct hash *h, struct hash_elem *e) 
 {
-  return find_elem (h, find_bucket (h, e), e);
+  struct list *bucket;
+
+  return lookup (h, e, &bucket);
 }
 
 /* Finds, removes, and returns an element equal to E in hash
@@ -144,7 +148,8 @@ hash_find (struct hash *h, struct hash_elem *e)
 struct hash_elem *
 hash_delete (struct hash *h, struct hash_elem *e)
 {
-  struct hash_elem *found = find_elem (h, find_bucket (h, e), e);
+  struct list *bucket;
+  struct hash_elem *found = lookup (h, e, &bucket);
   if (found != NULL) 
     {
       remove_elem (h, found);
@@ -162,13 +167,12 @@ hash_delete (struct hash *h, struct hash_elem *e)
 void
 hash_apply (struct hash *h, hash_action_func *action) 
 {
-  size_t i;
+  struct list *bucket;
   
   ASSERT (action != NULL);
 
-  for (i = 0; i < h->bucket_cnt; i++) 
+  for (bucket = h->buckets; bucket != NULL; bucket = next_bucket (h, bucket))
     {
-      struct list *bucket = &h->buckets[i];
       struct list_elem *elem, *next;
 
       for (elem = list_begin (bucket); elem != list_end (bucket); elem = next) 
@@ -223,7 +227,8 @@ hash_next (struct hash_iterator *i)
   i->elem = list_elem_to_hash_elem (list_next (&i->elem->list_elem));
   while (i->elem == list_elem_to_hash_elem (list_end (i->bucket)))
     {
-      if (++i->bucket >= i->hash->buckets + i->hash->bucket_cnt)
+      i->bucket = next_bucket (i->hash, i->bucket);
+      if (i->bucket == NULL)
         {
           i->elem = NULL;
           break;
@@ -257,48 +262,90 @@ hash_empty (struct hash *h)
   return h->elem_cnt == 0;
 }
 
-/* Fowler-Noll-Vo hash constants, for 32-bit word sizes. */
-#define FNV_32_PRIME 16777619u
-#define FNV_32_BASIS 2166136261u
+/* MurmurHash3 constants, for the 32-bit variant. */
+#define MURMUR_C1 0xcc9e2d51u
+#define MURMUR_C2 0x1b873593u
+
+/* A 32-bit word that may be misaligned.  x86 loads these as fast,
+   or nearly as fast, as aligned words. */
+typedef uint32_t unaligned_word __attribute__ ((aligned (1), may_alias));
+
+/* Returns X rotated left by N bits. */
+static inline uint32_t
+rotl (uint32_t x, int n) 
+{
+  return (x << n) | (x >> (32 - n));
+}
+
+/* Scrambles K, a word of input, for mixing into a hash. */
+static inline uint32_t
+scramble (uint32_t k) 
+{
+  return rotl (k * MURMUR_C1, 15) * MURMUR_C2;
+}
+
+/* Spreads every bit of H across all the bits of the result, so
+   that masking off the low bits, as hash tables do to pick a
+   bucket, depends on all of H. */
+static inline uint32_t
+finish (uint32_t h) 
+{
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
 
 /* Returns a hash of the SIZE bytes in BUF. */
 unsigned
 hash_bytes (const void *buf_, size_t size)
 {
-  /* Fowler-Noll-Vo 32-bit hash, for bytes. */
+  /* MurmurHash3, 32-bit, taking the input a word at a time. */
   const unsigned char *buf = buf_;
-  unsigned hash;
+  uint32_t hash = 0;
+  uint32_t k = 0;
+  size_t i;
 
   ASSERT (buf != NULL);
 
-  hash = FNV_32_BASIS;
-  while (size-- > 0)
-    hash = (hash * FNV_32_PRIME) ^ *buf++;
+  for (i = 0; i + 4 <= size; i += 4)
+    {
+      hash ^= scramble (*(const unaligned_word *) (buf + i));
+      hash = rotl (hash, 13) * 5 + 0xe6546b64u;
+    }
+  switch (size & 3)
+    {
+    case 3:
+      k ^= buf[i + 2] << 16;
+      /* Fall through. */
+    case 2:
+      k ^= buf[i + 1] << 8;
+      /* Fall through. */
+    case 1:
+      k ^= buf[i];
+      hash ^= scramble (k);
+    }
 
-  return hash;
+  return finish (hash ^ size);
 } 
 
-/* Returns a hash of string S. */
+/* Returns a hash of string S, the same as that of its bytes,
+   not including the null terminator. */
 unsigned
-hash_string (const char *s_) 
+hash_string (const char *s) 
 {
-  const unsigned char *s = (const unsigned char *) s_;
-  unsigned hash;
-
   ASSERT (s != NULL);
 
-  hash = FNV_32_BASIS;
-  while (*s != '\0')
-    hash = (hash * FNV_32_PRIME) ^ *s++;
-
-  return hash;
+  return hash_bytes (s, strlen (s));
 }
 
 /* Returns a hash of integer I. */
 unsigned
 hash_int (int i) 
 {
-  return hash_bytes (&i, sizeof i);
+  return finish (i);
 }
 
 /* Returns the bucket in H that E belongs in. */
@@ -309,6 +356,28 @@ find_bucket (struct hash *h, struct hash_elem *e)
   return &h->buckets[bucket_idx];
 }
 
+/* Searches H for a hash element equal to E, in the bucket E
+   belongs in and, while H is being resized, in the old bucket it
+   belonged in if that has not yet been emptied.  Returns the
+   element if found or a null pointer otherwise, and sets *BUCKET
+   to the bucket E belongs in. */
+static struct hash_elem *
+lookup (struct hash *h, struct hash_elem *e, struct list **bucket) 
+{
+  unsigned hash = h->hash (e, h->aux);
+  struct hash_elem *found;
+
+  *bucket = &h->buckets[hash & (h->bucket_cnt - 1)];
+  found = find_elem (h, *bucket, e);
+  if (found == NULL && h->old_buckets != NULL) 
+    {
+      size_t old_idx = hash & (h->old_bucket_cnt - 1);
+      if (old_idx >= h->migrate_idx)
+        found = find_elem (h, &h->old_buckets[old_idx], e);
+    }
+  return found;
+}
+
 /* Searches BUCKET in H for a hash element equal to E.  Returns
    it if found or a null pointer otherwise. */
 static struct hash_elem *
@@ -344,22 +413,98 @@ is_power_of_2 (size_t x)
 #define BEST_ELEMS_PER_BUCKET 2 /* Ideal elems/bucket. */
 #define MAX_ELEMS_PER_BUCKET  4 /* Elems/bucket > 4: increase # of buckets. */
 
-/* Changes the number of buckets in hash table H to match the
-   ideal.  This function can fail because of an out-of-memory
-   condition, but that'll just make hash accesses less efficient;
-   we can still continue. */
+/* Number of old buckets emptied by each call to rehash() while a
+   table is being resized.  Resizing starts when the number of
+   elements reaches double or half of what the old bucket count
+   suits, so at this rate it ends long before the next resize is
+   due. */
+#define MIGRATE_CNT 4
+
+/* Returns the bucket in H after BUCKET, going on from the last of
+   H's buckets to the old buckets still to be emptied, or a null
+   pointer after the last of them. */
+static struct list *
+next_bucket (struct hash *h, struct list *bucket) 
+{
+  if (bucket >= h->buckets && bucket < h->buckets + h->bucket_cnt) 
+    {
+      if (++bucket < h->buckets + h->bucket_cnt)
+        return bucket;
+      return (h->old_buckets != NULL
+              ? h->old_buckets + h->migrate_idx : NULL);
+    }
+  return ++bucket < h->old_buckets + h->old_bucket_cnt ? bucket : NULL;
+}
+
+/* Empties the CNT buckets in BUCKETS, calling DESTRUCTOR, if it is
+   non-null, for each element. */
+static void
+clear_buckets (struct hash *h, struct list *buckets, size_t cnt,
+               hash_action_func *destructor) 
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++) 
+    {
+      struct list *bucket = &buckets[i];
+
+      if (destructor != NULL) 
+        while (!list_empty (bucket)) 
+          {
+            struct list_elem *list_elem = list_pop_front (bucket);
+            struct hash_elem *hash_elem = list_elem_to_hash_elem (list_elem);
+            destructor (hash_elem, h->aux);
+          }
+
+      list_init (bucket); 
+    }    
+}
+
+/* Moves the elements of up to CNT of H's old buckets into the
+   buckets they now belong in, and frees the old buckets once they
+   are all empty. */
+static void
+migrate (struct hash *h, size_t cnt) 
+{
+  for (; cnt > 0 && h->old_buckets != NULL; cnt--) 
+    {
+      struct list *old_bucket = &h->old_buckets[h->migrate_idx];
+
+      while (!list_empty (old_bucket)) 
+        {
+          struct list_elem *elem = list_pop_front (old_bucket);
+          list_push_front (find_bucket (h, list_elem_to_hash_elem (elem)),
+                           elem);
+        }
+
+      if (++h->migrate_idx >= h->old_bucket_cnt) 
+        {
+          free (h->old_buckets);
+          h->old_buckets = NULL;
+        }
+    }
+}
+
+/* Moves on the resizing of hash table H, if it is being resized,
+   or otherwise starts resizing it if its number of buckets does
+   not match the ideal.  This function can fail because of an
+   out-of-memory condition, but that'll just make hash accesses
+   less efficient; we can still continue. */
 static void
 rehash (struct hash *h) 
 {
-  size_t old_bucket_cnt, new_bucket_cnt;
-  struct list *new_buckets, *old_buckets;
+  size_t new_bucket_cnt;
+  struct list *new_buckets;
   size_t i;
 
   ASSERT (h != NULL);
 
-  /* Save old bucket info for later use. */
-  old_buckets = h->buckets;
-  old_bucket_cnt = h->bucket_cnt;
+  /* Finish one resize before starting another. */
+  if (h->old_buckets != NULL) 
+    {
+      migrate (h, MIGRATE_CNT);
+      return;
+    }
 
   /* Calculate the number of buckets to use now.
      We want one bucket for about every BEST_ELEMS_PER_BUCKET.
@@ -372,7 +517,7 @@ rehash (struct hash *h)
     new_bucket_cnt = turn_off_least_1bit (new_bucket_cnt);
 
   /* Don't do anything if the bucket count wouldn't change. */
-  if (new_bucket_cnt == old_bucket_cnt)
+  if (new_bucket_cnt == h->bucket_cnt)
     return;
 
   /* Allocate new buckets and initialize them as empty. */
@@ -387,29 +532,14 @@ rehash (struct hash *h)
   for (i = 0; i < new_bucket_cnt; i++) 
     list_init (&new_buckets[i]);
 
-  /* Install new bucket info. */
+  /* Install new bucket info, keeping the old buckets until
+     migrate() has emptied them. */
+  h->old_buckets = h->buckets;
+  h->old_bucket_cnt = h->bucket_cnt;
+  h->migrate_idx = 0;
   h->buckets = new_buckets;
   h->bucket_cnt = new_bucket_cnt;
-
-  /* Move each old element into the appropriate new bucket. */
-  for (i = 0; i < old_bucket_cnt; i++) 
-    {
-      struct list *old_bucket;
-      struct list_elem *elem, *next;
-
-      old_bucket = &old_buckets[i];
-      for (elem = list_begin (old_bucket);
-           elem != list_end (old_bucket); elem = next) 
-        {
-          struct list *new_bucket
-            = find_bucket (h, list_elem_to_hash_elem (elem));
-          next = list_next (elem);
-          list_remove (elem);
-          list_push_front (new_bucket, elem);
-        }
-    }
-
-  free (old_buckets);
+  migrate (h, MIGRATE_CNT);
 }
 
 /* Inserts E into BUCKET (in hash table H). */
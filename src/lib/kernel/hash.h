@@ -18,7 +18,16 @@
    conversion from a struct hash_elem back to a structure object
    that contains it.  This is the same technique used in the
    linked list implementation.  Refer to lib/kernel/list.h for a
-   detailed explanation. */
+   detailed explanation.
+
+   The number of buckets follows the number of elements.  Rather
+   than moving every element to a new bucket array at once when
+   it changes, which would make the one insertion or deletion
+   that triggers it take time proportional to the size of the
+   table, the table keeps the old array alongside the new one
+   while it is resized and moves a few of the old buckets'
+   elements across on each insertion, replacement and deletion.
+   Searches and iteration look in both arrays meanwhile. */
 
 #include <stdbool.h>
 #include <stddef.h>
@@ -61,6 +70,9 @@ struct hash
     size_t elem_cnt;            /* Number of elements in table. */
     size_t bucket_cnt;          /* Number of buckets, a power of 2. */
     struct list *buckets;       /* Array of `bucket_cnt' lists. */
+    size_t old_bucket_cnt;      /* Number of buckets in `old_buckets'. */
+    struct list *old_buckets;   /* Buckets being emptied, or null. */
+    size_t migrate_idx;         /* First old bucket not yet emptied. */
     hash_hash_func *hash;       /* Hash function. */
     hash_less_func *less;       /* Comparison function. */
     void *aux;                  /* Auxiliary data for `hash' and `less'. */
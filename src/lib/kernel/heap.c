@@ -0,0 +1,240 @@
+#include "heap.h"
+#include "../debug.h"
+
+/* Pairing heap.
+
+   The root of the tree is the greatest element.  Merging two
+   trees makes the root of the lesser the first child of the
+   root of the greater.  Popping the root merges its children in
+   two passes: first in pairs from left to right, then the
+   results from right to left, which is what keeps the tree
+   shallow enough for the amortized bounds in heap.h.
+
+   An element's PREV member points to its previous sibling, or to
+   its parent if it is the first child, so that it can be cut out
+   of the tree in constant time.  The root's PREV and NEXT are
+   null. */
+
+/* Initializes HEAP as an empty heap ordered by LESS, given
+   auxiliary data AUX. */
+void
+heap_init (struct heap *heap, heap_less_func *less, void *aux)
+{
+  ASSERT (heap != NULL);
+  ASSERT (less != NULL);
+
+  heap->root = NULL;
+  heap->less = less;
+  heap->aux = aux;
+}
+
+/* Merges trees A and B, neither of which has siblings, and
+   returns the root of the result. */
+static struct heap_elem *
+meld (struct heap *heap, struct heap_elem *a, struct heap_elem *b)
+{
+  if (heap->less (a, b, heap->aux))
+    {
+      struct heap_elem *t = a;
+      a = b;
+      b = t;
+    }
+
+  b->prev = a;
+  b->next = a->child;
+  if (a->child != NULL)
+    a->child->prev = b;
+  a->child = b;
+  return a;
+}
+
+/* Merges the list of sibling trees starting at FIRST into one
+   tree and returns its root, or a null pointer if FIRST is
+   null. */
+static struct heap_elem *
+merge_pairs (struct heap *heap, struct heap_elem *first)
+{
+  struct heap_elem *pairs = NULL;
+  struct heap_elem *root;
+
+  /* Meld the trees in pairs, left to right, collecting the
+     results in reverse order through their NEXT members. */
+  while (first != NULL)
+    {
+      struct heap_elem *a = first;
+      struct heap_elem *b = a->next;
+
+      a->prev = a->next = NULL;
+      if (b != NULL)
+        {
+          first = b->next;
+          b->prev = b->next = NULL;
+          a = meld (heap, a, b);
+        }
+      else
+        first = NULL;
+      a->next = pairs;
+      pairs = a;
+    }
+
+  /* Meld the results into one tree, right to left. */
+  root = pairs;
+  if (root != NULL)
+    {
+      pairs = root->next;
+      root->next = NULL;
+      while (pairs != NULL)
+        {
+          struct heap_elem *next = pairs->next;
+
+          pairs->next = NULL;
+          root = meld (heap, root, pairs);
+          pairs = next;
+        }
+    }
+  return root;
+}
+
+/* Cuts E, with its children, out of the tree it is in, which it
+   must not be the root of. */
+static void
+cut (struct heap_elem *e)
+{
+  if (e->prev->child == e)
+    e->prev->child = e->next;
+  else
+    e->prev->next = e->next;
+  if (e->next != NULL)
+    e->next->prev = e->prev;
+  e->prev = e->next = NULL;
+}
+
+/* Inserts E into HEAP. */
+void
+heap_push (struct heap *heap, struct heap_elem *e)
+{
+  ASSERT (heap != NULL);
+  ASSERT (e != NULL);
+
+  e->child = e->next = e->prev = NULL;
+  heap->root = heap->root != NULL ? meld (heap, heap->root, e) : e;
+}
+
+/* Removes and returns the greatest element in HEAP, which must
+   not be empty.  If more than one element is greatest, returns
+   any one of them. */
+struct heap_elem *
+heap_pop (struct heap *heap)
+{
+  struct heap_elem *root;
+
+  ASSERT (heap != NULL);
+  ASSERT (heap->root != NULL);
+
+  root = heap->root;
+  heap->root = merge_pairs (heap, root->child);
+  root->child = NULL;
+  return root;
+}
+
+/* Removes E, which must be in HEAP, from HEAP.  E's value may
+   have changed in any way since it was inserted or last
+   updated. */
+void
+heap_remove (struct heap *heap, struct heap_elem *e)
+{
+  struct heap_elem *sub;
+
+  ASSERT (heap != NULL);
+  ASSERT (e != NULL);
+
+  if (e == heap->root)
+    {
+      heap_pop (heap);
+      return;
+    }
+
+  cut (e);
+  sub = merge_pairs (heap, e->child);
+  e->child = NULL;
+  if (sub != NULL)
+    heap->root = meld (heap, heap->root, sub);
+}
+
+/* Restores the order of HEAP after the value of E, which must be
+   in HEAP, has become greater, or stayed the same. */
+void
+heap_increase (struct heap *heap, struct heap_elem *e)
+{
+  ASSERT (heap != NULL);
+  ASSERT (e != NULL);
+
+  if (e != heap->root)
+    {
+      cut (e);
+      heap->root = meld (heap, heap->root, e);
+    }
+}
+
+/* Restores the order of HEAP after the value of E, which must be
+   in HEAP, has changed in any way. */
+void
+heap_update (struct heap *heap, struct heap_elem *e)
+{
+  heap_remove (heap, e);
+  heap_push (heap, e);
+}
+
+/* Returns the first element of HEAP in a traversal of all its
+   elements, in no particular order, or a null pointer if HEAP is
+   empty.  Modifying HEAP during a traversal yields undefined
+   behavior. */
+struct heap_elem *
+heap_begin (struct heap *heap)
+{
+  ASSERT (heap != NULL);
+
+  return heap->root;
+}
+
+/* Returns the element after E in a traversal of its heap begun
+   with heap_begin(), or a null pointer if E is the last. */
+struct heap_elem *
+heap_next (struct heap_elem *e)
+{
+  ASSERT (e != NULL);
+
+  if (e->child != NULL)
+    return e->child;
+  for (;;)
+    {
+      if (e->next != NULL)
+        return e->next;
+
+      /* Climb to the first sibling, then to its parent. */
+      while (e->prev != NULL && e->prev->child != e)
+        e = e->prev;
+      e = e->prev;
+      if (e == NULL)
+        return NULL;
+    }
+}
+
+/* Returns the greatest element in HEAP, or a null pointer if
+   HEAP is empty. */
+struct heap_elem *
+heap_max (struct heap *heap)
+{
+  ASSERT (heap != NULL);
+
+  return heap->root;
+}
+
+/* Returns true if HEAP is empty, false otherwise. */
+bool
+heap_empty (struct heap *heap)
+{
+  ASSERT (heap != NULL);
+
+  return heap->root == NULL;
+}
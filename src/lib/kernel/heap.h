@@ -0,0 +1,73 @@
+#ifndef __LIB_KERNEL_HEAP_H
+#define __LIB_KERNEL_HEAP_H
+
+/* Priority queue.
+
+   This is a pairing heap: a tree, kept in heap order, in which
+   each node has any number of children, linked from the first
+   through their siblings.  Pushing an element or raising its
+   key takes constant time, and popping the greatest element or
+   removing an arbitrary one takes O(log n) amortized time, so a
+   heap suits a wait queue whose members' priorities change while
+   they wait.
+
+   Like a list, a heap does not allocate memory.  Each structure
+   that can be in a heap embeds a struct heap_elem member, and
+   the heap_entry macro converts a struct heap_elem back to the
+   structure that contains it, in the same way as list_entry()
+   (see list.h). */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Heap element. */
+struct heap_elem
+  {
+    struct heap_elem *child;    /* First child. */
+    struct heap_elem *next;     /* Next sibling. */
+    struct heap_elem *prev;     /* Previous sibling, or parent if
+                                   first child, or null if root. */
+  };
+
+/* Converts pointer to heap element HEAP_ELEM into a pointer to
+   the structure that HEAP_ELEM is embedded inside.  Supply the
+   name of the outer structure STRUCT and the member name MEMBER
+   of the heap element. */
+#define heap_entry(HEAP_ELEM, STRUCT, MEMBER)           \
+        ((STRUCT *) ((uint8_t *) &(HEAP_ELEM)->child    \
+                     - offsetof (STRUCT, MEMBER.child)))
+
+/* Compares the value of two heap elements A and B, given
+   auxiliary data AUX.  Returns true if A is less than B, or
+   false if A is greater than or equal to B. */
+typedef bool heap_less_func (const struct heap_elem *a,
+                             const struct heap_elem *b,
+                             void *aux);
+
+/* Heap. */
+struct heap
+  {
+    struct heap_elem *root;     /* Greatest element, or null. */
+    heap_less_func *less;       /* Comparison function. */
+    void *aux;                  /* Auxiliary data for `less'. */
+  };
+
+void heap_init (struct heap *, heap_less_func *, void *aux);
+
+/* Heap elements. */
+void heap_push (struct heap *, struct heap_elem *);
+struct heap_elem *heap_pop (struct heap *);
+void heap_remove (struct heap *, struct heap_elem *);
+void heap_increase (struct heap *, struct heap_elem *);
+void heap_update (struct heap *, struct heap_elem *);
+
+/* Heap traversal. */
+struct heap_elem *heap_begin (struct heap *);
+struct heap_elem *heap_next (struct heap_elem *);
+
+/* Heap properties. */
+struct heap_elem *heap_max (struct heap *);
+bool heap_empty (struct heap *);
+
+#endif /* lib/kernel/heap.h */
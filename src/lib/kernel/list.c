@@ -1,5 +1,6 @@
 #include "list.h"
 #include "../debug.h"
+#include <limits.h>
 
 /* Our doubly linked lists have two header elements: the "head"
    just before the first element and the "tail" just after the
@@ -349,94 +350,100 @@ is_sorted (struct list_elem *a, struct list_elem *b,
   return true;
 }
 
-/* Finds a run, starting at A and ending not after B, of list
-   elements that are in nondecreasing order according to LESS
-   given auxiliary data AUX.  Returns the (exclusive) end of the
-   run.
-   A through B (exclusive) must form a non-empty range. */
+/* Merges the null-terminated singly linked lists A and B, each
+   linked through its elements' NEXT members and sorted in
+   nondecreasing order according to LESS given auxiliary data
+   AUX, into one such list, and returns its first element.  Of
+   equal elements, those from A come first. */
 static struct list_elem *
-find_end_of_run (struct list_elem *a, struct list_elem *b,
-                 list_less_func *less, void *aux)
+merge (struct list_elem *a, struct list_elem *b,
+       list_less_func *less, void *aux)
 {
-  ASSERT (a != NULL);
-  ASSERT (b != NULL);
-  ASSERT (less != NULL);
-  ASSERT (a != b);
-  
-  do 
+  struct list_elem *head;
+  struct list_elem **tail = &head;
+
+  while (a != NULL && b != NULL)
     {
-      a = list_next (a);
+      if (less (b, a, aux))
+        {
+          *tail = b;
+          b = b->next;
+        }
+      else
+        {
+          *tail = a;
+          a = a->next;
+        }
+      tail = &(*tail)->next;
     }
-  while (a != b && !less (a, list_prev (a), aux));
-  return a;
-}
-
-/* Merges A0 through A1B0 (exclusive) with A1B0 through B1
-   (exclusive) to form a combined range also ending at B1
-   (exclusive).  Both input ranges must be nonempty and sorted in
-   nondecreasing order according to LESS given auxiliary data
-   AUX.  The output range will be sorted the same way. */
-static void
-inplace_merge (struct list_elem *a0, struct list_elem *a1b0,
-               struct list_elem *b1,
-               list_less_func *less, void *aux)
-{
-  ASSERT (a0 != NULL);
-  ASSERT (a1b0 != NULL);
-  ASSERT (b1 != NULL);
-  ASSERT (less != NULL);
-  ASSERT (is_sorted (a0, a1b0, less, aux));
-  ASSERT (is_sorted (a1b0, b1, less, aux));
-
-  while (a0 != a1b0 && a1b0 != b1)
-    if (!less (a1b0, a0, aux)) 
-      a0 = list_next (a0);
-    else 
-      {
-        a1b0 = list_next (a1b0);
-        list_splice (a0, list_prev (a1b0), a1b0);
-      }
+  *tail = a != NULL ? a : b;
+  return head;
 }
 
 /* Sorts LIST according to LESS given auxiliary data AUX, using a
-   natural iterative merge sort that runs in O(n lg n) time and
-   O(1) space in the number of elements in LIST. */
+   bottom-up merge sort that runs in O(n lg n) time and O(1) space
+   in the number of elements in LIST.  The sort is stable: equal
+   elements keep their relative order.
+
+   The elements are taken off the list one at a time and merged
+   into an array of sorted sublists, linked through their NEXT
+   members only, in which sublist I is empty or holds 2**I
+   elements, the way a binary counter is incremented.  Each
+   element is thus visited once on the way in and takes part in
+   about lg n merges, and the PREV members are fixed up in a
+   final pass. */
 void
 list_sort (struct list *list, list_less_func *less, void *aux)
 {
-  size_t output_run_cnt;        /* Number of runs output in current pass. */
+  struct list_elem *bins[sizeof (size_t) * CHAR_BIT];
+  size_t bin_cnt = 0;
+  struct list_elem *e, *sorted, *prev;
+  size_t i;
 
   ASSERT (list != NULL);
   ASSERT (less != NULL);
 
-  /* Pass over the list repeatedly, merging adjacent runs of
-     nondecreasing elements, until only one run is left. */
-  do
+  /* Lists of fewer than two elements are already sorted. */
+  if (list_begin (list) == list_end (list)
+      || list_begin (list) == list_rbegin (list))
+    return;
+
+  /* Feed the elements, in order, into the bins.  Each bin holds
+     elements that came before those of the bins below it, so it
+     is passed to merge() first, keeping the sort stable. */
+  list_rbegin (list)->next = NULL;
+  for (e = list_begin (list); e != NULL; )
     {
-      struct list_elem *a0;     /* Start of first run. */
-      struct list_elem *a1b0;   /* End of first run, start of second. */
-      struct list_elem *b1;     /* End of second run. */
+      struct list_elem *carry = e;
 
-      output_run_cnt = 0;
-      for (a0 = list_begin (list); a0 != list_end (list); a0 = b1)
+      e = e->next;
+      carry->next = NULL;
+      for (i = 0; i < bin_cnt && bins[i] != NULL; i++)
         {
-          /* Each iteration produces one output run. */
-          output_run_cnt++;
-
-          /* Locate two adjacent runs of nondecreasing elements
-             A0...A1B0 and A1B0...B1. */
-          a1b0 = find_end_of_run (a0, list_end (list), less, aux);
-          if (a1b0 == list_end (list))
-            break;
-          b1 = find_end_of_run (a1b0, list_end (list), less, aux);
-
-          /* Merge the runs. */
-          inplace_merge (a0, a1b0, b1, less, aux);
+          carry = merge (bins[i], carry, less, aux);
+          bins[i] = NULL;
         }
+      if (i == bin_cnt)
+        bin_cnt++;
+      bins[i] = carry;
     }
-  while (output_run_cnt > 1);
 
-  ASSERT (is_sorted (list_begin (list), list_end (list), less, aux));
+  /* Merge the bins, lowest first. */
+  sorted = NULL;
+  for (i = 0; i < bin_cnt; i++)
+    if (bins[i] != NULL)
+      sorted = merge (bins[i], sorted, less, aux);
+
+  /* Restore the PREV members and the header and tail. */
+  prev = &list->head;
+  for (e = sorted; e != NULL; e = e->next)
+    {
+      prev->next = e;
+      e->prev = prev;
+      prev = e;
+    }
+  prev->next = &list->tail;
+  list->tail.prev = prev;
 }
 
 /* Inserts ELEM in the proper position in LIST, which must be
@@ -522,3 +529,115 @@ list_min (struct list *list, list_less_func *less, void *aux)
     }
   return min;
 }
+
+/* Initializes CL as an empty counted list. */
+void
+clist_init (struct clist *cl)
+{
+  ASSERT (cl != NULL);
+  list_init (&cl->list);
+  cl->size = 0;
+}
+
+/* Returns the list of CL's elements, for traversal only. */
+struct list *
+clist_list (struct clist *cl)
+{
+  return &cl->list;
+}
+
+#ifdef LIST_CHECK
+/* Returns true if E is an interior element of CL's list or its
+   tail.  Runs in O(n). */
+static bool
+clist_contains (struct clist *cl, struct list_elem *e)
+{
+  struct list_elem *i;
+
+  for (i = list_begin (&cl->list); i != list_end (&cl->list);
+       i = list_next (i))
+    if (i == e)
+      return true;
+  return e == list_end (&cl->list);
+}
+#endif
+
+/* Inserts ELEM just before BEFORE, which must be an interior
+   element of CL or its tail, and counts it. */
+void
+clist_insert (struct clist *cl, struct list_elem *before,
+              struct list_elem *elem)
+{
+#ifdef LIST_CHECK
+  ASSERT (clist_contains (cl, before));
+#endif
+  list_insert (before, elem);
+  cl->size++;
+}
+
+/* Inserts ELEM at the beginning of CL. */
+void
+clist_push_front (struct clist *cl, struct list_elem *elem)
+{
+  list_push_front (&cl->list, elem);
+  cl->size++;
+}
+
+/* Inserts ELEM at the end of CL. */
+void
+clist_push_back (struct clist *cl, struct list_elem *elem)
+{
+  list_push_back (&cl->list, elem);
+  cl->size++;
+}
+
+/* Removes ELEM, which must be an interior element of CL, and
+   returns the element that followed it, like list_remove(). */
+struct list_elem *
+clist_remove (struct clist *cl, struct list_elem *elem)
+{
+  ASSERT (cl->size > 0);
+#ifdef LIST_CHECK
+  ASSERT (elem != list_end (&cl->list) && clist_contains (cl, elem));
+#endif
+  cl->size--;
+  return list_remove (elem);
+}
+
+/* Removes the front element from CL and returns it.
+   Undefined behavior if CL is empty before removal. */
+struct list_elem *
+clist_pop_front (struct clist *cl)
+{
+  ASSERT (cl->size > 0);
+  cl->size--;
+  return list_pop_front (&cl->list);
+}
+
+/* Removes the back element from CL and returns it.
+   Undefined behavior if CL is empty before removal. */
+struct list_elem *
+clist_pop_back (struct clist *cl)
+{
+  ASSERT (cl->size > 0);
+  cl->size--;
+  return list_pop_back (&cl->list);
+}
+
+/* Returns the number of elements in CL, in O(1). */
+size_t
+clist_size (struct clist *cl)
+{
+#ifdef LIST_CHECK
+  ASSERT (cl->size == list_size (&cl->list));
+#endif
+  return cl->size;
+}
+
+/* Returns true if CL is empty, false otherwise. */
+bool
+clist_empty (struct clist *cl)
+{
+  ASSERT ((cl->size == 0) == list_empty (&cl->list));
+  return cl->size == 0;
+}
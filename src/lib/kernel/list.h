@@ -178,4 +178,38 @@ void list_unique (struct list *, struct list *duplicates,
 struct list_elem *list_max (struct list *, list_less_func *, void *aux);
 struct list_elem *list_min (struct list *, list_less_func *, void *aux);
 
+/* Counted list.
+
+   A list that also keeps the number of its elements, so that
+   clist_size() runs in O(1), for queues whose length is asked
+   for often.  Its elements must be added and removed only with
+   the clist_*() functions, which keep the count; it can be
+   traversed, but not modified, through clist_list() and the
+   ordinary list functions.
+
+   If the kernel is built with LIST_CHECK defined, for example by
+   adding -DLIST_CHECK to DEFINES in the build directory's
+   Make.vars, clist_size() also counts the elements the slow way
+   and asserts that the count is right. */
+struct clist
+  {
+    struct list list;           /* Elements. */
+    size_t size;                /* Number of elements. */
+  };
+
+/* Initializer for a counted list named NAME. */
+#define CLIST_INITIALIZER(NAME) { LIST_INITIALIZER ((NAME).list), 0 }
+
+void clist_init (struct clist *);
+struct list *clist_list (struct clist *);
+void clist_insert (struct clist *, struct list_elem *before,
+                   struct list_elem *);
+void clist_push_front (struct clist *, struct list_elem *);
+void clist_push_back (struct clist *, struct list_elem *);
+struct list_elem *clist_remove (struct clist *, struct list_elem *);
+struct list_elem *clist_pop_front (struct clist *);
+struct list_elem *clist_pop_back (struct clist *);
+size_t clist_size (struct clist *);
+bool clist_empty (struct clist *);
+
 #endif /* lib/kernel/list.h */
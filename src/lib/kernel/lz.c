@@ -0,0 +1,159 @@
+#include "lz.h"
+#include <debug.h>
+#include <string.h>
+
+/* The compressed form is a sequence of groups, each a flag byte
+   followed by up to 8 items, one for each bit of the flag byte
+   from least to most significant.  A 0 bit is a literal byte,
+   copied to the output as it is.  A 1 bit is a match, two or
+   three bytes that say to copy LENGTH bytes that were output
+   OFFSET bytes earlier:
+
+     byte 0: low 8 bits of OFFSET - 1.
+     byte 1: high 4 bits of OFFSET - 1, then LENGTH - 3 in the
+             upper 4 bits, or 15 if LENGTH is at least 18.
+     byte 2: LENGTH - 18, present only if the nibble was 15.
+
+   OFFSET may be smaller than LENGTH, in which case the match
+   overlaps the bytes it produces, so a run of one repeated byte
+   costs only three bytes per MATCH_MAX bytes.
+
+   The compressor finds matches through a hash table of 3-byte
+   prefixes, each entry holding the last position at which its
+   prefix was seen, and takes whatever match that position
+   yields.  This is much weaker than searching for the longest
+   match, but it looks at each input byte only about once. */
+
+/* Shortest and longest match, and farthest match offset. */
+#define MATCH_MIN 3
+#define MATCH_MAX (18 + 255)
+#define WINDOW 4096
+
+/* Returns the work area index for the 3 bytes at P. */
+static inline unsigned
+hash3 (const uint8_t *p) 
+{
+  uint32_t x = ((uint32_t) p[0] << 16) | (p[1] << 8) | p[2];
+  return (x * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Compresses the SRC_LEN bytes at SRC into DST, which has room
+   for DST_CAP bytes, using WORK as scratch space.  Returns the
+   size of the compressed data, or 0 if it does not fit in
+   DST_CAP bytes. */
+size_t
+lz_compress (const void *src_, size_t src_len,
+             void *dst_, size_t dst_cap, uint16_t work[LZ_WORK_CNT]) 
+{
+  const uint8_t *src = src_;
+  uint8_t *dst = dst_;
+  size_t ip = 0;
+  size_t op = 0;
+
+  ASSERT (src_len <= LZ_MAX_INPUT);
+
+  /* Entries are positions plus 1, so that 0 means none. */
+  memset (work, 0, LZ_WORK_CNT * sizeof *work);
+  while (ip < src_len) 
+    {
+      size_t flag_op = op++;
+      uint8_t flags = 0;
+      int bit;
+
+      if (op > dst_cap)
+        return 0;
+      for (bit = 0; bit < 8 && ip < src_len; bit++) 
+        {
+          size_t len = 0;
+          size_t ofs = 0;
+
+          if (ip + MATCH_MIN <= src_len) 
+            {
+              unsigned h = hash3 (src + ip);
+              size_t cand = work[h];
+
+              work[h] = ip + 1;
+              if (cand != 0 && ip - (cand - 1) <= WINDOW
+                  && !memcmp (src + cand - 1, src + ip, MATCH_MIN)) 
+                {
+                  size_t max = src_len - ip;
+
+                  if (max > MATCH_MAX)
+                    max = MATCH_MAX;
+                  ofs = ip - (cand - 1);
+                  len = MATCH_MIN;
+                  while (len < max && src[ip - ofs + len] == src[ip + len])
+                    len++;
+                }
+            }
+
+          if (len >= MATCH_MIN) 
+            {
+              if (op + (len >= 18 ? 3 : 2) > dst_cap)
+                return 0;
+              dst[op++] = (ofs - 1) & 0xff;
+              dst[op++] = ((ofs - 1) >> 8) | ((len >= 18 ? 15 : len - 3) << 4);
+              if (len >= 18)
+                dst[op++] = len - 18;
+              flags |= 1 << bit;
+              ip += len;
+            }
+          else 
+            {
+              if (op + 1 > dst_cap)
+                return 0;
+              dst[op++] = src[ip++];
+            }
+        }
+      dst[flag_op] = flags;
+    }
+  return op;
+}
+
+/* Decompresses the SRC_LEN bytes at SRC, produced by
+   lz_compress(), into the DST_LEN bytes at DST.  Returns true if
+   successful, false if SRC is malformed or does not decompress
+   to exactly DST_LEN bytes. */
+bool
+lz_decompress (const void *src_, size_t src_len, void *dst_, size_t dst_len) 
+{
+  const uint8_t *src = src_;
+  uint8_t *dst = dst_;
+  size_t ip = 0;
+  size_t op = 0;
+
+  while (ip < src_len) 
+    {
+      uint8_t flags = src[ip++];
+      int bit;
+
+      for (bit = 0; bit < 8 && ip < src_len; bit++) 
+        if (flags & (1 << bit)) 
+          {
+            size_t ofs, len;
+
+            if (ip + 2 > src_len)
+              return false;
+            ofs = (src[ip] | ((src[ip + 1] & 0x0f) << 8)) + 1;
+            len = (src[ip + 1] >> 4) + 3;
+            ip += 2;
+            if (len == 18) 
+              {
+                if (ip >= src_len)
+                  return false;
+                len += src[ip++];
+              }
+            if (ofs > op || len > dst_len - op)
+              return false;
+            for (; len > 0; len--, op++)
+              dst[op] = dst[op - ofs];
+          }
+        else 
+          {
+            if (op >= dst_len)
+              return false;
+            dst[op++] = src[ip++];
+          }
+    }
+  return op == dst_len;
+}
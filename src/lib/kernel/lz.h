@@ -0,0 +1,23 @@
+#ifndef __LIB_KERNEL_LZ_H
+#define __LIB_KERNEL_LZ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Fast LZ77-style compression, for data no larger than
+   LZ_MAX_INPUT bytes. */
+
+#define LZ_MAX_INPUT 65535
+
+/* Entries in the work area that lz_compress() needs.  The area
+   is too large for a kernel stack. */
+#define LZ_HASH_BITS 12
+#define LZ_WORK_CNT (1 << LZ_HASH_BITS)
+
+size_t lz_compress (const void *src, size_t src_len,
+                    void *dst, size_t dst_cap, uint16_t work[LZ_WORK_CNT]);
+bool lz_decompress (const void *src, size_t src_len,
+                    void *dst, size_t dst_len);
+
+#endif /* lib/kernel/lz.h */
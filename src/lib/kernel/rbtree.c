@@ -0,0 +1,423 @@
+#include "rbtree.h"
+#include "../debug.h"
+
+/* Red-black tree.
+
+   The tree keeps these properties, which bound its height by
+   2 log2 (n + 1):
+
+     1. The root is black.
+
+     2. A red element has no red child.
+
+     3. Every path from an element down to a missing child passes
+        through the same number of black elements.
+
+   A missing child, represented by a null pointer, counts as
+   black.  Inserting and removing rebalance the tree with at most
+   three rotations, following Cormen, Leiserson, Rivest and
+   Stein, "Introduction to Algorithms", chapter 13. */
+
+static bool is_red (const struct rb_elem *);
+static void rotate_left (struct rb_tree *, struct rb_elem *);
+static void rotate_right (struct rb_tree *, struct rb_elem *);
+static void replace_child (struct rb_tree *, struct rb_elem *parent,
+                           struct rb_elem *old, struct rb_elem *new);
+static struct rb_elem *leftmost (struct rb_elem *);
+static struct rb_elem *rightmost (struct rb_elem *);
+
+/* Initializes TREE as an empty tree ordered by LESS, given
+   auxiliary data AUX. */
+void
+rb_init (struct rb_tree *tree, rb_less_func *less, void *aux)
+{
+  ASSERT (tree != NULL);
+  ASSERT (less != NULL);
+
+  tree->root = NULL;
+  tree->less = less;
+  tree->aux = aux;
+}
+
+/* Inserts E into TREE, after any elements equal to it. */
+void
+rb_insert (struct rb_tree *tree, struct rb_elem *e)
+{
+  struct rb_elem *parent = NULL;
+  struct rb_elem **link = &tree->root;
+
+  ASSERT (tree != NULL);
+  ASSERT (e != NULL);
+
+  while (*link != NULL)
+    {
+      parent = *link;
+      link = (tree->less (e, parent, tree->aux)
+              ? &parent->left : &parent->right);
+    }
+  e->parent = parent;
+  e->left = e->right = NULL;
+  e->red = true;
+  *link = e;
+
+  /* Restore property 2: while E and its parent are both red,
+     either recolor and move the problem up to E's grandparent,
+     or rotate it away. */
+  while (is_red (e->parent))
+    {
+      struct rb_elem *p = e->parent;
+      struct rb_elem *g = p->parent;
+
+      if (p == g->left)
+        {
+          struct rb_elem *uncle = g->right;
+
+          if (is_red (uncle))
+            {
+              p->red = uncle->red = false;
+              g->red = true;
+              e = g;
+              continue;
+            }
+          if (e == p->right)
+            {
+              rotate_left (tree, p);
+              e = p;
+              p = e->parent;
+            }
+          p->red = false;
+          g->red = true;
+          rotate_right (tree, g);
+        }
+      else
+        {
+          struct rb_elem *uncle = g->left;
+
+          if (is_red (uncle))
+            {
+              p->red = uncle->red = false;
+              g->red = true;
+              e = g;
+              continue;
+            }
+          if (e == p->left)
+            {
+              rotate_right (tree, p);
+              e = p;
+              p = e->parent;
+            }
+          p->red = false;
+          g->red = true;
+          rotate_left (tree, g);
+        }
+    }
+  tree->root->red = false;
+}
+
+/* Removes E, which must be in TREE, from TREE. */
+void
+rb_remove (struct rb_tree *tree, struct rb_elem *e)
+{
+  struct rb_elem *x, *parent;
+  bool removed_red;
+
+  ASSERT (tree != NULL);
+  ASSERT (e != NULL);
+
+  if (e->left == NULL || e->right == NULL)
+    {
+      /* E has at most one child, X, which takes its place. */
+      x = e->left != NULL ? e->left : e->right;
+      parent = e->parent;
+      removed_red = e->red;
+      replace_child (tree, parent, e, x);
+      if (x != NULL)
+        x->parent = parent;
+    }
+  else
+    {
+      /* E's successor S, which has no left child, takes E's place
+         and color, and S's right child X takes S's place. */
+      struct rb_elem *s = leftmost (e->right);
+
+      x = s->right;
+      removed_red = s->red;
+      if (s->parent == e)
+        parent = s;
+      else
+        {
+          parent = s->parent;
+          parent->left = x;
+          if (x != NULL)
+            x->parent = parent;
+          s->right = e->right;
+          s->right->parent = s;
+        }
+      s->left = e->left;
+      s->left->parent = s;
+      s->parent = e->parent;
+      s->red = e->red;
+      replace_child (tree, e->parent, e, s);
+    }
+
+  /* Removing a black element leaves the paths through X one black
+     element short.  Restore property 3 by moving the shortage up
+     the tree until it reaches a red element, which is made black,
+     or the root, or is fixed by rotating around X's parent. */
+  if (removed_red)
+    return;
+  while (x != tree->root && !is_red (x))
+    {
+      if (x == parent->left)
+        {
+          struct rb_elem *w = parent->right;
+
+          if (is_red (w))
+            {
+              w->red = false;
+              parent->red = true;
+              rotate_left (tree, parent);
+              w = parent->right;
+            }
+          if (!is_red (w->left) && !is_red (w->right))
+            {
+              w->red = true;
+              x = parent;
+              parent = x->parent;
+              continue;
+            }
+          if (!is_red (w->right))
+            {
+              w->left->red = false;
+              w->red = true;
+              rotate_right (tree, w);
+              w = parent->right;
+            }
+          w->red = parent->red;
+          parent->red = false;
+          w->right->red = false;
+          rotate_left (tree, parent);
+        }
+      else
+        {
+          struct rb_elem *w = parent->left;
+
+          if (is_red (w))
+            {
+              w->red = false;
+              parent->red = true;
+              rotate_right (tree, parent);
+              w = parent->left;
+            }
+          if (!is_red (w->left) && !is_red (w->right))
+            {
+              w->red = true;
+              x = parent;
+              parent = x->parent;
+              continue;
+            }
+          if (!is_red (w->left))
+            {
+              w->right->red = false;
+              w->red = true;
+              rotate_left (tree, w);
+              w = parent->left;
+            }
+          w->red = parent->red;
+          parent->red = false;
+          w->left->red = false;
+          rotate_right (tree, parent);
+        }
+      x = tree->root;
+    }
+  if (x != NULL)
+    x->red = false;
+}
+
+/* Returns the first element in TREE equal to KEY, or a null
+   pointer if there is none. */
+struct rb_elem *
+rb_find (const struct rb_tree *tree, const struct rb_elem *key)
+{
+  struct rb_elem *e = rb_lower_bound (tree, key);
+
+  return e != NULL && !tree->less (key, e, tree->aux) ? e : NULL;
+}
+
+/* Returns the first element in TREE that is not less than KEY,
+   or a null pointer if there is none. */
+struct rb_elem *
+rb_lower_bound (const struct rb_tree *tree, const struct rb_elem *key)
+{
+  struct rb_elem *e, *bound = NULL;
+
+  ASSERT (tree != NULL);
+  ASSERT (key != NULL);
+
+  for (e = tree->root; e != NULL; )
+    if (tree->less (e, key, tree->aux))
+      e = e->right;
+    else
+      {
+        bound = e;
+        e = e->left;
+      }
+  return bound;
+}
+
+/* Returns the first element in TREE that is greater than KEY, or
+   a null pointer if there is none. */
+struct rb_elem *
+rb_upper_bound (const struct rb_tree *tree, const struct rb_elem *key)
+{
+  struct rb_elem *e, *bound = NULL;
+
+  ASSERT (tree != NULL);
+  ASSERT (key != NULL);
+
+  for (e = tree->root; e != NULL; )
+    if (tree->less (key, e, tree->aux))
+      {
+        bound = e;
+        e = e->left;
+      }
+    else
+      e = e->right;
+  return bound;
+}
+
+/* Returns the least element in TREE, or rb_end() if TREE is
+   empty. */
+struct rb_elem *
+rb_begin (const struct rb_tree *tree)
+{
+  ASSERT (tree != NULL);
+
+  return tree->root != NULL ? leftmost (tree->root) : NULL;
+}
+
+/* Returns TREE's end, which follows its greatest element: a null
+   pointer. */
+struct rb_elem *
+rb_end (const struct rb_tree *tree UNUSED)
+{
+  return NULL;
+}
+
+/* Returns the greatest element in TREE, or a null pointer if
+   TREE is empty. */
+struct rb_elem *
+rb_last (const struct rb_tree *tree)
+{
+  ASSERT (tree != NULL);
+
+  return tree->root != NULL ? rightmost (tree->root) : NULL;
+}
+
+/* Returns the element after E in its tree, or rb_end() if E is
+   the greatest. */
+struct rb_elem *
+rb_next (struct rb_elem *e)
+{
+  ASSERT (e != NULL);
+
+  if (e->right != NULL)
+    return leftmost (e->right);
+  while (e->parent != NULL && e == e->parent->right)
+    e = e->parent;
+  return e->parent;
+}
+
+/* Returns the element before E in its tree, or a null pointer if
+   E is the least. */
+struct rb_elem *
+rb_prev (struct rb_elem *e)
+{
+  ASSERT (e != NULL);
+
+  if (e->left != NULL)
+    return rightmost (e->left);
+  while (e->parent != NULL && e == e->parent->left)
+    e = e->parent;
+  return e->parent;
+}
+
+/* Returns true if TREE is empty, false otherwise. */
+bool
+rb_empty (const struct rb_tree *tree)
+{
+  ASSERT (tree != NULL);
+
+  return tree->root == NULL;
+}
+
+/* Returns true if E is red, false if it is black or null. */
+static bool
+is_red (const struct rb_elem *e)
+{
+  return e != NULL && e->red;
+}
+
+/* Makes E's right child take E's place in TREE, with E as its
+   left child. */
+static void
+rotate_left (struct rb_tree *tree, struct rb_elem *e)
+{
+  struct rb_elem *r = e->right;
+
+  e->right = r->left;
+  if (r->left != NULL)
+    r->left->parent = e;
+  r->parent = e->parent;
+  replace_child (tree, e->parent, e, r);
+  r->left = e;
+  e->parent = r;
+}
+
+/* Makes E's left child take E's place in TREE, with E as its
+   right child. */
+static void
+rotate_right (struct rb_tree *tree, struct rb_elem *e)
+{
+  struct rb_elem *l = e->left;
+
+  e->left = l->right;
+  if (l->right != NULL)
+    l->right->parent = e;
+  l->parent = e->parent;
+  replace_child (tree, e->parent, e, l);
+  l->right = e;
+  e->parent = l;
+}
+
+/* Makes NEW take OLD's place as a child of PARENT, or as the
+   root of TREE if PARENT is null.  Does not set NEW's parent. */
+static void
+replace_child (struct rb_tree *tree, struct rb_elem *parent,
+               struct rb_elem *old, struct rb_elem *new)
+{
+  if (parent == NULL)
+    tree->root = new;
+  else if (parent->left == old)
+    parent->left = new;
+  else
+    parent->right = new;
+}
+
+/* Returns the least element in the subtree rooted at E. */
+static struct rb_elem *
+leftmost (struct rb_elem *e)
+{
+  while (e->left != NULL)
+    e = e->left;
+  return e;
+}
+
+/* Returns the greatest element in the subtree rooted at E. */
+static struct rb_elem *
+rightmost (struct rb_elem *e)
+{
+  while (e->right != NULL)
+    e = e->right;
+  return e;
+}
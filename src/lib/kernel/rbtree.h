@@ -0,0 +1,99 @@
+#ifndef __LIB_KERNEL_RBTREE_H
+#define __LIB_KERNEL_RBTREE_H
+
+/* Ordered set.
+
+   This is a red-black tree: a binary search tree whose nodes are
+   colored so that no path from the root to a leaf is more than
+   twice as long as any other.  Inserting, removing and finding
+   an element, and finding the first element not less than, or
+   greater than, a given key take O(log n) time, and stepping
+   from one element to the next in order takes constant amortized
+   time, so a tree suits an index that is searched by ranges,
+   such as address ranges or disk positions.
+
+   Like a list, a tree does not allocate memory.  Each structure
+   that can be in a tree embeds a struct rb_elem member, and the
+   rb_entry macro converts a struct rb_elem back to the structure
+   that contains it, in the same way as list_entry() (see
+   list.h).
+
+   A search takes a key in the form of an element, usually one
+   embedded in a local structure with only the members the
+   comparison function looks at filled in, in the same way as
+   hash_find() (see hash.h).
+
+   Iteration is in ascending order:
+
+      struct rb_elem *e;
+
+      for (e = rb_begin (&tree); e != rb_end (&tree); e = rb_next (e))
+        {
+          struct foo *f = rb_entry (e, struct foo, elem);
+          ...do something with f...
+        }
+
+   Modifying a tree during an iteration yields undefined
+   behavior, except that removing the current element is safe if
+   rb_next() is called on it first. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Tree element. */
+struct rb_elem
+  {
+    struct rb_elem *parent;     /* Parent, or null if root. */
+    struct rb_elem *left;       /* Left child, or null. */
+    struct rb_elem *right;      /* Right child, or null. */
+    bool red;                   /* Red, or black? */
+  };
+
+/* Converts pointer to tree element RB_ELEM into a pointer to the
+   structure that RB_ELEM is embedded inside.  Supply the name of
+   the outer structure STRUCT and the member name MEMBER of the
+   tree element. */
+#define rb_entry(RB_ELEM, STRUCT, MEMBER)               \
+        ((STRUCT *) ((uint8_t *) &(RB_ELEM)->parent     \
+                     - offsetof (STRUCT, MEMBER.parent)))
+
+/* Compares the value of two tree elements A and B, given
+   auxiliary data AUX.  Returns true if A is less than B, or
+   false if A is greater than or equal to B. */
+typedef bool rb_less_func (const struct rb_elem *a,
+                           const struct rb_elem *b,
+                           void *aux);
+
+/* Tree. */
+struct rb_tree
+  {
+    struct rb_elem *root;       /* Root, or null. */
+    rb_less_func *less;         /* Comparison function. */
+    void *aux;                  /* Auxiliary data for `less'. */
+  };
+
+void rb_init (struct rb_tree *, rb_less_func *, void *aux);
+
+/* Tree elements. */
+void rb_insert (struct rb_tree *, struct rb_elem *);
+void rb_remove (struct rb_tree *, struct rb_elem *);
+
+/* Search. */
+struct rb_elem *rb_find (const struct rb_tree *, const struct rb_elem *);
+struct rb_elem *rb_lower_bound (const struct rb_tree *,
+                                const struct rb_elem *);
+struct rb_elem *rb_upper_bound (const struct rb_tree *,
+                                const struct rb_elem *);
+
+/* Tree traversal. */
+struct rb_elem *rb_begin (const struct rb_tree *);
+struct rb_elem *rb_end (const struct rb_tree *);
+struct rb_elem *rb_last (const struct rb_tree *);
+struct rb_elem *rb_next (struct rb_elem *);
+struct rb_elem *rb_prev (struct rb_elem *);
+
+/* Tree properties. */
+bool rb_empty (const struct rb_tree *);
+
+#endif /* lib/kernel/rbtree.h */
@@ -0,0 +1,113 @@
+/* Single-producer, single-consumer ring buffer.
+
+   See ring.h for basic information. */
+
+#include "ring.h"
+#include <string.h>
+#include "../debug.h"
+
+/* Keeps the compiler from moving memory accesses across it. */
+#define barrier() asm volatile ("" : : : "memory")
+
+static void copy_in (struct ring *, uint32_t pos, const uint8_t *, size_t cnt);
+static void copy_out (const struct ring *, uint32_t pos, uint8_t *,
+                      size_t cnt);
+
+/* Initializes R, empty, to hold records of REC_SIZE bytes in the
+   REC_CNT * REC_SIZE bytes at BUF, which must outlive R.
+   REC_CNT must be a power of 2. */
+void
+ring_init (struct ring *r, void *buf, size_t rec_size, size_t rec_cnt)
+{
+  ASSERT (buf != NULL);
+  ASSERT (rec_size > 0);
+  ASSERT (rec_cnt > 0 && (rec_cnt & (rec_cnt - 1)) == 0);
+  ASSERT (rec_cnt <= UINT32_MAX / 2 + 1);
+
+  r->buf = buf;
+  r->rec_size = rec_size;
+  r->mask = rec_cnt - 1;
+  r->head = r->tail = 0;
+}
+
+/* Adds up to CNT of the records at RECS to the end of R, as many
+   as there is room for, and returns the number added.  Only the
+   producer may call this. */
+size_t
+ring_push (struct ring *r, const void *recs, size_t cnt)
+{
+  uint32_t head = r->head;
+  size_t room = ring_capacity (r) - (head - r->tail);
+
+  if (cnt > room)
+    cnt = room;
+  if (cnt == 0)
+    return 0;
+
+  barrier ();
+  copy_in (r, head, recs, cnt);
+  barrier ();
+  r->head = head + cnt;
+  return cnt;
+}
+
+/* Removes up to CNT records from the front of R, as many as it
+   holds, into RECS, and returns the number removed.  Only the
+   consumer may call this. */
+size_t
+ring_pop (struct ring *r, void *recs, size_t cnt)
+{
+  uint32_t tail = r->tail;
+  size_t avail = r->head - tail;
+
+  if (cnt > avail)
+    cnt = avail;
+  if (cnt == 0)
+    return 0;
+
+  barrier ();
+  copy_out (r, tail, recs, cnt);
+  barrier ();
+  r->tail = tail + cnt;
+  return cnt;
+}
+
+/* Copies the CNT records at RECS into R's slots starting at the
+   one for position POS, wrapping around at the end of the
+   buffer. */
+static void
+copy_in (struct ring *r, uint32_t pos, const uint8_t *recs, size_t cnt)
+{
+  size_t idx = pos & r->mask;
+  size_t first = ring_capacity (r) - idx;
+
+  if (r->rec_size == 1 && cnt == 1)
+    {
+      r->buf[idx] = *recs;
+      return;
+    }
+  if (first > cnt)
+    first = cnt;
+  memcpy (r->buf + idx * r->rec_size, recs, first * r->rec_size);
+  memcpy (r->buf, recs + first * r->rec_size, (cnt - first) * r->rec_size);
+}
+
+/* Copies CNT records out of R's slots, starting at the one for
+   position POS and wrapping around at the end of the buffer,
+   into RECS. */
+static void
+copy_out (const struct ring *r, uint32_t pos, uint8_t *recs, size_t cnt)
+{
+  size_t idx = pos & r->mask;
+  size_t first = ring_capacity (r) - idx;
+
+  if (r->rec_size == 1 && cnt == 1)
+    {
+      *recs = r->buf[idx];
+      return;
+    }
+  if (first > cnt)
+    first = cnt;
+  memcpy (recs, r->buf + idx * r->rec_size, first * r->rec_size);
+  memcpy (recs + first * r->rec_size, r->buf, (cnt - first) * r->rec_size);
+}
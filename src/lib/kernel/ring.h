@@ -0,0 +1,80 @@
+#ifndef __LIB_KERNEL_RING_H
+#define __LIB_KERNEL_RING_H
+
+/* Single-producer, single-consumer ring buffer.
+
+   A ring holds up to a power-of-2 number of fixed-size records
+   in a buffer supplied by its owner, in first-in, first-out
+   order.  One context adds records and one takes them out, for
+   example an interrupt handler and a kernel thread, and neither
+   has to turn interrupts off or take a lock to do so, because
+   each of the ring's two positions is written by just one of
+   them.  The producer copies records in and only then advances
+   HEAD; the consumer copies them out and only then advances
+   TAIL.  A compiler barrier keeps the copies on the right side
+   of each update, and x86 does not reorder a store after another
+   store, or a load after another load, so the other side sees a
+   record only once it is complete and never sees its slot reused
+   while it is still being read.
+
+   HEAD and TAIL count every record ever added and removed,
+   rather than being indexes into the buffer, so that a full ring
+   and an empty one are told apart without giving up a slot, and
+   the index of a record is its count masked with the record
+   count minus 1.  The counts wrap around harmlessly because
+   their difference never exceeds the record count.
+
+   Pushing and popping take any number of records at once, with
+   at most two copies each, so that a caller moving a burst of
+   bytes pays for updating the positions once.  A context that
+   shares an end of the ring among several threads must keep
+   them from using it at the same time itself. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A ring buffer. */
+struct ring
+  {
+    uint8_t *buf;               /* Records. */
+    size_t rec_size;            /* Bytes per record. */
+    uint32_t mask;              /* Number of records, minus 1. */
+    volatile uint32_t head;     /* Records ever pushed. */
+    volatile uint32_t tail;     /* Records ever popped. */
+  };
+
+void ring_init (struct ring *, void *buf, size_t rec_size, size_t rec_cnt);
+
+size_t ring_push (struct ring *, const void *recs, size_t cnt);
+size_t ring_pop (struct ring *, void *recs, size_t cnt);
+
+/* Returns the number of records in R. */
+static inline size_t
+ring_count (const struct ring *r)
+{
+  return r->head - r->tail;
+}
+
+/* Returns the number of records R can hold. */
+static inline size_t
+ring_capacity (const struct ring *r)
+{
+  return (size_t) r->mask + 1;
+}
+
+/* Returns true if R holds no records. */
+static inline bool
+ring_empty (const struct ring *r)
+{
+  return r->head == r->tail;
+}
+
+/* Returns true if R has no room for another record. */
+static inline bool
+ring_full (const struct ring *r)
+{
+  return ring_count (r) == ring_capacity (r);
+}
+
+#endif /* lib/kernel/ring.h */
@@ -140,6 +140,20 @@ static const struct integer_base base_o = {8, "01234567", 0, 3};
 static const struct integer_base base_x = {16, "0123456789abcdef", 'x', 4};
 static const struct integer_base base_X = {16, "0123456789ABCDEF", 'X', 4};
 
+/* "00" through "99", so that decimal conversion can produce two
+   digits per division. */
+static const char digit_pairs[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
 static const char *parse_conversion (const char *format,
                                      struct printf_conversion *,
                                      va_list *);
@@ -147,6 +161,9 @@ static void format_integer (uintmax_t value, bool is_signed, bool negative,
                             const struct integer_base *,
                             const struct printf_conversion *,
                             void (*output) (char, void *), void *aux);
+static void format_decimal (uint32_t value, bool negative,
+                            void (*output) (char, void *), void *aux);
+static char *reverse_decimal (uint32_t value, char *cp);
 static void output_dup (char ch, size_t cnt,
                         void (*output) (char, void *), void *aux);
 static void format_string (const char *string, int length,
@@ -176,6 +193,32 @@ __vprintf (const char *format, va_list args,
           continue;
         }
 
+      /* Plain %d, %i, %u, and %s, with no flags, width,
+         precision, or length modifier, are by far the most
+         common conversions, so handle them without going
+         through parse_conversion(). */
+      if (*format == 'd' || *format == 'i') 
+        {
+          int value = va_arg (args, int);
+          format_decimal (value < 0 ? 0u - (unsigned) value : (unsigned) value,
+                          value < 0, output, aux);
+          continue;
+        }
+      else if (*format == 'u') 
+        {
+          format_decimal (va_arg (args, unsigned), false, output, aux);
+          continue;
+        }
+      else if (*format == 's') 
+        {
+          const char *s = va_arg (args, char *);
+          if (s == NULL)
+            s = "(null)";
+          for (; *s != '\0'; s++)
+            output (*s, aux);
+          continue;
+        }
+
       /* Parse conversion specifiers. */
       format = parse_conversion (format, &c, &args);
 
@@ -502,14 +545,20 @@ format_integer (uintmax_t value, bool is_signed, bool negative,
      This algorithm produces digits in reverse order, so later we
      will output the buffer's content in reverse. */
   cp = buf;
-  digit_cnt = 0;
-  while (value > 0) 
+  if (b->base == 10 && (c->flags & GROUP) == 0 && value <= UINT32_MAX)
+    cp = reverse_decimal (value, cp);
+  else
     {
-      if ((c->flags & GROUP) && digit_cnt > 0 && digit_cnt % b->group == 0)
-        *cp++ = ',';
-      *cp++ = b->digits[value % b->base];
-      value /= b->base;
-      digit_cnt++;
+      digit_cnt = 0;
+      while (value > 0) 
+        {
+          if ((c->flags & GROUP) && digit_cnt > 0
+              && digit_cnt % b->group == 0)
+            *cp++ = ',';
+          *cp++ = b->digits[value % b->base];
+          value /= b->base;
+          digit_cnt++;
+        }
     }
 
   /* Append enough zeros to match precision.
@@ -546,6 +595,50 @@ format_integer (uintmax_t value, bool is_signed, bool negative,
     output_dup (' ', pad_cnt, output, aux);
 }
 
+/* Writes VALUE to OUTPUT with auxiliary data AUX in decimal,
+   preceded by a minus sign if NEGATIVE is true, as a %d or %u
+   conversion with no flags, width, or precision would. */
+static void
+format_decimal (uint32_t value, bool negative,
+                void (*output) (char, void *), void *aux) 
+{
+  char buf[10], *cp;
+
+  cp = reverse_decimal (value, buf);
+  if (cp == buf)
+    *cp++ = '0';
+  if (negative)
+    output ('-', aux);
+  while (cp > buf)
+    output (*--cp, aux);
+}
+
+/* Stores the decimal digits of VALUE starting at CP in reverse
+   order, least significant first, and returns the position just
+   past the last one.  A VALUE of 0 produces no digits.  Uses
+   32-bit divisions, which are much cheaper than the 64-bit
+   divisions that a uintmax_t needs, and only half as many of
+   them as there are digits. */
+static char *
+reverse_decimal (uint32_t value, char *cp) 
+{
+  while (value >= 100) 
+    {
+      const char *pair = digit_pairs + value % 100 * 2;
+      value /= 100;
+      *cp++ = pair[1];
+      *cp++ = pair[0];
+    }
+  if (value >= 10) 
+    {
+      *cp++ = digit_pairs[value * 2 + 1];
+      *cp++ = digit_pairs[value * 2];
+    }
+  else if (value > 0)
+    *cp++ = '0' + value;
+  return cp;
+}
+
 /* Writes CH to OUTPUT with auxiliary data AUX, CNT times. */
 static void
 output_dup (char ch, size_t cnt, void (*output) (char, void *), void *aux) 
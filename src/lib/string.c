@@ -1,20 +1,106 @@
 #include <string.h>
 #include <debug.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A machine word, for reading strings and blocks 4 bytes at a
+   time.  The attribute allows it to alias the bytes it reads. */
+typedef uint32_t word_t __attribute__ ((may_alias));
+
+/* A word with each byte set to 0x01, and to 0x80. */
+#define ONES  0x01010101u
+#define HIGHS 0x80808080u
+
+/* Returns true if any byte of W is zero.  Subtracting 1 from each
+   byte sets its high bit if it was 0 (or above 0x80, which the
+   mask of ~W rules out), and the borrow from a zero byte only
+   ever propagates into bytes above the lowest zero byte. */
+static inline bool
+has_zero (uint32_t w) 
+{
+  return ((w - ONES) & ~w & HIGHS) != 0;
+}
 
-/* Copies SIZE bytes from SRC to DST, which must not overlap.
-   Returns DST. */
-void *
-memcpy (void *dst_, const void *src_, size_t size) 
+/* Returns true if P is word-aligned.  An aligned word never
+   crosses a page boundary, so reading one that holds a string's
+   last byte cannot fault even though it may read a few bytes
+   beyond the string. */
+static inline bool
+word_aligned (const void *p) 
 {
-  unsigned char *dst = dst_;
-  const unsigned char *src = src_;
+  return ((uintptr_t) p & (sizeof (word_t) - 1)) == 0;
+}
 
-  ASSERT (dst != NULL || size == 0);
-  ASSERT (src != NULL || size == 0);
+/* Blocks shorter than this are copied or set a byte at a time,
+   since aligning a `rep' string instruction would cost more than
+   it saves. */
+#define STRING_WORD_MIN 16
+
+/* Copies SIZE bytes from SRC to DST upward, in ascending address
+   order: a byte at a time until DST is word-aligned, then with
+   `rep movsl', then the remaining bytes.  Safe for overlapping
+   blocks as long as DST is below SRC. */
+static inline void
+copy_up (unsigned char *dst, const unsigned char *src, size_t size) 
+{
+  if (size >= STRING_WORD_MIN) 
+    {
+      size_t head = -(uintptr_t) dst & 3;
+      size_t words;
 
+      size -= head;
+      while (head-- > 0)
+        *dst++ = *src++;
+      words = size / 4;
+      size %= 4;
+      asm volatile ("rep movsl"
+                    : "+D" (dst), "+S" (src), "+c" (words) : : "memory");
+    }
   while (size-- > 0)
     *dst++ = *src++;
+}
 
+/* Copies SIZE bytes from SRC to DST downward, in descending
+   address order, the mirror image of copy_up().  Safe for
+   overlapping blocks as long as DST is above SRC. */
+static inline void
+copy_down (unsigned char *dst, const unsigned char *src, size_t size) 
+{
+  dst += size;
+  src += size;
+  if (size >= STRING_WORD_MIN) 
+    {
+      size_t tail = (uintptr_t) dst & 3;
+      size_t words;
+
+      size -= tail;
+      while (tail-- > 0)
+        *--dst = *--src;
+      words = size / 4;
+      size %= 4;
+
+      /* With the direction flag set, `rep movsl' starts at the
+         last word and works down. */
+      dst -= 4;
+      src -= 4;
+      asm volatile ("std; rep movsl; cld"
+                    : "+D" (dst), "+S" (src), "+c" (words) : : "memory");
+      dst += 4;
+      src += 4;
+    }
+  while (size-- > 0)
+    *--dst = *--src;
+}
+
+/* Copies SIZE bytes from SRC to DST, which must not overlap.
+   Returns DST. */
+void *
+memcpy (void *dst_, const void *src_, size_t size) 
+{
+  ASSERT (dst_ != NULL || size == 0);
+  ASSERT (src_ != NULL || size == 0);
+
+  copy_up (dst_, src_, size);
   return dst_;
 }
 
@@ -30,19 +116,11 @@ memmove (void *dst_, const void *src_, size_t size)
   ASSERT (src != NULL || size == 0);
 
   if (dst < src) 
-    {
-      while (size-- > 0)
-        *dst++ = *src++;
-    }
-  else 
-    {
-      dst += size;
-      src += size;
-      while (size-- > 0)
-        *--dst = *--src;
-    }
+    copy_up (dst, src, size);
+  else if (dst > src)
+    copy_down (dst, src, size);
 
-  return dst;
+  return dst_;
 }
 
 /* Find the first differing byte in the two blocks of SIZE bytes
@@ -58,6 +136,20 @@ memcmp (const void *a_, const void *b_, size_t size)
   ASSERT (a != NULL || size == 0);
   ASSERT (b != NULL || size == 0);
 
+  /* Skip equal words, aligning A.  The loads from B may not be
+     aligned, which x86 allows; either way they stay within the
+     block.  The differing byte, if any, is found a byte at a
+     time. */
+  for (; size > 0 && !word_aligned (a); size--, a++, b++)
+    if (*a != *b)
+      return *a > *b ? +1 : -1;
+  for (; size >= sizeof (word_t); size -= sizeof (word_t))
+    {
+      if (*(const word_t *) a != *(const word_t *) b)
+        break;
+      a += sizeof (word_t);
+      b += sizeof (word_t);
+    }
   for (; size-- > 0; a++, b++)
     if (*a != *b)
       return *a > *b ? +1 : -1;
@@ -78,6 +170,21 @@ strcmp (const char *a_, const char *b_)
   ASSERT (a != NULL);
   ASSERT (b != NULL);
 
+  /* If A and B are equally aligned, compare them a word at a time
+     up to the word where they differ or A ends. */
+  if (((uintptr_t) a ^ (uintptr_t) b) % sizeof (word_t) == 0) 
+    {
+      for (; !word_aligned (a); a++, b++)
+        if (*a == '\0' || *a != *b)
+          return *a < *b ? -1 : *a > *b;
+      while (*(const word_t *) a == *(const word_t *) b
+             && !has_zero (*(const word_t *) a))
+        {
+          a += sizeof (word_t);
+          b += sizeof (word_t);
+        }
+    }
+
   while (*a != '\0' && *a == *b) 
     {
       a++;
@@ -95,9 +202,21 @@ memchr (const void *block_, int ch_, size_t size)
 {
   const unsigned char *block = block_;
   unsigned char ch = ch_;
+  uint32_t pattern = ch * ONES;
 
   ASSERT (block != NULL || size == 0);
 
+  /* A byte of a word XORed with PATTERN is zero where the word
+     holds CH. */
+  for (; size > 0 && !word_aligned (block); size--, block++)
+    if (*block == ch)
+      return (void *) block;
+  for (; size >= sizeof (word_t); size -= sizeof (word_t))
+    {
+      if (has_zero (*(const word_t *) block ^ pattern))
+        break;
+      block += sizeof (word_t);
+    }
   for (; size-- > 0; block++)
     if (*block == ch)
       return (void *) block;
@@ -113,9 +232,22 @@ char *
 strchr (const char *string, int c_) 
 {
   char c = c_;
+  uint32_t pattern = (unsigned char) c * ONES;
+  const word_t *w;
 
   ASSERT (string != NULL);
 
+  /* Skip words that hold neither C nor a null terminator. */
+  for (; !word_aligned (string); string++)
+    if (*string == c)
+      return (char *) string;
+    else if (*string == '\0')
+      return NULL;
+  for (w = (const word_t *) string;
+       !has_zero (*w) && !has_zero (*w ^ pattern); w++)
+    continue;
+  string = (const char *) w;
+
   for (;;) 
     if (*string == c)
       return (char *) string;
@@ -281,7 +413,21 @@ memset (void *dst_, int value, size_t size)
   unsigned char *dst = dst_;
 
   ASSERT (dst != NULL || size == 0);
-  
+
+  if (size >= STRING_WORD_MIN) 
+    {
+      size_t head = -(uintptr_t) dst & 3;
+      uint32_t word = (unsigned char) value * 0x01010101u;
+      size_t words;
+
+      size -= head;
+      while (head-- > 0)
+        *dst++ = value;
+      words = size / 4;
+      size %= 4;
+      asm volatile ("rep stosl"
+                    : "+D" (dst), "+c" (words) : "a" (word) : "memory");
+    }
   while (size-- > 0)
     *dst++ = value;
 
@@ -292,11 +438,17 @@ memset (void *dst_, int value, size_t size)
 size_t
 strlen (const char *string) 
 {
-  const char *p;
+  const char *p = string;
+  const word_t *w;
 
   ASSERT (string != NULL);
 
-  for (p = string; *p != '\0'; p++)
+  for (; !word_aligned (p); p++)
+    if (*p == '\0')
+      return p - string;
+  for (w = (const word_t *) p; !has_zero (*w); w++)
+    continue;
+  for (p = (const char *) w; *p != '\0'; p++)
     continue;
   return p - string;
 }
@@ -28,7 +28,37 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_FORK,                   /* Duplicate this process. */
+    SYS_SUBMIT,                 /* Run a batch of system calls. */
+    SYS_PREAD,                  /* Read from a file at an offset. */
+    SYS_PWRITE,                 /* Write to a file at an offset. */
+    SYS_READV,                  /* Read from a file into buffers. */
+    SYS_WRITEV,                 /* Write to a file from buffers. */
+    SYS_SENDFILE,               /* Copy between files. */
+    SYS_SPAWN,                  /* Start a process with given files. */
+    SYS_WAIT_ANY,               /* Wait for any child process to die. */
+    SYS_STATS,                  /* Read a kernel statistic. */
+    SYS_CLOCK,                  /* Read the monotonic clock. */
+    SYS_DIRECT,                 /* Switch a file to direct I/O. */
+    SYS_FADVISE,                /* Advise on a file's access pattern. */
+    SYS_GETDENTS,               /* Read many directory entries. */
+    SYS_SBRK,                   /* Grow or shrink the heap. */
+    SYS_MADVISE,                /* Advise on memory's access pattern. */
+    SYS_MEMSTATS,               /* Read this process's memory stats. */
+    SYS_THREAD_CREATE,          /* Start a thread in this process. */
+    SYS_THREAD_EXIT,            /* End the calling thread. */
+    SYS_FUTEX_WAIT,             /* Sleep on a word if it holds a value. */
+    SYS_FUTEX_WAKE,             /* Wake threads sleeping on a word. */
+    SYS_PIPE,                   /* Create a pipe. */
+    SYS_SHM_MAP,                /* Map a shared-memory segment. */
+    SYS_SHM_UNMAP,              /* Unmap a shared-memory segment. */
+    SYS_IPC_CALL,               /* Send a message and await the reply. */
+    SYS_IPC_RECEIVE,            /* Receive a call. */
+    SYS_IPC_REPLY,              /* Reply to a received call. */
+    SYS_PERF_READ               /* Read this thread's event counts. */
   };
 
 #endif /* lib/syscall-nr.h */
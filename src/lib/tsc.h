@@ -0,0 +1,17 @@
+#ifndef __LIB_TSC_H
+#define __LIB_TSC_H
+
+#include <stdint.h>
+
+/* Returns the processor's time-stamp counter, which counts CPU
+   cycles.  Usable in the kernel and in user programs alike, for
+   timing intervals too short for the timer. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+#endif /* lib/tsc.h */
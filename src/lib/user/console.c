@@ -2,6 +2,129 @@
 #include <string.h>
 #include <syscall.h>
 #include <syscall-nr.h>
+#include <thread.h>
+
+/* Output buffering.
+
+   Output to the console, through printf(), putchar(), puts(),
+   and hprintf() with STDOUT_FILENO, collects in a buffer that is
+   written out when a call leaves a complete line in it, or when
+   it fills up, so that a line printed a piece at a time still
+   takes a single write().  Output through hprintf() to up to
+   FILE_BUF_CNT other handles at a time is buffered fully and
+   only written out when its buffer fills up.  A further handle
+   takes over the buffer of the handle that has had one longest,
+   after flushing it.
+
+   fflush() writes out the buffers by hand.  exit() flushes them
+   all, as does fork(), so the child does not repeat the parent's
+   pending output, and close() flushes the handle it closes.  A
+   program that mixes buffered output with write() to the same
+   handle must call fflush() in between to keep them in order.
+   Output still buffered when the kernel kills a process is
+   lost.  The buffers belong to the whole process, so each output
+   function holds a mutex while it uses them. */
+
+/* Size of an output buffer. */
+#define BUF_SIZE 1024
+
+/* Number of handles other than the console that can have
+   buffers at once. */
+#define FILE_BUF_CNT 4
+
+/* An output buffer. */
+struct out_buf
+  {
+    int handle;                 /* File handle, or 0 if unused. */
+    bool line_done;             /* Console: holds the end of a line? */
+    size_t len;                 /* Bytes in DATA. */
+    char data[BUF_SIZE];        /* Buffered output. */
+  };
+
+/* The console's buffer. */
+static struct out_buf console_buf = {.handle = STDOUT_FILENO};
+
+/* Buffers for other handles, and the one to take over next. */
+static struct out_buf file_bufs[FILE_BUF_CNT];
+static size_t next_file_buf;
+
+/* Protects the buffers. */
+static struct mutex buf_mutex = MUTEX_INITIALIZER;
+
+static void flush_buf (struct out_buf *);
+
+/* Returns the buffer for HANDLE, taking one over if HANDLE does
+   not have one yet, or a null pointer if output to HANDLE is not
+   buffered. */
+static struct out_buf *
+get_buf (int handle)
+{
+  struct out_buf *b;
+  size_t i;
+
+  if (handle == STDOUT_FILENO)
+    return &console_buf;
+  if (handle <= STDIN_FILENO)
+    return NULL;
+
+  for (i = 0; i < FILE_BUF_CNT; i++)
+    if (file_bufs[i].handle == handle)
+      return &file_bufs[i];
+
+  b = &file_bufs[next_file_buf];
+  next_file_buf = (next_file_buf + 1) % FILE_BUF_CNT;
+  flush_buf (b);
+  b->handle = handle;
+  return b;
+}
+
+/* Writes out the contents of B. */
+static void
+flush_buf (struct out_buf *b)
+{
+  if (b->len > 0)
+    write (b->handle, b->data, b->len);
+  b->len = 0;
+  b->line_done = false;
+}
+
+/* Adds C to B, flushing B if it fills up. */
+static void
+put_buf (struct out_buf *b, char c)
+{
+  b->data[b->len++] = c;
+  if (c == '\n' && b == &console_buf)
+    b->line_done = true;
+  if (b->len >= BUF_SIZE)
+    flush_buf (b);
+}
+
+/* Flushes B if it is the console's and holds the end of a
+   line.  Called at the end of each output function. */
+static void
+end_output (struct out_buf *b)
+{
+  if (b->line_done)
+    flush_buf (b);
+}
+
+/* Writes out any output buffered for HANDLE, or for every handle
+   if HANDLE is -1.  Returns 0. */
+int
+fflush (int handle)
+{
+  size_t i;
+
+  mutex_lock (&buf_mutex);
+  if (handle == -1 || handle == STDOUT_FILENO)
+    flush_buf (&console_buf);
+  for (i = 0; i < FILE_BUF_CNT; i++)
+    if (file_bufs[i].handle != 0
+        && (handle == -1 || file_bufs[i].handle == handle))
+      flush_buf (&file_bufs[i]);
+  mutex_unlock (&buf_mutex);
+  return 0;
+}
 
 /* The standard vprintf() function,
    which is like printf() but uses a va_list. */
@@ -30,8 +153,12 @@ hprintf (int handle, const char *format, ...)
 int
 puts (const char *s) 
 {
-  write (STDOUT_FILENO, s, strlen (s));
-  putchar ('\n');
+  mutex_lock (&buf_mutex);
+  for (; *s != '\0'; s++)
+    put_buf (&console_buf, *s);
+  put_buf (&console_buf, '\n');
+  end_output (&console_buf);
+  mutex_unlock (&buf_mutex);
 
   return 0;
 }
@@ -40,18 +167,22 @@ puts (const char *s)
 int
 putchar (int c) 
 {
-  char c2 = c;
-  write (STDOUT_FILENO, &c2, 1);
+  mutex_lock (&buf_mutex);
+  put_buf (&console_buf, c);
+  end_output (&console_buf);
+  mutex_unlock (&buf_mutex);
   return c;
 }
 
 /* Auxiliary data for vhprintf_helper(). */
 struct vhprintf_aux 
   {
-    char buf[64];       /* Character buffer. */
-    char *p;            /* Current position in buffer. */
-    int char_cnt;       /* Total characters written so far. */
-    int handle;         /* Output file handle. */
+    struct out_buf *buf;        /* Output buffer, or null. */
+    char unbuf[64];             /* Characters for HANDLE if BUF
+                                   is null. */
+    char *p;                    /* Current position in UNBUF. */
+    int char_cnt;               /* Total characters written so far. */
+    int handle;                 /* Output file handle. */
   };
 
 static void add_char (char, void *);
@@ -64,31 +195,43 @@ int
 vhprintf (int handle, const char *format, va_list args) 
 {
   struct vhprintf_aux aux;
-  aux.p = aux.buf;
+
+  mutex_lock (&buf_mutex);
+  aux.buf = get_buf (handle);
+  aux.p = aux.unbuf;
   aux.char_cnt = 0;
   aux.handle = handle;
   __vprintf (format, args, add_char, &aux);
-  flush (&aux);
+  if (aux.buf != NULL)
+    end_output (aux.buf);
+  else
+    flush (&aux);
+  mutex_unlock (&buf_mutex);
   return aux.char_cnt;
 }
 
-/* Adds C to the buffer in AUX, flushing it if the buffer fills
-   up. */
+/* Adds C to the output buffer for AUX, or to its own buffer,
+   flushing that if it fills up. */
 static void
 add_char (char c, void *aux_) 
 {
   struct vhprintf_aux *aux = aux_;
-  *aux->p++ = c;
-  if (aux->p >= aux->buf + sizeof aux->buf)
-    flush (aux);
+  if (aux->buf != NULL)
+    put_buf (aux->buf, c);
+  else
+    {
+      *aux->p++ = c;
+      if (aux->p >= aux->unbuf + sizeof aux->unbuf)
+        flush (aux);
+    }
   aux->char_cnt++;
 }
 
-/* Flushes the buffer in AUX. */
+/* Flushes AUX's own buffer. */
 static void
 flush (struct vhprintf_aux *aux)
 {
-  if (aux->p > aux->buf)
-    write (aux->handle, aux->buf, aux->p - aux->buf);
-  aux->p = aux->buf;
+  if (aux->p > aux->unbuf)
+    write (aux->handle, aux->unbuf, aux->p - aux->unbuf);
+  aux->p = aux->unbuf;
 }
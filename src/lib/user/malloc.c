@@ -0,0 +1,411 @@
+#include <malloc.h>
+#include <debug.h>
+#include <round.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include <thread.h>
+
+/* A heap allocator for user programs.
+
+   The heap is one contiguous region that grows and shrinks with
+   sbrk().  Every block in it starts with a 4-byte header, and
+   its data follows at an 8-byte boundary.  Blocks are either
+   "large" blocks, carved straight out of the heap, or "small"
+   blocks, carved out of an "arena", which is itself a large
+   block.
+
+   Requests of up to SMALL_MAX bytes, header included, are
+   rounded up to one of a few size classes.  Each class has a
+   free list of blocks of exactly that size, so allocating and
+   freeing a small block only pushes or pops a list.  When a
+   class's list runs empty, a new arena of ARENA_SIZE bytes is
+   divided into blocks for it.  Small blocks are never merged,
+   and their arenas are never given back.
+
+   Bigger requests are served first-fit from a list of free
+   large blocks.  A free large block also has a copy of its size
+   in its last word, its "footer", and the block after it has
+   PREV_FREE set in its header, so freeing a block merges it
+   with both of its neighbours in constant time, and no two free
+   large blocks are ever adjacent.  An "epilogue" header, always
+   in use, marks the end of the heap.  When no free block is big
+   enough, the heap grows by at least GROW_MIN bytes, and when
+   free() leaves TRIM_MIN bytes free at its end, all but GROW_MIN
+   of them go back to the kernel.
+
+   A program that uses malloc() must not call sbrk() itself,
+   since the heap must stay contiguous.
+
+   The heap belongs to the whole process, so malloc() and free()
+   hold a mutex, which costs little while only one thread
+   allocates. */
+
+/* Size of a block header. */
+#define HDR sizeof (uint32_t)
+
+/* Alignment of the data in a block. */
+#define ALIGN 8
+
+/* Header flags.  The rest of a header is a large block's size,
+   or a small block's class index shifted left by 3. */
+#define IN_USE 1u               /* Large block: allocated. */
+#define PREV_FREE 2u            /* Large block: block before is free. */
+#define SMALL 4u                /* Small block. */
+#define FLAGS 7u
+
+/* Smallest large block: header, two list links, footer. */
+#define LARGE_MIN 16
+
+/* Size of an arena of small blocks. */
+#define ARENA_SIZE 4096
+
+/* Granularity of heap growth and trimming. */
+#define HEAP_PAGE 4096
+
+/* Least the heap grows by, and most free space left at its end
+   after trimming. */
+#define GROW_MIN (16 * 1024)
+
+/* Free space at the end of the heap that triggers trimming. */
+#define TRIM_MIN (64 * 1024)
+
+/* Sizes of the small block classes, header included.  Closely
+   spaced at the low end, where most requests fall. */
+static const size_t class_size[] =
+  {16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512};
+#define CLASS_CNT (sizeof class_size / sizeof *class_size)
+#define SMALL_MAX 512
+
+/* Free small blocks of each class, linked through their first
+   data word. */
+static void *free_small[CLASS_CNT];
+
+/* A large block. */
+struct large
+  {
+    uint32_t header;            /* Size and flags. */
+    struct large *prev;         /* Previous free block, while free. */
+    struct large *next;         /* Next free block, while free. */
+  };
+
+/* Free large blocks. */
+static struct large *free_list;
+
+/* Header at the end of the heap, or null before the heap is
+   set up. */
+static uint32_t *epilogue;
+
+/* Protects the heap. */
+static struct mutex heap_mutex = MUTEX_INITIALIZER;
+
+/* Returns the size of large block B. */
+static inline size_t
+block_size (const struct large *b)
+{
+  return b->header & ~FLAGS;
+}
+
+/* Returns the block after large block B. */
+static inline struct large *
+next_block (const struct large *b)
+{
+  return (struct large *) ((uint8_t *) b + block_size (b));
+}
+
+/* Removes free block B from the free list. */
+static void
+unlink_free (struct large *b)
+{
+  if (b->prev != NULL)
+    b->prev->next = b->next;
+  else
+    free_list = b->next;
+  if (b->next != NULL)
+    b->next->prev = b->prev;
+}
+
+/* Makes B a free block of SIZE bytes, whose predecessor is in
+   use, and adds it to the free list. */
+static void
+make_free (struct large *b, size_t size)
+{
+  b->header = size;
+  ((uint32_t *) ((uint8_t *) b + size))[-1] = size;
+  next_block (b)->header |= PREV_FREE;
+
+  b->prev = NULL;
+  b->next = free_list;
+  if (free_list != NULL)
+    free_list->prev = b;
+  free_list = b;
+}
+
+/* Frees large block B, merging it with its free neighbours.
+   Returns the merged free block. */
+static struct large *
+free_large (struct large *b)
+{
+  size_t size = block_size (b);
+  struct large *next = next_block (b);
+
+  if (!(next->header & IN_USE))
+    {
+      unlink_free (next);
+      size += block_size (next);
+    }
+  if (b->header & PREV_FREE)
+    {
+      struct large *prev = (struct large *) ((uint8_t *) b
+                                             - ((uint32_t *) b)[-1]);
+      unlink_free (prev);
+      size += block_size (prev);
+      b = prev;
+    }
+  make_free (b, size);
+  return b;
+}
+
+/* Gives back to the kernel all but GROW_MIN bytes of free block
+   B if it is at the end of the heap and has at least TRIM_MIN
+   bytes. */
+static void
+trim (struct large *b)
+{
+  size_t size = block_size (b);
+  size_t release;
+
+  if (next_block (b) != (struct large *) epilogue || size < TRIM_MIN)
+    return;
+  release = ROUND_DOWN (size - GROW_MIN, HEAP_PAGE);
+  if (sbrk (-(intptr_t) release) == (void *) -1)
+    return;
+  unlink_free (b);
+  size -= release;
+  epilogue = (uint32_t *) ((uint8_t *) b + size);
+  *epilogue = IN_USE;
+  make_free (b, size);
+}
+
+/* Grows the heap by at least SIZE bytes and frees the new space.
+   Returns true if successful, false if the kernel refuses. */
+static bool
+grow (size_t size)
+{
+  struct large *b;
+  uint8_t *old;
+
+  size = ROUND_UP (size, HEAP_PAGE);
+  if (epilogue == NULL)
+    {
+      /* Put the epilogue where headers go, 4 bytes past an
+         8-byte boundary. */
+      uintptr_t start = (uintptr_t) sbrk (0);
+      size_t pad = (ALIGN + HDR - start % ALIGN) % ALIGN;
+
+      if (sbrk (pad + HDR) == (void *) -1)
+        return false;
+      epilogue = (uint32_t *) (start + pad);
+      *epilogue = IN_USE;
+    }
+
+  old = sbrk (size);
+  if (old == (void *) -1)
+    return false;
+  ASSERT (old == (uint8_t *) epilogue + HDR);
+
+  /* The old epilogue becomes the new block's header. */
+  b = (struct large *) epilogue;
+  b->header = size | (*epilogue & PREV_FREE) | IN_USE;
+  epilogue = (uint32_t *) ((uint8_t *) b + size);
+  *epilogue = IN_USE;
+  free_large (b);
+  return true;
+}
+
+/* Allocates a large block of SIZE bytes, header included, which
+   must be a multiple of ALIGN and at least LARGE_MIN.  Returns
+   the block, or a null pointer if memory is not available. */
+static struct large *
+alloc_large (size_t size)
+{
+  struct large *b;
+  size_t b_size;
+
+  for (;;)
+    {
+      for (b = free_list; b != NULL; b = b->next)
+        if (block_size (b) >= size)
+          break;
+      if (b != NULL)
+        break;
+      if (!grow (size > GROW_MIN ? size : GROW_MIN))
+        return NULL;
+    }
+
+  unlink_free (b);
+  b_size = block_size (b);
+  if (b_size - size >= LARGE_MIN)
+    {
+      /* Split off the rest as a free block. */
+      b->header = size | IN_USE;
+      make_free (next_block (b), b_size - size);
+    }
+  else
+    {
+      b->header = b_size | IN_USE;
+      next_block (b)->header &= ~PREV_FREE;
+    }
+  return b;
+}
+
+/* Divides a new arena into blocks of class CLS and adds them to
+   the class's free list.  Returns true if successful, false if
+   memory is not available. */
+static bool
+refill (size_t cls)
+{
+  size_t size = class_size[cls];
+  struct large *a = alloc_large (ARENA_SIZE);
+  uint8_t *first, *p;
+
+  if (a == NULL)
+    return false;
+
+  /* The first small header goes one word past the arena's own,
+     where the next header boundary is.  Push the blocks from the
+     last down, so that they come off the list in address
+     order. */
+  first = (uint8_t *) a + ALIGN;
+  p = first + (ARENA_SIZE - ALIGN) / size * size;
+  while (p > first)
+    {
+      p -= size;
+      *(uint32_t *) p = (cls << 3) | SMALL;
+      *(void **) (p + HDR) = free_small[cls];
+      free_small[cls] = p + HDR;
+    }
+  return true;
+}
+
+/* Returns the number of bytes the block at P can hold. */
+static size_t
+capacity (void *p)
+{
+  uint32_t header = ((uint32_t *) p)[-1];
+
+  if (header & SMALL)
+    return class_size[header >> 3] - HDR;
+  else
+    return (header & ~FLAGS) - HDR;
+}
+
+/* Obtains and returns a new block of at least SIZE bytes.
+   Returns a null pointer if memory is not available. */
+void *
+malloc (size_t size)
+{
+  struct large *b;
+  size_t need, cls;
+  void *p;
+
+  if (size == 0 || size > INT32_MAX)
+    return NULL;
+  need = ROUND_UP (size + HDR, ALIGN);
+
+  mutex_lock (&heap_mutex);
+  if (need <= SMALL_MAX)
+    {
+      for (cls = 0; class_size[cls] < need; cls++)
+        continue;
+      if (free_small[cls] == NULL && !refill (cls))
+        p = NULL;
+      else
+        {
+          p = free_small[cls];
+          free_small[cls] = *(void **) p;
+        }
+    }
+  else
+    {
+      b = alloc_large (need);
+      p = b != NULL ? (uint8_t *) b + HDR : NULL;
+    }
+  mutex_unlock (&heap_mutex);
+  return p;
+}
+
+/* Allocates and return A times B bytes initialized to zeroes.
+   Returns a null pointer if memory is not available. */
+void *
+calloc (size_t a, size_t b)
+{
+  void *p;
+  size_t size;
+
+  size = a * b;
+  if (size < a || size < b)
+    return NULL;
+  p = malloc (size);
+  if (p != NULL)
+    memset (p, 0, size);
+  return p;
+}
+
+/* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
+   moving it in the process.  If successful, returns the new
+   block; on failure, returns a null pointer.  A call with null
+   OLD_BLOCK is equivalent to malloc(new_size).  A call with
+   zero NEW_SIZE is equivalent to free(old_block). */
+void *
+realloc (void *old_block, size_t new_size)
+{
+  void *new_block;
+  size_t old_size;
+
+  if (new_size == 0)
+    {
+      free (old_block);
+      return NULL;
+    }
+  if (old_block == NULL)
+    return malloc (new_size);
+
+  old_size = capacity (old_block);
+  if (new_size <= old_size)
+    return old_block;
+  new_block = malloc (new_size);
+  if (new_block != NULL)
+    {
+      memcpy (new_block, old_block, old_size);
+      free (old_block);
+    }
+  return new_block;
+}
+
+/* Frees block P, which must have been previously allocated with
+   malloc(), calloc(), or realloc(). */
+void
+free (void *p)
+{
+  uint32_t header;
+
+  if (p == NULL)
+    return;
+  header = ((uint32_t *) p)[-1];
+  mutex_lock (&heap_mutex);
+  if (header & SMALL)
+    {
+      size_t cls = header >> 3;
+
+      *(void **) p = free_small[cls];
+      free_small[cls] = p;
+    }
+  else
+    {
+      ASSERT (header & IN_USE);
+      trim (free_large ((struct large *) ((uint8_t *) p - HDR)));
+    }
+  mutex_unlock (&heap_mutex);
+}
@@ -1,31 +1,62 @@
 #include <syscall.h>
+#include <stdio.h>
 #include "../syscall-nr.h"
 
+/* True if system calls can use SYSENTER instead of `int $0x30'.
+   Set by syscall_probe(), which _start() calls first thing. */
+static bool use_sysenter;
+
+/* CPUID feature bit (function 1, EDX) for SYSENTER and SYSEXIT,
+   which the kernel also checks to decide whether to take system
+   calls that way. */
+#define CPUID_SEP (1u << 11)
+
+/* Decides how to make system calls. */
+void
+syscall_probe (void) 
+{
+  unsigned eax = 1, ebx, ecx, edx;
+
+  asm ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  use_sysenter = (edx & CPUID_SEP) != 0;
+}
+
+/* Traps into the kernel with the system call number and ARGS
+   bytes of arguments already pushed, and then pops them.  With
+   SYSENTER, the kernel returns to the address in %edx with the
+   stack pointer in %ecx; otherwise `int $0x30' is used. */
+#define SYSCALL_TRAP(ARGS)                                      \
+        "cmpb $0, %[fast]; je 1f; "                             \
+        "movl %%esp, %%ecx; movl $2f, %%edx; sysenter; "        \
+        "1: int $0x30; 2: addl $" #ARGS ", %%esp"
+
 /* Invokes syscall NUMBER, passing no arguments, and returns the
    return value as an `int'. */
 #define syscall0(NUMBER)                                        \
         ({                                                      \
           int retval;                                           \
           asm volatile                                          \
-            ("pushl %[number]; int $0x30; addl $4, %%esp"       \
+            ("pushl %[number]; " SYSCALL_TRAP (4)               \
                : "=a" (retval)                                  \
-               : [number] "i" (NUMBER)                          \
-               : "memory");                                     \
+               : [number] "i" (NUMBER),                         \
+                 [fast] "m" (use_sysenter)                      \
+               : "ecx", "edx", "memory");                       \
           retval;                                               \
         })
 
 /* Invokes syscall NUMBER, passing argument ARG0, and returns the
    return value as an `int'. */
-#define syscall1(NUMBER, ARG0)                                           \
-        ({                                                               \
-          int retval;                                                    \
-          asm volatile                                                   \
-            ("pushl %[arg0]; pushl %[number]; int $0x30; addl $8, %%esp" \
-               : "=a" (retval)                                           \
-               : [number] "i" (NUMBER),                                  \
-                 [arg0] "g" (ARG0)                                       \
-               : "memory");                                              \
-          retval;                                                        \
+#define syscall1(NUMBER, ARG0)                                  \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg0]; pushl %[number]; " SYSCALL_TRAP (8) \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [fast] "m" (use_sysenter),                     \
+                 [arg0] "g" (ARG0)                              \
+               : "ecx", "edx", "memory");                       \
+          retval;                                               \
         })
 
 /* Invokes syscall NUMBER, passing arguments ARG0 and ARG1, and
@@ -35,12 +66,13 @@
           int retval;                                           \
           asm volatile                                          \
             ("pushl %[arg1]; pushl %[arg0]; "                   \
-             "pushl %[number]; int $0x30; addl $12, %%esp"      \
+             "pushl %[number]; " SYSCALL_TRAP (12)              \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER),                         \
+                 [fast] "m" (use_sysenter),                     \
                  [arg0] "g" (ARG0),                             \
                  [arg1] "g" (ARG1)                              \
-               : "memory");                                     \
+               : "ecx", "edx", "memory");                       \
           retval;                                               \
         })
 
@@ -51,13 +83,34 @@
           int retval;                                           \
           asm volatile                                          \
             ("pushl %[arg2]; pushl %[arg1]; pushl %[arg0]; "    \
-             "pushl %[number]; int $0x30; addl $16, %%esp"      \
+             "pushl %[number]; " SYSCALL_TRAP (16)              \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER),                         \
+                 [fast] "m" (use_sysenter),                     \
                  [arg0] "g" (ARG0),                             \
                  [arg1] "g" (ARG1),                             \
                  [arg2] "g" (ARG2)                              \
-               : "memory");                                     \
+               : "ecx", "edx", "memory");                       \
+          retval;                                               \
+        })
+
+/* Invokes syscall NUMBER, passing arguments ARG0, ARG1, ARG2,
+   and ARG3, and returns the return value as an `int'. */
+#define syscall4(NUMBER, ARG0, ARG1, ARG2, ARG3)                \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg3]; pushl %[arg2]; "                   \
+             "pushl %[arg1]; pushl %[arg0]; "                   \
+             "pushl %[number]; " SYSCALL_TRAP (20)              \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [fast] "m" (use_sysenter),                     \
+                 [arg0] "g" (ARG0),                             \
+                 [arg1] "g" (ARG1),                             \
+                 [arg2] "g" (ARG2),                             \
+                 [arg3] "g" (ARG3)                              \
+               : "ecx", "edx", "memory");                       \
           retval;                                               \
         })
 
@@ -71,6 +124,7 @@ halt (void)
 void
 exit (int status)
 {
+  fflush (-1);
   syscall1 (SYS_EXIT, status);
   NOT_REACHED ();
 }
@@ -138,13 +192,20 @@ tell (int fd)
 void
 close (int fd)
 {
+  fflush (fd);
   syscall1 (SYS_CLOSE, fd);
 }
 
 mapid_t
 mmap (int fd, void *addr)
 {
-  return syscall2 (SYS_MMAP, fd, addr);
+  return syscall3 (SYS_MMAP, fd, addr, 0);
+}
+
+mapid_t
+mmap_flags (int fd, void *addr, int flags)
+{
+  return syscall3 (SYS_MMAP, fd, addr, flags);
 }
 
 void
@@ -182,3 +243,182 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+pid_t
+fork (void) 
+{
+  fflush (-1);
+  return (pid_t) syscall0 (SYS_FORK);
+}
+
+int
+submit (struct syscall_op *ops, unsigned cnt) 
+{
+  return syscall2 (SYS_SUBMIT, ops, cnt);
+}
+
+int
+pread (int fd, void *buffer, unsigned size, unsigned offset) 
+{
+  return syscall4 (SYS_PREAD, fd, buffer, size, offset);
+}
+
+int
+pwrite (int fd, const void *buffer, unsigned size, unsigned offset) 
+{
+  return syscall4 (SYS_PWRITE, fd, buffer, size, offset);
+}
+
+int
+readv (int fd, const struct iovec *iov, unsigned iov_cnt) 
+{
+  return syscall3 (SYS_READV, fd, iov, iov_cnt);
+}
+
+int
+writev (int fd, const struct iovec *iov, unsigned iov_cnt) 
+{
+  return syscall3 (SYS_WRITEV, fd, iov, iov_cnt);
+}
+
+int
+sendfile (int out_fd, int in_fd, unsigned size) 
+{
+  return syscall3 (SYS_SENDFILE, out_fd, in_fd, size);
+}
+
+pid_t
+spawn (const char *cmd_line, const struct spawn_action *actions,
+       unsigned action_cnt) 
+{
+  return (pid_t) syscall3 (SYS_SPAWN, cmd_line, actions, action_cnt);
+}
+
+pid_t
+wait_any (int *exit_code, bool block) 
+{
+  return (pid_t) syscall2 (SYS_WAIT_ANY, exit_code, block);
+}
+
+bool
+stats_read (unsigned idx, struct stats_entry *entry) 
+{
+  return syscall2 (SYS_STATS, idx, entry);
+}
+
+unsigned long long
+clock_ns (void) 
+{
+  unsigned long long ns;
+  syscall1 (SYS_CLOCK, &ns);
+  return ns;
+}
+
+bool
+direct_io (int fd, bool direct) 
+{
+  return syscall2 (SYS_DIRECT, fd, direct);
+}
+
+bool
+fadvise (int fd, unsigned offset, unsigned length, int advice) 
+{
+  return syscall4 (SYS_FADVISE, fd, offset, length, advice);
+}
+
+int
+getdents (int fd, struct dirent *entries, unsigned size) 
+{
+  return syscall4 (SYS_GETDENTS, fd, entries, size, 0);
+}
+
+int
+getdents_stat (int fd, struct dirent_stat *entries, unsigned size) 
+{
+  return syscall4 (SYS_GETDENTS, fd, entries, size, 1);
+}
+
+void *
+sbrk (intptr_t increment) 
+{
+  return (void *) syscall1 (SYS_SBRK, increment);
+}
+
+int
+madvise (void *addr, unsigned size, int advice) 
+{
+  return syscall3 (SYS_MADVISE, addr, size, advice);
+}
+
+void
+memstats (struct mem_stats *ms) 
+{
+  syscall1 (SYS_MEMSTATS, ms);
+}
+
+tid_t
+thread_create (void (*entry) (void), void *stack, int *tid_word) 
+{
+  return syscall3 (SYS_THREAD_CREATE, entry, stack, tid_word);
+}
+
+void
+thread_exit (void) 
+{
+  syscall0 (SYS_THREAD_EXIT);
+  NOT_REACHED ();
+}
+
+int
+futex_wait (int *word, int expected) 
+{
+  return syscall2 (SYS_FUTEX_WAIT, word, expected);
+}
+
+int
+futex_wake (int *word, int cnt) 
+{
+  return syscall2 (SYS_FUTEX_WAKE, word, cnt);
+}
+
+bool
+pipe (int fds[2]) 
+{
+  return syscall1 (SYS_PIPE, fds);
+}
+
+void *
+shm_map (const char *name, unsigned size, void *addr) 
+{
+  return (void *) syscall3 (SYS_SHM_MAP, name, size, addr);
+}
+
+bool
+shm_unmap (void *addr) 
+{
+  return syscall1 (SYS_SHM_UNMAP, addr);
+}
+
+bool
+ipc_call (pid_t pid, struct ipc_msg *msg) 
+{
+  return syscall2 (SYS_IPC_CALL, pid, msg);
+}
+
+tid_t
+ipc_receive (struct ipc_msg *msg) 
+{
+  return syscall1 (SYS_IPC_RECEIVE, msg);
+}
+
+bool
+ipc_reply (tid_t client, const struct ipc_msg *msg) 
+{
+  return syscall2 (SYS_IPC_REPLY, client, msg);
+}
+
+bool
+perf_read (struct perf_counts *pc) 
+{
+  return syscall1 (SYS_PERF_READ, pc);
+}
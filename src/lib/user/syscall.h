@@ -2,19 +2,45 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <debug.h>
 
 /* Process identifier. */
 typedef int pid_t;
 #define PID_ERROR ((pid_t) -1)
 
+/* Thread identifier. */
+typedef int tid_t;
+#define TID_ERROR ((tid_t) -1)
+
 /* Map region identifier. */
 typedef int mapid_t;
 #define MAP_FAILED ((mapid_t) -1)
 
+/* Flags for mmap_flags().  Match MMAP_* in vm/mmap.h. */
+#define MAP_POPULATE 0x1        /* Read in the whole file at once. */
+
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
+/* Maximum characters in a statistic name written by
+   stats_read(). */
+#define STATS_NAME_MAX 31
+
+/* Maximum characters in the name of a shared-memory segment.
+   Matches SHM_NAME_MAX in vm/shm.h. */
+#define SHM_NAME_MAX 31
+
+/* Number of words in a message passed by ipc_call().  Matches
+   IPC_MSG_WORDS in userprog/ipc.h. */
+#define IPC_MSG_WORDS 8
+
+/* A message passed by ipc_call() and ipc_reply(). */
+struct ipc_msg
+  {
+    unsigned words[IPC_MSG_WORDS];
+  };
+
 /* Typical return values from main() and arguments to exit(). */
 #define EXIT_SUCCESS 0          /* Successful execution. */
 #define EXIT_FAILURE 1          /* Unsuccessful execution. */
@@ -36,6 +62,7 @@ void close (int fd);
 
 /* Task 3 and optionally task 4. */
 mapid_t mmap (int fd, void *addr);
+mapid_t mmap_flags (int fd, void *addr, int flags);
 void munmap (mapid_t);
 
 /* Task 4 only. */
@@ -45,4 +72,142 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* A system call queued for submit().  NR is one of SYS_READ,
+   SYS_WRITE, SYS_PREAD, SYS_PWRITE, SYS_READV, SYS_WRITEV,
+   SYS_SENDFILE, SYS_SEEK, SYS_TELL, SYS_FILESIZE, or SYS_CLOSE,
+   and ARG holds its arguments.  RESULT receives what the call
+   returns. */
+struct syscall_op
+  {
+    int nr;                     /* System call number. */
+    unsigned arg[4];            /* Arguments. */
+    int result;                 /* Return value. */
+  };
+
+/* A buffer for readv() and writev(). */
+struct iovec
+  {
+    void *iov_base;             /* Start of buffer. */
+    unsigned iov_len;           /* Length in bytes. */
+  };
+
+/* Advice for fadvise(). */
+enum fadvise_advice
+  {
+    FADV_NORMAL,                /* No particular pattern. */
+    FADV_SEQUENTIAL,            /* Read from start to end. */
+    FADV_RANDOM,                /* Read in no particular order. */
+    FADV_WILLNEED,              /* Range will be read soon. */
+    FADV_DONTNEED               /* Range will not be read again soon. */
+  };
+
+/* Advice for madvise(). */
+enum madvise_advice
+  {
+    MADV_NORMAL,                /* No particular pattern. */
+    MADV_SEQUENTIAL,            /* Used once, from start to end. */
+    MADV_WILLNEED,              /* Range will be used soon. */
+    MADV_DONTNEED               /* Range will not be used again soon. */
+  };
+
+/* What a spawn_action does. */
+enum spawn_op
+  {
+    SPAWN_DUP,                  /* Copy this process's SRC_FD to FD. */
+    SPAWN_CLOSE,                /* Close FD. */
+    SPAWN_OPEN                  /* Open PATH as FD. */
+  };
+
+/* A change to make to the file descriptors of a process started
+   by spawn(), which starts out with no files open, before it is
+   loaded. */
+struct spawn_action
+  {
+    int op;                     /* A spawn_op. */
+    int fd;                     /* Descriptor to change. */
+    int src_fd;                 /* Our descriptor, for SPAWN_DUP. */
+    const char *path;           /* File to open, for SPAWN_OPEN. */
+  };
+
+/* A directory entry, as read by getdents(). */
+struct dirent
+  {
+    unsigned inumber;                   /* Inode sector number. */
+    char name[READDIR_MAX_LEN + 1];     /* Null terminated file name. */
+  };
+
+/* A directory entry with facts about its inode, as read by
+   getdents_stat(). */
+struct dirent_stat
+  {
+    unsigned inumber;                   /* Inode sector number. */
+    int length;                         /* Length in bytes. */
+    bool is_dir;                        /* Is it a directory? */
+    char name[READDIR_MAX_LEN + 1];     /* Null terminated file name. */
+  };
+
+/* A kernel statistic, as read by stats_read(). */
+struct stats_entry
+  {
+    unsigned long long value;           /* Current value. */
+    int gauge;                          /* Nonzero for a gauge. */
+    char name[STATS_NAME_MAX + 1];      /* "group.name". */
+  };
+
+/* Memory statistics of a process, as read by memstats(). */
+struct mem_stats
+  {
+    unsigned long long minor_faults;    /* Page faults that did no I/O. */
+    unsigned long long major_faults;    /* Page faults that read a page. */
+    unsigned long long swap_ins;        /* Pages read from swap. */
+    unsigned long long swap_outs;       /* Pages written to swap. */
+    unsigned resident_pages;            /* Pages in memory now. */
+    unsigned mapped_pages;              /* Pages of mapped files now. */
+  };
+
+/* Hardware event counts of a thread, as read by perf_read(). */
+struct perf_counts
+  {
+    unsigned long long cycles;          /* Unhalted core cycles. */
+    unsigned long long instructions;    /* Instructions retired. */
+    unsigned long long llc_misses;      /* Last-level cache misses. */
+    unsigned long long dtlb_misses;     /* Data TLB misses that walk the
+                                           page tables. */
+  };
+
+/* Extensions. */
+pid_t fork (void);
+pid_t spawn (const char *cmd_line, const struct spawn_action *,
+             unsigned action_cnt);
+pid_t wait_any (int *exit_code, bool block);
+int submit (struct syscall_op *, unsigned cnt);
+int pread (int fd, void *buffer, unsigned length, unsigned offset);
+int pwrite (int fd, const void *buffer, unsigned length, unsigned offset);
+int readv (int fd, const struct iovec *, unsigned iov_cnt);
+int writev (int fd, const struct iovec *, unsigned iov_cnt);
+int sendfile (int out_fd, int in_fd, unsigned length);
+bool stats_read (unsigned idx, struct stats_entry *);
+unsigned long long clock_ns (void);
+bool direct_io (int fd, bool direct);
+bool fadvise (int fd, unsigned offset, unsigned length, int advice);
+int getdents (int fd, struct dirent *, unsigned size);
+int getdents_stat (int fd, struct dirent_stat *, unsigned size);
+void *sbrk (intptr_t increment);
+int madvise (void *addr, unsigned length, int advice);
+void memstats (struct mem_stats *);
+tid_t thread_create (void (*entry) (void), void *stack, int *tid_word);
+void thread_exit (void) NO_RETURN;
+int futex_wait (int *word, int expected);
+int futex_wake (int *word, int cnt);
+bool pipe (int fds[2]);
+void *shm_map (const char *name, unsigned size, void *addr);
+bool shm_unmap (void *addr);
+bool ipc_call (pid_t, struct ipc_msg *);
+tid_t ipc_receive (struct ipc_msg *);
+bool ipc_reply (tid_t client, const struct ipc_msg *);
+bool perf_read (struct perf_counts *);
+
+/* Called by _start() before main(). */
+void syscall_probe (void);
+
 #endif /* lib/user/syscall.h */
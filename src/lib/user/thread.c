@@ -0,0 +1,118 @@
+#include <thread.h>
+#include <debug.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <syscall.h>
+
+/* Threads.
+
+   Each thread has a stack of UTHREAD_STACK_SIZE bytes from
+   malloc().  The kernel starts a new thread at start() with its
+   stack pointer where uthread_create() has laid out start()'s
+   arguments, as a call would have.  The kernel stores the new
+   thread's id in its struct uthread before thread_create()
+   returns and clears it when the thread exits, waking any
+   futex_wait() on it, so uthread_join() waits on that word and
+   frees the stack once it is 0.
+
+   A mutex is a futex, after Drepper, "Futexes Are Tricky": its
+   word is 0 when free, 1 when held, and 2 when held and other
+   threads may be waiting.  Taking a free mutex changes 0 to 1,
+   and releasing one that is 1 stores 0, with no system call.
+   Only a thread that finds the mutex held sets it to 2 and
+   sleeps in futex_wait(), and only a release that finds 2 calls
+   futex_wake(). */
+
+/* Atomically stores NEW into *P and returns the old value. */
+static inline int
+xchg (int *p, int new)
+{
+  asm volatile ("xchgl %0, %1" : "+r" (new), "+m" (*p) : : "memory");
+  return new;
+}
+
+/* Atomically stores NEW into *P if it holds OLD.  Returns the
+   value *P held. */
+static inline int
+cmpxchg (int *p, int old, int new)
+{
+  asm volatile ("lock cmpxchgl %2, %1"
+                : "+a" (old), "+m" (*p) : "r" (new) : "memory");
+  return old;
+}
+
+/* Runs FUNC(AUX) as a new thread, then ends the thread. */
+static void NO_RETURN
+start (uthread_func *func, void *aux)
+{
+  func (aux);
+  thread_exit ();
+}
+
+/* Starts a new thread in this process running FUNC(AUX), and
+   sets up T to refer to it.  Returns true if successful, false
+   if no memory is available for the thread's stack or the
+   kernel cannot create the thread. */
+bool
+uthread_create (struct uthread *t, uthread_func *func, void *aux)
+{
+  uint32_t *sp;
+
+  t->stack = malloc (UTHREAD_STACK_SIZE);
+  if (t->stack == NULL)
+    return false;
+
+  /* A fake return address and start()'s arguments, placed so
+     that the stack is 16-byte aligned at the call, as GCC
+     expects. */
+  sp = (uint32_t *) ((uintptr_t) ((uint8_t *) t->stack + UTHREAD_STACK_SIZE)
+                     & ~(uintptr_t) 15) - 5;
+  sp[0] = 0;
+  sp[1] = (uint32_t) func;
+  sp[2] = (uint32_t) aux;
+
+  t->tid = 0;
+  if (thread_create ((void (*) (void)) start, sp, &t->tid) == TID_ERROR)
+    {
+      free (t->stack);
+      return false;
+    }
+  return true;
+}
+
+/* Waits for thread T to exit and frees its stack. */
+void
+uthread_join (struct uthread *t)
+{
+  int tid;
+
+  while ((tid = t->tid) != 0)
+    futex_wait (&t->tid, tid);
+  free (t->stack);
+}
+
+/* Takes mutex M, waiting for it if another thread holds it. */
+void
+mutex_lock (struct mutex *m)
+{
+  int c = cmpxchg (&m->state, 0, 1);
+
+  if (c == 0)
+    return;
+  if (c != 2)
+    c = xchg (&m->state, 2);
+  while (c != 0)
+    {
+      futex_wait (&m->state, 2);
+      c = xchg (&m->state, 2);
+    }
+}
+
+/* Releases mutex M, which the running thread must hold, waking
+   a thread waiting for it if there may be one. */
+void
+mutex_unlock (struct mutex *m)
+{
+  if (xchg (&m->state, 0) == 2)
+    futex_wake (&m->state, 1);
+}
@@ -0,0 +1,38 @@
+#ifndef __LIB_USER_THREAD_H
+#define __LIB_USER_THREAD_H
+
+#include <stdbool.h>
+#include <syscall.h>
+
+/* A thread started by uthread_create(). */
+struct uthread
+  {
+    int tid;                    /* Thread id, 0 once it has exited. */
+    void *stack;                /* Its stack, from malloc(). */
+  };
+
+/* Function that a thread runs. */
+typedef void uthread_func (void *aux);
+
+/* Size of a thread's stack. */
+#define UTHREAD_STACK_SIZE (64 * 1024)
+
+bool uthread_create (struct uthread *, uthread_func *, void *aux);
+void uthread_join (struct uthread *);
+
+/* A lock for a process's threads, which costs one atomic
+   instruction to take and release while no other thread wants
+   it, and enters the kernel only to wait for it otherwise. */
+struct mutex
+  {
+    int state;                  /* 0: free, 1: held, 2: held with
+                                   waiters. */
+  };
+
+/* Initializer for a mutex, which is free. */
+#define MUTEX_INITIALIZER {0}
+
+void mutex_lock (struct mutex *);
+void mutex_unlock (struct mutex *);
+
+#endif /* lib/user/thread.h */
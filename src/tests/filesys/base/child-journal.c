@@ -0,0 +1,20 @@
+/* Run by journal-replay-persistence on the disk that
+   journal-replay left behind.  Checks that the file it wrote has
+   its data and that the file it removed is gone. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/base/journal-replay.h"
+
+static char buf[BUF_SIZE];
+
+void
+test_main (void) 
+{
+  random_bytes (buf, sizeof buf);
+  check_file (file_name, buf, sizeof buf);
+  CHECK (open (removed_name) == -1, "open \"%s\" (must fail)",
+         removed_name);
+}
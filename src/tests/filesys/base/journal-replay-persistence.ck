@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+fail "Journal was not replayed at boot.\n"
+  if !grep (/^Journal: replayed \d+ transactions\.$/, @output);
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(child-journal) begin
+(child-journal) open "journaled" for verification
+(child-journal) verified contents of "journaled"
+(child-journal) close "journaled"
+(child-journal) open "removed" (must fail)
+(child-journal) end
+EOF
+pass;
@@ -0,0 +1,29 @@
+/* Creates and writes a file, and creates and removes another.
+   The kernel runs with -crash, so that it powers off with these
+   changes committed to the journal but not written home, and
+   child-journal, run from the same disk by
+   journal-replay-persistence, checks that the next boot replays
+   them. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/base/journal-replay.h"
+
+static char buf[BUF_SIZE];
+
+void
+test_main (void) 
+{
+  int fd;
+
+  random_bytes (buf, sizeof buf);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf, "write \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  CHECK (create (removed_name, 0), "create \"%s\"", removed_name);
+  CHECK (remove (removed_name), "remove \"%s\"", removed_name);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(journal-replay) begin
+(journal-replay) create "journaled"
+(journal-replay) open "journaled"
+(journal-replay) write "journaled"
+(journal-replay) close "journaled"
+(journal-replay) create "removed"
+(journal-replay) remove "removed"
+(journal-replay) end
+EOF
+pass;
@@ -0,0 +1,8 @@
+#ifndef TESTS_FILESYS_BASE_JOURNAL_REPLAY_H
+#define TESTS_FILESYS_BASE_JOURNAL_REPLAY_H
+
+#define BUF_SIZE 5000
+static const char file_name[] = "journaled";
+static const char removed_name[] = "removed";
+
+#endif /* tests/filesys/base/journal-replay.h */
@@ -0,0 +1,98 @@
+/* Test program and benchmark for lib/kernel/bitmap.c.
+
+   Checks bitmap_scan() against a straightforward bit-by-bit
+   scan, on bitmaps fragmented to various degrees, and reports
+   how many CPU cycles each takes.
+
+   This is not a test we will run on your submitted tasks.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/test.h"
+
+/* Number of bits in each bitmap tested, about as many as there
+   are pages in a user pool. */
+#define BIT_CNT 4096
+
+/* Number of scans timed for each bitmap. */
+#define SCAN_CNT 64
+
+static size_t simple_scan (const struct bitmap *, size_t start, size_t cnt,
+                           bool value);
+static void fragment (struct bitmap *, int percent);
+
+/* Tests and times bitmap_scan(). */
+void
+test (void) 
+{
+  static const int percents[] = {10, 50, 90, 99};
+  struct bitmap *b = bitmap_create (BIT_CNT);
+  size_t i;
+
+  ASSERT (b != NULL);
+  for (i = 0; i < sizeof percents / sizeof *percents; i++)
+    {
+      uint64_t fast = 0, slow = 0;
+      int j;
+
+      fragment (b, percents[i]);
+      for (j = 0; j < SCAN_CNT; j++)
+        {
+          size_t start = random_ulong () % BIT_CNT;
+          size_t cnt = 1 + random_ulong () % 8;
+          bool value = j % 2 == 0;
+          uint64_t t0, t1, t2;
+          size_t a, b_idx;
+
+          t0 = timer_tsc ();
+          a = bitmap_scan (b, start, cnt, value);
+          t1 = timer_tsc ();
+          b_idx = simple_scan (b, start, cnt, value);
+          t2 = timer_tsc ();
+          ASSERT (a == b_idx);
+          fast += t1 - t0;
+          slow += t2 - t1;
+        }
+      printf ("%d%% set: bitmap_scan %llu cycles, bit by bit %llu cycles\n",
+              percents[i], fast / SCAN_CNT, slow / SCAN_CNT);
+    }
+  bitmap_destroy (b);
+  printf ("bitmap: PASS\n");
+}
+
+/* bitmap_scan() as it was originally written, testing every
+   candidate start one bit at a time. */
+static size_t
+simple_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
+{
+  size_t bit_cnt = bitmap_size (b);
+  size_t i, j;
+
+  if (cnt > bit_cnt)
+    return BITMAP_ERROR;
+  for (i = start; i <= bit_cnt - cnt; i++)
+    {
+      for (j = 0; j < cnt; j++)
+        if (bitmap_test (b, i + j) != value)
+          break;
+      if (j == cnt)
+        return i;
+    }
+  return BITMAP_ERROR;
+}
+
+/* Sets about PERCENT percent of the bits in B, at random. */
+static void
+fragment (struct bitmap *b, int percent) 
+{
+  size_t i;
+
+  for (i = 0; i < bitmap_size (b); i++)
+    bitmap_set (b, i, (int) (random_ulong () % 100) < percent);
+}
@@ -0,0 +1,131 @@
+/* Benchmark for the sample hash functions in lib/kernel/hash.c.
+
+   Hashes two kinds of key that the kernel's tables use heavily,
+   user page addresses and file names, with hash_bytes() and
+   hash_string() and with the byte-at-a-time FNV-1 hash they
+   originally computed.  Reports the CPU cycles each takes per
+   key, and how evenly each spreads the keys over a power-of-2
+   number of buckets, the way struct hash picks a bucket, as the
+   length of the longest bucket and the average number of keys
+   sharing a key's bucket.
+
+   This is not a test we will run on your submitted tasks.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/test.h"
+#include "threads/vaddr.h"
+
+/* Number of keys of each kind. */
+#define KEY_CNT 1024
+
+/* Number of buckets to spread the keys over, a power of 2. */
+#define BUCKET_CNT 256
+
+/* Fowler-Noll-Vo hash constants, for 32-bit word sizes. */
+#define FNV_32_PRIME 16777619u
+#define FNV_32_BASIS 2166136261u
+
+/* The keys. */
+static void *pages[KEY_CNT];
+static char names[KEY_CNT][16];
+
+typedef unsigned hash_key_func (int key, bool fast);
+
+static hash_key_func page_key, name_key;
+static void measure (const char *name, hash_key_func *);
+
+/* Times and compares the hash functions. */
+void
+test (void)
+{
+  int i;
+
+  for (i = 0; i < KEY_CNT; i++)
+    {
+      pages[i] = (uint8_t *) 0x08048000 + i * PGSIZE;
+      snprintf (names[i], sizeof names[i], "file%d.c", i);
+    }
+  measure ("page addresses", page_key);
+  measure ("file names", name_key);
+  printf ("hash: PASS\n");
+}
+
+/* Returns the FNV-1 hash of the SIZE bytes in BUF. */
+static unsigned
+fnv_bytes (const void *buf_, size_t size)
+{
+  const unsigned char *buf = buf_;
+  unsigned hash = FNV_32_BASIS;
+
+  while (size-- > 0)
+    hash = (hash * FNV_32_PRIME) ^ *buf++;
+  return hash;
+}
+
+/* Returns the hash of the KEY'th user page address, with
+   hash_bytes() if FAST is true, otherwise with FNV-1, as the
+   supplemental page table hashes them. */
+static unsigned
+page_key (int key, bool fast)
+{
+  return (fast
+          ? hash_bytes (&pages[key], sizeof pages[key])
+          : fnv_bytes (&pages[key], sizeof pages[key]));
+}
+
+/* Returns the hash of the KEY'th file name, with hash_string()
+   if FAST is true, otherwise with FNV-1. */
+static unsigned
+name_key (int key, bool fast)
+{
+  const char *name = names[key];
+
+  return fast ? hash_string (name) : fnv_bytes (name, strlen (name));
+}
+
+/* Hashes KEY_CNT keys with KEY, first with FNV-1 then with the
+   current hash, and prints the results under NAME. */
+static void
+measure (const char *name, hash_key_func *key)
+{
+  static const char *labels[] = {"FNV-1", "current"};
+  int fast;
+
+  for (fast = 0; fast <= 1; fast++)
+    {
+      static int buckets[BUCKET_CNT];
+      uint64_t cycles = 0;
+      unsigned sum_squares = 0;
+      int longest = 0;
+      int i;
+
+      memset (buckets, 0, sizeof buckets);
+      for (i = 0; i < KEY_CNT; i++)
+        {
+          uint64_t t0 = timer_tsc ();
+          unsigned hash = key (i, fast);
+          cycles += timer_tsc () - t0;
+          buckets[hash & (BUCKET_CNT - 1)]++;
+        }
+      for (i = 0; i < BUCKET_CNT; i++)
+        {
+          sum_squares += buckets[i] * buckets[i];
+          if (buckets[i] > longest)
+            longest = buckets[i];
+        }
+
+      /* An ideal hash gives about KEY_CNT / BUCKET_CNT + 1 keys
+         sharing a bucket. */
+      printf ("%s, %s: %llu cycles/key, longest bucket %d, "
+              "%u.%02u keys/bucket\n", name, labels[fast],
+              cycles / KEY_CNT, longest, sum_squares / KEY_CNT,
+              sum_squares % KEY_CNT * 100 / KEY_CNT);
+    }
+}
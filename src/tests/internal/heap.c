@@ -0,0 +1,125 @@
+/* Test program for lib/kernel/heap.c.
+
+   Pushes, pops, removes and raises the keys of random elements,
+   checking after each step that the heap's maximum and a
+   traversal of it agree with a straightforward scan of which
+   elements should be in it.
+
+   This is not a test we will run on your submitted tasks.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <heap.h>
+#include <random.h>
+#include <stdio.h>
+#include "threads/test.h"
+
+/* Number of elements. */
+#define ELEM_CNT 64
+
+/* Number of operations. */
+#define OP_CNT 20000
+
+/* A heap element. */
+struct value
+  {
+    struct heap_elem elem;      /* Heap element. */
+    int key;                    /* Key. */
+    bool in_heap;               /* In the heap? */
+  };
+
+static struct value values[ELEM_CNT];
+
+static heap_less_func value_less;
+static void verify (struct heap *);
+
+/* Tests the heap implementation. */
+void
+test (void)
+{
+  struct heap heap;
+  int i;
+
+  heap_init (&heap, value_less, NULL);
+  for (i = 0; i < OP_CNT; i++)
+    {
+      struct value *v = &values[random_ulong () % ELEM_CNT];
+
+      switch (random_ulong () % 4)
+        {
+        case 0:
+          if (!v->in_heap)
+            {
+              v->key = random_ulong () % 32;
+              v->in_heap = true;
+              heap_push (&heap, &v->elem);
+            }
+          break;
+
+        case 1:
+          if (!heap_empty (&heap))
+            heap_entry (heap_pop (&heap), struct value, elem)->in_heap
+              = false;
+          break;
+
+        case 2:
+          if (v->in_heap)
+            {
+              heap_remove (&heap, &v->elem);
+              v->in_heap = false;
+            }
+          break;
+
+        default:
+          if (v->in_heap)
+            {
+              v->key += random_ulong () % 8;
+              heap_increase (&heap, &v->elem);
+            }
+          break;
+        }
+      verify (&heap);
+    }
+  printf ("heap: PASS\n");
+}
+
+/* Returns true if value A's key is less than value B's. */
+static bool
+value_less (const struct heap_elem *a, const struct heap_elem *b,
+            void *aux UNUSED)
+{
+  return (heap_entry (a, struct value, elem)->key
+          < heap_entry (b, struct value, elem)->key);
+}
+
+/* Checks that HEAP holds exactly the values marked as in it, and
+   that its maximum has the greatest of their keys. */
+static void
+verify (struct heap *heap)
+{
+  struct heap_elem *e;
+  int max = -1;
+  int cnt = 0;
+  int i;
+
+  for (i = 0; i < ELEM_CNT; i++)
+    if (values[i].in_heap)
+      {
+        cnt++;
+        if (values[i].key > max)
+          max = values[i].key;
+      }
+
+  for (e = heap_begin (heap); e != NULL; e = heap_next (e))
+    {
+      ASSERT (heap_entry (e, struct value, elem)->in_heap);
+      cnt--;
+    }
+  ASSERT (cnt == 0);
+
+  ASSERT (max < 0
+          ? heap_empty (heap)
+          : heap_entry (heap_max (heap), struct value, elem)->key == max);
+}
@@ -0,0 +1,172 @@
+/* Test program for lib/kernel/rbtree.c.
+
+   Inserts and removes random elements, some with equal keys,
+   checking after each step that the tree keeps the red-black
+   properties, that iterating it forward and backward visits
+   exactly the elements that should be in it in order, and that
+   searches for random keys agree with a straightforward scan.
+
+   This is not a test we will run on your submitted tasks.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <random.h>
+#include <rbtree.h>
+#include <stdio.h>
+#include "threads/test.h"
+
+/* Number of elements. */
+#define ELEM_CNT 64
+
+/* Number of distinct keys. */
+#define KEY_CNT 32
+
+/* Number of operations. */
+#define OP_CNT 20000
+
+/* A tree element. */
+struct value
+  {
+    struct rb_elem elem;        /* Tree element. */
+    int key;                    /* Key. */
+    int seq;                    /* Order of insertion. */
+    bool in_tree;               /* In the tree? */
+  };
+
+static struct value values[ELEM_CNT];
+
+static rb_less_func value_less;
+static int verify_subtree (const struct rb_elem *, const struct rb_elem *);
+static void verify (struct rb_tree *);
+static void verify_search (struct rb_tree *, int key);
+
+/* Tests the tree implementation. */
+void
+test (void)
+{
+  struct rb_tree tree;
+  int seq = 0;
+  int i;
+
+  rb_init (&tree, value_less, NULL);
+  for (i = 0; i < OP_CNT; i++)
+    {
+      struct value *v = &values[random_ulong () % ELEM_CNT];
+
+      if (!v->in_tree)
+        {
+          v->key = random_ulong () % KEY_CNT;
+          v->seq = seq++;
+          v->in_tree = true;
+          rb_insert (&tree, &v->elem);
+        }
+      else if (random_ulong () % 2)
+        {
+          rb_remove (&tree, &v->elem);
+          v->in_tree = false;
+        }
+      verify (&tree);
+      verify_search (&tree, (int) (random_ulong () % (KEY_CNT + 2)) - 1);
+    }
+  printf ("rbtree: PASS\n");
+}
+
+/* Returns true if value A's key is less than value B's. */
+static bool
+value_less (const struct rb_elem *a, const struct rb_elem *b,
+            void *aux UNUSED)
+{
+  return (rb_entry (a, struct value, elem)->key
+          < rb_entry (b, struct value, elem)->key);
+}
+
+/* Checks the links and colors of the subtree rooted at E, whose
+   parent is PARENT, and returns the number of black elements on
+   each path down from E, counting E. */
+static int
+verify_subtree (const struct rb_elem *e, const struct rb_elem *parent)
+{
+  int left, right;
+
+  if (e == NULL)
+    return 0;
+  ASSERT (e->parent == parent);
+  ASSERT (!e->red || parent == NULL || !parent->red);
+
+  left = verify_subtree (e->left, e);
+  right = verify_subtree (e->right, e);
+  ASSERT (left == right);
+  return left + !e->red;
+}
+
+/* Checks that TREE is a red-black tree holding exactly the values
+   marked as in it, ordered by key and then by insertion. */
+static void
+verify (struct rb_tree *tree)
+{
+  struct rb_elem *e;
+  struct value *prev = NULL;
+  int in_cnt = 0, cnt = 0;
+  int i;
+
+  ASSERT (rb_empty (tree) || !tree->root->red);
+  verify_subtree (tree->root, NULL);
+
+  for (i = 0; i < ELEM_CNT; i++)
+    if (values[i].in_tree)
+      in_cnt++;
+
+  for (e = rb_begin (tree); e != rb_end (tree); e = rb_next (e))
+    {
+      struct value *v = rb_entry (e, struct value, elem);
+
+      ASSERT (v->in_tree);
+      ASSERT (prev == NULL || prev->key < v->key
+              || (prev->key == v->key && prev->seq < v->seq));
+      prev = v;
+      cnt++;
+    }
+  ASSERT (cnt == in_cnt);
+  ASSERT (rb_last (tree) == (prev != NULL ? &prev->elem : NULL));
+
+  for (e = rb_last (tree); e != NULL; e = rb_prev (e))
+    cnt--;
+  ASSERT (cnt == 0);
+  ASSERT (rb_empty (tree) == (in_cnt == 0));
+}
+
+/* Checks that searching TREE for KEY finds the first element
+   whose key is not less than KEY, the first whose key is greater,
+   and the first equal to it. */
+static void
+verify_search (struct rb_tree *tree, int key)
+{
+  struct value k, *lower = NULL, *upper = NULL;
+  int i;
+
+  for (i = 0; i < ELEM_CNT; i++)
+    {
+      struct value *v = &values[i];
+
+      if (!v->in_tree)
+        continue;
+      if (v->key >= key
+          && (lower == NULL || v->key < lower->key
+              || (v->key == lower->key && v->seq < lower->seq)))
+        lower = v;
+      if (v->key > key
+          && (upper == NULL || v->key < upper->key
+              || (v->key == upper->key && v->seq < upper->seq)))
+        upper = v;
+    }
+
+  k.key = key;
+  ASSERT (rb_lower_bound (tree, &k.elem)
+          == (lower != NULL ? &lower->elem : rb_end (tree)));
+  ASSERT (rb_upper_bound (tree, &k.elem)
+          == (upper != NULL ? &upper->elem : rb_end (tree)));
+  ASSERT (rb_find (tree, &k.elem)
+          == (lower != NULL && lower->key == key ? &lower->elem : NULL));
+}
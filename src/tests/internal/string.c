@@ -0,0 +1,149 @@
+/* Benchmark for memcpy(), memmove() and memset() in lib/string.c
+   and for clear_page() and copy_page() in threads/vaddr.h.
+
+   Checks each against a byte-at-a-time loop, like the ones the
+   functions originally used, and reports the throughput of both
+   in hundredths of a byte per CPU cycle.
+
+   This is not a test we will run on your submitted tasks.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/palloc.h"
+#include "threads/test.h"
+#include "threads/vaddr.h"
+
+/* Number of times each operation is timed. */
+#define REPEAT_CNT 64
+
+static void byte_copy (unsigned char *, const unsigned char *, size_t);
+static void byte_set (unsigned char *, int, size_t);
+static void report (const char *, size_t size, uint64_t fast,
+                    uint64_t slow);
+
+/* Checks and times the string functions. */
+void
+test (void)
+{
+  static const size_t sizes[] = {16, 64, 512, PGSIZE - 3};
+  unsigned char *src = palloc_get_page (PAL_ASSERT);
+  unsigned char *dst = palloc_get_page (PAL_ASSERT);
+  unsigned char *ref = palloc_get_page (PAL_ASSERT);
+  uint64_t fast, slow, t0;
+  size_t i;
+  int j;
+
+  random_bytes (src, PGSIZE);
+  for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+    {
+      size_t size = sizes[i];
+      size_t ofs = (PGSIZE - size) - random_ulong () % 4;
+
+      fast = slow = 0;
+      for (j = 0; j < REPEAT_CNT; j++)
+        {
+          t0 = timer_tsc ();
+          memcpy (dst + ofs, src + 1, size);
+          fast += timer_tsc () - t0;
+          t0 = timer_tsc ();
+          byte_copy (ref + ofs, src + 1, size);
+          slow += timer_tsc () - t0;
+          ASSERT (!memcmp (dst + ofs, ref + ofs, size));
+        }
+      report ("memcpy", size, fast, slow);
+
+      fast = slow = 0;
+      for (j = 0; j < REPEAT_CNT; j++)
+        {
+          t0 = timer_tsc ();
+          memset (dst + ofs, j, size);
+          fast += timer_tsc () - t0;
+          t0 = timer_tsc ();
+          byte_set (ref + ofs, j, size);
+          slow += timer_tsc () - t0;
+          ASSERT (!memcmp (dst + ofs, ref + ofs, size));
+        }
+      report ("memset", size, fast, slow);
+
+      /* Overlapping moves in both directions. */
+      memcpy (dst, src, PGSIZE);
+      memcpy (ref, src, PGSIZE);
+      memmove (dst + 1, dst, size);
+      memmove (dst, dst + 3, size);
+      byte_copy (ref + 1, src, size);
+      byte_copy (ref, ref + 3, size);
+      ASSERT (!memcmp (dst, ref, PGSIZE));
+    }
+
+  fast = slow = 0;
+  for (j = 0; j < REPEAT_CNT; j++)
+    {
+      t0 = timer_tsc ();
+      copy_page (dst, src);
+      fast += timer_tsc () - t0;
+      t0 = timer_tsc ();
+      byte_copy (ref, src, PGSIZE);
+      slow += timer_tsc () - t0;
+      ASSERT (!memcmp (dst, ref, PGSIZE));
+    }
+  report ("copy_page", PGSIZE, fast, slow);
+
+  fast = slow = 0;
+  for (j = 0; j < REPEAT_CNT; j++)
+    {
+      t0 = timer_tsc ();
+      clear_page (dst);
+      fast += timer_tsc () - t0;
+      t0 = timer_tsc ();
+      byte_set (ref, 0, PGSIZE);
+      slow += timer_tsc () - t0;
+      ASSERT (!memcmp (dst, ref, PGSIZE));
+    }
+  report ("clear_page", PGSIZE, fast, slow);
+
+  palloc_free_page (src);
+  palloc_free_page (dst);
+  palloc_free_page (ref);
+  printf ("string: PASS\n");
+}
+
+/* Copies SIZE bytes from SRC to DST a byte at a time, in
+   ascending order. */
+static void
+byte_copy (unsigned char *dst, const unsigned char *src, size_t size)
+{
+  volatile unsigned char *d = dst;
+
+  while (size-- > 0)
+    *d++ = *src++;
+}
+
+/* Sets SIZE bytes at DST to VALUE a byte at a time. */
+static void
+byte_set (unsigned char *dst, int value, size_t size)
+{
+  volatile unsigned char *d = dst;
+
+  while (size-- > 0)
+    *d++ = value;
+}
+
+/* Prints the throughput of NAME, which took FAST cycles in all
+   for REPEAT_CNT operations on SIZE bytes, against the SLOW
+   cycles the byte loop took. */
+static void
+report (const char *name, size_t size, uint64_t fast, uint64_t slow)
+{
+  uint64_t bytes = (uint64_t) size * REPEAT_CNT * 100;
+
+  printf ("%s of %zu bytes: %llu.%02llu bytes/cycle, "
+          "byte loop %llu.%02llu bytes/cycle\n", name, size,
+          bytes / (fast + 1) / 100, bytes / (fast + 1) % 100,
+          bytes / (slow + 1) / 100, bytes / (slow + 1) % 100);
+}
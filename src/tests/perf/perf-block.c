@@ -0,0 +1,60 @@
+/* Measures the bandwidth of block_read_multiple() reading the
+   first few megabytes of the file system device, or of the first
+   block device if there is none, in transfers of increasing
+   size.  Does nothing in a kernel without block devices. */
+
+#include <stdio.h>
+#include "tests/perf/perf.h"
+#include "devices/block.h"
+#include "devices/timer.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Most sectors read, in all, for each transfer size. */
+#define READ_SECTORS 4096
+
+/* Pages in the buffer, giving the largest transfer size. */
+#define BUFFER_PAGES 16
+
+void
+test_perf_block (void) 
+{
+  struct block *block = block_get_role (BLOCK_FILESYS);
+  size_t sectors_per_page = PGSIZE / BLOCK_SECTOR_SIZE;
+  block_sector_t total;
+  size_t cnt;
+  void *buffer;
+
+  if (block == NULL)
+    block = block_first ();
+  if (block == NULL)
+    {
+      msg ("no block device; nothing to measure.");
+      return;
+    }
+  total = block_size (block) < READ_SECTORS ? block_size (block)
+                                            : READ_SECTORS;
+  buffer = palloc_get_multiple (PAL_ASSERT, BUFFER_PAGES);
+
+  for (cnt = 1; cnt <= BUFFER_PAGES * sectors_per_page; cnt *= 4)
+    {
+      int64_t start_ticks = timer_ticks ();
+      uint64_t start = rdtsc ();
+      block_sector_t sector;
+      int64_t ticks;
+      char what[48];
+
+      for (sector = 0; sector + cnt <= total; sector += cnt)
+        block_read_multiple (block, sector, cnt, buffer);
+      ticks = timer_elapsed (start_ticks);
+
+      snprintf (what, sizeof what, "%s: read %zu sectors at a time",
+                block_name (block), cnt);
+      perf_report (what, rdtsc () - start, total / cnt);
+      if (ticks > 0)
+        msg ("%s: %lld kB/s", what,
+             (long long) (total / cnt * cnt) * BLOCK_SECTOR_SIZE
+             / 1024 * TIMER_FREQ / ticks);
+    }
+  palloc_free_multiple (buffer, BUFFER_PAGES);
+}
@@ -0,0 +1,72 @@
+/* Measures the throughput of crc32c_sw(), which uses lookup
+   tables, and of crc32c() with the crc32 instruction if the CPU
+   has it, on buffers of increasing size, in bytes per cycle.
+   Checks first that both give the standard check value and agree
+   with each other on unaligned data. */
+
+#include <crc32.h>
+#include <debug.h>
+#include <stdio.h>
+#include "tests/perf/perf.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Bytes checksummed, in all, for each buffer size. */
+#define TOTAL_BYTES (4 * 1024 * 1024)
+
+/* Pages in the buffer, giving the largest buffer size. */
+#define BUFFER_PAGES 16
+
+typedef uint32_t crc_func (uint32_t, const void *, size_t);
+
+/* Times FUNC on buffers of increasing size from BUFFER and
+   reports the results under NAME. */
+static void
+measure (const char *name, crc_func *func, const uint8_t *buffer)
+{
+  size_t size;
+
+  for (size = 64; size <= BUFFER_PAGES * PGSIZE; size *= 8)
+    {
+      size_t cnt = TOTAL_BYTES / size;
+      uint32_t crc = 0;
+      uint64_t start, cycles;
+      char what[48];
+      size_t i;
+
+      start = rdtsc ();
+      for (i = 0; i < cnt; i++)
+        crc = func (crc, buffer, size);
+      cycles = rdtsc () - start;
+
+      snprintf (what, sizeof what, "%s: %zu bytes", name, size);
+      perf_report (what, cycles, cnt);
+      if (cycles > 0)
+        msg ("%s: %llu.%02llu bytes/cycle", what,
+             (unsigned long long) TOTAL_BYTES / cycles,
+             (unsigned long long) TOTAL_BYTES * 100 / cycles % 100);
+    }
+}
+
+void
+test_perf_crc (void)
+{
+  uint8_t *buffer = palloc_get_multiple (PAL_ASSERT, BUFFER_PAGES);
+  size_t i;
+
+  for (i = 0; i < BUFFER_PAGES * PGSIZE; i++)
+    buffer[i] = i * 31 + (i >> 8);
+
+  ASSERT (crc32c_sw (0, "123456789", 9) == 0xe3069283);
+  ASSERT (crc32c (0, "123456789", 9) == 0xe3069283);
+  ASSERT (crc32c (crc32c (0, buffer + 1, 100), buffer + 101, 999)
+          == crc32c_sw (0, buffer + 1, 1099));
+
+  measure ("crc32c tables", crc32c_sw, buffer);
+  if (crc32c_hw_present ())
+    measure ("crc32c instruction", crc32c, buffer);
+  else
+    msg ("no SSE4.2; crc32 instruction not measured.");
+
+  palloc_free_multiple (buffer, BUFFER_PAGES);
+}
@@ -0,0 +1,64 @@
+/* Measures the cost of acquiring and releasing a lock that no
+   other thread wants, and of handing a lock back and forth
+   between two threads that both want it. */
+
+#include "tests/perf/perf.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Number of acquisitions. */
+#define ACQUIRE_CNT 100000
+
+/* Number of handoffs. */
+#define HANDOFF_CNT 5000
+
+static struct lock lock;
+static thread_func contend_thread;
+
+void
+test_perf_lock (void) 
+{
+  struct semaphore done;
+  uint64_t start;
+  int i;
+
+  lock_init (&lock);
+  start = rdtsc ();
+  for (i = 0; i < ACQUIRE_CNT; i++)
+    {
+      lock_acquire (&lock);
+      lock_release (&lock);
+    }
+  perf_report ("lock_acquire() and lock_release(), uncontended",
+               rdtsc () - start, ACQUIRE_CNT);
+
+  /* Holding the lock while we yield makes the other thread wait
+     for it each time. */
+  sema_init (&done, 0);
+  thread_create ("contender", thread_get_priority (), contend_thread,
+                 &done);
+  start = rdtsc ();
+  for (i = 0; i < HANDOFF_CNT; i++)
+    {
+      lock_acquire (&lock);
+      thread_yield ();
+      lock_release (&lock);
+    }
+  sema_down (&done);
+  perf_report ("lock handoff between two threads", rdtsc () - start,
+               2 * HANDOFF_CNT);
+}
+
+static void
+contend_thread (void *done) 
+{
+  int i;
+
+  for (i = 0; i < HANDOFF_CNT; i++)
+    {
+      lock_acquire (&lock);
+      thread_yield ();
+      lock_release (&lock);
+    }
+  sema_up (done);
+}
@@ -0,0 +1,49 @@
+/* Measures the throughput of malloc() and free() for a range of
+   block sizes. */
+
+#include <stdio.h>
+#include "tests/perf/perf.h"
+#include "threads/malloc.h"
+
+/* Number of blocks held at once. */
+#define BLOCK_CNT 64
+
+/* Number of times to allocate and free all of them. */
+#define ROUND_CNT 100
+
+void
+test_perf_malloc (void) 
+{
+  static const size_t sizes[] = {16, 64, 256, 1024, 2048, 8192};
+  static void *blocks[BLOCK_CNT];
+  size_t s;
+
+  for (s = 0; s < sizeof sizes / sizeof *sizes; s++)
+    {
+      uint64_t malloc_cycles = 0, free_cycles = 0;
+      char what[32];
+      int round, i;
+
+      for (round = 0; round < ROUND_CNT; round++)
+        {
+          uint64_t start = rdtsc ();
+          for (i = 0; i < BLOCK_CNT; i++)
+            {
+              blocks[i] = malloc (sizes[s]);
+              if (blocks[i] == NULL)
+                fail ("malloc (%zu) failed", sizes[s]);
+            }
+          malloc_cycles += rdtsc () - start;
+
+          start = rdtsc ();
+          for (i = 0; i < BLOCK_CNT; i++)
+            free (blocks[i]);
+          free_cycles += rdtsc () - start;
+        }
+
+      snprintf (what, sizeof what, "malloc (%zu)", sizes[s]);
+      perf_report (what, malloc_cycles, ROUND_CNT * BLOCK_CNT);
+      snprintf (what, sizeof what, "free() of %zu bytes", sizes[s]);
+      perf_report (what, free_cycles, ROUND_CNT * BLOCK_CNT);
+    }
+}
@@ -0,0 +1,56 @@
+/* Measures the throughput of the page allocator, one page at a
+   time and in runs of contiguous pages. */
+
+#include "tests/perf/perf.h"
+#include "threads/palloc.h"
+
+/* Number of pages held at once. */
+#define PAGE_CNT 64
+
+/* Number of times to allocate and free all of them. */
+#define ROUND_CNT 100
+
+/* Pages in each contiguous run. */
+#define RUN_PAGES 8
+
+void
+test_perf_palloc (void) 
+{
+  static void *pages[PAGE_CNT];
+  uint64_t get_cycles = 0, free_cycles = 0;
+  uint64_t start;
+  int round, i;
+
+  for (round = 0; round < ROUND_CNT; round++)
+    {
+      start = rdtsc ();
+      for (i = 0; i < PAGE_CNT; i++)
+        pages[i] = palloc_get_page (PAL_ASSERT);
+      get_cycles += rdtsc () - start;
+
+      start = rdtsc ();
+      for (i = 0; i < PAGE_CNT; i++)
+        palloc_free_page (pages[i]);
+      free_cycles += rdtsc () - start;
+    }
+  perf_report ("palloc_get_page()", get_cycles, ROUND_CNT * PAGE_CNT);
+  perf_report ("palloc_free_page()", free_cycles, ROUND_CNT * PAGE_CNT);
+
+  get_cycles = free_cycles = 0;
+  for (round = 0; round < ROUND_CNT; round++)
+    {
+      start = rdtsc ();
+      for (i = 0; i < PAGE_CNT / RUN_PAGES; i++)
+        pages[i] = palloc_get_multiple (PAL_ASSERT, RUN_PAGES);
+      get_cycles += rdtsc () - start;
+
+      start = rdtsc ();
+      for (i = 0; i < PAGE_CNT / RUN_PAGES; i++)
+        palloc_free_multiple (pages[i], RUN_PAGES);
+      free_cycles += rdtsc () - start;
+    }
+  perf_report ("palloc_get_multiple() of 8 pages", get_cycles,
+               ROUND_CNT * (PAGE_CNT / RUN_PAGES));
+  perf_report ("palloc_free_multiple() of 8 pages", free_cycles,
+               ROUND_CNT * (PAGE_CNT / RUN_PAGES));
+}
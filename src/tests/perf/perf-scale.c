@@ -0,0 +1,281 @@
+/* Measures how the scheduler and synchronization primitives
+   scale with the number of threads.  For 1, 10, 100 and 1000
+   threads in turn, it times:
+
+     - A timer_sleep() storm: every thread sleeps for one to four
+       ticks, over and over.  Reported per wakeup, along with how
+       many ticks late the storm finished, since a wakeup path
+       that is linear in the number of sleepers shows up as
+       missed ticks rather than as CPU time.
+
+     - A lock convoy: every thread acquires one lock, yields
+       while holding it, and releases it, so that the others
+       queue up behind it.  Reported per acquisition.
+
+     - A semaphore chain: the threads, and this one, form a ring
+       in which each waits on its own semaphore and ups the next
+       one's, passing a single token around.  Reported per
+       handoff.
+
+   All threads wait for a common start, so that creating them is
+   not timed.  A point whose threads cannot all be created, for
+   lack of memory, is skipped with a message, as are the points
+   after it. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/perf/perf.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Thread counts swept. */
+static const unsigned points[] = {1, 10, 100, 1000};
+#define POINT_CNT (sizeof points / sizeof *points)
+
+/* Sleeps by each thread in the storm. */
+#define SLEEP_ROUNDS 8
+
+/* Acquisitions and handoffs in all, shared among the threads. */
+#define CONVOY_OPS 4000
+#define CHAIN_OPS 20000
+
+/* What the threads of one point share. */
+struct scale
+  {
+    unsigned thread_cnt;                /* Number of threads. */
+    unsigned rounds;                    /* Work per thread. */
+    struct semaphore start;             /* Up'd once per thread to go. */
+    struct semaphore done;              /* Up'd by each thread at end. */
+    struct lock lock;                   /* For the convoy. */
+    struct semaphore *ring;             /* THREAD_CNT + 1, for the chain. */
+  };
+
+/* A thread of the chain, and its place in the ring. */
+struct link
+  {
+    struct scale *s;
+    unsigned idx;
+  };
+
+static thread_func sleep_thread, convoy_thread, chain_thread;
+
+/* Starts S->thread_cnt threads running FUNC, passing the I'th
+   one AUX[I] if AUX is nonnull or S otherwise.  Returns false
+   if they cannot all be created, after letting the ones that
+   were created finish. */
+static bool
+spawn (struct scale *s, thread_func *func, struct link *aux)
+{
+  unsigned i;
+
+  for (i = 0; i < s->thread_cnt; i++)
+    {
+      char name[16];
+
+      snprintf (name, sizeof name, "scale %u", i);
+      if (thread_create (name, thread_get_priority (), func,
+                         aux != NULL ? (void *) &aux[i] : s) == TID_ERROR)
+        {
+          s->rounds = 0;
+          s->thread_cnt = i;
+          return false;
+        }
+    }
+  return true;
+}
+
+/* Lets S's threads go, waits for them all to finish, and returns
+   the cycles that took. */
+static uint64_t
+run (struct scale *s)
+{
+  uint64_t start = rdtsc ();
+  unsigned i;
+
+  for (i = 0; i < s->thread_cnt; i++)
+    sema_up (&s->start);
+  for (i = 0; i < s->thread_cnt; i++)
+    sema_down (&s->done);
+  return rdtsc () - start;
+}
+
+/* Runs the storm for N threads.  Returns false if they cannot
+   all be created. */
+static bool
+sleep_storm (unsigned n)
+{
+  struct scale s;
+  int64_t start;
+  uint64_t cycles;
+  bool ok;
+  char what[64];
+
+  s.thread_cnt = n;
+  s.rounds = SLEEP_ROUNDS;
+  sema_init (&s.start, 0);
+  sema_init (&s.done, 0);
+  ok = spawn (&s, sleep_thread, NULL);
+
+  /* Start at a tick boundary. */
+  timer_sleep (1);
+  start = timer_ticks ();
+  cycles = run (&s);
+  if (!ok)
+    return false;
+
+  snprintf (what, sizeof what, "timer_sleep() storm, %u threads", n);
+  perf_report (what, cycles, n * SLEEP_ROUNDS);
+
+  /* No thread sleeps more than 4 ticks a round, so a storm that
+     takes much longer than 4 * SLEEP_ROUNDS ticks is falling
+     behind. */
+  msg ("%s: %"PRId64" ticks for at most %d", what,
+       timer_ticks () - start, 4 * SLEEP_ROUNDS);
+  return true;
+}
+
+static void
+sleep_thread (void *s_)
+{
+  struct scale *s = s_;
+  int64_t ticks = thread_tid () % 4 + 1;
+  unsigned i;
+
+  sema_down (&s->start);
+  for (i = 0; i < s->rounds; i++)
+    timer_sleep (ticks);
+  sema_up (&s->done);
+}
+
+/* Runs the convoy for N threads.  Returns false if they cannot
+   all be created. */
+static bool
+lock_convoy (unsigned n)
+{
+  struct scale s;
+  uint64_t cycles;
+  bool ok;
+  char what[64];
+
+  s.thread_cnt = n;
+  s.rounds = CONVOY_OPS / n > 0 ? CONVOY_OPS / n : 1;
+  sema_init (&s.start, 0);
+  sema_init (&s.done, 0);
+  lock_init (&s.lock);
+  ok = spawn (&s, convoy_thread, NULL);
+  cycles = run (&s);
+  if (!ok)
+    return false;
+
+  snprintf (what, sizeof what, "lock convoy, %u threads", n);
+  perf_report (what, cycles, n * s.rounds);
+  return true;
+}
+
+static void
+convoy_thread (void *s_)
+{
+  struct scale *s = s_;
+  unsigned i;
+
+  sema_down (&s->start);
+  for (i = 0; i < s->rounds; i++)
+    {
+      lock_acquire (&s->lock);
+      thread_yield ();
+      lock_release (&s->lock);
+    }
+  sema_up (&s->done);
+}
+
+/* Runs the chain for N threads.  Returns false if they cannot
+   all be created. */
+static bool
+sema_chain (unsigned n)
+{
+  struct scale s;
+  struct link *links;
+  uint64_t start, cycles;
+  unsigned i;
+  char what[64];
+
+  s.thread_cnt = n;
+  s.rounds = CHAIN_OPS / (n + 1) > 0 ? CHAIN_OPS / (n + 1) : 1;
+  sema_init (&s.start, 0);
+  sema_init (&s.done, 0);
+  s.ring = malloc ((n + 1) * sizeof *s.ring);
+  links = malloc (n * sizeof *links);
+  if (s.ring == NULL || links == NULL)
+    {
+      free (s.ring);
+      free (links);
+      return false;
+    }
+  for (i = 0; i <= n; i++)
+    sema_init (&s.ring[i], 0);
+  for (i = 0; i < n; i++)
+    {
+      links[i].s = &s;
+      links[i].idx = i + 1;
+    }
+
+  if (!spawn (&s, chain_thread, links))
+    {
+      run (&s);
+      free (s.ring);
+      free (links);
+      return false;
+    }
+
+  /* This thread is place 0 in the ring, and starts the token. */
+  for (i = 0; i < n; i++)
+    sema_up (&s.start);
+  start = rdtsc ();
+  for (i = 0; i < s.rounds; i++)
+    {
+      sema_up (&s.ring[1]);
+      sema_down (&s.ring[0]);
+    }
+  cycles = rdtsc () - start;
+  for (i = 0; i < n; i++)
+    sema_down (&s.done);
+
+  snprintf (what, sizeof what, "semaphore chain, %u threads", n);
+  perf_report (what, cycles, (n + 1) * s.rounds);
+  free (s.ring);
+  free (links);
+  return true;
+}
+
+static void
+chain_thread (void *link_)
+{
+  struct link *link = link_;
+  struct scale *s = link->s;
+  struct semaphore *next = &s->ring[(link->idx + 1) % (s->thread_cnt + 1)];
+  unsigned i;
+
+  sema_down (&s->start);
+  for (i = 0; i < s->rounds; i++)
+    {
+      sema_down (&s->ring[link->idx]);
+      sema_up (next);
+    }
+  sema_up (&s->done);
+}
+
+void
+test_perf_scale (void) 
+{
+  size_t i;
+
+  for (i = 0; i < POINT_CNT; i++)
+    if (!sleep_storm (points[i]) || !lock_convoy (points[i])
+        || !sema_chain (points[i]))
+      {
+        msg ("%u threads: out of memory, stopping", points[i]);
+        break;
+      }
+}
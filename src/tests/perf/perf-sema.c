@@ -0,0 +1,44 @@
+/* Measures the round-trip latency of two threads waking each
+   other with a pair of semaphores. */
+
+#include "tests/perf/perf.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Number of round trips. */
+#define ROUND_CNT 10000
+
+static struct semaphore ping, pong;
+static thread_func pong_thread;
+
+void
+test_perf_sema (void) 
+{
+  uint64_t start;
+  int i;
+
+  sema_init (&ping, 0);
+  sema_init (&pong, 0);
+  thread_create ("pong", thread_get_priority (), pong_thread, NULL);
+
+  start = rdtsc ();
+  for (i = 0; i < ROUND_CNT; i++)
+    {
+      sema_up (&ping);
+      sema_down (&pong);
+    }
+  perf_report ("semaphore ping-pong round trip", rdtsc () - start,
+               ROUND_CNT);
+}
+
+static void
+pong_thread (void *aux UNUSED) 
+{
+  int i;
+
+  for (i = 0; i < ROUND_CNT; i++)
+    {
+      sema_down (&ping);
+      sema_up (&pong);
+    }
+}
@@ -0,0 +1,40 @@
+/* Measures how regularly timer_sleep() wakes a thread: the
+   cycles between successive wakeups from timer_sleep (1), which
+   should each be one timer tick, and how much they vary. */
+
+#include "tests/perf/perf.h"
+#include "devices/timer.h"
+
+/* Number of sleeps. */
+#define SLEEP_CNT 100
+
+void
+test_perf_sleep (void) 
+{
+  uint64_t min = UINT64_MAX, max = 0, total;
+  uint64_t start, last;
+  int i;
+
+  /* Start at a tick boundary. */
+  timer_sleep (1);
+  start = last = rdtsc ();
+  for (i = 0; i < SLEEP_CNT; i++)
+    {
+      uint64_t now, interval;
+
+      timer_sleep (1);
+      now = rdtsc ();
+      interval = now - last;
+      if (interval < min)
+        min = interval;
+      if (interval > max)
+        max = interval;
+      last = now;
+    }
+  total = last - start;
+
+  perf_report ("timer_sleep (1), average", total, SLEEP_CNT);
+  perf_report ("timer_sleep (1), shortest", min, 1);
+  perf_report ("timer_sleep (1), longest", max, 1);
+  perf_report ("timer_sleep (1), jitter", max - min, 1);
+}
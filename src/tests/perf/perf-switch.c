@@ -0,0 +1,39 @@
+/* Measures the cost of a context switch, as two threads of the
+   same priority take turns with thread_yield(). */
+
+#include "tests/perf/perf.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Number of yields by each thread. */
+#define YIELD_CNT 10000
+
+static thread_func yield_thread;
+
+void
+test_perf_switch (void) 
+{
+  struct semaphore done;
+  uint64_t start;
+  int i;
+
+  sema_init (&done, 0);
+  thread_create ("yielder", thread_get_priority (), yield_thread, &done);
+
+  start = rdtsc ();
+  for (i = 0; i < YIELD_CNT; i++)
+    thread_yield ();
+  perf_report ("thread_yield() to another thread", rdtsc () - start,
+               2 * YIELD_CNT);
+  sema_down (&done);
+}
+
+static void
+yield_thread (void *done) 
+{
+  int i;
+
+  for (i = 0; i < YIELD_CNT; i++)
+    thread_yield ();
+  sema_up (done);
+}
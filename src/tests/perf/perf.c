@@ -0,0 +1,9 @@
+#include "tests/perf/perf.h"
+
+/* Reports that WHAT, done CNT times, took CYCLES CPU cycles in
+   all. */
+void
+perf_report (const char *what, uint64_t cycles, unsigned cnt)
+{
+  msg ("%s: %llu cycles", what, cycles / (cnt != 0 ? cnt : 1));
+}
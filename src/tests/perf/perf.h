@@ -0,0 +1,22 @@
+#ifndef TESTS_PERF_PERF_H
+#define TESTS_PERF_PERF_H
+
+#include <stdint.h>
+#include <tsc.h>
+#include "tests/threads/tests.h"
+
+/* Kernel benchmarks, run like the tests in tests/threads. */
+extern test_func test_perf_switch;
+extern test_func test_perf_lock;
+extern test_func test_perf_sema;
+extern test_func test_perf_sleep;
+extern test_func test_perf_palloc;
+extern test_func test_perf_malloc;
+extern test_func test_perf_block;
+extern test_func test_perf_intr;
+extern test_func test_perf_scale;
+extern test_func test_perf_crc;
+
+void perf_report (const char *what, uint64_t cycles, unsigned cnt);
+
+#endif /* tests/perf/perf.h */
@@ -0,0 +1,76 @@
+/* The main thread acquires a reader/writer lock for reading.
+   Then it creates a higher-priority writer, which blocks
+   waiting for the lock and donates its priority to the main
+   thread, and a still higher-priority reader, which is kept out
+   by the waiting writer even though only readers hold the lock.
+   When the main thread releases the lock, it goes to the reader,
+   which has the higher priority, and then to the writer.
+
+   Then the main thread acquires the lock for writing and creates
+   a higher-priority reader, which donates its priority to the
+   main thread until it gets the lock. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+static thread_func reader_thread_func;
+static thread_func writer_thread_func;
+
+void
+test_priority_donate_rwlock (void) 
+{
+  struct rwlock rwlock;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  rwlock_init (&rwlock);
+  rwlock_acquire_read (&rwlock);
+  thread_create ("writer", PRI_DEFAULT + 2, writer_thread_func, &rwlock);
+  msg ("This thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT + 2, thread_get_priority ());
+  thread_create ("reader", PRI_DEFAULT + 3, reader_thread_func, &rwlock);
+  msg ("This thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT + 2, thread_get_priority ());
+  rwlock_release_read (&rwlock);
+  msg ("reader, writer must already have finished, in that order.");
+  msg ("This thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT, thread_get_priority ());
+
+  rwlock_acquire_write (&rwlock);
+  thread_create ("reader2", PRI_DEFAULT + 1, reader_thread_func, &rwlock);
+  msg ("This thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT + 1, thread_get_priority ());
+  rwlock_release_write (&rwlock);
+  msg ("reader2 must already have finished.");
+  msg ("This thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT, thread_get_priority ());
+}
+
+static void
+reader_thread_func (void *rwlock_) 
+{
+  struct rwlock *rwlock = rwlock_;
+
+  rwlock_acquire_read (rwlock);
+  msg ("%s: got the lock", thread_name ());
+  rwlock_release_read (rwlock);
+  msg ("%s: done", thread_name ());
+}
+
+static void
+writer_thread_func (void *rwlock_) 
+{
+  struct rwlock *rwlock = rwlock_;
+
+  rwlock_acquire_write (rwlock);
+  msg ("writer: got the lock");
+  rwlock_release_write (rwlock);
+  msg ("writer: done");
+}
@@ -0,0 +1,90 @@
+/* Checks sema_down_timeout(), lock_acquire_timeout() and
+   cond_wait_timeout().  Each must give up once its deadline
+   passes, succeed when the resource is available, and a lock
+   waiter that gives up must withdraw its priority donation. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+static thread_func waiter_thread_func;
+static thread_func signaler_thread_func;
+
+/* Shared by the main thread and the signaler. */
+struct cond_data
+  {
+    struct lock lock;
+    struct condition cond;
+  };
+
+void
+test_synch_timeout (void) 
+{
+  struct semaphore sema;
+  struct lock lock;
+  struct cond_data data;
+  int64_t start;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  sema_init (&sema, 0);
+  start = timer_ticks ();
+  msg ("sema_down_timeout: %s",
+       sema_down_timeout (&sema, 10) ? "acquired" : "timed out");
+  msg ("%s", timer_elapsed (start) >= 10
+       ? "waited at least 10 ticks" : "returned too early");
+  sema_up (&sema);
+  msg ("sema_down_timeout with value: %s",
+       sema_down_timeout (&sema, 10) ? "acquired" : "timed out");
+
+  lock_init (&lock);
+  lock_acquire (&lock);
+  thread_create ("waiter", PRI_DEFAULT + 5, waiter_thread_func, &lock);
+  msg ("Main priority with donation: %d", thread_get_priority ());
+  timer_sleep (20);
+  msg ("Main priority after timeout: %d", thread_get_priority ());
+  lock_release (&lock);
+
+  lock_init (&data.lock);
+  cond_init (&data.cond);
+  lock_acquire (&data.lock);
+  msg ("cond_wait_timeout: %s",
+       cond_wait_timeout (&data.cond, &data.lock, 5)
+       ? "signaled" : "timed out");
+  thread_create ("signaler", PRI_DEFAULT - 1, signaler_thread_func, &data);
+  msg ("cond_wait_timeout with signal: %s",
+       cond_wait_timeout (&data.cond, &data.lock, 1000)
+       ? "signaled" : "timed out");
+  lock_release (&data.lock);
+}
+
+static void
+waiter_thread_func (void *lock_) 
+{
+  struct lock *lock = lock_;
+
+  if (lock_acquire_timeout (lock, 10))
+    {
+      msg ("waiter: got the lock");
+      lock_release (lock);
+    }
+  else
+    msg ("waiter: timed out");
+}
+
+static void
+signaler_thread_func (void *data_) 
+{
+  struct cond_data *data = data_;
+
+  lock_acquire (&data->lock);
+  cond_signal (&data->cond, &data->lock);
+  lock_release (&data->lock);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(synch-timeout) begin
+(synch-timeout) sema_down_timeout: timed out
+(synch-timeout) waited at least 10 ticks
+(synch-timeout) sema_down_timeout with value: acquired
+(synch-timeout) Main priority with donation: 36
+(synch-timeout) waiter: timed out
+(synch-timeout) Main priority after timeout: 31
+(synch-timeout) cond_wait_timeout: timed out
+(synch-timeout) cond_wait_timeout with signal: signaled
+(synch-timeout) end
+EOF
+pass;
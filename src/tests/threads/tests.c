@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <string.h>
 #include <stdio.h>
+#include "tests/perf/perf.h"
 
 struct test 
   {
@@ -19,10 +20,12 @@ static const struct test tests[] =
     {"priority-donate-sema", test_priority_donate_sema},
     {"priority-donate-lower", test_priority_donate_lower},
     {"priority-donate-chain", test_priority_donate_chain},
+    {"priority-donate-rwlock", test_priority_donate_rwlock},
     {"priority-fifo", test_priority_fifo},
     {"priority-preempt", test_priority_preempt},
     {"priority-sema", test_priority_sema},
     {"priority-condvar", test_priority_condvar},
+    {"synch-timeout", test_synch_timeout},
     {"mlfqs-load-1", test_mlfqs_load_1},
     {"mlfqs-load-60", test_mlfqs_load_60},
     {"mlfqs-load-avg", test_mlfqs_load_avg},
@@ -32,6 +35,16 @@ static const struct test tests[] =
     {"mlfqs-nice-2", test_mlfqs_nice_2},
     {"mlfqs-nice-10", test_mlfqs_nice_10},
     {"mlfqs-block", test_mlfqs_block},
+    {"perf-switch", test_perf_switch},
+    {"perf-lock", test_perf_lock},
+    {"perf-sema", test_perf_sema},
+    {"perf-sleep", test_perf_sleep},
+    {"perf-palloc", test_perf_palloc},
+    {"perf-malloc", test_perf_malloc},
+    {"perf-block", test_perf_block},
+    {"perf-intr", test_perf_intr},
+    {"perf-scale", test_perf_scale},
+    {"perf-crc", test_perf_crc},
   };
 
 static const char *test_name;
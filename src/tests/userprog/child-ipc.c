@@ -0,0 +1,32 @@
+/* Child process run by ipc-call test.
+   Serves IPC calls, replying to each with every word of its
+   message incremented, until it receives one whose first word
+   is 0.  Exits with a nonzero status if a call fails. */
+
+#include <syscall.h>
+
+int
+main (void) 
+{
+  for (;;)
+    {
+      struct ipc_msg msg;
+      tid_t client = ipc_receive (&msg);
+      bool last;
+      int i;
+
+      if (client == TID_ERROR)
+        return 1;
+      last = msg.words[0] == 0;
+      for (i = 0; i < IPC_MSG_WORDS; i++)
+        msg.words[i]++;
+      if (!ipc_reply (client, &msg))
+        return 2;
+
+      /* The call has been answered, so a second reply fails. */
+      if (ipc_reply (client, &msg))
+        return 3;
+      if (last)
+        return 0;
+    }
+}
@@ -0,0 +1,16 @@
+/* Waits on a futex word that does not hold the expected value,
+   which must return -1 at once rather than sleep, and wakes a
+   word that no thread is waiting on, which must wake none. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  static int word = 1;
+
+  CHECK (futex_wait (&word, 0) == -1, "wait with wrong value");
+  CHECK (futex_wake (&word, 1) == 0, "wake with no waiters");
+}
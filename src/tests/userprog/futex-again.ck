@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(futex-again) begin
+(futex-again) wait with wrong value
+(futex-again) wake with no waiters
+(futex-again) end
+futex-again: exit(0)
+EOF
+pass;
@@ -0,0 +1,13 @@
+/* Passes an invalid pointer to the futex-wait system call.
+   The process must be terminated with -1 exit code. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  futex_wait ((int *) 0xc0100000, 0);
+  fail ("should have called exit(-1)");
+}
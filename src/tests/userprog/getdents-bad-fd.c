@@ -0,0 +1,24 @@
+/* Reads directory entries from a file that is not a directory
+   and from invalid fds, which must either fail silently or
+   terminate the process with exit code -1. */
+
+#include <limits.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  struct dirent ent;
+  int handle;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (getdents (handle, &ent, sizeof ent) == -1,
+         "getdents on \"sample.txt\"");
+  getdents (STDIN_FILENO, &ent, sizeof ent);
+  getdents (0x20101234, &ent, sizeof ent);
+  getdents (-1, &ent, sizeof ent);
+  getdents (INT_MAX, &ent, sizeof ent);
+}
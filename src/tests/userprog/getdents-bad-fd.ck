@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF', <<'EOF']);
+(getdents-bad-fd) begin
+(getdents-bad-fd) open "sample.txt"
+(getdents-bad-fd) getdents on "sample.txt"
+(getdents-bad-fd) end
+getdents-bad-fd: exit(0)
+EOF
+(getdents-bad-fd) begin
+(getdents-bad-fd) open "sample.txt"
+(getdents-bad-fd) getdents on "sample.txt"
+getdents-bad-fd: exit(-1)
+EOF
+pass;
@@ -0,0 +1,17 @@
+/* Passes an invalid pointer to the getdents system call for a
+   directory that has entries to return.  The process must be
+   terminated with -1 exit code. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  int dir;
+
+  CHECK ((dir = open ("/")) > 1, "open \"/\"");
+  getdents (dir, (struct dirent *) 0xc0100000, 4 * sizeof (struct dirent));
+  fail ("should have called exit(-1)");
+}
@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(getdents-bad-ptr) begin
+(getdents-bad-ptr) open "/"
+getdents-bad-ptr: exit(-1)
+EOF
+pass;
@@ -0,0 +1,43 @@
+/* Creates two files and reads the root directory with getdents,
+   a few entries at a time, until it returns 0, checking that
+   each file is listed exactly once. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  struct dirent ents[2];
+  int a_cnt = 0, b_cnt = 0;
+  int dir, n;
+
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK (create ("b", 0), "create \"b\"");
+  CHECK ((dir = open ("/")) > 1, "open \"/\"");
+  msg ("read \"/\"");
+  while ((n = getdents (dir, ents, sizeof ents)) > 0)
+    {
+      int i;
+
+      if (n > 2)
+        fail ("getdents returned %d entries for room for 2", n);
+      for (i = 0; i < n; i++)
+        {
+          if (ents[i].inumber == 0)
+            fail ("\"%s\" has inumber 0", ents[i].name);
+          if (!strcmp (ents[i].name, "a"))
+            a_cnt++;
+          else if (!strcmp (ents[i].name, "b"))
+            b_cnt++;
+        }
+    }
+  if (n < 0)
+    fail ("getdents returned %d", n);
+  if (a_cnt != 1 || b_cnt != 1)
+    fail ("\"a\" listed %d times, \"b\" %d times", a_cnt, b_cnt);
+  CHECK (getdents (dir, ents, sizeof ents) == 0, "read past end of \"/\"");
+  close (dir);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(getdents-normal) begin
+(getdents-normal) create "a"
+(getdents-normal) create "b"
+(getdents-normal) open "/"
+(getdents-normal) read "/"
+(getdents-normal) read past end of "/"
+(getdents-normal) end
+getdents-normal: exit(0)
+EOF
+pass;
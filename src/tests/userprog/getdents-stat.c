@@ -0,0 +1,40 @@
+/* Creates a file of a known size and reads the root directory
+   with getdents_stat, checking that the file's entry gives its
+   length and says that it is not a directory. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  struct dirent_stat ents[3];
+  bool found = false;
+  int dir, n;
+
+  CHECK (create ("a", 123), "create \"a\"");
+  CHECK ((dir = open ("/")) > 1, "open \"/\"");
+  msg ("read \"/\"");
+  while ((n = getdents_stat (dir, ents, sizeof ents)) > 0)
+    {
+      int i;
+
+      for (i = 0; i < n; i++)
+        if (!strcmp (ents[i].name, "a"))
+          {
+            if (found)
+              fail ("\"a\" listed twice");
+            if (ents[i].length != 123 || ents[i].is_dir)
+              fail ("\"a\" has length %d and is_dir %d, "
+                    "expected 123 and 0", ents[i].length, ents[i].is_dir);
+            found = true;
+          }
+    }
+  if (n < 0)
+    fail ("getdents_stat returned %d", n);
+  if (!found)
+    fail ("\"a\" not listed");
+  close (dir);
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(getdents-stat) begin
+(getdents-stat) create "a"
+(getdents-stat) open "/"
+(getdents-stat) read "/"
+(getdents-stat) end
+getdents-stat: exit(0)
+EOF
+pass;
@@ -0,0 +1,14 @@
+/* Passes an invalid pointer for the message to the IPC call
+   system call.  The process must be terminated with -1 exit
+   code. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  ipc_call (PID_ERROR, (struct ipc_msg *) 0xc0100000);
+  fail ("should have called exit(-1)");
+}
@@ -0,0 +1,17 @@
+/* Calls processes that do not exist, which must fail, and
+   replies to a call that this thread is not serving, which must
+   fail too. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  struct ipc_msg m = {{0}};
+
+  CHECK (!ipc_call (PID_ERROR, &m), "call PID_ERROR");
+  CHECK (!ipc_call (0x0c020301, &m), "call missing pid");
+  CHECK (!ipc_reply (0x0c020301, &m), "reply to missing call");
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(ipc-bad) begin
+(ipc-bad) call PID_ERROR
+(ipc-bad) call missing pid
+(ipc-bad) reply to missing call
+(ipc-bad) end
+ipc-bad: exit(0)
+EOF
+pass;
@@ -0,0 +1,34 @@
+/* Runs child-ipc, which serves IPC calls, and calls it until it
+   has set up its port, then checks its replies.  The last call
+   tells it to exit, after which calling it must fail. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  struct ipc_msg m;
+  pid_t pid;
+  int i;
+
+  CHECK ((pid = exec ("child-ipc")) != PID_ERROR, "exec \"child-ipc\"");
+
+  /* A call fails at once until the child first receives. */
+  for (i = 0; i < IPC_MSG_WORDS; i++)
+    m.words[i] = i + 1;
+  msg ("call child-ipc");
+  while (!ipc_call (pid, &m))
+    continue;
+  for (i = 0; i < IPC_MSG_WORDS; i++)
+    if (m.words[i] != (unsigned) i + 2)
+      fail ("reply word %d is %u, expected %d", i, m.words[i], i + 2);
+
+  m.words[0] = 0;
+  if (!ipc_call (pid, &m))
+    fail ("call to make child-ipc exit failed");
+  i = wait (pid);
+  CHECK (i == 0, "wait for child-ipc");
+  CHECK (!ipc_call (pid, &m), "call child-ipc after exit");
+}
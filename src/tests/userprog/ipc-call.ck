@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(ipc-call) begin
+(ipc-call) exec "child-ipc"
+(ipc-call) call child-ipc
+child-ipc: exit(0)
+(ipc-call) wait for child-ipc
+(ipc-call) call child-ipc after exit
+(ipc-call) end
+ipc-call: exit(0)
+EOF
+pass;
@@ -0,0 +1,60 @@
+/* Measures how exec() and wait() scale with the number of child
+   processes.  For 1, 10, 100 and 1000 children in turn, starts
+   them all with exec(), each another copy of this program told
+   by its argument to exit at once, and then waits for each one,
+   so that the parent has that many children outstanding.
+   Reports the cycles per child.  Stops at the first point at
+   which exec() fails, for lack of memory.
+
+   This is a benchmark, not a test, so it is not part of "make
+   check".  Run it with
+   "pintos -p build/tests/userprog/perf-exec-scale -a perf-exec-scale
+    -- -q -f run perf-exec-scale". */
+
+#include <string.h>
+#include <syscall.h>
+#include <tsc.h>
+#include "tests/lib.h"
+
+const char *test_name = "perf-exec-scale";
+
+/* Child counts swept. */
+static const int points[] = {1, 10, 100, 1000};
+#define POINT_CNT (int) (sizeof points / sizeof *points)
+
+static pid_t pids[1000];
+
+int
+main (int argc, char *argv[]) 
+{
+  int i;
+
+  if (argc > 1 && !strcmp (argv[1], "child"))
+    return 0;
+
+  msg ("begin");
+  for (i = 0; i < POINT_CNT; i++)
+    {
+      unsigned long long start = rdtsc ();
+      int n = points[i];
+      int cnt, j;
+
+      for (cnt = 0; cnt < n; cnt++)
+        {
+          pids[cnt] = exec ("perf-exec-scale child");
+          if (pids[cnt] == PID_ERROR)
+            break;
+        }
+      for (j = 0; j < cnt; j++)
+        wait (pids[j]);
+      if (cnt < n)
+        {
+          msg ("%d children: exec failed after %d, stopping", n, cnt);
+          break;
+        }
+      msg ("exec() and wait(), %d children: %llu cycles", n,
+           (rdtsc () - start) / n);
+    }
+  msg ("end");
+  return 0;
+}
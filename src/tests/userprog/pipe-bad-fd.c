@@ -0,0 +1,23 @@
+/* Reads from the write end of a pipe and writes to its read end,
+   which must transfer nothing, and then reads and writes the
+   pipe's descriptors after closing them, which must either fail
+   silently or terminate the process with exit code -1. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  char buf = 'x';
+  int fds[2];
+
+  CHECK (pipe (fds), "pipe");
+  CHECK (read (fds[1], &buf, 1) == 0, "read write end");
+  CHECK (write (fds[0], &buf, 1) == 0, "write read end");
+  close (fds[0]);
+  close (fds[1]);
+  read (fds[0], &buf, 1);
+  write (fds[1], &buf, 1);
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF', <<'EOF']);
+(pipe-bad-fd) begin
+(pipe-bad-fd) pipe
+(pipe-bad-fd) read write end
+(pipe-bad-fd) write read end
+(pipe-bad-fd) end
+pipe-bad-fd: exit(0)
+EOF
+(pipe-bad-fd) begin
+(pipe-bad-fd) pipe
+(pipe-bad-fd) read write end
+(pipe-bad-fd) write read end
+pipe-bad-fd: exit(-1)
+EOF
+pass;
@@ -0,0 +1,21 @@
+/* Closes the read end of a pipe and then writes to its write
+   end, which must return at once without writing anything,
+   rather than wait for room that a reader will never make. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  static char buf[8192];
+  int fds[2];
+
+  CHECK (pipe (fds), "pipe");
+  close (fds[0]);
+  CHECK (write (fds[1], buf, 1) == 0, "write byte to pipe with no reader");
+  CHECK (write (fds[1], buf, sizeof buf) == 0,
+         "write %zu bytes to pipe with no reader", sizeof buf);
+  close (fds[1]);
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(pipe-no-reader) begin
+(pipe-no-reader) pipe
+(pipe-no-reader) write byte to pipe with no reader
+(pipe-no-reader) write 8192 bytes to pipe with no reader
+(pipe-no-reader) end
+pipe-no-reader: exit(0)
+EOF
+pass;
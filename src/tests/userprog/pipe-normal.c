@@ -0,0 +1,27 @@
+/* Writes to a pipe and reads the data back from its other end,
+   then closes the write end, after which reading the pipe must
+   return end of file. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  static const char data[] = "bytes through a pipe";
+  char buf[sizeof data];
+  int fds[2];
+
+  CHECK (pipe (fds), "pipe");
+  CHECK (fds[0] > 1 && fds[1] > 1 && fds[0] != fds[1],
+         "pipe returned two new fds");
+  CHECK (write (fds[1], data, sizeof data) == sizeof data, "write pipe");
+  CHECK (read (fds[0], buf, sizeof buf) == sizeof buf, "read pipe");
+  if (memcmp (buf, data, sizeof data))
+    fail ("read data differs from data written");
+  close (fds[1]);
+  CHECK (read (fds[0], buf, sizeof buf) == 0, "read pipe with no writer");
+  close (fds[0]);
+}
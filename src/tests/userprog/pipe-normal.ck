@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(pipe-normal) begin
+(pipe-normal) pipe
+(pipe-normal) pipe returned two new fds
+(pipe-normal) write pipe
+(pipe-normal) read pipe
+(pipe-normal) read pipe with no writer
+(pipe-normal) end
+pipe-normal: exit(0)
+EOF
+pass;
@@ -0,0 +1,21 @@
+/* Child process for shm-share test.
+   Maps the parent's shared-memory segment at an address of its
+   own choosing, checks what the parent wrote there, and writes a
+   reply. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((char *) 0x10000000)
+
+void
+test_main (void)
+{
+  CHECK (shm_map ("shm-share", 4096, ACTUAL) == ACTUAL,
+         "map \"shm-share\"");
+  if (strcmp (ACTUAL, "from parent"))
+    fail ("segment holds \"%s\", expected \"from parent\"", ACTUAL);
+  strlcpy (ACTUAL, "from child", 4096);
+}
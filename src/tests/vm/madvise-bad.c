@@ -0,0 +1,22 @@
+/* Passes advice that does not exist and ranges that reach into
+   kernel space or wrap around to madvise, which must fail with
+   -1, and advises a range where nothing is mapped, which has no
+   pages to apply to and must succeed. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  static char data[4096];
+
+  CHECK (madvise (data, sizeof data, 99) == -1, "advise unknown advice");
+  CHECK (madvise ((void *) 0xbffff000, 8192, MADV_DONTNEED) == -1,
+         "advise range into kernel space");
+  CHECK (madvise (data, 0xfffff000, MADV_NORMAL) == -1,
+         "advise range that wraps around");
+  CHECK (madvise ((void *) 0x20000000, 8192, MADV_DONTNEED) == 0,
+         "advise unmapped range");
+}
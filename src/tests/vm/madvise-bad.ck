@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(madvise-bad) begin
+(madvise-bad) advise unknown advice
+(madvise-bad) advise range into kernel space
+(madvise-bad) advise range that wraps around
+(madvise-bad) advise unmapped range
+(madvise-bad) end
+EOF
+pass;
@@ -0,0 +1,31 @@
+/* Fills two heap pages, advises that the first is not needed,
+   and checks that it then reads back as zeros while the second
+   keeps its data. */
+
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  uintptr_t start = (uintptr_t) sbrk (0);
+  uintptr_t aligned = ROUND_UP (start, 4096);
+  char *p;
+  size_t i;
+
+  CHECK (sbrk (aligned - start + 2 * 4096) != (void *) -1,
+         "grow heap by two pages");
+  p = (char *) aligned;
+  memset (p, 0x5a, 2 * 4096);
+  CHECK (madvise (p, 4096, MADV_DONTNEED) == 0, "advise DONTNEED");
+  for (i = 0; i < 4096; i++)
+    if (p[i] != 0)
+      fail ("byte %zu of dropped page is %d, not 0", i, p[i]);
+  for (i = 4096; i < 2 * 4096; i++)
+    if (p[i] != 0x5a)
+      fail ("byte %zu of kept page is %d, not 0x5a", i, p[i]);
+}
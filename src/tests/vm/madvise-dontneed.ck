@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(madvise-dontneed) begin
+(madvise-dontneed) grow heap by two pages
+(madvise-dontneed) advise DONTNEED
+(madvise-dontneed) end
+EOF
+pass;
@@ -0,0 +1,28 @@
+/* Gives each kind of advice for a memory-mapped file, none of
+   which may change what the mapping reads, and then reads it. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  char *actual = (char *) 0x10000000;
+  int handle;
+  mapid_t map;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (handle, actual)) != MAP_FAILED, "mmap \"sample.txt\"");
+  CHECK (madvise (actual, 4096, MADV_WILLNEED) == 0, "advise WILLNEED");
+  CHECK (madvise (actual, 4096, MADV_SEQUENTIAL) == 0, "advise SEQUENTIAL");
+  if (memcmp (actual, sample, strlen (sample)))
+    fail ("read of mmap'd file reported bad data");
+  CHECK (madvise (actual, 4096, MADV_DONTNEED) == 0, "advise DONTNEED");
+  CHECK (madvise (actual, 4096, MADV_NORMAL) == 0, "advise NORMAL");
+  if (memcmp (actual, sample, strlen (sample)))
+    fail ("read of mmap'd file reported bad data after DONTNEED");
+  munmap (map);
+}
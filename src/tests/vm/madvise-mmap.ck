@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(madvise-mmap) begin
+(madvise-mmap) open "sample.txt"
+(madvise-mmap) mmap "sample.txt"
+(madvise-mmap) advise WILLNEED
+(madvise-mmap) advise SEQUENTIAL
+(madvise-mmap) advise DONTNEED
+(madvise-mmap) advise NORMAL
+(madvise-mmap) end
+EOF
+pass;
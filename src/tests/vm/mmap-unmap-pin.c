@@ -0,0 +1,48 @@
+/* Unmaps a mapping while another thread of the process is
+   blocked reading from a pipe into it, and verifies that the
+   read completes once data arrives, rather than the kernel
+   writing into a freed frame or failing to unpin it. */
+
+#include <syscall.h>
+#include <thread.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((void *) 0x10000000)
+
+static int fds[2];
+static int read_cnt;
+
+/* Reads from the pipe into the mapping. */
+static void
+reader (void *aux UNUSED)
+{
+  read_cnt = read (fds[0], ACTUAL, 64);
+}
+
+void
+test_main (void)
+{
+  static const char data[64] = "data for a buffer that is gone";
+  struct uthread t;
+  unsigned long long start;
+  int handle;
+  mapid_t map;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"sample.txt\"");
+  CHECK (pipe (fds), "pipe");
+  CHECK (uthread_create (&t, reader, NULL), "start reader");
+
+  /* Give the reader time to pin the mapping and block. */
+  start = clock_ns ();
+  while (clock_ns () - start < 100000000)
+    continue;
+  munmap (map);
+
+  CHECK (write (fds[1], data, sizeof data) == sizeof data, "write to pipe");
+  uthread_join (&t);
+  if (read_cnt != sizeof data)
+    fail ("read returned %d, expected %zu", read_cnt, sizeof data);
+  close (handle);
+}
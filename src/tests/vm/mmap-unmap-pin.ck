@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-unmap-pin) begin
+(mmap-unmap-pin) open "sample.txt"
+(mmap-unmap-pin) mmap "sample.txt"
+(mmap-unmap-pin) pipe
+(mmap-unmap-pin) start reader
+(mmap-unmap-pin) write to pipe
+(mmap-unmap-pin) end
+EOF
+pass;
@@ -0,0 +1,44 @@
+/* Measures the cost of a page fault: the cycles taken by the
+   first write to each page of a zeroed array, each of which
+   faults to bring in a fresh page, against a second write to
+   the same pages, which does not fault.
+
+   This is a benchmark, not a test, so it is not part of "make
+   check".  Run it with
+   "pintos -p build/tests/vm/perf-page-fault -a perf-page-fault
+    -- -q -f run perf-page-fault". */
+
+#include <tsc.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+
+/* Number of pages touched. */
+#define PAGE_CNT 256
+
+static char buf[PAGE_CNT * PAGE_SIZE];
+
+/* Writes to each page of BUF once and returns the cycles it
+   took. */
+static unsigned long long
+touch_pages (void)
+{
+  unsigned long long start = rdtsc ();
+  size_t i;
+
+  for (i = 0; i < PAGE_CNT; i++)
+    buf[i * PAGE_SIZE] = 1;
+  return rdtsc () - start;
+}
+
+void
+test_main (void)
+{
+  unsigned long long faulting = touch_pages ();
+  unsigned long long resident = touch_pages ();
+
+  msg ("first write to a page: %llu cycles", faulting / PAGE_CNT);
+  msg ("later write to a page: %llu cycles", resident / PAGE_CNT);
+  msg ("page fault: %llu cycles", (faulting - resident) / PAGE_CNT);
+}
@@ -0,0 +1,19 @@
+/* Asks sbrk to move the break below the start of the heap, both
+   when the heap is empty and when it is not, which must fail,
+   leaving the break where it was. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  char *start = sbrk (0);
+
+  CHECK (sbrk (-1) == (void *) -1, "shrink empty heap");
+  CHECK (sbrk (4096) == start, "grow heap by a page");
+  CHECK (sbrk (-4097) == (void *) -1, "shrink heap by more than a page");
+  CHECK (sbrk (0) == start + 4096, "check break");
+  CHECK (sbrk (-4096) == start + 4096, "shrink heap by a page");
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(sbrk-bad) begin
+(sbrk-bad) shrink empty heap
+(sbrk-bad) grow heap by a page
+(sbrk-bad) shrink heap by more than a page
+(sbrk-bad) check break
+(sbrk-bad) shrink heap by a page
+(sbrk-bad) end
+EOF
+pass;
@@ -0,0 +1,31 @@
+/* Grows the heap with sbrk by a little over two pages, fills
+   the new bytes, and shrinks it back, checking the break that
+   each call returns. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (2 * 4096 + 10)
+
+void
+test_main (void)
+{
+  char *start = sbrk (0);
+  char *p;
+  size_t i;
+
+  CHECK (start != (void *) -1, "sbrk(0)");
+  CHECK ((p = sbrk (SIZE)) == start, "grow heap by %d bytes", SIZE);
+  CHECK (sbrk (0) == start + SIZE, "check break after growing");
+  for (i = 0; i < SIZE; i++)
+    if (p[i] != 0)
+      fail ("new heap byte %zu is %d, not 0", i, p[i]);
+  memset (p, 0x5a, SIZE);
+  for (i = 0; i < SIZE; i++)
+    if (p[i] != 0x5a)
+      fail ("heap byte %zu is %d, not 0x5a", i, p[i]);
+  CHECK (sbrk (-SIZE) == start + SIZE, "shrink heap by %d bytes", SIZE);
+  CHECK (sbrk (0) == start, "check break after shrinking");
+}
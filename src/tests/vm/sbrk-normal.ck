@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(sbrk-normal) begin
+(sbrk-normal) sbrk(0)
+(sbrk-normal) grow heap by 8202 bytes
+(sbrk-normal) check break after growing
+(sbrk-normal) shrink heap by 8202 bytes
+(sbrk-normal) check break after shrinking
+(sbrk-normal) end
+EOF
+pass;
@@ -0,0 +1,18 @@
+/* Grows the heap by a page, writes to it, shrinks the heap, and
+   then reads the page that was given back.
+   The process must be terminated with -1 exit code. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  char *p = sbrk (4096);
+
+  CHECK (p != (void *) -1, "grow heap by a page");
+  p[0] = 1;
+  CHECK (sbrk (-4096) == p + 4096, "shrink heap by a page");
+  fail ("read %d from memory above the break", p[0]);
+}
@@ -0,0 +1,13 @@
+/* Passes an invalid pointer for the name to the shm_map system
+   call.  The process must be terminated with -1 exit code. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  shm_map ((char *) 0xc0100000, 4096, NULL);
+  fail ("should have called exit(-1)");
+}
@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(shm-bad-ptr) begin
+shm-bad-ptr: exit(-1)
+EOF
+pass;
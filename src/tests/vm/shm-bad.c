@@ -0,0 +1,29 @@
+/* Passes invalid arguments to the shared-memory system calls,
+   which must fail without mapping or unmapping anything: an
+   empty name, a size of 0, a size that does not match the
+   segment's, a misaligned address, and unmapping an address that
+   was never mapped or that is not the start of a mapping. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((char *) 0x10000000)
+
+void
+test_main (void)
+{
+  static char data[4096];
+
+  CHECK (shm_map ("", 4096, NULL) == NULL, "map empty name");
+  CHECK (shm_map ("shm-bad", 0, NULL) == NULL, "map 0 bytes");
+  CHECK (shm_map ("shm-bad", 8192, ACTUAL) == ACTUAL, "map \"shm-bad\"");
+  CHECK (shm_map ("shm-bad", 4096, NULL) == NULL, "map with wrong size");
+  CHECK (shm_map ("shm-bad", 8192, ACTUAL + 0x10000 + 1) == NULL,
+         "map at misaligned address");
+  CHECK (!shm_unmap (ACTUAL + 4096), "unmap middle of segment");
+  CHECK (!shm_unmap (ACTUAL + 0x10000), "unmap unmapped address");
+  CHECK (!shm_unmap (data), "unmap data segment");
+  CHECK (shm_unmap (ACTUAL), "unmap \"shm-bad\"");
+  CHECK (!shm_unmap (ACTUAL), "unmap \"shm-bad\" again");
+}
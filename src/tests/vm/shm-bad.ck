@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(shm-bad) begin
+(shm-bad) map empty name
+(shm-bad) map 0 bytes
+(shm-bad) map "shm-bad"
+(shm-bad) map with wrong size
+(shm-bad) map at misaligned address
+(shm-bad) unmap middle of segment
+(shm-bad) unmap unmapped address
+(shm-bad) unmap data segment
+(shm-bad) unmap "shm-bad"
+(shm-bad) unmap "shm-bad" again
+(shm-bad) end
+shm-bad: exit(0)
+EOF
+pass;
@@ -0,0 +1,22 @@
+/* Maps a shared-memory segment, writes to it, and runs a child
+   that maps the same segment, checks what the parent wrote, and
+   writes a reply, which the parent must then see. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  char *seg;
+
+  CHECK ((seg = shm_map ("shm-share", 4096, NULL)) != NULL,
+         "map \"shm-share\"");
+  strlcpy (seg, "from parent", 4096);
+  CHECK (wait (exec ("child-shm")) == 0, "wait for child");
+  if (strcmp (seg, "from child"))
+    fail ("segment holds \"%s\", expected \"from child\"", seg);
+  CHECK (shm_unmap (seg), "unmap \"shm-share\"");
+}
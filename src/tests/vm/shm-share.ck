@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(shm-share) begin
+(shm-share) map "shm-share"
+(shm-share) wait for child
+(child-shm) begin
+(child-shm) map "shm-share"
+(child-shm) end
+child-shm: exit(0)
+(shm-share) unmap "shm-share"
+(shm-share) end
+shm-share: exit(0)
+EOF
+pass;
@@ -0,0 +1,42 @@
+/* Starts several threads that each add to a shared counter many
+   times while holding a mutex, joins them, and checks that no
+   addition was lost. */
+
+#include <syscall.h>
+#include <thread.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define THREAD_CNT 4
+#define ADD_CNT 10000
+
+static struct mutex mutex = MUTEX_INITIALIZER;
+static volatile int counter;
+
+/* Adds to COUNTER while holding MUTEX. */
+static void
+adder (void *aux UNUSED) 
+{
+  int i;
+
+  for (i = 0; i < ADD_CNT; i++)
+    {
+      mutex_lock (&mutex);
+      counter++;
+      mutex_unlock (&mutex);
+    }
+}
+
+void
+test_main (void) 
+{
+  struct uthread threads[THREAD_CNT];
+  int i;
+
+  for (i = 0; i < THREAD_CNT; i++)
+    CHECK (uthread_create (&threads[i], adder, NULL), "start thread %d", i);
+  for (i = 0; i < THREAD_CNT; i++)
+    uthread_join (&threads[i]);
+  if (counter != THREAD_CNT * ADD_CNT)
+    fail ("counter is %d, expected %d", counter, THREAD_CNT * ADD_CNT);
+}
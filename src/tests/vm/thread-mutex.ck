@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(thread-mutex) begin
+(thread-mutex) start thread 0
+(thread-mutex) start thread 1
+(thread-mutex) start thread 2
+(thread-mutex) start thread 3
+(thread-mutex) end
+thread-mutex: exit(0)
+EOF
+pass;
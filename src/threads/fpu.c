@@ -0,0 +1,368 @@
+#include "threads/fpu.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/stats.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Lazy FPU context switching.
+
+   switch_threads() saves only the integer registers, so the x87
+   and SSE registers are instead handed from thread to thread on
+   demand.  The CPU holds the registers of at most one thread,
+   fpu_owner.  Whenever any other thread runs, fpu_activate()
+   sets CR0.TS, so that the thread's first FPU or SSE instruction
+   raises #NM, Device Not Available.  The #NM handler clears TS,
+   saves the registers into the owner's save area, loads the
+   faulting thread's, and makes it the owner.  A switch between
+   threads that never touch the FPU, which is the common case
+   since the kernel is compiled with -msoft-float, costs only a
+   write to CR0 when TS needs to change.
+
+   Each thread that uses the FPU gets a save area from malloc()
+   the first time it does, so none of it is taken from the
+   thread's page.  FXSAVE and FXRSTOR, which also cover the SSE
+   registers, are used if the CPU has them, otherwise FNSAVE and
+   FRSTOR.
+
+   The kernel itself may use XMM0 through XMM3 between
+   fpu_kernel_begin() and fpu_kernel_end(), which save and
+   restore them around the section, whichever thread's state they
+   hold, with interrupts off so that the section is never
+   switched away from or entered again by an interrupt handler.
+   clear_page() and copy_page() use this, when the CPU has SSE2,
+   to write whole pages with MOVNTDQ.  Its non-temporal stores go
+   around the cache, so zeroing or copying a page does not evict
+   the working set of whatever runs next, most of all when the
+   page is not going to be read again soon, as with a page zeroed
+   ahead of need or a copy-on-write copy that its process will
+   only partly touch. */
+
+/* Size and alignment of an FXSAVE area.  FNSAVE needs less. */
+#define FPU_AREA_SIZE 512
+#define FPU_AREA_ALIGN 16
+
+/* CR0 and CR4 bits. */
+#define CR0_MP 0x00000002       /* Monitor coprocessor. */
+#define CR0_EM 0x00000004       /* Emulation. */
+#define CR0_TS 0x00000008       /* Task switched. */
+#define CR0_NE 0x00000020       /* Native FPU error reporting. */
+#define CR4_OSFXSR 0x00000200   /* FXSAVE, FXRSTOR and SSE. */
+#define CR4_OSXMMEXCPT 0x00000400 /* #XF for SSE exceptions. */
+
+/* CPUID feature bits, in %edx of leaf 1. */
+#define CPUID_FXSR 0x01000000   /* FXSAVE and FXRSTOR. */
+#define CPUID_SSE 0x02000000    /* SSE. */
+#define CPUID_SSE2 0x04000000   /* SSE2. */
+
+/* Does the CPU have FXSAVE and FXRSTOR? */
+static bool have_fxsr;
+
+/* Can clear_page() and copy_page() use non-temporal SSE2
+   stores? */
+bool fpu_nt_pages;
+
+/* XMM0 through XMM3, as fpu_kernel_begin() found them. */
+static uint8_t kernel_xmm[4][16] __attribute__ ((aligned (16)));
+
+/* Thread whose state the FPU registers hold, or null. */
+static struct thread *fpu_owner;
+
+/* Is CR0.TS clear? */
+static bool ts_clear;
+
+/* State that each thread's FPU starts out in. */
+static uint8_t initial_area[FPU_AREA_SIZE]
+  __attribute__ ((aligned (FPU_AREA_ALIGN)));
+
+/* Number of times a thread's state was loaded. */
+static struct stats_counter restore_cnt;
+
+static intr_handler_func handle_nm;
+
+static inline uint32_t
+read_cr0 (void) 
+{
+  uint32_t cr0;
+  asm volatile ("movl %%cr0, %0" : "=r" (cr0));
+  return cr0;
+}
+
+static inline void
+write_cr0 (uint32_t cr0) 
+{
+  asm volatile ("movl %0, %%cr0" : : "r" (cr0) : "memory");
+}
+
+/* Sets or clears CR0.TS. */
+static void
+set_ts (bool set) 
+{
+  if (set)
+    write_cr0 (read_cr0 () | CR0_TS);
+  else
+    asm volatile ("clts" : : : "memory");
+  ts_clear = !set;
+}
+
+/* Saves the FPU registers into AREA.  FNSAVE also reinitializes
+   the FPU, which is harmless here. */
+static void
+save (void *area) 
+{
+  if (have_fxsr)
+    asm volatile ("fxsave %0" : "=m" (*(uint8_t (*)[FPU_AREA_SIZE]) area));
+  else
+    asm volatile ("fnsave %0" : "=m" (*(uint8_t (*)[FPU_AREA_SIZE]) area));
+}
+
+/* Loads the FPU registers from AREA. */
+static void
+restore (const void *area) 
+{
+  if (have_fxsr)
+    asm volatile ("fxrstor %0"
+                  : : "m" (*(const uint8_t (*)[FPU_AREA_SIZE]) area));
+  else
+    asm volatile ("frstor %0"
+                  : : "m" (*(const uint8_t (*)[FPU_AREA_SIZE]) area));
+}
+
+/* Returns T's save area, which must have been allocated. */
+static void *
+area_of (const struct thread *t) 
+{
+  return (void *) ROUND_UP ((uintptr_t) t->fpu, FPU_AREA_ALIGN);
+}
+
+/* Allocates a save area for the running thread T, if it has none,
+   holding a copy of SRC.  Returns false if memory is short. */
+static bool
+alloc_area (struct thread *t, const void *src) 
+{
+  void *block;
+
+  if (t->fpu != NULL)
+    return true;
+  block = malloc (FPU_AREA_SIZE + FPU_AREA_ALIGN - 1);
+  if (block == NULL)
+    return false;
+  t->fpu = block;
+  memcpy (area_of (t), src, FPU_AREA_SIZE);
+  return true;
+}
+
+/* Turns on the FPU, and SSE if the CPU has it, records its
+   initial state, and starts switching it lazily. */
+void
+fpu_init (void) 
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+  bool have_sse;
+
+  asm ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  have_fxsr = (edx & CPUID_FXSR) != 0;
+  have_sse = have_fxsr && (edx & CPUID_SSE) != 0;
+  if (have_fxsr)
+    {
+      uint32_t cr4;
+
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      cr4 |= CR4_OSFXSR;
+      if (have_sse)
+        cr4 |= CR4_OSXMMEXCPT;
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4));
+    }
+
+  /* start.S set CR0.EM to make every FPU instruction trap. */
+  write_cr0 ((read_cr0 () & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+  asm volatile ("fninit");
+  if (have_sse)
+    {
+      uint32_t mxcsr = 0x1f80;    /* All exceptions masked. */
+      asm volatile ("ldmxcsr %0" : : "m" (mxcsr));
+    }
+  save (initial_area);
+  set_ts (true);
+  fpu_nt_pages = have_sse && (edx & CPUID_SSE2) != 0;
+
+  intr_register_int (7, 0, INTR_ON, handle_nm,
+                     "#NM Device Not Available Exception");
+  stats_register (&restore_cnt, "fpu", "restores", STATS_COUNTER);
+  printf ("FPU: %s, switched lazily.\n",
+          fpu_nt_pages ? "x87 and SSE2" : have_sse ? "x87 and SSE" : "x87");
+}
+
+/* Called when thread T is switched to, with interrupts off.
+   Lets T use the FPU directly only if its registers are loaded. */
+void
+fpu_activate (struct thread *t) 
+{
+  bool owner = t == fpu_owner;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  if (owner != ts_clear)
+    set_ts (!owner);
+}
+
+/* Gives the new thread CHILD a copy of the FPU state of PARENT,
+   for fork(), if PARENT has used the FPU.  Must be called by
+   CHILD while PARENT cannot run.  Returns false if memory is
+   short. */
+bool
+fpu_clone (struct thread *child, struct thread *parent) 
+{
+  enum intr_level old_level;
+
+  ASSERT (child == thread_current ());
+  if (parent->fpu == NULL)
+    return true;
+  if (!alloc_area (child, initial_area))
+    return false;
+
+  old_level = intr_disable ();
+  if (fpu_owner == parent)
+    {
+      /* The parent's state is only in the registers. */
+      set_ts (false);
+      save (area_of (child));
+      if (!have_fxsr)
+        restore (area_of (child));
+      set_ts (true);
+    }
+  else
+    memcpy (area_of (child), area_of (parent), FPU_AREA_SIZE);
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Releases the running thread's FPU state, as it exits. */
+void
+fpu_exit (void) 
+{
+  struct thread *t = thread_current ();
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (fpu_owner == t)
+    fpu_owner = NULL;
+  intr_set_level (old_level);
+
+  free (t->fpu);
+  t->fpu = NULL;
+}
+
+/* Begins a section of kernel code that uses XMM0 through XMM3,
+   which the CPU must have SSE2 for.  Turns off interrupts, lets
+   the running thread use the registers whether or not they hold
+   its own state, and saves them.  Returns the previous interrupt
+   level, to pass to fpu_kernel_end(). */
+enum intr_level
+fpu_kernel_begin (void) 
+{
+  enum intr_level old_level = intr_disable ();
+
+  ASSERT (fpu_nt_pages);
+  if (!ts_clear)
+    asm volatile ("clts" : : : "memory");
+  asm volatile ("movdqa %%xmm0, 0(%0)\n\t"
+                "movdqa %%xmm1, 16(%0)\n\t"
+                "movdqa %%xmm2, 32(%0)\n\t"
+                "movdqa %%xmm3, 48(%0)"
+                : : "r" (kernel_xmm) : "memory");
+  return old_level;
+}
+
+/* Ends a section begun with fpu_kernel_begin(), which returned
+   OLD_LEVEL, restoring XMM0 through XMM3, CR0.TS and the
+   interrupt level as they were. */
+void
+fpu_kernel_end (enum intr_level old_level) 
+{
+  asm volatile ("movdqa 0(%0), %%xmm0\n\t"
+                "movdqa 16(%0), %%xmm1\n\t"
+                "movdqa 32(%0), %%xmm2\n\t"
+                "movdqa 48(%0), %%xmm3"
+                : : "r" (kernel_xmm) : "memory");
+  if (!ts_clear)
+    write_cr0 (read_cr0 () | CR0_TS);
+  intr_set_level (old_level);
+}
+
+/* Sets the page at PAGE to zeros with non-temporal stores, for
+   clear_page(). */
+void
+fpu_clear_page (void *page) 
+{
+  uint8_t *p = page;
+  enum intr_level old_level = fpu_kernel_begin ();
+
+  asm volatile ("pxor %%xmm0, %%xmm0\n"
+                "1:\tmovntdq %%xmm0, 0(%0)\n\t"
+                "movntdq %%xmm0, 16(%0)\n\t"
+                "movntdq %%xmm0, 32(%0)\n\t"
+                "movntdq %%xmm0, 48(%0)\n\t"
+                "addl $64, %0\n\t"
+                "cmpl %1, %0\n\t"
+                "jne 1b\n\t"
+                "sfence"
+                : "+r" (p) : "r" (p + PGSIZE) : "memory");
+  fpu_kernel_end (old_level);
+}
+
+/* Copies the page at SRC to the page at DST with non-temporal
+   stores, for copy_page(). */
+void
+fpu_copy_page (void *dst, const void *src) 
+{
+  uint8_t *d = dst;
+  const uint8_t *s = src;
+  enum intr_level old_level = fpu_kernel_begin ();
+
+  asm volatile ("1:\tmovdqa 0(%1), %%xmm0\n\t"
+                "movdqa 16(%1), %%xmm1\n\t"
+                "movdqa 32(%1), %%xmm2\n\t"
+                "movdqa 48(%1), %%xmm3\n\t"
+                "movntdq %%xmm0, 0(%0)\n\t"
+                "movntdq %%xmm1, 16(%0)\n\t"
+                "movntdq %%xmm2, 32(%0)\n\t"
+                "movntdq %%xmm3, 48(%0)\n\t"
+                "addl $64, %0\n\t"
+                "addl $64, %1\n\t"
+                "cmpl %2, %0\n\t"
+                "jne 1b\n\t"
+                "sfence"
+                : "+r" (d), "+r" (s) : "r" (d + PGSIZE) : "memory");
+  fpu_kernel_end (old_level);
+}
+
+/* #NM handler: gives the FPU to the running thread. */
+static void
+handle_nm (struct intr_frame *f UNUSED) 
+{
+  struct thread *t = thread_current ();
+  enum intr_level old_level;
+
+  if (!alloc_area (t, initial_area))
+    {
+      printf ("%s: out of memory for FPU state\n", t->name);
+      thread_exit ();
+    }
+
+  old_level = intr_disable ();
+  set_ts (false);
+  if (fpu_owner != t)
+    {
+      if (fpu_owner != NULL)
+        save (area_of (fpu_owner));
+      restore (area_of (t));
+      fpu_owner = t;
+      stats_inc (&restore_cnt);
+    }
+  intr_set_level (old_level);
+}
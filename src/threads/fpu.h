@@ -0,0 +1,25 @@
+#ifndef THREADS_FPU_H
+#define THREADS_FPU_H
+
+#include <stdbool.h>
+#include "threads/interrupt.h"
+
+struct thread;
+
+/* Lazily switched FPU and SSE state.  See fpu.c for details. */
+
+void fpu_init (void);
+void fpu_activate (struct thread *);
+bool fpu_clone (struct thread *child, struct thread *parent);
+void fpu_exit (void);
+
+/* Can clear_page() and copy_page() use non-temporal SSE2
+   stores? */
+extern bool fpu_nt_pages;
+
+enum intr_level fpu_kernel_begin (void);
+void fpu_kernel_end (enum intr_level);
+void fpu_clear_page (void *page);
+void fpu_copy_page (void *dst, const void *src);
+
+#endif /* threads/fpu.h */
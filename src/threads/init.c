@@ -1,5 +1,6 @@
 #include "threads/init.h"
 #include <console.h>
+#include <crc32.h>
 #include <debug.h>
 #include <inttypes.h>
 #include <limits.h>
@@ -15,16 +16,25 @@
 #include "devices/timer.h"
 #include "devices/vga.h"
 #include "devices/rtc.h"
+#include "threads/fpu.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
+#include "threads/mp.h"
 #include "threads/palloc.h"
+#include "threads/perf.h"
+#include "threads/profile.h"
 #include "threads/pte.h"
+#include "threads/rcu.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
+#include "threads/work.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
+#include "userprog/futex.h"
+#include "userprog/ipc.h"
 #include "userprog/gdt.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
@@ -34,9 +44,31 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/overlay.h"
+#include "devices/ramdisk.h"
+#include "devices/virtio-blk.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/hibernate.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/share.h"
+#include "vm/shm.h"
+#include "vm/swap.h"
+#include "vm/zswap.h"
+#endif
+
+/* CPUID feature bit (function 1, EDX) and CR4 bit for 4 MB
+   pages. */
+#define CPUID_PSE (1u << 3)
+#define CR4_PSE 0x00000010
+
+/* Likewise for global pages. */
+#define CPUID_PGE (1u << 13)
+#define CR4_PGE 0x00000080
 
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
@@ -54,10 +86,17 @@ static const char *swap_bdev_name;
 #endif
 #endif /* FILESYS */
 
+#ifdef LOCK_STATS
+/* -lockreset: Reset lock statistics before running actions? */
+static bool lock_reset;
+#endif
+
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
 static void bss_init (void);
+static uint64_t ram_init (void);
+static uint64_t report_stage (const char *name, uint64_t start) UNUSED;
 static void paging_init (void);
 
 static char **read_command_line (void);
@@ -77,9 +116,12 @@ int
 main (void)
 {
   char **argv;
+  uint64_t stage UNUSED;
+  uint64_t high_ram;
 
-  /* Clear BSS. */  
+  /* Clear BSS and find out how much RAM there is. */  
   bss_init ();
+  high_ram = ram_init ();
 
   /* Break command line into arguments and parse options. */
   argv = read_command_line ();
@@ -93,11 +135,23 @@ main (void)
   /* Greet user. */
   printf ("Pintos booting with %'"PRIu32" kB RAM...\n",
           init_ram_pages * PGSIZE / 1024);
+  if (high_ram > 0)
+    printf ("%'"PRIu64" kB RAM beyond kernel virtual memory left unused.\n",
+            high_ram / 1024);
 
-  /* Initialize memory system. */
+  /* Initialize memory system.  Paging comes first, so that all
+     of RAM is mapped when the page allocator sets it up. */
+  paging_init ();
   palloc_init (user_page_limit);
   malloc_init ();
-  paging_init ();
+  trace_init ();
+  mp_init ();
+#ifdef VM
+  frame_init ();
+  page_init ();
+  share_init ();
+  shm_init ();
+#endif
 
   /* Segmentation. */
 #ifdef USERPROG
@@ -107,29 +161,54 @@ main (void)
 
   /* Initialize interrupt handlers. */
   intr_init ();
+  fpu_init ();
+  crc32c_init ();
   timer_init ();
+  profile_init ();
+  perf_init ();
   kbd_init ();
   input_init ();
 #ifdef USERPROG
   exception_init ();
+  process_init ();
+  futex_init ();
+  ipc_init ();
   syscall_init ();
 #endif
 
   /* Start thread scheduler and enable interrupts. */
   thread_start ();
+  console_start ();
+  rcu_init ();
+  work_start ();
   serial_init_queue ();
   timer_calibrate ();
 
 #ifdef FILESYS
   /* Initialize file system. */
+  stage = timer_ns ();
+  ramdisk_init ();
   ide_init ();
+  virtio_blk_init ();
+  stage = report_stage ("ide", stage);
   locate_block_devices ();
+  overlay_init ();
   filesys_init (format_filesys);
+  hibernate_resume ();
+  stage = report_stage ("filesys", stage);
+#endif
+#ifdef VM
+  swap_init ();
+  report_stage ("swap", stage);
 #endif
 
-  printf ("Boot complete.\n");
+  printf ("Boot complete in %"PRIu64" ms.\n", timer_ns () / 1000000);
   
   /* Run actions specified on kernel command line. */
+#ifdef LOCK_STATS
+  if (lock_reset)
+    lock_reset_stats ();
+#endif
   run_actions (argv);
 
   /* Finish up. */
@@ -137,6 +216,17 @@ main (void)
   thread_exit ();
 }
 
+/* Prints how long the boot stage NAME took, given the value of
+   timer_ns() when it began, and returns the current value. */
+static uint64_t
+report_stage (const char *name, uint64_t start)
+{
+  uint64_t now = timer_ns ();
+
+  printf ("Boot stage %s: %"PRIu64" ms.\n", name, (now - start) / 1000000);
+  return now;
+}
+
 /* Clear the "BSS", a segment that should be initialized to
    zeros.  It isn't actually stored on disk or zeroed by the
    kernel loader, so we have to zero it ourselves.
@@ -150,18 +240,80 @@ bss_init (void)
   memset (&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* If the loader got a memory map from the BIOS, sets
+   init_ram_pages from it, to the end of the last range of usable
+   RAM, but no more than LOADER_RAM_MAX.  Holes below that are
+   left to palloc_init().  Returns the number of bytes of usable
+   RAM above LOADER_RAM_MAX, which the kernel has no virtual
+   addresses for and does not use. */
+static uint64_t
+ram_init (void) 
+{
+  uint64_t end = 0;
+  uint64_t high = 0;
+  size_t i;
+
+  for (i = 0; i < init_mem_cnt; i++) 
+    {
+      const struct mem_range *r = &init_mem_map[i];
+      uint64_t r_end = r->base + r->length;
+
+      if (r->type != MEM_RAM || r->length == 0)
+        continue;
+      if (r_end > LOADER_RAM_MAX) 
+        {
+          high += r_end - (r->base > LOADER_RAM_MAX
+                           ? r->base : LOADER_RAM_MAX);
+          r_end = LOADER_RAM_MAX;
+        }
+      if (r->base < r_end && r_end > end)
+        end = r_end;
+    }
+
+  if (end > 0)
+    init_ram_pages = end / PGSIZE;
+  return high;
+}
+
+/* Returns the feature flags that CPUID function 1 reports in
+   EDX.  See [IA32-v2a] "CPUID--CPU Identification". */
+uint32_t
+cpu_features (void) 
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+
+  asm ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  return edx;
+}
+
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.  Runs before the page allocator is set
+   up, so it takes its pages from palloc_get_early().
+
+   If the CPU supports it, each 4 MB of physical memory is mapped
+   by a single large page, which takes one TLB entry instead of
+   1024 and needs no page table.  Only the 4 MB that hold the
+   kernel's code, which must stay read-only, and the part of the
+   last 4 MB that is RAM, are mapped with page tables.
+
+   If the CPU supports global pages, the kernel mapping is also
+   marked global, so that the TLB entries for it, which are the
+   same in every page directory, survive the CR3 reload when
+   pagedir_activate() switches processes. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
   size_t page;
+  uint32_t features = cpu_features ();
+  bool pse = (features & CPUID_PSE) != 0;
+  uint32_t global = (features & CPUID_PGE) != 0 ? PTE_G : 0;
+  uint32_t cr4;
   extern char _start, _end_kernel_text;
 
-  pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+  pd = init_page_dir = palloc_get_early ();
   pt = NULL;
   for (page = 0; page < init_ram_pages; page++)
     {
@@ -171,21 +323,48 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      if (pse && paddr % PTSPAN == 0
+          && page + PTSPAN / PGSIZE <= init_ram_pages
+          && !(&_start < vaddr + PTSPAN && vaddr < &_end_kernel_text))
+        {
+          pd[pde_idx] = pde_create_large (vaddr, true) | global;
+          page += PTSPAN / PGSIZE - 1;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
-          pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+          pt = palloc_get_early ();
           pd[pde_idx] = pde_create (pt);
         }
 
-      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
+      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text) | global;
     }
 
+  /* Let the CPU use the large pages.  See [IA32-v3a] 2.5
+     "Control Registers". */
+  asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+  if (pse)
+    {
+      cr4 |= CR4_PSE;
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4));
+    }
+#ifdef VM
+  else
+    page_large_pages = false;
+#endif
+
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
      new page tables immediately.  See [IA32-v2a] "MOV--Move
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base Address
      of the Page Directory". */
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
+
+  /* Honor the global bits only now that no stale global entries
+     from the loader's page tables can be in the TLB. */
+  if (global)
+    asm volatile ("movl %0, %%cr4" : : "r" (cr4 | CR4_PGE));
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -247,6 +426,26 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-ide-timeout"))
+        ide_timeout_ms = atoi (value);
+      else if (!strcmp (name, "-ide-large"))
+        ide_large_disks = true;
+      else if (!strcmp (name, "-overlay"))
+        overlay_filesys = true;
+      else if (!strcmp (name, "-crash"))
+        filesys_crash = true;
+      else if (!strcmp (name, "-ramdisk"))
+        {
+          if (!ramdisk_select (value))
+            PANIC ("bad RAM disk in `%s' (use -h for help)",
+                   value != NULL ? value : "");
+        }
+      else if (!strcmp (name, "-cache"))
+        {
+          if (!cache_select_policy (value))
+            PANIC ("unknown cache policy `%s' (use -h for help)",
+                   value != NULL ? value : "");
+        }
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -255,10 +454,94 @@ parse_options (char **argv)
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
-        thread_mlfqs = true;
+        {
+          thread_mlfqs = true;
+          thread_fair = false;
+        }
+      else if (!strcmp (name, "-fair"))
+        {
+          thread_fair = true;
+          thread_mlfqs = false;
+        }
+      else if (!strcmp (name, "-tickless"))
+        timer_tickless = true;
+      else if (!strcmp (name, "-timer-slack"))
+        timer_default_slack = atoi (value);
+      else if (!strcmp (name, "-lpt"))
+        timer_lpt = atoi (value);
+      else if (!strcmp (name, "-hz"))
+        {
+          if (!timer_select_freq (value))
+            PANIC ("timer frequency `%s' out of range %d...%d "
+                   "(use -h for help)", value != NULL ? value : "",
+                   TIMER_FREQ_MIN, TIMER_FREQ_MAX);
+        }
+      else if (!strcmp (name, "-slice"))
+        {
+          if (value == NULL || atoi (value) <= 0)
+            PANIC ("bad time slice `%s' (use -h for help)",
+                   value != NULL ? value : "");
+          thread_time_slice = atoi (value);
+        }
+      else if (!strcmp (name, "-buddy"))
+        palloc_buddy = true;
+      else if (!strcmp (name, "-prezero"))
+        palloc_prezero = true;
+      else if (!strcmp (name, "-malloc-keep"))
+        malloc_keep_arenas = atoi (value);
+      else if (!strcmp (name, "-profile"))
+        {
+          profile_enabled = true;
+          if (value != NULL)
+            profile_depth = atoi (value);
+        }
+      else if (!strcmp (name, "-profile-hz"))
+        profile_hz = atoi (value);
+      else if (!strcmp (name, "-perf"))
+        {
+          perf_enabled = true;
+          if (value != NULL && !strcmp (value, "exit"))
+            perf_print_exit = true;
+          else if (value != NULL)
+            PANIC ("unknown -perf mode `%s' (use -h for help)", value);
+        }
+      else if (!strcmp (name, "-async-console"))
+        console_async = true;
+      else if (!strcmp (name, "-canon"))
+        input_canonical = true;
+      else if (!strcmp (name, "-trace"))
+        {
+          if (!trace_select (value))
+            PANIC ("unknown trace category in `%s' (use -h for help)",
+                   value != NULL ? value : "");
+        }
+#ifdef LOCK_STATS
+      else if (!strcmp (name, "-lockreset"))
+        lock_reset = true;
+#endif
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+      else if (!strcmp (name, "-memstats"))
+        process_print_mem_stats = true;
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-stack"))
+        page_stack_limit = (size_t) atoi (value) * 1024;
+      else if (!strcmp (name, "-large-pages"))
+        page_large_pages = true;
+      else if (!strcmp (name, "-pageout"))
+        {
+          if (!frame_select_watermarks (value))
+            PANIC ("bad page-out watermarks `%s' (use -h for help)",
+                   value != NULL ? value : "");
+        }
+      else if (!strcmp (name, "-ksm"))
+        frame_merge_rate = value != NULL ? atoi (value) : 100;
+#ifdef FILESYS
+      else if (!strcmp (name, "-zswap"))
+        zswap_page_cnt = atoi (value);
+#endif
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -292,6 +575,17 @@ run_task (char **argv)
   printf ("Execution of '%s' complete.\n", task);
 }
 
+#ifdef FILESYS
+/* Saves a warm-start snapshot of the buffer cache and powers
+   off, skipping any actions that follow. */
+static void
+run_hibernate (char **argv UNUSED)
+{
+  if (hibernate_save ())
+    shutdown_power_off ();
+}
+#endif
+
 /* Executes all of the actions specified in ARGV[]
    up to the null pointer sentinel. */
 static void
@@ -315,6 +609,7 @@ run_actions (char **argv)
       {"rm", 2, fsutil_rm},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
+      {"hibernate", 1, run_hibernate},
 #endif
       {NULL, 0, NULL},
     };
@@ -364,6 +659,9 @@ usage (void)
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  extract            Untar from scratch device into file system.\n"
           "  append FILE        Append FILE to tar file on scratch device.\n"
+          "  hibernate          Save the list of cached sectors to the swap\n"
+          "                     device, to be read back into the cache on\n"
+          "                     each later boot, and power off.\n"
 #endif
           "\nOptions:\n"
           "  -h                 Print this help message and power off.\n"
@@ -373,14 +671,60 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -ide-timeout=MS    Wait up to MS ms for a busy IDE disk.\n"
+          "  -ide-large         Use IDE disks of 1 GB or more.\n"
+          "  -overlay           Keep file system writes in memory, leaving\n"
+          "                     the device unchanged.\n"
+          "  -crash             At power off, commit the journal but write\n"
+          "                     nothing home, so the next boot replays it.\n"
+          "  -ramdisk=ROLE:KB[,ROLE:KB]  Use a KB kB RAM disk for ROLE:\n"
+          "                     filesys, scratch or swap.\n"
+          "  -cache=POLICY      Replace cached sectors by POLICY: clock\n"
+          "                     (default) or 2q.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -fair              Use fair-share scheduler, weighted by nice.\n"
+          "  -tickless          Stop the timer tick while the CPU is idle.\n"
+          "  -timer-slack=TICKS Let sleeping threads wake up to TICKS ticks\n"
+          "                     late, to wake them together.\n"
+          "  -lpt=N             Skip delay loop calibration, using N.\n"
+          "  -hz=HZ             Interrupt HZ times a second (default 100).\n"
+          "  -slice=N           Give each thread N timer ticks at a time.\n"
+          "  -buddy             Use the buddy page allocator.\n"
+          "  -prezero           Zero free user pages while idle.\n"
+          "  -malloc-keep=N     Keep N empty arenas per malloc() size\n"
+          "                     class (default 1).\n"
+          "  -profile[=DEPTH]   Sample running code, with DEPTH callers.\n"
+          "  -profile-hz=HZ     Take about HZ samples a second.\n"
+          "  -perf[=exit]       Count hardware events for each thread,\n"
+          "                     and print the counts as threads exit.\n"
+          "  -async-console     Write console output from a low-priority\n"
+          "                     thread instead of in printf().\n"
+          "  -canon             Read the console a line at a time, with\n"
+          "                     echo and editing.\n"
+          "  -trace=CAT[,CAT]   Trace events in categories CAT: sched,\n"
+          "                     synch, vm, io, or all.\n"
+#ifdef LOCK_STATS
+          "  -lockreset         Reset lock statistics after booting.\n"
+#endif
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+          "  -memstats          Print memory statistics as processes exit.\n"
+#endif
+#ifdef VM
+          "  -stack=KB          Limit user stacks to KB kB (default 8192).\n"
+          "  -large-pages       Back big user heaps with 4 MB pages.\n"
+          "  -pageout=LOW,HIGH  Page out in the background from LOW free\n"
+          "                     user pages up to HIGH, or 0 for never.\n"
+          "  -ksm[=PAGES]       Merge identical user pages, scanning PAGES\n"
+          "                     pages (default 100) every 100 ms.\n"
+#ifdef FILESYS
+          "  -zswap=COUNT       Compress swapped pages into COUNT pages.\n"
+#endif
 #endif
           );
   shutdown_power_off ();
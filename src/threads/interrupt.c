@@ -6,9 +6,14 @@
 #include "threads/flags.h"
 #include "threads/intr-stubs.h"
 #include "threads/io.h"
+#include "threads/rcu.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "devices/timer.h"
+#ifdef USERPROG
+#include "userprog/gdt.h"
+#include "userprog/process.h"
+#endif
 
 /* Programmable Interrupt Controller (PIC) registers.
    A PC has two PICs, called the master and slave PICs, with the
@@ -47,6 +52,27 @@ static unsigned int unexpected_cnt[INTR_CNT];
 static bool in_external_intr;   /* Are we processing an external interrupt? */
 static bool yield_on_return;    /* Should we yield on interrupt return? */
 
+/* Softirqs are the deferred halves of external interrupt
+   handlers.  A handler does what must be done at once, such as
+   acknowledging its device, raises a softirq for the rest, and
+   returns.  Once the PIC has been told that the interrupt is
+   over, intr_handler() runs the raised softirqs with interrupts
+   turned back on, so another device's interrupt need only wait
+   for the short hard halves.  Softirqs do not nest: an interrupt
+   that arrives while they run leaves its softirq and any request
+   to yield for the code it interrupted, the softirq loop, which
+   handles both before it returns.
+
+   Softirq handlers, like external interrupt handlers, may not
+   sleep, and yield only through intr_yield_on_return(). */
+static softirq_func *softirq_handlers[SOFTIRQ_CNT];
+static unsigned softirq_pending;  /* Bit N set if softirq N raised. */
+static bool in_softirq;           /* Running softirqs? */
+
+/* Passes over softirq_pending before leaving the rest for the
+   next interrupt. */
+#define SOFTIRQ_ROUNDS 4
+
 /* Programmable Interrupt Controller helpers. */
 static void pic_init (void);
 static void pic_end_of_interrupt (int irq);
@@ -59,6 +85,7 @@ static inline uint64_t make_idtr_operand (uint16_t limit, void *base);
 /* Interrupt handlers. */
 void intr_handler (struct intr_frame *args);
 static void unexpected_interrupt (const struct intr_frame *);
+static void run_softirqs (void);
 
 /* Returns the current interrupt status. */
 enum intr_level
@@ -214,16 +241,73 @@ intr_context (void)
   return in_external_intr;
 }
 
-/* During processing of an external interrupt, directs the
-   interrupt handler to yield to a new process just before
-   returning from the interrupt.  May not be called at any other
-   time. */
+/* During processing of an external interrupt or a softirq,
+   directs the interrupt handler to yield to a new process just
+   before returning from the interrupt.  May not be called at any
+   other time. */
 void
 intr_yield_on_return (void) 
 {
-  ASSERT (intr_context ());
+  ASSERT (intr_context () || in_softirq);
   yield_on_return = true;
 }
+
+/* Makes FUNC the handler for softirq NR. */
+void
+intr_register_softirq (enum softirq nr, softirq_func *func) 
+{
+  ASSERT (nr < SOFTIRQ_CNT);
+  ASSERT (softirq_handlers[nr] == NULL);
+  softirq_handlers[nr] = func;
+}
+
+/* Raises softirq NR, which then runs at the end of the current
+   external interrupt, or of the next one if there is none. */
+void
+intr_raise_softirq (enum softirq nr) 
+{
+  enum intr_level old_level;
+
+  ASSERT (nr < SOFTIRQ_CNT);
+  old_level = intr_disable ();
+  softirq_pending |= 1u << nr;
+  intr_set_level (old_level);
+}
+
+/* Returns true while softirqs are running.  The code they
+   interrupted is still the running thread, and may not be
+   switched away from until they finish. */
+bool
+intr_in_softirq (void) 
+{
+  return in_softirq;
+}
+
+/* Runs the raised softirqs with interrupts on.  Interrupts must
+   be off, and are off again on return. */
+static void
+run_softirqs (void) 
+{
+  int round;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (!in_softirq);
+
+  in_softirq = true;
+  for (round = 0; round < SOFTIRQ_ROUNDS && softirq_pending != 0; round++)
+    {
+      unsigned pending = softirq_pending;
+      int nr;
+
+      softirq_pending = 0;
+      intr_enable ();
+      for (nr = 0; nr < SOFTIRQ_CNT; nr++)
+        if ((pending & (1u << nr)) && softirq_handlers[nr] != NULL)
+          softirq_handlers[nr] ();
+      intr_disable ();
+    }
+  in_softirq = false;
+}
 
 /* 8259A Programmable Interrupt Controller. */
 
@@ -274,6 +358,29 @@ pic_end_of_interrupt (int irq)
     outb (0xa0, 0x20);
 }
 
+/* Returns true if external interrupt VEC_NO has been raised by
+   its device but not yet delivered to the CPU, by reading the
+   interrupt request register of the PIC that handles it. */
+bool
+intr_is_pending (uint8_t vec_no)
+{
+  int port, bit;
+  bool pending;
+  enum intr_level old_level;
+
+  ASSERT (vec_no >= 0x20 && vec_no < 0x30);
+
+  port = vec_no < 0x28 ? PIC0_CTRL : PIC1_CTRL;
+  bit = (vec_no - 0x20) % 8;
+
+  old_level = intr_disable ();
+  outb (port, 0x0a);    /* OCW3: next read returns the IRR. */
+  pending = (inb (port) & (1 << bit)) != 0;
+  intr_set_level (old_level);
+
+  return pending;
+}
+
 /* Creates an gate that invokes FUNCTION.
 
    The gate has descriptor privilege level DPL, meaning that it
@@ -358,7 +465,8 @@ intr_handler (struct intr_frame *frame)
       ASSERT (!intr_context ());
 
       in_external_intr = true;
-      yield_on_return = false;
+      if (!in_softirq)
+        yield_on_return = false;
     }
 
   /* Invoke the interrupt's handler. */
@@ -383,8 +491,20 @@ intr_handler (struct intr_frame *frame)
       in_external_intr = false;
       pic_end_of_interrupt (frame->vec_no); 
 
-      if (yield_on_return) 
-        thread_yield (); 
+      /* An interrupt of the softirq loop leaves the rest to it. */
+      if (!in_softirq) 
+        {
+          if (softirq_pending != 0)
+            run_softirqs ();
+          if (yield_on_return && !rcu_defer_preemption ())
+            thread_yield (); 
+#ifdef USERPROG
+          /* A thread interrupted in user mode goes back to it
+             only if no other thread has ended its process. */
+          if (frame->cs == SEL_UCSEG)
+            process_check_exit ();
+#endif
+        }
     }
 }
 
@@ -57,6 +57,17 @@ struct intr_frame
 
 typedef void intr_handler_func (struct intr_frame *);
 
+/* Deferred halves of external interrupt handlers. */
+enum softirq
+  {
+    SOFTIRQ_TIMER,              /* Timer events and scheduler tick. */
+    SOFTIRQ_CNT                 /* Number of softirqs. */
+  };
+
+/* A softirq handler.  It runs with interrupts on, but must not
+   sleep. */
+typedef void softirq_func (void);
+
 void intr_init (void);
 void intr_register_ext (uint8_t vec, intr_handler_func *, const char *name);
 void intr_register_int (uint8_t vec, int dpl, enum intr_level,
@@ -64,6 +75,11 @@ void intr_register_int (uint8_t vec, int dpl, enum intr_level,
 bool intr_context (void);
 void intr_yield_on_return (void);
 
+void intr_register_softirq (enum softirq, softirq_func *);
+void intr_raise_softirq (enum softirq);
+bool intr_in_softirq (void);
+bool intr_is_pending (uint8_t vec);
+
 void intr_dump_frame (const struct intr_frame *);
 const char *intr_name (uint8_t vec);
 
@@ -0,0 +1,287 @@
+#include "threads/kmem.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Object caches ("slab allocator").
+
+   malloc() rounds every request up to a power of 2, which wastes
+   up to half of each block for kernel structures whose size is
+   not a power of 2.  A kmem_cache instead hands out objects of
+   one exact size, packed into page-sized "slabs" whose objects
+   start at the requested alignment.
+
+   A cache may have a constructor, which is called on each object
+   once, when the slab containing it is created, and a
+   destructor, which is called when the slab is given back to the
+   page allocator.  Objects must be freed in their constructed
+   state, so that kmem_cache_alloc() can hand them out again
+   without reinitializing them.  For that reason the free list of
+   a slab lives in an index array after the slab header rather
+   than inside the free objects.
+
+   Each cache keeps its partially used slabs on one list and its
+   full slabs on another, and holds on to at most one completely
+   free slab. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* An object cache. */
+struct kmem_cache
+  {
+    char name[16];              /* Name (for debugging purposes). */
+    size_t obj_size;            /* Object size rounded up to alignment. */
+    size_t objs_per_slab;       /* Number of objects in a slab. */
+    size_t obj_ofs;             /* Offset of first object in a slab. */
+    kmem_obj_func *ctor;        /* Constructor, or null. */
+    kmem_obj_func *dtor;        /* Destructor, or null. */
+    struct lock lock;           /* Protects everything below. */
+    struct list partial_slabs;  /* Slabs with free and used objects. */
+    struct list full_slabs;     /* Slabs with no free objects. */
+    struct slab *free_slab;     /* A slab with no used objects, or null. */
+    struct list_elem elem;      /* Element in cache_list. */
+
+    /* Statistics. */
+    unsigned long long alloc_cnt;  /* Objects allocated. */
+    unsigned long long free_cnt;   /* Objects freed. */
+    size_t slab_cnt;               /* Slabs currently owned. */
+    size_t slab_peak;              /* Most slabs ever owned at once. */
+  };
+
+/* A slab: one page holding this header, the free index stack,
+   and then the objects. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in partial or full list. */
+    size_t free_cnt;            /* Number of free objects. */
+    uint16_t free_idx[];        /* Indexes of the free objects. */
+  };
+
+/* List of all caches, for kmem_print_stats(). */
+static struct list cache_list = LIST_INITIALIZER (cache_list);
+
+static struct slab *slab_create (struct kmem_cache *);
+static void slab_destroy (struct kmem_cache *, struct slab *);
+
+/* Returns the number of bytes before the first object of a slab
+   with OBJ_CNT objects aligned to ALIGN. */
+static size_t
+slab_obj_ofs (size_t obj_cnt, size_t align)
+{
+  return ROUND_UP (sizeof (struct slab) + obj_cnt * sizeof (uint16_t), align);
+}
+
+/* Creates and returns a cache of objects SIZE bytes long, each
+   aligned to ALIGN bytes, which must be a power of 2 (or 0 for
+   pointer alignment).  CTOR and DTOR, either of which may be
+   null, are called on each object when its slab is created and
+   destroyed.  Returns a null pointer if memory is not
+   available. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, size_t align,
+                   kmem_obj_func *ctor, kmem_obj_func *dtor)
+{
+  struct kmem_cache *c;
+  size_t cnt;
+
+  if (align < sizeof (void *))
+    align = sizeof (void *);
+  ASSERT ((align & (align - 1)) == 0);
+  ASSERT (size > 0);
+
+  c = malloc (sizeof *c);
+  if (c == NULL)
+    return NULL;
+
+  strlcpy (c->name, name, sizeof c->name);
+  c->obj_size = ROUND_UP (size, align);
+
+  /* Fit as many objects as possible into a page. */
+  cnt = PGSIZE / c->obj_size;
+  while (cnt > 0 && slab_obj_ofs (cnt, align) + cnt * c->obj_size > PGSIZE)
+    cnt--;
+  if (cnt == 0)
+    PANIC ("kmem cache %s: %zu-byte objects do not fit in a slab",
+           name, size);
+  c->objs_per_slab = cnt;
+  c->obj_ofs = slab_obj_ofs (cnt, align);
+
+  c->ctor = ctor;
+  c->dtor = dtor;
+  lock_init_named (&c->lock, "kmem");
+  list_init (&c->partial_slabs);
+  list_init (&c->full_slabs);
+  c->free_slab = NULL;
+  c->alloc_cnt = c->free_cnt = 0;
+  c->slab_cnt = c->slab_peak = 0;
+  list_push_back (&cache_list, &c->elem);
+
+  return c;
+}
+
+/* Returns object IDX of slab S. */
+static void *
+slab_obj (struct kmem_cache *c, struct slab *s, size_t idx)
+{
+  return (uint8_t *) s + c->obj_ofs + idx * c->obj_size;
+}
+
+/* Obtains and returns a constructed object from cache C.
+   Returns a null pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  ASSERT (c != NULL);
+
+  lock_acquire (&c->lock);
+  if (!list_empty (&c->partial_slabs))
+    s = list_entry (list_front (&c->partial_slabs), struct slab, elem);
+  else
+    {
+      if (c->free_slab != NULL)
+        {
+          s = c->free_slab;
+          c->free_slab = NULL;
+        }
+      else
+        {
+          s = slab_create (c);
+          if (s == NULL)
+            {
+              lock_release (&c->lock);
+              return NULL;
+            }
+        }
+      list_push_front (&c->partial_slabs, &s->elem);
+    }
+
+  obj = slab_obj (c, s, s->free_idx[--s->free_cnt]);
+  if (s->free_cnt == 0)
+    {
+      list_remove (&s->elem);
+      list_push_front (&c->full_slabs, &s->elem);
+    }
+  c->alloc_cnt++;
+  lock_release (&c->lock);
+
+  return obj;
+}
+
+/* Returns OBJ, which must have been obtained from cache C and be
+   in its constructed state, to C.  Does nothing if OBJ is
+   null. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+  size_t idx;
+
+  if (obj == NULL)
+    return;
+
+  s = pg_round_down (obj);
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == c);
+  ASSERT ((size_t) pg_ofs (obj) >= c->obj_ofs);
+  idx = (pg_ofs (obj) - c->obj_ofs) / c->obj_size;
+  ASSERT (obj == slab_obj (c, s, idx));
+
+  lock_acquire (&c->lock);
+  ASSERT (s->free_cnt < c->objs_per_slab);
+  s->free_idx[s->free_cnt++] = idx;
+  if (s->free_cnt == 1)
+    {
+      /* Slab was full. */
+      list_remove (&s->elem);
+      list_push_front (&c->partial_slabs, &s->elem);
+    }
+  if (s->free_cnt == c->objs_per_slab)
+    {
+      /* Slab is now unused.  Keep one of these around. */
+      list_remove (&s->elem);
+      if (c->free_slab == NULL)
+        c->free_slab = s;
+      else
+        slab_destroy (c, s);
+    }
+  c->free_cnt++;
+  lock_release (&c->lock);
+}
+
+/* Prints statistics for every cache that has been used. */
+void
+kmem_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&cache_list); e != list_end (&cache_list);
+       e = list_next (e))
+    {
+      struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+
+      if (c->alloc_cnt == 0)
+        continue;
+      printf ("Cache %s: %llu allocs, %llu frees, %zu slabs (%zu peak), "
+              "%zu objects/slab\n",
+              c->name, c->alloc_cnt, c->free_cnt, c->slab_cnt, c->slab_peak,
+              c->objs_per_slab);
+    }
+}
+
+/* Obtains a page for a new slab of cache C, constructs its
+   objects, and returns it.  Returns a null pointer if memory
+   is not available. */
+static struct slab *
+slab_create (struct kmem_cache *c)
+{
+  struct slab *s = palloc_get_page (0);
+  size_t i;
+
+  if (s == NULL)
+    return NULL;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->free_cnt = c->objs_per_slab;
+  for (i = 0; i < c->objs_per_slab; i++)
+    {
+      s->free_idx[i] = c->objs_per_slab - i - 1;
+      if (c->ctor != NULL)
+        c->ctor (slab_obj (c, s, i));
+    }
+
+  if (++c->slab_cnt > c->slab_peak)
+    c->slab_peak = c->slab_cnt;
+  return s;
+}
+
+/* Destroys the objects of slab S, which must be unused, and
+   gives its page back. */
+static void
+slab_destroy (struct kmem_cache *c, struct slab *s)
+{
+  size_t i;
+
+  ASSERT (s->free_cnt == c->objs_per_slab);
+
+  if (c->dtor != NULL)
+    for (i = 0; i < c->objs_per_slab; i++)
+      c->dtor (slab_obj (c, s, i));
+
+  s->magic = 0;
+  palloc_free_page (s);
+  c->slab_cnt--;
+}
@@ -0,0 +1,23 @@
+#ifndef THREADS_KMEM_H
+#define THREADS_KMEM_H
+
+#include <stddef.h>
+
+/* Object caches.  See kmem.c for details. */
+
+/* Alignment that places each object at the start of a cache
+   line. */
+#define KMEM_CACHE_LINE 64
+
+/* Called on an object when its slab is created (constructor) or
+   given back to the page allocator (destructor). */
+typedef void kmem_obj_func (void *obj);
+
+struct kmem_cache *kmem_cache_create (const char *name, size_t size,
+                                      size_t align, kmem_obj_func *ctor,
+                                      kmem_obj_func *dtor);
+void *kmem_cache_alloc (struct kmem_cache *);
+void kmem_cache_free (struct kmem_cache *, void *);
+void kmem_print_stats (void);
+
+#endif /* threads/kmem.h */
@@ -24,6 +24,14 @@
 #define LOADER_ARGS_LEN 128
 #define LOADER_ARG_CNT_LEN 4
 
+/* Most ranges of the BIOS memory map that start.S keeps. */
+#define LOADER_MEM_MAP_MAX 32
+
+/* Most physical memory the kernel uses, in bytes: all that fits
+   above LOADER_PHYS_BASE, less the last 4 MB, so that the end of
+   RAM has a kernel virtual address too. */
+#define LOADER_RAM_MAX 0x3fc00000       /* 1020 MB. */
+
 /* GDT selectors defined by loader.
    More selectors are defined by userprog/gdt.h. */
 #define SEL_NULL        0x00    /* Null selector. */
@@ -35,6 +43,24 @@
 
 /* Amount of physical memory, in 4 kB pages. */
 extern uint32_t init_ram_pages;
+
+/* A range of physical memory in the BIOS memory map, as returned
+   by interrupt 15h function e820h. */
+struct mem_range
+  {
+    uint64_t base;              /* Physical address. */
+    uint64_t length;            /* Length in bytes. */
+    uint32_t type;              /* MEM_RAM or something reserved. */
+  }
+__attribute__ ((packed));
+
+/* Type of a range of usable RAM. */
+#define MEM_RAM 1
+
+/* BIOS memory map and its number of ranges, 0 if the BIOS did
+   not provide one. */
+extern struct mem_range init_mem_map[];
+extern uint32_t init_mem_cnt;
 #endif
 
 #endif /* threads/loader.h */
@@ -6,7 +6,9 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/palloc.h"
+#include "threads/stats.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* A simple implementation of malloc().
@@ -25,24 +27,87 @@
 
    When we free a block, we add it to its descriptor's free list.
    But if the arena that the block was in now has no in-use
-   blocks, we remove all of the arena's blocks from the free list
-   and give the arena back to the page allocator.
-
-   We can't handle blocks bigger than 2 kB using this scheme,
-   because they're too big to fit in a single page with a
-   descriptor.  We handle those by allocating contiguous pages
-   with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   blocks, and the descriptor already keeps malloc_keep_arenas
+   empty arenas, we remove all of the arena's blocks from the
+   free list and give the arena back to the page allocator.
+   Keeping a few empty arenas stops a single block allocated and
+   freed over and over at the boundary from going to the page
+   allocator every time.  When the kernel pool runs short, the
+   page allocator calls reclaim(), which gives back the empty
+   arenas that are kept, along with the blocks in the depots.
+
+   Blocks of 2 kB or more don't fit in a page alongside an arena
+   header more than once, so the descriptors for them, called
+   "large" descriptors, work differently.  Their block sizes, just
+   under 2, 3, 6, 10 and 14 kB, lie halfway between multiples of
+   the page size, which whole pages would round up to, wasting
+   up to half of the memory of a kernel buffer a little bigger
+   than a page or two.  A large descriptor's arena is the
+   smallest run of pages that its blocks fill exactly, 1 to 7
+   pages, and since a block may then start anywhere in the
+   arena, not just in its first page, each block follows a
+   header that points to its arena.  The first block's header is
+   the arena header itself.  Large blocks therefore start at a
+   multiple of 16 bytes into a page, and all other blocks do not,
+   which is how free() tells them apart.
+
+   Anything bigger, or anything that whole pages would hold as
+   cheaply, we handle by allocating contiguous pages with the
+   page allocator and sticking the allocation size at the
+   beginning of the allocated block's arena header.
+
+   In front of the descriptors, each thread keeps a "magazine" of
+   up to MAGAZINE_SIZE recently freed blocks per size class,
+   which malloc() and free() use without taking any lock.  When
+   a thread's magazine runs empty, malloc() swaps in a full one
+   from the descriptor's "depot", and when it fills up, free()
+   hands it to the depot, so the descriptor lock is taken once
+   per MAGAZINE_SIZE calls at most.  Blocks in magazines and in
+   the depot still count as in use by their arenas.  Large
+   descriptors don't use magazines, which would tie up too much
+   memory in idle blocks.
+
+   malloc_print_stats() reports, for each descriptor, how much of
+   the memory handed out was not asked for, and how many arenas
+   it has. */
+
+/* Blocks per magazine. */
+#define MAGAZINE_SIZE 16
+
+/* Full magazines kept in a descriptor's depot.  Magazines beyond
+   this are returned block by block to their arenas. */
+#define DEPOT_SIZE 4
+
+/* Empty arenas that each descriptor keeps rather than freeing.
+   Controlled by kernel command-line option "-malloc-keep". */
+size_t malloc_keep_arenas = 1;
 
 /* Descriptor. */
 struct desc
   {
     size_t block_size;          /* Size of each element in bytes. */
+    size_t slot_size;           /* Bytes per block, with its header. */
+    size_t block_ofs;           /* Offset of first block in arena. */
+    size_t page_cnt;            /* Pages per arena. */
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
-    struct list free_list;      /* List of free blocks. */
+    bool large;                 /* Large descriptor? */
+    struct clist free_list;     /* List of free blocks. */
+    size_t empty_cnt;           /* Arenas with no block in use. */
     struct lock lock;           /* Lock. */
+    struct block *depot;        /* Full magazines. */
+    size_t depot_cnt;           /* Number of full magazines. */
+
+    /* Statistics. */
+    size_t arena_cnt;           /* Arenas, under LOCK. */
+    size_t arena_peak;          /* Most arenas at once, under LOCK. */
+    struct stats_counter allocs;        /* Blocks allocated. */
+    struct stats_counter requested;     /* Bytes asked for in them. */
   };
 
+/* Sizes of the blocks, with their headers, of the large
+   descriptors. */
+static const size_t large_slot_sizes[] = {2048, 3072, 6144, 10240, 14336};
+
 /* Magic number for detecting arena corruption. */
 #define ARENA_MAGIC 0x9a548eed
 
@@ -54,34 +119,111 @@ struct arena
     size_t free_cnt;            /* Free blocks; pages in big block. */
   };
 
+/* Header in front of each block in a large descriptor's arena. */
+struct large_hdr
+  {
+    struct arena arena;         /* Arena header, in first block only. */
+    struct arena *base;         /* Arena that the block is in. */
+  };
+
 /* Free block. */
 struct block 
   {
-    struct list_elem free_elem; /* Free list element. */
+    union
+      {
+        struct list_elem free_elem; /* Free list element. */
+        struct
+          {
+            struct block *next; /* Next block in magazine. */
+            struct block *next_magazine; /* Next magazine in depot,
+                                            in first block only. */
+          } mag;
+      };
   };
 
 /* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
+static struct desc descs[MALLOC_CLASS_CNT]; /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* Statistics for big blocks. */
+static struct stats_counter big_allocs;         /* Blocks allocated. */
+static struct stats_counter big_requested;      /* Bytes asked for. */
+static struct stats_counter big_given;          /* Bytes handed out. */
+static struct stats_counter big_pages;          /* Pages in use. */
+
+static struct desc *new_desc (size_t block_size, size_t slot_size,
+                              size_t page_cnt, bool large);
+
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static void free_to_arena (struct desc *, struct block *);
+static void release_arena (struct desc *, struct arena *);
+static size_t reclaim (void);
 
 /* Initializes the malloc() descriptors. */
 void
 malloc_init (void) 
 {
   size_t block_size;
+  size_t i;
+
+  /* Large blocks' page offsets must differ from all others'. */
+  ASSERT (sizeof (struct arena) % sizeof (struct large_hdr) != 0);
 
   for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2)
+    new_desc (block_size, block_size, 1, false);
+
+  for (i = 0; i < sizeof large_slot_sizes / sizeof *large_slot_sizes; i++)
+    {
+      /* An arena of as few pages as the slots fill exactly. */
+      size_t slot_size = large_slot_sizes[i];
+      size_t page_cnt = 1;
+      while (page_cnt * PGSIZE % slot_size != 0)
+        page_cnt++;
+      new_desc (slot_size - sizeof (struct large_hdr), slot_size, page_cnt,
+                true);
+    }
+
+  palloc_register_reclaim (reclaim);
+}
+
+/* Adds and returns a descriptor for blocks of BLOCK_SIZE bytes,
+   each of which takes SLOT_SIZE bytes of an arena of PAGE_CNT
+   pages.  LARGE says whether it is a large descriptor. */
+static struct desc *
+new_desc (size_t block_size, size_t slot_size, size_t page_cnt, bool large)
+{
+  struct desc *d = &descs[desc_cnt++];
+
+  ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
+  d->block_size = block_size;
+  d->slot_size = slot_size;
+  d->page_cnt = page_cnt;
+  d->large = large;
+  if (large)
+    {
+      d->block_ofs = sizeof (struct large_hdr);
+      d->blocks_per_arena = page_cnt * PGSIZE / slot_size;
+    }
+  else
     {
-      struct desc *d = &descs[desc_cnt++];
-      ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
-      d->block_size = block_size;
+      d->block_ofs = sizeof (struct arena);
       d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
-      list_init (&d->free_list);
-      lock_init (&d->lock);
     }
+  clist_init (&d->free_list);
+  lock_init_named (&d->lock, "malloc");
+  d->depot = NULL;
+  d->depot_cnt = 0;
+  d->empty_cnt = 0;
+  d->arena_cnt = d->arena_peak = 0;
+  return d;
+}
+
+/* Returns the running thread's magazine for descriptor D. */
+static struct malloc_magazine *
+magazine_for (struct desc *d)
+{
+  return &thread_current ()->magazines[d - descs];
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
@@ -90,6 +232,7 @@ void *
 malloc (size_t size) 
 {
   struct desc *d;
+  struct malloc_magazine *mag;
   struct block *b;
   struct arena *a;
 
@@ -102,14 +245,20 @@ malloc (size_t size)
   for (d = descs; d < descs + desc_cnt; d++)
     if (d->block_size >= size)
       break;
-  if (d == descs + desc_cnt) 
+  if (d == descs + desc_cnt
+      || (d->large && d->slot_size >= ROUND_UP (size + sizeof *a, PGSIZE)))
     {
-      /* SIZE is too big for any descriptor.
-         Allocate enough pages to hold SIZE plus an arena. */
+      /* SIZE is too big for any descriptor, or as big as whole
+         pages would hold.  Allocate enough pages to hold SIZE
+         plus an arena. */
       size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
       a = palloc_get_multiple (0, page_cnt);
       if (a == NULL)
         return NULL;
+      stats_inc (&big_allocs);
+      stats_add (&big_requested, size);
+      stats_add (&big_given, page_cnt * PGSIZE - sizeof *a);
+      stats_add (&big_pages, page_cnt);
 
       /* Initialize the arena to indicate a big block of PAGE_CNT
          pages, and return it. */
@@ -118,21 +267,50 @@ malloc (size_t size)
       a->free_cnt = page_cnt;
       return a + 1;
     }
+  stats_inc (&d->allocs);
+  stats_add (&d->requested, size);
+
+  /* Take a block from our magazine if we can. */
+  mag = magazine_for (d);
+  if (mag->cnt > 0)
+    {
+      b = mag->head;
+      mag->head = b->mag.next;
+      mag->cnt--;
+      return b;
+    }
 
   lock_acquire (&d->lock);
 
+  /* Otherwise swap our empty magazine for a full one from the
+     depot. */
+  if (d->depot != NULL)
+    {
+      b = d->depot;
+      d->depot = b->mag.next_magazine;
+      d->depot_cnt--;
+      lock_release (&d->lock);
+
+      mag->head = b->mag.next;
+      mag->cnt = MAGAZINE_SIZE - 1;
+      return b;
+    }
+
   /* If the free list is empty, create a new arena. */
-  if (list_empty (&d->free_list))
+  if (clist_empty (&d->free_list))
     {
       size_t i;
 
-      /* Allocate a page. */
-      a = palloc_get_page (0);
+      /* Allocate pages. */
+      a = palloc_get_multiple (0, d->page_cnt);
       if (a == NULL) 
         {
           lock_release (&d->lock);
           return NULL; 
         }
+      if (++d->arena_cnt > d->arena_peak)
+        d->arena_peak = d->arena_cnt;
+      d->empty_cnt++;
 
       /* Initialize arena and add its blocks to the free list. */
       a->magic = ARENA_MAGIC;
@@ -141,14 +319,17 @@ malloc (size_t size)
       for (i = 0; i < d->blocks_per_arena; i++) 
         {
           struct block *b = arena_to_block (a, i);
-          list_push_back (&d->free_list, &b->free_elem);
+          if (d->large)
+            ((struct large_hdr *) b)[-1].base = a;
+          clist_push_back (&d->free_list, &b->free_elem);
         }
     }
 
   /* Get a block from free list and return it. */
-  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
+  b = list_entry (clist_pop_front (&d->free_list), struct block, free_elem);
   a = block_to_arena (b);
-  a->free_cnt--;
+  if (a->free_cnt-- == d->blocks_per_arena)
+    d->empty_cnt--;
   lock_release (&d->lock);
   return b;
 }
@@ -185,12 +366,46 @@ block_size (void *block)
   return d != NULL ? d->block_size : PGSIZE * a->free_cnt - pg_ofs (block);
 }
 
+/* Tries to resize OLD_BLOCK to NEW_SIZE bytes without moving
+   it.  A block from a descriptor stays put if NEW_SIZE still
+   fits.  A big block gives back the pages it no longer needs, or
+   takes the pages that follow it if they are free.  Returns
+   true if successful, false if the block must be moved. */
+static bool
+resize_in_place (void *old_block, size_t new_size) 
+{
+  struct arena *a = block_to_arena (old_block);
+  size_t old_cnt, new_cnt;
+
+  if (a->desc != NULL)
+    return new_size <= a->desc->block_size;
+
+  old_cnt = a->free_cnt;
+  new_cnt = DIV_ROUND_UP (new_size + sizeof *a, PGSIZE);
+  if (new_cnt < old_cnt)
+    {
+      palloc_free_multiple ((uint8_t *) a + new_cnt * PGSIZE,
+                            old_cnt - new_cnt);
+      stats_sub (&big_pages, old_cnt - new_cnt);
+    }
+  else if (new_cnt > old_cnt)
+    {
+      if (!palloc_extend (a, old_cnt, new_cnt - old_cnt))
+        return false;
+      stats_add (&big_pages, new_cnt - old_cnt);
+    }
+  a->free_cnt = new_cnt;
+  return true;
+}
+
 /* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
    moving it in the process.
    If successful, returns the new block; on failure, returns a
    null pointer.
    A call with null OLD_BLOCK is equivalent to malloc(NEW_SIZE).
-   A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK). */
+   A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK).
+   The block is resized in place when possible, so growing a
+   block a little at a time copies it only now and then. */
 void *
 realloc (void *old_block, size_t new_size) 
 {
@@ -199,6 +414,8 @@ realloc (void *old_block, size_t new_size)
       free (old_block);
       return NULL;
     }
+  else if (old_block != NULL && resize_in_place (old_block, new_size))
+    return old_block;
   else 
     {
       void *new_block = malloc (new_size);
@@ -227,47 +444,252 @@ free (void *p)
       if (d != NULL) 
         {
           /* It's a normal block.  We handle it here. */
+          struct malloc_magazine *mag = magazine_for (d);
 
 #ifndef NDEBUG
           /* Clear the block to help detect use-after-free bugs. */
           memset (b, 0xcc, d->block_size);
 #endif
-  
-          lock_acquire (&d->lock);
 
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
+          /* A large block goes straight back to its arena. */
+          if (d->large)
+            {
+              lock_acquire (&d->lock);
+              free_to_arena (d, b);
+              lock_release (&d->lock);
+              return;
+            }
 
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
+          /* Our magazine is full: hand it to the depot, or if the
+             depot is full too, give its blocks back. */
+          if (mag->cnt >= MAGAZINE_SIZE)
             {
-              size_t i;
+              struct block *full = mag->head;
 
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++) 
+              lock_acquire (&d->lock);
+              if (d->depot_cnt < DEPOT_SIZE)
                 {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
+                  full->mag.next_magazine = d->depot;
+                  d->depot = full;
+                  d->depot_cnt++;
                 }
-              palloc_free_page (a);
+              else
+                while (full != NULL)
+                  {
+                    struct block *next = full->mag.next;
+                    free_to_arena (d, full);
+                    full = next;
+                  }
+              lock_release (&d->lock);
+
+              mag->head = NULL;
+              mag->cnt = 0;
             }
 
-          lock_release (&d->lock);
+          /* Cache the block in our magazine. */
+          b->mag.next = mag->head;
+          mag->head = b;
+          mag->cnt++;
         }
       else
         {
           /* It's a big block.  Free its pages. */
+          stats_sub (&big_pages, a->free_cnt);
           palloc_free_multiple (a, a->free_cnt);
           return;
         }
     }
 }
 
+/* Gives every block in the running thread's magazines back to
+   its arena.  Called by a thread that is about to exit. */
+void
+malloc_release_magazines (void)
+{
+  size_t i;
+
+  for (i = 0; i < desc_cnt; i++)
+    {
+      struct desc *d = &descs[i];
+      struct malloc_magazine *mag = magazine_for (d);
+      struct block *b = mag->head;
+
+      if (mag->cnt == 0)
+        continue;
+
+      lock_acquire (&d->lock);
+      while (b != NULL)
+        {
+          struct block *next = b->mag.next;
+          free_to_arena (d, b);
+          b = next;
+        }
+      lock_release (&d->lock);
+
+      mag->head = NULL;
+      mag->cnt = 0;
+    }
+}
+
+/* Adds block B to descriptor D's free list.  If that leaves the
+   arena entirely unused, frees the arena, unless D keeps fewer
+   than malloc_keep_arenas empty arenas.  D's lock must be
+   held. */
+static void
+free_to_arena (struct desc *d, struct block *b)
+{
+  struct arena *a = block_to_arena (b);
+
+  ASSERT (lock_held_by_current_thread (&d->lock));
+
+  /* Add block to free list. */
+  clist_push_front (&d->free_list, &b->free_elem);
+
+  /* If the arena is now entirely unused, keep or free it. */
+  if (++a->free_cnt >= d->blocks_per_arena) 
+    {
+      ASSERT (a->free_cnt == d->blocks_per_arena);
+      if (d->empty_cnt < malloc_keep_arenas)
+        d->empty_cnt++;
+      else
+        release_arena (d, a);
+    }
+}
+
+/* Removes the blocks of A, an empty arena of descriptor D, from
+   D's free list and frees A.  D's lock must be held. */
+static void
+release_arena (struct desc *d, struct arena *a)
+{
+  size_t i;
+
+  ASSERT (a->free_cnt == d->blocks_per_arena);
+  for (i = 0; i < d->blocks_per_arena; i++) 
+    {
+      struct block *b = arena_to_block (a, i);
+      clist_remove (&d->free_list, &b->free_elem);
+    }
+  palloc_free_multiple (a, d->page_cnt);
+  d->arena_cnt--;
+}
+
+/* Gives back to the page allocator the blocks in the
+   descriptors' depots and the empty arenas that the descriptors
+   keep, for palloc_get_multiple() when the kernel pool runs
+   short.  Skips descriptors whose locks are busy, including one
+   whose lock the running thread holds because it is the one
+   allocating.  Returns the number of pages freed. */
+static size_t
+reclaim (void) 
+{
+  size_t freed = 0;
+  struct desc *d;
+
+  for (d = descs; d < descs + desc_cnt; d++)
+    {
+      size_t arena_cnt;
+
+      if (lock_held_by_current_thread (&d->lock)
+          || !lock_try_acquire (&d->lock))
+        continue;
+      arena_cnt = d->arena_cnt;
+
+      while (d->depot != NULL)
+        {
+          struct block *b = d->depot;
+
+          d->depot = b->mag.next_magazine;
+          d->depot_cnt--;
+          while (b != NULL)
+            {
+              struct block *next = b->mag.next;
+              free_to_arena (d, b);
+              b = next;
+            }
+        }
+
+      while (d->empty_cnt > 0)
+        {
+          struct list_elem *e;
+
+          for (e = list_begin (clist_list (&d->free_list)); ;
+               e = list_next (e))
+            {
+              struct block *b = list_entry (e, struct block, free_elem);
+              struct arena *a = block_to_arena (b);
+
+              ASSERT (e != list_end (clist_list (&d->free_list)));
+              if (a->free_cnt == d->blocks_per_arena)
+                {
+                  release_arena (d, a);
+                  break;
+                }
+            }
+          d->empty_cnt--;
+        }
+      freed += (arena_cnt - d->arena_cnt) * d->page_cnt;
+      lock_release (&d->lock);
+    }
+  return freed;
+}
+
+/* Prints, for each descriptor that has been used and for big
+   blocks, the number of allocations, the percentage of the
+   bytes handed out that were not asked for, and the arenas or
+   pages in use.  Blocks in magazines count as in use. */
+void
+malloc_print_stats (void) 
+{
+  uint64_t allocs;
+  size_t i;
+
+  for (i = 0; i < desc_cnt; i++)
+    {
+      struct desc *d = &descs[i];
+      uint64_t given;
+      size_t arena_cnt, arena_peak, empty_cnt, free_cnt;
+
+      allocs = stats_get (&d->allocs);
+      given = allocs * d->block_size;
+
+      if (allocs == 0)
+        continue;
+      lock_acquire (&d->lock);
+      arena_cnt = d->arena_cnt;
+      arena_peak = d->arena_peak;
+      empty_cnt = d->empty_cnt;
+      free_cnt = clist_size (&d->free_list);
+      lock_release (&d->lock);
+
+      printf ("Malloc %zu-byte blocks: %llu allocs, %llu%% wasted, "
+              "%zu arenas (%zu peak, %zu empty) of %zu pages, "
+              "%zu in use\n",
+              d->block_size, allocs,
+              (given - stats_get (&d->requested)) * 100 / given,
+              arena_cnt, arena_peak, empty_cnt, d->page_cnt,
+              arena_cnt * d->blocks_per_arena - free_cnt);
+    }
+  allocs = stats_get (&big_allocs);
+  if (allocs > 0)
+    {
+      uint64_t given = stats_get (&big_given);
+      printf ("Malloc big blocks: %llu allocs, %llu%% wasted, "
+              "%llu pages in use\n",
+              allocs, (given - stats_get (&big_requested)) * 100 / given,
+              stats_get (&big_pages));
+    }
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
 {
-  struct arena *a = pg_round_down (b);
+  struct arena *a;
+
+  if (pg_ofs (b) % sizeof (struct large_hdr) == 0)
+    a = ((struct large_hdr *) b)[-1].base;
+  else
+    a = pg_round_down (b);
 
   /* Check that the arena is valid. */
   ASSERT (a != NULL);
@@ -275,7 +697,8 @@ block_to_arena (struct block *b)
 
   /* Check that the block is properly aligned for the arena. */
   ASSERT (a->desc == NULL
-          || (pg_ofs (b) - sizeof *a) % a->desc->block_size == 0);
+          || ((uint8_t *) b - (uint8_t *) a - a->desc->block_ofs)
+             % a->desc->slot_size == 0);
   ASSERT (a->desc != NULL || pg_ofs (b) == sizeof *a);
 
   return a;
@@ -289,6 +712,6 @@ arena_to_block (struct arena *a, size_t idx)
   ASSERT (a->magic == ARENA_MAGIC);
   ASSERT (idx < a->desc->blocks_per_arena);
   return (struct block *) ((uint8_t *) a
-                           + sizeof *a
-                           + idx * a->desc->block_size);
+                           + a->desc->block_ofs
+                           + idx * a->desc->slot_size);
 }
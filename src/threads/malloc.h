@@ -4,7 +4,23 @@
 #include <debug.h>
 #include <stddef.h>
 
+/* Maximum number of malloc() size classes. */
+#define MALLOC_CLASS_CNT 12
+
+/* A thread's cache of recently freed blocks of one size class.
+   Owned by threads/malloc.c. */
+struct malloc_magazine
+  {
+    void *head;                 /* First cached block. */
+    size_t cnt;                 /* Number of cached blocks. */
+  };
+
+/* Empty arenas that each size class keeps cached. */
+extern size_t malloc_keep_arenas;
+
 void malloc_init (void);
+void malloc_release_magazines (void);
+void malloc_print_stats (void);
 void *malloc (size_t) __attribute__ ((malloc));
 void *calloc (size_t, size_t) __attribute__ ((malloc));
 void *realloc (void *, size_t);
@@ -0,0 +1,196 @@
+#include "threads/mp.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/init.h"
+#include "threads/vaddr.h"
+
+/* Multiprocessor discovery.
+
+   Finds the processors in the machine from the MP configuration
+   table that the BIOS leaves in low memory, as described by the
+   Intel MultiProcessor Specification 1.4.  This is the first step
+   of bringing up the other processors, and the only one taken
+   here: nothing starts them, and the kernel runs on the boot
+   processor alone, because thread.c, synch.c and the device
+   drivers all rely on turning off interrupts for mutual
+   exclusion, which does nothing to stop another processor.
+   mp_init() only reports what it finds. */
+
+/* MP floating pointer structure. */
+struct mp_float
+  {
+    char signature[4];          /* "_MP_". */
+    uint32_t config;            /* Physical address of mp_config. */
+    uint8_t length;             /* In 16-byte units. */
+    uint8_t spec_rev;           /* Version of the spec. */
+    uint8_t checksum;           /* Makes the bytes sum to 0. */
+    uint8_t type;               /* Default configuration, or 0. */
+    uint8_t features[4];
+  };
+
+/* MP configuration table header, followed by its entries. */
+struct mp_config
+  {
+    char signature[4];          /* "PCMP". */
+    uint16_t length;            /* Of header and entries. */
+    uint8_t spec_rev;           /* Version of the spec. */
+    uint8_t checksum;           /* Makes the bytes sum to 0. */
+    char oem[8], product[12];
+    uint32_t oem_table;
+    uint16_t oem_length;
+    uint16_t entry_cnt;         /* Number of entries. */
+    uint32_t lapic_addr;        /* Physical address of local APICs. */
+    uint16_t ext_length;
+    uint8_t ext_checksum;
+    uint8_t reserved;
+  };
+
+/* Processor entry in the configuration table.  The other entry
+   types are 8 bytes long. */
+struct mp_processor
+  {
+    uint8_t type;               /* MP_PROCESSOR. */
+    uint8_t apic_id;
+    uint8_t apic_version;
+    uint8_t flags;              /* MP_CPU_* flags. */
+    uint32_t signature, features;
+    uint8_t reserved[8];
+  };
+
+#define MP_PROCESSOR 0          /* Processor entry type. */
+#define MP_CPU_ENABLED 0x01     /* Processor is usable. */
+
+/* Local APIC address that default configurations use. */
+#define MP_DEFAULT_LAPIC 0xfee00000
+
+/* Returns the kernel address of the SIZE bytes at physical
+   address PADDR, or a null pointer if they are not all mapped. */
+static const void *
+map (uint32_t paddr, size_t size) 
+{
+  uint32_t end = init_ram_pages * PGSIZE;
+
+  if (paddr >= end || size > end - paddr)
+    return NULL;
+  return ptov (paddr);
+}
+
+/* Returns true if the SIZE bytes at P sum to 0 mod 256. */
+static bool
+checksum_ok (const void *p, size_t size) 
+{
+  const uint8_t *b = p;
+  uint8_t sum = 0;
+
+  while (size-- > 0)
+    sum += *b++;
+  return sum == 0;
+}
+
+/* Searches the LENGTH bytes at physical address PADDR for an MP
+   floating pointer structure and returns it, or a null pointer
+   if there is none. */
+static const struct mp_float *
+search (uint32_t paddr, size_t length) 
+{
+  const uint8_t *p = map (paddr, length);
+  size_t ofs;
+
+  if (p == NULL)
+    return NULL;
+  for (ofs = 0; ofs + sizeof (struct mp_float) <= length; ofs += 16)
+    {
+      const struct mp_float *mpf = (const struct mp_float *) (p + ofs);
+      if (!memcmp (mpf->signature, "_MP_", 4)
+          && checksum_ok (mpf, sizeof *mpf))
+        return mpf;
+    }
+  return NULL;
+}
+
+/* Finds the MP floating pointer structure in the places the spec
+   allows: the first kilobyte of the extended BIOS data area, the
+   last kilobyte of base memory, and the BIOS ROM. */
+static const struct mp_float *
+find_float (void) 
+{
+  const uint8_t *bda = map (0x400, 0x20);
+  const struct mp_float *mpf = NULL;
+  uint16_t ebda_seg, base_kb;
+
+  if (bda == NULL)
+    return NULL;
+
+  /* The BDA holds the EBDA's segment at offset 0x0e and the size
+     of base memory in kB at offset 0x13, which is not 16-bit
+     aligned. */
+  ebda_seg = bda[0x0e] | (bda[0x0f] << 8);
+  base_kb = bda[0x13] | (bda[0x14] << 8);
+  if (ebda_seg != 0)
+    mpf = search ((uint32_t) ebda_seg << 4, 1024);
+  if (mpf == NULL)
+    mpf = search (((uint32_t) base_kb - 1) * 1024, 1024);
+  if (mpf == NULL)
+    mpf = search (0xf0000, 0x10000);
+  return mpf;
+}
+
+/* Counts the enabled processors in configuration table CFG. */
+static unsigned
+count_processors (const struct mp_config *cfg) 
+{
+  const uint8_t *p = (const uint8_t *) (cfg + 1);
+  const uint8_t *end = (const uint8_t *) cfg + cfg->length;
+  unsigned cnt = 0;
+  unsigned i;
+
+  for (i = 0; i < cfg->entry_cnt && p < end; i++)
+    if (*p == MP_PROCESSOR)
+      {
+        const struct mp_processor *proc = (const void *) p;
+        if (proc->flags & MP_CPU_ENABLED)
+          cnt++;
+        p += sizeof *proc;
+      }
+    else
+      p += 8;
+  return cnt;
+}
+
+/* Looks for the MP configuration table and reports the number
+   of processors it lists.  Must be called after paging_init(). */
+void
+mp_init (void) 
+{
+  const struct mp_float *mpf = find_float ();
+  const struct mp_config *cfg;
+  unsigned cpu_cnt;
+  uint32_t lapic_addr;
+
+  if (mpf == NULL)
+    return;
+  if (mpf->type != 0)
+    {
+      /* One of the default two-processor configurations. */
+      cpu_cnt = 2;
+      lapic_addr = MP_DEFAULT_LAPIC;
+    }
+  else
+    {
+      cfg = map (mpf->config, sizeof *cfg);
+      if (cfg == NULL || memcmp (cfg->signature, "PCMP", 4)
+          || map (mpf->config, cfg->length) == NULL
+          || !checksum_ok (cfg, cfg->length))
+        return;
+      cpu_cnt = count_processors (cfg);
+      lapic_addr = cfg->lapic_addr;
+    }
+
+  if (cpu_cnt > 1)
+    printf ("MP: %u processors, local APIC at %#"PRIx32"; "
+            "using only the boot processor.\n",
+            cpu_cnt, lapic_addr);
+}
@@ -0,0 +1,8 @@
+#ifndef THREADS_MP_H
+#define THREADS_MP_H
+
+/* Multiprocessor discovery.  See mp.c for details. */
+
+void mp_init (void);
+
+#endif /* threads/mp.h */
@@ -7,7 +7,10 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
+#include "threads/pte.h"
+#include "threads/stats.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
@@ -23,7 +26,87 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+   Pages that the BIOS memory map does not report as RAM stay
+   marked used in either pool.
+
+   Two backends share the same pools.  The default one scans the
+   pool's bitmap for a run of free pages.  It takes a single page
+   without the pool lock, with bitmap_claim(), which finds a free
+   bit and sets it with an atomic compare-and-exchange, trying
+   again if another thread got there first; only runs of pages,
+   and the rare cases below that move pages between owners, take
+   the lock.  The buddy backend,
+   selected with the "-buddy" kernel command-line option, keeps
+   free blocks of 2**ORDER pages on per-order free lists, so that
+   a single page is found in constant time and a run of pages
+   with at most a few splits.  The bitmap is kept up to date in
+   both cases; the buddy backend uses it to tell whether a
+   block's buddy is free.  Buddy blocks are aligned on their
+   size in physical memory, not just within the pool, so that a
+   block of the largest order is a 4 MB page that a page
+   directory entry can map by itself; palloc_get_large()
+   allocates one.
+
+   With the "-prezero" option, the idle thread zeroes free user
+   pages in the background, with the bitmap backend, and keeps
+   up to ZEROED_MAX of them aside, marked used in the bitmap.  A
+   request for a single zeroed user page takes one of those
+   instead of zeroing a page itself.
+
+   Modules that keep free pages cached for themselves, like
+   malloc()'s empty arenas, register a reclaim function with
+   palloc_register_reclaim().  When the kernel pool has no run of
+   pages for a request, palloc_get_multiple() calls them to give
+   back what they can and tries again once.
+
+   The split between the pools is only where each starts out.
+   Both pools' bitmaps cover all of free memory, which is divided
+   into chunks of CHUNK_PAGES pages, each owned by one pool and
+   marked used in the other's bitmap.  When a pool has no run of
+   pages for a request, with the bitmap backend, it borrows a
+   chunk that is entirely free from the other pool, which
+   thereby gives up the pages until it borrows them back in
+   turn.  A pool borrows back the chunks it lent before taking
+   any of the other's own, and never takes the other below a
+   quarter of the pages it started with, so that neither can
+   starve the other.  The user pool also never grows past the
+   limit set with "-ul".
+
+   Once the user pool is fragmented by frames of user pages, a
+   request for a run of pages can fail although plenty are free.
+   With the bitmap backend, palloc_get_multiple() and
+   palloc_get_large() then compact the user pool: they pick the
+   run with the fewest pages in use and have the function
+   registered with palloc_register_migrate(), vm/frame.c's, move
+   those pages' contents elsewhere.  While it does, allocation
+   keeps out of the run, its "fence", so that the pages freed
+   there stay free, and the run goes to the request at the end.
+   A request to the kernel pool that cannot borrow a chunk
+   borrows one that compaction has emptied.
+
+   Lending is therefore lopsided.  The kernel pool gets a chunk
+   back from the user pool even while frames are in it, since
+   compaction moves them out.  The user pool cannot do the same,
+   because kernel pages never move: a chunk it lent stays with
+   the kernel pool until every kernel page in it has been freed,
+   however many of them there are. */
+
+/* Pages in a chunk that one pool lends the other: 1 MB. */
+#define CHUNK_PAGES 256
+
+/* Maximum number of pre-zeroed pages kept aside in a pool. */
+#define ZEROED_MAX 256
+
+/* Largest buddy block is 2**BUDDY_MAX_ORDER pages. */
+#define BUDDY_MAX_ORDER 10
+
+/* Header stored in the first page of a free buddy block. */
+struct buddy_block
+  {
+    struct list_elem elem;              /* Element in a free list. */
+    unsigned order;                     /* Block is 2**ORDER pages. */
+  };
 
 /* A memory pool. */
 struct pool
@@ -31,34 +114,190 @@ struct pool
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
     uint8_t *base;                      /* Base of pool. */
+    size_t skew;                        /* Page number of BASE, modulo
+                                           the largest buddy block. */
+    struct stats_counter free_cnt;      /* Pages not handed out. */
+    size_t page_cnt;                    /* Pages in chunks it owns. */
+    size_t reserve;                     /* Pages it keeps, at least. */
+    size_t limit;                       /* Pages it may own, at most. */
+    size_t fence_start;                 /* Run being emptied by */
+    size_t fence_cnt;                   /* compaction, if FENCE_CNT
+                                           is nonzero. */
+    struct list free_lists[BUDDY_MAX_ORDER + 1]; /* Free buddy blocks,
+                                                    by order. */
+
+    /* Pre-zeroed pages.  Pushed by the idle thread, which must not
+       sleep, so protected by disabling interrupts, not LOCK. */
+    void *zeroed[ZEROED_MAX];           /* Pre-zeroed pages. */
+    size_t zeroed_cnt;                  /* Number of pages in zeroed. */
   };
 
+/* If false (default), allocate by scanning the pool bitmap.
+   If true, use the buddy allocator.
+   Controlled by kernel command-line option "-buddy". */
+bool palloc_buddy;
+
+/* If false (default), zero pages only when they are allocated.
+   If true, the idle thread pre-zeroes free user pages.
+   Controlled by kernel command-line option "-prezero". */
+bool palloc_prezero;
+
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
-static void init_pool (struct pool *, void *base, size_t page_cnt,
+/* Owner of a chunk. */
+enum chunk_owner
+  {
+    OWNER_KERNEL,                       /* Kernel pool. */
+    OWNER_USER,                         /* User pool. */
+    OWNER_SPLIT                         /* Pages below split_idx are the
+                                           kernel pool's, the rest the
+                                           user pool's.  Never lent. */
+  };
+
+static uint8_t *chunk_owners;   /* Each chunk's enum chunk_owner. */
+static size_t split_idx;        /* First page of the user pool at boot. */
+static struct stats_counter lend_cnt;   /* Chunks lent. */
+
+/* Compaction. */
+static palloc_migrate_func *migrate_func;       /* Moves frames. */
+static struct lock compact_lock;        /* One compaction at a time. */
+static struct stats_counter compact_cnt;        /* Runs emptied. */
+static struct stats_counter compact_fail_cnt;   /* Attempts failed. */
+
+/* Number of pages handed out by palloc_get_early(). */
+static size_t early_cnt;
+
+/* Reclaim functions for the kernel pool. */
+#define RECLAIM_MAX 4
+static palloc_reclaim_func *reclaimers[RECLAIM_MAX];
+static size_t reclaimer_cnt;
+
+static void init_pool (struct pool *, void *bm, uint8_t *base,
+                       size_t page_cnt, size_t first, size_t cnt,
                        const char *name);
+static bool ram_usable (size_t page_no);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t alloc_pages (struct pool *, size_t page_cnt);
+static bool reclaim (void);
+static bool borrow_chunk (struct pool *);
+static bool borrow_compacted_chunk (void);
+static bool may_lend (const struct pool *lender, const struct pool *);
+static bool move_chunk (struct pool *lender, struct pool *, size_t chunk);
+static bool owns_run (const struct pool *, size_t page_idx,
+                      size_t page_cnt);
+static size_t compact (size_t page_cnt, size_t first, size_t step);
+static bool in_fence (const struct pool *, size_t page_idx,
+                      size_t page_cnt);
+static size_t scan_and_flip (struct pool *, size_t page_cnt);
+static size_t claim_page (struct pool *);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void buddy_free (struct pool *, size_t page_idx, size_t page_cnt);
+static void *pop_zeroed (struct pool *);
+static void release_zeroed (struct pool *);
+
+/* Obtains and returns a zeroed page for paging_init(), which
+   must map all of RAM before palloc_init() can set up the pools
+   in it.  Pages come from just above 1 MB, which the loader's
+   page tables map, and are never freed. */
+void *
+palloc_get_early (void) 
+{
+  uintptr_t paddr = 1024 * 1024 + early_cnt * PGSIZE;
+
+  ASSERT (paddr < 64 * 1024 * 1024);
+  ASSERT (paddr < init_ram_pages * PGSIZE);
+
+  early_cnt++;
+  memset (ptov (paddr), 0, PGSIZE);
+  return ptov (paddr);
+}
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
 void
 palloc_init (size_t user_page_limit)
 {
-  /* Free memory starts at 1 MB and runs to the end of RAM. */
-  uint8_t *free_start = ptov (1024 * 1024);
+  /* Free memory starts at 1 MB, past any pages that
+     palloc_get_early() handed out, and runs to the end of RAM. */
+  uint8_t *free_start = ptov (1024 * 1024 + early_cnt * PGSIZE);
   uint8_t *free_end = ptov (init_ram_pages * PGSIZE);
   size_t free_pages = (free_end - free_start) / PGSIZE;
-  size_t user_pages = free_pages / 2;
-  size_t kernel_pages;
+  size_t bm_size = bitmap_buf_size (free_pages);
+  size_t chunk_cnt = DIV_ROUND_UP (free_pages, CHUNK_PAGES);
+  size_t meta_pages = DIV_ROUND_UP (2 * bm_size + chunk_cnt, PGSIZE);
+  size_t page_cnt, user_pages, kernel_pages;
+  uint8_t *base;
+  size_t i;
+
+  /* The bitmaps and chunk owners go first, and the pages they
+     describe follow. */
+  if (meta_pages >= free_pages)
+    PANIC ("Not enough memory for page allocator.");
+  page_cnt = free_pages - meta_pages;
+  base = free_start + meta_pages * PGSIZE;
+  chunk_owners = free_start + 2 * bm_size;
+
+  /* Give half of memory to kernel, half to user. */
+  user_pages = page_cnt / 2;
   if (user_pages > user_page_limit)
     user_pages = user_page_limit;
-  kernel_pages = free_pages - user_pages;
+  kernel_pages = page_cnt - user_pages;
+  split_idx = kernel_pages;
+  for (i = 0; i * CHUNK_PAGES < page_cnt; i++)
+    if ((i + 1) * CHUNK_PAGES <= split_idx)
+      chunk_owners[i] = OWNER_KERNEL;
+    else if (i * CHUNK_PAGES >= split_idx)
+      chunk_owners[i] = OWNER_USER;
+    else
+      chunk_owners[i] = OWNER_SPLIT;
 
-  /* Give half of memory to kernel, half to user. */
-  init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
-  init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
-             user_pages, "user pool");
+  init_pool (&kernel_pool, free_start, base, page_cnt, 0, kernel_pages,
+             "kernel pool");
+  init_pool (&user_pool, free_start + bm_size, base, page_cnt,
+             kernel_pages, user_pages, "user pool");
+  kernel_pool.limit = SIZE_MAX;
+  user_pool.limit = user_page_limit;
+  stats_register (&kernel_pool.free_cnt, "palloc", "kernel_free",
+                  STATS_GAUGE);
+  stats_register (&user_pool.free_cnt, "palloc", "user_free",
+                  STATS_GAUGE);
+  stats_register (&lend_cnt, "palloc", "chunks_lent", STATS_COUNTER);
+  lock_init_named (&compact_lock, "palloc-compact");
+  stats_register (&compact_cnt, "palloc", "compactions", STATS_COUNTER);
+  stats_register (&compact_fail_cnt, "palloc", "compaction_failures",
+                  STATS_COUNTER);
+}
+
+/* Returns the number of free pages in the user pool if PAL_USER
+   is set in FLAGS, otherwise in the kernel pool.  Pre-zeroed
+   pages count as free. */
+size_t
+palloc_free_cnt (enum palloc_flags flags) 
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+
+  return stats_get (&pool->free_cnt);
+}
+
+/* Returns the number of pages that the two pools share among
+   them, each of which has an index from palloc_page_idx(). */
+size_t
+palloc_page_cnt (void) 
+{
+  return bitmap_size (user_pool.used_map);
+}
+
+/* Returns the index of PAGE, which must be a page of the kernel
+   or user pool, among the palloc_page_cnt() pages of the pools.
+   A page keeps its index when its chunk moves between pools. */
+size_t
+palloc_page_idx (const void *page) 
+{
+  size_t page_idx = pg_no (page) - pg_no (user_pool.base);
+
+  ASSERT (page_idx < bitmap_size (user_pool.used_map));
+  return page_idx;
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
@@ -77,9 +316,27 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
+  /* A pre-zeroed page needs no memset.  It counts as free while
+     it is set aside. */
+  if ((flags & PAL_ZERO) && page_cnt == 1)
+    {
+      pages = pop_zeroed (pool);
+      if (pages != NULL)
+        {
+          stats_sub (&pool->free_cnt, 1);
+          return pages;
+        }
+    }
+
+  page_idx = alloc_pages (pool, page_cnt);
+  if (page_idx == BITMAP_ERROR && pool == &kernel_pool && reclaim ())
+    page_idx = alloc_pages (pool, page_cnt);
+  if (page_idx == BITMAP_ERROR && page_cnt <= CHUNK_PAGES
+      && (borrow_chunk (pool)
+          || (pool == &kernel_pool && borrow_compacted_chunk ())))
+    page_idx = alloc_pages (pool, page_cnt);
+  if (page_idx == BITMAP_ERROR && pool == &user_pool && page_cnt > 1)
+    page_idx = compact (page_cnt, 0, page_cnt);
 
   if (page_idx != BITMAP_ERROR)
     pages = pool->base + PGSIZE * page_idx;
@@ -88,8 +345,14 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 
   if (pages != NULL) 
     {
+      stats_sub (&pool->free_cnt, page_cnt);
       if (flags & PAL_ZERO)
-        memset (pages, 0, PGSIZE * page_cnt);
+        {
+          size_t i;
+
+          for (i = 0; i < page_cnt; i++)
+            clear_page (pages + PGSIZE * i);
+        }
     }
   else 
     {
@@ -113,6 +376,68 @@ palloc_get_page (enum palloc_flags flags)
   return palloc_get_multiple (flags, 1);
 }
 
+/* Obtains a block of PTSPAN / PGSIZE free pages, 4 MB in all,
+   that starts on a 4 MB boundary in physical memory, so that a
+   single page directory entry can map it as a large page, and
+   returns its kernel virtual address.  FLAGS are as for
+   palloc_get_multiple().  Returns a null pointer if no such
+   block is free, which is likely once memory is fragmented.
+   The pages may be freed all at once or a few at a time. */
+void *
+palloc_get_large (enum palloc_flags flags) 
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  size_t page_cnt = PTSPAN / PGSIZE;
+  size_t page_idx = BITMAP_ERROR;
+  uint8_t *pages;
+
+  ASSERT (page_cnt == (size_t) 1 << BUDDY_MAX_ORDER);
+
+  if (palloc_buddy)
+    page_idx = buddy_alloc (pool, page_cnt);
+  else
+    {
+      size_t pool_pages = bitmap_size (pool->used_map);
+      size_t i;
+
+      lock_acquire (&pool->lock);
+      if (pool->zeroed_cnt > 0)
+        release_zeroed (pool);
+      for (i = (page_cnt - pool->skew) % page_cnt;
+           i + page_cnt <= pool_pages; i += page_cnt)
+        if (bitmap_none (pool->used_map, i, page_cnt)
+            && !in_fence (pool, i, page_cnt)
+            && bitmap_try_claim (pool->used_map, i, page_cnt))
+          {
+            page_idx = i;
+            break;
+          }
+      lock_release (&pool->lock);
+
+      if (page_idx == BITMAP_ERROR && pool == &user_pool)
+        page_idx = compact (page_cnt, (page_cnt - pool->skew) % page_cnt,
+                            page_cnt);
+    }
+
+  if (page_idx == BITMAP_ERROR)
+    {
+      if (flags & PAL_ASSERT)
+        PANIC ("palloc_get_large: out of pages");
+      return NULL;
+    }
+
+  pages = pool->base + PGSIZE * page_idx;
+  stats_sub (&pool->free_cnt, page_cnt);
+  if (flags & PAL_ZERO)
+    {
+      size_t i;
+
+      for (i = 0; i < page_cnt; i++)
+        clear_page (pages + PGSIZE * i);
+    }
+  return pages;
+}
+
 /* Frees the PAGE_CNT pages starting at PAGES. */
 void
 palloc_free_multiple (void *pages, size_t page_cnt) 
@@ -138,7 +463,65 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 #endif
 
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  stats_add (&pool->free_cnt, page_cnt);
+  if (palloc_buddy)
+    buddy_free (pool, page_idx, page_cnt);
+  else
+    bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+}
+
+/* Tries to extend the PAGE_CNT pages starting at PAGES, which
+   were allocated together, by the EXTRA_CNT pages that follow
+   them, without moving them.  Returns true if successful, false
+   if any of those pages is in use or outside the pool.  The
+   buddy backend, which would have to split the free blocks
+   around the new pages, never extends. */
+bool
+palloc_extend (void *pages, size_t page_cnt, size_t extra_cnt) 
+{
+  struct pool *pool;
+  size_t end_idx;
+  bool success = false;
+
+  ASSERT (pg_ofs (pages) == 0);
+  ASSERT (page_cnt > 0);
+
+  if (palloc_buddy)
+    return false;
+  if (page_from_pool (&kernel_pool, pages))
+    pool = &kernel_pool;
+  else if (page_from_pool (&user_pool, pages))
+    pool = &user_pool;
+  else
+    NOT_REACHED ();
+
+  end_idx = pg_no (pages) - pg_no (pool->base) + page_cnt;
+  lock_acquire (&pool->lock);
+  if (extra_cnt <= bitmap_size (pool->used_map) - end_idx
+      && !in_fence (pool, end_idx, extra_cnt))
+    success = bitmap_try_claim (pool->used_map, end_idx, extra_cnt);
+  lock_release (&pool->lock);
+
+  if (success)
+    stats_sub (&pool->free_cnt, extra_cnt);
+  return success;
+}
+
+/* Registers FUNC to be called when the kernel pool runs short of
+   pages. */
+void
+palloc_register_reclaim (palloc_reclaim_func *func) 
+{
+  ASSERT (reclaimer_cnt < RECLAIM_MAX);
+  reclaimers[reclaimer_cnt++] = func;
+}
+
+/* Registers FUNC to move frames out of the way when the user
+   pool is compacted. */
+void
+palloc_register_migrate (palloc_migrate_func *func) 
+{
+  migrate_func = func;
 }
 
 /* Frees the page at PAGE. */
@@ -148,35 +531,613 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
-/* Initializes pool P as starting at START and ending at END,
-   naming it NAME for debugging purposes. */
+/* Zeroes one free user page and sets it aside for a later
+   PAL_ZERO request.  Called by the idle thread, so it never
+   sleeps, and takes the page without the pool lock.  Returns
+   true if it zeroed a page, false if there is nothing to do. */
+bool
+palloc_prezero_page (void) 
+{
+  struct pool *pool = &user_pool;
+  enum intr_level old_level;
+  size_t page_idx;
+  void *page;
+
+  if (palloc_buddy || pool->zeroed_cnt >= ZEROED_MAX)
+    return false;
+  page_idx = claim_page (pool);
+  if (page_idx == BITMAP_ERROR)
+    return false;
+
+  page = pool->base + PGSIZE * page_idx;
+  clear_page (page);
+
+  old_level = intr_disable ();
+  if (pool->zeroed_cnt < ZEROED_MAX)
+    {
+      pool->zeroed[pool->zeroed_cnt++] = page;
+      page = NULL;
+    }
+  intr_set_level (old_level);
+
+  /* Lost a race to fill the last slot.  Just free the page,
+     which was never counted as allocated. */
+  if (page != NULL)
+    {
+      stats_sub (&pool->free_cnt, 1);
+      palloc_free_page (page);
+    }
+  return true;
+}
+
+/* Initializes pool P, with its bitmap in BM, to describe the
+   PAGE_CNT pages starting at BASE and to own the CNT of them
+   starting at index FIRST, naming it NAME for debugging
+   purposes. */
 static void
-init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
+init_pool (struct pool *p, void *bm, uint8_t *base, size_t page_cnt,
+           size_t first, size_t cnt, const char *name) 
+{
+  size_t avail_cnt, last, end;
+  unsigned order;
+
+  lock_init_named (&p->lock, "palloc");
+  p->used_map = bitmap_create_in_buf (page_cnt, bm,
+                                      bitmap_buf_size (page_cnt));
+  p->base = base;
+  p->skew = pg_no (p->base) % ((size_t) 1 << BUDDY_MAX_ORDER);
+  p->page_cnt = cnt;
+  p->reserve = cnt / 4;
+  for (order = 0; order <= BUDDY_MAX_ORDER; order++)
+    list_init (&p->free_lists[order]);
+
+  /* Free each run of usable pages that the pool owns, which the
+     buddy allocator takes as the largest aligned blocks that
+     fit. */
+  bitmap_set_all (p->used_map, true);
+  avail_cnt = 0;
+  last = first + cnt;
+  for (; first < last; first = end) 
+    {
+      bool usable = ram_usable (pg_no (p->base) + first);
+
+      for (end = first + 1; end < last; end++)
+        if (ram_usable (pg_no (p->base) + end) != usable)
+          break;
+      if (!usable)
+        continue;
+
+      avail_cnt += end - first;
+      if (palloc_buddy)
+        buddy_free (p, first, end - first);
+      else
+        bitmap_set_multiple (p->used_map, first, end - first, false);
+    }
+
+  stats_set (&p->free_cnt, avail_cnt);
+  printf ("%zu pages available in %s.\n", avail_cnt, name);
+}
+
+/* Returns true if physical page PAGE_NO lies entirely within
+   usable RAM, according to the BIOS memory map.  Without a map,
+   all pages are usable. */
+static bool
+ram_usable (size_t page_no) 
+{
+  uint64_t start = (uint64_t) page_no * PGSIZE;
+  uint64_t end = start + PGSIZE;
+  bool usable = init_mem_cnt == 0;
+  size_t i;
+
+  /* Ranges may overlap, in which case reserved wins. */
+  for (i = 0; i < init_mem_cnt; i++) 
+    {
+      const struct mem_range *r = &init_mem_map[i];
+
+      if (r->length == 0 || r->base >= end || r->base + r->length <= start)
+        continue;
+      if (r->type != MEM_RAM)
+        return false;
+      if (r->base <= start && end <= r->base + r->length)
+        usable = true;
+    }
+  return usable;
+}
+
+/* Takes a pre-zeroed page from POOL and returns it, or returns
+   a null pointer if there is none. */
+static void *
+pop_zeroed (struct pool *pool) 
+{
+  enum intr_level old_level = intr_disable ();
+  void *page = pool->zeroed_cnt > 0 ? pool->zeroed[--pool->zeroed_cnt] : NULL;
+  intr_set_level (old_level);
+  return page;
+}
+
+/* Returns all of POOL's pre-zeroed pages to its bitmap.  POOL's
+   lock must be held. */
+static void
+release_zeroed (struct pool *pool) 
+{
+  void *page;
+
+  ASSERT (lock_held_by_current_thread (&pool->lock));
+
+  while ((page = pop_zeroed (pool)) != NULL)
+    bitmap_reset (pool->used_map, pg_no (page) - pg_no (pool->base));
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL with the
+   selected backend and returns the index of the first one, or
+   BITMAP_ERROR if there is no such run of free pages.  A single
+   page comes from the bitmap without the pool lock if one is
+   free outside the fence. */
+static size_t
+alloc_pages (struct pool *pool, size_t page_cnt) 
+{
+  size_t page_idx;
+
+  if (palloc_buddy)
+    return buddy_alloc (pool, page_cnt);
+  if (page_cnt == 1)
+    {
+      page_idx = claim_page (pool);
+      if (page_idx != BITMAP_ERROR)
+        return page_idx;
+    }
+
+  lock_acquire (&pool->lock);
+  page_idx = scan_and_flip (pool, page_cnt);
+  if (page_idx == BITMAP_ERROR && pool->zeroed_cnt > 0)
+    {
+      /* Pre-zeroed pages are only set aside, not in use. */
+      release_zeroed (pool);
+      page_idx = scan_and_flip (pool, page_cnt);
+    }
+  lock_release (&pool->lock);
+  return page_idx;
+}
+
+/* Finds PAGE_CNT free pages in a row in POOL, outside its
+   fence, marks them used, and returns the index of the first
+   one, or BITMAP_ERROR if there is no such run.  POOL's lock must
+   be held. */
+static size_t
+scan_and_flip (struct pool *pool, size_t page_cnt) 
+{
+  size_t start = 0;
+
+  for (;;)
+    {
+      size_t page_idx = bitmap_scan (pool->used_map, start, page_cnt, false);
+
+      /* No run that starts later can end before the fence. */
+      if (page_idx != BITMAP_ERROR && in_fence (pool, page_idx, page_cnt))
+        page_idx = bitmap_scan (pool->used_map,
+                                pool->fence_start + pool->fence_cnt,
+                                page_cnt, false);
+      if (page_idx == BITMAP_ERROR
+          || bitmap_try_claim (pool->used_map, page_idx, page_cnt))
+        return page_idx;
+
+      /* claim_page() took one of the pages.  Look again. */
+      start = page_idx;
+    }
+}
+
+/* Takes a free page from POOL without its lock, and returns its
+   index, or BITMAP_ERROR if there is none or the page found lies
+   in the fence.  The page is claimed before the fence is
+   checked, so that compaction, which sets the fence and then
+   counts the pages in use, either sees the page as used or has
+   set the fence where this will see it, just as if the page had
+   been allocated under the lock. */
+static size_t
+claim_page (struct pool *pool) 
+{
+  size_t page_idx = bitmap_claim (pool->used_map, 0, 1);
+
+  if (page_idx != BITMAP_ERROR && in_fence (pool, page_idx, 1))
+    {
+      bitmap_reset (pool->used_map, page_idx);
+      page_idx = BITMAP_ERROR;
+    }
+  return page_idx;
+}
+
+/* Returns true if the PAGE_CNT pages starting at PAGE_IDX in
+   POOL overlap its fence. */
+static bool
+in_fence (const struct pool *pool, size_t page_idx, size_t page_cnt) 
+{
+  return (pool->fence_cnt > 0
+          && page_idx < pool->fence_start + pool->fence_cnt
+          && pool->fence_start < page_idx + page_cnt);
+}
+
+/* Calls the reclaim functions to give pages back to the kernel
+   pool.  Returns true if any of them freed a page. */
+static bool
+reclaim (void) 
+{
+  size_t freed = 0;
+  size_t i;
+
+  for (i = 0; i < reclaimer_cnt; i++)
+    freed += reclaimers[i] ();
+  return freed > 0;
+}
+
+/* Returns the chunk owner that stands for POOL. */
+static enum chunk_owner
+pool_owner (const struct pool *pool) 
+{
+  return pool == &kernel_pool ? OWNER_KERNEL : OWNER_USER;
+}
+
+/* Moves a chunk whose pages are all free from the other pool
+   into POOL, which has run out of pages.  Chunks that POOL lent
+   earlier come back first; after them, the other pool's own
+   chunks nearest the boundary between the two.  Returns true if
+   successful, false if the other pool has no such chunk or
+   cannot spare one, or if POOL is at its limit.  A chunk with
+   any page in use is never taken here; see
+   borrow_compacted_chunk() for the kernel pool's way around
+   that, which the user pool lacks.  The buddy
+   backend, whose free lists would need the chunk's blocks
+   unlinked, never lends. */
+static bool
+borrow_chunk (struct pool *pool) 
+{
+  struct pool *lender = pool == &kernel_pool ? &user_pool : &kernel_pool;
+  size_t chunk_cnt = bitmap_size (pool->used_map) / CHUNK_PAGES;
+  size_t chunk = BITMAP_ERROR;
+  size_t i;
+
+  if (palloc_buddy)
+    return false;
+
+  lock_acquire (&kernel_pool.lock);
+  lock_acquire (&user_pool.lock);
+  if (may_lend (lender, pool))
+    {
+      if (lender->zeroed_cnt > 0)
+        release_zeroed (lender);
+
+      /* The kernel pool's home chunks are the low ones, the user
+         pool's the high ones. */
+      for (i = 0; i < chunk_cnt; i++)
+        {
+          size_t c = pool == &kernel_pool ? i : chunk_cnt - 1 - i;
+          if (chunk_owners[c] == pool_owner (lender)
+              && bitmap_none (lender->used_map, c * CHUNK_PAGES,
+                              CHUNK_PAGES)
+              && !in_fence (lender, c * CHUNK_PAGES, CHUNK_PAGES))
+            {
+              chunk = c;
+              break;
+            }
+        }
+    }
+  if (chunk != BITMAP_ERROR && !move_chunk (lender, pool, chunk))
+    chunk = BITMAP_ERROR;
+  lock_release (&user_pool.lock);
+  lock_release (&kernel_pool.lock);
+  return chunk != BITMAP_ERROR;
+}
+
+/* Has compaction empty a chunk of the user pool and lends it to
+   the kernel pool.  Returns true if successful. */
+static bool
+borrow_compacted_chunk (void) 
+{
+  size_t page_idx;
+  bool success;
+
+  if (palloc_buddy || !may_lend (&user_pool, &kernel_pool))
+    return false;
+  page_idx = compact (CHUNK_PAGES, 0, CHUNK_PAGES);
+  if (page_idx == BITMAP_ERROR)
+    return false;
+
+  /* Compaction handed us the chunk's pages as allocated. */
+  lock_acquire (&kernel_pool.lock);
+  lock_acquire (&user_pool.lock);
+  bitmap_set_multiple (user_pool.used_map, page_idx, CHUNK_PAGES, false);
+  success = (may_lend (&user_pool, &kernel_pool)
+             && move_chunk (&user_pool, &kernel_pool,
+                            page_idx / CHUNK_PAGES));
+  lock_release (&user_pool.lock);
+  lock_release (&kernel_pool.lock);
+  return success;
+}
+
+/* Returns true if LENDER can lend POOL a chunk without going
+   below its reserve or taking POOL above its limit. */
+static bool
+may_lend (const struct pool *lender, const struct pool *pool) 
+{
+  return (lender->page_cnt >= lender->reserve + CHUNK_PAGES
+          && pool->page_cnt + CHUNK_PAGES <= pool->limit);
+}
+
+/* Moves CHUNK, whose pages were all found free, from LENDER to
+   POOL, and returns true, or returns false if claim_page() took
+   one of them meanwhile.  Both pools' locks must be held. */
+static bool
+move_chunk (struct pool *lender, struct pool *pool, size_t chunk) 
+{
+  enum intr_level old_level;
+
+  /* palloc_free_multiple() and claim_page() update bitmaps
+     without the lock, so claim the lender's pages atomically and
+     flip the bits with interrupts off. */
+  old_level = intr_disable ();
+  if (!bitmap_try_claim (lender->used_map, chunk * CHUNK_PAGES,
+                         CHUNK_PAGES))
+    {
+      intr_set_level (old_level);
+      return false;
+    }
+  bitmap_set_multiple (pool->used_map, chunk * CHUNK_PAGES,
+                       CHUNK_PAGES, false);
+  chunk_owners[chunk] = pool_owner (pool);
+  intr_set_level (old_level);
+
+  lender->page_cnt -= CHUNK_PAGES;
+  pool->page_cnt += CHUNK_PAGES;
+  stats_sub (&lender->free_cnt, CHUNK_PAGES);
+  stats_add (&pool->free_cnt, CHUNK_PAGES);
+  stats_inc (&lend_cnt);
+  return true;
+}
+
+/* Returns true if POOL owns all of the PAGE_CNT pages starting
+   at PAGE_IDX.  Within a chunk, the pool owns either all of them
+   or, in the chunk split at boot, those on its side of the
+   split, so checking each chunk's first and last page in the run
+   is enough. */
+static bool
+owns_run (const struct pool *pool, size_t page_idx, size_t page_cnt) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
-  if (bm_pages > page_cnt)
-    PANIC ("Not enough memory in %s for bitmap.", name);
-  page_cnt -= bm_pages;
+  size_t end = page_idx + page_cnt;
 
-  printf ("%zu pages available in %s.\n", page_cnt, name);
+  while (page_idx < end)
+    {
+      size_t next = ROUND_DOWN (page_idx, CHUNK_PAGES) + CHUNK_PAGES;
+      if (next > end)
+        next = end;
+      if (!page_from_pool (pool, pool->base + PGSIZE * page_idx)
+          || !page_from_pool (pool, pool->base + PGSIZE * (next - 1)))
+        return false;
+      page_idx = next;
+    }
+  return true;
+}
 
-  /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
-  p->base = base + bm_pages * PGSIZE;
+/* Compacts the user pool to get a run of PAGE_CNT free pages,
+   considering runs that start at FIRST and every STEP pages
+   after it.  Takes the run with the fewest pages in use, keeps
+   allocation out of it, has migrate_func move those pages
+   elsewhere, and, if that leaves the run free, allocates it.
+   Returns the index of the run's first page, or BITMAP_ERROR if
+   compaction is not possible or fails.  Only one thread
+   compacts at a time; another, or a nested call from the
+   migrate function's own allocations, fails at once. */
+static size_t
+compact (size_t page_cnt, size_t first, size_t step) 
+{
+  struct pool *pool = &user_pool;
+  size_t pool_pages = bitmap_size (pool->used_map);
+  size_t best = BITMAP_ERROR;
+  size_t best_used = page_cnt;
+  size_t page_idx = BITMAP_ERROR;
+  size_t i;
+
+  if (palloc_buddy || migrate_func == NULL
+      || lock_held_by_current_thread (&compact_lock)
+      || !lock_try_acquire (&compact_lock))
+    return BITMAP_ERROR;
+
+  lock_acquire (&pool->lock);
+  if (pool->zeroed_cnt > 0)
+    release_zeroed (pool);
+  for (i = first; i + page_cnt <= pool_pages; i += step)
+    if (owns_run (pool, i, page_cnt))
+      {
+        size_t used = bitmap_count (pool->used_map, i, page_cnt, true);
+        if (used < best_used)
+          {
+            best = i;
+            best_used = used;
+          }
+      }
+
+  /* The pages in use need somewhere to go outside the run. */
+  if (best != BITMAP_ERROR
+      && stats_get (&pool->free_cnt) >= page_cnt)
+    {
+      pool->fence_start = best;
+      pool->fence_cnt = page_cnt;
+    }
+  else
+    best = BITMAP_ERROR;
+  lock_release (&pool->lock);
+
+  if (best != BITMAP_ERROR)
+    {
+      bool moved = migrate_func (pool->base + PGSIZE * best, page_cnt);
+
+      lock_acquire (&pool->lock);
+      if (moved && bitmap_try_claim (pool->used_map, best, page_cnt))
+        page_idx = best;
+      pool->fence_cnt = 0;
+      lock_release (&pool->lock);
+    }
+
+  stats_inc (page_idx != BITMAP_ERROR ? &compact_cnt : &compact_fail_cnt);
+  lock_release (&compact_lock);
+  return page_idx;
 }
 
 /* Returns true if PAGE was allocated from POOL,
-   false otherwise. */
+   false otherwise.  A chunk changes owner only while all of its
+   pages are free, so this needs no lock. */
 static bool
 page_from_pool (const struct pool *pool, void *page) 
 {
-  size_t page_no = pg_no (page);
-  size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  size_t page_idx = pg_no (page) - pg_no (pool->base);
+  enum chunk_owner owner;
+
+  if (page_idx >= bitmap_size (pool->used_map))
+    return false;
+  owner = chunk_owners[page_idx / CHUNK_PAGES];
+  if (owner == OWNER_SPLIT)
+    owner = page_idx < split_idx ? OWNER_KERNEL : OWNER_USER;
+  return owner == pool_owner (pool);
+}
+
+/* Returns the header of the buddy block starting at page
+   PAGE_IDX in POOL. */
+static struct buddy_block *
+buddy_block_at (const struct pool *pool, size_t page_idx)
+{
+  return (struct buddy_block *) (pool->base + PGSIZE * page_idx);
+}
+
+/* Returns the smallest order whose blocks hold PAGE_CNT pages. */
+static unsigned
+buddy_order (size_t page_cnt)
+{
+  unsigned order = 0;
+
+  while ((size_t) 1 << order < page_cnt)
+    order++;
+  return order;
+}
+
+/* Frees the 2**ORDER pages starting at PAGE_IDX in POOL, whose
+   bits in the used map must still be set, merging the block
+   with its buddy for as long as the buddy is free too.  The
+   caller must disable interrupts. */
+static void
+buddy_free_block (struct pool *pool, size_t page_idx, unsigned order)
+{
+  size_t pool_pages = bitmap_size (pool->used_map);
+  struct buddy_block *b;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT ((page_idx + pool->skew) % ((size_t) 1 << order) == 0);
+
+  bitmap_set_multiple (pool->used_map, page_idx, (size_t) 1 << order, false);
+
+  /* A free first page of an aligned buddy always starts a free
+     block: a larger free block covering it would also cover
+     the block being freed.  Alignment is by physical page
+     number, so the buddy may start before the pool. */
+  while (order < BUDDY_MAX_ORDER)
+    {
+      size_t buddy_pg = (page_idx + pool->skew) ^ ((size_t) 1 << order);
+      size_t buddy_idx = buddy_pg - pool->skew;
+
+      if (buddy_pg < pool->skew
+          || buddy_idx + ((size_t) 1 << order) > pool_pages
+          || bitmap_test (pool->used_map, buddy_idx))
+        break;
+      b = buddy_block_at (pool, buddy_idx);
+      if (b->order != order)
+        break;
+
+      list_remove (&b->elem);
+      if (buddy_idx < page_idx)
+        page_idx = buddy_idx;
+      order++;
+    }
+
+  b = buddy_block_at (pool, page_idx);
+  b->order = order;
+  list_push_front (&pool->free_lists[order], &b->elem);
+}
+
+/* Frees the PAGE_CNT pages starting at PAGE_IDX in POOL, as the
+   largest aligned buddy blocks that make up the range. */
+static void
+buddy_free (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  enum intr_level old_level;
+
+  /* Pages are freed from thread_schedule_tail() with interrupts
+     off, so the free lists are protected by disabling interrupts
+     rather than by the pool lock.  Each operation touches at
+     most a few blocks per order. */
+  old_level = intr_disable ();
+  while (page_cnt > 0)
+    {
+      unsigned order = 0;
+
+      while (order < BUDDY_MAX_ORDER
+             && (page_idx + pool->skew) % ((size_t) 2 << order) == 0
+             && (size_t) 2 << order <= page_cnt)
+        order++;
+
+      buddy_free_block (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+  intr_set_level (old_level);
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL with the buddy
+   allocator and returns the index of the first one, or
+   BITMAP_ERROR if no free block is large enough.  The request is
+   carved from a block of the next power-of-two size and the
+   unused tail of that block is freed again. */
+static size_t
+buddy_alloc (struct pool *pool, size_t page_cnt)
+{
+  unsigned order = buddy_order (page_cnt);
+  enum intr_level old_level;
+  struct buddy_block *b;
+  size_t page_idx;
+  size_t block_pages;
+  unsigned k;
+
+  if (order > BUDDY_MAX_ORDER)
+    return BITMAP_ERROR;
+
+  old_level = intr_disable ();
+  for (k = order; k <= BUDDY_MAX_ORDER; k++)
+    if (!list_empty (&pool->free_lists[k]))
+      break;
+  if (k > BUDDY_MAX_ORDER)
+    {
+      intr_set_level (old_level);
+      return BITMAP_ERROR;
+    }
+
+  b = list_entry (list_pop_front (&pool->free_lists[k]),
+                  struct buddy_block, elem);
+  page_idx = ((uint8_t *) b - pool->base) / PGSIZE;
+
+  /* Split off upper halves until the block is the right size. */
+  while (k > order)
+    {
+      struct buddy_block *upper;
+
+      k--;
+      upper = buddy_block_at (pool, page_idx + ((size_t) 1 << k));
+      upper->order = k;
+      list_push_front (&pool->free_lists[k], &upper->elem);
+    }
+
+  block_pages = (size_t) 1 << order;
+  ASSERT (!bitmap_any (pool->used_map, page_idx, block_pages));
+  bitmap_set_multiple (pool->used_map, page_idx, block_pages, true);
+  intr_set_level (old_level);
+
+  if (block_pages > page_cnt)
+    buddy_free (pool, page_idx + page_cnt, block_pages - page_cnt);
 
-  return page_no >= start_page && page_no < end_page;
+  return page_idx;
 }
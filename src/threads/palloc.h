@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 /* How to allocate pages. */
@@ -11,10 +12,40 @@ enum palloc_flags
     PAL_USER = 004              /* User page. */
   };
 
+/* If true, use the buddy allocator instead of scanning the pool
+   bitmap.  Controlled by kernel command-line option "-buddy". */
+extern bool palloc_buddy;
+
+/* If true, pre-zero free user pages while idle.  Controlled by
+   kernel command-line option "-prezero". */
+extern bool palloc_prezero;
+
+/* Gives cached pages back to the kernel pool when it runs short.
+   Returns the number of pages freed.  Called with arbitrary locks
+   held, so it must only try to acquire locks, not wait for
+   them. */
+typedef size_t palloc_reclaim_func (void);
+
+/* Moves whatever occupies the PAGE_CNT pages of the user pool
+   starting at PAGES into other pages of the pool, for
+   compaction.  Returns true if it moved everything that it
+   found there.  Like a reclaim function, it may only try to
+   acquire locks. */
+typedef bool palloc_migrate_func (void *pages, size_t page_cnt);
+
+void *palloc_get_early (void);
 void palloc_init (size_t user_page_limit);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
+void *palloc_get_large (enum palloc_flags);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+bool palloc_extend (void *, size_t page_cnt, size_t extra_cnt);
+void palloc_register_reclaim (palloc_reclaim_func *);
+void palloc_register_migrate (palloc_migrate_func *);
+size_t palloc_free_cnt (enum palloc_flags);
+size_t palloc_page_cnt (void);
+size_t palloc_page_idx (const void *);
+bool palloc_prezero_page (void);
 
 #endif /* threads/palloc.h */
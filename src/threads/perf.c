@@ -0,0 +1,220 @@
+#include "threads/perf.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+
+/* Hardware performance counters.
+
+   With -perf, perf_init() programs one general-purpose counter of
+   the CPU's architectural performance monitoring (CPUID leaf 0xa)
+   for each event in enum perf_event, counting in kernel and user
+   mode alike, and leaves them running.  They are virtualized per
+   thread: on every switch, perf_switch() reads them and charges
+   what they advanced since the last switch to the thread that
+   was running, so that each thread's struct perf_counts holds
+   the events that happened while it ran.  Reading the counters
+   takes some tens of cycles per switch, so it is done only with
+   -perf.
+
+   Cycles, instructions retired and last-level cache misses are
+   architectural events, numbered the same on every CPU that
+   reports them.  There is no architectural event for TLB misses;
+   the one used here, DTLB_LOAD_MISSES.MISS_CAUSES_A_WALK, has
+   that number on Intel CPUs from Sandy Bridge on, and may count
+   something else on others.  An event that the CPU reports as
+   unavailable, or that no counter is left for, stays at 0.
+
+   Bochs, and QEMU without KVM, have no counters at all, and -perf
+   then does nothing. */
+
+/* Model-specific registers. */
+#define MSR_PMC0 0xc1                   /* First counter. */
+#define MSR_PERFEVTSEL0 0x186           /* Its event select register. */
+#define MSR_PERF_GLOBAL_CTRL 0x38f      /* Enables, from version 2. */
+
+/* Event select register bits. */
+#define EVTSEL_USR 0x10000              /* Count in user mode. */
+#define EVTSEL_OS 0x20000               /* Count in kernel mode. */
+#define EVTSEL_EN 0x400000              /* Enable. */
+
+/* How to count each event: its event number and unit mask, and
+   the bit in CPUID.0AH:EBX that says it is unavailable, or -1 if
+   it is not an architectural event. */
+static const struct
+  {
+    uint8_t event;
+    uint8_t umask;
+    int unavailable_bit;
+  }
+events[PERF_EVENT_CNT] =
+  {
+    [PERF_CYCLES] = {0x3c, 0x00, 0},
+    [PERF_INSTRUCTIONS] = {0xc0, 0x00, 1},
+    [PERF_LLC_MISSES] = {0x2e, 0x41, 4},
+    [PERF_DTLB_MISSES] = {0x08, 0x01, -1},
+  };
+
+/* Names of the events, for perf_exit(). */
+static const char *event_names[PERF_EVENT_CNT] =
+  {
+    [PERF_CYCLES] = "cycles",
+    [PERF_INSTRUCTIONS] = "instructions",
+    [PERF_LLC_MISSES] = "LLC misses",
+    [PERF_DTLB_MISSES] = "dTLB misses",
+  };
+
+bool perf_enabled;
+bool perf_print_exit;
+
+/* Counter for each event, or -1 if the event is not counted. */
+static int counters[PERF_EVENT_CNT];
+
+/* Mask of the bits that the counters implement. */
+static uint64_t counter_mask;
+
+/* Each counter's value at the last switch. */
+static uint64_t last[PERF_EVENT_CNT];
+
+/* Writes VALUE to model-specific register MSR. */
+static inline void
+wrmsr (uint32_t msr, uint64_t value) 
+{
+  asm volatile ("wrmsr" : : "c" (msr), "A" (value));
+}
+
+/* Returns the value of counter IDX. */
+static inline uint64_t
+rdpmc (int idx)
+{
+  uint64_t value;
+  asm volatile ("rdpmc" : "=A" (value) : "c" (idx));
+  return value;
+}
+
+/* Returns CPUID leaf LEAF in *EAX to *EDX. */
+static void
+cpuid (uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx,
+       uint32_t *edx)
+{
+  asm ("cpuid" : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+       : "a" (leaf), "c" (0));
+}
+
+/* Programs and starts the counters, if -perf was given and the
+   CPU has them. */
+void
+perf_init (void)
+{
+  uint32_t eax, ebx, ecx, edx;
+  unsigned version, counter_cnt, width, ebx_len;
+  int e, used = 0;
+
+  if (!perf_enabled)
+    return;
+
+  cpuid (0, &eax, &ebx, &ecx, &edx);
+  if (eax >= 0xa)
+    cpuid (0xa, &eax, &ebx, &ecx, &edx);
+  else
+    eax = 0;
+  version = eax & 0xff;
+  counter_cnt = (eax >> 8) & 0xff;
+  width = (eax >> 16) & 0xff;
+  ebx_len = eax >> 24;
+  if (version == 0 || counter_cnt == 0)
+    {
+      printf ("Perf: no performance counters.\n");
+      perf_enabled = perf_print_exit = false;
+      return;
+    }
+  counter_mask = width < 64 ? ((uint64_t) 1 << width) - 1 : UINT64_MAX;
+
+  for (e = 0; e < PERF_EVENT_CNT; e++)
+    {
+      int bit = events[e].unavailable_bit;
+
+      counters[e] = -1;
+      if ((bit >= 0 && ((unsigned) bit >= ebx_len || (ebx & (1u << bit))))
+          || (unsigned) used >= counter_cnt)
+        continue;
+
+      counters[e] = used++;
+      wrmsr (MSR_PERFEVTSEL0 + counters[e], 0);
+      wrmsr (MSR_PMC0 + counters[e], 0);
+      wrmsr (MSR_PERFEVTSEL0 + counters[e],
+             (events[e].event | (events[e].umask << 8)
+              | EVTSEL_USR | EVTSEL_OS | EVTSEL_EN));
+      last[e] = 0;
+    }
+  if (version >= 2)
+    wrmsr (MSR_PERF_GLOBAL_CTRL, ((uint64_t) 1 << used) - 1);
+
+  printf ("Perf: counting %d of %d events with %u-bit counters.\n",
+          used, PERF_EVENT_CNT, width);
+}
+
+/* Charges the events counted since the last switch to T.
+   Interrupts must be off. */
+static void
+charge (struct thread *t)
+{
+  int e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = 0; e < PERF_EVENT_CNT; e++)
+    if (counters[e] >= 0)
+      {
+        uint64_t now = rdpmc (counters[e]);
+        t->perf.counts[e] += (now - last[e]) & counter_mask;
+        last[e] = now;
+      }
+}
+
+/* Called by thread_schedule_tail() after a switch away from
+   PREV, with interrupts off.  Charges PREV for the events
+   counted while it ran. */
+void
+perf_switch (struct thread *prev)
+{
+  if (perf_enabled)
+    charge (prev);
+}
+
+/* Stores the running thread's counts into *PC.  Returns false,
+   with *PC all zero, if there are no counters. */
+bool
+perf_read (struct perf_counts *pc)
+{
+  enum intr_level old_level;
+
+  if (!perf_enabled)
+    {
+      *pc = (struct perf_counts) {{0}};
+      return false;
+    }
+  old_level = intr_disable ();
+  charge (thread_current ());
+  *pc = thread_current ()->perf;
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Called as the running thread exits.  With -perf=exit, prints
+   its counts. */
+void
+perf_exit (void)
+{
+  struct perf_counts pc;
+  int e;
+
+  if (!perf_print_exit || !perf_read (&pc))
+    return;
+  printf ("%s: perf:", thread_name ());
+  for (e = 0; e < PERF_EVENT_CNT; e++)
+    printf ("%s %"PRIu64" %s", e > 0 ? "," : "", pc.counts[e],
+            event_names[e]);
+  printf ("\n");
+}
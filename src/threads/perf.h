@@ -0,0 +1,39 @@
+#ifndef THREADS_PERF_H
+#define THREADS_PERF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct thread;
+
+/* Hardware performance counters.  See perf.c for details. */
+
+/* Events counted. */
+enum perf_event
+  {
+    PERF_CYCLES,                /* Unhalted core cycles. */
+    PERF_INSTRUCTIONS,          /* Instructions retired. */
+    PERF_LLC_MISSES,            /* Last-level cache misses. */
+    PERF_DTLB_MISSES,           /* Data TLB misses that walk the page
+                                   tables. */
+    PERF_EVENT_CNT              /* Number of events. */
+  };
+
+/* Counts of each event.  Laid out like `struct perf_counts' in
+   lib/user/syscall.h. */
+struct perf_counts
+  {
+    uint64_t counts[PERF_EVENT_CNT];
+  };
+
+/* -perf: Count events for each thread?  -perf=exit also prints
+   each thread's counts when it exits. */
+extern bool perf_enabled;
+extern bool perf_print_exit;
+
+void perf_init (void);
+void perf_switch (struct thread *prev);
+bool perf_read (struct perf_counts *);
+void perf_exit (void);
+
+#endif /* threads/perf.h */
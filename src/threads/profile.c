@@ -0,0 +1,226 @@
+#include "threads/profile.h"
+#include <debug.h>
+#include <hash.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/rtc.h"
+#include "devices/timer.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Sampling profiler.
+
+   With -profile, each timer tick looks at the code that it
+   interrupted and counts one sample for its EIP, in kernel or in
+   user mode.  -profile=DEPTH also follows up to DEPTH saved
+   frame pointers, in the same way as debug_backtrace(), so that
+   a sample tells which caller the time was spent for.  Only
+   kernel code is followed: the kernel cannot safely read user
+   stacks from an interrupt handler.
+
+   TIMER_FREQ samples a second take a long run to say much, so
+   -profile-hz=HZ samples with the RTC's periodic interrupt
+   instead, at up to 8192 Hz.  That also keeps sampling while the
+   timer sleeps under -tickless, which would otherwise hide idle
+   time.
+
+   Samples with the same EIP and callers share one slot in an
+   open-addressed hash table of PROFILE_PAGES pages, which needs
+   no allocation in the interrupt handler; once full, further
+   new stacks are only counted as lost.  profile_print() prints
+   each slot at shutdown as a "Profile:" line that the
+   `backtrace' utility accepts as it is. */
+
+/* Pages taken by the sample table. */
+#define PROFILE_PAGES 16
+
+/* Samples printed, for kernel and for user code each. */
+#define PROFILE_TOP 40
+
+/* A distinct call stack, and how often it was sampled. */
+struct sample
+  {
+    uint32_t count;                     /* Samples; 0 if slot free. */
+    bool user;                          /* User EIP? */
+    uint8_t depth;                      /* Entries used in PC[]. */
+    uint32_t pc[PROFILE_DEPTH_MAX + 1]; /* EIP, then return addresses. */
+  };
+
+/* Number of slots in the table. */
+#define SAMPLE_CNT (PROFILE_PAGES * PGSIZE / sizeof (struct sample))
+
+bool profile_enabled;
+unsigned profile_depth;
+unsigned profile_hz;
+
+/* Sample table, and counts of samples. */
+static struct sample *samples;
+static unsigned total_cnt, user_cnt, lost_cnt;
+
+/* True when sampling, with the timer or else with the RTC. */
+static bool sampling;
+static bool sample_on_tick;
+
+/* Actual sampling rate. */
+static unsigned sample_hz;
+
+static intr_handler_func take_sample;
+
+/* Allocates the sample table and starts sampling, if -profile
+   was given.  Must be called after the timer and the page
+   allocator are set up. */
+void
+profile_init (void)
+{
+  if (!profile_enabled)
+    return;
+
+  if (profile_depth > PROFILE_DEPTH_MAX)
+    profile_depth = PROFILE_DEPTH_MAX;
+  samples = palloc_get_multiple (PAL_ASSERT | PAL_ZERO, PROFILE_PAGES);
+  if (profile_hz != 0)
+    sample_hz = rtc_start_periodic (profile_hz, take_sample);
+  else
+    {
+      sample_hz = TIMER_FREQ;
+      sample_on_tick = true;
+    }
+  sampling = true;
+  printf ("Profiling at %u Hz, %u frames deep.\n",
+          sample_hz, profile_depth);
+}
+
+/* Called by the timer interrupt handler at each timer tick, with
+   the frame of the code it interrupted. */
+void
+profile_tick (struct intr_frame *f)
+{
+  if (sample_on_tick && sampling)
+    take_sample (f);
+}
+
+/* Stores into S the call stack of the code that F interrupted. */
+static void
+get_stack (const struct intr_frame *f, struct sample *s)
+{
+  uint32_t *page = pg_round_down (f);
+  uint32_t *frame = (uint32_t *) f->ebp;
+
+  s->user = is_user_vaddr ((void *) f->eip);
+  s->pc[0] = (uint32_t) f->eip;
+  s->depth = 1;
+  if (s->user)
+    return;
+
+  /* Kernel frames are all on the interrupted thread's stack, the
+     page F is in, each above the one it was called from. */
+  while (s->depth <= profile_depth
+         && pg_round_down (frame) == page
+         && pg_round_down (frame + 1) == page
+         && frame[1] != 0)
+    {
+      uint32_t *next = (uint32_t *) frame[0];
+
+      s->pc[s->depth++] = frame[1];
+      if (next <= frame)
+        break;
+      frame = next;
+    }
+}
+
+/* Counts one sample of the code that F interrupted. */
+static void
+take_sample (struct intr_frame *f)
+{
+  struct sample s;
+  size_t size, i, probes;
+
+  if (!sampling)
+    return;
+
+  get_stack (f, &s);
+  size = s.depth * sizeof *s.pc;
+  total_cnt++;
+  if (s.user)
+    user_cnt++;
+
+  i = hash_bytes (s.pc, size) % SAMPLE_CNT;
+  for (probes = 0; probes < SAMPLE_CNT; probes++)
+    {
+      struct sample *slot = &samples[i];
+
+      if (slot->count == 0)
+        {
+          memcpy (slot, &s, sizeof s);
+          slot->count = 1;
+          return;
+        }
+      if (slot->user == s.user && slot->depth == s.depth
+          && !memcmp (slot->pc, s.pc, size))
+        {
+          slot->count++;
+          return;
+        }
+      if (++i >= SAMPLE_CNT)
+        i = 0;
+    }
+  lost_cnt++;
+}
+
+/* Orders samples by decreasing count. */
+static int
+compare_samples (const void *a_, const void *b_)
+{
+  const struct sample *a = a_;
+  const struct sample *b = b_;
+
+  return a->count < b->count ? 1 : a->count > b->count ? -1 : 0;
+}
+
+/* Prints the PROFILE_TOP most sampled call stacks of user code
+   if USER is true, otherwise of kernel code, from the CNT
+   samples in SORTED. */
+static void
+print_samples (const struct sample *sorted, size_t cnt, bool user)
+{
+  size_t i, printed = 0;
+
+  printf ("Profile: %s code, most sampled first:\n",
+          user ? "user" : "kernel");
+  for (i = 0; i < cnt && printed < PROFILE_TOP; i++)
+    if (sorted[i].user == user)
+      {
+        int j;
+
+        printf ("Profile: %"PRIu32, sorted[i].count);
+        for (j = 0; j < sorted[i].depth; j++)
+          printf (" %#"PRIx32, sorted[i].pc[j]);
+        printf ("\n");
+        printed++;
+      }
+}
+
+/* Stops sampling and prints the profile. */
+void
+profile_print (void)
+{
+  size_t cnt, i;
+
+  if (!sampling)
+    return;
+  sampling = false;
+
+  /* Gather the used slots at the front and sort them. */
+  for (cnt = i = 0; i < SAMPLE_CNT; i++)
+    if (samples[i].count != 0)
+      samples[cnt++] = samples[i];
+  qsort (samples, cnt, sizeof *samples, compare_samples);
+
+  printf ("Profile: %u samples at %u Hz, %u kernel, %u user, "
+          "%u lost\n", total_cnt, sample_hz, total_cnt - user_cnt,
+          user_cnt, lost_cnt);
+  print_samples (samples, cnt, false);
+  print_samples (samples, cnt, true);
+}
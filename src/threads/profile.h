@@ -0,0 +1,24 @@
+#ifndef THREADS_PROFILE_H
+#define THREADS_PROFILE_H
+
+#include <stdbool.h>
+#include "threads/interrupt.h"
+
+/* Sampling profiler.  See profile.c for details. */
+
+/* Most calling frames recorded with each sample. */
+#define PROFILE_DEPTH_MAX 6
+
+/* -profile: Sample the running code?  -profile=DEPTH also
+   records up to DEPTH calling frames of kernel code.
+   -profile-hz: Samples per second, or 0 to sample at each timer
+   tick. */
+extern bool profile_enabled;
+extern unsigned profile_depth;
+extern unsigned profile_hz;
+
+void profile_init (void);
+void profile_tick (struct intr_frame *);
+void profile_print (void);
+
+#endif /* threads/profile.h */
@@ -0,0 +1,196 @@
+#include "threads/rcu.h"
+#include <debug.h>
+#include "threads/interrupt.h"
+#include "threads/stats.h"
+#include "threads/thread.h"
+#include "threads/work.h"
+
+/* Read-copy-update.
+
+   Some tables, like the directory entry cache, are looked up far
+   more often than they change.  Instead of taking a lock, which
+   every reader writes to, a reader brackets its lookup with
+   rcu_read_lock() and rcu_read_unlock() and follows pointers
+   with rcu_dereference().  A writer, still serialized with other
+   writers by a lock, publishes a new object with
+   rcu_assign_pointer() once the object is initialized, and
+   unlinks an old one where readers can no longer find it, but
+   frees it only through call_rcu(), once every reader that could
+   have found it is done.
+
+   A read-side critical section must not sleep or yield.  With
+   that rule, and with preemption held off meanwhile, a thread
+   that gets off the CPU is outside any critical section.  This
+   kernel has a single CPU, so once the CPU has switched threads,
+   every critical section that was under way before the switch
+   has ended, and that is a grace period.  call_rcu() notes the
+   number of context switches so far, and its callback runs in
+   a worker thread once the count has moved on.  Readers thus
+   write nothing shared: rcu_read_lock() only counts up a member
+   of the running thread.
+
+   A timer interrupt that would preempt a reader leaves the
+   reader running; rcu_read_unlock() yields once the outermost
+   critical section ends. */
+
+/* Callbacks waiting for their grace period, oldest first.
+   Protected by turning off interrupts, so that call_rcu() may be
+   called from an interrupt handler. */
+static struct list callbacks = LIST_INITIALIZER (callbacks);
+
+/* Number of context switches. */
+static unsigned switch_cnt;
+
+/* Runs callbacks. */
+static struct work rcu_work;
+static work_func rcu_job;
+
+/* Callbacks run. */
+static struct stats_counter callback_cnt;
+
+/* Initializes read-copy-update. */
+void
+rcu_init (void)
+{
+  work_init (&rcu_work, rcu_job, NULL);
+  stats_register (&callback_cnt, "rcu", "callbacks", STATS_COUNTER);
+}
+
+/* Enters a read-side critical section.  Critical sections may
+   nest. */
+void
+rcu_read_lock (void)
+{
+  thread_current ()->rcu_depth++;
+  barrier ();
+}
+
+/* Leaves a read-side critical section.  Yields if an interrupt
+   tried to preempt the thread while in the outermost one. */
+void
+rcu_read_unlock (void)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (cur->rcu_depth > 0);
+
+  barrier ();
+  if (--cur->rcu_depth == 0 && cur->rcu_yield)
+    {
+      cur->rcu_yield = false;
+      if (intr_context ())
+        intr_yield_on_return ();
+      else
+        thread_yield ();
+    }
+}
+
+/* Called on return from an interrupt that would preempt the
+   running thread.  If the thread is in a read-side critical
+   section, notes that it should yield at the end of it and
+   returns true; otherwise returns false. */
+bool
+rcu_defer_preemption (void)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (cur->rcu_depth == 0)
+    return false;
+  cur->rcu_yield = true;
+  return true;
+}
+
+/* Called by the scheduler for each context switch, with
+   interrupts off. */
+void
+rcu_note_switch (void)
+{
+  switch_cnt++;
+}
+
+/* Has FUNC(HEAD) run by a worker thread once a grace period has
+   passed, that is, once every read-side critical section under
+   way now has ended.  May be called from an interrupt
+   handler. */
+void
+call_rcu (struct rcu_head *head, rcu_func *func)
+{
+  enum intr_level old_level;
+
+  head->func = func;
+  old_level = intr_disable ();
+  head->switch_cnt = switch_cnt;
+  list_push_back (&callbacks, &head->elem);
+  intr_set_level (old_level);
+  work_queue (&rcu_work);
+}
+
+/* Waiter in synchronize_rcu(). */
+struct rcu_sync
+  {
+    struct rcu_head head;       /* Queued with call_rcu(). */
+    struct semaphore done;      /* Upped by the callback. */
+  };
+
+/* Wakes the thread in synchronize_rcu() that queued HEAD. */
+static void
+sync_done (struct rcu_head *head)
+{
+  struct rcu_sync *sync = rcu_entry (head, struct rcu_sync, head);
+  sema_up (&sync->done);
+}
+
+/* Waits until a grace period has passed.  Must not be called
+   within a read-side critical section, or from an interrupt
+   handler. */
+void
+synchronize_rcu (void)
+{
+  struct rcu_sync sync;
+
+  ASSERT (!intr_context ());
+  ASSERT (thread_current ()->rcu_depth == 0);
+
+  sema_init (&sync.done, 0);
+  call_rcu (&sync.head, sync_done);
+  sema_down (&sync.done);
+}
+
+/* Runs the callbacks whose grace period has passed.  Requeues
+   itself for the next tick if any are left, which happens only
+   for callbacks queued by the worker thread running this
+   function, since for any other thread the switch to the worker
+   ended the grace period. */
+static void
+rcu_job (void *aux UNUSED)
+{
+  for (;;)
+    {
+      enum intr_level old_level;
+      struct rcu_head *head = NULL;
+      bool waiting;
+
+      old_level = intr_disable ();
+      if (!list_empty (&callbacks))
+        {
+          head = list_entry (list_front (&callbacks), struct rcu_head, elem);
+          if (head->switch_cnt != switch_cnt)
+            list_pop_front (&callbacks);
+          else
+            head = NULL;
+        }
+      waiting = !list_empty (&callbacks);
+      intr_set_level (old_level);
+
+      if (head == NULL)
+        {
+          if (waiting)
+            work_queue_delayed (&rcu_work, 1);
+          return;
+        }
+      head->func (head);
+      stats_inc (&callback_cnt);
+    }
+}
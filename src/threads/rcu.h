@@ -0,0 +1,59 @@
+#ifndef THREADS_RCU_H
+#define THREADS_RCU_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "threads/synch.h"
+
+/* Read-copy-update.  See rcu.c for details. */
+
+struct rcu_head;
+
+/* Function run for a struct rcu_head once a grace period has
+   passed, usually to free the object that contains it.  It runs
+   in a worker thread and may sleep. */
+typedef void rcu_func (struct rcu_head *);
+
+/* Member of an object whose freeing waits for a grace period. */
+struct rcu_head
+  {
+    struct list_elem elem;      /* In the list of callbacks. */
+    rcu_func *func;             /* Function to run. */
+    unsigned switch_cnt;        /* Context switches when queued. */
+  };
+
+/* Converts pointer to rcu_head HEAD into a pointer to the
+   structure that HEAD is embedded inside.  Supply the name of
+   the outer structure STRUCT and the member name MEMBER of
+   HEAD. */
+#define rcu_entry(HEAD, STRUCT, MEMBER)                         \
+        ((STRUCT *) ((uint8_t *) (HEAD)                         \
+                     - offsetof (STRUCT, MEMBER)))
+
+/* Returns the value of pointer P, which writers may change
+   concurrently with rcu_assign_pointer(), for a reader to follow
+   within a read-side critical section. */
+#define rcu_dereference(P) (*(volatile __typeof__ (P) *) &(P))
+
+/* Sets pointer P to V, an object whose members have all been
+   initialized, so that a reader that finds V through P sees them
+   initialized. */
+#define rcu_assign_pointer(P, V)                \
+        do                                      \
+          {                                     \
+            barrier ();                         \
+            (P) = (V);                          \
+          }                                     \
+        while (0)
+
+void rcu_init (void);
+void rcu_read_lock (void);
+void rcu_read_unlock (void);
+bool rcu_defer_preemption (void);
+void rcu_note_switch (void);
+void call_rcu (struct rcu_head *, rcu_func *);
+void synchronize_rcu (void);
+
+#endif /* threads/rcu.h */
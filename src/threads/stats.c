@@ -0,0 +1,121 @@
+#include "threads/stats.h"
+#include <debug.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+
+/* Kernel statistics registry.
+
+   Each subsystem keeps its counters and gauges in struct
+   stats_counter objects, registers them with stats_register()
+   when it initializes, and updates them with stats_inc(),
+   stats_add() and stats_sub(), which take no lock and do not
+   touch the interrupt level, so they cost no more in a hot path
+   than the plain integers they replace.  stats_print() dumps
+   every registered statistic at shutdown, and stats_read() lets
+   the SYS_STATS system call hand them to user programs one at a
+   time.
+
+   A 64-bit update is two instructions on the 80x86.  Readers
+   turn off interrupts, so they never see half of an update made
+   by an interrupt handler, but a thread preempted between the
+   two instructions leaves a carry out of the low word pending
+   until it runs again.  That matters only to a counter that
+   passes a multiple of 2**32 while a reader looks at it.
+
+   Statistics are never unregistered, so each must live as long
+   as the kernel does. */
+
+/* All registered statistics, in order of registration. */
+static struct list registry = LIST_INITIALIZER (registry);
+
+/* Registers C under GROUP and NAME as a statistic of the given
+   KIND.  C keeps whatever was counted in it before, so a static
+   counter may be updated before its module registers it.  GROUP
+   and NAME must not be freed. */
+void
+stats_register (struct stats_counter *c, const char *group,
+                const char *name, enum stats_kind kind)
+{
+  enum intr_level old_level;
+
+  ASSERT (c != NULL);
+  ASSERT (group != NULL && name != NULL);
+
+  c->group = group;
+  c->name = name;
+  c->kind = kind;
+
+  old_level = intr_disable ();
+  list_push_back (&registry, &c->elem);
+  intr_set_level (old_level);
+}
+
+/* Returns the value of C. */
+uint64_t
+stats_get (const struct stats_counter *c)
+{
+  enum intr_level old_level;
+  uint64_t value;
+
+  old_level = intr_disable ();
+  value = c->u.value;
+  intr_set_level (old_level);
+  return value;
+}
+
+/* Sets gauge C to VALUE. */
+void
+stats_set (struct stats_counter *c, uint64_t value)
+{
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  c->u.value = value;
+  intr_set_level (old_level);
+}
+
+/* Stores the name, as "group.name", the value and the kind of
+   the IDX'th registered statistic in NAME, *VALUE and *KIND, and
+   returns true, or returns false if fewer than IDX + 1
+   statistics are registered.  KIND may be a null pointer. */
+bool
+stats_read (unsigned idx, char name[STATS_NAME_MAX + 1],
+            uint64_t *value, enum stats_kind *kind)
+{
+  struct stats_counter *c = NULL;
+  enum intr_level old_level;
+  struct list_elem *e;
+
+  old_level = intr_disable ();
+  for (e = list_begin (&registry); e != list_end (&registry);
+       e = list_next (e))
+    if (idx-- == 0)
+      {
+        c = list_entry (e, struct stats_counter, elem);
+        *value = c->u.value;
+        break;
+      }
+  intr_set_level (old_level);
+
+  if (c == NULL)
+    return false;
+  snprintf (name, STATS_NAME_MAX + 1, "%s.%s", c->group, c->name);
+  if (kind != NULL)
+    *kind = c->kind;
+  return true;
+}
+
+/* Prints every registered statistic. */
+void
+stats_print (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&registry); e != list_end (&registry);
+       e = list_next (e))
+    {
+      struct stats_counter *c = list_entry (e, struct stats_counter, elem);
+      printf ("Stats: %s.%s %llu%s\n", c->group, c->name, stats_get (c),
+              c->kind == STATS_GAUGE ? " (gauge)" : "");
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef THREADS_STATS_H
+#define THREADS_STATS_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Kernel statistics.  See stats.c for details. */
+
+/* What a statistic measures. */
+enum stats_kind
+  {
+    STATS_COUNTER,              /* Events so far; only ever rises. */
+    STATS_GAUGE                 /* A level that rises and falls. */
+  };
+
+/* A named statistic.  Usually a static object in the module that
+   updates it, registered by that module's initialization. */
+struct stats_counter
+  {
+    union
+      {
+        uint64_t value;         /* Current value. */
+        uint32_t half[2];       /* VALUE as low and high words. */
+      } u;
+    const char *group;          /* Subsystem, e.g. "thread". */
+    const char *name;           /* Statistic within GROUP. */
+    enum stats_kind kind;       /* Counter or gauge. */
+    struct list_elem elem;      /* Element in the registry. */
+  };
+
+/* Longest "group.name" that stats_read() reports, not counting
+   the null terminator. */
+#define STATS_NAME_MAX 31
+
+void stats_register (struct stats_counter *, const char *group,
+                     const char *name, enum stats_kind);
+uint64_t stats_get (const struct stats_counter *);
+void stats_set (struct stats_counter *, uint64_t);
+bool stats_read (unsigned idx, char name[STATS_NAME_MAX + 1],
+                 uint64_t *value, enum stats_kind *);
+void stats_print (void);
+
+/* Adds N to C.  The carry into the high word is a second
+   instruction, but each instruction updates memory in place, so
+   an interrupt handler that updates C between them loses
+   nothing. */
+static inline void
+stats_add (struct stats_counter *c, uint32_t n)
+{
+  asm volatile ("addl %2, %0; adcl $0, %1"
+                : "+m" (c->u.half[0]), "+m" (c->u.half[1])
+                : "ri" (n)
+                : "cc");
+}
+
+/* Subtracts N from gauge C, in the same way as stats_add(). */
+static inline void
+stats_sub (struct stats_counter *c, uint32_t n)
+{
+  asm volatile ("subl %2, %0; sbbl $0, %1"
+                : "+m" (c->u.half[0]), "+m" (c->u.half[1])
+                : "ri" (n)
+                : "cc");
+}
+
+/* Adds 1 to C. */
+static inline void
+stats_inc (struct stats_counter *c)
+{
+  stats_add (c, 1);
+}
+
+#endif /* threads/stats.h */
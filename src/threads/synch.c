@@ -31,6 +31,93 @@
 #include <string.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
+#include "devices/timer.h"
+
+/* Waiters on semaphores and condition variables are kept in
+   heaps, so that waking the highest-priority waiter does not
+   mean searching all of them.  Waiters of equal priority are
+   woken in the order they started waiting, told apart by a
+   sequence number from wait_seq. */
+static unsigned wait_seq;
+
+static heap_less_func waiter_less;
+static heap_less_func cond_waiter_less;
+
+/* Returns a sequence number for a new waiter. */
+static unsigned
+next_wait_seq (void)
+{
+  enum intr_level old_level = intr_disable ();
+  unsigned seq = wait_seq++;
+  intr_set_level (old_level);
+  return seq;
+}
+
+/* Returns true if a waiter with priority A_PRIORITY and sequence
+   number A_SEQ should be woken after one with B_PRIORITY and
+   B_SEQ. */
+static inline bool
+wakes_after (int a_priority, unsigned a_seq, int b_priority, unsigned b_seq)
+{
+  if (a_priority != b_priority)
+    return a_priority < b_priority;
+  return (int) (a_seq - b_seq) > 0;
+}
+
+/* Puts the current thread on SEMA's wait list.  Interrupts must
+   be off. */
+static void
+enqueue_waiter (struct semaphore *sema)
+{
+  struct thread *cur = thread_current ();
+
+  cur->wait_sema = sema;
+  cur->wait_seq = wait_seq++;
+  heap_push (&sema->waiters, &cur->wait_elem);
+}
+
+/* Puts the current thread on SEMA's wait list and blocks it.
+   Interrupts must be off. */
+static void
+wait_on (struct semaphore *sema)
+{
+  enqueue_waiter (sema);
+  trace (TRACE_SYNCH, TRACE_SEMA_WAIT, (uint32_t) sema, 0);
+  thread_block ();
+}
+
+/* Puts the current thread on LOCK's wait list, has it donate its
+   priority to LOCK's holder, and blocks it until lock_release()
+   hands it LOCK or, in lock_acquire_timeout(), its deadline
+   passes.  Interrupts must be off. */
+static void
+wait_on_lock (struct lock *lock)
+{
+  struct thread *cur = thread_current ();
+
+  enqueue_waiter (&lock->semaphore);
+  cur->required_lock = lock;
+  if (!thread_mlfqs)
+    thread_donate_priority (cur);
+  trace (TRACE_SYNCH, TRACE_LOCK_WAIT, (uint32_t) lock,
+         lock->holder != NULL ? lock->holder->tid : 0);
+  thread_block ();
+}
+
+/* Takes the highest-priority thread off SEMA's wait list, which
+   must not be empty, unblocks it and returns it.  Interrupts
+   must be off. */
+static struct thread *
+wake_waiter (struct semaphore *sema)
+{
+  struct thread *t = heap_entry (heap_pop (&sema->waiters),
+                                 struct thread, wait_elem);
+
+  t->wait_sema = NULL;
+  thread_unblock (t);
+  return t;
+}
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
@@ -47,7 +134,7 @@ sema_init (struct semaphore *sema, unsigned value)
   ASSERT (sema != NULL);
 
   sema->value = value;
-  list_init (&sema->waiters);
+  heap_init (&sema->waiters, waiter_less, NULL);
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
@@ -67,10 +154,7 @@ sema_down (struct semaphore *sema)
 
   old_level = intr_disable ();
   while (sema->value == 0) 
-    {
-      list_push_back (&sema->waiters, &thread_current ()->elem);
-      thread_block ();
-    }
+    wait_on (sema);
   sema->value--;
   intr_set_level (old_level);
 }
@@ -101,30 +185,123 @@ sema_try_down (struct semaphore *sema)
   return success;
 }
 
+/* A thread waiting in sema_down_timeout(). */
+struct sema_timeout
+  {
+    struct thread *thread;      /* The waiting thread. */
+    bool timed_out;             /* Set when the deadline passes. */
+  };
+
+/* Timer event function for sema_down_timeout().  If the waiter is
+   still blocked on the semaphore, takes it off the semaphore's
+   wait list and puts it back on the run queue. */
+static void
+sema_timeout_expire (void *waiter_)
+{
+  struct sema_timeout *waiter = waiter_;
+  struct thread *t = waiter->thread;
+
+  /* A waiter that sema_up() has already woken is no longer on
+     the wait list. */
+  if (t->wait_sema != NULL)
+    {
+      waiter->timed_out = true;
+      heap_remove (&t->wait_sema->waiters, &t->wait_elem);
+      t->wait_sema = NULL;
+      thread_unblock (t);
+      thread_max_yield ();
+    }
+}
+
+/* Down or "P" operation on a semaphore that gives up after TICKS
+   timer ticks.  Returns true if SEMA was decremented, false if
+   the deadline passed first.  With TICKS <= 0 this is the same
+   as sema_try_down().
+
+   Like sema_down(), this function may sleep, so it must not be
+   called within an interrupt handler. */
+bool
+sema_down_timeout (struct semaphore *sema, int64_t ticks)
+{
+  enum intr_level old_level;
+  bool success;
+
+  ASSERT (sema != NULL);
+  ASSERT (!intr_context ());
+
+  old_level = intr_disable ();
+  if (sema->value == 0 && ticks > 0)
+    {
+      struct sema_timeout waiter = { thread_current (), false };
+      struct timer_event event;
+
+      timer_event_schedule (&event, timer_ticks () + ticks,
+                            sema_timeout_expire, &waiter);
+      while (sema->value == 0 && !waiter.timed_out)
+        wait_on (sema);
+      timer_event_cancel (&event);
+    }
+
+  success = sema->value > 0;
+  if (success)
+    sema->value--;
+  intr_set_level (old_level);
+
+  return success;
+}
+
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
-   and wakes up one thread of those waiting for SEMA, if any.
+   and wakes up one thread of those waiting for SEMA, if any.  If
+   that thread should preempt the current one, switches straight
+   to it.
 
    This function may be called from an interrupt handler. */
 void
 sema_up (struct semaphore *sema) 
 {
   enum intr_level old_level;
+  struct thread *woken = NULL;
+  bool switched;
 
   ASSERT (sema != NULL);
 
   old_level = intr_disable ();
-  if (!list_empty (&sema->waiters))
-  {
-    struct list_elem *waiter = list_min (&sema->waiters,
-                                         thread_compare_priority,
-                                         NULL);
-    list_remove(waiter);
-    thread_unblock (list_entry (waiter, struct thread, elem));
-  }
+  if (!heap_empty (&sema->waiters))
+    woken = wake_waiter (sema);
   sema->value++;
+  switched = woken != NULL && thread_yield_to (woken);
   intr_set_level (old_level);
 
-  thread_max_yield ();
+  if (!switched)
+    thread_max_yield ();
+}
+
+/* Moves T, if it is waiting on a semaphore, to its place in the
+   semaphore's wait list after its priority has changed from
+   OLD_PRIORITY.  Interrupts must be off. */
+void
+sema_update_waiter (struct thread *t, int old_priority)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t->wait_sema == NULL || t->priority == old_priority)
+    return;
+  if (t->priority > old_priority)
+    heap_increase (&t->wait_sema->waiters, &t->wait_elem);
+  else
+    heap_update (&t->wait_sema->waiters, &t->wait_elem);
+}
+
+/* Returns true if the thread waiting in A should be woken after
+   the one waiting in B. */
+static bool
+waiter_less (const struct heap_elem *a_, const struct heap_elem *b_,
+             void *aux UNUSED)
+{
+  const struct thread *a = heap_entry (a_, struct thread, wait_elem);
+  const struct thread *b = heap_entry (b_, struct thread, wait_elem);
+
+  return wakes_after (a->priority, a->wait_seq, b->priority, b->wait_seq);
 }
 
 static void sema_test_helper (void *sema_);
@@ -164,6 +341,129 @@ sema_test_helper (void *sema_)
     }
 }
 
+#ifdef LOCK_STATS
+/* Statistics for the locks initialized with one name. */
+struct lock_class
+  {
+    const char *name;           /* Name passed to lock_init_named(). */
+    unsigned acquire_cnt;       /* Number of acquisitions. */
+    unsigned contended_cnt;     /* Acquisitions that had to wait. */
+    uint64_t wait_cycles;       /* Total CPU cycles spent waiting. */
+    uint64_t max_wait_cycles;   /* Longest wait, in CPU cycles. */
+    uint64_t hold_cycles;       /* Total CPU cycles held. */
+  };
+
+/* Number of distinct lock names whose statistics are kept.
+   Locks with other names share the last class. */
+#define LOCK_CLASS_CNT 64
+
+/* Number of classes lock_print_stats() prints. */
+#define LOCK_STATS_TOP 10
+
+static struct lock_class lock_classes[LOCK_CLASS_CNT];
+static size_t lock_class_cnt;
+
+/* Returns the class for locks named NAME, creating it if
+   necessary. */
+static struct lock_class *
+find_lock_class (const char *name)
+{
+  enum intr_level old_level;
+  struct lock_class *class;
+  size_t i;
+
+  old_level = intr_disable ();
+  for (i = 0; i < lock_class_cnt; i++)
+    if (lock_classes[i].name == name || !strcmp (lock_classes[i].name, name))
+      break;
+  if (i == LOCK_CLASS_CNT)
+    i = LOCK_CLASS_CNT - 1;
+  else if (i == lock_class_cnt)
+    {
+      lock_classes[i].name = i < LOCK_CLASS_CNT - 1 ? name : "(other)";
+      lock_class_cnt++;
+    }
+  class = &lock_classes[i];
+  intr_set_level (old_level);
+  return class;
+}
+
+/* Records that the current thread acquired LOCK, having asked
+   for it at timer_tsc() value START and waited for it if
+   CONTENDED.  Interrupts must be off. */
+static void
+stats_acquired (struct lock *lock, uint64_t start, bool contended)
+{
+  struct lock_class *class = lock->class;
+  uint64_t now = timer_tsc ();
+
+  class->acquire_cnt++;
+  if (contended)
+    {
+      uint64_t wait = now - start;
+
+      class->contended_cnt++;
+      class->wait_cycles += wait;
+      if (wait > class->max_wait_cycles)
+        class->max_wait_cycles = wait;
+    }
+  lock->acquire_tsc = now;
+}
+
+/* Records that the current thread is releasing LOCK.  Interrupts
+   must be off. */
+static void
+stats_released (struct lock *lock)
+{
+  lock->class->hold_cycles += timer_tsc () - lock->acquire_tsc;
+}
+
+/* Prints the statistics of the LOCK_STATS_TOP lock names whose
+   locks were waited for longest in total. */
+void
+lock_print_stats (void)
+{
+  struct lock_class *top[LOCK_CLASS_CNT];
+  size_t i, j;
+
+  /* Sort by total wait, descending. */
+  for (i = 0; i < lock_class_cnt; i++)
+    {
+      struct lock_class *class = &lock_classes[i];
+
+      for (j = i; j > 0 && top[j - 1]->wait_cycles < class->wait_cycles; j--)
+        top[j] = top[j - 1];
+      top[j] = class;
+    }
+
+  printf ("Locks: %zu names, top %d by wait time in CPU cycles:\n",
+          lock_class_cnt, LOCK_STATS_TOP);
+  printf ("Locks: %-16s %10s %10s %14s %12s %14s\n", "name", "acquires",
+          "contended", "wait", "max wait", "held");
+  for (i = 0; i < lock_class_cnt && i < LOCK_STATS_TOP; i++)
+    printf ("Locks: %-16s %10u %10u %14llu %12llu %14llu\n", top[i]->name,
+            top[i]->acquire_cnt, top[i]->contended_cnt, top[i]->wait_cycles,
+            top[i]->max_wait_cycles, top[i]->hold_cycles);
+}
+
+/* Resets the statistics of all locks to zero. */
+void
+lock_reset_stats (void)
+{
+  enum intr_level old_level = intr_disable ();
+  size_t i;
+
+  for (i = 0; i < lock_class_cnt; i++)
+    {
+      struct lock_class *class = &lock_classes[i];
+
+      class->acquire_cnt = class->contended_cnt = 0;
+      class->wait_cycles = class->max_wait_cycles = class->hold_cycles = 0;
+    }
+  intr_set_level (old_level);
+}
+#endif /* LOCK_STATS */
+
 /* Initializes LOCK.  A lock can be held by at most a single
    thread at any given time.  Our locks are not "recursive", that
    is, it is an error for the thread currently holding a lock to
@@ -181,17 +481,105 @@ sema_test_helper (void *sema_)
    instead of a lock. */
 void
 lock_init (struct lock *lock)
+{
+  lock_init_named (lock, "(unnamed)");
+}
+
+/* Initializes LOCK like lock_init(), giving it NAME, which must
+   remain valid as long as the kernel runs, for statistics. */
+void
+lock_init_named (struct lock *lock, const char *name UNUSED)
 {
   ASSERT (lock != NULL);
+  ASSERT (name != NULL);
 
   lock->holder = NULL;
+  lock->adaptive = false;
   sema_init (&lock->semaphore, 1);
+#ifdef LOCK_STATS
+  lock->class = find_lock_class (name);
+#endif
+}
+
+/* Most rounds an adaptive lock's waiter spins before blocking.
+   A round is a PAUSE and a check of the lock, on the order of
+   10 ns, so this is a few microseconds, about the cost of the
+   two context switches that blocking takes. */
+#define LOCK_SPIN_MAX 500
+
+/* Initializes LOCK like lock_init_named(), as an adaptive lock,
+   for critical sections short enough that waiting out the
+   holder beats sleeping: a thread that finds LOCK held spins
+   for up to LOCK_SPIN_MAX rounds while the holder is running on
+   another CPU, and blocks as usual, donating its priority, only
+   if the holder is not running or the lock is still held after
+   the spin. */
+void
+lock_init_adaptive (struct lock *lock, const char *name)
+{
+  lock_init_named (lock, name);
+  lock->adaptive = true;
+}
+
+/* Returns true if LOCK's holder is running, on a CPU other than
+   the current thread's.  With a single CPU, the only thread
+   running is the current one, so a waiter never spins; the
+   holder cannot make progress until the waiter gets off the
+   CPU. */
+static bool
+holder_running (const struct lock *lock)
+{
+  struct thread *holder = lock->holder;
+
+  return (holder != NULL && holder != thread_current ()
+          && holder->status == THREAD_RUNNING);
+}
+
+/* Spins, with interrupts on, while adaptive LOCK is held by a
+   running thread, for up to LOCK_SPIN_MAX rounds.  Returns with
+   interrupts off, which they must be on entry. */
+static void
+spin_on_lock (struct lock *lock)
+{
+  int i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (i = 0; i < LOCK_SPIN_MAX && lock->semaphore.value == 0
+         && holder_running (lock); i++)
+    {
+      intr_enable ();
+      asm volatile ("pause" : : : "memory");
+      intr_disable ();
+    }
+}
+
+/* Makes T the holder of LOCK, and brings T's priority up to date
+   with LOCK's waiters.  T is either the current thread, which
+   has just downed LOCK's semaphore, or a waiter that
+   lock_release() is handing LOCK to, with the semaphore left at
+   0.  Interrupts must be off. */
+static void
+take_lock (struct lock *lock, struct thread *t)
+{
+  t->required_lock = NULL;
+  lock->holder = t;
+  list_push_back (&t->held_locks, &lock->elem);
+  if (!thread_mlfqs && !heap_empty (&lock->semaphore.waiters))
+    thread_reset_priority (t);
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
    necessary.  The lock must not already be held by the current
    thread.
 
+   While it waits, the current thread donates its priority to
+   the lock's holder: a thread's priority is the highest of its
+   own and those of the highest-priority waiters of the locks it
+   holds, and these are at the top of the locks' wait lists.
+   A waiter does not contend for the lock again once woken:
+   lock_release() makes it the holder first.
+
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
@@ -199,24 +587,33 @@ lock_init (struct lock *lock)
 void
 lock_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
   ASSERT (thread_current ()->required_lock == NULL);
 
-  enum intr_level old_level;
   old_level = intr_disable ();
-
-  if (lock->holder != NULL)
-  {
-    thread_current ()->required_lock = lock;
-    thread_donate_priority (thread_current());
-  }
-
-  sema_down (&lock->semaphore);
-  lock->holder = thread_current ();
-  thread_current ()->required_lock = NULL;
-
+#ifdef LOCK_STATS
+  uint64_t start = timer_tsc ();
+  bool contended = lock->semaphore.value == 0;
+#endif
+  if (lock->semaphore.value == 0 && lock->adaptive)
+    spin_on_lock (lock);
+  if (lock->semaphore.value > 0)
+    {
+      lock->semaphore.value--;
+      take_lock (lock, thread_current ());
+    }
+  else
+    {
+      wait_on_lock (lock);
+      ASSERT (lock_held_by_current_thread (lock));
+    }
+#ifdef LOCK_STATS
+  stats_acquired (lock, start, contended);
+#endif
   intr_set_level (old_level);
 }
 
@@ -229,18 +626,87 @@ lock_acquire (struct lock *lock)
 bool
 lock_try_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
   bool success;
 
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    {
+      take_lock (lock, thread_current ());
+#ifdef LOCK_STATS
+      stats_acquired (lock, 0, false);
+#endif
+    }
+  intr_set_level (old_level);
+  return success;
+}
+
+/* Acquires LOCK like lock_acquire(), but gives up after TICKS
+   timer ticks.  Returns true if the lock was acquired, false if
+   the deadline passed first.  A waiter that gives up withdraws
+   the priority it donated to the holder, and the holder's
+   lowered priority is passed along the chain of holders it is
+   itself waiting on.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+bool
+lock_acquire_timeout (struct lock *lock, int64_t ticks)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  bool success;
+
+  ASSERT (lock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!lock_held_by_current_thread (lock));
+  ASSERT (cur->required_lock == NULL);
+
+  old_level = intr_disable ();
+#ifdef LOCK_STATS
+  uint64_t start = timer_tsc ();
+  bool contended = lock->semaphore.value == 0;
+#endif
+  if (lock->semaphore.value > 0)
+    {
+      lock->semaphore.value--;
+      take_lock (lock, cur);
+    }
+  else if (ticks > 0)
+    {
+      struct sema_timeout waiter = { cur, false };
+      struct timer_event event;
+
+      timer_event_schedule (&event, timer_ticks () + ticks,
+                            sema_timeout_expire, &waiter);
+      wait_on_lock (lock);
+      timer_event_cancel (&event);
+    }
+  success = lock->holder == cur;
+#ifdef LOCK_STATS
+  if (success)
+    stats_acquired (lock, start, contended);
+#endif
+  if (!success)
+    {
+      cur->required_lock = NULL;
+      if (!thread_mlfqs && lock->holder != NULL)
+        thread_donate_priority (lock->holder);
+    }
+  intr_set_level (old_level);
   return success;
 }
 
 /* Releases LOCK, which must be owned by the current thread.
+   If any thread is waiting for LOCK, hands it to the
+   highest-priority waiter, and switches straight to that thread
+   if it should preempt the current one.  Takes time proportional
+   to the number of locks the current thread holds, to
+   recalculate its priority without LOCK's waiters.
 
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to release a lock within an interrupt
@@ -248,30 +714,35 @@ lock_try_acquire (struct lock *lock)
 void
 lock_release (struct lock *lock) 
 {
+  enum intr_level old_level;
+  struct thread *next;
+  bool switched;
+
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
-  enum intr_level old_level;
   old_level = intr_disable ();
+#ifdef LOCK_STATS
+  stats_released (lock);
+#endif
+  list_remove (&lock->elem);
+  if (heap_empty (&lock->semaphore.waiters))
+    {
+      lock->holder = NULL;
+      lock->semaphore.value++;
+      intr_set_level (old_level);
+      return;
+    }
 
-  // Loop through threads waiting for this lock and remove from donations
-  if (!list_empty (&lock->semaphore.waiters) && !thread_mlfqs)
-  {
-    struct list_elem *e;
-    for (e = list_begin (&lock->semaphore.waiters);
-         e != list_end (&lock->semaphore.waiters);
-         e = list_next (e))
-     {
-       struct thread *t = list_entry (e, struct thread, elem);
-       thread_remove_donation (t);
-     }
-
+  if (!thread_mlfqs)
     thread_reset_priority (thread_current ());
-  }
-
-  lock->holder = NULL;
-  sema_up (&lock->semaphore);
+  next = wake_waiter (&lock->semaphore);
+  take_lock (lock, next);
+  switched = thread_yield_to (next);
   intr_set_level (old_level);
+
+  if (!switched)
+    thread_max_yield ();
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -285,25 +756,27 @@ lock_held_by_current_thread (const struct lock *lock)
   return lock->holder == thread_current ();
 }
 
-/* One semaphore in a list. */
+/* One semaphore in a heap. */
 struct semaphore_elem 
   {
     int priority;                       /* priority of this waiting thread */
-    struct list_elem elem;              /* List element. */
+    unsigned seq;                       /* Order of arrival. */
+    struct heap_elem elem;              /* Heap element. */
     struct semaphore semaphore;         /* This semaphore. */
   };
 
+/* Returns true if the thread waiting in A should be signaled
+   after the one waiting in B. */
 static bool
-sema_compare_priority (const struct list_elem *a,
-                       const struct list_elem *b,
-                       void *aux UNUSED)
+cond_waiter_less (const struct heap_elem *a_, const struct heap_elem *b_,
+                  void *aux UNUSED)
 {
-  struct semaphore_elem *a_sema;
-  struct semaphore_elem *b_sema;
-  a_sema = list_entry (a, struct semaphore_elem, elem);
-  b_sema = list_entry (b, struct semaphore_elem, elem);
+  const struct semaphore_elem *a
+    = heap_entry (a_, struct semaphore_elem, elem);
+  const struct semaphore_elem *b
+    = heap_entry (b_, struct semaphore_elem, elem);
 
-  return a_sema->priority > b_sema->priority;
+  return wakes_after (a->priority, a->seq, b->priority, b->seq);
 }
 
 /* Initializes condition variable COND.  A condition variable
@@ -314,7 +787,7 @@ cond_init (struct condition *cond)
 {
   ASSERT (cond != NULL);
 
-  list_init (&cond->waiters);
+  heap_init (&cond->waiters, cond_waiter_less, NULL);
 }
 
 /* Atomically releases LOCK and waits for COND to be signaled by
@@ -349,14 +822,53 @@ cond_wait (struct condition *cond, struct lock *lock)
   
   sema_init (&waiter.semaphore, 0);
   waiter.priority = thread_get_priority ();
-  list_insert_ordered (&cond->waiters,
-                       &waiter.elem,
-                       sema_compare_priority, NULL);
+  waiter.seq = next_wait_seq ();
+  heap_push (&cond->waiters, &waiter.elem);
   lock_release (lock);
   sema_down (&waiter.semaphore);
   lock_acquire (lock);
 }
 
+/* Like cond_wait(), but gives up waiting after TICKS timer
+   ticks.  LOCK is reacquired before returning in either case.
+   Returns true if COND was signaled, false if the deadline passed
+   first.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+bool
+cond_wait_timeout (struct condition *cond, struct lock *lock, int64_t ticks)
+{
+  struct semaphore_elem waiter;
+  bool signaled;
+
+  ASSERT (cond != NULL);
+  ASSERT (lock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (lock_held_by_current_thread (lock));
+
+  sema_init (&waiter.semaphore, 0);
+  waiter.priority = thread_get_priority ();
+  waiter.seq = next_wait_seq ();
+  heap_push (&cond->waiters, &waiter.elem);
+  lock_release (lock);
+  signaled = sema_down_timeout (&waiter.semaphore, ticks);
+  lock_acquire (lock);
+
+  /* cond_signal() only runs with LOCK held, so now that we hold
+     it the waiter is either still on the list or has been fully
+     signaled.  A signal that raced with the deadline still
+     counts, so that it is not lost. */
+  if (!signaled)
+    {
+      if (sema_try_down (&waiter.semaphore))
+        signaled = true;
+      else
+        heap_remove (&cond->waiters, &waiter.elem);
+    }
+  return signaled;
+}
+
 /* If any threads are waiting on COND (protected by LOCK), then
    this function signals one of them to wake up from its wait.
    LOCK must be held before calling this function.
@@ -372,8 +884,8 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
 
-  if (!list_empty (&cond->waiters)) 
-    sema_up (&list_entry (list_pop_front (&cond->waiters),
+  if (!heap_empty (&cond->waiters)) 
+    sema_up (&heap_entry (heap_pop (&cond->waiters),
                           struct semaphore_elem, elem)->semaphore);
 }
 
@@ -389,6 +901,354 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
 
-  while (!list_empty (&cond->waiters))
+  while (!heap_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes wait queue WQ. */
+void
+wait_queue_init (struct wait_queue *wq)
+{
+  ASSERT (wq != NULL);
+
+  heap_init (&wq->shared, cond_waiter_less, NULL);
+  heap_init (&wq->exclusive, cond_waiter_less, NULL);
+}
+
+/* Atomically releases LOCK and waits on WQ until woken, then
+   reacquires LOCK, in the same way as cond_wait().  If
+   EXCLUSIVE, a wakeup wakes this thread only if no
+   higher-priority exclusive waiter is waiting; otherwise, every
+   wakeup wakes it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+wait_queue_wait (struct wait_queue *wq, struct lock *lock, bool exclusive)
+{
+  struct semaphore_elem waiter;
+
+  ASSERT (wq != NULL);
+  ASSERT (lock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (lock_held_by_current_thread (lock));
+
+  sema_init (&waiter.semaphore, 0);
+  waiter.priority = thread_get_priority ();
+  waiter.seq = next_wait_seq ();
+  heap_push (exclusive ? &wq->exclusive : &wq->shared, &waiter.elem);
+  lock_release (lock);
+  sema_down (&waiter.semaphore);
+  lock_acquire (lock);
+}
+
+/* Wakes every non-exclusive waiter on WQ (protected by LOCK)
+   and the highest-priority exclusive waiter, if any.  LOCK must
+   be held before calling this function. */
+void
+wait_queue_wake (struct wait_queue *wq, struct lock *lock UNUSED)
+{
+  ASSERT (wq != NULL);
+  ASSERT (lock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (lock_held_by_current_thread (lock));
+
+  while (!heap_empty (&wq->shared))
+    sema_up (&heap_entry (heap_pop (&wq->shared),
+                          struct semaphore_elem, elem)->semaphore);
+  if (!heap_empty (&wq->exclusive))
+    sema_up (&heap_entry (heap_pop (&wq->exclusive),
+                          struct semaphore_elem, elem)->semaphore);
+}
+
+/* Wakes every waiter on WQ (protected by LOCK), exclusive or
+   not.  LOCK must be held before calling this function. */
+void
+wait_queue_wake_all (struct wait_queue *wq, struct lock *lock)
+{
+  ASSERT (wq != NULL);
+  ASSERT (lock != NULL);
+
+  do
+    wait_queue_wake (wq, lock);
+  while (!heap_empty (&wq->exclusive));
+}
+
+/* Initializes RWLOCK.  Any number of readers can hold a
+   reader/writer lock at once, or a single writer.  A writer
+   that is waiting keeps new readers out, so that a steady stream
+   of readers cannot starve writers.
+
+   The lock is handed directly to the threads it wakes.  When it
+   becomes free, the highest-priority waiting writer gets it,
+   unless a waiting reader has a higher priority still, in which
+   case all the waiting readers get it together.
+
+   A writer waiting for the lock donates its priority to the
+   thread holding it for writing, in the same way as for a lock,
+   or to each thread holding it for reading: a reader's priority
+   is raised to that of the highest-priority writer waiting on
+   any reader/writer lock it holds.  Readers waiting for a writer
+   donate to it too.
+
+   Like a lock, a reader/writer lock is not recursive: a thread
+   that holds it must not try to acquire it again.  A thread can
+   hold at most RWLOCK_READ_MAX of them for reading at once. */
+void
+rwlock_init (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  rwlock->writer = NULL;
+  list_init (&rwlock->readers);
+  sema_init (&rwlock->read_wait, 0);
+  sema_init (&rwlock->write_wait, 0);
+}
+
+/* Returns the highest-priority thread waiting in QUEUE, or a
+   null pointer if there is none. */
+static struct thread *
+top_waiter (struct semaphore *queue)
+{
+  if (heap_empty (&queue->waiters))
+    return NULL;
+  return heap_entry (heap_max (&queue->waiters), struct thread, wait_elem);
+}
+
+/* Returns the priority of the highest-priority thread waiting in
+   QUEUE, or PRI_MIN - 1 if there is none. */
+static int
+top_priority (struct semaphore *queue)
+{
+  struct thread *t = top_waiter (queue);
+
+  return t != NULL ? t->priority : PRI_MIN - 1;
+}
+
+/* Records that T holds RWLOCK for reading. */
+static void
+add_reader (struct rwlock *rwlock, struct thread *t)
+{
+  struct rwlock_hold *h;
+
+  for (h = t->read_holds; h < t->read_holds + RWLOCK_READ_MAX; h++)
+    if (h->rwlock == NULL)
+      {
+        h->rwlock = rwlock;
+        h->thread = t;
+        list_push_back (&rwlock->readers, &h->elem);
+        return;
+      }
+  PANIC ("%s holds too many reader/writer locks for reading", t->name);
+}
+
+/* Records that T, which holds RWLOCK for reading, no longer
+   does. */
+static void
+remove_reader (struct rwlock *rwlock, struct thread *t)
+{
+  struct rwlock_hold *h;
+
+  for (h = t->read_holds; h < t->read_holds + RWLOCK_READ_MAX; h++)
+    if (h->rwlock == rwlock)
+      {
+        list_remove (&h->elem);
+        h->rwlock = NULL;
+        return;
+      }
+  NOT_REACHED ();
+}
+
+/* Hands RWLOCK, which nobody holds, to the threads waiting for it
+   that should get it next, if any, and has the threads left
+   waiting donate to their new holders.  The threads woken stop
+   waiting here, rather than when they next run, so that they
+   donate no more.  Interrupts must be off. */
+static void
+hand_off (struct rwlock *rwlock)
+{
+  ASSERT (rwlock->writer == NULL && list_empty (&rwlock->readers));
+
+  if (!heap_empty (&rwlock->write_wait.waiters)
+      && top_priority (&rwlock->write_wait)
+         >= top_priority (&rwlock->read_wait))
+    {
+      rwlock->writer = wake_waiter (&rwlock->write_wait);
+      rwlock->writer->required_rwlock = NULL;
+      list_push_back (&rwlock->writer->held_rwlocks, &rwlock->elem);
+    }
+  else
+    while (!heap_empty (&rwlock->read_wait.waiters))
+      {
+        struct thread *t = wake_waiter (&rwlock->read_wait);
+
+        t->required_rwlock = NULL;
+        add_reader (rwlock, t);
+      }
+
+  if (thread_mlfqs)
+    return;
+  if (rwlock->writer != NULL)
+    thread_reset_priority (rwlock->writer);
+  else
+    rwlock_donate_readers (rwlock);
+}
+
+/* Acquires RWLOCK for reading, sleeping until no writer holds or
+   is waiting for it. */
+void
+rwlock_acquire_read (struct rwlock *rwlock)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (rwlock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (rwlock->writer != cur);
+
+  old_level = intr_disable ();
+  if (rwlock->writer != NULL || !heap_empty (&rwlock->write_wait.waiters))
+    {
+      /* Sleep until hand_off() makes us a reader.  Join the
+         waiters first, so that a writer holding the lock sees our
+         priority. */
+      cur->required_rwlock = rwlock;
+      enqueue_waiter (&rwlock->read_wait);
+      if (rwlock->writer != NULL && !thread_mlfqs)
+        thread_donate_priority (cur);
+      trace (TRACE_SYNCH, TRACE_RWLOCK_WAIT, (uint32_t) rwlock, false);
+      thread_block ();
+    }
+  else
+    add_reader (rwlock, cur);
+  intr_set_level (old_level);
+}
+
+/* Releases RWLOCK, which the current thread must hold for
+   reading. */
+void
+rwlock_release_read (struct rwlock *rwlock)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (rwlock != NULL);
+
+  old_level = intr_disable ();
+  remove_reader (rwlock, cur);
+  if (!thread_mlfqs)
+    thread_reset_priority (cur);
+  if (list_empty (&rwlock->readers))
+    hand_off (rwlock);
+  intr_set_level (old_level);
+
+  thread_max_yield ();
+}
+
+/* Acquires RWLOCK for writing, sleeping until no reader or writer
+   holds it. */
+void
+rwlock_acquire_write (struct rwlock *rwlock)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (rwlock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (rwlock->writer != cur);
+
+  old_level = intr_disable ();
+  if (rwlock->writer != NULL || !list_empty (&rwlock->readers))
+    {
+      /* Sleep until hand_off() makes us the writer.  Join the
+         waiters first, so that readers see our priority. */
+      cur->required_rwlock = rwlock;
+      enqueue_waiter (&rwlock->write_wait);
+      if (!thread_mlfqs)
+        thread_donate_priority (cur);
+      trace (TRACE_SYNCH, TRACE_RWLOCK_WAIT, (uint32_t) rwlock, true);
+      thread_block ();
+    }
+  else
+    {
+      rwlock->writer = cur;
+      list_push_back (&cur->held_rwlocks, &rwlock->elem);
+    }
+  intr_set_level (old_level);
+}
+
+/* Releases RWLOCK, which the current thread must hold for
+   writing, and hands it to the threads waiting for it. */
+void
+rwlock_release_write (struct rwlock *rwlock)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (rwlock != NULL);
+  ASSERT (rwlock->writer == cur);
+
+  old_level = intr_disable ();
+  rwlock->writer = NULL;
+  list_remove (&rwlock->elem);
+  if (!thread_mlfqs)
+    thread_reset_priority (cur);
+  hand_off (rwlock);
+  intr_set_level (old_level);
+
+  thread_max_yield ();
+}
+
+/* Brings the priority of each thread holding RWLOCK for reading
+   up to date with the writers waiting for it, passing it along
+   the chain of holders each is itself waiting on.  Interrupts
+   must be off. */
+void
+rwlock_donate_readers (struct rwlock *rwlock)
+{
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&rwlock->readers); e != list_end (&rwlock->readers);
+       e = list_next (e))
+    thread_donate_priority (list_entry (e, struct rwlock_hold,
+                                        elem)->thread);
+}
+
+/* Returns the highest priority donated to thread T: that of the
+   highest-priority thread waiting for any lock or reader/writer
+   lock T holds, or for the writers waiting on a reader/writer
+   lock T holds for reading.  Returns PRI_MIN - 1 if there is
+   none.  Takes time proportional to the number of locks T holds.
+   Interrupts must be off. */
+int
+synch_donated_priority (struct thread *t)
+{
+  int priority = PRI_MIN - 1;
+  struct list_elem *e;
+  struct rwlock_hold *h;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&t->held_locks); e != list_end (&t->held_locks);
+       e = list_next (e))
+    {
+      struct lock *lock = list_entry (e, struct lock, elem);
+      if (top_priority (&lock->semaphore) > priority)
+        priority = top_priority (&lock->semaphore);
+    }
+  for (e = list_begin (&t->held_rwlocks); e != list_end (&t->held_rwlocks);
+       e = list_next (e))
+    {
+      struct rwlock *rwlock = list_entry (e, struct rwlock, elem);
+      if (top_priority (&rwlock->read_wait) > priority)
+        priority = top_priority (&rwlock->read_wait);
+      if (top_priority (&rwlock->write_wait) > priority)
+        priority = top_priority (&rwlock->write_wait);
+    }
+  for (h = t->read_holds; h < t->read_holds + RWLOCK_READ_MAX; h++)
+    if (h->rwlock != NULL && top_priority (&h->rwlock->write_wait) > priority)
+      priority = top_priority (&h->rwlock->write_wait);
+  return priority;
+}
@@ -1,46 +1,121 @@
 #ifndef THREADS_SYNCH_H
 #define THREADS_SYNCH_H
 
+#include <heap.h>
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+struct thread;
 
 /* A counting semaphore. */
 struct semaphore 
   {
     unsigned value;             /* Current value. */
-    struct list waiters;        /* List of waiting threads. */
+    struct heap waiters;        /* Waiting threads, by priority. */
   };
 
 void sema_init (struct semaphore *, unsigned value);
 void sema_down (struct semaphore *);
 bool sema_try_down (struct semaphore *);
+bool sema_down_timeout (struct semaphore *, int64_t ticks);
 void sema_up (struct semaphore *);
+void sema_update_waiter (struct thread *, int old_priority);
 void sema_self_test (void);
 
-/* Lock. */
+/* Lock.
+
+   If the kernel is built with LOCK_STATS defined, for example
+   by adding -DLOCK_STATS to DEFINES in the build directory's
+   Make.vars, each lock keeps statistics, shared by all the locks
+   initialized with the same name, that lock_print_stats()
+   prints. */
 struct lock 
   {
     struct thread *holder;      /* Thread holding lock (for debugging). */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
+    struct list_elem elem;      /* Element in holder's held_locks. */
+    bool adaptive;              /* Spin before blocking? */
+#ifdef LOCK_STATS
+    struct lock_class *class;   /* Statistics for the lock's name. */
+    uint64_t acquire_tsc;       /* timer_tsc() when acquired. */
+#endif
   };
 
 void lock_init (struct lock *);
+void lock_init_named (struct lock *, const char *name);
+void lock_init_adaptive (struct lock *, const char *name);
 void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
+bool lock_acquire_timeout (struct lock *, int64_t ticks);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
+#ifdef LOCK_STATS
+void lock_print_stats (void);
+void lock_reset_stats (void);
+#endif
 
 /* Condition variable. */
 struct condition 
   {
-    struct list waiters;        /* List of waiting semaphore_elems. */
+    struct heap waiters;        /* Waiting semaphore_elems, by priority. */
   };
 
 void cond_init (struct condition *);
 void cond_wait (struct condition *, struct lock *);
+bool cond_wait_timeout (struct condition *, struct lock *, int64_t ticks);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Wait queue.
+
+   Like a condition variable, but each waiter says whether it
+   waits exclusively.  A wakeup wakes every non-exclusive waiter,
+   which waits for an event that all of them can act on, but only
+   the highest-priority exclusive waiter, which waits for a
+   resource that only one of them can take. */
+struct wait_queue
+  {
+    struct heap shared;         /* Non-exclusive semaphore_elems. */
+    struct heap exclusive;      /* Exclusive semaphore_elems. */
+  };
+
+void wait_queue_init (struct wait_queue *);
+void wait_queue_wait (struct wait_queue *, struct lock *, bool exclusive);
+void wait_queue_wake (struct wait_queue *, struct lock *);
+void wait_queue_wake_all (struct wait_queue *, struct lock *);
+
+/* Reader/writer lock. */
+struct rwlock
+  {
+    struct thread *writer;      /* Thread holding it for writing. */
+    struct list_elem elem;      /* Element in writer's held_rwlocks. */
+    struct list readers;        /* struct rwlock_holds of readers. */
+    struct semaphore read_wait; /* Waiting readers; value stays 0. */
+    struct semaphore write_wait; /* Waiting writers; value stays 0. */
+  };
+
+/* Maximum number of reader/writer locks a thread can hold for
+   reading at once. */
+#define RWLOCK_READ_MAX 4
+
+/* A thread's hold on a reader/writer lock for reading. */
+struct rwlock_hold
+  {
+    struct list_elem elem;      /* Element in rwlock's readers. */
+    struct rwlock *rwlock;      /* Lock held, or null if unused. */
+    struct thread *thread;      /* Holding thread. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+void rwlock_donate_readers (struct rwlock *);
+
+int synch_donated_priority (struct thread *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
@@ -2,33 +2,62 @@
 #include <debug.h>
 #include <stddef.h>
 #include <random.h>
+#include <round.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/flags.h"
+#include "threads/fpu.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
+#include "threads/perf.h"
+#include "threads/rcu.h"
+#include "threads/stats.h"
 #include "threads/switch.h"
+#include "threads/trace.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 #include "devices/timer.h"
 #ifdef USERPROG
+#include "userprog/ipc.h"
 #include "userprog/process.h"
 #endif
+#ifdef VM
+#include "vm/mmap.h"
+#endif
 
 /* Random value for struct thread's `magic' member.
    Used to detect stack overflow.  See the big comment at the top
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Number of distinct thread priorities. */
+#define PRI_CNT (PRI_MAX - PRI_MIN + 1)
+#if PRI_CNT > 64
+#error ready_bitmap requires at most 64 priority levels
+#endif
+
+/* Run queue of processes in THREAD_READY state, that is,
+   processes that are ready to run but not actually running.
+   There is one FIFO per priority level, and bit P of
+   ready_bitmap is set if and only if ready_queues[P - PRI_MIN]
+   is non-empty, so that enqueue, dequeue and finding the
+   highest ready priority all take constant time. */
+static struct list ready_queues[PRI_CNT];
+static uint64_t ready_bitmap;
+static int ready_cnt;           /* # of threads in the run queue. */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
 
+/* Threads in all_list, hashed by tid into TID_BUCKETS chains for
+   thread_lookup().  Tids are handed out in order, so the live
+   threads spread evenly over the buckets.  Like all_list,
+   protected by disabling interrupts. */
+#define TID_BUCKETS 1024
+static struct list tid_buckets[TID_BUCKETS];
+
 /* Idle thread. */
 static struct thread *idle_thread;
 
@@ -41,6 +70,70 @@ static struct lock tid_lock;
 /* Average number of threads ready to run per minute */
 fixed_point load_avg;
 
+/* Lazy recent_cpu decay for the BSD scheduler.  Instead of
+   decaying every thread's recent_cpu once per second, the
+   coefficient 2*load_avg / (2*load_avg + 1) for each second is
+   recorded in decay_table, indexed by that second's epoch, and a
+   thread applies the coefficients it has missed only when it is
+   next inspected.  Threads in the run queue and the running
+   thread are brought up to date every second so that their
+   priorities stay correct; blocked threads catch up when they
+   are unblocked. */
+#define DECAY_TABLE_SIZE 64     /* Seconds of history kept. */
+static fixed_point decay_table[DECAY_TABLE_SIZE];
+static unsigned mlfqs_epoch;    /* # of seconds since boot. */
+
+/* Earliest-deadline-first class, which runs ahead of all other
+   threads.  Its ready threads wait in edf_queue, earliest
+   deadline first, and are counted in ready_cnt.  A thread that
+   has used up its budget for the current period waits in
+   edf_throttled, ordered by deadline, until that period ends, so
+   that however much it wants to run it takes no more than its
+   reserved share.  thread_set_period() admits a thread only if
+   all reservations then add up to no more than EDF_UTIL_MAX, so
+   the other classes always get the rest. */
+static struct list edf_queue;
+static struct list edf_throttled;
+static unsigned edf_util;       /* Sum of edf_util of all threads. */
+static struct stats_counter edf_throttles; /* Budgets used up. */
+static struct stats_counter edf_misses;    /* Deadlines missed. */
+
+/* Fair-share scheduler.  The run queue is a tree ordered by
+   vruntime, the CPU time each thread has received, scaled by
+   NICE_0_WEIGHT / its weight, so that the thread furthest behind
+   its share always comes first.  Each thread runs for its share
+   of FAIR_LATENCY ticks, but at least FAIR_MIN_GRANULARITY.  A
+   thread that wakes up preempts the running thread if it is
+   FAIR_WAKEUP_GRANULARITY ticks behind it, and is placed no more
+   than FAIR_SLEEPER_CREDIT ticks behind fair_min_vruntime, so
+   that sleeping does not bank CPU time.  These are ticks at
+   TIMER_FREQ_DEFAULT; fair_latency and fair_min_granularity are
+   the first two at the actual rate, and each actual tick adds
+   fair_tick_vruntime at nice 0. */
+#define FAIR_TICK 1024          /* vruntime of one tick at nice 0. */
+#define FAIR_LATENCY 20         /* Period in which all should run. */
+#define FAIR_MIN_GRANULARITY 2  /* Fewest ticks before preemption. */
+#define FAIR_WAKEUP_GRANULARITY 1 /* Lead needed to preempt on wakeup. */
+#define FAIR_SLEEPER_CREDIT (FAIR_LATENCY / 2) /* Most lead on wakeup. */
+#define NICE_0_WEIGHT 1024      /* Weight of a thread with nice 0. */
+static struct rb_tree fair_tree;
+static unsigned fair_latency;
+static unsigned fair_min_granularity;
+static uint32_t fair_tick_vruntime;
+static uint64_t fair_min_vruntime; /* Never decreases. */
+static uint32_t fair_load;      /* Total weight of fair_tree. */
+
+/* Weights by nice value, from NICE_MIN to NICE_MAX.  Each step of
+   nice changes the share of CPU time by about 10% against a
+   thread that keeps its nice value. */
+static const uint32_t fair_weights[NICE_MAX - NICE_MIN + 1] =
+  {
+    88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949,
+    11916, 9548, 7620, 6100, 4904, 3906, 3121, 2501, 1991, 1586, 1277,
+    1024, 820, 655, 526, 423, 335, 272, 215, 172, 137, 110, 87, 70,
+    56, 45, 36, 29, 23, 18, 15, 12,
+  };
+
 /* Stack frame for kernel_thread(). */
 struct kernel_thread_frame 
   {
@@ -50,19 +143,68 @@ struct kernel_thread_frame
   };
 
 /* Statistics. */
-static long long idle_ticks;    /* # of timer ticks spent idle. */
-static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
-static long long user_ticks;    /* # of timer ticks in user programs. */
+static struct stats_counter idle_ticks;   /* Timer ticks spent idle. */
+static struct stats_counter kernel_ticks; /* Ticks in kernel threads. */
+static struct stats_counter user_ticks;   /* Ticks in user programs. */
+static struct stats_counter max_ready;    /* Deepest run queue so far. */
+static int max_ready_cnt;                 /* Value of max_ready. */
+static struct stats_counter page_reuses;  /* Thread pages recycled. */
+static struct stats_counter pages_cached; /* Thread pages in the cache. */
+static struct stats_counter voluntary_switches;   /* Blocked or exited. */
+static struct stats_counter involuntary_switches; /* Preempted or yielded. */
+static struct stats_counter runq_total;   /* Run queue length, summed
+                                             over timer ticks. */
+
+/* Log2 histograms, in which bucket 0 counts samples of 0 and
+   bucket B > 0 counts samples from 2**(B-1) to 2**B - 1.  The
+   last bucket also counts everything bigger. */
+#define WAKEUP_BUCKETS 40       /* Up to minutes at GHz rates. */
+#define RUNQ_BUCKETS 16
+static unsigned wakeup_hist[WAKEUP_BUCKETS]; /* Cycles from
+                                                thread_unblock() to
+                                                running. */
+static unsigned runq_hist[RUNQ_BUCKETS];  /* Run queue length at each
+                                             timer tick. */
+
+/* Pages of dead threads, kept for new threads so that creating
+   and destroying short-lived threads bypasses the page allocator.
+   Only the struct thread at the bottom of a page is cleared when
+   it is reused, by init_thread(); the stack above it need not be.
+   Accessed with interrupts off, since pages are put back from
+   thread_schedule_tail(). */
+#define PAGE_CACHE_SIZE 8
+static struct thread *page_cache[PAGE_CACHE_SIZE];
+static size_t page_cache_cnt;
 
 /* Scheduling. */
-#define TIME_SLICE 4            /* # of timer ticks to give each thread. */
+#define TIME_SLICE 4            /* # of timer ticks to give each thread
+                                   at TIMER_FREQ_DEFAULT. */
+static unsigned time_slice;     /* # of timer ticks to give each thread. */
 static unsigned thread_ticks;   /* # of timer ticks since last yield. */
+static bool slice_handed_off;   /* Next thread keeps thread_ticks? */
+
+/* Time slice in timer ticks, or 0 to use TIME_SLICE scaled to
+   the timer frequency.
+   Controlled by kernel command-line option "-slice". */
+unsigned thread_time_slice;
+
+/* The BSD scheduler's formulas assume TIMER_FREQ_DEFAULT ticks a
+   second.  At other rates, each tick adds mlfqs_tick_cpu to
+   recent_cpu instead of 1, and the running thread's priority is
+   recalculated every mlfqs_priority_ticks instead of every 4
+   ticks. */
+static fixed_point mlfqs_tick_cpu;
+static int64_t mlfqs_priority_ticks;
 
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* If true, use the fair-share scheduler.
+   Controlled by kernel command-line option "-fair". */
+bool thread_fair;
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
@@ -71,20 +213,42 @@ static struct thread *next_thread_to_run (void);
 static void init_thread (struct thread *, const char *name, int priority);
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
+static struct thread *alloc_thread_page (void);
+static void free_thread_page (struct thread *);
 static void schedule (void);
+static void switch_to (struct thread *);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static void add_tid (struct thread *);
 static int thread_get_max_priority (void);
-static void thread_reinsert_ready_list (struct thread *);
+static void ready_queue_push (struct thread *);
+static void ready_queue_remove (struct thread *, int priority);
+static struct thread *ready_queue_pop (void);
+static int ready_queue_max_priority (void);
+static void thread_reinsert_ready_list (struct thread *, int old_priority);
 static int thread_get_donated_priority (struct thread *);
-static bool thread_compare_donation (const struct list_elem *a,
-                                     const struct list_elem *b,
-                                     void *aux UNUSED);
 static void thread_calculate_bsd_priority (struct thread *t, void *aux UNUSED);
-static void thread_recalculate_bsd_variables (void);
-static void thread_calculate_recent_cpu (struct thread *t, void *aux UNUSED);
+static void thread_recalculate_bsd_variables (int64_t now);
+static void thread_catch_up_recent_cpu (struct thread *t);
+static void thread_decay_ready_threads (void);
 static void thread_calculate_load_avg (void);
 static int get_ready_threads_size (void);
+static uint32_t fair_weight (const struct thread *);
+static rb_less_func fair_less;
+static struct thread *fair_first (void);
+static void fair_update_min_vruntime (struct thread *);
+static bool fair_tick (struct thread *);
+static void fair_place (struct thread *);
+static bool fair_wakeup_preempt (void);
+static void account_switch (struct thread *prev, struct thread *cur);
+static void hist_add (unsigned hist[], size_t cnt, uint64_t value);
+static void print_hist (const char *title, const unsigned hist[],
+                        size_t cnt);
+static void print_thread_stats (struct thread *, void *aux);
+static list_less_func edf_less;
+static bool edf_tick (struct thread *);
+static void edf_wake (struct thread *);
+static bool thread_should_yield (void);
 
 
 /* Initializes the threading system by transforming the code
@@ -105,17 +269,51 @@ thread_init (void)
 {
   ASSERT (intr_get_level () == INTR_OFF);
 
-  lock_init (&tid_lock);
-  list_init (&ready_list);
+  int i;
+
+  lock_init_named (&tid_lock, "tid");
+  stats_register (&idle_ticks, "thread", "idle_ticks", STATS_COUNTER);
+  stats_register (&kernel_ticks, "thread", "kernel_ticks", STATS_COUNTER);
+  stats_register (&user_ticks, "thread", "user_ticks", STATS_COUNTER);
+  stats_register (&max_ready, "thread", "max_ready", STATS_GAUGE);
+  stats_register (&page_reuses, "thread", "page_reuses", STATS_COUNTER);
+  stats_register (&pages_cached, "thread", "pages_cached", STATS_GAUGE);
+  stats_register (&voluntary_switches, "thread", "voluntary_switches",
+                  STATS_COUNTER);
+  stats_register (&involuntary_switches, "thread", "involuntary_switches",
+                  STATS_COUNTER);
+  stats_register (&runq_total, "thread", "runq_total", STATS_COUNTER);
+  for (i = 0; i < PRI_CNT; i++)
+    list_init (&ready_queues[i]);
+  ready_bitmap = 0;
+  ready_cnt = 0;
+  rb_init (&fair_tree, fair_less, NULL);
+  list_init (&edf_queue);
+  list_init (&edf_throttled);
+  stats_register (&edf_throttles, "thread", "edf_throttles", STATS_COUNTER);
+  stats_register (&edf_misses, "thread", "edf_misses", STATS_COUNTER);
   list_init (&all_list);
+  for (i = 0; i < TID_BUCKETS; i++)
+    list_init (&tid_buckets[i]);
 
   load_avg = 0;
+  mlfqs_tick_cpu = div_fixed_by_int (convert_to_fixed_point
+                                     (TIMER_FREQ_DEFAULT), TIMER_FREQ);
+  mlfqs_priority_ticks = timer_scale_ticks (4);
+
+  time_slice = (thread_time_slice != 0 ? thread_time_slice
+                : timer_scale_ticks (TIME_SLICE));
+  fair_latency = timer_scale_ticks (FAIR_LATENCY);
+  fair_min_granularity = timer_scale_ticks (FAIR_MIN_GRANULARITY);
+  fair_tick_vruntime = FAIR_TICK * TIMER_FREQ_DEFAULT / TIMER_FREQ;
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
   init_thread (initial_thread, "main", PRI_DEFAULT);
   initial_thread->status = THREAD_RUNNING;
   initial_thread->tid = allocate_tid ();
+  add_tid (initial_thread);
+  initial_thread->run_tsc = timer_tsc ();
 }
 
 /* Starts preemptive thread scheduling by enabling interrupts.
@@ -135,39 +333,70 @@ thread_start (void)
   sema_down (&idle_started);
 }
 
-/* Called by the timer interrupt handler at each timer tick.
-   Thus, this function runs in an external interrupt context. */
+/* Called by the timer softirq once for each timer tick, with
+   interrupts off, where NOW is the number of the tick, which may
+   be behind timer_ticks() if the softirq is catching up. */
 void
-thread_tick (void) 
+thread_tick (int64_t now) 
 {
   struct thread *t = thread_current ();
+  bool preempt;
 
   /* Update statistics. */
   if (t == idle_thread)
-    idle_ticks++;
+    stats_inc (&idle_ticks);
 #ifdef USERPROG
-  else if (t->pagedir != NULL)
-    user_ticks++;
+  else if (t->proc->pagedir != NULL)
+    stats_inc (&user_ticks);
 #endif
   else
-    kernel_ticks++;
+    stats_inc (&kernel_ticks);
+  stats_add (&runq_total, ready_cnt);
+  hist_add (runq_hist, RUNQ_BUCKETS, ready_cnt);
 
   if (thread_mlfqs)
   {
-    thread_recalculate_bsd_variables ();
+    thread_recalculate_bsd_variables (now);
   }
 
-  /* Enforce preemption. */
-  if (++thread_ticks >= TIME_SLICE)
+  /* Enforce preemption.  A thread in the EDF class runs until it
+     blocks, uses up its budget or an earlier deadline comes
+     along. */
+  thread_ticks++;
+  preempt = edf_tick (t);
+  if (t->edf_period == 0
+      && (thread_fair && t != idle_thread
+          ? fair_tick (t) : thread_ticks >= time_slice))
+    preempt = true;
+  if (preempt)
     intr_yield_on_return ();
 }
 
-/* Prints thread statistics. */
+/* Accounts for CNT timer ticks that passed while the idle thread
+   ran without a timer interrupt arriving (see timer_idle_enter()). */
+void
+thread_credit_idle_ticks (unsigned cnt)
+{
+  stats_add (&idle_ticks, cnt);
+  runq_hist[0] += cnt;
+}
+
+/* Prints the scheduler's latency and run queue histograms, and
+   the scheduling statistics of every thread. */
 void
 thread_print_stats (void) 
 {
-  printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
-          idle_ticks, kernel_ticks, user_ticks);
+  enum intr_level old_level;
+
+  print_hist ("wakeup latency in CPU cycles", wakeup_hist, WAKEUP_BUCKETS);
+  print_hist ("run queue length at timer ticks", runq_hist, RUNQ_BUCKETS);
+
+  printf ("Thread: %-16s %5s %14s %14s %8s %8s %8s %10s %12s\n", "name",
+          "tid", "ready", "running", "vol", "invol", "wakeups", "avg wakeup",
+          "max wakeup");
+  old_level = intr_disable ();
+  thread_foreach (print_thread_stats, NULL);
+  intr_set_level (old_level);
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -199,7 +428,7 @@ thread_create (const char *name, int priority,
   ASSERT (function != NULL);
 
   /* Allocate thread. */
-  t = palloc_get_page (PAL_ZERO);
+  t = alloc_thread_page ();
   if (t == NULL)
     return TID_ERROR;
 
@@ -211,6 +440,7 @@ thread_create (const char *name, int priority,
      Do this atomically so intermediate values for the 'stack' 
      member cannot be observed. */
   old_level = intr_disable ();
+  add_tid (t);
 
   /* Stack frame for kernel_thread(). */
   kf = alloc_frame (t, sizeof *kf);
@@ -247,12 +477,50 @@ void
 thread_block (void) 
 {
   ASSERT (!intr_context ());
+  ASSERT (!intr_in_softirq ());
   ASSERT (intr_get_level () == INTR_OFF);
 
+  trace (TRACE_SCHED, TRACE_BLOCK, 0, 0);
   thread_current ()->status = THREAD_BLOCKED;
   schedule ();
 }
 
+/* Blocks the running thread, like thread_block(), and runs T,
+   a thread that it has just woken for it to work on its behalf,
+   in its place, with the rest of its time slice, if no ready
+   thread has a higher priority than T.  This skips the run queue
+   scan, and lets T run ahead of other threads of its priority
+   that were ready before it.  Otherwise, or if the scheduler has
+   no fast path for T, the running thread just blocks.
+
+   T must not be able to exit before this function looks at it,
+   so interrupts must be off from the time T is woken. */
+void
+thread_block_to (struct thread *t) 
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (!intr_context ());
+  ASSERT (!intr_in_softirq ());
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (is_thread (t));
+
+  trace (TRACE_SCHED, TRACE_BLOCK, 0, 0);
+  cur->status = THREAD_BLOCKED;
+  if (thread_fair || cur->edf_period != 0
+      || t->edf_period != 0 || !list_empty (&edf_queue)
+      || t->status != THREAD_READY
+      || ready_queue_max_priority () > t->priority)
+    {
+      schedule ();
+      return;
+    }
+
+  ready_queue_remove (t, t->priority);
+  slice_handed_off = true;
+  switch_to (t);
+}
+
 /* Transitions a blocked thread T to the ready-to-run state.
    This is an error if T is not blocked.  (Use thread_yield() to
    make the running thread ready.)
@@ -270,11 +538,17 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_insert_ordered(&ready_list,
-                      &t->elem,
-                      &thread_compare_priority,
-                      NULL);
+  if (thread_mlfqs)
+    thread_calculate_bsd_priority (t, NULL);
+  else if (thread_fair)
+    fair_place (t);
+  if (t->edf_period != 0)
+    edf_wake (t);
+  ready_queue_push (t);
   t->status = THREAD_READY;
+  t->ready_tsc = timer_tsc ();
+  t->woken = true;
+  trace (TRACE_SCHED, TRACE_UNBLOCK, t->tid, t->priority);
   intr_set_level (old_level);
 }
 
@@ -311,6 +585,43 @@ thread_tid (void)
   return thread_current ()->tid;
 }
 
+/* Returns the thread whose tid is TID, or a null pointer if
+   there is none or it has called thread_exit().  Interrupts must
+   be off, and the thread may go away as soon as they are turned
+   back on; use thread_get() to keep it. */
+struct thread *
+thread_lookup (tid_t tid) 
+{
+  struct list *bucket = &tid_buckets[(unsigned) tid % TID_BUCKETS];
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (bucket); e != list_end (bucket); e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, tidelem);
+      if (t->tid == tid)
+        return t;
+    }
+  return NULL;
+}
+
+/* Returns the thread whose tid is TID with a hold on it, as by
+   thread_hold(), which the caller must drop with
+   thread_release(), or a null pointer if there is no such thread
+   or it has called thread_exit(). */
+struct thread *
+thread_get (tid_t tid) 
+{
+  enum intr_level old_level = intr_disable ();
+  struct thread *t = thread_lookup (tid);
+
+  if (t != NULL)
+    t->hold_cnt++;
+  intr_set_level (old_level);
+  return t;
+}
+
 /* Deschedules the current thread and destroys it.  Never
    returns to the caller. */
 void
@@ -322,42 +633,217 @@ thread_exit (void)
   process_exit ();
 #endif
 
+  fpu_exit ();
+  perf_exit ();
+
+  /* Give back the blocks cached in our malloc() magazines. */
+  malloc_release_magazines ();
+
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
      when it calls thread_schedule_tail(). */
   intr_disable ();
+  edf_util -= thread_current ()->edf_util;
   list_remove (&thread_current()->allelem);
+  list_remove (&thread_current ()->tidelem);
   thread_current ()->status = THREAD_DYING;
   schedule ();
   NOT_REACHED ();
 }
 
+/* Keeps T's struct thread, which shares a page with T's kernel
+   stack, from being freed when T exits, until a matching
+   thread_release(), so that another thread can finish cleaning
+   up after T. */
+void
+thread_hold (struct thread *t) 
+{
+  enum intr_level old_level = intr_disable ();
+  t->hold_cnt++;
+  intr_set_level (old_level);
+}
+
+/* Drops a hold on T taken with thread_hold(), freeing T if it
+   has already exited and this was the last hold.  T must not be
+   the running thread. */
+void
+thread_release (struct thread *t) 
+{
+  enum intr_level old_level = intr_disable ();
+
+  ASSERT (t != thread_current ());
+  ASSERT (t->hold_cnt > 0);
+
+  if (--t->hold_cnt == 0 && t->status == THREAD_DYING)
+    free_thread_page (t);
+  intr_set_level (old_level);
+}
+
 /* Returns the highest priority of all ready threads */
 static int
 thread_get_max_priority (void)
 {
-    int return_val = PRI_MIN - 1;
-
     enum intr_level old_level = intr_disable ();
-
-    if (!list_empty (&ready_list))
-      {
-        struct thread *t = list_entry (list_begin (&ready_list),
-                                       struct thread, elem);
-        return_val = t->priority;
-      }
-
+    int return_val = ready_queue_max_priority ();
     intr_set_level (old_level);
     return return_val;
 }
 
-/* Yields the CPU to the thread with highest priority */
+/* Appends T to the back of the run queue for its priority, or
+   for the fair-share scheduler inserts it in fair_tree after the
+   threads with the same vruntime.  A thread in the EDF class goes
+   to edf_queue instead, or to edf_throttled if it has no budget
+   left, where it does not count as ready.  Interrupts must be
+   off. */
+static void
+ready_queue_push (struct thread *t)
+{
+  int idx = t->priority - PRI_MIN;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (PRI_MIN <= t->priority && t->priority <= PRI_MAX);
+
+  if (t->edf_period != 0 && t->edf_runtime <= 0)
+    {
+      list_insert_ordered (&edf_throttled, &t->elem, edf_less, NULL);
+      return;
+    }
+  if (t->edf_period != 0)
+    list_insert_ordered (&edf_queue, &t->elem, edf_less, NULL);
+  else if (thread_fair)
+    {
+      rb_insert (&fair_tree, &t->fair_elem);
+      fair_load += fair_weight (t);
+    }
+  else
+    {
+      list_push_back (&ready_queues[idx], &t->elem);
+      ready_bitmap |= (uint64_t) 1 << idx;
+    }
+  if (++ready_cnt > max_ready_cnt)
+    stats_set (&max_ready, max_ready_cnt = ready_cnt);
+}
+
+/* Removes T from the run queue for PRIORITY, which must be the
+   priority T had when it was pushed.  Interrupts must be off. */
+static void
+ready_queue_remove (struct thread *t, int priority)
+{
+  int idx = priority - PRI_MIN;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  ready_cnt--;
+  if (t->edf_period != 0)
+    {
+      list_remove (&t->elem);
+      return;
+    }
+  if (thread_fair)
+    {
+      rb_remove (&fair_tree, &t->fair_elem);
+      fair_load -= fair_weight (t);
+      return;
+    }
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[idx]))
+    ready_bitmap &= ~((uint64_t) 1 << idx);
+}
+
+/* Removes and returns the EDF thread with the earliest deadline
+   if any is ready, and otherwise the front thread of the
+   highest-priority non-empty run queue, or for the fair-share
+   scheduler the thread with the least vruntime, or a null
+   pointer if no thread is ready.  Interrupts must be off. */
+static struct thread *
+ready_queue_pop (void)
+{
+  int priority;
+  struct thread *t;
+
+  if (!list_empty (&edf_queue))
+    {
+      t = list_entry (list_front (&edf_queue), struct thread, elem);
+      ready_queue_remove (t, t->priority);
+      return t;
+    }
+
+  if (thread_fair)
+    {
+      t = fair_first ();
+      if (t != NULL)
+        {
+          ready_queue_remove (t, t->priority);
+          fair_update_min_vruntime (t);
+        }
+      return t;
+    }
+
+  priority = ready_queue_max_priority ();
+  if (priority < PRI_MIN)
+    return NULL;
+
+  t = list_entry (list_front (&ready_queues[priority - PRI_MIN]),
+                  struct thread, elem);
+  ready_queue_remove (t, priority);
+  return t;
+}
+
+/* Returns the highest priority of any ready thread, or
+   PRI_MIN - 1 if the run queue is empty.  Scans the bitmap one
+   32-bit half at a time so that __builtin_clz compiles to a
+   single BSR instead of a libgcc call. */
+static int
+ready_queue_max_priority (void)
+{
+  uint32_t high = ready_bitmap >> 32;
+  uint32_t low = ready_bitmap;
+
+  if (high != 0)
+    return PRI_MIN + 63 - __builtin_clz (high);
+  else if (low != 0)
+    return PRI_MIN + 31 - __builtin_clz (low);
+  else
+    return PRI_MIN - 1;
+}
+
+/* Returns true if a ready thread should preempt the running
+   thread: an EDF thread with an earlier deadline, or if the
+   running thread is not in the EDF class, any EDF thread, a
+   thread with higher priority, or for the fair-share scheduler a
+   thread that is far enough behind it. */
+static bool
+thread_should_yield (void)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level = intr_disable ();
+  bool yield = false;
+
+  if (!list_empty (&edf_queue))
+    {
+      struct thread *first = list_entry (list_front (&edf_queue),
+                                         struct thread, elem);
+      yield = (cur->edf_period == 0
+               || first->edf_deadline < cur->edf_deadline);
+    }
+  intr_set_level (old_level);
+
+  if (yield || cur->edf_period != 0)
+    return yield;
+  if (thread_fair)
+    return fair_wakeup_preempt ();
+  return thread_get_max_priority () > thread_get_priority ();
+}
+
+/* Yields the CPU to the thread with highest priority, or for the
+   fair-share scheduler to a thread that is far enough behind the
+   running thread, or to a thread in the EDF class */
 void
 thread_max_yield (void)
 {
-  if (thread_get_max_priority () > thread_get_priority ())
+  if (thread_should_yield ())
   {
-    if (intr_context ())
+    if (intr_context () || intr_in_softirq ())
     {
       intr_yield_on_return ();
     }
@@ -368,6 +854,43 @@ thread_max_yield (void)
   }
 }
 
+/* Switches straight to T, a thread that the running thread has
+   just woken, if T is the thread that thread_max_yield() would
+   switch to: T has a higher priority than the running thread and
+   is at the front of the run queue.  This skips the run queue
+   scan and the recheck of whether to yield at all.  Returns true
+   if it switched, and the running thread has since been
+   scheduled again, false if T should not preempt the running
+   thread or the scheduler has no fast path for it, in which case
+   the caller should fall back to thread_max_yield().
+
+   T must not be able to exit before this function looks at it,
+   so interrupts must be off from the time T is woken. */
+bool
+thread_yield_to (struct thread *t)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (is_thread (t));
+
+  if (intr_context () || intr_in_softirq () || thread_fair
+      || cur == idle_thread || cur->edf_period != 0 || t->edf_period != 0
+      || !list_empty (&edf_queue))
+    return false;
+  if (t->status != THREAD_READY || t->priority <= cur->priority
+      || ready_queue_max_priority () != t->priority
+      || list_front (&ready_queues[t->priority - PRI_MIN]) != &t->elem)
+    return false;
+
+  ready_queue_remove (t, t->priority);
+  ready_queue_push (cur);
+  cur->status = THREAD_READY;
+  cur->ready_tsc = timer_tsc ();
+  switch_to (t);
+  return true;
+}
+
 /* Yields the CPU.  The current thread is not put to sleep and
    may be scheduled again immediately at the scheduler's whim. */
 void
@@ -380,15 +903,21 @@ thread_yield (void)
 
   old_level = intr_disable ();
   if (cur != idle_thread) 
-    list_insert_ordered(&ready_list,
-                        &cur->elem,
-                        &thread_compare_priority,
-                        NULL);
+    ready_queue_push (cur);
   cur->status = THREAD_READY;
+  cur->ready_tsc = timer_tsc ();
   schedule ();
   intr_set_level (old_level);
 }
 
+/* Returns the number of threads in the THREAD_READY state, not
+   counting the running thread. */
+int
+thread_ready_count (void)
+{
+  return ready_cnt;
+}
+
 /* Invoke function 'func' on all threads, passing along 'aux'.
    This function must be called with interrupts off. */
 void
@@ -413,33 +942,33 @@ thread_get_donated_priority (struct thread *t)
   ASSERT (is_thread (t));
   enum intr_level old_level = intr_disable ();
 
-  int donated_priority = PRI_MIN - 1;
-  if (!list_empty (&t->donations))
-  {
-    struct thread *doner = list_entry (list_front (&t->donations),
-                                       struct thread, dona_elem);
-    donated_priority = doner->priority;
-  }
+  int donated_priority = synch_donated_priority (t);
+#ifdef USERPROG
+  int ipc_priority = ipc_donated_priority (t);
+  if (ipc_priority > donated_priority)
+    donated_priority = ipc_priority;
+#endif
 
   intr_set_level (old_level);
   return donated_priority;
 }
 
-/* Reinserts thread into correct position in sorted list */
+/* Moves a ready thread whose priority has just changed from
+   OLD_PRIORITY to the run queue for its new priority.  The
+   fair-share scheduler and the EDF class do not order threads by
+   priority. */
 static void
-thread_reinsert_ready_list (struct thread *t)
+thread_reinsert_ready_list (struct thread *t, int old_priority)
 {
-  if (t->status == THREAD_READY)
+  if (t->status == THREAD_READY && t->priority != old_priority
+      && !thread_fair && t->edf_period == 0)
     {
       /* Interrupts should already be off for
          non-running threads */
       ASSERT (intr_get_level () == INTR_OFF);
 
-      list_remove (&t->elem);
-      list_insert_ordered (&ready_list,
-                          &t->elem,
-                          thread_compare_priority,
-                          NULL);
+      ready_queue_remove (t, old_priority);
+      ready_queue_push (t);
     }
 }
 
@@ -452,13 +981,15 @@ thread_reset_priority (struct thread *t)
 
   enum intr_level old_level = intr_disable ();
 
+  int old_priority = t->priority;
   int donated_priority = thread_get_donated_priority (t);
   if (donated_priority > t->base_priority)
     t->priority = donated_priority;
   else
     t->priority = t->base_priority;
 
-  thread_reinsert_ready_list(t);
+  thread_reinsert_ready_list (t, old_priority);
+  sema_update_waiter (t, old_priority);
   intr_set_level (old_level);
 }
 
@@ -476,68 +1007,188 @@ thread_set_priority (int new_priority)
   }
 }
 
-/* Priority comparison for threads in the priority_donation list. */
-static bool
-thread_compare_donation (const struct list_elem *a,
-                         const struct list_elem *b,
-                         void *aux UNUSED)
-{
-  struct thread *a_thread = list_entry (a, struct thread, dona_elem);
-  struct thread *b_thread = list_entry (b, struct thread, dona_elem);
-  return a_thread->priority > b_thread->priority;
-}
-
-/* Calculate an up-to-date priority for the given thread and then
-   recursively donate this to the thread which holds its' required lock */
+/* Recalculates T's priority, which must have changed or whose
+   waiters must have changed, and passes the result along the
+   chain of threads holding the locks that T and each holder in
+   turn are waiting on, or serving the calls they are waiting
+   for replies to, until a holder's priority stays the same.
+   Each step costs time proportional to the number of locks the
+   holder holds. */
 void
 thread_donate_priority (struct thread *t)
 {
-    ASSERT (intr_get_level () == INTR_OFF);
-    ASSERT (is_thread (t));
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (is_thread (t));
 
-    while (t->required_lock != NULL)
+  thread_reset_priority (t);
+  for (;;)
     {
-      thread_reset_priority (t);
-
-      struct thread *holder = t->required_lock->holder;
+      struct thread *holder;
+      int old_priority;
+
+      if (t->required_lock != NULL)
+        holder = t->required_lock->holder;
+      else if (t->required_rwlock != NULL)
+        {
+          holder = t->required_rwlock->writer;
+
+          /* Readers hold the reader/writer lock, and draw on the
+             priority of its waiting writers themselves. */
+          if (holder == NULL)
+            rwlock_donate_readers (t->required_rwlock);
+        }
+#ifdef USERPROG
+      else if (t->ipc_server != NULL)
+        holder = t->ipc_server;
+#endif
+      else
+        holder = NULL;
+      if (holder == NULL)
+        return;
       ASSERT (holder != t);
 
-      /* If the thread is not current and has a required lock, it may
-         have already donated so remove old donation to make way for
-         updated donation */
-      if (thread_current () != t)
-      {
-        thread_remove_donation (t);
-      }
+      old_priority = holder->priority;
+      thread_reset_priority (holder);
+      if (holder->priority == old_priority)
+        return;
+      t = holder;
+    }
+}
 
-      if (holder != NULL)
-      {
-        ASSERT (is_thread (holder));
+/* Puts the current thread in the earliest-deadline-first class,
+   in which it runs ahead of all other threads for up to BUDGET
+   timer ticks in each PERIOD ticks, starting now.  Its priority
+   and nice value then no longer affect when it runs.  Returns
+   false, and leaves the thread's class as it was, if the
+   reservation would take the EDF class's total over
+   EDF_UTIL_MAX.  A PERIOD of 0 takes the thread out of the class
+   again. */
+bool
+thread_set_period (int64_t period, int64_t budget) 
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  unsigned util = 0;
 
-        list_insert_ordered (&holder->donations,
-                             &t->dona_elem,
-                             thread_compare_donation,
-                             NULL);
+  ASSERT (period >= 0);
+  ASSERT (period == 0 || (budget > 0 && budget <= period));
 
-        /* Iterate through chain of holders */
-        t = holder;
-      }
-  }
-    thread_reset_priority (t);
+  if (period != 0)
+    util = DIV_ROUND_UP (budget * EDF_UTIL_SCALE, period);
+
+  old_level = intr_disable ();
+  if (edf_util - cur->edf_util + util > EDF_UTIL_MAX)
+    {
+      intr_set_level (old_level);
+      return false;
+    }
+  edf_util = edf_util - cur->edf_util + util;
+  cur->edf_util = util;
+  cur->edf_period = period;
+  cur->edf_budget = budget;
+  cur->edf_deadline = timer_ticks () + period;
+  cur->edf_runtime = budget;
+  intr_set_level (old_level);
+
+  thread_max_yield ();
+  return true;
 }
 
-/* Remove the priority donated to a thread holding a lock this thread
-   previously required */
-void
-thread_remove_donation (struct thread *t)
+/* Returns the timer tick at which the first EDF thread that has
+   used up its budget may run again, or INT64_MAX if there is
+   none.  Interrupts must be off. */
+int64_t
+thread_edf_next_release (void) 
 {
   ASSERT (intr_get_level () == INTR_OFF);
-  ASSERT (is_thread (t));
 
-  if (t->dona_elem.next != NULL)
+  if (list_empty (&edf_throttled))
+    return INT64_MAX;
+  return list_entry (list_front (&edf_throttled),
+                     struct thread, elem)->edf_deadline;
+}
+
+/* Orders threads by EDF deadline. */
+static bool
+edf_less (const struct list_elem *a_, const struct list_elem *b_,
+          void *aux UNUSED)
+{
+  const struct thread *a = list_entry (a_, struct thread, elem);
+  const struct thread *b = list_entry (b_, struct thread, elem);
+
+  return a->edf_deadline < b->edf_deadline;
+}
+
+/* Does the EDF class's work for a timer tick with thread CUR
+   running: starts a new period for throttled threads whose
+   period has ended, and charges CUR for the tick if it is in the
+   class.  Returns true if CUR should be preempted, because it is
+   out of budget or because a ready EDF thread should run
+   instead. */
+static bool
+edf_tick (struct thread *cur)
+{
+  int64_t now;
+
+  if (list_empty (&edf_throttled) && list_empty (&edf_queue)
+      && cur->edf_period == 0)
+    return false;
+
+  now = timer_ticks ();
+  while (!list_empty (&edf_throttled))
+    {
+      struct thread *t = list_entry (list_front (&edf_throttled),
+                                     struct thread, elem);
+      if (t->edf_deadline > now)
+        break;
+      list_pop_front (&edf_throttled);
+      t->edf_deadline += t->edf_period;
+      if (t->edf_deadline <= now)
+        t->edf_deadline = now + t->edf_period;
+      t->edf_runtime = t->edf_budget;
+      ready_queue_push (t);
+    }
+
+  if (cur->edf_period != 0)
+    {
+      if (now >= cur->edf_deadline)
+        {
+          /* Ran past the end of its period with budget left. */
+          stats_inc (&edf_misses);
+          cur->edf_deadline = now + cur->edf_period;
+          cur->edf_runtime = cur->edf_budget;
+        }
+      if (--cur->edf_runtime <= 0)
+        {
+          stats_inc (&edf_throttles);
+          return true;
+        }
+    }
+
+  if (list_empty (&edf_queue))
+    return false;
+  return (cur->edf_period == 0
+          || list_entry (list_front (&edf_queue),
+                         struct thread, elem)->edf_deadline
+             < cur->edf_deadline);
+}
+
+/* Prepares EDF thread T, which is about to become ready after
+   blocking, to run.  If T's period is over, or if the budget it
+   has left would take more than its share of the time left in
+   the period, it starts a new period now, so that a thread that
+   sleeps can never take more than its share. */
+static void
+edf_wake (struct thread *t)
+{
+  int64_t now = timer_ticks ();
+
+  if (now >= t->edf_deadline
+      || (t->edf_runtime * t->edf_period
+          > (t->edf_deadline - now) * t->edf_budget))
     {
-      list_remove (&t->dona_elem);
-      t->dona_elem.next = NULL;
+      t->edf_deadline = now + t->edf_period;
+      t->edf_runtime = t->edf_budget;
     }
 }
 
@@ -548,26 +1199,13 @@ thread_get_priority (void)
   return thread_current ()->priority;
 }
 
-bool
-thread_compare_priority (const struct list_elem *a,
-                         const struct list_elem *b,
-                         void *aux UNUSED)
-{
-  struct thread *a_thread;
-  struct thread *b_thread;
-  a_thread = list_entry (a, struct thread, elem);
-  b_thread = list_entry (b, struct thread, elem);
-
-  return a_thread->priority > b_thread->priority;
-}
-
 /* Returns number of ready threads plus the current one if not idle */
 static int
 get_ready_threads_size (void)
 {
   ASSERT (thread_mlfqs);
 
-  int size = list_size (&ready_list);
+  int size = ready_cnt;
   if (thread_current () != idle_thread)
   {
     size++;
@@ -584,6 +1222,9 @@ thread_calculate_bsd_priority (struct thread *t, void *aux UNUSED)
   ASSERT (thread_mlfqs);
   ASSERT (is_thread (t));
 
+  thread_catch_up_recent_cpu (t);
+
+  int old_priority = t->priority;
   fixed_point fp_priority_max = convert_to_fixed_point (PRI_MAX);
   fixed_point temp_recent_cpu = div_fixed_by_int (t->recent_cpu, 4);
   fixed_point temp_nice = convert_to_fixed_point (t->nice * 2);
@@ -600,42 +1241,69 @@ thread_calculate_bsd_priority (struct thread *t, void *aux UNUSED)
     new_priority = PRI_MAX;
   }
   t->priority = new_priority;
+  thread_reinsert_ready_list (t, old_priority);
+  sema_update_waiter (t, old_priority);
 }
 
 /* Recalculates variables for bsd:
-   Thread priority is recalculated every 4 ticks.
-   Recent_cpu for running thread is incremented every tick
-   and recalculated for every thread once per second.  */
+   Recent_cpu for running thread is incremented every tick and
+   its priority recalculated every 4 ticks, both scaled to the
+   timer frequency.  Once per second
+   load_avg is updated and recent_cpu decayed, but only for the
+   running thread and the threads in the run queue, so the cost
+   does not depend on how many threads are blocked.  Those catch
+   up when they are unblocked.  No other priority changes, so a
+   thread moves between run queues only here, in
+   thread_set_nice() and in thread_unblock(), and schedule() just
+   pops the highest nonempty queue.  */
 static void
-thread_recalculate_bsd_variables (void)
+thread_recalculate_bsd_variables (int64_t now)
 {
+  static int64_t last_second;   /* Second of the last recalculation. */
   ASSERT (thread_mlfqs);
   struct thread *t = thread_current ();
 
   if (t != idle_thread)
   {
     ASSERT (t->status == THREAD_RUNNING);
-    t->recent_cpu = add_fixed_to_int (t->recent_cpu, 1);
+    t->recent_cpu = add_fixed_to_fixed (t->recent_cpu, mlfqs_tick_cpu);
   }
 
-  if (timer_ticks () % TIMER_FREQ == 0)
+  /* Recalculate once on entering each second, even if its first
+     tick went by in a tickless idle period. */
+  if (now / TIMER_FREQ > last_second)
   {
+    last_second = now / TIMER_FREQ;
     thread_calculate_load_avg ();
-    thread_foreach (thread_calculate_recent_cpu, NULL);
+    thread_decay_ready_threads ();
   }
+  else if (now % mlfqs_priority_ticks == 0 && t != idle_thread)
+    thread_calculate_bsd_priority (t, NULL);
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE.  For the
+   fair-share scheduler this changes the thread's weight, which
+   matters only while it runs, since the running thread is not in
+   fair_tree. */
 void
 thread_set_nice (int nice UNUSED) 
 {
-  ASSERT (thread_mlfqs);
+  ASSERT (thread_mlfqs || thread_fair);
   ASSERT (nice >= NICE_MIN && nice <= NICE_MAX);
 
   struct thread *t = thread_current ();
-  t->nice = nice;
-  thread_calculate_bsd_priority (t, NULL);
-  thread_reinsert_ready_list (t);
+  enum intr_level old_level = intr_disable ();
+
+  if (thread_mlfqs)
+    {
+      /* Apply any pending decay with the old nice value first. */
+      thread_catch_up_recent_cpu (t);
+      t->nice = nice;
+      thread_calculate_bsd_priority (t, NULL);
+    }
+  else
+    t->nice = nice;
+  intr_set_level (old_level);
   thread_max_yield ();
 }
 
@@ -643,7 +1311,7 @@ thread_set_nice (int nice UNUSED)
 int
 thread_get_nice (void) 
 {
-  ASSERT (thread_mlfqs);
+  ASSERT (thread_mlfqs || thread_fair);
 
   return thread_current ()->nice;
 }
@@ -676,20 +1344,78 @@ thread_get_load_avg (void)
   return convert_to_int_round_nearest (temp_load_avg);
 }
 
-/*Calculates bsd_scheduler priority using the formula
-  recent_cpu = (2 * load_avg) / (2 * load_avg + 1) * recent_cpu + nice
-*/
+/* Starts a new decay epoch: records the coefficient for
+     recent_cpu = (2 * load_avg) / (2 * load_avg + 1) * recent_cpu + nice
+   in decay_table and brings the running thread and every thread
+   in the run queue up to date. */
 static void
-thread_calculate_recent_cpu (struct thread *t, void *aux UNUSED)
+thread_decay_ready_threads (void)
 {
   ASSERT (thread_mlfqs);
+  ASSERT (intr_get_level () == INTR_OFF);
 
-  fixed_point recent_cpu = t->recent_cpu;
   fixed_point temp_load_avg = multiply_fixed_by_int (load_avg, 2);
   fixed_point temp_sum = add_fixed_to_int (temp_load_avg, 1);
-  fixed_point coefficient = div_fixed_by_fixed (temp_load_avg, temp_sum);
-  recent_cpu = multiply_fixed_by_fixed (coefficient, recent_cpu);
-  recent_cpu = add_fixed_to_int (recent_cpu, t->nice);
+  mlfqs_epoch++;
+  decay_table[mlfqs_epoch % DECAY_TABLE_SIZE]
+    = div_fixed_by_fixed (temp_load_avg, temp_sum);
+
+  if (thread_current () != idle_thread)
+    thread_calculate_bsd_priority (thread_current (), NULL);
+
+  /* Recalculating may move a thread to another queue, possibly
+     one that is still to be visited, but doing so again is
+     harmless because the thread is already up to date. */
+  int i;
+  for (i = PRI_CNT - 1; i >= 0; i--)
+    {
+      struct list_elem *e = list_begin (&ready_queues[i]);
+      while (e != list_end (&ready_queues[i]))
+        {
+          struct thread *t = list_entry (e, struct thread, elem);
+          e = list_next (e);
+          thread_calculate_bsd_priority (t, NULL);
+        }
+    }
+}
+
+/* Applies to T's recent_cpu every decay step it has missed since
+   it was last brought up to date. */
+static void
+thread_catch_up_recent_cpu (struct thread *t)
+{
+  ASSERT (thread_mlfqs);
+
+  unsigned lag = mlfqs_epoch - t->recent_cpu_epoch;
+  fixed_point recent_cpu = t->recent_cpu;
+
+  if (lag > DECAY_TABLE_SIZE)
+    {
+      /* The coefficients of the oldest missed seconds have been
+         overwritten.  Approximate them with the oldest one still
+         in the table; the decay converges geometrically, so at
+         most DECAY_TABLE_SIZE such steps are worth applying. */
+      unsigned oldest = mlfqs_epoch - DECAY_TABLE_SIZE + 1;
+      fixed_point coefficient = decay_table[oldest % DECAY_TABLE_SIZE];
+      unsigned extra = lag - DECAY_TABLE_SIZE;
+      if (extra > DECAY_TABLE_SIZE)
+        extra = DECAY_TABLE_SIZE;
+      while (extra-- > 0)
+        recent_cpu = add_fixed_to_int (multiply_fixed_by_fixed (coefficient,
+                                                                recent_cpu),
+                                       t->nice);
+      t->recent_cpu_epoch = mlfqs_epoch - DECAY_TABLE_SIZE;
+    }
+
+  while (t->recent_cpu_epoch != mlfqs_epoch)
+    {
+      t->recent_cpu_epoch++;
+      fixed_point coefficient
+        = decay_table[t->recent_cpu_epoch % DECAY_TABLE_SIZE];
+      recent_cpu = add_fixed_to_int (multiply_fixed_by_fixed (coefficient,
+                                                              recent_cpu),
+                                     t->nice);
+    }
   t->recent_cpu = recent_cpu;
 }
 
@@ -699,11 +1425,117 @@ thread_get_recent_cpu (void)
 {
   ASSERT (thread_mlfqs);
 
+  enum intr_level old_level = intr_disable ();
+  thread_catch_up_recent_cpu (thread_current ());
   fixed_point temp_recent_cpu = thread_current ()->recent_cpu;
+  intr_set_level (old_level);
   temp_recent_cpu = multiply_fixed_by_int (temp_recent_cpu, 100);
   return convert_to_int_round_nearest (temp_recent_cpu);
 }
 
+/* Returns T's weight for the fair-share scheduler. */
+static uint32_t
+fair_weight (const struct thread *t)
+{
+  return fair_weights[t->nice - NICE_MIN];
+}
+
+/* Orders threads in fair_tree by vruntime. */
+static bool
+fair_less (const struct rb_elem *a_, const struct rb_elem *b_,
+           void *aux UNUSED)
+{
+  const struct thread *a = rb_entry (a_, struct thread, fair_elem);
+  const struct thread *b = rb_entry (b_, struct thread, fair_elem);
+
+  return a->vruntime < b->vruntime;
+}
+
+/* Returns the ready thread with the least vruntime, or a null
+   pointer if no thread is ready.  Interrupts must be off. */
+static struct thread *
+fair_first (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (rb_empty (&fair_tree))
+    return NULL;
+  return rb_entry (rb_begin (&fair_tree), struct thread, fair_elem);
+}
+
+/* Advances fair_min_vruntime to the least vruntime of running
+   thread CUR and the ready threads, if that is greater. */
+static void
+fair_update_min_vruntime (struct thread *cur)
+{
+  struct thread *first = fair_first ();
+  uint64_t min = cur->vruntime;
+
+  if (first != NULL && first->vruntime < min)
+    min = first->vruntime;
+  if (min > fair_min_vruntime)
+    fair_min_vruntime = min;
+}
+
+/* Charges running thread T for a timer tick and returns true if
+   its slice is up: its share, by weight, of fair_latency ticks,
+   or fair_min_granularity ticks if that is more.  T keeps the
+   CPU if no other thread is ready. */
+static bool
+fair_tick (struct thread *t)
+{
+  uint32_t weight = fair_weight (t);
+  unsigned slice;
+
+  t->vruntime += fair_tick_vruntime * NICE_0_WEIGHT / weight;
+  fair_update_min_vruntime (t);
+
+  if (rb_empty (&fair_tree))
+    return false;
+  slice = fair_latency * weight / (fair_load + weight);
+  if (slice < fair_min_granularity)
+    slice = fair_min_granularity;
+  return thread_ticks >= slice;
+}
+
+/* Places T, which is about to become ready after blocking, in
+   the fair-share order.  A new thread starts at
+   fair_min_vruntime.  A thread that has slept keeps its vruntime
+   if it is still recent, but otherwise gets a lead of at most
+   FAIR_SLEEPER_CREDIT ticks on the others, so that it runs soon
+   after waking without having banked the time it slept. */
+static void
+fair_place (struct thread *t)
+{
+  uint64_t credit = (uint64_t) FAIR_SLEEPER_CREDIT * FAIR_TICK;
+  uint64_t floor = (fair_min_vruntime > credit
+                    ? fair_min_vruntime - credit : 0);
+
+  if (t->vruntime < floor)
+    t->vruntime = floor;
+}
+
+/* Returns true if the running thread should give way to a ready
+   thread: always for the idle thread, and otherwise if a ready
+   thread is more than FAIR_WAKEUP_GRANULARITY ticks of vruntime
+   behind it. */
+static bool
+fair_wakeup_preempt (void)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level = intr_disable ();
+  struct thread *first = fair_first ();
+  bool preempt = false;
+
+  if (first != NULL)
+    preempt = (cur == idle_thread
+               || (first->vruntime
+                   + (uint64_t) FAIR_WAKEUP_GRANULARITY * FAIR_TICK
+                   < cur->vruntime));
+  intr_set_level (old_level);
+  return preempt;
+}
+
 /* Idle thread.  Executes when no other thread is ready to run.
 
    The idle thread is initially put on the ready list by
@@ -726,6 +1558,23 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* Nothing else is ready, so zero free pages for palloc
+         until something is, or until there is nothing left to
+         do. */
+      if (palloc_prezero)
+        {
+          intr_enable ();
+          while (ready_cnt == 0 && palloc_prezero_page ())
+            continue;
+          intr_disable ();
+          if (ready_cnt > 0)
+            continue;
+        }
+
+      /* Stop the periodic tick until something is due, if
+         tickless idle is enabled. */
+      timer_idle_enter ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -791,10 +1640,31 @@ init_thread (struct thread *t, const char *name, int priority)
   t->stack = (uint8_t *) t + PGSIZE;
   t->priority = priority;
   t->base_priority = priority;
+  t->hold_cnt = 0;
   t->required_lock = NULL;
+  t->recent_cpu_epoch = mlfqs_epoch;
+  t->vruntime = fair_min_vruntime;
+  t->timer_slack = timer_default_slack;
   t->magic = THREAD_MAGIC;
 
-  list_init (&t->donations);
+  list_init (&t->held_locks);
+  list_init (&t->held_rwlocks);
+#ifdef USERPROG
+  list_init (&t->children);
+  list_init (&t->exited);
+  sema_init (&t->child_exited, 0);
+  t->proc = t;
+  lock_init_named (&t->threads_lock, "threads");
+  cond_init (&t->threads_gone);
+  t->thread_cnt = 1;
+  lock_init_named (&t->fd_lock, "fd-table");
+  t->ipc_server = NULL;
+  list_init (&t->ipc_callers);
+#endif
+#ifdef VM
+  lock_init_named (&t->pages_lock, "page-table");
+  mmap_init (t);
+#endif
 
   old_level = intr_disable ();
   list_push_back (&all_list, &t->allelem);
@@ -822,10 +1692,8 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
-    return idle_thread;
-  else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+  struct thread *t = ready_queue_pop ();
+  return t != NULL ? t : idle_thread;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -853,9 +1721,22 @@ thread_schedule_tail (struct thread *prev)
 
   /* Mark us as running. */
   cur->status = THREAD_RUNNING;
+  if (prev != NULL)
+    {
+      rcu_note_switch ();
+      trace (TRACE_SCHED, TRACE_SWITCH, prev->tid, prev->status);
+      account_switch (prev, cur);
+      perf_switch (prev);
+    }
+
+  /* Start new time slice, unless thread_block_to() handed over
+     the rest of the last one. */
+  if (!slice_handed_off)
+    thread_ticks = 0;
+  slice_handed_off = false;
 
-  /* Start new time slice. */
-  thread_ticks = 0;
+  /* Trap the FPU unless it holds our registers. */
+  fpu_activate (cur);
 
 #ifdef USERPROG
   /* Activate the new address space. */
@@ -866,12 +1747,153 @@ thread_schedule_tail (struct thread *prev)
      thread.  This must happen late so that thread_exit() doesn't
      pull out the rug under itself.  (We don't free
      initial_thread because its memory was not obtained via
-     palloc().) */
-  if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread) 
+     palloc().)  A thread that is still held is freed by
+     thread_release() instead. */
+  if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread
+      && prev->hold_cnt == 0) 
     {
       ASSERT (prev != cur);
-      palloc_free_page (prev);
+      free_thread_page (prev);
+    }
+}
+
+/* Updates the scheduling statistics for a switch from PREV,
+   which may be dying, to CUR.  PREV's switch is voluntary if it
+   blocked or exited, and involuntary if it is still ready to
+   run.  The idle thread's statistics are not kept. */
+static void
+account_switch (struct thread *prev, struct thread *cur)
+{
+  uint64_t now = timer_tsc ();
+
+  if (prev != idle_thread)
+    {
+      prev->run_cycles += now - prev->run_tsc;
+      if (prev->status == THREAD_READY)
+        {
+          prev->involuntary_switches++;
+          stats_inc (&involuntary_switches);
+        }
+      else
+        {
+          prev->voluntary_switches++;
+          stats_inc (&voluntary_switches);
+        }
+    }
+
+  if (cur != idle_thread)
+    {
+      uint64_t waited = now - cur->ready_tsc;
+
+      cur->ready_cycles += waited;
+      if (cur->woken)
+        {
+          cur->woken = false;
+          cur->wakeup_cnt++;
+          cur->wakeup_cycles += waited;
+          if (waited > cur->max_wakeup_cycles)
+            cur->max_wakeup_cycles = waited;
+          hist_add (wakeup_hist, WAKEUP_BUCKETS, waited);
+        }
+      cur->run_tsc = now;
+    }
+}
+
+/* Adds VALUE to log2 histogram HIST, which has CNT buckets. */
+static void
+hist_add (unsigned hist[], size_t cnt, uint64_t value)
+{
+  uint32_t high = value >> 32;
+  uint32_t low = value;
+  size_t bucket;
+
+  if (high != 0)
+    bucket = 64 - __builtin_clz (high);
+  else if (low != 0)
+    bucket = 32 - __builtin_clz (low);
+  else
+    bucket = 0;
+  hist[bucket < cnt ? bucket : cnt - 1]++;
+}
+
+/* Prints the nonempty buckets of log2 histogram HIST, which has
+   CNT buckets, under TITLE. */
+static void
+print_hist (const char *title, const unsigned hist[], size_t cnt)
+{
+  size_t i;
+
+  printf ("Thread: %s:\n", title);
+  for (i = 0; i < cnt; i++)
+    if (hist[i] != 0)
+      {
+        uint64_t low = i > 0 ? (uint64_t) 1 << (i - 1) : 0;
+
+        if (i == cnt - 1)
+          printf ("Thread:   %12llu and up %10u\n", low, hist[i]);
+        else
+          printf ("Thread:   %12llu..%-12llu %10u\n", low,
+                  ((uint64_t) 1 << i) - 1, hist[i]);
+      }
+}
+
+/* Prints the scheduling statistics of thread T, in CPU cycles.
+   A thread_action_func. */
+static void
+print_thread_stats (struct thread *t, void *aux UNUSED)
+{
+  if (t == idle_thread)
+    return;
+  printf ("Thread: %-16s %5d %14llu %14llu %8u %8u %8u %10llu %12llu\n",
+          t->name, t->tid, t->ready_cycles, t->run_cycles,
+          t->voluntary_switches, t->involuntary_switches, t->wakeup_cnt,
+          t->wakeup_cnt > 0 ? t->wakeup_cycles / t->wakeup_cnt : 0,
+          t->max_wakeup_cycles);
+}
+
+/* Returns a page for a new thread, from the cache of dead
+   threads' pages if possible, or a null pointer if memory is
+   short. */
+static struct thread *
+alloc_thread_page (void) 
+{
+  struct thread *t = NULL;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (page_cache_cnt > 0)
+    {
+      t = page_cache[--page_cache_cnt];
+      stats_sub (&pages_cached, 1);
     }
+  intr_set_level (old_level);
+
+  if (t != NULL)
+    {
+      /* Nothing may have written to the page while it was
+         cached. */
+      ASSERT (t->magic == THREAD_MAGIC);
+      stats_inc (&page_reuses);
+      return t;
+    }
+  return palloc_get_page (0);
+}
+
+/* Puts dead thread T's page in the cache, or frees it if the
+   cache is full.  Interrupts must be off. */
+static void
+free_thread_page (struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (is_thread (t));
+
+  if (page_cache_cnt < PAGE_CACHE_SIZE)
+    {
+      page_cache[page_cache_cnt++] = t;
+      stats_inc (&pages_cached);
+    }
+  else
+    palloc_free_page (t);
 }
 
 /* Schedules a new process.  At entry, interrupts must be off and
@@ -883,26 +1905,43 @@ thread_schedule_tail (struct thread *prev)
    has completed. */
 static void
 schedule (void) 
+{
+  switch_to (next_thread_to_run ());
+}
+
+/* Switches from the running thread, whose state must already
+   have been changed from running, to NEXT, which must have been
+   taken off the run queue.  Interrupts must be off. */
+static void
+switch_to (struct thread *next)
 {
   struct thread *cur = running_thread ();
-  struct thread *next = next_thread_to_run ();
   struct thread *prev = NULL;
 
   ASSERT (intr_get_level () == INTR_OFF);
   ASSERT (cur->status != THREAD_RUNNING);
   ASSERT (is_thread (next));
+  ASSERT (cur->rcu_depth == 0);
 
-  if (thread_mlfqs)
-  {
-    thread_foreach (thread_calculate_bsd_priority, NULL);
-    list_sort (&ready_list, thread_compare_priority, NULL);
-  }
+  if (cur == idle_thread)
+    timer_idle_exit ();
 
   if (cur != next)
     prev = switch_threads (cur, next);
   thread_schedule_tail (prev);
 }
 
+/* Adds T, whose tid has been set, to its bucket in tid_buckets.
+   Interrupts must be off. */
+static void
+add_tid (struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  list_push_front (&tid_buckets[(unsigned) t->tid % TID_BUCKETS],
+                   &t->tidelem);
+}
+
 /* Returns a tid to use for a new thread. */
 static tid_t
 allocate_tid (void) 
@@ -3,9 +3,14 @@
 
 #include <debug.h>
 #include <list.h>
+#include <rbtree.h>
 #include <stdint.h>
 #include "threads/synch.h"
 #include "threads/fixed_point.h"
+#include "threads/malloc.h"
+#include "threads/perf.h"
+#include "threads/stats.h"
+#include "threads/work.h"
 
 /* States in a thread's life cycle. */
 enum thread_status
@@ -21,6 +26,11 @@ enum thread_status
 typedef int tid_t;
 #define TID_ERROR ((tid_t) -1)          /* Error value for tid_t. */
 
+/* Earliest-deadline-first class.  Threads in it reserve at most
+   EDF_UTIL_MAX / EDF_UTIL_SCALE of the CPU between them. */
+#define EDF_UTIL_SCALE 1000
+#define EDF_UTIL_MAX 900
+
 /* Thread priorities. */
 #define PRI_MIN 0                       /* Lowest priority. */
 #define PRI_DEFAULT 31                  /* Default priority. */
@@ -80,40 +90,188 @@ typedef int tid_t;
    the `magic' member of the running thread's `struct thread' is
    set to THREAD_MAGIC.  Stack overflow will normally change this
    value, triggering the assertion. */
-/* The `elem' member has a dual purpose.  It can be an element in
-   the run queue (thread.c), or it can be an element in a
-   semaphore wait list (synch.c).  It can be used these two ways
-   only because they are mutually exclusive: only a thread in the
-   ready state is on the run queue, whereas only a thread in the
-   blocked state is on a semaphore wait list. */
+/* The `elem' member is an element in the run queue (thread.c).
+   A thread waiting on a semaphore is instead in the semaphore's
+   wait heap (synch.c), through `wait_elem'.
+
+   The members that every context switch and wakeup touch come
+   first, packed into the first 64-byte cache line of the page,
+   and those that blocking and waking touch follow in the second,
+   so that scheduling a thread brings in two cache lines of its
+   struct thread rather than one for every few members.  Status
+   and priority are kept in a byte each for the purpose.  The
+   rest is laid out by owner.  `magic' must stay last. */
 struct thread
   {
-    /* Owned by thread.c. */
+    /* Hot: read or written on every switch or wakeup.  The
+       first cache line. */
+    uint8_t *stack;                     /* Saved stack pointer. */
+    struct list_elem elem;              /* List element. */
+    uint8_t status;                     /* Thread state, an
+                                           enum thread_status. */
+    int8_t priority;                    /* Effective priority. */
+    bool woken;                         /* Ready since thread_unblock()? */
     tid_t tid;                          /* Thread identifier. */
-    enum thread_status status;          /* Thread state. */
+    uint64_t ready_tsc;                 /* When last made ready, in
+                                           timer_tsc() cycles. */
+    uint64_t run_tsc;                   /* When last scheduled. */
+    uint64_t ready_cycles;              /* Total time ready to run. */
+    uint64_t run_cycles;                /* Total time running. */
+    unsigned wakeup_cnt;                /* Times woken by
+                                           thread_unblock(). */
+    unsigned voluntary_switches;        /* Times blocked. */
+    unsigned involuntary_switches;      /* Times preempted or yielded. */
+
+    /* Warm: read or written when blocking and waking.  The
+       second cache line. */
+    uint64_t wakeup_cycles;             /* Total wakeup latency. */
+    uint64_t max_wakeup_cycles;         /* Longest wakeup latency. */
+    int64_t edf_period;                 /* Length of an EDF period, in
+                                           timer ticks, or 0. */
+    struct heap_elem wait_elem;         /* Element in wait_sema's heap. */
+    struct semaphore *wait_sema;        /* Semaphore waited on, or null. */
+    unsigned wait_seq;                  /* Order of arrival at wait_sema. */
+
+    /* Owned by thread.c. */
     char name[16];                      /* Name (for debugging purposes). */
-    uint8_t *stack;                     /* Saved stack pointer. */
-    int priority;                       /* Effective priority. */
     struct list_elem allelem;           /* List element for all threads list. */
-
-    /* Shared between thread.c and synch.c. */
-    struct list_elem elem;              /* List element. */
+    struct list_elem tidelem;           /* Element in a tid bucket. */
+    unsigned hold_cnt;                  /* Not freed on exit while
+                                           nonzero. */
 
     /* Priority Donations */
     int base_priority;                  /* Priority before donations */
-    struct list donations;              /* Sorted list of donated priorities */
-    struct list_elem dona_elem;         /* Elem for donating priority */
+    struct list held_locks;             /* Locks held */
+    struct list held_rwlocks;           /* Reader/writer locks held for
+                                           writing */
     struct lock *required_lock;         /* Lock which thread is waiting to
                                            acquire */
+    struct rwlock *required_rwlock;     /* Reader/writer lock waited on */
+    struct rwlock_hold read_holds[RWLOCK_READ_MAX];
+                                        /* Reader/writer locks held for
+                                           reading */
 
     /* BSD_scheduler */
     int nice;                           /* Niceness of a thread */
     fixed_point recent_cpu;             /* Amount of recent cpu time a thread
                                            has received */
+    unsigned recent_cpu_epoch;          /* Decay epoch recent_cpu is up to
+                                           date with */
+
+    /* Fair-share scheduler */
+    struct rb_elem fair_elem;           /* Element in the fair run queue. */
+    uint64_t vruntime;                  /* CPU time received, weighted by
+                                           nice */
+
+    /* Earliest-deadline-first class, if EDF_PERIOD is nonzero.
+       Times are in timer ticks. */
+    int64_t edf_budget;                 /* CPU time per period. */
+    int64_t edf_deadline;               /* End of the current period. */
+    int64_t edf_runtime;                /* Budget left in this period. */
+    unsigned edf_util;                  /* Share of the CPU reserved, in
+                                           EDF_UTIL_SCALE units. */
+
+    /* Owned by threads/malloc.c. */
+    struct malloc_magazine magazines[MALLOC_CLASS_CNT];
+                                        /* Cached free blocks. */
+
+    /* Owned by threads/fpu.c. */
+    void *fpu;                          /* FPU save area, or null. */
+
+    /* Owned by threads/perf.c. */
+    struct perf_counts perf;            /* Hardware events while
+                                           running. */
+
+    /* Owned by devices/timer.c. */
+    int64_t timer_slack;                /* Ticks timer_sleep() may
+                                           wake late by. */
+
+    /* Owned by threads/rcu.c. */
+    int rcu_depth;                      /* Nesting of rcu_read_lock(). */
+    bool rcu_yield;                     /* Yield at rcu_read_unlock()? */
+
+#ifdef FILESYS
+    /* Owned by filesys/journal.c. */
+    int journal_depth;                  /* Nesting of journal_begin(). */
+    int journal_credits;                /* Sectors left to log. */
+#endif
 
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
+    int exit_code;                      /* Status reported on exit. */
+    struct process_status *wait_status; /* Shared with parent, or null. */
+    struct list children;               /* Children's process_status. */
+    struct list exited;                 /* Exited children, in order. */
+    struct semaphore child_exited;      /* Upped as children exit. */
+    struct work reap_work;              /* Tears down address space
+                                           after exit. */
+
+    /* Threads of a process.  The process's first thread, its
+       "leader", holds the state of the whole process, here and in
+       the members below, and PROC in each of its threads points
+       to it.  Owned by userprog/process.c. */
+    struct thread *proc;                /* Leader of this thread's
+                                           process; itself if none. */
+    uint32_t *tid_word;                 /* Cleared on exit, or null. */
+    bool exit_alone;                    /* Exiting without ending the
+                                           process? */
+    struct lock threads_lock;           /* Protects the next three. */
+    struct condition threads_gone;      /* Signaled as threads exit. */
+    int thread_cnt;                     /* Threads in the process. */
+    bool exiting;                       /* Process is exiting? */
+
+    /* Owned by userprog/fd.c. */
+    struct lock fd_lock;                /* Protects the descriptor
+                                           table. */
+    struct file **fds;                  /* Open files, by descriptor. */
+    struct bitmap *fd_map;              /* Descriptors in use. */
+    size_t fd_cnt;                      /* Size of fds and fd_map. */
+    size_t fd_low;                      /* All below are in use. */
+
+    /* Owned by userprog/ipc.c. */
+    struct thread *ipc_server;          /* Thread serving this thread's
+                                           call, or null. */
+    struct list ipc_callers;            /* Calls received, not yet
+                                           replied to. */
+
+    /* Memory statistics, counted by vm/page.c, sometimes on
+       behalf of another thread. */
+    struct stats_counter minor_faults;  /* Faults that did no I/O. */
+    struct stats_counter major_faults;  /* Faults that read a page. */
+    struct stats_counter swap_ins;      /* Pages read from swap. */
+    struct stats_counter swap_outs;     /* Pages written to swap. */
+#endif
+#ifdef VM
+    /* Owned by vm/page.c. */
+    struct lock pages_lock;             /* Protects the page table. */
+    int pages_depth;                    /* Nesting of page_table_lock()
+                                           beyond the first. */
+    struct hash *pages;                 /* Supplemental page table. */
+    struct rb_tree regions;             /* Ranges of pages not yet in
+                                           the table. */
+    void *stack_bottom;                 /* Lowest page of stack. */
+    size_t stack_run;                   /* Pages added by last growth. */
+    void *heap_start;                   /* Lowest page of heap. */
+    void *heap_end;                     /* End of heap, the break. */
+    struct list large_pages;            /* Large pages of the heap. */
+    void *large_miss;                   /* Last span of the heap that
+                                           could not get one. */
+    void *user_esp;                     /* User %esp in a system call,
+                                           or null. */
+    void *swap_upage;                   /* Page last written to swap. */
+    size_t swap_slot;                   /* Its swap slot. */
+
+    /* Owned by vm/frame.c. */
+    unsigned refault_rate;              /* Recent refaults, decaying. */
+    int64_t refault_tick;               /* Last decay of refault_rate. */
+
+    /* Owned by vm/mmap.c. */
+    struct rb_tree mappings;            /* Memory-mapped files. */
+    int next_mapid;                     /* Next mapping identifier. */
+
+    /* Owned by userprog/process.c. */
+    struct file *exec_file;             /* Executable, backing pages. */
 #endif
 
     /* Owned by thread.c. */
@@ -125,38 +283,54 @@ struct thread
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
+/* If true, use the fair-share scheduler, which runs the thread
+   that has had the least CPU time for its nice value.
+   Controlled by kernel command-line option "-fair". */
+extern bool thread_fair;
+
+/* -slice: Timer ticks in a time slice, or 0 for the default. */
+extern unsigned thread_time_slice;
+
 void thread_init (void);
 void thread_start (void);
 
-void thread_tick (void);
+void thread_tick (int64_t now);
+void thread_credit_idle_ticks (unsigned cnt);
 void thread_print_stats (void);
 
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
 
 void thread_block (void);
+void thread_block_to (struct thread *);
 void thread_unblock (struct thread *);
 
 struct thread *thread_current (void);
 tid_t thread_tid (void);
 const char *thread_name (void);
 
+struct thread *thread_lookup (tid_t);
+struct thread *thread_get (tid_t);
+
 void thread_exit (void) NO_RETURN;
+void thread_hold (struct thread *);
+void thread_release (struct thread *);
 void thread_yield (void);
 void thread_max_yield (void);
+bool thread_yield_to (struct thread *);
+int thread_ready_count (void);
 
 /* Performs some operation on thread t, given auxiliary data AUX. */
 typedef void thread_action_func (struct thread *t, void *aux);
 void thread_foreach (thread_action_func *, void *);
 
+bool thread_set_period (int64_t period, int64_t budget);
+int64_t thread_edf_next_release (void);
+
 int thread_get_priority (void);
 void thread_set_priority (int);
 void thread_reset_priority (struct thread *t);
 void thread_donate_priority (struct thread *t);
-void thread_remove_donation (struct thread *t);
-bool thread_compare_priority (const struct list_elem *a,
-                              const struct list_elem *b,
-                              void *aux UNUSED);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
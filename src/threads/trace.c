@@ -0,0 +1,154 @@
+#include "threads/trace.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Kernel event tracing.
+
+   Each traced event is recorded, with the time stamp counter,
+   the running thread's tid and two event-specific arguments, in
+   a ring buffer of TRACE_CNT records that keeps the most recent
+   ones.  Recording an event takes a few dozen cycles with
+   interrupts off, and an event whose category is not enabled
+   costs only a test of trace_mask, so the calls can stay in the
+   scheduler, synchronization, page fault and disk paths.
+
+   The -trace=CATEGORY[,CATEGORY]... kernel option picks the
+   categories to record, from "sched", "synch", "vm", "io" and
+   "all".  At power off trace_dump() prints the buffer to the
+   console, one "Trace:" line per event, oldest first, which
+   utils/pintos-trace turns into a timeline. */
+
+/* Pages taken by the ring buffer. */
+#define TRACE_PAGES 24
+
+/* A recorded event. */
+struct trace_record
+  {
+    uint64_t tsc;               /* Time stamp counter. */
+    int32_t tid;                /* Running thread. */
+    uint32_t event;             /* A trace_event. */
+    uint32_t a, b;              /* Arguments. */
+  };
+
+/* Number of records in the ring buffer, a power of 2. */
+#define TRACE_CNT (TRACE_PAGES * PGSIZE / sizeof (struct trace_record))
+
+/* Categories being traced.  Nonzero only once the ring buffer
+   exists. */
+unsigned trace_mask;
+
+/* Categories picked by -trace. */
+static unsigned selected;
+
+/* Ring buffer, and the number of events ever recorded in it. */
+static struct trace_record *ring;
+static uint32_t recorded;
+
+/* Names of the categories, for -trace, indexed by bit number. */
+static const char *category_names[] = {"sched", "synch", "vm", "io"};
+#define CATEGORY_CNT (sizeof category_names / sizeof *category_names)
+
+/* Names of the events, for trace_dump(). */
+static const char *event_names[TRACE_EVENT_CNT] =
+  {
+    [TRACE_SWITCH] = "switch",
+    [TRACE_BLOCK] = "block",
+    [TRACE_UNBLOCK] = "unblock",
+    [TRACE_SEMA_WAIT] = "sema-wait",
+    [TRACE_LOCK_WAIT] = "lock-wait",
+    [TRACE_RWLOCK_WAIT] = "rwlock-wait",
+    [TRACE_PAGE_FAULT] = "page-fault",
+    [TRACE_IO_ISSUE] = "io-issue",
+    [TRACE_IO_DONE] = "io-done",
+  };
+
+/* Picks the comma-separated CATEGORIES for trace_init() to
+   enable.  Returns false if one of them has no such name. */
+bool
+trace_select (const char *categories)
+{
+  char buf[64];
+  char *name, *save_ptr;
+
+  if (categories == NULL)
+    return false;
+  strlcpy (buf, categories, sizeof buf);
+  for (name = strtok_r (buf, ",", &save_ptr); name != NULL;
+       name = strtok_r (NULL, ",", &save_ptr))
+    {
+      size_t i;
+
+      if (!strcmp (name, "all"))
+        {
+          selected = (1u << CATEGORY_CNT) - 1;
+          continue;
+        }
+      for (i = 0; i < CATEGORY_CNT; i++)
+        if (!strcmp (name, category_names[i]))
+          break;
+      if (i >= CATEGORY_CNT)
+        return false;
+      selected |= 1u << i;
+    }
+  return true;
+}
+
+/* Allocates the ring buffer and starts tracing the categories
+   picked by trace_select(), if any.  The page allocator must
+   have been initialized. */
+void
+trace_init (void)
+{
+  ASSERT ((TRACE_CNT & (TRACE_CNT - 1)) == 0);
+
+  if (selected == 0)
+    return;
+  ring = palloc_get_multiple (PAL_ASSERT, TRACE_PAGES);
+  trace_mask = selected;
+}
+
+/* Records EVENT with arguments A and B.  Use trace() instead,
+   which checks that EVENT's category is enabled first. */
+void
+trace_log (enum trace_event event, uint32_t a, uint32_t b)
+{
+  enum intr_level old_level;
+  struct trace_record *r;
+
+  old_level = intr_disable ();
+  r = &ring[recorded++ % TRACE_CNT];
+  r->tsc = timer_tsc ();
+  r->tid = thread_tid ();
+  r->event = event;
+  r->a = a;
+  r->b = b;
+  intr_set_level (old_level);
+}
+
+/* Prints the recorded events, oldest first, and stops tracing. */
+void
+trace_dump (void)
+{
+  uint32_t first, i;
+
+  if (trace_mask == 0)
+    return;
+  trace_mask = 0;
+
+  first = recorded > TRACE_CNT ? recorded - TRACE_CNT : 0;
+  printf ("Trace: %"PRIu32" events, %"PRIu32" overwritten\n",
+          recorded, first);
+  for (i = first; i != recorded; i++)
+    {
+      const struct trace_record *r = &ring[i % TRACE_CNT];
+      printf ("Trace: %llu %"PRId32" %s %#"PRIx32" %#"PRIx32"\n",
+              r->tsc, r->tid, event_names[r->event], r->a, r->b);
+    }
+}
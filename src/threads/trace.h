@@ -0,0 +1,57 @@
+#ifndef THREADS_TRACE_H
+#define THREADS_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Kernel event tracing.  See trace.c for details. */
+
+/* Categories of events, enabled with -trace on the kernel
+   command line. */
+enum trace_category
+  {
+    TRACE_SCHED = 0x1,          /* Thread switches and wakeups. */
+    TRACE_SYNCH = 0x2,          /* Waits on semaphores and locks. */
+    TRACE_VM = 0x4,             /* Page faults. */
+    TRACE_IO = 0x8              /* Disk requests. */
+  };
+
+/* Events.  The comment on each gives the meaning of the two
+   arguments recorded with it. */
+enum trace_event
+  {
+    TRACE_SWITCH,               /* Switched from tid A, left in state B. */
+    TRACE_BLOCK,                /* Running thread blocks. */
+    TRACE_UNBLOCK,              /* Tid A made ready, at priority B. */
+    TRACE_SEMA_WAIT,            /* Waits on semaphore A. */
+    TRACE_LOCK_WAIT,            /* Waits on lock A, held by tid B. */
+    TRACE_RWLOCK_WAIT,          /* Waits on rwlock A, to write if B. */
+    TRACE_PAGE_FAULT,           /* Fault at address A, error code B. */
+    TRACE_IO_ISSUE,             /* Disk transfer at position A, B sectors,
+                                   B's top bit set for a write. */
+    TRACE_IO_DONE,              /* The transfer A, B finishes. */
+    TRACE_EVENT_CNT             /* Number of events. */
+  };
+
+/* Top bit of a TRACE_IO_* event's second argument. */
+#define TRACE_IO_WRITE 0x80000000u
+
+/* Categories being traced. */
+extern unsigned trace_mask;
+
+bool trace_select (const char *categories);
+void trace_init (void);
+void trace_log (enum trace_event, uint32_t a, uint32_t b);
+void trace_dump (void);
+
+/* Records EVENT, in category CATEGORY, with arguments A and B, if
+   CATEGORY is being traced. */
+static inline void
+trace (enum trace_category category, enum trace_event event,
+       uint32_t a, uint32_t b)
+{
+  if (trace_mask & category)
+    trace_log (event, a, b);
+}
+
+#endif /* threads/trace.h */
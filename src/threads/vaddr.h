@@ -2,9 +2,11 @@
 #define THREADS_VADDR_H
 
 #include <debug.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "threads/fpu.h"
 #include "threads/loader.h"
 
 /* Functions and macros for working with virtual addresses.
@@ -86,4 +88,35 @@ vtop (const void *vaddr)
   return (uintptr_t) vaddr - (uintptr_t) PHYS_BASE;
 }
 
+/* Sets the page at PAGE to zeros.  Faster than memset() for a
+   whole page, since it needs no alignment or length checks, and
+   goes around the cache if the CPU has SSE2. */
+static inline void
+clear_page (void *page)
+{
+  size_t words = PGSIZE / 4;
+
+  ASSERT (pg_ofs (page) == 0);
+  if (fpu_nt_pages)
+    fpu_clear_page (page);
+  else
+    asm volatile ("rep stosl"
+                  : "+D" (page), "+c" (words) : "a" (0) : "memory");
+}
+
+/* Copies the page at SRC to the page at DST, which must not be
+   the same page, around the cache if the CPU has SSE2. */
+static inline void
+copy_page (void *dst, const void *src)
+{
+  size_t words = PGSIZE / 4;
+
+  ASSERT (pg_ofs (dst) == 0 && pg_ofs (src) == 0);
+  if (fpu_nt_pages)
+    fpu_copy_page (dst, src);
+  else
+    asm volatile ("rep movsl"
+                  : "+D" (dst), "+S" (src), "+c" (words) : : "memory");
+}
+
 #endif /* threads/vaddr.h */
@@ -0,0 +1,164 @@
+#include "threads/work.h"
+#include <debug.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/stats.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Deferred work.
+
+   Background jobs, such as the buffer cache's write-behind and
+   read-ahead, queue struct work items here instead of each
+   keeping a kernel thread, and its stack page, of its own.
+   WORK_THREAD_CNT worker threads at WORK_PRIORITY run the items
+   in the order they were queued.  A long item only holds up the
+   items behind it while every worker is busy.
+
+   The queue is protected by turning off interrupts, not by a
+   lock, so work_queue() may be called from an interrupt handler
+   as well as from a thread.  Waking a worker from an interrupt
+   handler yields to it on return, as sema_up() does for any
+   higher-priority thread.  work_queue_delayed() queues an item
+   from the timer interrupt after a delay, which is how periodic
+   jobs requeue themselves.
+
+   An item is taken off the queue before its function runs, so it
+   may queue itself again, and it is never queued twice at once:
+   queuing an item that is already waiting has no effect. */
+
+/* Number of worker threads. */
+#define WORK_THREAD_CNT 2
+
+/* Priority of the worker threads. */
+#define WORK_PRIORITY PRI_DEFAULT
+
+/* A delayed item may be queued up to 1/WORK_SLACK_DIV of its
+   delay late, which lets the periodic jobs' timer events share
+   ticks with each other and with sleeping threads (see
+   timer_slacken()). */
+#define WORK_SLACK_DIV 8
+
+/* Queued items, and a semaphore counting them once the workers
+   have started. */
+static struct list queue = LIST_INITIALIZER (queue);
+static struct semaphore queue_cnt;
+static bool started;
+
+/* Number of items run. */
+static struct stats_counter done_cnt;
+
+static thread_func worker;
+static timer_event_func queue_from_timer;
+
+/* Initializes W to run FUNC with AUX when queued. */
+void
+work_init (struct work *w, work_func *func, void *aux) 
+{
+  ASSERT (w != NULL);
+  ASSERT (func != NULL);
+
+  w->func = func;
+  w->aux = aux;
+  w->queued = false;
+  w->timer.pending = false;
+}
+
+/* Queues W to be run by a worker thread.  Returns true if W was
+   queued, false if it was already waiting to run.  May be called
+   from an interrupt handler, and before work_start(). */
+bool
+work_queue (struct work *w) 
+{
+  enum intr_level old_level;
+  bool queued = false;
+  bool wake = false;
+
+  old_level = intr_disable ();
+  if (!w->queued)
+    {
+      w->queued = true;
+      list_push_back (&queue, &w->elem);
+      queued = true;
+      wake = started;
+    }
+  intr_set_level (old_level);
+
+  if (wake)
+    sema_up (&queue_cnt);
+  return queued;
+}
+
+/* Queues W once TICKS timer ticks have passed, or a little
+   later.  Returns false, doing nothing, if W is already waiting
+   for its delay or for a worker.  May be called from an
+   interrupt handler. */
+bool
+work_queue_delayed (struct work *w, int64_t ticks) 
+{
+  enum intr_level old_level;
+  bool queued = false;
+
+  old_level = intr_disable ();
+  if (!w->queued && !w->timer.pending)
+    {
+      timer_event_schedule (&w->timer,
+                            timer_slacken (timer_ticks () + ticks,
+                                           ticks / WORK_SLACK_DIV),
+                            queue_from_timer, w);
+      queued = true;
+    }
+  intr_set_level (old_level);
+  return queued;
+}
+
+/* Timer event function for work_queue_delayed(). */
+static void
+queue_from_timer (void *w) 
+{
+  work_queue (w);
+}
+
+/* Starts the worker threads.  Must be called after
+   thread_start(). */
+void
+work_start (void) 
+{
+  enum intr_level old_level;
+  int i;
+
+  /* Count the items queued so far. */
+  old_level = intr_disable ();
+  sema_init (&queue_cnt, list_size (&queue));
+  started = true;
+  intr_set_level (old_level);
+
+  stats_register (&done_cnt, "work", "done", STATS_COUNTER);
+  for (i = 0; i < WORK_THREAD_CNT; i++)
+    {
+      char name[16];
+
+      snprintf (name, sizeof name, "worker%d", i);
+      thread_create (name, WORK_PRIORITY, worker, NULL);
+    }
+}
+
+/* A worker thread: runs queued items, one at a time. */
+static void
+worker (void *aux UNUSED) 
+{
+  for (;;)
+    {
+      enum intr_level old_level;
+      struct work *w;
+
+      sema_down (&queue_cnt);
+      old_level = intr_disable ();
+      w = list_entry (list_pop_front (&queue), struct work, elem);
+      w->queued = false;
+      intr_set_level (old_level);
+
+      w->func (w->aux);
+      stats_inc (&done_cnt);
+    }
+}
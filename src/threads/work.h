@@ -0,0 +1,32 @@
+#ifndef THREADS_WORK_H
+#define THREADS_WORK_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "devices/timer.h"
+
+/* Deferred work, run by a shared pool of kernel threads.  See
+   work.c for details. */
+
+/* Function run by a worker thread for a work item.  It may
+   sleep. */
+typedef void work_func (void *aux);
+
+/* A unit of deferred work, usually a static object in the module
+   that queues it. */
+struct work
+  {
+    struct list_elem elem;      /* In the pool's queue. */
+    work_func *func;            /* Function to run. */
+    void *aux;                  /* Its argument. */
+    bool queued;                /* In the queue? */
+    struct timer_event timer;   /* For work_queue_delayed(). */
+  };
+
+void work_init (struct work *, work_func *, void *aux);
+bool work_queue (struct work *);
+bool work_queue_delayed (struct work *, int64_t ticks);
+void work_start (void);
+
+#endif /* threads/work.h */
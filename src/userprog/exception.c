@@ -2,11 +2,22 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include "userprog/gdt.h"
+#include "threads/flags.h"
 #include "threads/interrupt.h"
+#include "threads/stats.h"
 #include "threads/thread.h"
-
-/* Number of page faults processed. */
-static long long page_fault_cnt;
+#include "threads/trace.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
+
+/* Page faults processed, by where they happened, and those
+   that brought a page in, by whether it had to be read. */
+static struct stats_counter user_fault_cnt;
+static struct stats_counter kernel_fault_cnt;
+static struct stats_counter minor_fault_cnt;
+static struct stats_counter major_fault_cnt;
 
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
@@ -41,12 +52,10 @@ exception_init (void)
   /* These exceptions have DPL==0, preventing user processes from
      invoking them via the INT instruction.  They can still be
      caused indirectly, e.g. #DE can be caused by dividing by
-     0.  */
+     0.  #NM belongs to threads/fpu.c. */
   intr_register_int (0, 0, INTR_ON, kill, "#DE Divide Error");
   intr_register_int (1, 0, INTR_ON, kill, "#DB Debug Exception");
   intr_register_int (6, 0, INTR_ON, kill, "#UD Invalid Opcode Exception");
-  intr_register_int (7, 0, INTR_ON, kill,
-                     "#NM Device Not Available Exception");
   intr_register_int (11, 0, INTR_ON, kill, "#NP Segment Not Present");
   intr_register_int (12, 0, INTR_ON, kill, "#SS Stack Fault Exception");
   intr_register_int (13, 0, INTR_ON, kill, "#GP General Protection Exception");
@@ -58,13 +67,15 @@ exception_init (void)
      We need to disable interrupts for page faults because the
      fault address is stored in CR2 and needs to be preserved. */
   intr_register_int (14, 0, INTR_OFF, page_fault, "#PF Page-Fault Exception");
-}
 
-/* Prints exception statistics. */
-void
-exception_print_stats (void) 
-{
-  printf ("Exception: %lld page faults\n", page_fault_cnt);
+  stats_register (&user_fault_cnt, "exception", "user_page_faults",
+                  STATS_COUNTER);
+  stats_register (&kernel_fault_cnt, "exception", "kernel_page_faults",
+                  STATS_COUNTER);
+  stats_register (&minor_fault_cnt, "exception", "minor_faults",
+                  STATS_COUNTER);
+  stats_register (&major_fault_cnt, "exception", "major_faults",
+                  STATS_COUNTER);
 }
 
 /* Handler for an exception (probably) caused by a user process. */
@@ -92,6 +103,16 @@ kill (struct intr_frame *f)
       thread_exit (); 
 
     case SEL_KCSEG:
+      /* SYSENTER does not clear the trap flag, so a user program
+         that single-steps into it takes a debug trap on the
+         first instruction of sysenter_entry.  The kernel itself
+         never sets the trap flag, so just clear it and go on. */
+      if (f->vec_no == 1 && (f->eflags & FLAG_TF))
+        {
+          f->eflags &= ~FLAG_TF;
+          return;
+        }
+
       /* Kernel's code segment, which indicates a kernel bug.
          Kernel code shouldn't throw exceptions.  (Page faults
          may cause kernel exceptions--but they shouldn't arrive
@@ -140,17 +161,54 @@ page_fault (struct intr_frame *f)
      be assured of reading CR2 before it changed). */
   intr_enable ();
 
-  /* Count page faults. */
-  page_fault_cnt++;
+  trace (TRACE_VM, TRACE_PAGE_FAULT, (uint32_t) fault_addr, f->error_code);
 
   /* Determine cause. */
   not_present = (f->error_code & PF_P) == 0;
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
+  stats_inc (user ? &user_fault_cnt : &kernel_fault_cnt);
+
+#ifdef VM
+  /* Bring the page in if it is not in memory, or give it a
+     frame of its own if it was mapped to the zero page, or grow
+     the stack to cover it.  A fault in the kernel, on behalf of a
+     system call, is judged against the process's stack pointer
+     at the time of the call.  The process's own count of major
+     faults tells whether the page had to be read. */
+  if (is_user_vaddr (fault_addr)) 
+    {
+      struct thread *t = thread_current ();
+      uint64_t major_cnt = stats_get (&t->proc->major_faults);
+      bool success;
+
+      page_table_lock ();
+      success = (page_fault_in (fault_addr, write)
+                 || page_grow_stack (fault_addr,
+                                     user ? f->esp : t->user_esp, write));
+      page_table_unlock ();
+      if (success)
+        {
+          stats_inc (stats_get (&t->proc->major_faults) != major_cnt
+                     ? &major_fault_cnt : &minor_fault_cnt);
+          return;
+        }
+    }
+#endif
+
+  /* A fault in the kernel on a user address is a bad pointer
+     passed to a system call, caught by one of the get_user() and
+     put_user() family in userprog/syscall.c, which are the only
+     kernel code that touches user memory.  They put the address
+     to resume at in %eax, and expect -1 there to tell them that
+     the access failed. */
+  if (!user && is_user_vaddr (fault_addr))
+    {
+      f->eip = (void (*) (void)) f->eax;
+      f->eax = 0xffffffff;
+      return;
+    }
 
-  /* To implement virtual memory, delete the rest of the function
-     body, and replace it with code that brings in the page to
-     which fault_addr refers. */
   printf ("Page fault at %p: %s error %s page in %s context.\n",
           fault_addr,
           not_present ? "not present" : "rights violation",
@@ -7,6 +7,5 @@
 #define PF_U 0x4    /* 0: kernel, 1: user process. */
 
 void exception_init (void);
-void exception_print_stats (void);
 
 #endif /* userprog/exception.h */
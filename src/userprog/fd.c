@@ -0,0 +1,279 @@
+#include "userprog/fd.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "userprog/process.h"
+
+/* File descriptor tables.
+
+   Each process's open files are kept in an array indexed by file
+   descriptor, so looking one up is a bounds check and a load, and
+   closing one is a store, however many files are open.  A bitmap
+   records which descriptors are in use, and the table remembers
+   the lowest one that might be free, so that opening a file
+   takes the lowest free descriptor without walking the ones
+   below it that are known to be taken.  When every descriptor is
+   in use, the array and bitmap are replaced by ones twice the
+   size, which costs constant time per open on average.
+
+   Descriptors below FD_FIRST are the console and are marked in
+   use from the start.  fd_install_at() can make them refer to a
+   file instead, such as one end of a pipe, and closing that file
+   makes them the console again.
+
+   The threads of a process share its table, so each change to
+   the table and each lookup holds the table's lock.  The lock
+   does not keep a file from being closed by one thread while
+   another uses it; a program must not do that. */
+
+/* Number of descriptors in a table when it is first needed. */
+#define FD_INIT_CNT 16
+
+static bool grow (struct thread *);
+
+/* Adds FILE to the running process's descriptor table.  Returns
+   the lowest free file descriptor, which now refers to FILE, or
+   -1 if memory is not available. */
+int
+fd_install (struct file *file) 
+{
+  struct thread *t = process_current ();
+  size_t fd;
+
+  ASSERT (file != NULL);
+
+  lock_acquire (&t->fd_lock);
+  fd = BITMAP_ERROR;
+  if (t->fd_map != NULL)
+    fd = bitmap_scan_and_flip (t->fd_map, t->fd_low, 1, false);
+  if (fd == BITMAP_ERROR)
+    {
+      if (!grow (t))
+        {
+          lock_release (&t->fd_lock);
+          return -1;
+        }
+      fd = bitmap_scan_and_flip (t->fd_map, t->fd_low, 1, false);
+      ASSERT (fd != BITMAP_ERROR);
+    }
+  t->fds[fd] = file;
+  t->fd_low = fd + 1;
+  lock_release (&t->fd_lock);
+  return fd;
+}
+
+/* Makes FD in the running process's descriptor table refer to
+   FILE, closing any file it referred to before.  FD may be one
+   of the console's descriptors.  Returns true if successful,
+   false if FD cannot name a file or memory is not available, in
+   which case FILE is closed. */
+bool
+fd_install_at (int fd, struct file *file) 
+{
+  struct thread *t = process_current ();
+  struct file *old;
+
+  ASSERT (file != NULL);
+
+  if (fd < 0 || fd > FD_MAX)
+    {
+      file_close (file);
+      return false;
+    }
+  lock_acquire (&t->fd_lock);
+  while ((size_t) fd >= t->fd_cnt)
+    if (!grow (t))
+      {
+        lock_release (&t->fd_lock);
+        file_close (file);
+        return false;
+      }
+  old = t->fds[fd];
+  t->fds[fd] = file;
+  bitmap_mark (t->fd_map, fd);
+  lock_release (&t->fd_lock);
+  file_close (old);
+  return true;
+}
+
+/* Gives the running process, under descriptor FD, its own copy,
+   at the same position, of the file that FROM_FD refers to in
+   process FROM.  Returns true if successful, false if FROM_FD or
+   FD cannot name a file or memory is not available. */
+bool
+fd_dup_from (struct thread *from, int from_fd, int fd) 
+{
+  struct file *file = NULL;
+
+  lock_acquire (&from->fd_lock);
+  if (from_fd >= 0 && (size_t) from_fd < from->fd_cnt
+      && from->fds[from_fd] != NULL)
+    {
+      file = file_reopen (from->fds[from_fd]);
+      if (file != NULL)
+        file_seek (file, file_tell (from->fds[from_fd]));
+    }
+  lock_release (&from->fd_lock);
+  return file != NULL && fd_install_at (fd, file);
+}
+
+/* Returns the file that FD refers to in the running process, or
+   a null pointer if none, which for a descriptor below FD_FIRST
+   means the console. */
+struct file *
+fd_lookup (int fd) 
+{
+  struct thread *t = process_current ();
+  struct file *file = NULL;
+
+  lock_acquire (&t->fd_lock);
+  if (fd >= 0 && (size_t) fd < t->fd_cnt)
+    file = t->fds[fd];
+  lock_release (&t->fd_lock);
+  return file;
+}
+
+/* Frees FD in the running process's descriptor table and
+   returns the file it referred to, which the caller must close,
+   or a null pointer if it did not refer to a file. */
+struct file *
+fd_remove (int fd) 
+{
+  struct thread *t = process_current ();
+  struct file *file = NULL;
+
+  lock_acquire (&t->fd_lock);
+  if (fd >= 0 && (size_t) fd < t->fd_cnt)
+    file = t->fds[fd];
+  if (file != NULL)
+    {
+      t->fds[fd] = NULL;
+      if (fd >= FD_FIRST)
+        {
+          bitmap_reset (t->fd_map, fd);
+          if ((size_t) fd < t->fd_low)
+            t->fd_low = fd;
+        }
+    }
+  lock_release (&t->fd_lock);
+  return file;
+}
+
+/* Closes all of the running process's files and frees its
+   descriptor table.  The process must have no other threads
+   left. */
+void
+fd_close_all (void) 
+{
+  struct thread *t = process_current ();
+  size_t fd;
+
+  for (fd = 0; fd < t->fd_cnt; fd++)
+    file_close (t->fds[fd]);
+  free (t->fds);
+  if (t->fd_map != NULL)
+    bitmap_destroy (t->fd_map);
+  t->fds = NULL;
+  t->fd_map = NULL;
+  t->fd_cnt = t->fd_low = 0;
+}
+
+/* Gives the running process, which must have no open files yet,
+   its own copy of each of PARENT's open files, under the same
+   descriptors and at the same positions.  Returns true if
+   successful, false if memory is not available. */
+bool
+fd_table_clone (struct thread *parent) 
+{
+  struct thread *t = process_current ();
+  bool success = false;
+  size_t fd;
+
+  ASSERT (t->fd_cnt == 0);
+
+  lock_acquire (&parent->fd_lock);
+  if (parent->fd_cnt == 0)
+    {
+      success = true;
+      goto done;
+    }
+  t->fds = calloc (parent->fd_cnt, sizeof *t->fds);
+  t->fd_map = bitmap_create (parent->fd_cnt);
+  if (t->fds == NULL || t->fd_map == NULL)
+    {
+      free (t->fds);
+      if (t->fd_map != NULL)
+        bitmap_destroy (t->fd_map);
+      t->fds = NULL;
+      t->fd_map = NULL;
+      goto done;
+    }
+  t->fd_cnt = parent->fd_cnt;
+  t->fd_low = parent->fd_low;
+  bitmap_set_multiple (t->fd_map, 0, FD_FIRST, true);
+
+  for (fd = 0; fd < parent->fd_cnt; fd++)
+    if (parent->fds[fd] != NULL)
+      {
+        struct file *file = file_reopen (parent->fds[fd]);
+        if (file == NULL)
+          goto done;
+        file_seek (file, file_tell (parent->fds[fd]));
+        t->fds[fd] = file;
+        bitmap_mark (t->fd_map, fd);
+      }
+  success = true;
+
+ done:
+  lock_release (&parent->fd_lock);
+  return success;
+}
+
+/* Makes T's descriptor table twice as big, or gives it its first
+   one.  T's lock must be held.  Returns true if successful, false
+   if memory is not available. */
+static bool
+grow (struct thread *t) 
+{
+  size_t new_cnt = t->fd_cnt > 0 ? t->fd_cnt * 2 : FD_INIT_CNT;
+  struct file **new_fds;
+  struct bitmap *new_map;
+
+  if (new_cnt <= t->fd_cnt || new_cnt > INT_MAX)
+    return false;
+  new_fds = calloc (new_cnt, sizeof *new_fds);
+  new_map = bitmap_create (new_cnt);
+  if (new_fds == NULL || new_map == NULL)
+    {
+      free (new_fds);
+      if (new_map != NULL)
+        bitmap_destroy (new_map);
+      return false;
+    }
+
+  if (t->fd_cnt > 0)
+    {
+      size_t fd;
+
+      memcpy (new_fds, t->fds, t->fd_cnt * sizeof *new_fds);
+      for (fd = 0; fd < t->fd_cnt; fd++)
+        if (bitmap_test (t->fd_map, fd))
+          bitmap_mark (new_map, fd);
+      free (t->fds);
+      bitmap_destroy (t->fd_map);
+    }
+  else 
+    {
+      bitmap_set_multiple (new_map, 0, FD_FIRST, true);
+      t->fd_low = FD_FIRST;
+    }
+  t->fds = new_fds;
+  t->fd_map = new_map;
+  t->fd_cnt = new_cnt;
+  return true;
+}
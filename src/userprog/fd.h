@@ -0,0 +1,25 @@
+#ifndef USERPROG_FD_H
+#define USERPROG_FD_H
+
+#include <stdbool.h>
+
+struct file;
+struct thread;
+
+/* File descriptors 0 and 1 are the console unless
+   fd_install_at() points them at a file, so the first one that
+   fd_install() hands out is 2. */
+#define FD_FIRST 2
+
+/* Highest descriptor that fd_install_at() will fill. */
+#define FD_MAX 65535
+
+int fd_install (struct file *);
+bool fd_install_at (int fd, struct file *);
+bool fd_dup_from (struct thread *, int from_fd, int fd);
+struct file *fd_lookup (int fd);
+struct file *fd_remove (int fd);
+void fd_close_all (void);
+bool fd_table_clone (struct thread *parent);
+
+#endif /* userprog/fd.h */
@@ -0,0 +1,214 @@
+#include "userprog/futex.h"
+#include <debug.h>
+#include <list.h>
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "userprog/process.h"
+#include "userprog/syscall.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
+
+/* Futexes.
+
+   A futex is any aligned word of a process's memory that the
+   process's threads wait on and wake each other through.  The
+   kernel keeps no state for a futex that no one waits on: a user
+   mutex takes its uncontended path with a single atomic
+   instruction, and only a thread that finds the mutex held
+   enters the kernel, with futex_wait(), to sleep until the
+   holder calls futex_wake().
+
+   A futex is identified by a key: the process and the word's
+   user address, since threads of different processes may wait on
+   the same address in their own address spaces, or, for a word
+   in a shared-memory segment, the segment and the word's offset
+   in it, so that processes that map the segment at different
+   addresses wait on and wake the same futex.  Waiters are kept in
+   a fixed table of buckets, hashed on the key.  A bucket's lock
+   is held while futex_wait() reads the word and queues the
+   waiter, and while futex_wake() takes waiters off, so a wake
+   that follows a change to the word can never slip in between a
+   waiter's check of the word and its going to sleep.  Reading
+   the word may fault a page in, which is why the buckets have
+   locks rather than turning interrupts off.
+
+   Waiters are woken in the order they started waiting.  When a
+   process exits, futex_wake_all() wakes all of its waiters, so
+   that its threads notice and exit too. */
+
+/* Number of buckets.  Must be a power of 2. */
+#define BUCKET_CNT 64
+
+/* A bucket of waiters. */
+struct bucket
+  {
+    struct lock lock;           /* Protects WAITERS. */
+    struct list waiters;        /* Waiting threads' struct waiter. */
+  };
+
+static struct bucket buckets[BUCKET_CNT];
+
+/* Identifies a futex. */
+struct key
+  {
+    const void *base;           /* Process or segment. */
+    uintptr_t ofs;              /* User address or segment offset. */
+  };
+
+/* A thread in futex_wait(), on its own stack. */
+struct waiter
+  {
+    struct list_elem elem;      /* Element in bucket's waiters. */
+    struct thread *proc;        /* Process waiting. */
+    struct key key;             /* Futex waited on. */
+    struct semaphore woken;     /* Upped to wake the thread. */
+  };
+
+/* Initializes the futex buckets. */
+void
+futex_init (void)
+{
+  size_t i;
+
+  for (i = 0; i < BUCKET_CNT; i++)
+    {
+      lock_init_named (&buckets[i].lock, "futex");
+      list_init (&buckets[i].waiters);
+    }
+}
+
+/* Stores into *KEY the key of the futex at user address UADDR
+   in the running process. */
+static void
+get_key (uint32_t *uaddr, struct key *key)
+{
+#ifdef VM
+  const void *shm;
+  size_t ofs;
+
+  page_table_lock ();
+  shm = page_get_shm (uaddr, &ofs);
+  page_table_unlock ();
+  if (shm != NULL)
+    {
+      key->base = shm;
+      key->ofs = ofs;
+      return;
+    }
+#endif
+  key->base = process_current ();
+  key->ofs = (uintptr_t) uaddr;
+}
+
+/* Returns the bucket for KEY. */
+static struct bucket *
+bucket_for (const struct key *key)
+{
+  uintptr_t hash = key->ofs >> 2 ^ (uintptr_t) key->base >> 12;
+
+  return &buckets[(hash ^ hash >> 6) & (BUCKET_CNT - 1)];
+}
+
+/* Puts the running thread to sleep on the word at user address
+   UADDR, if the word holds EXPECTED, until another thread of its
+   process, or of any process if the word is in a shared-memory
+   segment, wakes it with futex_wake().  Returns FUTEX_WOKEN once
+   woken, FUTEX_AGAIN at once if the word holds something else or
+   the process is exiting, or FUTEX_FAULT if UADDR is not a
+   readable, aligned user address. */
+int
+futex_wait (uint32_t *uaddr, uint32_t expected)
+{
+  struct thread *proc = process_current ();
+  struct bucket *b;
+  struct waiter w;
+  uint32_t value;
+
+  if ((uintptr_t) uaddr % sizeof *uaddr != 0)
+    return FUTEX_FAULT;
+
+  get_key (uaddr, &w.key);
+  b = bucket_for (&w.key);
+  lock_acquire (&b->lock);
+  if (!syscall_get_word (uaddr, &value))
+    {
+      lock_release (&b->lock);
+      return FUTEX_FAULT;
+    }
+  if (value != expected || proc->exiting)
+    {
+      lock_release (&b->lock);
+      return FUTEX_AGAIN;
+    }
+  w.proc = proc;
+  sema_init (&w.woken, 0);
+  list_push_back (&b->waiters, &w.elem);
+  lock_release (&b->lock);
+
+  sema_down (&w.woken);
+  return FUTEX_WOKEN;
+}
+
+/* Wakes up to CNT threads waiting on the word at user address
+   UADDR, the ones that have waited longest: threads of the
+   running process, or of any process that maps the same word if
+   it is in a shared-memory segment.  Returns the number woken. */
+int
+futex_wake (uint32_t *uaddr, int cnt)
+{
+  struct key key;
+  struct bucket *b;
+  struct list_elem *e;
+  int woken = 0;
+
+  get_key (uaddr, &key);
+  b = bucket_for (&key);
+  lock_acquire (&b->lock);
+  for (e = list_begin (&b->waiters);
+       e != list_end (&b->waiters) && woken < cnt; )
+    {
+      struct waiter *w = list_entry (e, struct waiter, elem);
+
+      e = list_next (e);
+      if (w->key.base == key.base && w->key.ofs == key.ofs)
+        {
+          list_remove (&w->elem);
+          sema_up (&w->woken);
+          woken++;
+        }
+    }
+  lock_release (&b->lock);
+  return woken;
+}
+
+/* Wakes every thread of process PROC that is waiting on any
+   futex.  PROC must already be marked as exiting, so that none
+   of its threads starts waiting again. */
+void
+futex_wake_all (struct thread *proc)
+{
+  size_t i;
+
+  ASSERT (proc->exiting);
+
+  for (i = 0; i < BUCKET_CNT; i++)
+    {
+      struct bucket *b = &buckets[i];
+      struct list_elem *e;
+
+      lock_acquire (&b->lock);
+      for (e = list_begin (&b->waiters); e != list_end (&b->waiters); )
+        {
+          struct waiter *w = list_entry (e, struct waiter, elem);
+
+          e = list_next (e);
+          if (w->proc == proc)
+            {
+              list_remove (&w->elem);
+              sema_up (&w->woken);
+            }
+        }
+      lock_release (&b->lock);
+    }
+}
@@ -0,0 +1,19 @@
+#ifndef USERPROG_FUTEX_H
+#define USERPROG_FUTEX_H
+
+#include <stdint.h>
+
+struct thread;
+
+/* Results of futex_wait(). */
+#define FUTEX_WOKEN 0           /* Woken by futex_wake(). */
+#define FUTEX_AGAIN (-1)        /* Word did not hold the value, or
+                                   the process is exiting. */
+#define FUTEX_FAULT (-2)        /* Bad user address. */
+
+void futex_init (void);
+int futex_wait (uint32_t *uaddr, uint32_t expected);
+int futex_wake (uint32_t *uaddr, int cnt);
+void futex_wake_all (struct thread *proc);
+
+#endif /* userprog/futex.h */
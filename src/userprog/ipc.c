@@ -0,0 +1,404 @@
+#include "userprog/ipc.h"
+#include <debug.h>
+#include <list.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "userprog/process.h"
+
+/* Synchronous message passing.
+
+   A thread calls a process with ipc_call(), which sends a short
+   message, IPC_MSG_WORDS words, and sleeps until a thread of
+   that process receives it with ipc_receive() and answers with
+   ipc_reply().  This is the round trip of a local RPC, with each
+   message copied once, through a small buffer on the calling
+   thread's kernel stack, rather than twice, through a pipe, with
+   a wakeup for each direction.
+
+   A process gets a port, where its calls wait, the first time
+   one of its threads receives, and loses it when it exits.
+   Calls to a process with no port fail at once.  A call that
+   finds a thread waiting in ipc_receive() goes straight to it,
+   and the caller, which has nothing to do but wait for the
+   reply, blocks and switches directly to the receiver with
+   thread_block_to(), which gives it the rest of the caller's
+   time slice.  Otherwise the call waits on the port until a
+   thread receives.  Replying wakes the caller and, if the caller
+   has the higher priority, switches straight back to it.
+
+   The thread that receives a call serves it until it replies,
+   and only it may reply.  A caller that is waiting for a reply
+   donates its priority to the thread serving its call, through
+   thread_donate_priority(), just as a thread waiting for a lock
+   donates its priority to the lock's holder, so that a
+   high-priority client is not held up by a server that runs at a
+   low priority, and the donation passes on along the chain if
+   the server in turn waits for a lock or makes a call of its
+   own.  A call whose server exits without replying, or that is
+   still queued on a port when the port's process exits, fails,
+   and so does a call whose own process exits, so that the
+   calling thread can leave the process.
+
+   Ports, their queues, and the calls that threads are serving
+   are protected by turning interrupts off, which the direct
+   switches need anyway. */
+
+/* A process's port, where its threads receive calls. */
+struct port
+  {
+    struct list_elem elem;      /* Element in ports. */
+    struct thread *proc;        /* Process that receives. */
+    struct list receivers;      /* Threads in ipc_receive(). */
+    struct list calls;          /* Calls waiting for a receiver. */
+  };
+
+/* State of a call. */
+enum call_state
+  {
+    CALL_PENDING,               /* Not yet replied to. */
+    CALL_REPLIED,               /* Replied to. */
+    CALL_FAILED                 /* Server or port went away. */
+  };
+
+/* A call, on its caller's stack. */
+struct call
+  {
+    struct list_elem elem;      /* Element in port's calls or in
+                                   server's ipc_callers. */
+    struct thread *client;      /* Calling thread. */
+    struct ipc_msg msg;         /* Request, then reply. */
+    enum call_state state;      /* State. */
+  };
+
+/* A thread in ipc_receive(), on its own stack. */
+struct receiver
+  {
+    struct list_elem elem;      /* Element in port's receivers. */
+    struct thread *thread;      /* Receiving thread. */
+    struct call *call;          /* Call received, or null. */
+    bool closed;                /* Port closed? */
+  };
+
+static struct list ports;       /* All ports. */
+
+static struct port *lookup (tid_t pid);
+static void accept (struct thread *server, struct call *);
+static void finish (struct call *, enum call_state);
+static thread_action_func fail_served_calls;
+
+/* Initializes the list of ports. */
+void
+ipc_init (void)
+{
+  list_init (&ports);
+}
+
+/* Calls process PID with the message in MSG, waits for the reply,
+   and stores the reply in MSG.  Returns true if successful, false
+   if PID has no port or exits before replying, or if the running
+   process is exiting. */
+bool
+ipc_call (tid_t pid, struct ipc_msg *msg)
+{
+  struct thread *cur = thread_current ();
+  struct thread *server = NULL;
+  enum intr_level old_level;
+  struct port *port;
+  struct call c;
+
+  c.client = cur;
+  c.msg = *msg;
+  c.state = CALL_PENDING;
+
+  old_level = intr_disable ();
+  port = lookup (pid);
+  if (port == NULL || process_current ()->exiting)
+    {
+      intr_set_level (old_level);
+      return false;
+    }
+  if (!list_empty (&port->receivers))
+    {
+      struct receiver *r = list_entry (list_pop_front (&port->receivers),
+                                       struct receiver, elem);
+
+      server = r->thread;
+      r->call = &c;
+      accept (server, &c);
+      thread_unblock (server);
+      thread_block_to (server);
+    }
+  else
+    list_push_back (&port->calls, &c.elem);
+  while (c.state == CALL_PENDING)
+    thread_block ();
+  intr_set_level (old_level);
+
+  if (c.state != CALL_REPLIED)
+    return false;
+  *msg = c.msg;
+  return true;
+}
+
+/* Waits for a call to the running process and stores its message
+   in MSG.  The running thread then serves the call until it
+   answers it with ipc_reply().  Returns the calling thread's
+   identifier, for ipc_reply(), or TID_ERROR if the process is
+   exiting or memory is not available for its port. */
+tid_t
+ipc_receive (struct ipc_msg *msg)
+{
+  struct thread *cur = thread_current ();
+  struct thread *proc = process_current ();
+  struct port *new = NULL;
+  enum intr_level old_level;
+  struct port *port;
+  struct receiver r;
+  tid_t client;
+
+  old_level = intr_disable ();
+  port = lookup (proc->tid);
+  if (port == NULL)
+    {
+      /* Make a port, with interrupts on for malloc(). */
+      intr_set_level (old_level);
+      new = malloc (sizeof *new);
+      if (new == NULL)
+        return TID_ERROR;
+      new->proc = proc;
+      list_init (&new->receivers);
+      list_init (&new->calls);
+
+      old_level = intr_disable ();
+      port = lookup (proc->tid);
+      if (port == NULL && !proc->exiting)
+        {
+          list_push_back (&ports, &new->elem);
+          port = new;
+          new = NULL;
+        }
+    }
+  if (port == NULL || proc->exiting)
+    {
+      intr_set_level (old_level);
+      free (new);
+      return TID_ERROR;
+    }
+
+  r.thread = cur;
+  r.call = NULL;
+  r.closed = false;
+  if (!list_empty (&port->calls))
+    {
+      r.call = list_entry (list_pop_front (&port->calls), struct call, elem);
+      accept (cur, r.call);
+    }
+  else
+    {
+      list_push_back (&port->receivers, &r.elem);
+      while (r.call == NULL && !r.closed)
+        thread_block ();
+    }
+
+  /* The caller cannot leave while we serve its call. */
+  if (r.call != NULL)
+    {
+      *msg = r.call->msg;
+      client = r.call->client->tid;
+    }
+  else
+    client = TID_ERROR;
+  intr_set_level (old_level);
+  free (new);
+  return client;
+}
+
+/* Answers the call from thread CLIENT that the running thread is
+   serving with the message in MSG.  Returns true if successful,
+   false if the running thread is not serving a call from
+   CLIENT. */
+bool
+ipc_reply (tid_t client, const struct ipc_msg *msg)
+{
+  struct thread *cur = thread_current ();
+  struct thread *woken = NULL;
+  enum intr_level old_level;
+  struct list_elem *e;
+  bool switched;
+
+  old_level = intr_disable ();
+  for (e = list_begin (&cur->ipc_callers); e != list_end (&cur->ipc_callers);
+       e = list_next (e))
+    {
+      struct call *c = list_entry (e, struct call, elem);
+
+      if (c->client->tid == client)
+        {
+          woken = c->client;
+          c->msg = *msg;
+          finish (c, CALL_REPLIED);
+          break;
+        }
+    }
+  switched = woken != NULL && thread_yield_to (woken);
+  intr_set_level (old_level);
+
+  if (woken != NULL && !switched)
+    thread_max_yield ();
+  return woken != NULL;
+}
+
+/* Fails the calls that thread T, which is exiting, received and
+   has not replied to. */
+void
+ipc_thread_exit (struct thread *t)
+{
+  enum intr_level old_level = intr_disable ();
+
+  while (!list_empty (&t->ipc_callers))
+    finish (list_entry (list_front (&t->ipc_callers), struct call, elem),
+            CALL_FAILED);
+  intr_set_level (old_level);
+}
+
+/* Closes the port of process PROC, which must already be marked
+   as exiting, failing the calls waiting on it and waking its
+   threads waiting to receive.  Also fails the calls that PROC's
+   threads are making, queued or being served, so that no thread
+   of PROC stays blocked in ipc_call(). */
+void
+ipc_process_exit (struct thread *proc)
+{
+  enum intr_level old_level;
+  struct list_elem *e, *next;
+  struct port *port;
+
+  ASSERT (proc->exiting);
+
+  old_level = intr_disable ();
+  for (e = list_begin (&ports); e != list_end (&ports); e = list_next (e))
+    {
+      struct port *p = list_entry (e, struct port, elem);
+      struct list_elem *ce;
+
+      for (ce = list_begin (&p->calls); ce != list_end (&p->calls); ce = next)
+        {
+          struct call *c = list_entry (ce, struct call, elem);
+
+          next = list_next (ce);
+          if (c->client->proc == proc)
+            {
+              list_remove (&c->elem);
+              c->state = CALL_FAILED;
+              thread_unblock (c->client);
+            }
+        }
+    }
+  thread_foreach (fail_served_calls, proc);
+
+  port = lookup (proc->tid);
+  if (port != NULL)
+    {
+      list_remove (&port->elem);
+      while (!list_empty (&port->calls))
+        {
+          struct call *c = list_entry (list_pop_front (&port->calls),
+                                       struct call, elem);
+          c->state = CALL_FAILED;
+          thread_unblock (c->client);
+        }
+      while (!list_empty (&port->receivers))
+        {
+          struct receiver *r = list_entry (list_pop_front (&port->receivers),
+                                           struct receiver, elem);
+          r->closed = true;
+          thread_unblock (r->thread);
+        }
+    }
+  intr_set_level (old_level);
+  free (port);
+}
+
+/* Fails the calls that thread T is serving for threads of
+   process PROC_, for thread_foreach().  Interrupts must be off. */
+static void
+fail_served_calls (struct thread *t, void *proc_)
+{
+  struct thread *proc = proc_;
+  struct list_elem *e, *next;
+
+  for (e = list_begin (&t->ipc_callers); e != list_end (&t->ipc_callers);
+       e = next)
+    {
+      struct call *c = list_entry (e, struct call, elem);
+
+      next = list_next (e);
+      if (c->client->proc == proc)
+        finish (c, CALL_FAILED);
+    }
+}
+
+/* Returns the highest priority of the threads waiting for
+   replies from thread T, or PRI_MIN - 1 if there are none.
+   Interrupts must be off. */
+int
+ipc_donated_priority (struct thread *t)
+{
+  int priority = PRI_MIN - 1;
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&t->ipc_callers); e != list_end (&t->ipc_callers);
+       e = list_next (e))
+    {
+      struct call *c = list_entry (e, struct call, elem);
+      if (c->client->priority > priority)
+        priority = c->client->priority;
+    }
+  return priority;
+}
+
+/* Returns the port of the process whose identifier is PID, or a
+   null pointer if it has none.  Interrupts must be off. */
+static struct port *
+lookup (tid_t pid)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&ports); e != list_end (&ports); e = list_next (e))
+    {
+      struct port *port = list_entry (e, struct port, elem);
+      if (port->proc->tid == pid)
+        return port;
+    }
+  return NULL;
+}
+
+/* Makes SERVER the thread that serves call C, and has C's caller
+   donate its priority to SERVER.  Interrupts must be off. */
+static void
+accept (struct thread *server, struct call *c)
+{
+  list_push_back (&server->ipc_callers, &c->elem);
+  c->client->ipc_server = server;
+  if (!thread_mlfqs)
+    thread_donate_priority (c->client);
+}
+
+/* Ends call C, which its server is serving, in STATE, wakes its
+   caller, and takes back the caller's donation from the server.
+   Interrupts must be off. */
+static void
+finish (struct call *c, enum call_state state)
+{
+  struct thread *server = c->client->ipc_server;
+
+  list_remove (&c->elem);
+  c->client->ipc_server = NULL;
+  c->state = state;
+  thread_unblock (c->client);
+  if (!thread_mlfqs)
+    thread_reset_priority (server);
+}
@@ -0,0 +1,28 @@
+#ifndef USERPROG_IPC_H
+#define USERPROG_IPC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "threads/thread.h"
+
+/* Number of words in a message.  Matches IPC_MSG_WORDS in
+   lib/user/syscall.h. */
+#define IPC_MSG_WORDS 8
+
+/* A message, passed by value. */
+struct ipc_msg
+  {
+    uint32_t words[IPC_MSG_WORDS];
+  };
+
+void ipc_init (void);
+bool ipc_call (tid_t pid, struct ipc_msg *);
+tid_t ipc_receive (struct ipc_msg *);
+bool ipc_reply (tid_t client, const struct ipc_msg *);
+void ipc_thread_exit (struct thread *);
+void ipc_process_exit (struct thread *proc);
+
+/* For thread.c. */
+int ipc_donated_priority (struct thread *);
+
+#endif /* userprog/ipc.h */
@@ -6,8 +6,23 @@
 #include "threads/pte.h"
 #include "threads/palloc.h"
 
+/* Most pages whose TLB entries a range operation invalidates
+   one at a time, with INVLPG.  Beyond this, reloading CR3 to
+   flush the whole TLB is cheaper. */
+#define INVLPG_MAX 32
+
+/* Nonzero while pagedir_set_accessed() defers invalidating the
+   TLB, and whether it has deferred any.  See
+   pagedir_defer_flush(). */
+static unsigned defer_depth;
+static bool flush_pending;
+
 static uint32_t *active_pd (void);
 static void invalidate_pagedir (uint32_t *);
+static void invalidate_page (uint32_t *, const void *vaddr);
+static void invalidate_range (uint32_t *, const void *upage,
+                              size_t page_cnt);
+static uint8_t *pt_end (const uint8_t *vaddr, const uint8_t *end);
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -18,12 +33,12 @@ pagedir_create (void)
 {
   uint32_t *pd = palloc_get_page (0);
   if (pd != NULL)
-    memcpy (pd, init_page_dir, PGSIZE);
+    copy_page (pd, init_page_dir);
   return pd;
 }
 
 /* Destroys page directory PD, freeing all the pages it
-   references. */
+   references, including 4 MB large pages. */
 void
 pagedir_destroy (uint32_t *pd) 
 {
@@ -34,7 +49,9 @@ pagedir_destroy (uint32_t *pd)
 
   ASSERT (pd != init_page_dir);
   for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
-    if (*pde & PTE_P) 
+    if ((*pde & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS))
+      palloc_free_multiple (pte_get_page (*pde), PTSPAN / PGSIZE);
+    else if (*pde & PTE_P) 
       {
         uint32_t *pt = pde_get_pt (*pde);
         uint32_t *pte;
@@ -79,6 +96,11 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
       else
         return NULL;
     }
+  else if (*pde & PTE_PS)
+    {
+      /* A large page has no page table. */
+      return NULL;
+    }
 
   /* Return the page table entry. */
   pt = pde_get_pt (*pde);
@@ -118,6 +140,48 @@ pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool writable)
     return false;
 }
 
+/* Maps the PAGE_CNT user virtual pages starting at UPAGE in
+   page directory PD to the frames at kernel virtual addresses
+   KPAGES[0], KPAGES[1], and so on, as pagedir_set_page() would
+   one at a time, but walking each page table once.  None of the
+   pages may already be mapped.  If WRITABLE is true, the pages
+   are read/write; otherwise they are read-only.  Returns true
+   if successful, false if memory allocation failed, in which
+   case none of the pages is mapped. */
+bool
+pagedir_map_range (uint32_t *pd, void *upage, void *const kpages[],
+                   size_t page_cnt, bool writable) 
+{
+  uint8_t *vaddr = upage;
+  uint8_t *end = vaddr + page_cnt * PGSIZE;
+  size_t i = 0;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (page_cnt == 0 || is_user_vaddr (end - 1));
+  ASSERT (pd != init_page_dir);
+
+  /* Create the page tables first, so that failure leaves
+     nothing mapped. */
+  for (; vaddr < end; vaddr = pt_end (vaddr, end))
+    if (lookup_page (pd, vaddr, true) == NULL)
+      return false;
+
+  for (vaddr = upage; vaddr < end; ) 
+    {
+      uint8_t *stop = pt_end (vaddr, end);
+      uint32_t *pte = lookup_page (pd, vaddr, false);
+
+      for (; vaddr < stop; vaddr += PGSIZE, pte++, i++) 
+        {
+          ASSERT (pg_ofs (kpages[i]) == 0);
+          ASSERT (vtop (kpages[i]) >> PTSHIFT < init_ram_pages);
+          ASSERT ((*pte & PTE_P) == 0);
+          *pte = pte_create_user (kpages[i], writable);
+        }
+    }
+  return true;
+}
+
 /* Looks up the physical address that corresponds to user virtual
    address UADDR in PD.  Returns the kernel virtual address
    corresponding to that physical address, or a null pointer if
@@ -128,6 +192,10 @@ pagedir_get_page (uint32_t *pd, const void *uaddr)
   uint32_t *pte;
 
   ASSERT (is_user_vaddr (uaddr));
+
+  if ((pd[pd_no (uaddr)] & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS))
+    return (pte_get_page (pd[pd_no (uaddr)])
+            + ((uintptr_t) uaddr & (PTSPAN - 1)));
   
   pte = lookup_page (pd, uaddr, false);
   if (pte != NULL && (*pte & PTE_P) != 0)
@@ -136,6 +204,75 @@ pagedir_get_page (uint32_t *pd, const void *uaddr)
     return NULL;
 }
 
+/* Maps the 4 MB of user virtual memory starting at UPAGE in
+   page directory PD to the large page at KPAGE, obtained with
+   palloc_get_large(), with a single page directory entry.  Both
+   must be aligned on 4 MB.  If WRITABLE is true, the memory is
+   read/write; otherwise it is read-only.  Any page table that
+   covered UPAGE is freed, but not the pages it mapped, so none
+   of them may belong to the process.  The CPU must support
+   large pages. */
+void
+pagedir_set_large (uint32_t *pd, void *upage, void *kpage, bool writable) 
+{
+  uint32_t *pde = pd + pd_no (upage);
+
+  ASSERT (((uintptr_t) upage & (PTSPAN - 1)) == 0);
+  ASSERT (is_user_vaddr (upage));
+  ASSERT (pd != init_page_dir);
+
+  if (*pde & PTE_P)
+    {
+      ASSERT (!(*pde & PTE_PS));
+      palloc_free_page (pde_get_pt (*pde));
+    }
+  *pde = pde_create_large (kpage, writable) | PTE_U;
+  invalidate_pagedir (pd);
+}
+
+/* Replaces the large page that maps UPAGE in page directory PD,
+   installed with pagedir_set_large(), by a page table that maps
+   the same memory a page at a time.  Each page table entry
+   starts out with the large page's accessed bit, and dirty,
+   since the large page's dirty bit does not say which of its
+   pages were written, nor count writes through KPAGE.  Returns
+   true if successful, false if memory allocation failed, in
+   which case the large page stays as it was. */
+bool
+pagedir_split_large (uint32_t *pd, void *upage) 
+{
+  uint32_t *pde = pd + pd_no (upage);
+  uint8_t *kpage;
+  uint32_t *pt;
+  size_t i;
+
+  ASSERT ((*pde & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS));
+
+  pt = palloc_get_page (0);
+  if (pt == NULL)
+    return false;
+  kpage = pte_get_page (*pde);
+  for (i = 0; i < PGSIZE / sizeof *pt; i++)
+    pt[i] = (pte_create_user (kpage + i * PGSIZE, (*pde & PTE_W) != 0)
+             | (*pde & PTE_A) | PTE_D);
+  *pde = pde_create (pt);
+  invalidate_pagedir (pd);
+  return true;
+}
+
+/* Unmaps the large page that maps UPAGE in page directory PD,
+   installed with pagedir_set_large(), without freeing it. */
+void
+pagedir_clear_large (uint32_t *pd, void *upage) 
+{
+  uint32_t *pde = pd + pd_no (upage);
+
+  ASSERT ((*pde & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS));
+
+  *pde = 0;
+  invalidate_pagedir (pd);
+}
+
 /* Marks user virtual page UPAGE "not present" in page
    directory PD.  Later accesses to the page will fault.  Other
    bits in the page table entry are preserved.
@@ -152,7 +289,92 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      invalidate_page (pd, upage);
+    }
+}
+
+/* Marks the PAGE_CNT user virtual pages starting at UPAGE "not
+   present" in page directory PD, as pagedir_clear_page() would
+   one at a time, but walking each page table once and
+   invalidating the TLB once at the end.  Other bits in the page
+   table entries are preserved.  The pages need not be mapped. */
+void
+pagedir_clear_range (uint32_t *pd, void *upage, size_t page_cnt) 
+{
+  uint8_t *vaddr = upage;
+  uint8_t *end = vaddr + page_cnt * PGSIZE;
+  bool changed = false;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (page_cnt == 0 || is_user_vaddr (end - 1));
+
+  while (vaddr < end) 
+    {
+      uint8_t *stop = pt_end (vaddr, end);
+      uint32_t *pte = lookup_page (pd, vaddr, false);
+
+      if (pte != NULL)
+        for (; vaddr < stop; vaddr += PGSIZE, pte++)
+          if (*pte & PTE_P) 
+            {
+              *pte &= ~PTE_P;
+              changed = true;
+            }
+      vaddr = stop;
+    }
+  if (changed)
+    invalidate_range (pd, upage, page_cnt);
+}
+
+/* Makes the PTEs for the PAGE_CNT user virtual pages starting
+   at UPAGE in page directory PD writable if RW is true,
+   read-only otherwise, as pagedir_set_writable() would one at a
+   time, but walking each page table once and invalidating the
+   TLB once at the end.  Pages that are not mapped are
+   skipped. */
+void
+pagedir_protect_range (uint32_t *pd, void *upage, size_t page_cnt,
+                       bool rw) 
+{
+  uint8_t *vaddr = upage;
+  uint8_t *end = vaddr + page_cnt * PGSIZE;
+  bool changed = false;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (page_cnt == 0 || is_user_vaddr (end - 1));
+
+  while (vaddr < end) 
+    {
+      uint8_t *stop = pt_end (vaddr, end);
+      uint32_t *pte = lookup_page (pd, vaddr, false);
+
+      if (pte != NULL)
+        for (; vaddr < stop; vaddr += PGSIZE, pte++)
+          if ((*pte & PTE_P) && ((*pte & PTE_W) != 0) != rw) 
+            {
+              *pte ^= PTE_W;
+              changed = true;
+            }
+      vaddr = stop;
+    }
+  if (changed)
+    invalidate_range (pd, upage, page_cnt);
+}
+
+/* Makes the PTE for virtual page VPAGE in PD writable if RW is
+   true, read-only otherwise, keeping its accessed and dirty
+   bits.  Has no effect if PD contains no PTE for VPAGE. */
+void
+pagedir_set_writable (uint32_t *pd, const void *vpage, bool rw) 
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  if (pte != NULL && (*pte & PTE_P) != 0) 
+    {
+      if (rw)
+        *pte |= PTE_W;
+      else
+        *pte &= ~(uint32_t) PTE_W;
+      invalidate_page (pd, vpage);
     }
 }
 
@@ -180,7 +402,7 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
       else 
         {
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -197,7 +419,9 @@ pagedir_is_accessed (uint32_t *pd, const void *vpage)
 }
 
 /* Sets the accessed bit to ACCESSED in the PTE for virtual page
-   VPAGE in PD. */
+   VPAGE in PD.  Between pagedir_defer_flush() and
+   pagedir_flush_deferred(), clearing the bit does not invalidate
+   the TLB right away. */
 void
 pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed) 
 {
@@ -209,11 +433,44 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
       else 
         {
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          if (defer_depth == 0)
+            invalidate_page (pd, vpage);
+          else if (active_pd () == pd)
+            flush_pending = true;
         }
     }
 }
 
+/* Starts deferring the TLB invalidations that clearing accessed
+   bits with pagedir_set_accessed() calls for, until a matching
+   pagedir_flush_deferred(), for a scan such as the eviction
+   clock's that clears many of them at once.  Until then, the CPU
+   may not set again the accessed bit of a page whose bit was
+   cleared while a stale TLB entry for it was cached, so the page
+   may look unused when it was not, which costs only a little
+   accuracy.  Other bits are never deferred: a missed dirty bit
+   would lose data.  Calls may nest, but the caller must keep
+   other threads from deferring at the same time, as by holding
+   a lock. */
+void
+pagedir_defer_flush (void) 
+{
+  defer_depth++;
+}
+
+/* Ends a pagedir_defer_flush(), flushing the TLB once if any
+   invalidation was deferred and this was the outermost call. */
+void
+pagedir_flush_deferred (void) 
+{
+  ASSERT (defer_depth > 0);
+  if (--defer_depth == 0 && flush_pending)
+    {
+      flush_pending = false;
+      pagedir_activate (active_pd ());
+    }
+}
+
 /* Loads page directory PD into the CPU's page directory base
    register. */
 void
@@ -243,10 +500,56 @@ active_pd (void)
   return ptov (pd);
 }
 
+/* Returns the end of the part of the range from VADDR up to END
+   that one page table covers: END, or the first address that
+   the next page table covers, whichever is lower. */
+static uint8_t *
+pt_end (const uint8_t *vaddr, const uint8_t *end) 
+{
+  uint8_t *next = (uint8_t *) (((uintptr_t) vaddr & ~(PTSPAN - 1)) + PTSPAN);
+  return next < end ? next : (uint8_t *) end;
+}
+
+/* Invalidates the TLB entries for the PAGE_CNT pages starting at
+   UPAGE, if PD is the active page directory: one at a time with
+   INVLPG if there are at most INVLPG_MAX of them, otherwise all
+   at once by reloading PD.  See [IA32-v3a] 3.12 "Translation
+   Lookaside Buffers (TLBs)". */
+static void
+invalidate_range (uint32_t *pd, const void *upage, size_t page_cnt) 
+{
+  if (active_pd () == pd) 
+    {
+      if (page_cnt <= INVLPG_MAX) 
+        {
+          const uint8_t *vaddr = upage;
+          size_t i;
+
+          for (i = 0; i < page_cnt; i++)
+            invalidate_page (pd, vaddr + i * PGSIZE);
+        }
+      else
+        pagedir_activate (pd);
+    }
+}
+
+/* Invalidates the TLB entry for the page containing VADDR, if
+   PD is the active page directory, with INVLPG, which leaves the
+   rest of the TLB alone, for a change to that page's page table
+   entry alone.  See [IA32-v2a] "INVLPG--Invalidate TLB Entry". */
+static void
+invalidate_page (uint32_t *pd, const void *vaddr) 
+{
+  if (active_pd () == pd)
+    asm volatile ("invlpg (%0)" : : "r" (vaddr) : "memory");
+}
+
 /* Seom page table changes can cause the CPU's translation
    lookaside buffer (TLB) to become out-of-sync with the page
    table.  When this happens, we have to "invalidate" the TLB by
-   re-activating it.
+   re-activating it.  A change to a single page's entry only
+   needs invalidate_page(); this is for changes to page directory
+   entries, such as those for large pages.
 
    This function invalidates the TLB if PD is the active page
    directory.  (If PD is not active then its entries are not in
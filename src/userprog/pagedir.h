@@ -2,17 +2,29 @@
 #define USERPROG_PAGEDIR_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 uint32_t *pagedir_create (void);
 void pagedir_destroy (uint32_t *pd);
 bool pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool rw);
+bool pagedir_map_range (uint32_t *pd, void *upage, void *const kpages[],
+                        size_t page_cnt, bool rw);
 void *pagedir_get_page (uint32_t *pd, const void *upage);
 void pagedir_clear_page (uint32_t *pd, void *upage);
+void pagedir_clear_range (uint32_t *pd, void *upage, size_t page_cnt);
+void pagedir_protect_range (uint32_t *pd, void *upage, size_t page_cnt,
+                            bool rw);
+void pagedir_set_large (uint32_t *pd, void *upage, void *kpage, bool rw);
+bool pagedir_split_large (uint32_t *pd, void *upage);
+void pagedir_clear_large (uint32_t *pd, void *upage);
+void pagedir_set_writable (uint32_t *pd, const void *upage, bool rw);
 bool pagedir_is_dirty (uint32_t *pd, const void *upage);
 void pagedir_set_dirty (uint32_t *pd, const void *upage, bool dirty);
 bool pagedir_is_accessed (uint32_t *pd, const void *upage);
 void pagedir_set_accessed (uint32_t *pd, const void *upage, bool accessed);
+void pagedir_defer_flush (void);
+void pagedir_flush_deferred (void);
 void pagedir_activate (uint32_t *pd);
 
 #endif /* userprog/pagedir.h */
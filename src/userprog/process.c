@@ -1,68 +1,193 @@
 #include "userprog/process.h"
 #include <debug.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <round.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "userprog/fd.h"
+#include "userprog/futex.h"
+#include "userprog/ipc.h"
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
+#include "userprog/syscall.h"
 #include "userprog/tss.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/flags.h"
+#include "threads/fpu.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "threads/work.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
+
+/* The exit status of a process, shared between the process and
+   its parent, so that the parent can wait for it, and find out
+   its exit code, even after the process itself is gone.
+
+   A process that exits while its parent still holds its status
+   also puts the status on the parent's queue of exited children,
+   so that the parent can wait for whichever child exits first.
+   The queue, and the QUEUED and REF_CNT members, are protected by
+   turning interrupts off, as is the parent's list of children,
+   which all of the parent's threads share. */
+struct process_status
+  {
+    struct list_elem elem;      /* Element in parent's children. */
+    struct list_elem exit_elem; /* Element in parent's exited. */
+    bool queued;                /* In parent's exited? */
+    bool claimed;               /* Taken out of parent's children? */
+    struct thread *parent;      /* Parent process. */
+    tid_t tid;                  /* Process's thread id. */
+    int exit_code;              /* Exit code, once DEAD is up. */
+    struct semaphore dead;      /* Upped when the process exits. */
+    int ref_cnt;                /* 2 while both are alive, 1 after
+                                   either is gone. */
+  };
+
+/* Passes a new process from process_execute() to its thread. */
+struct exec_aux
+  {
+    uint8_t *stack;             /* Initial stack page contents. */
+    uint32_t *sp;               /* Initial stack pointer in STACK. */
+    const char *file_name;      /* Program to load, in STACK. */
+    struct thread *parent;      /* Process calling process_spawn(). */
+    const struct spawn_action *actions; /* File actions to apply. */
+    size_t action_cnt;          /* Number of ACTIONS. */
+    struct process_status *status; /* New process's status. */
+    struct semaphore loaded;    /* Upped when loading is done. */
+    bool success;               /* Did loading succeed? */
+  };
 
 static thread_func start_process NO_RETURN;
-static bool load (const char *cmdline, void (**eip) (void), void **esp);
+static bool apply_actions (const struct exec_aux *);
+static bool load (struct exec_aux *, void (**eip) (void), void **esp);
+static bool push_args (uint8_t *kpage, const char *cmd_line,
+                       uint32_t **sp, const char **file_name);
+static struct process_status *new_status (void);
+static void add_child (struct process_status *, tid_t);
+static void release_status (struct process_status *);
+static work_func reap;
+static void leave_process (struct thread *);
+
+/* -memstats: Print memory statistics when a process exits? */
+bool process_print_mem_stats;
+
+/* Exited processes whose address spaces the reaper has yet to
+   tear down, and a wait queue woken once it has finished them
+   all.  See process_exit(). */
+static struct lock reap_lock;
+static struct wait_queue reaped;
+static size_t reap_cnt;
+
+/* Starts a new thread running a user program loaded from the
+   first word of CMD_LINE, passing it the words of CMD_LINE as
+   its arguments, and waits for it to be loaded.  Returns the new
+   process's thread id, or TID_ERROR if the thread cannot be
+   created or the program cannot be loaded. */
+tid_t
+process_execute (const char *cmd_line) 
+{
+  return process_spawn (cmd_line, NULL, 0);
+}
 
-/* Starts a new thread running a user program loaded from
-   FILENAME.  The new thread may be scheduled (and may even exit)
-   before process_execute() returns.  Returns the new process's
-   thread id, or TID_ERROR if the thread cannot be created. */
+/* Like process_execute(), but first gives the new process the
+   file descriptors that the ACTION_CNT actions in ACTIONS
+   describe, in order.  The new process starts with no files
+   open, so these are all it has.  Fails if any action fails.
+   The new process applies the actions itself, while the caller
+   waits, so there is no copy of the caller's address space or
+   descriptor table to make and throw away. */
 tid_t
-process_execute (const char *file_name) 
+process_spawn (const char *cmd_line, const struct spawn_action *actions,
+               size_t action_cnt) 
 {
-  char *fn_copy;
+  struct exec_aux aux;
+  char name[16];
   tid_t tid;
 
-  /* Make a copy of FILE_NAME.
-     Otherwise there's a race between the caller and load(). */
-  fn_copy = palloc_get_page (0);
-  if (fn_copy == NULL)
-    return TID_ERROR;
-  strlcpy (fn_copy, file_name, PGSIZE);
+  /* Split CMD_LINE into words straight into the layout of the
+     new process's stack page, which also gives load() a copy of
+     the program name that no one else can change.  Without
+     virtual memory the page becomes the process's stack itself,
+     so take it from the user pool. */
+#ifdef VM
+  aux.stack = palloc_get_page (0);
+#else
+  aux.stack = palloc_get_page (PAL_USER | PAL_ZERO);
+#endif
+  aux.status = new_status ();
+  if (aux.stack == NULL || aux.status == NULL
+      || !push_args (aux.stack, cmd_line, &aux.sp, &aux.file_name))
+    {
+      palloc_free_page (aux.stack);
+      free (aux.status);
+      return TID_ERROR;
+    }
+  aux.parent = process_current ();
+  aux.actions = actions;
+  aux.action_cnt = action_cnt;
+  sema_init (&aux.loaded, 0);
+  aux.success = false;
 
-  /* Create a new thread to execute FILE_NAME. */
-  tid = thread_create (file_name, PRI_DEFAULT, start_process, fn_copy);
+  /* Create a new thread named after the program, and wait only
+     until it has loaded. */
+  strlcpy (name, aux.file_name, sizeof name);
+  tid = thread_create (name, PRI_DEFAULT, start_process, &aux);
+  if (tid != TID_ERROR)
+    sema_down (&aux.loaded);
+  palloc_free_page (aux.stack);
   if (tid == TID_ERROR)
-    palloc_free_page (fn_copy); 
+    {
+      free (aux.status);
+      return TID_ERROR;
+    }
+
+  /* The new process has dropped its reference if it failed. */
+  if (!aux.success)
+    {
+      release_status (aux.status);
+      return TID_ERROR;
+    }
+  add_child (aux.status, tid);
   return tid;
 }
 
 /* A thread function that loads a user process and starts it
    running. */
 static void
-start_process (void *file_name_)
+start_process (void *aux_)
 {
-  char *file_name = file_name_;
+  struct exec_aux *aux = aux_;
+  struct thread *t = thread_current ();
   struct intr_frame if_;
   bool success;
 
+  t->wait_status = aux->status;
+  t->exit_code = -1;
+
   /* Initialize interrupt frame and load executable. */
   memset (&if_, 0, sizeof if_);
   if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
   if_.cs = SEL_UCSEG;
   if_.eflags = FLAG_IF | FLAG_MBS;
-  success = load (file_name, &if_.eip, &if_.esp);
+  success = apply_actions (aux) && load (aux, &if_.eip, &if_.esp);
 
-  /* If load failed, quit. */
-  palloc_free_page (file_name);
+  /* Report to the parent, whose stack AUX is on.  If load
+     failed, quit. */
+  aux->success = success;
+  sema_up (&aux->loaded);
   if (!success) 
     thread_exit ();
 
@@ -76,44 +201,625 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+/* Applies AUX's file actions to the running process.  Returns
+   true if they all succeed, false otherwise. */
+static bool
+apply_actions (const struct exec_aux *aux) 
+{
+  size_t i;
+
+  for (i = 0; i < aux->action_cnt; i++)
+    {
+      const struct spawn_action *a = &aux->actions[i];
+      struct file *file;
+
+      switch (a->op)
+        {
+        case SPAWN_DUP:
+          if (!fd_dup_from (aux->parent, a->src_fd, a->fd))
+            return false;
+          break;
+
+        case SPAWN_CLOSE:
+          file_close (fd_remove (a->fd));
+          break;
+
+        case SPAWN_OPEN:
+          file = filesys_open (a->path);
+          if (file == NULL || !fd_install_at (a->fd, file))
+            return false;
+          break;
+
+        default:
+          return false;
+        }
+    }
+  return true;
+}
+
+#ifdef VM
+/* Passes a fork from process_fork() to its child. */
+struct fork_aux
+  {
+    struct thread *parent;      /* Process being forked. */
+    struct thread *caller;      /* Thread calling process_fork(). */
+    struct intr_frame if_;      /* Parent's user register state. */
+    struct process_status *status; /* Child's status. */
+    struct semaphore done;      /* Upped when the child is set up. */
+    bool success;               /* Did the child copy the parent? */
+  };
+
+static thread_func start_fork NO_RETURN;
+
+/* Creates a child of the running process that is a copy of it,
+   starting from the user register state in IF_ but with 0 in
+   %eax, as the return value of a fork system call.  The child's
+   pages share the parent's memory copy-on-write, so forking does
+   not copy any of it.  Returns the child's thread id, or
+   TID_ERROR if the child cannot be created.  Only the calling
+   thread is copied into the child, even if the running process
+   has others. */
+tid_t
+process_fork (const struct intr_frame *if_) 
+{
+  struct thread *cur = thread_current ();
+  struct fork_aux aux;
+  tid_t tid;
+
+  aux.parent = cur->proc;
+  aux.caller = cur;
+  aux.if_ = *if_;
+  aux.status = new_status ();
+  sema_init (&aux.done, 0);
+  aux.success = false;
+  if (aux.status == NULL)
+    return TID_ERROR;
+
+  tid = thread_create (cur->name, thread_get_priority (), start_fork,
+                      &aux);
+  if (tid == TID_ERROR)
+    {
+      free (aux.status);
+      return TID_ERROR;
+    }
+  sema_down (&aux.done);
+  if (!aux.success)
+    {
+      release_status (aux.status);
+      return TID_ERROR;
+    }
+  add_child (aux.status, tid);
+  return tid;
+}
+
+/* A thread function that sets up a forked process as a copy of
+   its parent and starts it running. */
+static void
+start_fork (void *aux_) 
+{
+  struct fork_aux *aux = aux_;
+  struct thread *t = thread_current ();
+  struct intr_frame if_ = aux->if_;
+  bool success = false;
+
+  t->wait_status = aux->status;
+  t->exit_code = -1;
+  t->pagedir = pagedir_create ();
+  if (t->pagedir != NULL)
+    {
+      process_activate ();
+      t->exec_file = file_reopen (aux->parent->exec_file);
+      if (t->exec_file != NULL)
+        file_deny_write (t->exec_file);
+      success = (t->exec_file != NULL
+                 && page_table_init ()
+                 && page_table_clone (aux->parent)
+                 && fd_table_clone (aux->parent)
+                 && fpu_clone (t, aux->caller));
+    }
+
+  /* AUX lives on the parent's stack, so it must not be used once
+     the parent wakes up. */
+  aux->success = success;
+  sema_up (&aux->done);
+  if (!success) 
+    thread_exit ();
+
+  /* Start the user process as start_process() does. */
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+#endif
+
+/* Returns a new process status with references for a process
+   and its parent, or a null pointer if memory is not
+   available. */
+static struct process_status *
+new_status (void) 
+{
+  struct process_status *s = malloc (sizeof *s);
+
+  if (s != NULL)
+    {
+      s->parent = process_current ();
+      s->queued = false;
+      s->claimed = false;
+      s->tid = TID_ERROR;
+      s->exit_code = -1;
+      sema_init (&s->dead, 0);
+      s->ref_cnt = 2;
+    }
+  return s;
+}
+
+/* Records S, the status of the new process TID, as a child of
+   the running process. */
+static void
+add_child (struct process_status *s, tid_t tid) 
+{
+  enum intr_level old_level;
+
+  s->tid = tid;
+  old_level = intr_disable ();
+  list_push_back (&process_current ()->children, &s->elem);
+  intr_set_level (old_level);
+}
+
+/* Drops a reference to S, freeing it if it was the last. */
+static void
+release_status (struct process_status *s) 
+{
+  enum intr_level old_level;
+  int ref_cnt;
+
+  old_level = intr_disable ();
+  if (s->queued && s->parent == process_current ())
+    {
+      list_remove (&s->exit_elem);
+      s->queued = false;
+    }
+  ref_cnt = --s->ref_cnt;
+  intr_set_level (old_level);
+
+  if (ref_cnt == 0)
+    free (s);
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
    child of the calling process, or if process_wait() has already
    been successfully called for the given TID, returns -1
-   immediately, without waiting.
-
-   This function will be implemented in problem 2-2.  For now, it
-   does nothing. */
+   immediately, without waiting. */
 int
-process_wait (tid_t child_tid UNUSED) 
+process_wait (tid_t child_tid) 
 {
-  return -1;
+  struct thread *cur = process_current ();
+  struct process_status *s = NULL;
+  enum intr_level old_level;
+  struct thread *child;
+  struct list_elem *e;
+  int exit_code;
+
+  old_level = intr_disable ();
+
+  /* A child that is still running has its status at hand; only
+     one that has exited must be searched for. */
+  child = thread_lookup (child_tid);
+  if (child != NULL && child->proc == child && child->wait_status != NULL
+      && child->wait_status->parent == cur && !child->wait_status->claimed)
+    s = child->wait_status;
+  else
+    for (e = list_begin (&cur->children); e != list_end (&cur->children);
+         e = list_next (e))
+      if (list_entry (e, struct process_status, elem)->tid == child_tid)
+        {
+          s = list_entry (e, struct process_status, elem);
+          break;
+        }
+  if (s != NULL)
+    {
+      list_remove (&s->elem);
+      s->claimed = true;
+      if (s->queued)
+        {
+          list_remove (&s->exit_elem);
+          s->queued = false;
+        }
+    }
+  intr_set_level (old_level);
+  if (s == NULL)
+    return -1;
+
+  sema_down (&s->dead);
+  exit_code = s->exit_code;
+  release_status (s);
+  return exit_code;
 }
 
-/* Free the current process's resources. */
+/* Waits for any child process to die, in the order they die,
+   and stores its exit code into *EXIT_CODE.  If BLOCK is false,
+   does not wait, but returns 0 if no child has died yet.
+   Returns the child's thread id, or TID_ERROR if the process has
+   no children left to wait for. */
+tid_t
+process_wait_any (bool block, int *exit_code) 
+{
+  struct thread *cur = process_current ();
+  struct process_status *s = NULL;
+  enum intr_level old_level;
+  tid_t tid;
+
+  /* CHILD_EXITED may be up once for a child that process_wait()
+     has already reaped, so check the queue each time around. */
+  for (;;)
+    {
+      old_level = intr_disable ();
+      if (!list_empty (&cur->exited))
+        {
+          s = list_entry (list_pop_front (&cur->exited),
+                          struct process_status, exit_elem);
+          s->queued = false;
+          s->claimed = true;
+          list_remove (&s->elem);
+        }
+      intr_set_level (old_level);
+      if (s != NULL)
+        break;
+
+      if (list_empty (&cur->children))
+        return TID_ERROR;
+      if (!block)
+        return 0;
+      sema_down (&cur->child_exited);
+    }
+
+  sema_down (&s->dead);
+  *exit_code = s->exit_code;
+  tid = s->tid;
+  release_status (s);
+  return tid;
+}
+
+/* Free the current process's resources.
+
+   Tearing down the address space, which means freeing every
+   frame, swap slot, and page table the process has, takes time
+   in proportion to its size, so it is left to a worker thread,
+   the "reaper", and exiting costs about the same for every
+   process.  The reaper needs the process's struct thread, which
+   its page table refers to, so the struct stays allocated until
+   the reaper is done.  Memory that is still waiting to be freed
+   is not lost to the rest of the system: a process that runs
+   short of user memory waits for the reaper with
+   process_reap_wait() before it evicts anything.
+
+   A process's state belongs to its leader, so another of its
+   threads that exits only leaves the process, and the leader
+   waits for all of the others to leave before it tears the
+   process down. */
 void
 process_exit (void)
 {
   struct thread *cur = thread_current ();
-  uint32_t *pd;
 
-  /* Destroy the current process's page directory and switch back
-     to the kernel-only page directory. */
-  pd = cur->pagedir;
-  if (pd != NULL) 
+  if (cur->proc != cur)
+    {
+      leave_process (cur);
+      return;
+    }
+
+  /* Make the process's other threads exit, waking any that sleep
+     on a futex or wait for calls, and wait for them to leave.
+     Calls that this thread has not replied to fail. */
+  ipc_thread_exit (cur);
+  lock_acquire (&cur->threads_lock);
+  cur->exiting = true;
+  ipc_process_exit (cur);
+  if (cur->thread_cnt > 1)
+    futex_wake_all (cur);
+  while (cur->thread_cnt > 1)
+    cond_wait (&cur->threads_gone, &cur->threads_lock);
+  lock_release (&cur->threads_lock);
+
+  /* Report the exit code to the parent, and let go of the
+     children, which may outlive us. */
+  if (cur->wait_status != NULL)
+    {
+      struct process_status *s = cur->wait_status;
+      enum intr_level old_level;
+
+      printf ("%s: exit(%d)\n", cur->name, cur->exit_code);
+      if (process_print_mem_stats) 
+        {
+          struct mem_stats ms;
+
+          process_get_mem_stats (&ms);
+          printf ("%s: %"PRIu64" minor faults, %"PRIu64" major faults, "
+                  "%"PRIu64" swap-ins, %"PRIu64" swap-outs, "
+                  "%"PRIu32" resident pages, %"PRIu32" mapped pages\n",
+                  cur->name, ms.minor_faults, ms.major_faults,
+                  ms.swap_ins, ms.swap_outs,
+                  ms.resident_pages, ms.mapped_pages);
+        }
+      s->exit_code = cur->exit_code;
+      old_level = intr_disable ();
+      if (s->ref_cnt == 2)
+        {
+          list_push_back (&s->parent->exited, &s->exit_elem);
+          s->queued = true;
+          sema_up (&s->parent->child_exited);
+        }
+      intr_set_level (old_level);
+      sema_up (&s->dead);
+
+      /* process_wait() trusts a nonnull WAIT_STATUS. */
+      cur->wait_status = NULL;
+      release_status (s);
+    }
+  while (!list_empty (&cur->children))
+    release_status (list_entry (list_pop_front (&cur->children),
+                                struct process_status, elem));
+  fd_close_all ();
+
+#ifdef VM
+  /* Unmapping files writes back what the process changed in
+     them, and the executable may be written again as soon as the
+     process is gone, so neither waits for the reaper. */
+  mmap_unmap_all ();
+  if (cur->exec_file != NULL)
+    file_allow_write (cur->exec_file);
+#endif
+
+  if (cur->pagedir != NULL) 
+    {
+      thread_hold (cur);
+      lock_acquire (&reap_lock);
+      reap_cnt++;
+      lock_release (&reap_lock);
+      work_init (&cur->reap_work, reap, cur);
+      work_queue (&cur->reap_work);
+    }
+}
+
+/* Passes a new thread from process_thread_create() to itself. */
+struct thread_aux
+  {
+    struct thread *proc;        /* Process the thread joins. */
+    struct intr_frame if_;      /* Initial user register state. */
+    uint32_t *tid_word;         /* Gets the thread's id, or null. */
+    struct semaphore started;   /* Upped once AUX has been used. */
+  };
+
+static thread_func start_thread NO_RETURN;
+
+/* Starts a new thread in the running process, sharing its
+   address space and file descriptors, that runs user code at EIP
+   with its stack pointer at ESP.  If TID_WORD is not null, the
+   new thread stores its id at that user address before this
+   function returns, and clears it and wakes it as a futex when
+   it exits, so that other threads can wait for it to finish.
+   Returns the new thread's id, or TID_ERROR if the thread cannot
+   be created or the process is exiting. */
+tid_t
+process_thread_create (void (*eip) (void), void *esp, uint32_t *tid_word) 
+{
+  struct thread *proc = process_current ();
+  struct thread_aux aux;
+  tid_t tid;
+
+  lock_acquire (&proc->threads_lock);
+  if (proc->exiting)
+    {
+      lock_release (&proc->threads_lock);
+      return TID_ERROR;
+    }
+  proc->thread_cnt++;
+  lock_release (&proc->threads_lock);
+
+  aux.proc = proc;
+  memset (&aux.if_, 0, sizeof aux.if_);
+  aux.if_.gs = aux.if_.fs = aux.if_.es = aux.if_.ds = SEL_UDSEG;
+  aux.if_.ss = SEL_UDSEG;
+  aux.if_.cs = SEL_UCSEG;
+  aux.if_.eflags = FLAG_IF | FLAG_MBS;
+  aux.if_.eip = eip;
+  aux.if_.esp = esp;
+  aux.tid_word = tid_word;
+  sema_init (&aux.started, 0);
+
+  /* Hold the leader's struct thread, which the new thread uses,
+     until the new thread has left the process. */
+  thread_hold (proc);
+  tid = thread_create (proc->name, thread_get_priority (), start_thread,
+                       &aux);
+  if (tid == TID_ERROR)
+    {
+      lock_acquire (&proc->threads_lock);
+      proc->thread_cnt--;
+      cond_signal (&proc->threads_gone, &proc->threads_lock);
+      lock_release (&proc->threads_lock);
+      thread_release (proc);
+      return TID_ERROR;
+    }
+  sema_down (&aux.started);
+  return tid;
+}
+
+/* A thread function that joins a new thread to its process and
+   starts it running user code. */
+static void
+start_thread (void *aux_) 
+{
+  struct thread_aux *aux = aux_;
+  struct thread *t = thread_current ();
+  struct intr_frame if_ = aux->if_;
+
+  t->proc = aux->proc;
+  t->exit_code = -1;
+  t->tid_word = aux->tid_word;
+  process_activate ();
+  if (t->tid_word != NULL)
+    syscall_put_word (t->tid_word, t->tid);
+
+  /* AUX lives on the creator's stack. */
+  sema_up (&aux->started);
+
+  /* Start the thread as start_process() does, unless the process
+     has begun to exit meanwhile. */
+  process_check_exit ();
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Ends the running thread.  A thread other than its process's
+   leader leaves the process, which goes on running.  The leader,
+   whose struct thread holds the process's state, waits until it
+   is the last thread and then ends the process with exit code 0,
+   unless another thread has already ended it. */
+void
+process_thread_exit (void) 
+{
+  struct thread *cur = thread_current ();
+
+  if (cur->proc != cur)
+    cur->exit_alone = true;
+  else
+    {
+      lock_acquire (&cur->threads_lock);
+      while (cur->thread_cnt > 1 && !cur->exiting)
+        cond_wait (&cur->threads_gone, &cur->threads_lock);
+      if (!cur->exiting)
+        cur->exit_code = 0;
+      lock_release (&cur->threads_lock);
+    }
+  thread_exit ();
+}
+
+/* Makes the running thread exit if its process is exiting, as
+   when another of its threads has called exit() or been killed.
+   Called before a thread returns to user mode.  Interrupts may
+   be off. */
+void
+process_check_exit (void) 
+{
+  if (thread_current ()->proc->exiting)
+    {
+      intr_enable ();
+      thread_exit ();
+    }
+}
+
+/* Takes CUR, the running thread, out of its process, for
+   process_exit().  A thread that exits on its own clears and
+   wakes its id word for any thread waiting for it; one that
+   calls exit() or is killed ends the whole process, with its
+   exit code.  Either way, CUR stops using the process's address
+   space before the leader may tear it down. */
+static void
+leave_process (struct thread *cur) 
+{
+  struct thread *proc = cur->proc;
+  enum intr_level old_level;
+
+  ipc_thread_exit (cur);
+  lock_acquire (&proc->threads_lock);
+  if (!cur->exit_alone && !proc->exiting)
     {
-      /* Correct ordering here is crucial.  We must set
-         cur->pagedir to NULL before switching page directories,
-         so that a timer interrupt can't switch back to the
-         process page directory.  We must activate the base page
-         directory before destroying the process's page
-         directory, or our active page directory will be one
-         that's been freed (and cleared). */
-      cur->pagedir = NULL;
-      pagedir_activate (NULL);
-      pagedir_destroy (pd);
+      proc->exit_code = cur->exit_code;
+      proc->exiting = true;
+      ipc_process_exit (proc);
+      futex_wake_all (proc);
     }
+  lock_release (&proc->threads_lock);
+
+  if (cur->tid_word != NULL && !proc->exiting
+      && syscall_put_word (cur->tid_word, 0))
+    futex_wake (cur->tid_word, INT_MAX);
+
+  old_level = intr_disable ();
+  cur->proc = cur;
+  process_activate ();
+  intr_set_level (old_level);
+
+  lock_acquire (&proc->threads_lock);
+  proc->thread_cnt--;
+  cond_signal (&proc->threads_gone, &proc->threads_lock);
+  lock_release (&proc->threads_lock);
+  thread_release (proc);
+}
+
+/* Stores the running process's memory statistics into MS.
+   Without virtual memory, they are all 0. */
+void
+process_get_mem_stats (struct mem_stats *ms) 
+{
+  struct thread *cur = process_current ();
+  size_t resident = 0, mapped = 0;
+
+#ifdef VM
+  page_table_lock ();
+  page_count (&resident, &mapped);
+  page_table_unlock ();
+#endif
+  ms->minor_faults = stats_get (&cur->minor_faults);
+  ms->major_faults = stats_get (&cur->major_faults);
+  ms->swap_ins = stats_get (&cur->swap_ins);
+  ms->swap_outs = stats_get (&cur->swap_outs);
+  ms->resident_pages = resident;
+  ms->mapped_pages = mapped;
+}
+
+/* Tears down the address space of T, an exited process, for the
+   reaper: frees its pages and then its page directory, and lets
+   go of T. */
+static void
+reap (void *t_) 
+{
+  struct thread *t = t_;
+  uint32_t *pd;
+
+#ifdef VM
+  /* Free the process's pages while its page directory, which
+     maps them, still exists, then the executable that backs
+     them. */
+  page_table_destroy (t);
+  file_close (t->exec_file);
+  t->exec_file = NULL;
+#endif
+
+  /* T may not have finished exiting yet.  We must set
+     T->pagedir to NULL before destroying the page directory, so
+     that switching back to T activates the kernel-only page
+     directory instead.  The reaper, a kernel thread, never has
+     T's page directory active itself. */
+  pd = t->pagedir;
+  t->pagedir = NULL;
+  pagedir_destroy (pd);
+  thread_release (t);
+
+  lock_acquire (&reap_lock);
+  if (--reap_cnt == 0)
+    wait_queue_wake (&reaped, &reap_lock);
+  lock_release (&reap_lock);
+}
+
+/* Waits until the reaper has torn down the address spaces of all
+   the processes that have exited so far, for a thread that has
+   run short of memory.  Returns true if there were any, false if
+   there was nothing to wait for. */
+bool
+process_reap_wait (void) 
+{
+  bool waited;
+
+  lock_acquire (&reap_lock);
+  waited = reap_cnt > 0;
+  while (reap_cnt > 0)
+    wait_queue_wait (&reaped, &reap_lock, false);
+  lock_release (&reap_lock);
+  return waited;
 }
 
 /* Sets up the CPU for running user code in the current
@@ -124,8 +830,8 @@ process_activate (void)
 {
   struct thread *t = thread_current ();
 
-  /* Activate thread's page tables. */
-  pagedir_activate (t->pagedir);
+  /* Activate the page tables of the thread's process. */
+  pagedir_activate (t->proc->pagedir);
 
   /* Set thread's kernel stack for use in processing
      interrupts. */
@@ -195,39 +901,177 @@ struct Elf32_Phdr
 #define PF_W 2          /* Writable. */
 #define PF_R 4          /* Readable. */
 
-static bool setup_stack (void **esp);
+static bool setup_stack (struct exec_aux *, void **esp);
 static bool validate_segment (const struct Elf32_Phdr *, struct file *);
 static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
                           uint32_t read_bytes, uint32_t zero_bytes,
                           bool writable);
 
-/* Loads an ELF executable from FILE_NAME into the current thread.
-   Stores the executable's entry point into *EIP
-   and its initial stack pointer into *ESP.
-   Returns true if successful, false otherwise. */
-bool
-load (const char *file_name, void (**eip) (void), void **esp) 
+/* Executable images.
+
+   Loading a program needs only its entry point and the list of
+   segments to map, but finding those takes a read of the ELF
+   header and one of each program header, all of which have to
+   be checked.  The image cache keeps the result for the last few
+   programs loaded, keyed by inode, so that running the same
+   program again goes straight to mapping its segments.
+
+   Each entry holds its executable open, so that the inode, and
+   with it the count inode_mod_cnt() keeps of writes to it, stays
+   in memory for as long as the entry exists.  An entry is only
+   used while that count is what it was before the headers were
+   read.  The remove system call has process_forget_removed()
+   drop the entries of removed executables, whose sectors are
+   only freed once the last opener closes them. */
+
+/* Most loadable segments an executable may have. */
+#define SEG_MAX 8
+
+/* A loadable segment, as load_segment() takes it. */
+struct segment
+  {
+    uint32_t file_page;         /* Offset in file of first page. */
+    uint32_t mem_page;          /* User address of first page. */
+    uint32_t read_bytes;        /* Bytes to read from file. */
+    uint32_t zero_bytes;        /* Bytes to zero after those. */
+    bool writable;              /* Writable by the process? */
+  };
+
+/* An executable's layout. */
+struct image
+  {
+    void (*entry) (void);       /* Entry point. */
+    unsigned mod_cnt;           /* inode_mod_cnt() before reading. */
+    size_t seg_cnt;             /* Number of segments. */
+    struct segment segs[SEG_MAX]; /* Segments to map. */
+  };
+
+/* An entry in the image cache. */
+struct image_entry
+  {
+    struct file *file;          /* Executable, or null if unused. */
+    int64_t stamp;              /* Time of last use, for LRU. */
+    struct image image;         /* Layout. */
+  };
+
+/* Number of images cached. */
+#define IMAGE_CNT 8
+
+/* The image cache, protected by image_lock. */
+static struct image_entry images[IMAGE_CNT];
+static int64_t image_clock;
+static struct lock image_lock;
+
+/* Initializes the image cache and the reaper. */
+void
+process_init (void) 
 {
-  struct thread *t = thread_current ();
-  struct Elf32_Ehdr ehdr;
-  struct file *file = NULL;
-  off_t file_ofs;
-  bool success = false;
-  int i;
+  lock_init_named (&image_lock, "image");
+  lock_init_named (&reap_lock, "reap");
+  wait_queue_init (&reaped);
+}
 
-  /* Allocate and activate page directory. */
-  t->pagedir = pagedir_create ();
-  if (t->pagedir == NULL) 
-    goto done;
-  process_activate ();
+/* Looks up the executable FILE in the image cache.  If it is
+   there and up to date, copies its layout into *IMAGE and returns
+   true; otherwise returns false. */
+static bool
+image_lookup (struct file *file, struct image *image) 
+{
+  struct inode *inode = file_get_inode (file);
+  bool found = false;
+  size_t i;
 
-  /* Open executable file. */
-  file = filesys_open (file_name);
-  if (file == NULL) 
+  lock_acquire (&image_lock);
+  for (i = 0; i < IMAGE_CNT; i++)
     {
-      printf ("load: %s: open failed\n", file_name);
-      goto done; 
+      struct image_entry *e = &images[i];
+      if (e->file != NULL && file_get_inode (e->file) == inode)
+        {
+          if (e->image.mod_cnt == inode_mod_cnt (inode))
+            {
+              *image = e->image;
+              e->stamp = ++image_clock;
+              found = true;
+            }
+          break;
+        }
     }
+  lock_release (&image_lock);
+  return found;
+}
+
+/* Adds IMAGE, the layout of FILE, to the image cache, replacing
+   any older entry for FILE or else the least recently used
+   entry. */
+static void
+image_insert (struct file *file, const struct image *image) 
+{
+  struct inode *inode = file_get_inode (file);
+  struct image_entry *victim = &images[0];
+  struct file *old_file;
+  size_t i;
+
+  lock_acquire (&image_lock);
+  for (i = 0; i < IMAGE_CNT; i++)
+    {
+      struct image_entry *e = &images[i];
+      if (e->file != NULL && file_get_inode (e->file) == inode)
+        {
+          victim = e;
+          break;
+        }
+      if (e->file == NULL || e->stamp < victim->stamp)
+        victim = e;
+    }
+  old_file = victim->file;
+  victim->file = file_reopen (file);
+  victim->stamp = ++image_clock;
+  victim->image = *image;
+  lock_release (&image_lock);
+
+  /* Closing may write to disk, so do it without the lock. */
+  file_close (old_file);
+}
+
+/* Drops the image cache entries for executables that have been
+   removed, so that closing them can free their sectors. */
+void
+process_forget_removed (void) 
+{
+  struct file *removed[IMAGE_CNT];
+  size_t removed_cnt = 0;
+  size_t i;
+
+  lock_acquire (&image_lock);
+  for (i = 0; i < IMAGE_CNT; i++)
+    {
+      struct image_entry *e = &images[i];
+      if (e->file != NULL && inode_is_removed (file_get_inode (e->file)))
+        {
+          removed[removed_cnt++] = e->file;
+          e->file = NULL;
+        }
+    }
+  lock_release (&image_lock);
+
+  /* Closing may write to disk, so do it without the lock. */
+  for (i = 0; i < removed_cnt; i++)
+    file_close (removed[i]);
+}
+
+/* Reads and checks the ELF headers of FILE, named FILE_NAME, and
+   stores its layout in *IMAGE.  Returns true if successful,
+   false if FILE is not an executable we can load. */
+static bool
+read_image (struct file *file, const char *file_name, struct image *image) 
+{
+  struct Elf32_Ehdr ehdr;
+  off_t file_ofs;
+  int i;
+
+  /* Note the write count first, so that a write that races with
+     reading the headers makes the result out of date. */
+  image->mod_cnt = inode_mod_cnt (file_get_inode (file));
 
   /* Read and verify executable header. */
   if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
@@ -239,21 +1083,21 @@ load (const char *file_name, void (**eip) (void), void **esp)
       || ehdr.e_phnum > 1024) 
     {
       printf ("load: %s: error loading executable\n", file_name);
-      goto done; 
+      return false;
     }
 
   /* Read program headers. */
+  image->entry = (void (*) (void)) ehdr.e_entry;
+  image->seg_cnt = 0;
   file_ofs = ehdr.e_phoff;
   for (i = 0; i < ehdr.e_phnum; i++) 
     {
       struct Elf32_Phdr phdr;
 
       if (file_ofs < 0 || file_ofs > file_length (file))
-        goto done;
-      file_seek (file, file_ofs);
-
-      if (file_read (file, &phdr, sizeof phdr) != sizeof phdr)
-        goto done;
+        return false;
+      if (file_read_at (file, &phdr, sizeof phdr, file_ofs) != sizeof phdr)
+        return false;
       file_ofs += sizeof phdr;
       switch (phdr.p_type) 
         {
@@ -267,58 +1111,135 @@ load (const char *file_name, void (**eip) (void), void **esp)
         case PT_DYNAMIC:
         case PT_INTERP:
         case PT_SHLIB:
-          goto done;
+          return false;
         case PT_LOAD:
-          if (validate_segment (&phdr, file)) 
+          if (validate_segment (&phdr, file)
+              && image->seg_cnt < SEG_MAX) 
             {
-              bool writable = (phdr.p_flags & PF_W) != 0;
-              uint32_t file_page = phdr.p_offset & ~PGMASK;
-              uint32_t mem_page = phdr.p_vaddr & ~PGMASK;
+              struct segment *seg = &image->segs[image->seg_cnt++];
               uint32_t page_offset = phdr.p_vaddr & PGMASK;
-              uint32_t read_bytes, zero_bytes;
+
+              seg->writable = (phdr.p_flags & PF_W) != 0;
+              seg->file_page = phdr.p_offset & ~PGMASK;
+              seg->mem_page = phdr.p_vaddr & ~PGMASK;
               if (phdr.p_filesz > 0)
                 {
                   /* Normal segment.
                      Read initial part from disk and zero the rest. */
-                  read_bytes = page_offset + phdr.p_filesz;
-                  zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz, PGSIZE)
-                                - read_bytes);
+                  seg->read_bytes = page_offset + phdr.p_filesz;
+                  seg->zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz,
+                                               PGSIZE)
+                                     - seg->read_bytes);
                 }
               else 
                 {
                   /* Entirely zero.
                      Don't read anything from disk. */
-                  read_bytes = 0;
-                  zero_bytes = ROUND_UP (page_offset + phdr.p_memsz, PGSIZE);
+                  seg->read_bytes = 0;
+                  seg->zero_bytes = ROUND_UP (page_offset + phdr.p_memsz,
+                                              PGSIZE);
                 }
-              if (!load_segment (file, file_page, (void *) mem_page,
-                                 read_bytes, zero_bytes, writable))
-                goto done;
             }
           else
-            goto done;
+            return false;
           break;
         }
     }
+  return true;
+}
+
+/* Loads the ELF executable that AUX names into the current
+   thread, with the arguments in AUX's stack page.  Stores the
+   executable's entry point into *EIP and its initial stack
+   pointer into *ESP.
+   Returns true if successful, false otherwise. */
+bool
+load (struct exec_aux *aux, void (**eip) (void), void **esp) 
+{
+  struct thread *t = thread_current ();
+  const char *file_name = aux->file_name;
+  struct image image;
+  struct file *file = NULL;
+  uint32_t heap_start = 0;
+  bool success = false;
+  size_t i;
+
+  /* Allocate and activate page directory. */
+  t->pagedir = pagedir_create ();
+  if (t->pagedir == NULL) 
+    goto done;
+  process_activate ();
+#ifdef VM
+  if (!page_table_init ())
+    goto done;
+#endif
+
+  /* Open executable file. */
+  file = filesys_open (file_name);
+  if (file == NULL) 
+    {
+      printf ("load: %s: open failed\n", file_name);
+      goto done; 
+    }
+
+  /* Find the executable's layout, parsing its headers only if
+     the image cache does not already have it. */
+  if (!image_lookup (file, &image))
+    {
+      if (!read_image (file, file_name, &image))
+        goto done;
+      image_insert (file, &image);
+    }
+
+  /* Map the loadable segments.  The heap starts just above the
+     highest of them. */
+  for (i = 0; i < image.seg_cnt; i++)
+    {
+      const struct segment *seg = &image.segs[i];
+      uint32_t seg_end = seg->mem_page + seg->read_bytes + seg->zero_bytes;
+
+      if (!load_segment (file, seg->file_page, (void *) seg->mem_page,
+                         seg->read_bytes, seg->zero_bytes, seg->writable))
+        goto done;
+      if (seg_end > heap_start)
+        heap_start = seg_end;
+    }
+#ifdef VM
+  page_heap_init ((void *) heap_start);
+#endif
 
   /* Set up stack. */
-  if (!setup_stack (esp))
+  if (!setup_stack (aux, esp))
     goto done;
 
   /* Start address. */
-  *eip = (void (*) (void)) ehdr.e_entry;
+  *eip = image.entry;
 
   success = true;
 
  done:
   /* We arrive here whether the load is successful or not. */
+#ifdef VM
+  /* Pages not yet read in still refer to the executable, so keep
+     it open, and unchanged, until the process exits. */
+  if (success)
+    {
+      file_deny_write (file);
+      t->exec_file = file;
+    }
+  else
+    file_close (file);
+#else
   file_close (file);
+#endif
   return success;
 }
 
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -377,6 +1298,10 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   With virtual memory, the segment is only recorded as a region
+   of the page table here, and the page fault handler reads each
+   page in when the process first touches it.
+
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
 static bool
@@ -387,6 +1312,11 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
+#ifdef VM
+  /* Record where to find the segment's pages. */
+  return page_add_region (upage, (read_bytes + zero_bytes) / PGSIZE,
+                          file, ofs, read_bytes, writable, false);
+#else
   file_seek (file, ofs);
   while (read_bytes > 0 || zero_bytes > 0) 
     {
@@ -396,8 +1326,11 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-      /* Get a page of memory. */
+      /* Get a page of memory, waiting for exited processes'
+         memory to be freed if there is none. */
       uint8_t *kpage = palloc_get_page (PAL_USER);
+      if (kpage == NULL && process_reap_wait ())
+        kpage = palloc_get_page (PAL_USER);
       if (kpage == NULL)
         return false;
 
@@ -422,28 +1355,102 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       upage += PGSIZE;
     }
   return true;
+#endif
 }
 
-/* Create a minimal stack by mapping a zeroed page at the top of
-   user virtual memory. */
+/* Create a minimal stack by mapping a page at the top of user
+   virtual memory, laid out with the program's arguments in
+   AUX's stack page by push_args(). */
 static bool
-setup_stack (void **esp) 
+setup_stack (struct exec_aux *aux, void **esp) 
 {
-  uint8_t *kpage;
-  bool success = false;
+  uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
+  size_t used = aux->stack + PGSIZE - (uint8_t *) aux->sp;
 
-  kpage = palloc_get_page (PAL_USER | PAL_ZERO);
-  if (kpage != NULL) 
+  *esp = (uint8_t *) PHYS_BASE - used;
+#ifdef VM
+  {
+    /* The stack page has to be a frame, so copy in the part of
+       AUX's page that push_args() used: usually a few dozen
+       bytes. */
+    uint8_t *kpage = page_alloc (upage, true, 0);
+    if (kpage == NULL)
+      return false;
+    memset (kpage, 0, PGSIZE - used);
+    memcpy (kpage + PGSIZE - used, aux->sp, used);
+    return page_install (upage);
+  }
+#else
+  /* Map AUX's page itself, which now belongs to the process. */
+  if (!install_page (upage, aux->stack, true))
+    return false;
+  aux->stack = NULL;
+  return true;
+#endif
+}
+
+/* Lays out the arguments of a new process in KPAGE, which is to
+   be its initial stack page, as the 80x86 calling convention has
+   them at the entry to main(): the words of CMD_LINE, separated
+   by spaces, at the top, then argv[], argv, argc, and a null
+   return address.  Nothing in the layout depends on the process,
+   so this can be done before the process exists, straight from
+   the caller's command line.  Stores the kernel address of the
+   last of these into *SP and of argv[0] into *FILE_NAME.  Returns
+   true if successful, false if CMD_LINE has no words or they do
+   not fit in the page. */
+static bool
+push_args (uint8_t *kpage, const char *cmd_line, uint32_t **sp_,
+           const char **file_name) 
+{
+  uint8_t *top = kpage + PGSIZE;
+  uint8_t *strings = top;
+  uint32_t *sp;
+  int argc = 0;
+  int i;
+
+  /* Copy the words, argv[argc - 1] lowest. */
+  for (;;)
     {
-      success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
-      if (success)
-        *esp = PHYS_BASE;
-      else
-        palloc_free_page (kpage);
+      size_t len;
+
+      cmd_line += strspn (cmd_line, " ");
+      len = strcspn (cmd_line, " ");
+      if (len == 0)
+        break;
+      if ((size_t) (strings - kpage) < len + 1 + (argc + 5) * sizeof *sp)
+        return false;
+      strings -= len + 1;
+      memcpy (strings, cmd_line, len);
+      strings[len] = '\0';
+      cmd_line += len;
+      argc++;
     }
-  return success;
+  if (argc == 0)
+    return false;
+
+  /* Word-align, then argv[] with its null terminator.  Our
+     arithmetic above reserved room for these and the rest. */
+  sp = (uint32_t *) ((uintptr_t) strings & ~(sizeof *sp - 1));
+  sp -= argc + 1;
+  sp[argc] = 0;
+  for (i = argc - 1; i >= 0; i--)
+    {
+      sp[i] = (uintptr_t) PHYS_BASE - (top - strings);
+      if (i == 0)
+        *file_name = (const char *) strings;
+      strings += strlen ((char *) strings) + 1;
+    }
+
+  /* argv, argc, and the fake return address. */
+  sp[-1] = (uintptr_t) PHYS_BASE - (top - (uint8_t *) sp);
+  sp[-2] = argc;
+  sp[-3] = 0;
+  *sp_ = sp - 3;
+  return true;
 }
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -463,3 +1470,4 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
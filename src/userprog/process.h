@@ -1,11 +1,69 @@
 #ifndef USERPROG_PROCESS_H
 #define USERPROG_PROCESS_H
 
+#include "threads/interrupt.h"
 #include "threads/thread.h"
 
+/* What a spawn_action does. */
+enum spawn_op
+  {
+    SPAWN_DUP,                  /* Copy parent's SRC_FD into FD. */
+    SPAWN_CLOSE,                /* Close FD. */
+    SPAWN_OPEN                  /* Open PATH as FD. */
+  };
+
+/* A change to make to a new process's file descriptors before it
+   is loaded.  Laid out like `struct spawn_action' in
+   lib/user/syscall.h, except that PATH is in kernel memory. */
+struct spawn_action
+  {
+    int op;                     /* A spawn_op. */
+    int fd;                     /* Descriptor to change. */
+    int src_fd;                 /* Parent's descriptor, for SPAWN_DUP. */
+    const char *path;           /* File to open, for SPAWN_OPEN. */
+  };
+
+/* Memory statistics of a process.  Laid out like `struct
+   mem_stats' in lib/user/syscall.h. */
+struct mem_stats
+  {
+    uint64_t minor_faults;      /* Page faults that did no I/O. */
+    uint64_t major_faults;      /* Page faults that read a page. */
+    uint64_t swap_ins;          /* Pages read from swap. */
+    uint64_t swap_outs;         /* Pages written to swap. */
+    uint32_t resident_pages;    /* Pages in memory now. */
+    uint32_t mapped_pages;      /* Pages of memory-mapped files now. */
+  };
+
+/* -memstats: Print memory statistics when a process exits? */
+extern bool process_print_mem_stats;
+
+void process_init (void);
 tid_t process_execute (const char *file_name);
+tid_t process_spawn (const char *cmd_line, const struct spawn_action *,
+                     size_t action_cnt);
+#ifdef VM
+tid_t process_fork (const struct intr_frame *);
+#endif
 int process_wait (tid_t);
+tid_t process_wait_any (bool block, int *exit_code);
 void process_exit (void);
+bool process_reap_wait (void);
+void process_forget_removed (void);
 void process_activate (void);
+void process_get_mem_stats (struct mem_stats *);
+tid_t process_thread_create (void (*eip) (void), void *esp,
+                             uint32_t *tid_word);
+void process_thread_exit (void) NO_RETURN;
+void process_check_exit (void);
+
+/* Returns the leader of the running thread's process, whose
+   struct thread holds the state that the process's threads
+   share. */
+static inline struct thread *
+process_current (void) 
+{
+  return thread_current ()->proc;
+}
 
 #endif /* userprog/process.h */
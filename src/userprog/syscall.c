@@ -1,20 +1,1428 @@
 #include "userprog/syscall.h"
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include "devices/input.h"
+#include "devices/shutdown.h"
+#include "devices/timer.h"
+#include "filesys/directory.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "filesys/pipe.h"
+#include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/perf.h"
+#include "threads/stats.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/fd.h"
+#include "userprog/futex.h"
+#include "userprog/gdt.h"
+#include "userprog/ipc.h"
+#include "userprog/process.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#include "vm/shm.h"
+#endif
 
-static void syscall_handler (struct intr_frame *);
+/* System calls.
+
+   A user program makes a system call with `int $0x30', after
+   pushing the system call's arguments and then its number, so
+   that on entry the user stack pointer points to the number and
+   the arguments follow it.  syscall_handler() fetches the number
+   and then as many argument words as the table entry for it
+   says, with a single bounds check and one word load each, and
+   calls the entry's handler, which returns the value for %eax.
+
+   A program that makes many small file system calls can instead
+   queue them in an array of `struct syscall_op' and run them all
+   with a single SYS_SUBMIT, which calls the same handlers for
+   each and stores their results back in the array.
+
+   User memory is only ever read and written through get_user(),
+   get_user_word(), put_user() and put_user_word(), which the
+   page fault handler in userprog/exception.c recovers from if
+   the address turns out to be bad, rather than by looking up
+   each page in the page directory first.  The exception, with
+   VM, is the buffer of a read or write of a file, whose pages
+   are pinned in memory one at a time and accessed through their
+   frames, so that the file system never faults on them.  A bad
+   pointer kills the process. */
+
+/* A system call handler.  ARG points to the call's arguments,
+   and F to the interrupt frame with the caller's registers.
+   Returns the value for %eax. */
+typedef uint32_t syscall_func (const uint32_t *arg, struct intr_frame *f);
+
+/* An entry in the system call table. */
+struct syscall
+  {
+    syscall_func *func;         /* Handler, or null if none. */
+    int arg_cnt;                /* Number of argument words. */
+    bool batch;                 /* Allowed in SYS_SUBMIT? */
+  };
+
+static syscall_func sys_halt, sys_exit, sys_exec, sys_spawn, sys_wait;
+static syscall_func sys_wait_any;
+static syscall_func sys_create, sys_remove, sys_open, sys_filesize;
+static syscall_func sys_read, sys_write, sys_seek, sys_tell, sys_close;
+static syscall_func sys_pread, sys_pwrite, sys_readv, sys_writev;
+static syscall_func sys_sendfile, sys_submit, sys_stats, sys_clock;
+static syscall_func sys_direct, sys_fadvise, sys_readdir, sys_getdents;
+static syscall_func sys_memstats, sys_thread_create, sys_thread_exit;
+static syscall_func sys_futex_wait, sys_futex_wake, sys_pipe, sys_nosys;
+static syscall_func sys_ipc_call, sys_ipc_receive, sys_ipc_reply;
+static syscall_func sys_perf_read;
+#ifdef VM
+static syscall_func sys_mmap, sys_munmap, sys_fork, sys_sbrk, sys_madvise;
+static syscall_func sys_shm_map, sys_shm_unmap;
+#endif
+
+/* System call table, indexed by system call number.  The file
+   system has only the root directory, so the calls for other
+   directories fail, as do the memory-mapping calls without
+   virtual memory. */
+static const struct syscall syscalls[] =
+  {
+    [SYS_HALT] = {sys_halt, 0},
+    [SYS_EXIT] = {sys_exit, 1},
+    [SYS_EXEC] = {sys_exec, 1},
+    [SYS_WAIT] = {sys_wait, 1},
+    [SYS_CREATE] = {sys_create, 2},
+    [SYS_REMOVE] = {sys_remove, 1},
+    [SYS_OPEN] = {sys_open, 1},
+    [SYS_FILESIZE] = {sys_filesize, 1, true},
+    [SYS_READ] = {sys_read, 3, true},
+    [SYS_WRITE] = {sys_write, 3, true},
+    [SYS_SEEK] = {sys_seek, 2, true},
+    [SYS_TELL] = {sys_tell, 1, true},
+    [SYS_CLOSE] = {sys_close, 1, true},
+#ifdef VM
+    [SYS_MMAP] = {sys_mmap, 3},
+    [SYS_MUNMAP] = {sys_munmap, 1},
+#else
+    [SYS_MMAP] = {sys_nosys, 2},
+    [SYS_MUNMAP] = {sys_nosys, 1},
+#endif
+    [SYS_CHDIR] = {sys_nosys, 1},
+    [SYS_MKDIR] = {sys_nosys, 1},
+    [SYS_READDIR] = {sys_readdir, 2, true},
+    [SYS_ISDIR] = {sys_nosys, 1},
+    [SYS_INUMBER] = {sys_nosys, 1},
+#ifdef VM
+    [SYS_FORK] = {sys_fork, 0},
+#endif
+    [SYS_SUBMIT] = {sys_submit, 2},
+    [SYS_PREAD] = {sys_pread, 4, true},
+    [SYS_PWRITE] = {sys_pwrite, 4, true},
+    [SYS_READV] = {sys_readv, 3, true},
+    [SYS_WRITEV] = {sys_writev, 3, true},
+    [SYS_SENDFILE] = {sys_sendfile, 3, true},
+    [SYS_SPAWN] = {sys_spawn, 3},
+    [SYS_WAIT_ANY] = {sys_wait_any, 2},
+    [SYS_STATS] = {sys_stats, 2},
+    [SYS_CLOCK] = {sys_clock, 1},
+    [SYS_DIRECT] = {sys_direct, 2, true},
+    [SYS_FADVISE] = {sys_fadvise, 4, true},
+    [SYS_GETDENTS] = {sys_getdents, 4, true},
+#ifdef VM
+    [SYS_SBRK] = {sys_sbrk, 1},
+    [SYS_MADVISE] = {sys_madvise, 3},
+#else
+    [SYS_SBRK] = {sys_nosys, 1},
+    [SYS_MADVISE] = {sys_nosys, 3},
+#endif
+    [SYS_MEMSTATS] = {sys_memstats, 1},
+    [SYS_THREAD_CREATE] = {sys_thread_create, 3},
+    [SYS_THREAD_EXIT] = {sys_thread_exit, 0},
+    [SYS_FUTEX_WAIT] = {sys_futex_wait, 2},
+    [SYS_FUTEX_WAKE] = {sys_futex_wake, 2},
+    [SYS_PIPE] = {sys_pipe, 1},
+#ifdef VM
+    [SYS_SHM_MAP] = {sys_shm_map, 3},
+    [SYS_SHM_UNMAP] = {sys_shm_unmap, 1},
+#else
+    [SYS_SHM_MAP] = {sys_nosys, 3},
+    [SYS_SHM_UNMAP] = {sys_nosys, 1},
+#endif
+    [SYS_IPC_CALL] = {sys_ipc_call, 2},
+    [SYS_IPC_RECEIVE] = {sys_ipc_receive, 1},
+    [SYS_IPC_REPLY] = {sys_ipc_reply, 2},
+    [SYS_PERF_READ] = {sys_perf_read, 1},
+  };
+
+/* Number of entries in syscalls[]. */
+#define SYSCALL_CNT (sizeof syscalls / sizeof *syscalls)
+
+/* Most arguments any system call takes. */
+#define ARG_MAX 4
+
+/* A system call queued for SYS_SUBMIT.  Laid out like `struct
+   syscall_op' in lib/user/syscall.h. */
+struct syscall_op
+  {
+    uint32_t nr;                /* System call number. */
+    uint32_t arg[ARG_MAX];      /* Arguments. */
+    int32_t result;             /* Return value. */
+  };
+
+/* A kernel statistic read by SYS_STATS.  Laid out like `struct
+   stats_entry' in lib/user/syscall.h. */
+struct stats_entry
+  {
+    uint64_t value;                     /* Current value. */
+    int32_t gauge;                      /* Nonzero for a gauge. */
+    char name[STATS_NAME_MAX + 1];      /* "group.name". */
+  };
+
+void syscall_handler (struct intr_frame *);
+static void kill (void) NO_RETURN;
+static bool copy_in (void *, const void *usrc, size_t);
+static bool copy_out (void *udst, const void *, size_t);
+static char *copy_in_string (const char *us);
+static bool is_dir (struct file *);
+
+/* CPUID feature bit (function 1, EDX) for SYSENTER and SYSEXIT. */
+#define CPUID_SEP (1u << 11)
+
+/* Model-specific registers that SYSENTER loads from. */
+#define MSR_SYSENTER_CS 0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+/* True if the CPU supports SYSENTER and we have set it up. */
+static bool sysenter_enabled;
+
+/* Writes VALUE to model-specific register MSR. */
+static inline void
+wrmsr (uint32_t msr, uint64_t value) 
+{
+  asm volatile ("wrmsr" : : "c" (msr), "A" (value));
+}
 
 void
 syscall_init (void) 
 {
+  extern void sysenter_entry (void);
+
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
+
+  /* Also take system calls through SYSENTER if the CPU has it.
+     SYSENTER loads SS with the selector after the one given for
+     CS, and SYSEXIT loads the user selectors from the two after
+     that, which matches the GDT's layout. */
+  if (cpu_features () & CPUID_SEP)
+    {
+      wrmsr (MSR_SYSENTER_CS, SEL_KCSEG);
+      wrmsr (MSR_SYSENTER_EIP, (uint32_t) sysenter_entry);
+      sysenter_enabled = true;
+      syscall_set_stack ((uint8_t *) thread_current () + PGSIZE);
+    }
+}
+
+/* Makes SYSENTER switch to kernel stack pointer ESP0.  Called on
+   every switch to a new thread. */
+void
+syscall_set_stack (void *esp0) 
+{
+  if (sysenter_enabled)
+    wrmsr (MSR_SYSENTER_ESP, (uint32_t) esp0);
+}
+
+/* Dispatches the system call that F's user stack asks for.
+   Called through interrupt 0x30 and from sysenter_entry in
+   userprog/sysenter.S. */
+void
+syscall_handler (struct intr_frame *f) 
+{
+  const uint32_t *usp = f->esp;
+  uint32_t arg[ARG_MAX];
+  const struct syscall *sc;
+  uint32_t nr;
+
+#ifdef VM
+  thread_current ()->user_esp = f->esp;
+#endif
+  if (!copy_in (&nr, usp, sizeof nr) || nr >= SYSCALL_CNT)
+    kill ();
+  sc = &syscalls[nr];
+  if (sc->func == NULL || !copy_in (arg, usp + 1, sc->arg_cnt * sizeof *arg))
+    kill ();
+  f->eax = sc->func (arg, f);
+#ifdef VM
+  thread_current ()->user_esp = NULL;
+#endif
+
+  /* Another thread may have ended the process meanwhile. */
+  process_check_exit ();
 }
 
+/* Terminates the running process, which passed a bad system call
+   number or pointer, with exit code -1. */
 static void
-syscall_handler (struct intr_frame *f UNUSED) 
+kill (void) 
+{
+  thread_current ()->exit_code = -1;
+  thread_exit ();
+}
+
+/* Returns true if FILE is a directory, whose entries can be read
+   but which cannot be written as a file. */
+static bool
+is_dir (struct file *file) 
+{
+  return (!file_is_pipe (file)
+          && (inode_flags (file_get_inode (file)) & INODE_DIR) != 0);
+}
+
+/* Reads a byte at user virtual address UADDR, which must be
+   below PHYS_BASE.  Returns the byte value if successful, -1 if
+   a page fault occurred. */
+static inline int
+get_user (const uint8_t *uaddr) 
+{
+  int result;
+  asm ("movl $1f, %0; movzbl %1, %0; 1:"
+       : "=&a" (result) : "m" (*uaddr));
+  return result;
+}
+
+/* Reads a word at user virtual address UADDR, which must be
+   below PHYS_BASE, into *WORD.  Returns true if successful,
+   false if a page fault occurred. */
+static inline bool
+get_user_word (const uint32_t *uaddr, uint32_t *word) 
+{
+  int result;
+  uint32_t w;
+  asm ("movl $1f, %0; movl %2, %1; 1:"
+       : "=&a" (result), "=&r" (w) : "m" (*uaddr));
+  *word = w;
+  return result != -1;
+}
+
+/* Writes BYTE to user address UDST, which must be below
+   PHYS_BASE.  Returns true if successful, false if a page fault
+   occurred. */
+static inline bool
+put_user (uint8_t *udst, uint8_t byte) 
+{
+  int error_code;
+  asm ("movl $1f, %0; movb %b2, %1; 1:"
+       : "=&a" (error_code), "=m" (*udst) : "q" (byte));
+  return error_code != -1;
+}
+
+/* Writes WORD to user address UDST, which must be below
+   PHYS_BASE.  Returns true if successful, false if a page fault
+   occurred. */
+static inline bool
+put_user_word (uint32_t *udst, uint32_t word) 
+{
+  int error_code;
+  asm ("movl $1f, %0; movl %2, %1; 1:"
+       : "=&a" (error_code), "=m" (*udst) : "r" (word));
+  return error_code != -1;
+}
+
+/* Returns true if the SIZE bytes at UADDR all lie below
+   PHYS_BASE. */
+static inline bool
+is_user_range (const void *uaddr, size_t size) 
+{
+  return ((uintptr_t) uaddr < (uintptr_t) PHYS_BASE
+          && size <= (uintptr_t) PHYS_BASE - (uintptr_t) uaddr);
+}
+
+/* Copies SIZE bytes from user address USRC to kernel address
+   DST.  Returns true if successful, false if any of the bytes is
+   not a valid user address. */
+static bool
+copy_in (void *dst_, const void *usrc_, size_t size) 
+{
+  uint8_t *dst = dst_;
+  const uint8_t *usrc = usrc_;
+
+  if (!is_user_range (usrc, size))
+    return false;
+  for (; size >= sizeof (uint32_t); size -= sizeof (uint32_t))
+    {
+      if (!get_user_word ((const uint32_t *) usrc, (uint32_t *) dst))
+        return false;
+      usrc += sizeof (uint32_t);
+      dst += sizeof (uint32_t);
+    }
+  for (; size > 0; size--)
+    {
+      int byte = get_user (usrc++);
+      if (byte == -1)
+        return false;
+      *dst++ = byte;
+    }
+  return true;
+}
+
+/* Copies SIZE bytes from kernel address SRC to user address
+   UDST.  Returns true if successful, false if any of the bytes
+   is not a valid, writable user address. */
+static bool
+copy_out (void *udst_, const void *src_, size_t size) 
+{
+  uint8_t *udst = udst_;
+  const uint8_t *src = src_;
+
+  if (!is_user_range (udst, size))
+    return false;
+  for (; size >= sizeof (uint32_t); size -= sizeof (uint32_t))
+    {
+      if (!put_user_word ((uint32_t *) udst, *(const uint32_t *) src))
+        return false;
+      udst += sizeof (uint32_t);
+      src += sizeof (uint32_t);
+    }
+  for (; size > 0; size--)
+    if (!put_user (udst++, *src++))
+      return false;
+  return true;
+}
+
+/* Reads the word at user address UADDR into *WORD.  Returns
+   true if successful, false if UADDR is a bad pointer. */
+bool
+syscall_get_word (const uint32_t *uaddr, uint32_t *word) 
+{
+  return copy_in (word, uaddr, sizeof *word);
+}
+
+/* Writes WORD to user address UADDR.  Returns true if
+   successful, false if UADDR is a bad pointer. */
+bool
+syscall_put_word (uint32_t *uaddr, uint32_t word) 
+{
+  return copy_out (uaddr, &word, sizeof word);
+}
+
+/* Copies the null-terminated string at user address US into the
+   SIZE bytes at DST.  Returns the length of the string, SIZE if
+   it does not fit, or -1 if US is a bad pointer. */
+static int
+copy_in_string_to (char *dst, const char *us_, size_t size) 
+{
+  const uint8_t *us = (const uint8_t *) us_;
+  size_t len;
+
+  for (len = 0; len < size; len++)
+    {
+      int c = is_user_vaddr (us + len) ? get_user (us + len) : -1;
+
+      if (c == -1)
+        return -1;
+      dst[len] = c;
+      if (c == '\0')
+        return len;
+    }
+  return size;
+}
+
+/* Copies the null-terminated string at user address US into a
+   new page and returns it, to be freed with palloc_free_page().
+   Kills the process if US is a bad pointer.  Returns a null
+   pointer if the string does not fit in a page or no page is
+   available. */
+static char *
+copy_in_string (const char *us) 
 {
-  printf ("system call!\n");
+  char *ks;
+  int len;
+
+  ks = palloc_get_page (0);
+  if (ks == NULL)
+    return NULL;
+  len = copy_in_string_to (ks, us, PGSIZE);
+  if (len < 0 || len >= PGSIZE)
+    {
+      palloc_free_page (ks);
+      if (len < 0)
+        kill ();
+      return NULL;
+    }
+  return ks;
+}
+
+/* Halt system call. */
+static uint32_t
+sys_halt (const uint32_t *arg UNUSED, struct intr_frame *f UNUSED) 
+{
+  shutdown_power_off ();
+}
+
+/* Exit system call. */
+static uint32_t
+sys_exit (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  thread_current ()->exit_code = arg[0];
   thread_exit ();
 }
+
+/* Exec system call. */
+static uint32_t
+sys_exec (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  char *cmd_line = copy_in_string ((const char *) arg[0]);
+  tid_t tid = TID_ERROR;
+
+  if (cmd_line != NULL)
+    {
+      tid = process_execute (cmd_line);
+      palloc_free_page (cmd_line);
+    }
+  return tid;
+}
+
+/* Most file actions a spawn system call may take. */
+#define SPAWN_ACTION_MAX 16
+
+/* Spawn system call.  Runs a command line, like exec, in a new
+   process whose file descriptors are set up by a list of file
+   actions. */
+static uint32_t
+sys_spawn (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  const struct spawn_action *uactions = (const void *) arg[1];
+  unsigned cnt = arg[2];
+  struct spawn_action actions[SPAWN_ACTION_MAX];
+  char *cmd_line, *paths;
+  size_t used = 0;
+  tid_t tid = TID_ERROR;
+  unsigned i;
+
+  if (cnt > SPAWN_ACTION_MAX)
+    return TID_ERROR;
+  cmd_line = copy_in_string ((const char *) arg[0]);
+  if (cmd_line == NULL)
+    return TID_ERROR;
+
+  /* Copy in the actions, and the names of files to open, which
+     all share one page. */
+  paths = palloc_get_page (0);
+  if (paths == NULL)
+    goto done;
+  for (i = 0; i < cnt; i++)
+    {
+      struct spawn_action *a = &actions[i];
+
+      if (!copy_in (a, &uactions[i], sizeof *a))
+        goto bad;
+      if (a->op == SPAWN_OPEN)
+        {
+          int len = copy_in_string_to (paths + used, a->path,
+                                       PGSIZE - used);
+          if (len < 0)
+            goto bad;
+          if ((size_t) len >= PGSIZE - used)
+            goto done;
+          a->path = paths + used;
+          used += len + 1;
+        }
+    }
+  tid = process_spawn (cmd_line, actions, cnt);
+
+ done:
+  palloc_free_page (paths);
+  palloc_free_page (cmd_line);
+  return tid;
+
+ bad:
+  palloc_free_page (paths);
+  palloc_free_page (cmd_line);
+  kill ();
+}
+
+/* Wait system call. */
+static uint32_t
+sys_wait (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  return process_wait (arg[0]);
+}
+
+/* Wait-any system call.  Reaps whichever child exits first,
+   storing its exit code at the given user address. */
+static uint32_t
+sys_wait_any (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  int *uexit_code = (int *) arg[0];
+  int exit_code;
+  tid_t tid;
+
+  if (!is_user_range (uexit_code, sizeof *uexit_code))
+    kill ();
+  tid = process_wait_any (arg[1] != 0, &exit_code);
+  if (tid != TID_ERROR && tid != 0
+      && !copy_out (uexit_code, &exit_code, sizeof exit_code))
+    kill ();
+  return tid;
+}
+
+/* Create system call. */
+static uint32_t
+sys_create (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  char *name = copy_in_string ((const char *) arg[0]);
+  bool success = false;
+
+  if (name != NULL)
+    {
+      success = filesys_create (name, arg[1]);
+      palloc_free_page (name);
+    }
+  return success;
+}
+
+/* Remove system call. */
+static uint32_t
+sys_remove (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  char *name = copy_in_string ((const char *) arg[0]);
+  bool success = false;
+
+  if (name != NULL)
+    {
+      success = filesys_remove (name);
+      palloc_free_page (name);
+      if (success)
+        process_forget_removed ();
+    }
+  return success;
+}
+
+/* Open system call. */
+static uint32_t
+sys_open (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  char *name = copy_in_string ((const char *) arg[0]);
+  struct file *file;
+  int fd = -1;
+
+  if (name == NULL)
+    return -1;
+  file = filesys_open (name);
+  palloc_free_page (name);
+  if (file != NULL)
+    {
+      fd = fd_install (file);
+      if (fd == -1)
+        file_close (file);
+    }
+  return fd;
+}
+
+/* Filesize system call. */
+static uint32_t
+sys_filesize (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  struct file *file = fd_lookup (arg[0]);
+
+  return file != NULL ? file_length (file) : -1;
+}
+
+/* Reads SIZE bytes from FILE into BUFFER, at *OFS, which is
+   advanced, if OFS is non-null, or at the file position
+   otherwise.  Returns the number of bytes read. */
+static off_t
+read_chunk (struct file *file, void *buffer, off_t size, off_t *ofs) 
+{
+  off_t n;
+
+  if (ofs == NULL)
+    return file_read (file, buffer, size);
+  n = file_read_at (file, buffer, size, *ofs);
+  *ofs += n;
+  return n;
+}
+
+/* Writes SIZE bytes from BUFFER into FILE, at *OFS, which is
+   advanced, if OFS is non-null, or at the file position
+   otherwise.  Returns the number of bytes written. */
+static off_t
+write_chunk (struct file *file, const void *buffer, off_t size,
+             off_t *ofs) 
+{
+  off_t n;
+
+  if (ofs == NULL)
+    return file_write (file, buffer, size);
+  n = file_write_at (file, buffer, size, *ofs);
+  *ofs += n;
+  return n;
+}
+
+/* Reads SIZE bytes into user buffer UDST from file descriptor
+   FD, at *OFS, which is advanced, if OFS is non-null, or at the
+   file position otherwise.  Returns the number of bytes read, or
+   -1 if FD is not open for reading in this way.  Kills the
+   process if UDST is bad.  A pipe is read only once, since
+   reading it again after it has returned data could block
+   although there is data to return. */
+static int
+do_read (int fd, uint8_t *udst, unsigned size, off_t *ofs) 
+{
+  struct file *file;
+  unsigned done;
+
+  if (!is_user_range (udst, size))
+    kill ();
+  file = fd_lookup (fd);
+  if (file == NULL && fd == STDIN_FILENO && ofs == NULL)
+    {
+      /* Return whatever input there is, once there is some,
+         rather than waiting for SIZE bytes. */
+      uint8_t buf[128];
+
+      done = input_read (buf, size < sizeof buf ? size : sizeof buf);
+      if (!copy_out (udst, buf, done))
+        kill ();
+      return done;
+    }
+  if (file == NULL)
+    return -1;
+
+#ifdef VM
+  /* Read straight into the frames of the user buffer, pinning
+     one page at a time, so that no page fault on it can happen
+     while the file system is busy. */
+  for (done = 0; done < size; )
+    {
+      uint8_t *uaddr = udst + done;
+      off_t chunk = PGSIZE - pg_ofs (uaddr);
+      uint8_t *kaddr;
+      off_t n;
+
+      if ((unsigned) chunk > size - done)
+        chunk = size - done;
+      page_table_lock ();
+      kaddr = page_pin (uaddr, true);
+      page_table_unlock ();
+      if (kaddr == NULL)
+        kill ();
+      n = read_chunk (file, kaddr, chunk, ofs);
+      page_table_lock ();
+      page_unpin (kaddr);
+      page_table_unlock ();
+      done += n;
+      if (n < chunk || file_is_pipe (file))
+        break;
+    }
+#else
+  {
+    /* Read through a kernel page, so that no page fault on the
+       user buffer can happen while the file system is busy. */
+    uint8_t *buf = palloc_get_page (0);
+
+    if (buf == NULL)
+      return -1;
+    for (done = 0; done < size; )
+      {
+        off_t chunk = size - done < PGSIZE ? size - done : PGSIZE;
+        off_t n = read_chunk (file, buf, chunk, ofs);
+
+        if (!copy_out (udst + done, buf, n))
+          {
+            palloc_free_page (buf);
+            kill ();
+          }
+        done += n;
+        if (n < chunk || file_is_pipe (file))
+          break;
+      }
+    palloc_free_page (buf);
+  }
+#endif
+  return done;
+}
+
+/* Writes SIZE bytes from user buffer USRC to file descriptor FD,
+   at *OFS, which is advanced, if OFS is non-null, or at the file
+   position otherwise.  Returns the number of bytes written, or -1
+   if FD is not open for writing in this way.  Kills the process
+   if USRC is bad. */
+static int
+do_write (int fd, const uint8_t *usrc, unsigned size, off_t *ofs) 
+{
+  struct file *file;
+  unsigned done;
+
+  if (!is_user_range (usrc, size))
+    kill ();
+  file = fd_lookup (fd);
+  if (file == NULL && fd == STDOUT_FILENO && ofs == NULL)
+    {
+      /* Copy through a small buffer, writing one buffer at a
+         time so that a long write is not interleaved with other
+         output within a buffer. */
+      for (done = 0; done < size; )
+        {
+          char cbuf[256];
+          size_t chunk = size - done < sizeof cbuf ? size - done : sizeof cbuf;
+
+          if (!copy_in (cbuf, usrc + done, chunk))
+            kill ();
+          putbuf (cbuf, chunk);
+          done += chunk;
+        }
+      return size;
+    }
+  if (file == NULL || is_dir (file))
+    return -1;
+
+#ifdef VM
+  /* Write straight from the pinned frames of the user buffer, as
+     do_read() reads. */
+  for (done = 0; done < size; )
+    {
+      const uint8_t *uaddr = usrc + done;
+      off_t chunk = PGSIZE - pg_ofs (uaddr);
+      const uint8_t *kaddr;
+      off_t n;
+
+      if ((unsigned) chunk > size - done)
+        chunk = size - done;
+      page_table_lock ();
+      kaddr = page_pin (uaddr, false);
+      page_table_unlock ();
+      if (kaddr == NULL)
+        kill ();
+      n = write_chunk (file, kaddr, chunk, ofs);
+      page_table_lock ();
+      page_unpin (kaddr);
+      page_table_unlock ();
+      done += n;
+      if (n < chunk)
+        break;
+    }
+#else
+  {
+    /* Write through a kernel page, as do_read() reads. */
+    uint8_t *buf = palloc_get_page (0);
+
+    if (buf == NULL)
+      return -1;
+    for (done = 0; done < size; )
+      {
+        off_t chunk = size - done < PGSIZE ? size - done : PGSIZE;
+        off_t n;
+
+        if (!copy_in (buf, usrc + done, chunk))
+          {
+            palloc_free_page (buf);
+            kill ();
+          }
+        n = write_chunk (file, buf, chunk, ofs);
+        done += n;
+        if (n < chunk)
+          break;
+      }
+    palloc_free_page (buf);
+  }
+#endif
+  return done;
+}
+
+/* Read system call. */
+static uint32_t
+sys_read (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  return do_read (arg[0], (uint8_t *) arg[1], arg[2], NULL);
+}
+
+/* Write system call. */
+static uint32_t
+sys_write (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  return do_write (arg[0], (const uint8_t *) arg[1], arg[2], NULL);
+}
+
+/* Pread system call.  Reads at the given offset, leaving the file
+   position alone. */
+static uint32_t
+sys_pread (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  off_t ofs = arg[3];
+
+  if (ofs < 0)
+    return -1;
+  return do_read (arg[0], (uint8_t *) arg[1], arg[2], &ofs);
+}
+
+/* Pwrite system call.  Writes at the given offset, leaving the
+   file position alone. */
+static uint32_t
+sys_pwrite (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  off_t ofs = arg[3];
+
+  if (ofs < 0)
+    return -1;
+  return do_write (arg[0], (const uint8_t *) arg[1], arg[2], &ofs);
+}
+
+/* A buffer for readv and writev.  Laid out like `struct iovec'
+   in lib/user/syscall.h. */
+struct iovec
+  {
+    void *base;                 /* Start of buffer. */
+    uint32_t len;               /* Length in bytes. */
+  };
+
+/* Readv and writev system calls: reads or writes, according to
+   WRITE, the IOV_CNT buffers described by the array at user
+   address UIOV, in order, stopping early at a short transfer.
+   Returns the total number of bytes transferred, or -1 if the
+   file descriptor is bad. */
+static int
+do_vector (int fd, const struct iovec *uiov, unsigned iov_cnt, bool write) 
+{
+  unsigned total = 0;
+  unsigned i;
+
+  for (i = 0; i < iov_cnt; i++)
+    {
+      struct iovec iov;
+      int n;
+
+      if (!copy_in (&iov, &uiov[i], sizeof iov))
+        kill ();
+      n = (write
+           ? do_write (fd, iov.base, iov.len, NULL)
+           : do_read (fd, iov.base, iov.len, NULL));
+      if (n < 0)
+        return i == 0 ? -1 : (int) total;
+      total += n;
+      if ((unsigned) n < iov.len)
+        break;
+    }
+  return total;
+}
+
+/* Readv system call. */
+static uint32_t
+sys_readv (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  return do_vector (arg[0], (const struct iovec *) arg[1], arg[2], false);
+}
+
+/* Writev system call. */
+static uint32_t
+sys_writev (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  return do_vector (arg[0], (const struct iovec *) arg[1], arg[2], true);
+}
+
+/* Sendfile system call.  Copies up to SIZE bytes from the file
+   position of IN_FD to the file position of OUT_FD, advancing
+   both, without the data ever passing through user memory.
+   Returns the number of bytes copied, which is short at end of
+   file or if the disk fills, or -1 if either descriptor is not
+   an open file. */
+static uint32_t
+sys_sendfile (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  struct file *out = fd_lookup (arg[0]);
+  struct file *in = fd_lookup (arg[1]);
+  unsigned size = arg[2];
+  uint8_t *buf;
+  unsigned done;
+
+  if (out == NULL || in == NULL || is_dir (out))
+    return -1;
+
+  /* Each page goes from the source's cache blocks into BUF and
+     from there into the destination's, and file_read()'s
+     readahead keeps the source sectors coming. */
+  buf = palloc_get_page (0);
+  if (buf == NULL)
+    return -1;
+  for (done = 0; done < size; )
+    {
+      off_t chunk = size - done < PGSIZE ? size - done : PGSIZE;
+      off_t n = file_read (in, buf, chunk);
+      off_t written = file_write (out, buf, n);
+
+      done += written;
+      if (written < n)
+        {
+          /* Leave IN positioned just after what was copied. */
+          file_seek (in, file_tell (in) - (n - written));
+          break;
+        }
+      if (n < chunk)
+        break;
+    }
+  palloc_free_page (buf);
+  return done;
+}
+
+/* Seek system call. */
+static uint32_t
+sys_seek (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  struct file *file = fd_lookup (arg[0]);
+
+  if (file != NULL)
+    file_seek (file, arg[1]);
+  return 0;
+}
+
+/* Tell system call. */
+static uint32_t
+sys_tell (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  struct file *file = fd_lookup (arg[0]);
+
+  return file != NULL ? file_tell (file) : -1;
+}
+
+/* Close system call. */
+static uint32_t
+sys_close (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  file_close (fd_remove (arg[0]));
+  return 0;
+}
+
+#ifdef VM
+/* Mmap system call.  Maps the file open as arg[0] at arg[1],
+   with MMAP_* flags arg[2]. */
+static uint32_t
+sys_mmap (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  struct file *file = fd_lookup (arg[0]);
+  mapid_t id;
+
+  if (file == NULL || is_dir (file) || file_is_pipe (file)
+      || (arg[2] & ~MMAP_POPULATE) != 0)
+    return MAP_FAILED;
+  page_table_lock ();
+  id = mmap_map (file, (void *) arg[1], arg[2]);
+  page_table_unlock ();
+  return id;
+}
+
+/* Munmap system call. */
+static uint32_t
+sys_munmap (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  page_table_lock ();
+  mmap_unmap (arg[0]);
+  page_table_unlock ();
+  return 0;
+}
+
+/* Fork system call. */
+static uint32_t
+sys_fork (const uint32_t *arg UNUSED, struct intr_frame *f) 
+{
+  return process_fork (f);
+}
+
+/* Sbrk system call.  Moves the end of the heap by arg[0] bytes
+   and returns where it was, or -1 on failure. */
+static uint32_t
+sys_sbrk (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  void *old_end;
+
+  page_table_lock ();
+  old_end = page_sbrk ((intptr_t) arg[0]);
+  page_table_unlock ();
+  return old_end != NULL ? (uint32_t) old_end : (uint32_t) -1;
+}
+
+/* Madvise system call.  Applies advice arg[2] to the pages
+   holding the arg[1] bytes at arg[0].  Returns 0 if successful,
+   -1 if the advice or range is not valid. */
+static uint32_t
+sys_madvise (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  bool success;
+
+  if (arg[2] > MADV_DONTNEED)
+    return -1;
+  page_table_lock ();
+  success = page_advise ((void *) arg[0], arg[1], arg[2]);
+  page_table_unlock ();
+  return success ? 0 : -1;
+}
+
+/* Shm-map system call.  Maps the shared-memory segment named by
+   the string at arg[0], creating it with arg[1] bytes if there is
+   none, at user address arg[2], or where the kernel picks if
+   arg[2] is null.  Returns the address of the mapping, or a null
+   pointer on failure. */
+static uint32_t
+sys_shm_map (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  char name[SHM_NAME_MAX + 1];
+  int len = copy_in_string_to (name, (const char *) arg[0], sizeof name);
+  void *addr;
+
+  if (len < 0)
+    kill ();
+  if ((size_t) len == sizeof name)
+    return 0;
+  page_table_lock ();
+  addr = shm_map (name, arg[1], (void *) arg[2]);
+  page_table_unlock ();
+  return (uint32_t) addr;
+}
+
+/* Shm-unmap system call.  Removes the mapping of a shared-memory
+   segment that starts at arg[0].  Returns false if there is
+   none. */
+static uint32_t
+sys_shm_unmap (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  bool success;
+
+  page_table_lock ();
+  success = shm_unmap ((void *) arg[0]);
+  page_table_unlock ();
+  return success;
+}
+#endif
+
+/* Submit system call.  Runs the CNT calls queued at OPS in
+   order, storing each one's return value in its RESULT member,
+   and returns the number run.  Stops early at a call that may
+   not be batched. */
+static uint32_t
+sys_submit (const uint32_t *arg, struct intr_frame *f) 
+{
+  struct syscall_op *uops = (struct syscall_op *) arg[0];
+  unsigned cnt = arg[1];
+  unsigned i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct syscall_op op;
+      const struct syscall *sc;
+
+      if (!copy_in (&op, &uops[i], sizeof op))
+        kill ();
+      if (op.nr >= SYSCALL_CNT || !syscalls[op.nr].batch)
+        break;
+      sc = &syscalls[op.nr];
+      op.result = sc->func (op.arg, f);
+      if (!copy_out (&uops[i].result, &op.result, sizeof op.result))
+        kill ();
+    }
+  return i;
+}
+
+/* Stats system call: copies the statistic at index arg[0] in
+   the registry to arg[1], for a monitor that polls them all by
+   counting up from 0. */
+static uint32_t
+sys_stats (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  struct stats_entry entry;
+  enum stats_kind kind;
+
+  memset (&entry, 0, sizeof entry);
+  if (!stats_read (arg[0], entry.name, &entry.value, &kind))
+    return false;
+  entry.gauge = kind == STATS_GAUGE;
+  if (!copy_out ((struct stats_entry *) arg[1], &entry, sizeof entry))
+    kill ();
+  return true;
+}
+
+/* Clock system call: stores the nanoseconds since boot, from
+   timer_ns(), into the 64-bit integer that arg[0] points to. */
+static uint32_t
+sys_clock (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  uint64_t ns = timer_ns ();
+
+  if (!copy_out ((uint64_t *) arg[0], &ns, sizeof ns))
+    kill ();
+  return 0;
+}
+
+/* Memstats system call: stores the running process's memory
+   statistics into the struct mem_stats that arg[0] points to. */
+static uint32_t
+sys_memstats (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  struct mem_stats ms;
+
+  process_get_mem_stats (&ms);
+  if (!copy_out ((struct mem_stats *) arg[0], &ms, sizeof ms))
+    kill ();
+  return 0;
+}
+
+/* Thread-create system call: starts a new thread in the running
+   process that runs user code from arg[0] with its stack pointer
+   at arg[1], which the caller must have set up.  If arg[2] is
+   not null, the new thread's id is stored at that address before
+   the call returns, and the word is cleared and woken as a futex
+   when the thread exits.  Returns the new thread's id, or
+   TID_ERROR. */
+static uint32_t
+sys_thread_create (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  if (!is_user_vaddr ((void *) arg[0]) || !is_user_vaddr ((void *) arg[1]))
+    return TID_ERROR;
+  return process_thread_create ((void (*) (void)) arg[0], (void *) arg[1],
+                                (uint32_t *) arg[2]);
+}
+
+/* Thread-exit system call. */
+static uint32_t
+sys_thread_exit (const uint32_t *arg UNUSED, struct intr_frame *f UNUSED) 
+{
+  process_thread_exit ();
+}
+
+/* Futex-wait system call: sleeps on the word at user address
+   arg[0] if it holds arg[1], until woken by a futex-wake on the
+   same address.  Returns 0 once woken, or -1 at once if the word
+   held something else. */
+static uint32_t
+sys_futex_wait (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  int result = futex_wait ((uint32_t *) arg[0], arg[1]);
+
+  if (result == FUTEX_FAULT)
+    kill ();
+  return result;
+}
+
+/* Futex-wake system call: wakes up to arg[1] threads sleeping on
+   the word at user address arg[0], and returns how many it
+   woke. */
+static uint32_t
+sys_futex_wake (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  return futex_wake ((uint32_t *) arg[0], arg[1]);
+}
+
+/* Pipe system call: creates a pipe and stores file descriptors
+   for its read end and its write end, in that order, in the two
+   ints at user address arg[0].  Returns false if memory or
+   descriptors are not available. */
+static uint32_t
+sys_pipe (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  struct file *read_end, *write_end;
+  int fds[2];
+
+  if (!pipe_create (&read_end, &write_end))
+    return false;
+  fds[0] = fd_install (read_end);
+  if (fds[0] == -1)
+    {
+      file_close (read_end);
+      file_close (write_end);
+      return false;
+    }
+  fds[1] = fd_install (write_end);
+  if (fds[1] == -1)
+    {
+      file_close (fd_remove (fds[0]));
+      file_close (write_end);
+      return false;
+    }
+
+  /* Exiting closes both descriptors. */
+  if (!copy_out ((int *) arg[0], fds, sizeof fds))
+    kill ();
+  return true;
+}
+
+/* IPC-call system call: sends the message at user address
+   arg[1] to process arg[0], waits for the reply, and stores it
+   over the message.  Returns false if the process has no port or
+   exits before replying. */
+static uint32_t
+sys_ipc_call (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  struct ipc_msg msg;
+
+  if (!copy_in (&msg, (const void *) arg[1], sizeof msg))
+    kill ();
+  if (!ipc_call (arg[0], &msg))
+    return false;
+  if (!copy_out ((void *) arg[1], &msg, sizeof msg))
+    kill ();
+  return true;
+}
+
+/* IPC-receive system call: waits for a call to this process and
+   stores its message at user address arg[0].  Returns the
+   caller's thread identifier, to reply to, or TID_ERROR. */
+static uint32_t
+sys_ipc_receive (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  struct ipc_msg msg;
+  tid_t client;
+
+  /* If the message cannot be stored, the call fails as the
+     thread exits. */
+  client = ipc_receive (&msg);
+  if (client != TID_ERROR && !copy_out ((void *) arg[0], &msg, sizeof msg))
+    kill ();
+  return client;
+}
+
+/* IPC-reply system call: answers the call from thread arg[0]
+   that the calling thread received with the message at user
+   address arg[1].  Returns false if the calling thread is not
+   serving such a call. */
+static uint32_t
+sys_ipc_reply (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  struct ipc_msg msg;
+
+  if (!copy_in (&msg, (const void *) arg[1], sizeof msg))
+    kill ();
+  return ipc_reply (arg[0], &msg);
+}
+
+/* Perf-read system call: stores the calling thread's hardware
+   event counts into the struct perf_counts that arg[0] points
+   to.  Returns false, storing zeros, if they are not being
+   counted. */
+static uint32_t
+sys_perf_read (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  struct perf_counts pc;
+  bool ok = perf_read (&pc);
+
+  if (!copy_out ((struct perf_counts *) arg[0], &pc, sizeof pc))
+    kill ();
+  return ok;
+}
+
+/* Direct system call: turns direct I/O, which bypasses the
+   buffer cache, on for file descriptor arg[0] if arg[1] is
+   nonzero, off otherwise.  Returns false if arg[0] is not an
+   open file. */
+static uint32_t
+sys_direct (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  struct file *file = fd_lookup (arg[0]);
+
+  if (file == NULL)
+    return false;
+  file_set_direct (file, arg[1] != 0);
+  return true;
+}
+
+/* Fadvise system call: applies advice arg[3], an enum
+   file_advice, to the arg[2] bytes of file descriptor arg[0]
+   starting at offset arg[1].  Returns false if arg[0] is not an
+   open file or the advice or range is not valid. */
+static uint32_t
+sys_fadvise (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  struct file *file = fd_lookup (arg[0]);
+  off_t ofs = arg[1], size = arg[2];
+
+  if (file == NULL || ofs < 0 || size < 0 || arg[3] > FADV_DONTNEED)
+    return false;
+  file_advise (file, ofs, size, arg[3]);
+  return true;
+}
+
+/* Reads up to CNT entries of the directory open as FILE into
+   RECORDS, from FILE's position on, and advances the position
+   past them.  RECORDS is an array of `struct dir_stat_record' if
+   STAT is true, and of `struct dir_record' otherwise.  Returns
+   the number read, or -1 if FILE is not a directory or memory
+   allocation fails. */
+static int
+read_dir (struct file *file, void *records, size_t cnt, bool stat)
+{
+  struct dir *dir;
+  int n;
+
+  if (file == NULL || !is_dir (file))
+    return -1;
+  dir = dir_open (inode_reopen (file_get_inode (file)));
+  if (dir == NULL)
+    return -1;
+  dir_seek (dir, file_tell (file));
+  if (stat)
+    n = dir_readdir_stat (dir, records, cnt);
+  else
+    n = dir_readdir_batch (dir, records, cnt);
+  file_seek (file, dir_tell (dir));
+  dir_close (dir);
+  return n;
+}
+
+/* Readdir system call: reads the next entry of the directory
+   open as file descriptor arg[0] and stores its name in user
+   buffer arg[1], of READDIR_MAX_LEN + 1 bytes.  Returns false at
+   the end of the directory or if arg[0] is not a directory. */
+static uint32_t
+sys_readdir (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  struct dir_record r;
+
+  if (read_dir (fd_lookup (arg[0]), &r, 1, false) != 1)
+    return false;
+  if (!copy_out ((char *) arg[1], r.name, strlen (r.name) + 1))
+    kill ();
+  return true;
+}
+
+/* Getdents system call: fills user buffer arg[1], of arg[2]
+   bytes, with as many records as fit for the next entries of the
+   directory open as file descriptor arg[0].  The records are
+   `struct dir_stat_record's if arg[3] is nonzero, and `struct
+   dir_record's otherwise.  Returns the number stored, which is 0
+   at the end of the directory, or -1 if arg[0] is not a
+   directory or memory runs out. */
+static uint32_t
+sys_getdents (const uint32_t *arg, struct intr_frame *f UNUSED) 
+{
+  bool stat = arg[3] != 0;
+  size_t record_size = (stat
+                        ? sizeof (struct dir_stat_record)
+                        : sizeof (struct dir_record));
+  size_t cnt = arg[2] / record_size;
+  void *records;
+  int n;
+
+  if (cnt > PGSIZE / record_size)
+    cnt = PGSIZE / record_size;
+  /* Zeroed, so that the bytes of each record past its name's
+     null terminator, and any padding, tell nothing about what the
+     page held before. */
+  records = palloc_get_page (PAL_ZERO);
+  if (records == NULL)
+    return -1;
+  n = read_dir (fd_lookup (arg[0]), records, cnt, stat);
+  if (n > 0 && !copy_out ((void *) arg[1], records, n * record_size))
+    {
+      palloc_free_page (records);
+      kill ();
+    }
+  palloc_free_page (records);
+  return n;
+}
+
+/* Handler for system calls that are not supported yet, which
+   fail. */
+static uint32_t
+sys_nosys (const uint32_t *arg UNUSED, struct intr_frame *f UNUSED) 
+{
+  return -1;
+}
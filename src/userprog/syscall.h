@@ -1,6 +1,12 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 void syscall_init (void);
+void syscall_set_stack (void *esp0);
+bool syscall_get_word (const uint32_t *uaddr, uint32_t *word);
+bool syscall_put_word (uint32_t *uaddr, uint32_t word);
 
 #endif /* userprog/syscall.h */
@@ -0,0 +1,961 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/kmem.h"
+#include "threads/stats.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "threads/work.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#include "vm/page.h"
+
+/* Frame table.
+
+   Tracks every frame of the user pool that holds a user page and
+   the pages that map it, each of which knows its owner thread
+   and user virtual address.  Normally there is one such page,
+   but after a fork a frame is mapped copy-on-write by a page in
+   each process, until one of them writes to it.  The table is a
+   flat array with a slot for each page that the page allocator
+   manages, indexed by palloc_page_idx() of the frame's kernel
+   page, so that the frame of a kernel page is found in O(1), and
+   the slots of pages that hold no frame are null.  The clock
+   hand sweeps the array in order, as a ring, when the user pool
+   is exhausted and a frame has to be taken away from the page
+   that holds it.  The slots of kernel pages make the sweep a
+   little longer, but it reads the table sequentially.
+
+   Eviction uses a clock in which each frame has a level, the
+   number of further sweeps of the hand that it survives without
+   being used.  When the hand finds that a frame's page has been
+   accessed since it last passed, it clears the page's accessed
+   bit and raises the frame's level, up to LEVEL_MAX; otherwise,
+   it lowers the level, or takes the frame as the victim if the
+   level is already 0.  Frames in active use thus build up
+   credit, and a process that streams through memory touching
+   each page only once, such as a sequential scan of a mapped
+   file, only replaces its own and other cold pages rather than
+   the working sets of other processes.  The access that brought
+   a page in does not count, since every page has it: a new
+   frame is "fresh" until the hand first passes it, wherever in
+   the ring its page happens to be.  A page that
+   its process has marked as used only once, with MADV_SEQUENTIAL,
+   earns no credit at all, so the hand takes it on its next pass
+   after the page was last used.
+
+   The working set of a process that keeps faulting its own
+   evicted pages back in is too large for the level it earns by
+   use alone, so such a refaulted page starts out at level 1, and
+   at LEVEL_MAX if its process has refaulted more than
+   REFAULT_HIGH pages in the last REFAULT_WINDOW ticks or so.
+   LEVEL_MAX + 2 sweeps always find a victim among the frames
+   that may be evicted.
+
+   A pinned frame is never chosen.  frame_alloc() returns frames
+   pinned, so that a frame cannot be evicted while its page is
+   being read in, until the caller maps it and calls
+   frame_unpin().  A frame may be pinned more than once, as when
+   a system call pins the pages of a user buffer, and may be
+   evicted again once every pin is dropped.  Frames shared
+   among processes by vm/share.c stay pinned, and list no pages.
+   A frame mapped by more than one page is not evicted either,
+   nor is a frame of a vm/shm.c segment that no page maps at the
+   moment.
+
+   A process's large pages, which vm/page.c maps for big heaps,
+   are not in the table at all, and so are never chosen.  When
+   the clock finds no victim, the allocating process's large
+   pages are split into ordinary frames, which frame_adopt()
+   enters in the table, and the clock tries again.
+
+   So that a thread that needs a frame seldom has to wait for a
+   page to be written out first, a page-out job on the work queue
+   keeps some frames free ahead of need.  Each allocation that
+   leaves fewer than frame_low_water frames free in the user pool
+   queues it, and it evicts pages with the same clock, a batch at
+   a time, until frame_high_water frames are free.  Pages that it
+   writes to swap one after another land in consecutive slots.
+   The "-pageout" option sets the watermarks; by default they are
+   1/32 and 1/16 of the user pool.
+
+   When the page allocator compacts the user pool to make room
+   for a run of pages, migrate() moves the frames in the run to
+   other pages of the pool, finding them through their slots.  A
+   frame keeps its struct frame, and only its kernel page and its
+   slot change, so nothing that refers to the frame notices.  The
+   frames that the clock would not evict, and those of
+   shared-memory segments, which other processes may map at any
+   moment, stay put, and so does the run.
+
+   With the "-ksm=PAGES" option, a merge job on the work queue
+   examines PAGES frames every MERGE_TICKS timer ticks, going
+   round the table with a hand of its own, and merges frames of
+   anonymous pages that hold the same data into one, which the
+   pages then map read-only, copy-on-write, as after a fork.  A
+   frame whose data hashes the same as when the job last saw it,
+   and so seems to change seldom, goes into a hash table under
+   that hash.  If a frame is already there under the same hash,
+   the job write-protects the pages of both and compares their
+   data, and if it is identical, it points the new frame's page
+   at the frame in the table, frees the new frame, and leaves the
+   frame in the table as "stable", read-only for as long as a
+   page maps it that way, so that any number of pages can be
+   merged into it.  A frame that is only a candidate may change
+   under its hash, so candidates left over from earlier passes of
+   the hand are ignored, and every comparison is of the data
+   itself.  The first page to write to a frame it alone maps
+   takes the frame out of the table, through frame_claim(). */
+
+static struct frame **frame_table;      /* Frames by page index. */
+static size_t slot_cnt;                 /* Slots in frame_table. */
+static size_t hand;                     /* Next slot for the clock. */
+static size_t frame_cnt;                /* Number of frames. */
+static struct lock frame_lock;          /* Protects the above. */
+static struct kmem_cache *frame_cache;  /* Allocates frame entries. */
+
+/* Statistics. */
+static long long alloc_cnt;             /* Frames allocated. */
+static long long evict_cnt;             /* Frames evicted. */
+static long long refault_cnt;           /* Evicted pages faulted in. */
+static long long sweep_cnt;             /* Frames examined by clock. */
+
+/* -pageout=LOW,HIGH: Free frames below which allocation starts
+   the page-out job, and up to which the job evicts.  A low
+   watermark of 0 leaves all eviction to allocating threads.
+   FRAME_WATER_AUTO sizes them from the user pool. */
+#define FRAME_WATER_AUTO ((size_t) -1)
+static size_t frame_low_water = FRAME_WATER_AUTO;
+static size_t frame_high_water = FRAME_WATER_AUTO;
+
+/* The page-out job, and whether it is queued or running.  The
+   flag is protected by frame_lock. */
+static struct work pageout_work;
+static bool pageout_busy;
+
+/* Page-out statistics. */
+static struct stats_counter low_hit_cnt;   /* Job started. */
+static struct stats_counter high_hit_cnt;  /* Job reached high mark. */
+static struct stats_counter pageout_cnt;   /* Frames it freed. */
+
+/* Frames moved by compaction. */
+static struct stats_counter migrate_cnt;
+
+/* -ksm: Frames the merge job scans per period, or 0 not to
+   merge. */
+size_t frame_merge_rate;
+
+/* Timer ticks between runs of the merge job. */
+#define MERGE_TICKS (TIMER_FREQ / 10)
+
+/* Same-page merging.  The table and hand are protected by
+   frame_lock. */
+static struct hash merge_table;         /* Frames by merge_key. */
+static size_t merge_hand;               /* Next slot to scan. */
+static unsigned merge_pass;             /* Passes of merge_hand. */
+static struct work merge_work;          /* The merge job. */
+static struct stats_counter merge_scan_cnt;  /* Frames scanned. */
+static struct stats_counter merge_cnt;  /* Frames freed by merging. */
+
+/* Highest level a frame can reach. */
+#define LEVEL_MAX 2
+
+/* Refaults within about REFAULT_WINDOW timer ticks above which a
+   process's refaulted pages get the most protection. */
+#define REFAULT_WINDOW TIMER_FREQ
+#define REFAULT_HIGH 16
+
+static struct frame *allocate (enum palloc_flags, struct page *,
+                               bool may_evict);
+static struct frame **frame_slot (void *kpage);
+static struct frame *new_frame (void *kpage, struct page *);
+static void remove_frame (struct frame *);
+static unsigned initial_level (struct page *);
+static struct frame *evict (void);
+static work_func pageout;
+static void check_low_water (void);
+static palloc_migrate_func migrate;
+static void unlink_frame (struct frame *);
+static work_func merge;
+static void merge_frame (struct frame *);
+static bool stabilize (struct frame *into, struct frame *);
+static struct page *merge_candidate (struct frame *);
+static void forget (struct frame *);
+static hash_hash_func merge_hash;
+static hash_less_func merge_less;
+
+/* Initializes the frame table. */
+void
+frame_init (void) 
+{
+  slot_cnt = palloc_page_cnt ();
+  frame_table = palloc_get_multiple (PAL_ZERO,
+                                     DIV_ROUND_UP (slot_cnt
+                                                   * sizeof *frame_table,
+                                                   PGSIZE));
+  if (frame_table == NULL)
+    PANIC ("frame table creation failed");
+  lock_init_adaptive (&frame_lock, "frame");
+  frame_cache = kmem_cache_create ("frame", sizeof (struct frame), 0,
+                                   NULL, NULL);
+  if (frame_cache == NULL)
+    PANIC ("frame table creation failed");
+
+  if (frame_low_water == FRAME_WATER_AUTO) 
+    {
+      size_t pool_cnt = palloc_free_cnt (PAL_USER);
+
+      frame_low_water = pool_cnt / 32;
+      frame_high_water = pool_cnt / 16;
+    }
+  work_init (&pageout_work, pageout, NULL);
+  stats_register (&low_hit_cnt, "frame", "low_water_hits", STATS_COUNTER);
+  stats_register (&high_hit_cnt, "frame", "high_water_hits",
+                  STATS_COUNTER);
+  stats_register (&pageout_cnt, "frame", "paged_out", STATS_COUNTER);
+  stats_register (&migrate_cnt, "frame", "migrated", STATS_COUNTER);
+  palloc_register_migrate (migrate);
+
+  if (frame_merge_rate > 0)
+    {
+      if (!hash_init (&merge_table, merge_hash, merge_less, NULL))
+        PANIC ("merge table creation failed");
+      stats_register (&merge_scan_cnt, "frame", "merge_scanned",
+                      STATS_COUNTER);
+      stats_register (&merge_cnt, "frame", "merged", STATS_COUNTER);
+      work_init (&merge_work, merge, NULL);
+      work_queue (&merge_work);
+    }
+}
+
+/* Sets the page-out watermarks from VALUE, which is "LOW,HIGH",
+   with LOW <= HIGH, or "0" to turn the page-out job off.  Returns
+   true if successful, false if VALUE is malformed. */
+bool
+frame_select_watermarks (const char *value) 
+{
+  const char *comma;
+  int low, high;
+
+  if (value == NULL)
+    return false;
+  low = atoi (value);
+  comma = strchr (value, ',');
+  high = comma != NULL ? atoi (comma + 1) : low;
+  if (low < 0 || high < low || (comma == NULL && low != 0))
+    return false;
+  frame_low_water = low;
+  frame_high_water = high;
+  return true;
+}
+
+/* Obtains a frame from the user pool to hold PAGE, using FLAGS
+   as for palloc_get_page().  PAL_USER is implied.  PAGE may be
+   null for a frame that vm/share.c shares.  If the pool
+   is exhausted, evicts another page's frame.  Returns the frame,
+   pinned, or a null pointer if no frame could be obtained. */
+struct frame *
+frame_alloc (enum palloc_flags flags, struct page *page) 
+{
+  return allocate (flags, page, true);
+}
+
+/* Like frame_alloc(), but returns a null pointer rather than
+   evict a page if the user pool is exhausted, for reading in a
+   page that no one has asked for yet. */
+struct frame *
+frame_try_alloc (enum palloc_flags flags, struct page *page) 
+{
+  return allocate (flags, page, false);
+}
+
+/* Obtains a frame for frame_alloc() and frame_try_alloc(),
+   evicting a page for it only if MAY_EVICT is true.  If nothing
+   can be evicted, the running process's large pages are split
+   up, which makes their pages candidates too. */
+static struct frame *
+allocate (enum palloc_flags flags, struct page *page, bool may_evict) 
+{
+  struct frame *f;
+  void *kpage;
+
+  kpage = palloc_get_page (flags | PAL_USER);
+  if (kpage == NULL && may_evict && process_reap_wait ())
+    kpage = palloc_get_page (flags | PAL_USER);
+  check_low_water ();
+  if (kpage == NULL)
+    {
+      if (!may_evict)
+        return NULL;
+      f = evict ();
+      if (f == NULL && page_split_large ())
+        f = evict ();
+      if (f == NULL)
+        return NULL;
+      if (flags & PAL_ZERO)
+        clear_page (f->kpage);
+      list_init (&f->pages);
+      if (page != NULL)
+        list_push_back (&f->pages, &page->frame_elem);
+      f->fresh = true;
+      f->level = initial_level (page);
+      f->checksum = 0;
+      return f;
+    }
+
+  f = new_frame (kpage, page);
+  if (f == NULL)
+    palloc_free_page (kpage);
+  return f;
+}
+
+/* Enters KPAGE, a page of the user pool that was obtained
+   other than through frame_alloc(), such as a piece of a large
+   page being split up, into the frame table as the frame of
+   PAGE.  Returns the frame, pinned, or a null pointer if memory
+   is not available. */
+struct frame *
+frame_adopt (void *kpage, struct page *page) 
+{
+  return new_frame (kpage, page);
+}
+
+/* Returns the slot in the frame table for KPAGE. */
+static struct frame **
+frame_slot (void *kpage) 
+{
+  return &frame_table[palloc_page_idx (kpage)];
+}
+
+/* Adds a frame for KPAGE, mapped by PAGE, to the frame table.
+   Returns the frame, pinned, or a null pointer if memory is not
+   available. */
+static struct frame *
+new_frame (void *kpage, struct page *page) 
+{
+  struct frame *f;
+
+  f = kmem_cache_alloc (frame_cache);
+  if (f == NULL)
+    return NULL;
+  f->kpage = kpage;
+  list_init (&f->pages);
+  if (page != NULL)
+    list_push_back (&f->pages, &page->frame_elem);
+  f->pin_cnt = 1;
+  f->orphaned = false;
+  f->fresh = true;
+  f->level = initial_level (page);
+  f->checksum = 0;
+  f->merge = MERGE_NONE;
+
+  lock_acquire (&frame_lock);
+  ASSERT (*frame_slot (kpage) == NULL);
+  *frame_slot (kpage) = f;
+  frame_cnt++;
+  alloc_cnt++;
+  lock_release (&frame_lock);
+
+  return f;
+}
+
+/* Keeps F from being evicted until a matching frame_unpin(). */
+void
+frame_pin (struct frame *f) 
+{
+  lock_acquire (&frame_lock);
+  f->pin_cnt++;
+  lock_release (&frame_lock);
+}
+
+/* Drops a pin on F, allowing F to be evicted if it was the
+   last.  If F was released while pinned, the last unpin frees
+   it. */
+void
+frame_unpin (struct frame *f) 
+{
+  bool dead;
+
+  lock_acquire (&frame_lock);
+  ASSERT (f->pin_cnt > 0);
+  f->pin_cnt--;
+  dead = f->pin_cnt == 0 && f->orphaned;
+  lock_release (&frame_lock);
+
+  if (dead)
+    frame_free (f);
+}
+
+/* Records that PAGE, which must be locked, maps F too. */
+void
+frame_add_page (struct frame *f, struct page *page) 
+{
+  lock_acquire (&frame_lock);
+  list_push_back (&f->pages, &page->frame_elem);
+  lock_release (&frame_lock);
+}
+
+/* Records that PAGE, which must be locked and already unmapped,
+   no longer maps F, but leaves F in the frame table even if no
+   page maps it any more, for a frame that something else, such
+   as a shared-memory segment, still holds. */
+void
+frame_remove_page (struct frame *f UNUSED, struct page *page) 
+{
+  lock_acquire (&frame_lock);
+  list_remove (&page->frame_elem);
+  lock_release (&frame_lock);
+}
+
+/* Returns true if F is mapped by more than one page. */
+bool
+frame_is_shared (struct frame *f) 
+{
+  bool shared;
+
+  lock_acquire (&frame_lock);
+  shared = list_begin (&f->pages) != list_rbegin (&f->pages);
+  lock_release (&frame_lock);
+  return shared;
+}
+
+/* Returns true if PAGE, which must be locked, is the only page
+   that maps F, in which case it may make F writable, and no page
+   is merged into F from then on.  Returns false if other pages
+   still map F. */
+bool
+frame_claim (struct frame *f, struct page *page) 
+{
+  bool alone;
+
+  lock_acquire (&frame_lock);
+  alone = (list_begin (&f->pages) == &page->frame_elem
+           && list_rbegin (&f->pages) == &page->frame_elem);
+  if (alone)
+    forget (f);
+  lock_release (&frame_lock);
+  return alone;
+}
+
+/* Marks F, which must be pinned, to be freed by its last
+   frame_unpin(), and keeps any page from being merged into it
+   meanwhile.  The caller must hold frame_lock. */
+static void
+orphan (struct frame *f) 
+{
+  ASSERT (f->pin_cnt > 0);
+  forget (f);
+  f->orphaned = true;
+}
+
+/* Records that PAGE, which must be locked and already unmapped,
+   no longer maps F, and frees F if no page maps it any more.
+   A system call may still be reading or writing F through a pin
+   from page_pin(), as when another thread unmaps its buffer, in
+   which case F is freed only once it is unpinned. */
+void
+frame_release (struct frame *f, struct page *page) 
+{
+  bool unused;
+
+  lock_acquire (&frame_lock);
+  list_remove (&page->frame_elem);
+  unused = list_empty (&f->pages);
+  if (unused && f->pin_cnt > 0)
+    {
+      orphan (f);
+      unused = false;
+    }
+  lock_release (&frame_lock);
+
+  if (unused)
+    frame_free (f);
+}
+
+/* Frees F, which no page maps any more, or leaves it to the last
+   frame_unpin() if it is pinned, as frame_release() does. */
+void
+frame_put (struct frame *f) 
+{
+  bool pinned;
+
+  lock_acquire (&frame_lock);
+  pinned = f->pin_cnt > 0;
+  if (pinned)
+    orphan (f);
+  lock_release (&frame_lock);
+
+  if (!pinned)
+    frame_free (f);
+}
+
+/* Removes F from the frame table and returns its memory to the
+   user pool.  The caller must already have unmapped it. */
+void
+frame_free (struct frame *f) 
+{
+  void *kpage = f->kpage;
+
+  remove_frame (f);
+  palloc_free_page (kpage);
+}
+
+/* Returns the frame in the frame table for KPAGE, a page of the
+   user pool, or a null pointer if there is none. */
+struct frame *
+frame_lookup (void *kpage) 
+{
+  struct frame *f;
+
+  lock_acquire (&frame_lock);
+  f = *frame_slot (pg_round_down (kpage));
+  lock_release (&frame_lock);
+  return f;
+}
+
+/* Removes F, obtained with frame_adopt(), from the frame table
+   without freeing its memory, which goes back to whoever had it
+   before. */
+void
+frame_disown (struct frame *f) 
+{
+  remove_frame (f);
+}
+
+/* Removes F from the frame table and frees its entry. */
+static void
+remove_frame (struct frame *f) 
+{
+  lock_acquire (&frame_lock);
+  unlink_frame (f);
+  lock_release (&frame_lock);
+
+  kmem_cache_free (frame_cache, f);
+}
+
+/* Takes F out of the frame table and the merge table.  The
+   caller must hold frame_lock. */
+static void
+unlink_frame (struct frame *f) 
+{
+  forget (f);
+  *frame_slot (f->kpage) = NULL;
+  frame_cnt--;
+}
+
+/* Prints frame table statistics. */
+void
+frame_print_stats (void) 
+{
+  printf ("Frames: %zu in use, %lld allocated, %lld evicted, "
+          "%lld refaulted, %lld examined by clock\n",
+          frame_cnt, alloc_cnt, evict_cnt, refault_cnt, sweep_cnt);
+}
+
+/* Chooses a victim frame with the clock algorithm, writes its
+   page out, and returns it, pinned, for reuse.  Returns a null
+   pointer if no frame can be evicted. */
+static struct frame *
+evict (void) 
+{
+  struct frame *f = NULL;
+  size_t i;
+
+  /* LEVEL_MAX + 2 sweeps of the table find any evictable frame,
+     if any frame is in the table at all.  A frame is
+     skipped if it is pinned, if it is not mapped by exactly one
+     page, or if its page is busy (page_try_lock() fails), in
+     which case there may be no victim at all.  The accessed bits
+     the sweep clears cost one TLB flush at the end, not one
+     each. */
+  lock_acquire (&frame_lock);
+  pagedir_defer_flush ();
+  for (i = 0; frame_cnt > 0 && i < (LEVEL_MAX + 2) * slot_cnt; i++)
+    {
+      struct frame *cand = frame_table[hand];
+      struct page *page;
+      uint32_t *pd;
+
+      hand = (hand + 1) % slot_cnt;
+      if (cand == NULL)
+        continue;
+      sweep_cnt++;
+
+      if (cand->pin_cnt > 0 || list_empty (&cand->pages)
+          || list_begin (&cand->pages) != list_rbegin (&cand->pages))
+        continue;
+      page = list_entry (list_front (&cand->pages), struct page,
+                         frame_elem);
+      pd = page->owner->pagedir;
+      if (pagedir_is_accessed (pd, page->upage))
+        {
+          pagedir_set_accessed (pd, page->upage, false);
+          if (page->sequential)
+            cand->level = 0;
+          else if (cand->fresh)
+            cand->fresh = false;
+          else if (cand->level < LEVEL_MAX)
+            cand->level++;
+        }
+      else if (cand->level > 0)
+        cand->level--;
+      else if (page_try_lock (page))
+        {
+          f = cand;
+          f->pin_cnt = 1;
+          forget (f);
+          break;
+        }
+    }
+  pagedir_flush_deferred ();
+  lock_release (&frame_lock);
+
+  if (f == NULL)
+    return NULL;
+  if (!page_out (list_entry (list_front (&f->pages), struct page,
+                             frame_elem)))
+    {
+      frame_unpin (f);
+      return NULL;
+    }
+  evict_cnt++;
+  return f;
+}
+
+/* Queues the page-out job if the user pool has fewer than
+   frame_low_water frames free and the job is not already
+   pending. */
+static void
+check_low_water (void) 
+{
+  bool start;
+
+  if (frame_low_water == 0 || palloc_free_cnt (PAL_USER) >= frame_low_water)
+    return;
+
+  lock_acquire (&frame_lock);
+  start = !pageout_busy;
+  pageout_busy = true;
+  lock_release (&frame_lock);
+
+  if (start) 
+    {
+      stats_inc (&low_hit_cnt);
+      work_queue (&pageout_work);
+    }
+}
+
+/* The page-out job.  Evicts pages and frees their frames until
+   frame_high_water frames are free in the user pool, or nothing
+   more can be evicted.  Gives up after evicting as many frames
+   as the high watermark, in case allocating threads take the
+   frames as fast as it frees them. */
+static void
+pageout (void *aux UNUSED) 
+{
+  size_t i;
+
+  for (i = 0; i < frame_high_water; i++) 
+    {
+      struct frame *f;
+
+      if (palloc_free_cnt (PAL_USER) >= frame_high_water) 
+        {
+          stats_inc (&high_hit_cnt);
+          break;
+        }
+      f = evict ();
+      if (f == NULL)
+        break;
+      frame_free (f);
+      stats_inc (&pageout_cnt);
+    }
+
+  lock_acquire (&frame_lock);
+  pageout_busy = false;
+  lock_release (&frame_lock);
+}
+
+/* Moves the frames in the PAGE_CNT pages of the user pool
+   starting at PAGES to other pages of the pool, for compaction.
+   Returns true if successful, false if any frame there cannot be
+   moved, because it is pinned, is not mapped by exactly one
+   page, belongs to a shared-memory segment, or its page is busy,
+   or if memory runs out.  Like evict(), it only tries to lock,
+   since the page allocator may call it with any lock held. */
+static bool
+migrate (void *pages, size_t page_cnt) 
+{
+  uint8_t *start = pages;
+  size_t list_pages = DIV_ROUND_UP (page_cnt * sizeof (struct frame *),
+                                    PGSIZE);
+  struct frame **frames;
+  size_t cnt = 0;
+  size_t i;
+  bool success = true;
+
+  /* Not malloc(), which may be what is compacting. */
+  frames = palloc_get_multiple (0, list_pages);
+  if (frames == NULL)
+    return false;
+  if (lock_held_by_current_thread (&frame_lock)
+      || !lock_try_acquire (&frame_lock))
+    {
+      palloc_free_multiple (frames, list_pages);
+      return false;
+    }
+
+  /* Lock the page of each frame in the run and pin the frame. */
+  for (i = 0; i < page_cnt; i++)
+    {
+      struct frame *f = *frame_slot (start + i * PGSIZE);
+      struct page *page;
+
+      if (f == NULL)
+        continue;
+      if (f->pin_cnt > 0 || list_empty (&f->pages)
+          || list_begin (&f->pages) != list_rbegin (&f->pages))
+        {
+          success = false;
+          break;
+        }
+      page = list_entry (list_front (&f->pages), struct page, frame_elem);
+      if (page->shm != NULL || !page_try_lock (page))
+        {
+          success = false;
+          break;
+        }
+      f->pin_cnt = 1;
+      frames[cnt++] = f;
+    }
+  lock_release (&frame_lock);
+
+  /* Give each frame a new page and move its page there, or just
+     let go of the rest once something fails.  Allocation keeps
+     out of the run while it is being compacted. */
+  for (i = 0; i < cnt; i++)
+    {
+      struct frame *f = frames[i];
+      struct page *page = list_entry (list_front (&f->pages), struct page,
+                                      frame_elem);
+      void *kpage = success ? palloc_get_page (PAL_USER) : NULL;
+
+      if (kpage != NULL)
+        {
+          void *old_kpage = f->kpage;
+
+          lock_acquire (&frame_lock);
+          *frame_slot (old_kpage) = NULL;
+          *frame_slot (kpage) = f;
+          f->kpage = kpage;
+          lock_release (&frame_lock);
+          page_move (page, old_kpage);
+          palloc_free_page (old_kpage);
+          stats_inc (&migrate_cnt);
+        }
+      else
+        {
+          page_unlock (page);
+          success = false;
+        }
+      frame_unpin (f);
+    }
+  palloc_free_multiple (frames, list_pages);
+  return success;
+}
+
+/* The merge job.  Scans the next frame_merge_rate frames of the
+   table for merging, looking at each slot at most once, then
+   queues itself to run again after MERGE_TICKS. */
+static void
+merge (void *aux UNUSED) 
+{
+  size_t scanned = 0;
+  size_t i;
+
+  lock_acquire (&frame_lock);
+  for (i = 0; i < slot_cnt && scanned < frame_merge_rate; i++) 
+    {
+      struct frame *f = frame_table[merge_hand];
+
+      merge_hand = (merge_hand + 1) % slot_cnt;
+      if (merge_hand == 0)
+        merge_pass++;
+      if (f == NULL)
+        continue;
+      merge_frame (f);
+      stats_inc (&merge_scan_cnt);
+      scanned++;
+    }
+  lock_release (&frame_lock);
+
+  work_queue_delayed (&merge_work, MERGE_TICKS);
+}
+
+/* Merges F into a frame in the merge table that holds the same
+   data, or enters F in the table as a candidate, if F holds the
+   same data as when the merge job last scanned it.  F is freed
+   if it is merged.  The caller must hold frame_lock. */
+static void
+merge_frame (struct frame *f) 
+{
+  struct page *page = merge_candidate (f);
+  struct frame *into;
+  struct hash_elem *e;
+  unsigned sum;
+  bool same;
+
+  if (page == NULL || f->merge == MERGE_STABLE || !page_try_lock (page))
+    return;
+  sum = hash_bytes (f->kpage, PGSIZE);
+  if (sum != f->checksum)
+    {
+      /* Not seen before, or changed since. */
+      f->checksum = sum;
+      page_unlock (page);
+      return;
+    }
+
+  forget (f);
+  f->merge_key = sum;
+  e = hash_find (&merge_table, &f->merge_elem);
+  into = e != NULL ? hash_entry (e, struct frame, merge_elem) : NULL;
+
+  /* Hold the data still while it is compared. */
+  page_protect (page);
+  if (into != NULL && into->merge == MERGE_UNSTABLE)
+    same = stabilize (into, f);
+  else
+    same = into != NULL && !memcmp (f->kpage, into->kpage, PGSIZE);
+  if (same)
+    {
+      list_remove (&page->frame_elem);
+      list_push_back (&into->pages, &page->frame_elem);
+      page_remap (page, into);
+      page_unlock (page);
+
+      unlink_frame (f);
+      palloc_free_page (f->kpage);
+      kmem_cache_free (frame_cache, f);
+      stats_inc (&merge_cnt);
+      return;
+    }
+
+  page_unprotect (page);
+  page_unlock (page);
+  if (into == NULL || into->merge == MERGE_NONE)
+    {
+      f->merge = MERGE_UNSTABLE;
+      f->merge_pass = merge_pass;
+      hash_insert (&merge_table, &f->merge_elem);
+    }
+}
+
+/* Makes INTO, a candidate in the merge table, stable, by
+   protecting its page, if it holds the same data as F, whose
+   page is protected.  Otherwise, or if INTO was entered in an
+   earlier pass of the merge job's hand or can no longer be
+   merged, takes INTO out of the table.  Returns true if INTO is
+   now stable.  The caller must hold frame_lock. */
+static bool
+stabilize (struct frame *into, struct frame *f) 
+{
+  struct page *page = merge_candidate (into);
+  bool same = false;
+
+  if (page != NULL && into->merge_pass == merge_pass
+      && page_try_lock (page))
+    {
+      page_protect (page);
+      same = !memcmp (into->kpage, f->kpage, PGSIZE);
+      if (same)
+        into->merge = MERGE_STABLE;
+      else
+        page_unprotect (page);
+      page_unlock (page);
+    }
+  if (!same)
+    forget (into);
+  return same;
+}
+
+/* Returns the page that maps F, if F may be merged: it is not
+   pinned, exactly one page maps it, and that page is anonymous,
+   neither memory-mapped nor part of a shared-memory segment.
+   Otherwise, returns a null pointer. */
+static struct page *
+merge_candidate (struct frame *f) 
+{
+  struct page *page;
+
+  if (f->pin_cnt > 0 || list_empty (&f->pages)
+      || list_begin (&f->pages) != list_rbegin (&f->pages))
+    return NULL;
+  page = list_entry (list_front (&f->pages), struct page, frame_elem);
+  return !page->mapped && page->shm == NULL ? page : NULL;
+}
+
+/* Takes F out of the merge table, if it is there.  The caller
+   must hold frame_lock. */
+static void
+forget (struct frame *f) 
+{
+  if (f->merge != MERGE_NONE)
+    {
+      hash_delete (&merge_table, &f->merge_elem);
+      f->merge = MERGE_NONE;
+    }
+}
+
+/* Returns the hash under which frame E is in the merge table. */
+static unsigned
+merge_hash (const struct hash_elem *e, void *aux UNUSED) 
+{
+  return hash_entry (e, struct frame, merge_elem)->merge_key;
+}
+
+/* Orders frames A and B in the merge table by their hashes. */
+static bool
+merge_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED) 
+{
+  return (hash_entry (a, struct frame, merge_elem)->merge_key
+          < hash_entry (b, struct frame, merge_elem)->merge_key);
+}
+
+/* Returns the level at which a new frame for PAGE starts, and
+   accounts for PAGE's refault if it was evicted before.  PAGE
+   may be null. */
+static unsigned
+initial_level (struct page *page) 
+{
+  struct thread *t;
+  int64_t now;
+  int64_t shift;
+
+  if (page == NULL || !page->evicted)
+    return 0;
+  page->evicted = false;
+
+  /* Halve the owner's refault rate for every REFAULT_WINDOW
+     ticks since it last decayed, then count this refault.  Only
+     the owner changes its own rate. */
+  t = page->owner;
+  now = timer_ticks ();
+  shift = (now - t->refault_tick) / REFAULT_WINDOW;
+  if (shift > 0)
+    {
+      t->refault_rate = shift < 32 ? t->refault_rate >> shift : 0;
+      t->refault_tick += shift * REFAULT_WINDOW;
+    }
+  t->refault_rate++;
+  refault_cnt++;
+
+  return t->refault_rate > REFAULT_HIGH ? LEVEL_MAX : 1;
+}
@@ -0,0 +1,59 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include "threads/palloc.h"
+
+struct page;
+
+/* A frame's place in the table of candidates for merging. */
+enum frame_merge
+  {
+    MERGE_NONE,                     /* Not in the table. */
+    MERGE_UNSTABLE,                 /* Writable, merely a candidate. */
+    MERGE_STABLE                    /* Read-only, may be merged into. */
+  };
+
+/* A frame of the user pool, holding a user page. */
+struct frame
+  {
+    void *kpage;                    /* Kernel virtual address. */
+    struct list pages;              /* Pages that map the frame. */
+    unsigned pin_cnt;               /* Not evicted while nonzero. */
+    bool orphaned;                  /* Freed at the last unpin? */
+    bool fresh;                     /* Not yet seen by the clock? */
+    unsigned level;                 /* Sweeps it survives unused. */
+
+    /* Same-page merging. */
+    struct hash_elem merge_elem;    /* Element in merge table. */
+    unsigned checksum;              /* Hash of data at last scan. */
+    unsigned merge_key;             /* Hash it is in the table under. */
+    unsigned merge_pass;            /* Scan pass it was entered in. */
+    enum frame_merge merge;         /* Place in the merge table. */
+  };
+
+/* -ksm: Frames the same-page merger scans per period, or 0 not
+   to merge. */
+extern size_t frame_merge_rate;
+
+void frame_init (void);
+bool frame_select_watermarks (const char *);
+struct frame *frame_alloc (enum palloc_flags, struct page *);
+struct frame *frame_try_alloc (enum palloc_flags, struct page *);
+struct frame *frame_adopt (void *kpage, struct page *);
+void frame_disown (struct frame *);
+void frame_pin (struct frame *);
+void frame_unpin (struct frame *);
+void frame_add_page (struct frame *, struct page *);
+void frame_remove_page (struct frame *, struct page *);
+bool frame_is_shared (struct frame *);
+bool frame_claim (struct frame *, struct page *);
+void frame_release (struct frame *, struct page *);
+void frame_put (struct frame *);
+void frame_free (struct frame *);
+struct frame *frame_lookup (void *kpage);
+void frame_print_stats (void);
+
+#endif /* vm/frame.h */
@@ -0,0 +1,161 @@
+#include "vm/mmap.h"
+#include <debug.h>
+#include <rbtree.h>
+#include <round.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/process.h"
+#include "vm/page.h"
+
+/* Memory-mapped files.
+
+   mmap_map() maps a whole file into consecutive pages of the
+   running process's address space.  The mapping is added to the
+   supplemental page table as a region of memory-mapped pages, so
+   nothing is read, or even entered in the table, until the
+   process touches a page, and the page fault handler reads it
+   straight into the frame the process maps, with no intermediate
+   copy.  Modified pages are written back to the file when they
+   are evicted and when the mapping is removed, and never go to
+   swap.  With MMAP_POPULATE, the whole file is read in and mapped
+   at once instead, for a mapping that will be read in full, such
+   as a table loaded at startup: page_populate() asks for all of
+   its data in one read-ahead request and maps the pages a batch
+   at a time, so the program takes no faults on it.  Unmapping
+   visits only the pages that were touched, from
+   the first to the last, so that the pages it writes back reach
+   the file, and the buffer cache behind it, in sequential order.
+
+   A process's mappings are kept in a tree ordered by address.
+   The process's threads share its mappings, which, like its page
+   table, are only looked at and changed with the table locked
+   by page_table_lock(). */
+
+/* A mapping. */
+struct mapping
+  {
+    struct rb_elem elem;            /* Element in thread's mappings. */
+    mapid_t id;                     /* Mapping identifier. */
+    struct file *file;              /* File, opened for the mapping. */
+    uint8_t *base;                  /* First page. */
+    size_t page_cnt;                /* Number of pages. */
+  };
+
+static rb_less_func mapping_less;
+static struct mapping *lookup (mapid_t);
+static void unmap (struct mapping *);
+
+/* Initializes thread T's set of mappings. */
+void
+mmap_init (struct thread *t)
+{
+  rb_init (&t->mappings, mapping_less, NULL);
+}
+
+/* Maps FILE into the running process's address space starting
+   at user virtual address ADDR, reading it all in at once if
+   FLAGS includes MMAP_POPULATE.  The mapping uses its own
+   reopened copy of FILE, so FILE may be closed afterward.
+   Returns the new mapping's identifier, or MAP_FAILED if ADDR is
+   null or not page-aligned, FILE is empty, the pages would
+   overlap any already in the address space, or memory is not
+   available. */
+mapid_t
+mmap_map (struct file *file, void *addr, unsigned flags) 
+{
+  struct thread *t = process_current ();
+  struct mapping *m;
+  off_t length;
+
+  length = file_length (file);
+  if (addr == NULL || pg_ofs (addr) != 0 || length == 0
+      || !is_user_vaddr ((uint8_t *) addr + length - 1))
+    return MAP_FAILED;
+
+  m = malloc (sizeof *m);
+  if (m == NULL)
+    return MAP_FAILED;
+  m->file = file_reopen (file);
+  if (m->file == NULL)
+    {
+      free (m);
+      return MAP_FAILED;
+    }
+  m->base = addr;
+  m->page_cnt = DIV_ROUND_UP (length, PGSIZE);
+  if (!page_add_region (m->base, m->page_cnt, m->file, 0, length,
+                        true, true))
+    {
+      file_close (m->file);
+      free (m);
+      return MAP_FAILED;
+    }
+
+  if (flags & MMAP_POPULATE)
+    page_populate (m->base, m->page_cnt);
+
+  m->id = t->next_mapid++;
+  rb_insert (&t->mappings, &m->elem);
+  return m->id;
+}
+
+/* Removes the running process's mapping ID, writing back the
+   pages it modified.  Does nothing if there is no such
+   mapping. */
+void
+mmap_unmap (mapid_t id) 
+{
+  struct mapping *m = lookup (id);
+
+  if (m != NULL)
+    unmap (m);
+}
+
+/* Removes all of the running process's mappings. */
+void
+mmap_unmap_all (void) 
+{
+  struct thread *t = process_current ();
+
+  while (!rb_empty (&t->mappings))
+    unmap (rb_entry (rb_begin (&t->mappings), struct mapping, elem));
+}
+
+/* Returns the running process's mapping ID, or a null pointer if
+   there is none. */
+static struct mapping *
+lookup (mapid_t id) 
+{
+  struct thread *t = process_current ();
+  struct rb_elem *e;
+
+  for (e = rb_begin (&t->mappings); e != rb_end (&t->mappings);
+       e = rb_next (e))
+    {
+      struct mapping *m = rb_entry (e, struct mapping, elem);
+      if (m->id == id)
+        return m;
+    }
+  return NULL;
+}
+
+/* Returns true if mapping A's first page is below mapping B's. */
+static bool
+mapping_less (const struct rb_elem *a, const struct rb_elem *b,
+              void *aux UNUSED)
+{
+  return (rb_entry (a, struct mapping, elem)->base
+          < rb_entry (b, struct mapping, elem)->base);
+}
+
+/* Removes mapping M and frees it. */
+static void
+unmap (struct mapping *m) 
+{
+  page_remove_region (m->base);
+  rb_remove (&process_current ()->mappings, &m->elem);
+  file_close (m->file);
+  free (m);
+}
@@ -0,0 +1,19 @@
+#ifndef VM_MMAP_H
+#define VM_MMAP_H
+
+struct file;
+struct thread;
+
+/* Memory-mapped file identifier. */
+typedef int mapid_t;
+#define MAP_FAILED ((mapid_t) -1)
+
+/* Flags for mmap_map().  Match MAP_* in lib/user/syscall.h. */
+#define MMAP_POPULATE 0x1       /* Read in the whole file at once. */
+
+void mmap_init (struct thread *);
+mapid_t mmap_map (struct file *, void *addr, unsigned flags);
+void mmap_unmap (mapid_t);
+void mmap_unmap_all (void);
+
+#endif /* vm/mmap.h */
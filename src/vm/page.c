@@ -0,0 +1,2201 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <rbtree.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/kmem.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#include "vm/frame.h"
+#include "vm/share.h"
+#include "vm/shm.h"
+#include "vm/swap.h"
+
+/* Supplemental page table.
+
+   Each process has a table of the pages in its address space,
+   keyed by user virtual address, that records where each page's
+   data is when the page is not in memory.  The page fault
+   handler reads a page in when the process touches it.
+
+   A page of an executable starts out in its file, or as zeros,
+   and is only read in when first touched, so loading a program
+   costs only the I/O for the pages it actually uses.
+
+   An executable's segments and memory-mapped files do not start
+   out with a page in the table at all.  Each is a region: a run
+   of pages whose data lies at consecutive offsets in one file,
+   followed by zeros, kept in a tree ordered by address.  A page
+   of a region gets its struct page, with the region's data for
+   it, the first time it is needed, as when it is faulted in, and
+   joins the region's list of such pages.  Mapping even a huge
+   file thus costs one region, whatever its size, and unmapping
+   it only visits the pages that were ever touched, sorted into
+   address order so that write-back is sequential.  The stack,
+   the heap, and shared-memory segments are added a page at a
+   time.  Other
+   pages, such as the stack, are created resident.  A thread that
+   needs a frame may evict a page: if the page has been modified,
+   it goes to swap, where it stays until the process exits;
+   otherwise it is simply dropped from memory, since its file,
+   its swap slot, or zeros still hold its data.
+
+   A memory-mapped page comes from its file like an executable
+   page, but when it has been modified it is written back there,
+   on eviction or when it is unmapped, instead of to swap.
+
+   A fault on a page that comes from a file also maps those of
+   its neighbours, within an aligned group of FAULT_AROUND pages,
+   that come from the same file and can be had cheaply: shared
+   pages already in memory, and private pages for which a free
+   frame is at hand.  Their file data is requested from the
+   buffer cache's read-ahead thread all at once before the
+   faulting page itself is read, so it is usually cached by the
+   time it is copied.  Sequential access to an executable or a
+   memory-mapped file thus takes one fault per group rather than
+   one per page.
+
+   Pages in swap get the same treatment.  When a page is written
+   to swap right after its virtual neighbour, it goes into the
+   slot next to the neighbour's, so that a process's pages,
+   evicted together, lie in address order in swap.  A fault on a
+   page in swap then reads it together with those of the pages
+   of its fault-around group that lie within SWAP_CLUSTER slots
+   of it, in one request, and maps those for which a free frame
+   is at hand.
+
+   The stack starts out as a single page and grows down when the
+   process touches memory just below it, up to page_stack_limit
+   bytes.  When the stack keeps growing one page at a time, as in
+   a deep recursion, each growth adds twice as many resident pages
+   as the last, up to STACK_RUN_MAX, so that the fault rate falls
+   the longer the growth lasts.
+
+   The heap starts out empty at the first page above the
+   executable's segments, and page_sbrk() moves its end, the
+   break, up or down.  The pages it adds are zero pages, like
+   those of BSS, so they take no frame until they are touched,
+   and the pages it removes are freed at once.
+
+   With the "-large-pages" kernel command-line option, the first
+   write to a page of the heap that lies in an aligned 4 MB span
+   wholly within the heap, none of whose pages has held data yet,
+   gives the whole span a single zeroed 4 MB large page, mapped
+   by one page directory entry, instead of a frame for the one
+   page.  A program that works through a big heap array then
+   takes one fault per 4 MB rather than per page, and one TLB
+   entry covers what would otherwise take 1024.  When no aligned
+   4 MB of memory is free, the span is left to ordinary pages.
+   A large page is not in the frame table, so it is never
+   evicted; instead, when nothing else can be evicted, the
+   process's large pages are split into ordinary pages in the
+   frame table, which can.  A large page is also split when the
+   process forks, to share its pages copy-on-write, and when the
+   break moves into it or MADV_DONTNEED applies to part of it.
+   System calls pin it as a whole, so that it is not split while
+   they use it.
+
+   A page that holds nothing but zeros, such as an untouched page
+   of BSS, of the heap, or of the stack, is mapped read-only to a single shared
+   zero page when the process reads it, and gets a frame of its
+   own only when the process first writes to it.
+
+   Read-only pages read from a file are shared with every other
+   process that maps the same data, through vm/share.c, and stay
+   in memory as long as any process maps them.  Pages that map a
+   shared-memory segment get their frames, and their data when
+   evicted, from the segment, through vm/shm.c.
+
+   A forked process starts out with a copy of its parent's table
+   in which each resident page shares its parent's frame, mapped
+   read-only in both processes, and each page in swap shares its
+   parent's swap slot.  The first write to a copy-on-write page,
+   by either process, gives the writer a frame of its own if the
+   frame is still shared, or else just makes its mapping
+   writable again.  A frame that more than one page maps is
+   never evicted, and a swap slot is only ever rewritten by a
+   page that has it to itself.
+
+   The same-page merger in vm/frame.c shares frames the same
+   way: it protects pages whose data it compares with
+   page_protect(), which makes them copy-on-write, and points
+   pages with identical data at one frame with page_remap().
+
+   A system call that moves file data to or from a user buffer
+   pins the buffer's pages with page_pin(), a page at a time,
+   faulting each in first, and reads or writes its frame
+   directly.  The file system then never takes a page fault on a
+   user address, which could need the disk while it holds its own
+   locks, and the data is not copied through a kernel buffer.
+
+   A process may advise on a range of its pages with
+   page_advise().  MADV_WILLNEED queues the file data of those
+   not in memory for read-ahead into the buffer cache, so that it
+   is read in the background and faulting them in later only
+   copies it.  Pages in swap are left alone.  MADV_DONTNEED drops
+   the pages from memory and swap at once, writing modified
+   memory-mapped pages back first, so that the next access reads
+   them from their file again or, if they have none, finds them
+   zeroed.  MADV_SEQUENTIAL marks the pages as used only once, so
+   that the clock evicts them soon after use, and MADV_NORMAL
+   clears the mark.
+
+   A process's threads share its table, and each holds the
+   table's lock, through page_table_lock(), while it looks pages
+   up or changes the table, as the page fault handler and the
+   system calls that work on pages do.  The lock may be taken
+   again by a thread that holds it already, since a system call
+   that holds it may fault on a user address.  The functions
+   below that work on the running process's table expect their
+   caller to hold the lock, except page_split_large(), which
+   takes it itself, and those that set up a new process's table
+   before it has other threads.  Other processes
+   never change the table, except that a forked child copies its
+   parent's under the lock.  A page's lock serializes moving the
+   page in and out of memory: its owner holds it while faulting
+   the page in or destroying it, and an evicting thread while
+   writing it out.  Evicting threads only ever try to take it, from within
+   the frame table, so that they skip a busy page rather than
+   wait for it. */
+
+/* -stack: Maximum size of a process's stack, in bytes. */
+size_t page_stack_limit = 8 * 1024 * 1024;
+
+/* -large-pages: Back aligned 4 MB spans of the heap with large
+   pages?  Cleared at boot if the CPU does not support them. */
+bool page_large_pages;
+
+/* Pages in a fault-around group.  Must be a power of 2. */
+#define FAULT_AROUND 8
+
+/* Most pages that page_populate() maps at once. */
+#define POPULATE_BATCH 32
+
+/* Most pages that one stack growth adds. */
+#define STACK_RUN_MAX 16
+
+/* How far below the stack pointer an access may be and still
+   grow the stack.  PUSHA, the 80x86 instruction that pushes the
+   most at once, stores 32 bytes below %esp before updating it. */
+#define STACK_SLOP 32
+
+/* Pages in a large page. */
+#define LARGE_PAGES (PTSPAN / PGSIZE)
+
+/* A large page, mapping an aligned 4 MB span of a process's
+   heap. */
+struct large_page
+  {
+    struct list_elem elem;      /* Element in owner's large_pages. */
+    uint8_t *upage;             /* User virtual address. */
+    void *kpage;                /* Kernel virtual address. */
+    unsigned pin_cnt;           /* Not split while nonzero. */
+  };
+
+/* A run of pages that share a backing file, whose pages are
+   only entered in the page table when they are needed. */
+struct region
+  {
+    struct rb_elem elem;        /* Element in owner's regions. */
+    uint8_t *start;             /* First page. */
+    size_t page_cnt;            /* Number of pages. */
+    struct file *file;          /* File, or null for all zeros. */
+    off_t ofs;                  /* Offset in FILE of first page. */
+    off_t length;               /* Bytes of FILE data, then zeros. */
+    bool writable;              /* Pages mapped read/write? */
+    bool mapped;                /* Memory-mapped file? */
+    struct list pages;          /* Pages entered in the table. */
+  };
+
+static struct kmem_cache *page_cache;   /* Allocates pages. */
+static void *zero_page;                 /* Page of zeros, never
+                                           written. */
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func destroy_page;
+static bool clone_pages (struct thread *parent);
+static struct page *new_page (void *upage, bool writable);
+static struct page *page_lookup (const void *upage);
+static struct page *page_lookup_in (struct thread *, const void *upage);
+static struct page *page_get (const void *upage);
+static bool add_page (struct page *);
+static bool range_in_use (const uint8_t *upage, size_t page_cnt);
+static bool in_use (const void *upage);
+static struct region *find_region (struct thread *, const void *upage);
+static void region_data (const struct region *, const void *upage,
+                         struct file **, off_t *, size_t *);
+static rb_less_func region_less;
+static list_less_func region_page_less;
+static bool read_in (struct page *, void *kpage);
+static bool break_cow (struct page *);
+static size_t find_around (struct page *, struct page **);
+static void map_around (struct page **, size_t cnt);
+static bool swap_in_around (struct page *, void *kpage);
+static size_t near_slot (const struct page *);
+static bool is_shared (const struct page *);
+static bool is_zero (const struct page *);
+static void write_back (struct page *);
+static void drop (struct page *);
+static bool make_large (uint8_t *upage);
+static bool split_large (struct thread *, struct large_page *);
+static void free_large (struct thread *, struct large_page *);
+static bool break_large (struct page *, const uint8_t *start,
+                         const uint8_t *end);
+static struct large_page *find_large (const void *upage);
+
+/* Initializes the supplemental page table module. */
+void
+page_init (void) 
+{
+  page_cache = kmem_cache_create ("page", sizeof (struct page), 0,
+                                  NULL, NULL);
+  if (page_cache == NULL)
+    PANIC ("page table creation failed");
+  zero_page = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+}
+
+/* Locks the running process's page table against the process's
+   other threads.  A thread that already holds the lock may take
+   it again, and must release it as many times. */
+void
+page_table_lock (void) 
+{
+  struct thread *proc = process_current ();
+
+  if (lock_held_by_current_thread (&proc->pages_lock))
+    thread_current ()->pages_depth++;
+  else
+    lock_acquire (&proc->pages_lock);
+}
+
+/* Releases the running process's page table, locked with
+   page_table_lock(). */
+void
+page_table_unlock (void) 
+{
+  struct thread *cur = thread_current ();
+
+  if (cur->pages_depth > 0)
+    cur->pages_depth--;
+  else
+    lock_release (&cur->proc->pages_lock);
+}
+
+/* Gives the running process an empty page table.  Returns true
+   if successful, false on memory allocation failure. */
+bool
+page_table_init (void) 
+{
+  struct thread *t = process_current ();
+
+  ASSERT (t->pages == NULL);
+
+  t->pages = malloc (sizeof *t->pages);
+  if (t->pages == NULL)
+    return false;
+  if (!hash_init (t->pages, page_hash, page_less, NULL))
+    {
+      free (t->pages);
+      t->pages = NULL;
+      return false;
+    }
+  rb_init (&t->regions, region_less, NULL);
+
+  /* The page below PHYS_BASE, where the process loader puts the
+     initial stack. */
+  t->stack_bottom = (uint8_t *) PHYS_BASE - PGSIZE;
+  t->stack_run = 1;
+  t->heap_start = t->heap_end = NULL;
+  list_init (&t->large_pages);
+  t->large_miss = NULL;
+  t->swap_upage = NULL;
+  t->swap_slot = SWAP_ERROR;
+  return true;
+}
+
+/* Destroys process T's page table, freeing the frames and swap
+   slots of all its pages and unmapping them.  T must be the
+   running process, or an exited process that no longer runs
+   user code.  Must be called while T's page directory still
+   exists. */
+void
+page_table_destroy (struct thread *t) 
+{
+  if (t->pages == NULL)
+    return;
+  while (!list_empty (&t->large_pages))
+    free_large (t, list_entry (list_front (&t->large_pages),
+                               struct large_page, elem));
+  hash_destroy (t->pages, destroy_page);
+  free (t->pages);
+  t->pages = NULL;
+  while (!rb_empty (&t->regions))
+    {
+      struct region *r = rb_entry (rb_begin (&t->regions), struct region,
+                                   elem);
+      rb_remove (&t->regions, &r->elem);
+      free (r);
+    }
+}
+
+/* Stores into *RESIDENT the number of the running process's
+   pages that are in memory, not counting pages mapped to the
+   shared zero page, and into *MAPPED the number that belong to
+   memory-mapped files. */
+void
+page_count (size_t *resident, size_t *mapped) 
+{
+  struct thread *t = process_current ();
+  struct hash_iterator i;
+  struct rb_elem *e;
+
+  *resident = *mapped = 0;
+  if (t->pages == NULL)
+    return;
+  hash_first (&i, t->pages);
+  while (hash_next (&i)) 
+    {
+      struct page *p = hash_entry (hash_cur (&i), struct page, hash_elem);
+
+      if (p->frame != NULL || p->large)
+        (*resident)++;
+    }
+  for (e = rb_begin (&t->regions); e != rb_end (&t->regions);
+       e = rb_next (e))
+    {
+      struct region *r = rb_entry (e, struct region, elem);
+      if (r->mapped)
+        *mapped += r->page_cnt;
+    }
+}
+
+/* Copies PARENT's page table, which is locked meanwhile, into
+   the running process's empty page table, sharing PARENT's
+   resident pages copy-on-write and its swap slots, for a fork.
+   PARENT's memory-mapped pages are not copied, and its large
+   pages are split so that their pages can be shared.  The running
+   process's pages that come from a file use its own exec_file,
+   which must be open on the same executable as PARENT's.
+   Returns true if successful, false on memory allocation
+   failure or if a swap slot cannot be shared, in which case the
+   pages copied so far stay in the table, to be freed by
+   page_table_destroy(). */
+bool
+page_table_clone (struct thread *parent) 
+{
+  bool success;
+
+  lock_acquire (&parent->pages_lock);
+  success = clone_pages (parent);
+  lock_release (&parent->pages_lock);
+  return success;
+}
+
+/* Does the work of page_table_clone(). */
+static bool
+clone_pages (struct thread *parent) 
+{
+  struct thread *t = process_current ();
+  struct hash_iterator i;
+  struct rb_elem *e;
+
+  ASSERT (t->pages != NULL && hash_empty (t->pages));
+
+  if (parent->pages == NULL)
+    return false;
+  for (e = rb_begin (&parent->regions); e != rb_end (&parent->regions);
+       e = rb_next (e))
+    {
+      struct region *pr = rb_entry (e, struct region, elem);
+      struct region *r;
+
+      if (pr->mapped)
+        continue;
+      r = malloc (sizeof *r);
+      if (r == NULL)
+        return false;
+      *r = *pr;
+      r->file = pr->file != NULL ? t->exec_file : NULL;
+      list_init (&r->pages);
+      rb_insert (&t->regions, &r->elem);
+    }
+  while (!list_empty (&parent->large_pages))
+    if (!split_large (parent, list_entry (list_front (&parent->large_pages),
+                                          struct large_page, elem)))
+      return false;
+  t->stack_bottom = parent->stack_bottom;
+  t->stack_run = parent->stack_run;
+  t->heap_start = parent->heap_start;
+  t->heap_end = parent->heap_end;
+  hash_first (&i, parent->pages);
+  while (hash_next (&i)) 
+    {
+      struct page *pp = hash_entry (hash_cur (&i), struct page,
+                                    hash_elem);
+      struct page *p;
+      bool success = true;
+
+      if (pp->mapped)
+        continue;
+
+      p = new_page (pp->upage, pp->writable);
+      if (p == NULL)
+        return false;
+      if (pp->shm != NULL)
+        {
+          /* Map the same segment, faulting its pages in afresh. */
+          p->shm = pp->shm;
+          p->shm_idx = pp->shm_idx;
+          shm_ref (p->shm);
+          hash_insert (t->pages, &p->hash_elem);
+          continue;
+        }
+      p->sequential = pp->sequential;
+      p->file = pp->file != NULL ? t->exec_file : NULL;
+      p->file_ofs = pp->file_ofs;
+      p->read_bytes = pp->read_bytes;
+      hash_insert (t->pages, &p->hash_elem);
+      if (pp->region != NULL)
+        {
+          p->region = find_region (t, p->upage);
+          list_push_back (&p->region->pages, &p->region_elem);
+        }
+
+      lock_acquire (&pp->lock);
+      if (pp->swap_slot != SWAP_ERROR)
+        {
+          p->swap_slot = swap_dup (pp->swap_slot);
+          success = p->swap_slot != SWAP_ERROR;
+        }
+      if (success && pp->frame != NULL && !is_shared (pp))
+        {
+          /* Share the frame.  Neither process may write it from
+             now on without faulting. */
+          frame_add_page (pp->frame, p);
+          p->frame = pp->frame;
+          if (pp->writable)
+            {
+              pp->cow = p->cow = true;
+              pagedir_set_writable (parent->pagedir, pp->upage, false);
+            }
+          success = pagedir_set_page (t->pagedir, p->upage,
+                                      p->frame->kpage, false);
+          if (success && pagedir_is_dirty (parent->pagedir, pp->upage))
+            pagedir_set_dirty (t->pagedir, p->upage, true);
+        }
+      lock_release (&pp->lock);
+      if (!success)
+        return false;
+    }
+  return true;
+}
+
+/* Allocates and initializes a page at UPAGE, not yet resident,
+   or returns a null pointer if memory is not available. */
+static struct page *
+new_page (void *upage, bool writable) 
+{
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  p = kmem_cache_alloc (page_cache);
+  if (p != NULL)
+    {
+      p->region = NULL;
+      p->upage = upage;
+      p->owner = process_current ();
+      p->writable = writable;
+      p->mapped = false;
+      p->zero = false;
+      p->evicted = false;
+      p->cow = false;
+      p->sequential = false;
+      p->large = false;
+      lock_init_named (&p->lock, "page");
+      p->frame = NULL;
+      p->swap_slot = SWAP_ERROR;
+      p->file = NULL;
+      p->file_ofs = 0;
+      p->read_bytes = 0;
+      p->shm = NULL;
+      p->shm_idx = 0;
+    }
+  return p;
+}
+
+/* Adds a page at user virtual address UPAGE to the running
+   process's page table, writable if WRITABLE is true, whose
+   contents are the READ_BYTES bytes at offset OFS in FILE
+   followed by zeros.  The page is read in when it is first
+   accessed, so FILE must stay open, and unchanged, as long as
+   the page exists.  FILE may be null if READ_BYTES is 0.
+   Returns true if successful, false if UPAGE is already in the
+   table or if memory is not available. */
+bool
+page_add_file (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes, bool writable) 
+{
+  struct page *p;
+
+  ASSERT (read_bytes <= PGSIZE);
+  ASSERT (file != NULL || read_bytes == 0);
+
+  p = new_page (upage, writable);
+  if (p == NULL)
+    return false;
+  p->file = read_bytes > 0 ? file : NULL;
+  p->file_ofs = ofs;
+  p->read_bytes = read_bytes;
+  if (!add_page (p))
+    {
+      kmem_cache_free (page_cache, p);
+      return false;
+    }
+  return true;
+}
+
+/* Adds a region of PAGE_CNT pages starting at user virtual
+   address UPAGE to the running process's address space, writable
+   if WRITABLE is true, whose contents are the LENGTH bytes at
+   offset OFS in FILE followed by zeros.  If MAPPED is true, the
+   pages map FILE: their modified data is written back to its
+   first LENGTH bytes, and they are not copied into a forked
+   child.  Each page is entered in the page table, and read in,
+   only when it is first needed, so FILE must stay open, and
+   unchanged unless MAPPED is true, as long as the region exists.
+   FILE may be null if LENGTH is 0.  Returns true if successful,
+   false if any page in the range is already in use or if memory
+   is not available. */
+bool
+page_add_region (void *upage, size_t page_cnt, struct file *file,
+                 off_t ofs, off_t length, bool writable, bool mapped) 
+{
+  struct region *r;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (file != NULL || length == 0);
+  ASSERT ((size_t) length <= page_cnt * PGSIZE);
+
+  if (page_cnt == 0)
+    return true;
+  if (!is_user_vaddr ((uint8_t *) upage + page_cnt * PGSIZE - 1)
+      || range_in_use (upage, page_cnt))
+    return false;
+
+  r = malloc (sizeof *r);
+  if (r == NULL)
+    return false;
+  r->start = upage;
+  r->page_cnt = page_cnt;
+  r->file = file;
+  r->ofs = ofs;
+  r->length = length;
+  r->writable = writable;
+  r->mapped = mapped;
+  list_init (&r->pages);
+  rb_insert (&process_current ()->regions, &r->elem);
+  return true;
+}
+
+/* Removes the running process's region that starts at UPAGE,
+   added with page_add_region(), and those of its pages that are
+   in the page table, in address order, writing back modified
+   memory-mapped pages.  Takes time in proportion to the number
+   of such pages, not to the size of the region.  Does nothing
+   if there is no such region. */
+void
+page_remove_region (void *upage) 
+{
+  struct thread *t = process_current ();
+  struct region *r = find_region (t, upage);
+
+  if (r == NULL || r->start != upage)
+    return;
+  list_sort (&r->pages, region_page_less, NULL);
+  while (!list_empty (&r->pages))
+    {
+      struct page *p = list_entry (list_front (&r->pages), struct page,
+                                   region_elem);
+      hash_delete (t->pages, &p->hash_elem);
+      destroy_page (&p->hash_elem, NULL);
+    }
+  rb_remove (&t->regions, &r->elem);
+  free (r);
+}
+
+/* Reads in and maps the running process's PAGE_CNT pages
+   starting at UPAGE, which must be the start of a region, as far
+   as free frames allow, for a region that will be read in full.
+   Pages already in the page table are left alone.  The region's
+   file data is first requested from the buffer cache's
+   read-ahead thread all at once, so that it is read in large
+   requests, then each page is copied from the cache and the
+   pages are mapped POPULATE_BATCH at a time, with one walk of
+   the page table for each batch.  Stops early rather than evict
+   another page. */
+void
+page_populate (void *upage, size_t page_cnt) 
+{
+  struct thread *t = process_current ();
+  struct region *r = find_region (t, upage);
+  uint8_t *start = upage;
+  uint8_t *end = start + page_cnt * PGSIZE;
+  bool more = true;
+
+  ASSERT (r != NULL && r->start == upage);
+  ASSERT (page_cnt <= r->page_cnt);
+
+  if (r->file != NULL && r->length > 0)
+    inode_readahead (file_get_inode (r->file), r->ofs, r->length);
+  while (more && start < end) 
+    {
+      struct page *pages[POPULATE_BATCH];
+      void *kpages[POPULATE_BATCH];
+      size_t cnt = 0;
+      size_t i;
+
+      /* Give a run of untouched pages pinned frames holding their
+         data. */
+      while (cnt < POPULATE_BATCH && start + cnt * PGSIZE < end) 
+        {
+          uint8_t *u = start + cnt * PGSIZE;
+          struct page *p;
+          struct frame *f;
+
+          if (page_lookup (u) != NULL)
+            break;
+          p = page_get (u);
+          f = p != NULL ? frame_try_alloc (0, p) : NULL;
+          if (f == NULL)
+            {
+              more = false;
+              break;
+            }
+          if (!read_in (p, f->kpage))
+            {
+              frame_free (f);
+              more = false;
+              break;
+            }
+          p->frame = f;
+          pages[cnt] = p;
+          kpages[cnt] = f->kpage;
+          cnt++;
+        }
+
+      if (cnt > 0 && !pagedir_map_range (t->pagedir, start, kpages, cnt,
+                                         r->writable))
+        {
+          for (i = 0; i < cnt; i++)
+            {
+              frame_free (pages[i]->frame);
+              pages[i]->frame = NULL;
+            }
+          break;
+        }
+      for (i = 0; i < cnt; i++)
+        frame_unpin (pages[i]->frame);
+      start += (cnt > 0 ? cnt : 1) * PGSIZE;
+    }
+}
+
+/* Adds a writable page at user virtual address UPAGE to the
+   running process's page table that maps page IDX of
+   shared-memory segment SHM, and takes a reference to SHM for
+   it.  The page gets the segment's frame when it is first
+   accessed.  Returns true if successful, false if UPAGE is
+   already in the table or if memory is not available. */
+bool
+page_add_shm (void *upage, struct shm *shm, size_t idx) 
+{
+  struct page *p;
+
+  p = new_page (upage, true);
+  if (p == NULL)
+    return false;
+  p->shm = shm;
+  p->shm_idx = idx;
+  if (!add_page (p))
+    {
+      kmem_cache_free (page_cache, p);
+      return false;
+    }
+  shm_ref (shm);
+  return true;
+}
+
+/* Returns the shared-memory segment that the running process's
+   page containing ADDR maps, and stores ADDR's offset within the
+   segment in *OFS, or returns a null pointer if there is no such
+   page. */
+struct shm *
+page_get_shm (const void *addr, size_t *ofs) 
+{
+  struct page *p;
+
+  if (process_current ()->pages == NULL)
+    return NULL;
+  p = page_lookup (pg_round_down (addr));
+  if (p == NULL || p->shm == NULL)
+    return NULL;
+  *ofs = p->shm_idx * PGSIZE + pg_ofs (addr);
+  return p->shm;
+}
+
+/* Returns the highest user virtual address at which PAGE_CNT
+   pages are all free in the running process's address space,
+   between the end of the heap and the span reserved for the
+   stack, or a null pointer if there is no such address.  The
+   heap cannot grow past pages added there later. */
+void *
+page_find_gap (size_t page_cnt) 
+{
+  struct thread *t = process_current ();
+  uint8_t *bottom = t->heap_end != NULL ? pg_round_up (t->heap_end)
+                                        : (uint8_t *) PGSIZE;
+  uint8_t *top = pg_round_down ((uint8_t *) PHYS_BASE - page_stack_limit);
+  size_t size = page_cnt * PGSIZE;
+
+  /* Slide the candidate span down below the highest page in use
+     within it, until a span has none. */
+  while (top > bottom && (size_t) (top - bottom) >= size)
+    {
+      uint8_t *upage;
+
+      for (upage = top; upage > top - size; upage -= PGSIZE)
+        if (in_use (upage - PGSIZE))
+          break;
+      if (upage == top - size)
+        return top - size;
+      top = upage - PGSIZE;
+    }
+  return NULL;
+}
+
+/* Removes the running process's page at UPAGE from its page
+   table and its address space, writing it back first if it is a
+   modified memory-mapped page.  Does nothing if there is no page
+   at UPAGE. */
+void
+page_remove (void *upage) 
+{
+  struct page *p = page_lookup (upage);
+
+  if (p != NULL)
+    {
+      hash_delete (process_current ()->pages, &p->hash_elem);
+      destroy_page (&p->hash_elem, NULL);
+    }
+}
+
+/* Removes the running process's PAGE_CNT pages starting at
+   UPAGE, as page_remove() does for each of them, but unmaps them
+   all from its page directory at once first, so that the TLB is
+   flushed only once.  Addresses without a page are skipped. */
+void
+page_remove_range (void *upage, size_t page_cnt) 
+{
+  size_t i;
+
+  pagedir_clear_range (process_current ()->pagedir, upage, page_cnt);
+  for (i = 0; i < page_cnt; i++)
+    page_remove ((uint8_t *) upage + i * PGSIZE);
+}
+
+/* Adds a page at user virtual address UPAGE to the running
+   process's page table, writable if WRITABLE is true, and gives
+   it a frame obtained with FLAGS as for palloc_get_page().  The
+   frame is pinned and not yet mapped: the caller fills it in
+   through the returned kernel virtual address and then calls
+   page_install().  Returns a null pointer if UPAGE is already in
+   the table or if no frame or memory is available. */
+void *
+page_alloc (void *upage, bool writable, enum palloc_flags flags) 
+{
+  struct page *p;
+
+  p = new_page (upage, writable);
+  if (p == NULL)
+    return NULL;
+  p->frame = frame_alloc (flags, p);
+  if (p->frame == NULL)
+    {
+      kmem_cache_free (page_cache, p);
+      return NULL;
+    }
+  if (!add_page (p))
+    {
+      frame_free (p->frame);
+      kmem_cache_free (page_cache, p);
+      return NULL;
+    }
+  return p->frame->kpage;
+}
+
+/* Maps the page at UPAGE, obtained with page_alloc(), into the
+   running process's page directory, and unpins its frame.
+   Returns true if successful, false if memory allocation fails.
+   In the latter case the page stays in the table, to be freed
+   by page_table_destroy(). */
+bool
+page_install (void *upage) 
+{
+  struct thread *t = process_current ();
+  struct page *p = page_lookup (upage);
+
+  ASSERT (p != NULL && p->frame != NULL && p->frame->pin_cnt > 0);
+
+  if (pagedir_get_page (t->pagedir, upage) != NULL
+      || !pagedir_set_page (t->pagedir, upage, p->frame->kpage,
+                            p->writable))
+    return false;
+  frame_unpin (p->frame);
+  return true;
+}
+
+/* Brings the running process's page containing ADDR into
+   memory, after a page fault on it, caused by writing if WRITE
+   is true or by reading otherwise.  Returns true if successful,
+   false if ADDR is not in the process's address space, if WRITE
+   is true and the page is read-only, or if no frame can be
+   obtained or the page cannot be read. */
+bool
+page_fault_in (const void *addr, bool write) 
+{
+  struct thread *t = process_current ();
+  struct page *p;
+  struct frame *f;
+  struct page *around[FAULT_AROUND];
+  size_t around_cnt = 0;
+  bool success = false;
+  bool major = false;
+
+  if (t->pages == NULL)
+    return false;
+  p = page_get (pg_round_down (addr));
+  if (p == NULL || (write && !p->writable))
+    return false;
+  if (write && p->frame == NULL && !p->large && !p->mapped && is_zero (p)
+      && make_large ((uint8_t *) ((uintptr_t) addr & ~(PTSPAN - 1))))
+    {
+      stats_inc (&t->minor_faults);
+      return true;
+    }
+
+  lock_acquire (&p->lock);
+  if (p->frame == NULL && p->file != NULL && p->swap_slot == SWAP_ERROR)
+    around_cnt = find_around (p, around);
+  if (p->frame != NULL && p->cow && write)
+    {
+      /* Writing a copy-on-write page. */
+      success = break_cow (p);
+    }
+  else if (p->frame != NULL || p->large || (p->zero && !write))
+    {
+      /* Already back in memory. */
+      success = true;
+    }
+  else if (is_zero (p) && !write)
+    {
+      /* Reading a page of zeros.  Map the zero page. */
+      if (pagedir_set_page (t->pagedir, p->upage, zero_page, false))
+        {
+          p->zero = true;
+          success = true;
+        }
+    }
+  else if (p->shm != NULL)
+    {
+      /* The segment has the data, in memory or in swap. */
+      f = shm_get_frame (p);
+      if (f != NULL)
+        {
+          if (pagedir_set_page (t->pagedir, p->upage, f->kpage, true))
+            {
+              p->frame = f;
+              success = true;
+            }
+          else
+            shm_put_frame (p);
+          frame_unpin (f);
+        }
+    }
+  else if (is_shared (p))
+    {
+      /* Only a frame that is not yet shared needs reading. */
+      f = share_get_cached (p->file, p->file_ofs, p->read_bytes);
+      if (f == NULL) 
+        {
+          f = share_get (p->file, p->file_ofs, p->read_bytes);
+          major = true;
+        }
+      if (f != NULL)
+        {
+          if (pagedir_set_page (t->pagedir, p->upage, f->kpage, false))
+            {
+              p->frame = f;
+              success = true;
+            }
+          else
+            share_put (p->file, p->file_ofs, p->read_bytes);
+        }
+    }
+  else
+    {
+      /* Writing a page that was mapped to the zero page needs a
+         private copy. */
+      if (p->zero)
+        {
+          pagedir_clear_page (t->pagedir, p->upage);
+          p->zero = false;
+        }
+
+      major = p->swap_slot != SWAP_ERROR || p->file != NULL;
+      f = frame_alloc (0, p);
+      if (f != NULL)
+        {
+          if ((p->swap_slot != SWAP_ERROR
+               ? swap_in_around (p, f->kpage)
+               : read_in (p, f->kpage))
+              && pagedir_set_page (t->pagedir, p->upage, f->kpage,
+                                   p->writable))
+            {
+              p->frame = f;
+              p->cow = false;
+              frame_unpin (f);
+              success = true;
+            }
+          else
+            frame_free (f);
+        }
+    }
+  lock_release (&p->lock);
+
+  if (success)
+    {
+      stats_inc (major ? &t->major_faults : &t->minor_faults);
+      map_around (around, around_cnt);
+    }
+  return success;
+}
+
+/* Returns true if P, a page of the running process, is a
+   candidate for mapping around a fault on page FAULTED. */
+static bool
+is_around (const struct page *p, const struct page *faulted) 
+{
+  return (p->frame == NULL && !p->zero
+          && p->swap_slot == SWAP_ERROR
+          && p->file == faulted->file
+          && p->mapped == faulted->mapped);
+}
+
+/* Stores into AROUND the pages of P's fault-around group, other
+   than P, that are candidates for mapping along with P, which
+   must come from a file, and returns their number.  Queues
+   read-ahead for their data, together with P's. */
+static size_t
+find_around (struct page *p, struct page **around) 
+{
+  uint8_t *first = (uint8_t *) ((uintptr_t) p->upage
+                                & ~(uintptr_t) (FAULT_AROUND * PGSIZE - 1));
+  off_t start = p->file_ofs;
+  off_t end = p->file_ofs + p->read_bytes;
+  size_t cnt = 0;
+  size_t i;
+
+  for (i = 0; i < FAULT_AROUND; i++) 
+    {
+      uint8_t *upage = first + i * PGSIZE;
+      struct page *q = page_lookup (upage);
+
+      /* Enter untouched pages of P's region in the table. */
+      if (q == NULL && p->region != NULL && upage >= p->region->start
+          && upage < p->region->start + p->region->page_cnt * PGSIZE)
+        q = page_get (upage);
+      if (q == NULL || q == p || !is_around (q, p))
+        continue;
+      around[cnt++] = q;
+      if (q->file_ofs < start)
+        start = q->file_ofs;
+      if (q->file_ofs + (off_t) q->read_bytes > end)
+        end = q->file_ofs + q->read_bytes;
+    }
+  if (cnt > 0)
+    inode_readahead (file_get_inode (p->file), start, end - start);
+  return cnt;
+}
+
+/* Maps those of the CNT pages in AROUND, found by find_around(),
+   that can be mapped without waiting for another thread or
+   evicting a page. */
+static void
+map_around (struct page **around, size_t cnt) 
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++) 
+    {
+      struct page *q = around[i];
+      uint32_t *pd = q->owner->pagedir;
+      struct frame *f;
+
+      if (!page_try_lock (q))
+        continue;
+      if (q->frame == NULL && !q->zero && q->swap_slot == SWAP_ERROR)
+        {
+          if (is_shared (q))
+            {
+              f = share_get_cached (q->file, q->file_ofs, q->read_bytes);
+              if (f != NULL)
+                {
+                  if (pagedir_set_page (pd, q->upage, f->kpage, false))
+                    q->frame = f;
+                  else
+                    share_put (q->file, q->file_ofs, q->read_bytes);
+                }
+            }
+          else
+            {
+              f = frame_try_alloc (0, q);
+              if (f != NULL)
+                {
+                  if (read_in (q, f->kpage)
+                      && pagedir_set_page (pd, q->upage, f->kpage,
+                                           q->writable))
+                    {
+                      q->frame = f;
+                      q->cow = false;
+                      frame_unpin (f);
+                    }
+                  else
+                    frame_free (f);
+                }
+            }
+        }
+      lock_release (&q->lock);
+    }
+}
+
+/* Reads P, a page of the running process that must be locked
+   and in swap, into the frame at KPAGE, together with those of
+   the other pages of its fault-around group that are in swap
+   within SWAP_CLUSTER slots of it and can be had without waiting
+   for another thread or evicting a page, and maps the latter.
+   Returns true. */
+static bool
+swap_in_around (struct page *p, void *kpage) 
+{
+  uint8_t *first = (uint8_t *) ((uintptr_t) p->upage
+                                & ~(uintptr_t) (FAULT_AROUND * PGSIZE - 1));
+  uint32_t *pd = p->owner->pagedir;
+  struct page *around[FAULT_AROUND];
+  size_t slots[FAULT_AROUND];
+  void *kpages[FAULT_AROUND];
+  size_t lo = p->swap_slot, hi = p->swap_slot;
+  size_t cnt = 1;
+  size_t i;
+
+  slots[0] = p->swap_slot;
+  kpages[0] = kpage;
+  for (i = 0; i < FAULT_AROUND; i++) 
+    {
+      struct page *q = page_lookup (first + i * PGSIZE);
+      struct frame *f;
+      size_t slot;
+
+      if (q == NULL || q == p || q->frame != NULL
+          || q->swap_slot == SWAP_ERROR)
+        continue;
+      slot = q->swap_slot;
+      if ((slot < lo ? hi - slot : slot > hi ? slot - lo : 0)
+          >= SWAP_CLUSTER)
+        continue;
+      if (!page_try_lock (q))
+        continue;
+      if (q->frame != NULL)
+        {
+          lock_release (&q->lock);
+          continue;
+        }
+      f = frame_try_alloc (0, NULL);
+      if (f == NULL)
+        {
+          lock_release (&q->lock);
+          break;
+        }
+      frame_add_page (f, q);
+      q->frame = f;
+      if (slot < lo)
+        lo = slot;
+      if (slot > hi)
+        hi = slot;
+      around[cnt] = q;
+      slots[cnt] = slot;
+      kpages[cnt] = f->kpage;
+      cnt++;
+    }
+
+  swap_read_cluster (slots, kpages, cnt);
+  stats_add (&p->owner->swap_ins, cnt);
+
+  /* The neighbours were not asked for, so they do not count as
+     refaults. */
+  for (i = 1; i < cnt; i++) 
+    {
+      struct page *q = around[i];
+      struct frame *f = q->frame;
+
+      if (pagedir_set_page (pd, q->upage, f->kpage, q->writable))
+        {
+          q->cow = false;
+          q->evicted = false;
+          frame_unpin (f);
+        }
+      else
+        {
+          q->frame = NULL;
+          frame_release (f, q);
+        }
+      lock_release (&q->lock);
+    }
+  return true;
+}
+
+/* Grows the running process's stack to cover ADDR, after a page
+   fault on it, caused by writing if WRITE is true or by reading
+   otherwise, while the process's stack pointer was ESP, and
+   brings the page containing ADDR into memory.  Returns true if
+   successful, false if ADDR does not look like a stack access,
+   if it is beyond page_stack_limit, or if memory is not
+   available. */
+bool
+page_grow_stack (const void *addr, const void *esp, bool write) 
+{
+  struct thread *t = process_current ();
+  uint8_t *upage = pg_round_down (addr);
+  uint8_t *limit = (uint8_t *) PHYS_BASE - page_stack_limit;
+  void *kpages[STACK_RUN_MAX];
+  uint8_t *bottom;
+  size_t run;
+  size_t i;
+
+  if (t->pages == NULL || esp == NULL
+      || (uint8_t *) addr + STACK_SLOP < (const uint8_t *) esp
+      || (uint8_t *) addr < limit
+      || !is_user_vaddr (addr)
+      || in_use (upage))
+    return false;
+
+  /* Double the run if this fault continues the last growth. */
+  if (upage + PGSIZE == t->stack_bottom && t->stack_run < STACK_RUN_MAX)
+    run = t->stack_run * 2;
+  else if (upage + PGSIZE == t->stack_bottom)
+    run = STACK_RUN_MAX;
+  else
+    run = 1;
+
+  /* The faulting page, then resident zeroed pages below it, up to
+     the limit or an existing page.  Their frames go into KPAGES
+     from the end backward, so that they end up in address order,
+     and are mapped with one walk of the page table. */
+  if (!page_add_file (upage, NULL, 0, 0, true))
+    return false;
+  bottom = upage;
+  for (i = 1; i < run; i++) 
+    {
+      uint8_t *below = upage - i * PGSIZE;
+
+      if (below < limit || in_use (below))
+        break;
+      kpages[STACK_RUN_MAX - i] = page_alloc (below, true, PAL_ZERO);
+      if (kpages[STACK_RUN_MAX - i] == NULL)
+        break;
+      bottom = below;
+    }
+  if (bottom < upage)
+    {
+      size_t cnt = (upage - bottom) / PGSIZE;
+
+      if (pagedir_map_range (t->pagedir, bottom, kpages + STACK_RUN_MAX - cnt,
+                             cnt, true))
+        for (i = 0; i < cnt; i++)
+          frame_unpin (page_lookup (bottom + i * PGSIZE)->frame);
+      else
+        {
+          page_remove_range (bottom, cnt);
+          bottom = upage;
+        }
+    }
+  if (bottom < (uint8_t *) t->stack_bottom)
+    t->stack_bottom = bottom;
+  t->stack_run = run;
+
+  return page_fault_in (addr, write);
+}
+
+/* Brings the running process's page containing ADDR into
+   memory, as a fault on ADDR would, for writing if WRITE is
+   true, and pins its frame until page_unpin() is passed the
+   address returned.  If WRITE is
+   true, marks the page dirty, since the caller will write it
+   through its frame.  Returns the kernel virtual address that
+   ADDR maps to, or a null pointer if the page cannot be had, as
+   when ADDR is not in the process's address space or WRITE is
+   true and the page is read-only. */
+void *
+page_pin (const void *addr, bool write) 
+{
+  struct thread *t = process_current ();
+  struct page *p;
+
+  if (t->pages == NULL)
+    return NULL;
+  for (;;)
+    {
+      /* Holding P's lock keeps it from being evicted while its
+         frame is pinned. */
+      p = page_lookup (pg_round_down (addr));
+      if (p != NULL && p->large)
+        {
+          /* A large page is resident as long as it is not
+             split. */
+          struct large_page *lp = find_large (p->upage);
+
+          lp->pin_cnt++;
+          return (uint8_t *) lp->kpage + ((uintptr_t) addr & (PTSPAN - 1));
+        }
+      if (p != NULL)
+        {
+          lock_acquire (&p->lock);
+          if (p->frame != NULL && (!write || (p->writable && !p->cow)))
+            break;
+          lock_release (&p->lock);
+        }
+      if (!page_fault_in (addr, write)
+          && !page_grow_stack (addr, thread_current ()->user_esp, write))
+        return NULL;
+    }
+
+  frame_pin (p->frame);
+  pagedir_set_accessed (t->pagedir, p->upage, true);
+  if (write)
+    pagedir_set_dirty (t->pagedir, p->upage, true);
+  lock_release (&p->lock);
+  return (uint8_t *) p->frame->kpage + pg_ofs (addr);
+}
+
+/* Drops the pin that page_pin() took on the memory at KADDR, the
+   address it returned.  Another thread of the process may have
+   unmapped the page since, but its frame stays allocated while
+   it is pinned, so the pin is found by KADDR rather than through
+   the page table.  A large page cannot be split or freed while
+   it is pinned, so it is still the running process's. */
+void
+page_unpin (const void *kaddr) 
+{
+  struct thread *t = process_current ();
+  struct frame *f = frame_lookup ((void *) kaddr);
+  struct list_elem *e;
+
+  if (f != NULL)
+    {
+      frame_unpin (f);
+      return;
+    }
+  for (e = list_begin (&t->large_pages); e != list_end (&t->large_pages);
+       e = list_next (e))
+    {
+      struct large_page *lp = list_entry (e, struct large_page, elem);
+
+      if ((const uint8_t *) kaddr >= (uint8_t *) lp->kpage
+          && (const uint8_t *) kaddr < (uint8_t *) lp->kpage + PTSPAN)
+        {
+          ASSERT (lp->pin_cnt > 0);
+          lp->pin_cnt--;
+          return;
+        }
+    }
+  NOT_REACHED ();
+}
+
+/* Starts the running process's heap, empty, at UPAGE, which
+   must be the first page above its executable's segments. */
+void
+page_heap_init (void *upage) 
+{
+  struct thread *t = process_current ();
+
+  ASSERT (pg_ofs (upage) == 0);
+
+  t->heap_start = t->heap_end = upage;
+}
+
+/* Moves the running process's break INCREMENT bytes up, or down
+   if INCREMENT is negative, adding zero pages to its page table
+   or removing pages from it as needed.  Returns the old break if
+   successful.  Returns a null pointer, and leaves the break
+   alone, if the process has no heap, if the break would go below
+   the start of the heap or into the space reserved for the
+   stack, if a page it needs is already in use, as by a
+   memory-mapped file, or if memory is not available, as for
+   splitting a large page that the new break falls within. */
+void *
+page_sbrk (intptr_t increment) 
+{
+  struct thread *t = process_current ();
+  uint8_t *start = t->heap_start;
+  uint8_t *old_end = t->heap_end;
+  uint8_t *limit = (uint8_t *) PHYS_BASE - page_stack_limit;
+  uint8_t *new_end = old_end + increment;
+  uint8_t *upage;
+
+  if (start == NULL
+      || (increment > 0 && (new_end < old_end || new_end > limit))
+      || (increment < 0 && (new_end > old_end || new_end < start)))
+    return NULL;
+
+  /* Add the pages between the old and the new break, backing
+     them all out if any of them cannot be added. */
+  for (upage = pg_round_up (old_end); upage < new_end; upage += PGSIZE)
+    if (!page_add_file (upage, NULL, 0, 0, true))
+      {
+        while (upage > (uint8_t *) pg_round_up (old_end))
+          {
+            upage -= PGSIZE;
+            page_remove (upage);
+          }
+        return NULL;
+      }
+
+  /* Remove the pages wholly above the new break, freeing or
+     splitting any large pages among them first. */
+  for (upage = pg_round_up (new_end); upage < old_end; upage += PGSIZE)
+    {
+      struct page *p = page_lookup (upage);
+
+      if (p != NULL && p->large
+          && !break_large (p, pg_round_up (new_end), old_end))
+        return NULL;
+    }
+  if (new_end < old_end)
+    page_remove_range (pg_round_up (new_end),
+                       ((uint8_t *) pg_round_up (old_end)
+                        - (uint8_t *) pg_round_up (new_end)) / PGSIZE);
+
+  t->heap_end = new_end;
+  t->large_miss = NULL;
+  return old_end;
+}
+
+/* Applies ADVICE to the running process's pages that hold any
+   of the SIZE bytes starting at user virtual address ADDR.
+   Addresses without a page are skipped.  Returns true if
+   successful, false if the range is not in user space, or if
+   MADV_DONTNEED applies to part of a large page and memory is
+   not available for splitting it. */
+bool
+page_advise (void *addr, size_t size, enum page_advice advice) 
+{
+  struct thread *t = process_current ();
+  uint8_t *start = pg_round_down (addr);
+  uint8_t *end = (uint8_t *) addr + size;
+  uint8_t *upage;
+  struct file *ra_file = NULL;
+  off_t ra_start = 0, ra_end = 0;
+
+  if (t->pages == NULL || end < (uint8_t *) addr
+      || (size > 0 && !is_user_vaddr (end - 1)))
+    return false;
+
+  for (upage = start; upage < end; upage += PGSIZE) 
+    {
+      struct page *p = page_lookup (upage);
+      struct region *r;
+      struct file *file;
+      off_t ofs;
+      size_t bytes;
+
+      if (p == NULL && (advice == MADV_NORMAL
+                        || advice == MADV_SEQUENTIAL))
+        p = page_get (upage);
+      if (p != NULL)
+        {
+          file = p->file;
+          ofs = p->file_ofs;
+          bytes = p->read_bytes;
+        }
+      else if (advice == MADV_WILLNEED
+               && (r = find_region (t, upage)) != NULL)
+        {
+          /* An untouched page of a region is not in memory. */
+          region_data (r, upage, &file, &ofs, &bytes);
+        }
+      else
+        continue;
+      switch (advice)
+        {
+        case MADV_NORMAL:
+        case MADV_SEQUENTIAL:
+          p->sequential = advice == MADV_SEQUENTIAL;
+          break;
+        case MADV_WILLNEED:
+          if (file == NULL
+              || (p != NULL && (p->frame != NULL || p->zero
+                                || p->swap_slot != SWAP_ERROR)))
+            break;
+
+          /* Gather file data that is next to the last page's
+             into one read-ahead request. */
+          if (file == ra_file && ofs == ra_end)
+            ra_end += bytes;
+          else
+            {
+              if (ra_file != NULL)
+                inode_readahead (file_get_inode (ra_file), ra_start,
+                                 ra_end - ra_start);
+              ra_file = file;
+              ra_start = ofs;
+              ra_end = ofs + bytes;
+            }
+          break;
+        case MADV_DONTNEED:
+          if (p->large && !break_large (p, (uint8_t *) addr, end))
+            return false;
+          drop (p);
+          break;
+        }
+    }
+  if (ra_file != NULL)
+    inode_readahead (file_get_inode (ra_file), ra_start,
+                     ra_end - ra_start);
+  return true;
+}
+
+/* Splits all of the running process's large pages into
+   ordinary pages in the frame table, which can be evicted, for
+   when no other frame can be.  Returns true if it split any. */
+bool
+page_split_large (void) 
+{
+  struct thread *t = process_current ();
+  struct list_elem *e, *next;
+  bool split = false;
+
+  if (t->pages == NULL)
+    return false;
+  page_table_lock ();
+  for (e = list_begin (&t->large_pages); e != list_end (&t->large_pages);
+       e = next)
+    {
+      next = list_next (e);
+      if (split_large (t, list_entry (e, struct large_page, elem)))
+        split = true;
+    }
+  page_table_unlock ();
+  return split;
+}
+
+/* Tries to lock P, for writing it out with page_out().  Returns
+   true if successful, false if P is busy.  Does not sleep, so it
+   may be called with the frame table locked. */
+bool
+page_try_lock (struct page *p) 
+{
+  return (!lock_held_by_current_thread (&p->lock)
+          && lock_try_acquire (&p->lock));
+}
+
+/* Unlocks P, locked with page_try_lock(). */
+void
+page_unlock (struct page *p) 
+{
+  lock_release (&p->lock);
+}
+
+/* Moves P, which must be resident and locked with
+   page_try_lock(), from OLD_KPAGE, where its frame was, to the
+   page that its frame has just been given, and maps it there
+   with its dirty and accessed bits as they were.  Unlocks P. */
+void
+page_move (struct page *p, const void *old_kpage) 
+{
+  uint32_t *pd = p->owner->pagedir;
+  bool dirty, accessed;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+  ASSERT (p->frame != NULL);
+
+  /* Unmap first, so that the owner faults and waits for the lock
+     rather than changing the page while it is copied.  The
+     dirty and accessed bits survive in the page table entry. */
+  pagedir_clear_page (pd, p->upage);
+  dirty = pagedir_is_dirty (pd, p->upage);
+  accessed = pagedir_is_accessed (pd, p->upage);
+  memcpy (p->frame->kpage, old_kpage, PGSIZE);
+  if (pagedir_set_page (pd, p->upage, p->frame->kpage,
+                        p->writable && !p->cow))
+    {
+      pagedir_set_dirty (pd, p->upage, dirty);
+      pagedir_set_accessed (pd, p->upage, accessed);
+    }
+  lock_release (&p->lock);
+}
+
+/* Maps P, which must be resident and locked with
+   page_try_lock(), read-only, so that its data cannot change
+   under the same-page merger while it compares it.  A writable P
+   becomes copy-on-write, so that writing it later faults and
+   gets it back, sharing or not. */
+void
+page_protect (struct page *p) 
+{
+  ASSERT (lock_held_by_current_thread (&p->lock));
+  ASSERT (p->frame != NULL);
+
+  if (p->writable && !p->cow)
+    {
+      p->cow = true;
+      pagedir_set_writable (p->owner->pagedir, p->upage, false);
+    }
+}
+
+/* Undoes page_protect() for P, which must be locked with
+   page_try_lock() and the only page that maps its frame. */
+void
+page_unprotect (struct page *p) 
+{
+  ASSERT (lock_held_by_current_thread (&p->lock));
+  ASSERT (p->frame != NULL);
+
+  if (p->cow)
+    {
+      p->cow = false;
+      pagedir_set_writable (p->owner->pagedir, p->upage, true);
+    }
+}
+
+/* Maps P, which must be locked with page_try_lock() and
+   protected with page_protect(), to frame F, which holds the same
+   data as P's frame, with its dirty and accessed bits as they
+   were.  The caller moves P from its old frame's list of pages to
+   F's. */
+void
+page_remap (struct page *p, struct frame *f) 
+{
+  uint32_t *pd = p->owner->pagedir;
+  bool dirty, accessed;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+  ASSERT (p->frame != NULL);
+
+  pagedir_clear_page (pd, p->upage);
+  dirty = pagedir_is_dirty (pd, p->upage);
+  accessed = pagedir_is_accessed (pd, p->upage);
+  p->frame = f;
+
+  /* The page table that held the old mapping still exists, so
+     this cannot fail. */
+  pagedir_set_page (pd, p->upage, f->kpage, false);
+  pagedir_set_dirty (pd, p->upage, dirty);
+  pagedir_set_accessed (pd, p->upage, accessed);
+}
+
+/* Unmaps P, which must be resident and locked with
+   page_try_lock(), writing it to swap if it has been modified,
+   and leaves its frame for the caller to reuse.  Unlocks P.
+   Returns true if successful, false if P needs a swap slot and
+   swap is full, in which case P stays resident. */
+bool
+page_out (struct page *p) 
+{
+  uint32_t *pd = p->owner->pagedir;
+  bool success = true;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+  ASSERT (p->frame != NULL);
+  ASSERT (!is_shared (p));
+
+  /* Unmap first, so that the owner faults and waits for the lock
+     rather than changing the page while it is written.  The
+     dirty bit survives in the page table entry. */
+  pagedir_clear_page (pd, p->upage);
+  if (p->shm != NULL)
+    {
+      if (!shm_page_out (p))
+        {
+          pagedir_set_page (pd, p->upage, p->frame->kpage, p->writable);
+          success = false;
+        }
+    }
+  else if (p->mapped)
+    write_back (p);
+  else if (pagedir_is_dirty (pd, p->upage))
+    {
+      /* A slot shared with a forked process still holds the
+         other process's data, so get one of our own. */
+      if (p->swap_slot != SWAP_ERROR
+          && !swap_is_exclusive (p->swap_slot))
+        {
+          swap_free (p->swap_slot);
+          p->swap_slot = SWAP_ERROR;
+        }
+      if (p->swap_slot == SWAP_ERROR)
+        p->swap_slot = swap_alloc_near (near_slot (p));
+      if (p->swap_slot != SWAP_ERROR)
+        {
+          swap_write (p->swap_slot, p->frame->kpage);
+          stats_inc (&p->owner->swap_outs);
+          p->owner->swap_upage = p->upage;
+          p->owner->swap_slot = p->swap_slot;
+        }
+      else
+        {
+          /* Nowhere to put it.  Map it again, still dirty. */
+          pagedir_set_page (pd, p->upage, p->frame->kpage,
+                            p->writable && !p->cow);
+          pagedir_set_dirty (pd, p->upage, true);
+          success = false;
+        }
+    }
+  if (success)
+    {
+      p->frame = NULL;
+      p->evicted = true;
+    }
+  lock_release (&p->lock);
+
+  return success;
+}
+
+/* Returns the swap slot next to the one that P's owner last
+   wrote a page to, on the side that keeps their order in swap
+   the same as in virtual memory, if that page is P's neighbour,
+   or SWAP_ERROR otherwise.  Owners' hints are updated by
+   whichever thread evicts their pages, without a lock, but a
+   stale hint only costs a slot out of place. */
+static size_t
+near_slot (const struct page *p) 
+{
+  const uint8_t *last = p->owner->swap_upage;
+  size_t slot = p->owner->swap_slot;
+
+  if (slot == SWAP_ERROR)
+    return SWAP_ERROR;
+  else if (last + PGSIZE == p->upage)
+    return slot + 1;
+  else if (last == (uint8_t *) p->upage + PGSIZE && slot > 0)
+    return slot - 1;
+  else
+    return SWAP_ERROR;
+}
+
+/* Gives the running process's copy-on-write page P, which must
+   be resident and locked, a writable mapping of a frame of its
+   own, copying the frame it shares if another page still maps
+   it.  Returns true if successful, false if no frame can be
+   obtained. */
+static bool
+break_cow (struct page *p) 
+{
+  uint32_t *pd = p->owner->pagedir;
+  struct frame *f;
+
+  if (!frame_claim (p->frame, p))
+    {
+      f = frame_alloc (0, NULL);
+      if (f == NULL)
+        return false;
+      copy_page (f->kpage, p->frame->kpage);
+      pagedir_clear_page (pd, p->upage);
+      frame_release (p->frame, p);
+      frame_add_page (f, p);
+      p->frame = f;
+
+      /* The page table that held the old mapping still exists, so
+         this cannot fail. */
+      pagedir_set_page (pd, p->upage, f->kpage, true);
+      pagedir_set_dirty (pd, p->upage, true);
+      frame_unpin (f);
+    }
+  else
+    pagedir_set_writable (pd, p->upage, true);
+  p->cow = false;
+  return true;
+}
+
+/* Reads P's data into the frame at KPAGE, from wherever it is
+   when P is not resident.  Returns true if successful, false if
+   the file could not be read. */
+static bool
+read_in (struct page *p, void *kpage) 
+{
+  if (p->swap_slot != SWAP_ERROR)
+    {
+      swap_read (p->swap_slot, kpage);
+      stats_inc (&p->owner->swap_ins);
+    }
+  else
+    {
+      if (p->file != NULL
+          && file_read_at (p->file, kpage, p->read_bytes, p->file_ofs)
+             != (off_t) p->read_bytes)
+        return false;
+      memset ((uint8_t *) kpage + p->read_bytes, 0,
+              PGSIZE - p->read_bytes);
+    }
+  return true;
+}
+
+/* Writes memory-mapped page P, which must be resident and
+   unmapped, back to its file if it was modified while mapped. */
+static void
+write_back (struct page *p) 
+{
+  uint32_t *pd = p->owner->pagedir;
+
+  ASSERT (p->mapped && p->frame != NULL);
+
+  if (pagedir_is_dirty (pd, p->upage))
+    {
+      file_write_at (p->file, p->frame->kpage, p->read_bytes, p->file_ofs);
+      pagedir_set_dirty (pd, p->upage, false);
+    }
+}
+
+/* Returns true if P's frame is shared with other processes that
+   map the same file data, that is, if P is read-only and read
+   from a file. */
+static bool
+is_shared (const struct page *p) 
+{
+  return !p->writable && p->file != NULL;
+}
+
+/* Returns true if P holds nothing but zeros while it is not
+   resident. */
+static bool
+is_zero (const struct page *p) 
+{
+  return p->file == NULL && p->swap_slot == SWAP_ERROR && p->shm == NULL;
+}
+
+/* Returns the running process's page at UPAGE, or a null pointer
+   if there is none. */
+static struct page *
+page_lookup (const void *upage) 
+{
+  return page_lookup_in (process_current (), upage);
+}
+
+/* Returns T's page at UPAGE, or a null pointer if there is
+   none. */
+static struct page *
+page_lookup_in (struct thread *t, const void *upage) 
+{
+  struct page key;
+  struct hash_elem *e;
+
+  key.upage = (void *) upage;
+  e = hash_find (t->pages, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct page, hash_elem) : NULL;
+}
+
+/* Returns the running process's page at UPAGE, entering it in
+   the page table first if it is an untouched page of a region.
+   Returns a null pointer if there is no page at UPAGE or if
+   memory is not available. */
+static struct page *
+page_get (const void *upage) 
+{
+  struct thread *t = process_current ();
+  struct page *p = page_lookup (upage);
+  struct region *r;
+
+  if (p != NULL)
+    return p;
+  r = find_region (t, upage);
+  if (r == NULL)
+    return NULL;
+  p = new_page ((void *) upage, r->writable);
+  if (p == NULL)
+    return NULL;
+  region_data (r, upage, &p->file, &p->file_ofs, &p->read_bytes);
+  p->mapped = r->mapped;
+  p->region = r;
+  list_push_back (&r->pages, &p->region_elem);
+  hash_insert (t->pages, &p->hash_elem);
+  return p;
+}
+
+/* Enters P, a new page of the running process, in its page
+   table.  Returns true if successful, false if its address is
+   already in use. */
+static bool
+add_page (struct page *p) 
+{
+  struct thread *t = process_current ();
+
+  return (find_region (t, p->upage) == NULL
+          && hash_insert (t->pages, &p->hash_elem) == NULL);
+}
+
+/* Returns true if any of the PAGE_CNT pages starting at UPAGE is
+   in use in the running process's address space, by a page in
+   the table or a region.  Probes the table page by page or walks
+   all of it, whichever is less work. */
+static bool
+range_in_use (const uint8_t *upage, size_t page_cnt) 
+{
+  struct thread *t = process_current ();
+  const uint8_t *end = upage + page_cnt * PGSIZE;
+  struct region key;
+  struct rb_elem *e;
+  size_t i;
+
+  /* Only the last region that starts before the range ends can
+     reach into it. */
+  key.start = (uint8_t *) end;
+  e = rb_lower_bound (&t->regions, &key.elem);
+  e = e != rb_end (&t->regions) ? rb_prev (e) : rb_last (&t->regions);
+  if (e != NULL)
+    {
+      struct region *r = rb_entry (e, struct region, elem);
+      if (r->start + r->page_cnt * PGSIZE > upage)
+        return true;
+    }
+
+  if (hash_size (t->pages) < page_cnt)
+    {
+      struct hash_iterator it;
+
+      hash_first (&it, t->pages);
+      while (hash_next (&it))
+        {
+          struct page *p = hash_entry (hash_cur (&it), struct page,
+                                       hash_elem);
+          if ((uint8_t *) p->upage >= upage && (uint8_t *) p->upage < end)
+            return true;
+        }
+      return false;
+    }
+  for (i = 0; i < page_cnt; i++)
+    if (page_lookup (upage + i * PGSIZE) != NULL)
+      return true;
+  return false;
+}
+
+/* Returns true if the running process has a page at UPAGE, in
+   its page table or in a region. */
+static bool
+in_use (const void *upage) 
+{
+  return (page_lookup (upage) != NULL
+          || find_region (process_current (), upage) != NULL);
+}
+
+/* Returns T's region that contains UPAGE, or a null pointer if
+   there is none. */
+static struct region *
+find_region (struct thread *t, const void *upage) 
+{
+  struct region key;
+  struct region *r;
+  struct rb_elem *e;
+
+  key.start = (uint8_t *) upage;
+  e = rb_upper_bound (&t->regions, &key.elem);
+  e = e != rb_end (&t->regions) ? rb_prev (e) : rb_last (&t->regions);
+  if (e == NULL)
+    return NULL;
+  r = rb_entry (e, struct region, elem);
+  return (const uint8_t *) upage < r->start + r->page_cnt * PGSIZE ? r : NULL;
+}
+
+/* Stores into *FILE, *OFS and *READ_BYTES where the data of
+   region R's page at UPAGE comes from, as in struct page. */
+static void
+region_data (const struct region *r, const void *upage,
+             struct file **file, off_t *ofs, size_t *read_bytes) 
+{
+  off_t page_ofs = (const uint8_t *) upage - r->start;
+  off_t left = r->length - page_ofs;
+
+  *read_bytes = left <= 0 ? 0 : left < PGSIZE ? (size_t) left : PGSIZE;
+  *file = *read_bytes > 0 ? r->file : NULL;
+  *ofs = r->ofs + page_ofs;
+}
+
+/* Frees page E, for hash_destroy(). */
+static void
+destroy_page (struct hash_elem *e, void *aux UNUSED) 
+{
+  struct page *p = hash_entry (e, struct page, hash_elem);
+
+  ASSERT (!p->large);
+
+  lock_acquire (&p->lock);
+  if (p->zero)
+    pagedir_clear_page (p->owner->pagedir, p->upage);
+  if (p->frame != NULL)
+    {
+      pagedir_clear_page (p->owner->pagedir, p->upage);
+      if (p->mapped)
+        write_back (p);
+      if (is_shared (p))
+        share_put (p->file, p->file_ofs, p->read_bytes);
+      else if (p->shm != NULL)
+        shm_put_frame (p);
+      else
+        frame_release (p->frame, p);
+    }
+  if (p->swap_slot != SWAP_ERROR)
+    swap_free (p->swap_slot);
+  lock_release (&p->lock);
+  if (p->shm != NULL)
+    shm_unref (p->shm);
+  if (p->region != NULL)
+    list_remove (&p->region_elem);
+  kmem_cache_free (page_cache, p);
+}
+
+/* Removes the running process's page P from memory and from
+   swap, writing it back first if it is a modified memory-mapped
+   page, so that its next access reads it in afresh from its
+   file, or as zeros.  A page that maps a shared-memory segment
+   is only unmapped, since the segment holds its data. */
+static void
+drop (struct page *p) 
+{
+  uint32_t *pd = p->owner->pagedir;
+
+  lock_acquire (&p->lock);
+  if (p->zero)
+    {
+      pagedir_clear_page (pd, p->upage);
+      p->zero = false;
+    }
+  if (p->frame != NULL)
+    {
+      pagedir_clear_page (pd, p->upage);
+      if (p->mapped)
+        write_back (p);
+      if (is_shared (p))
+        share_put (p->file, p->file_ofs, p->read_bytes);
+      else if (p->shm != NULL)
+        shm_put_frame (p);
+      else
+        frame_release (p->frame, p);
+      p->frame = NULL;
+      p->cow = false;
+    }
+  if (p->swap_slot != SWAP_ERROR)
+    {
+      swap_free (p->swap_slot);
+      p->swap_slot = SWAP_ERROR;
+    }
+  lock_release (&p->lock);
+}
+
+/* Gives the aligned span of LARGE_PAGES pages at UPAGE in the
+   running process's heap a zeroed large page, if the span lies
+   wholly within the heap and none of its pages has held data:
+   each is still all zeros, with no frame or swap slot.  Returns
+   true if successful, false if the span does not qualify or no
+   large page is free. */
+static bool
+make_large (uint8_t *upage) 
+{
+  struct thread *t = process_current ();
+  struct large_page *lp;
+  size_t i;
+
+  if (!page_large_pages || upage == t->large_miss
+      || upage < (uint8_t *) t->heap_start
+      || upage + PTSPAN > (uint8_t *) t->heap_end)
+    return false;
+
+  /* Remember a span that fails, so that faults on the rest of
+     its pages do not check it again. */
+  t->large_miss = upage;
+  for (i = 0; i < LARGE_PAGES; i++) 
+    {
+      struct page *p = page_lookup (upage + i * PGSIZE);
+
+      if (p == NULL || p->frame != NULL || p->large || p->mapped
+          || !is_zero (p))
+        return false;
+    }
+  lp = malloc (sizeof *lp);
+  if (lp == NULL)
+    return false;
+  lp->kpage = palloc_get_large (PAL_USER | PAL_ZERO);
+  if (lp->kpage == NULL)
+    {
+      free (lp);
+      return false;
+    }
+  lp->upage = upage;
+  lp->pin_cnt = 0;
+  t->large_miss = NULL;
+
+  /* Mapping the large page frees the page table that held the
+     span's mappings of the zero page. */
+  for (i = 0; i < LARGE_PAGES; i++) 
+    {
+      struct page *p = page_lookup (upage + i * PGSIZE);
+
+      p->zero = false;
+      p->evicted = false;
+      p->large = true;
+    }
+  pagedir_set_large (t->pagedir, upage, lp->kpage, true);
+  list_push_back (&t->large_pages, &lp->elem);
+  return true;
+}
+
+/* Splits large page LP of process T into ordinary pages, each
+   with a frame of its own in the frame table.  T must be the
+   running process, or the parent of the running process,
+   waiting for it to finish forking.  Returns true if
+   successful, false if LP is pinned or memory is not available,
+   in which case LP stays as it was. */
+static bool
+split_large (struct thread *t, struct large_page *lp) 
+{
+  size_t i;
+
+  if (lp->pin_cnt > 0)
+    return false;
+  for (i = 0; i < LARGE_PAGES; i++) 
+    {
+      struct page *p = page_lookup_in (t, lp->upage + i * PGSIZE);
+
+      p->frame = frame_adopt ((uint8_t *) lp->kpage + i * PGSIZE, p);
+      if (p->frame == NULL)
+        break;
+    }
+  if (i < LARGE_PAGES || !pagedir_split_large (t->pagedir, lp->upage))
+    {
+      while (i-- > 0) 
+        {
+          struct page *p = page_lookup_in (t, lp->upage + i * PGSIZE);
+
+          frame_disown (p->frame);
+          p->frame = NULL;
+        }
+      return false;
+    }
+
+  for (i = 0; i < LARGE_PAGES; i++) 
+    {
+      struct page *p = page_lookup_in (t, lp->upage + i * PGSIZE);
+
+      p->large = false;
+      frame_unpin (p->frame);
+    }
+  list_remove (&lp->elem);
+  free (lp);
+  return true;
+}
+
+/* Unmaps and frees process T's large page LP, whose pages
+   become zero pages again. */
+static void
+free_large (struct thread *t, struct large_page *lp) 
+{
+  size_t i;
+
+  ASSERT (lp->pin_cnt == 0);
+
+  pagedir_clear_large (t->pagedir, lp->upage);
+  palloc_free_multiple (lp->kpage, LARGE_PAGES);
+  for (i = 0; i < LARGE_PAGES; i++) 
+    page_lookup_in (t, lp->upage + i * PGSIZE)->large = false;
+  list_remove (&lp->elem);
+  free (lp);
+}
+
+/* Makes the running process's page P, part of a large page, an
+   ordinary page whose data is about to be discarded, along with
+   that of the process's other pages from START up to END.  The
+   large page is simply freed if it lies wholly within that
+   range, and split otherwise.  Returns true if successful,
+   false if splitting fails. */
+static bool
+break_large (struct page *p, const uint8_t *start, const uint8_t *end) 
+{
+  struct large_page *lp = find_large (p->upage);
+
+  if (lp->upage >= start && lp->upage + PTSPAN <= end && lp->pin_cnt == 0)
+    {
+      free_large (process_current (), lp);
+      return true;
+    }
+  return split_large (process_current (), lp);
+}
+
+/* Returns the running process's large page that maps UPAGE,
+   which must be part of one. */
+static struct large_page *
+find_large (const void *upage) 
+{
+  struct thread *t = process_current ();
+  uint8_t *base = (uint8_t *) ((uintptr_t) upage & ~(PTSPAN - 1));
+  struct list_elem *e;
+
+  for (e = list_begin (&t->large_pages); e != list_end (&t->large_pages);
+       e = list_next (e))
+    {
+      struct large_page *lp = list_entry (e, struct large_page, elem);
+
+      if (lp->upage == base)
+        return lp;
+    }
+  NOT_REACHED ();
+}
+
+/* Returns a hash value for page E. */
+static unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED) 
+{
+  const struct page *p = hash_entry (e, struct page, hash_elem);
+  return hash_bytes (&p->upage, sizeof p->upage);
+}
+
+/* Returns true if page A precedes page B. */
+static bool
+page_less (const struct hash_elem *a, const struct hash_elem *b,
+           void *aux UNUSED) 
+{
+  const struct page *pa = hash_entry (a, struct page, hash_elem);
+  const struct page *pb = hash_entry (b, struct page, hash_elem);
+  return pa->upage < pb->upage;
+}
+
+/* Returns true if region A starts below region B. */
+static bool
+region_less (const struct rb_elem *a, const struct rb_elem *b,
+             void *aux UNUSED) 
+{
+  return (rb_entry (a, struct region, elem)->start
+          < rb_entry (b, struct region, elem)->start);
+}
+
+/* Returns true if page A, on a region's list, is below page B. */
+static bool
+region_page_less (const struct list_elem *a, const struct list_elem *b,
+                  void *aux UNUSED) 
+{
+  return (list_entry (a, struct page, region_elem)->upage
+          < list_entry (b, struct page, region_elem)->upage);
+}
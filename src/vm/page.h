@@ -0,0 +1,108 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+
+struct region;
+
+/* A page of a process's address space, as recorded in the
+   process's supplemental page table. */
+struct page
+  {
+    struct hash_elem hash_elem;     /* Element in owner's page table. */
+    struct list_elem frame_elem;    /* Element in FRAME's page list. */
+    struct region *region;          /* Region it was created for, or
+                                       null. */
+    struct list_elem region_elem;   /* Element in REGION's pages. */
+    void *upage;                    /* User virtual address. */
+    struct thread *owner;           /* Process the page belongs to. */
+    bool writable;                  /* Mapped read/write? */
+    bool mapped;                    /* Memory-mapped: FILE, not swap,
+                                       holds modified data? */
+    bool zero;                      /* Mapped to the zero page? */
+    bool evicted;                   /* Evicted since last resident? */
+    bool cow;                       /* Mapped read-only, sharing FRAME
+                                       with a forked process or a
+                                       merged page, until written? */
+    bool sequential;                /* Evict soon after use? */
+    bool large;                     /* Part of a large page? */
+    struct lock lock;               /* Held while paging in or out. */
+
+    /* Where the page's data is.  If the page is resident, it is
+       in FRAME.  Otherwise, if it has a swap slot, it is there;
+       otherwise it is READ_BYTES bytes at FILE_OFS in FILE,
+       followed by zeros (all zeros if READ_BYTES is 0).  A
+       memory-mapped page never has a swap slot.  A page that maps
+       a shared-memory segment has neither swap slot nor file: its
+       data is wherever the segment, SHM, keeps its page SHM_IDX. */
+    struct frame *frame;            /* Frame, or null. */
+    size_t swap_slot;               /* Swap slot, or SWAP_ERROR. */
+    struct file *file;              /* File, or null. */
+    off_t file_ofs;                 /* Offset in FILE. */
+    size_t read_bytes;              /* Bytes to read from FILE. */
+    struct shm *shm;                /* Shared-memory segment, or null. */
+    size_t shm_idx;                 /* Page's index in SHM. */
+  };
+
+/* Advice for page_advise().  Matches `enum madvise_advice' in
+   lib/user/syscall.h. */
+enum page_advice
+  {
+    MADV_NORMAL,                /* No particular pattern. */
+    MADV_SEQUENTIAL,            /* Used once, from start to end. */
+    MADV_WILLNEED,              /* Range will be used soon. */
+    MADV_DONTNEED               /* Range will not be used again soon. */
+  };
+
+/* -stack: Maximum size of a process's stack, in bytes. */
+extern size_t page_stack_limit;
+
+/* -large-pages: Back aligned 4 MB spans of the heap with large
+   pages? */
+extern bool page_large_pages;
+
+void page_init (void);
+bool page_table_init (void);
+void page_table_destroy (struct thread *);
+void page_count (size_t *resident, size_t *mapped);
+bool page_table_clone (struct thread *parent);
+void page_table_lock (void);
+void page_table_unlock (void);
+
+bool page_add_file (void *upage, struct file *, off_t,
+                    size_t read_bytes, bool writable);
+bool page_add_region (void *upage, size_t page_cnt, struct file *,
+                      off_t ofs, off_t length, bool writable, bool mapped);
+void page_remove_region (void *upage);
+void page_populate (void *upage, size_t page_cnt);
+bool page_add_shm (void *upage, struct shm *, size_t idx);
+struct shm *page_get_shm (const void *addr, size_t *ofs);
+void *page_find_gap (size_t page_cnt);
+void page_remove (void *upage);
+void page_remove_range (void *upage, size_t page_cnt);
+void *page_alloc (void *upage, bool writable, enum palloc_flags);
+bool page_install (void *upage);
+bool page_fault_in (const void *addr, bool write);
+bool page_grow_stack (const void *addr, const void *esp, bool write);
+void *page_pin (const void *addr, bool write);
+void page_unpin (const void *kaddr);
+void page_heap_init (void *upage);
+void *page_sbrk (intptr_t increment);
+bool page_advise (void *addr, size_t size, enum page_advice);
+bool page_split_large (void);
+
+bool page_try_lock (struct page *);
+bool page_out (struct page *);
+void page_unlock (struct page *);
+void page_move (struct page *, const void *old_kpage);
+void page_protect (struct page *);
+void page_unprotect (struct page *);
+void page_remap (struct page *, struct frame *);
+
+#endif /* vm/page.h */
@@ -0,0 +1,236 @@
+#include "vm/share.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/kmem.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+
+/* Shared read-only file pages.
+
+   Processes running the same executable map the same frames for
+   its read-only pages, instead of each reading its own copy.  A
+   shared page is identified by the inode of the file it comes
+   from, its offset in the file, and the number of bytes read
+   from there (the rest of the page being zeros).  A table of
+   shared pages maps each one to its frame and counts the
+   processes that map it.
+
+   A shared frame stays pinned, and is never evicted, while any
+   process maps it.  When the last process unmaps it, normally
+   because it exits, the frame goes back to the user pool.  Each
+   process keeps the executable open and denies writes to it
+   while it runs, so a shared page's contents cannot go stale,
+   and its inode pointer stays valid as its identity. */
+
+/* A shared page. */
+struct shared_page
+  {
+    struct hash_elem elem;          /* Element in shared_pages. */
+    struct inode *inode;            /* File's inode. */
+    off_t ofs;                      /* Offset in file. */
+    size_t read_bytes;              /* Bytes read from the file. */
+    int ref_cnt;                    /* Number of mappings. */
+    struct lock load_lock;          /* Held while reading in. */
+    struct frame *frame;            /* Frame, or null until read. */
+  };
+
+static struct hash shared_pages;        /* All shared pages. */
+static struct lock share_lock;          /* Protects shared_pages and
+                                           ref_cnt members. */
+static struct kmem_cache *share_cache;  /* Allocates shared pages. */
+
+/* Statistics. */
+static long long hit_cnt;               /* Mappings of a loaded page. */
+static long long load_cnt;              /* Pages read in. */
+
+static hash_hash_func shared_page_hash;
+static hash_less_func shared_page_less;
+static struct shared_page *lookup (struct inode *, off_t,
+                                   size_t read_bytes);
+
+/* Initializes the shared page table. */
+void
+share_init (void) 
+{
+  if (!hash_init (&shared_pages, shared_page_hash, shared_page_less, NULL))
+    PANIC ("shared page table creation failed");
+  lock_init_named (&share_lock, "share");
+  share_cache = kmem_cache_create ("shared_page",
+                                   sizeof (struct shared_page), 0,
+                                   NULL, NULL);
+  if (share_cache == NULL)
+    PANIC ("shared page table creation failed");
+}
+
+/* Returns the frame that holds the READ_BYTES bytes at offset
+   OFS in FILE, followed by zeros, reading them in if no other
+   process has them in memory yet, and takes a reference to it,
+   to be dropped with share_put().  The frame must only be mapped
+   read-only.  Returns a null pointer if no frame can be obtained
+   or the file cannot be read. */
+struct frame *
+share_get (struct file *file, off_t ofs, size_t read_bytes) 
+{
+  struct inode *inode = file_get_inode (file);
+  struct shared_page *sp;
+  struct frame *f;
+
+  ASSERT (read_bytes <= PGSIZE);
+
+  lock_acquire (&share_lock);
+  sp = lookup (inode, ofs, read_bytes);
+  if (sp == NULL)
+    {
+      sp = kmem_cache_alloc (share_cache);
+      if (sp == NULL)
+        {
+          lock_release (&share_lock);
+          return NULL;
+        }
+      sp->inode = inode;
+      sp->ofs = ofs;
+      sp->read_bytes = read_bytes;
+      sp->ref_cnt = 0;
+      lock_init_named (&sp->load_lock, "share-load");
+      sp->frame = NULL;
+      hash_insert (&shared_pages, &sp->elem);
+    }
+  sp->ref_cnt++;
+  lock_release (&share_lock);
+
+  /* Our reference keeps SP in the table, so it can be read in
+     without holding share_lock. */
+  lock_acquire (&sp->load_lock);
+  if (sp->frame == NULL)
+    {
+      f = frame_alloc (0, NULL);
+      if (f != NULL)
+        {
+          if (file_read_at (file, f->kpage, read_bytes, ofs)
+              == (off_t) read_bytes)
+            {
+              memset ((uint8_t *) f->kpage + read_bytes, 0,
+                      PGSIZE - read_bytes);
+              sp->frame = f;
+              load_cnt++;
+            }
+          else
+            frame_free (f);
+        }
+    }
+  else
+    hit_cnt++;
+  f = sp->frame;
+  lock_release (&sp->load_lock);
+
+  if (f == NULL)
+    share_put (file, ofs, read_bytes);
+  return f;
+}
+
+/* Like share_get(), but only if another process already has the
+   data in memory: returns a null pointer instead of reading it
+   in. */
+struct frame *
+share_get_cached (struct file *file, off_t ofs, size_t read_bytes) 
+{
+  struct shared_page *sp;
+  struct frame *f = NULL;
+
+  lock_acquire (&share_lock);
+  sp = lookup (file_get_inode (file), ofs, read_bytes);
+  if (sp != NULL)
+    sp->ref_cnt++;
+  lock_release (&share_lock);
+  if (sp == NULL)
+    return NULL;
+
+  /* Wait out a load in progress rather than start one. */
+  lock_acquire (&sp->load_lock);
+  f = sp->frame;
+  if (f != NULL)
+    hit_cnt++;
+  lock_release (&sp->load_lock);
+
+  if (f == NULL)
+    share_put (file, ofs, read_bytes);
+  return f;
+}
+
+/* Drops a reference taken by share_get() or share_get_cached()
+   with the same arguments.  Frees the frame when the last one is
+   dropped.  The caller must already have unmapped it. */
+void
+share_put (struct file *file, off_t ofs, size_t read_bytes) 
+{
+  struct shared_page *sp;
+
+  lock_acquire (&share_lock);
+  sp = lookup (file_get_inode (file), ofs, read_bytes);
+  ASSERT (sp != NULL && sp->ref_cnt > 0);
+  if (--sp->ref_cnt > 0)
+    sp = NULL;
+  else
+    hash_delete (&shared_pages, &sp->elem);
+  lock_release (&share_lock);
+
+  if (sp != NULL)
+    {
+      if (sp->frame != NULL)
+        frame_put (sp->frame);
+      kmem_cache_free (share_cache, sp);
+    }
+}
+
+/* Prints shared page statistics. */
+void
+share_print_stats (void) 
+{
+  printf ("Shared pages: %zu in use, %lld read in, %lld reused\n",
+          hash_size (&shared_pages), load_cnt, hit_cnt);
+}
+
+/* Returns the shared page for the given file data, or a null
+   pointer if there is none.  share_lock must be held. */
+static struct shared_page *
+lookup (struct inode *inode, off_t ofs, size_t read_bytes) 
+{
+  struct shared_page key;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&share_lock));
+
+  key.inode = inode;
+  key.ofs = ofs;
+  key.read_bytes = read_bytes;
+  e = hash_find (&shared_pages, &key.elem);
+  return e != NULL ? hash_entry (e, struct shared_page, elem) : NULL;
+}
+
+/* Returns a hash value for shared page E. */
+static unsigned
+shared_page_hash (const struct hash_elem *e, void *aux UNUSED) 
+{
+  const struct shared_page *sp = hash_entry (e, struct shared_page, elem);
+  return hash_bytes (&sp->inode, sizeof sp->inode) ^ hash_int (sp->ofs);
+}
+
+/* Returns true if shared page A precedes shared page B. */
+static bool
+shared_page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+                  void *aux UNUSED) 
+{
+  const struct shared_page *a = hash_entry (a_, struct shared_page, elem);
+  const struct shared_page *b = hash_entry (b_, struct shared_page, elem);
+
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  else if (a->ofs != b->ofs)
+    return a->ofs < b->ofs;
+  else
+    return a->read_bytes < b->read_bytes;
+}
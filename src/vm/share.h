@@ -0,0 +1,16 @@
+#ifndef VM_SHARE_H
+#define VM_SHARE_H
+
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+struct file;
+
+void share_init (void);
+struct frame *share_get (struct file *, off_t, size_t read_bytes);
+struct frame *share_get_cached (struct file *, off_t,
+                                size_t read_bytes);
+void share_put (struct file *, off_t, size_t read_bytes);
+void share_print_stats (void);
+
+#endif /* vm/share.h */
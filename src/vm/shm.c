@@ -0,0 +1,348 @@
+#include "vm/shm.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/stats.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+
+/* Shared-memory segments.
+
+   A segment is a named, fixed-size run of pages that any number
+   of processes map into their address spaces with shm_map(),
+   each at an address of its own choosing or at one the kernel
+   picks, so that what one process stores there the others see at
+   once, without copying and without I/O.  Processes wait for
+   each other's stores with futex_wait() and futex_wake() on words
+   in the segment, which userprog/futex.c identifies by segment
+   and offset rather than by address, since each process may map
+   the segment somewhere else.
+
+   A process's mapping is a run of ordinary pages in its
+   supplemental page table, each of which refers to the segment
+   and its index there.  The page fault handler gets a page's
+   frame from shm_get_frame() and maps it writable.  Like a frame
+   shared copy-on-write after a fork, a segment's frame lists
+   every page that maps it.  A segment's pages start out as zeros
+   and get a frame when first touched by any process.
+
+   A segment's frame that just one page maps is evicted like any
+   other: the clock picks it, and page_out() calls shm_page_out()
+   to write it to a swap slot that belongs to the segment rather
+   than the page.  It is always written, because the page's dirty
+   bit says nothing about what processes that unmapped it earlier
+   did.  The next fault on the page, by any process, reads it back
+   and frees the slot.  A frame that more than one page maps is
+   not evicted, and neither is one that no page maps at the
+   moment, which the segment keeps until a process touches that
+   page again or the segment is freed.
+
+   A segment lives as long as any page maps it.  The last page to
+   go, normally at exit, frees its frames and swap slots, and a
+   later shm_map() of the same name creates a new, zeroed segment.
+   A forked child maps its parent's segments at the same
+   addresses.
+
+   segments_lock protects the list of segments and their
+   reference counts, and each segment's lock its frames and swap
+   slots.  A segment's lock is taken after the lock of a page that
+   maps it, and is never held while allocating a frame, because
+   that may evict another page of the same segment. */
+
+/* A segment. */
+struct shm
+  {
+    struct list_elem elem;          /* Element in segments. */
+    char name[SHM_NAME_MAX + 1];    /* Null-terminated name. */
+    size_t page_cnt;                /* Number of pages. */
+    int ref_cnt;                    /* Pages that map it, plus
+                                       mappings being set up. */
+    struct lock lock;               /* Protects FRAMES and SLOTS. */
+    struct frame **frames;          /* Each page's frame, or null. */
+    size_t *slots;                  /* Each page's swap slot, or
+                                       SWAP_ERROR. */
+  };
+
+static struct list segments;            /* All segments. */
+static struct lock segments_lock;       /* Protects segments and
+                                           ref_cnt members. */
+
+static struct shm *lookup (const char *name);
+static struct shm *create (const char *name, size_t page_cnt);
+static void destroy (struct shm *);
+
+/* Initializes the segment table. */
+void
+shm_init (void)
+{
+  list_init (&segments);
+  lock_init_named (&segments_lock, "shm");
+}
+
+/* Maps the segment named NAME into the running process's address
+   space at user virtual address ADDR, or at an address above the
+   heap and below the stack that the kernel picks if ADDR is null.
+   If there is no such segment, creates one of SIZE bytes, rounded
+   up to whole pages, first; otherwise, SIZE must round up to the
+   same number of pages as the segment has.  Returns the address
+   of the mapping, or a null pointer if NAME is empty or longer
+   than SHM_NAME_MAX, SIZE is 0 or does not match, ADDR is not
+   page-aligned, the pages would overlap any already in the
+   address space, or memory is not available. */
+void *
+shm_map (const char *name, size_t size, void *addr)
+{
+  size_t len = strnlen (name, SHM_NAME_MAX + 1);
+  uint8_t *base = addr;
+  struct shm *seg;
+  size_t page_cnt;
+  size_t i;
+
+  if (len == 0 || len > SHM_NAME_MAX
+      || size == 0 || size > (size_t) PHYS_BASE)
+    return NULL;
+  page_cnt = DIV_ROUND_UP (size, PGSIZE);
+
+  /* Our reference keeps the segment alive while its pages are
+     added. */
+  lock_acquire (&segments_lock);
+  seg = lookup (name);
+  if (seg == NULL)
+    {
+      seg = create (name, page_cnt);
+      if (seg != NULL)
+        list_push_back (&segments, &seg->elem);
+    }
+  else if (seg->page_cnt != page_cnt)
+    seg = NULL;
+  if (seg != NULL)
+    seg->ref_cnt++;
+  lock_release (&segments_lock);
+  if (seg == NULL)
+    return NULL;
+
+  if (base == NULL)
+    base = page_find_gap (page_cnt);
+  else if (pg_ofs (base) != 0 || !is_user_vaddr (base)
+           || page_cnt * PGSIZE > (size_t) ((uint8_t *) PHYS_BASE - base))
+    base = NULL;
+  if (base != NULL)
+    for (i = 0; i < page_cnt; i++)
+      if (!page_add_shm (base + i * PGSIZE, seg, i))
+        {
+          /* Back out the pages added so far. */
+          while (i-- > 0)
+            page_remove (base + i * PGSIZE);
+          base = NULL;
+          break;
+        }
+
+  shm_unref (seg);
+  return base;
+}
+
+/* Removes the running process's mapping of a segment that starts
+   at ADDR.  Returns true if successful, false if no mapping
+   starts there. */
+bool
+shm_unmap (void *addr)
+{
+  size_t ofs;
+  struct shm *seg = page_get_shm (addr, &ofs);
+
+  if (seg == NULL || ofs != 0)
+    return false;
+  page_remove_range (addr, seg->page_cnt);
+  return true;
+}
+
+/* Takes a reference to SEG, for a page that maps it. */
+void
+shm_ref (struct shm *seg)
+{
+  lock_acquire (&segments_lock);
+  seg->ref_cnt++;
+  lock_release (&segments_lock);
+}
+
+/* Drops a reference to SEG, freeing SEG if it was the last. */
+void
+shm_unref (struct shm *seg)
+{
+  bool unused;
+
+  lock_acquire (&segments_lock);
+  ASSERT (seg->ref_cnt > 0);
+  unused = --seg->ref_cnt == 0;
+  if (unused)
+    list_remove (&seg->elem);
+  lock_release (&segments_lock);
+
+  if (unused)
+    destroy (seg);
+}
+
+/* Returns the frame that holds the data of P, a locked page that
+   maps a segment, with P added to its pages, reading the data
+   back from swap or zeroing a new frame if the segment has none
+   in memory.  The frame is pinned, for the caller to map and
+   then unpin.  Returns a null pointer if no frame can be
+   obtained. */
+struct frame *
+shm_get_frame (struct page *p)
+{
+  struct shm *seg = p->shm;
+  size_t i = p->shm_idx;
+  struct frame *new = NULL;
+  struct frame *f;
+
+  lock_acquire (&seg->lock);
+  if (seg->frames[i] == NULL)
+    {
+      /* Evicting a page for the new frame may need the lock. */
+      lock_release (&seg->lock);
+      new = frame_alloc (0, p);
+      if (new == NULL)
+        return NULL;
+      lock_acquire (&seg->lock);
+    }
+
+  f = seg->frames[i];
+  if (f == NULL)
+    {
+      /* NEW already lists P and is pinned. */
+      f = seg->frames[i] = new;
+      if (seg->slots[i] != SWAP_ERROR)
+        {
+          swap_read (seg->slots[i], f->kpage);
+          swap_free (seg->slots[i]);
+          seg->slots[i] = SWAP_ERROR;
+          stats_inc (&p->owner->swap_ins);
+        }
+      else
+        clear_page (f->kpage);
+    }
+  else
+    {
+      /* Another process brought the page in meanwhile, or it was
+         already in memory. */
+      if (new != NULL)
+        frame_free (new);
+      frame_pin (f);
+      frame_add_page (f, p);
+    }
+  lock_release (&seg->lock);
+  return f;
+}
+
+/* Records that P, a locked page that maps a segment and is
+   already unmapped, no longer maps its frame.  The frame stays
+   with the segment. */
+void
+shm_put_frame (struct page *p)
+{
+  frame_remove_page (p->frame, p);
+}
+
+/* Writes the frame of P, a page that maps a segment and is
+   locked and unmapped, to a swap slot of the segment's, for
+   page_out().  Returns true if successful, in which case the
+   frame is the caller's to reuse, or false if another page has
+   mapped the frame since it was chosen for eviction or swap is
+   full. */
+bool
+shm_page_out (struct page *p)
+{
+  struct shm *seg = p->shm;
+  size_t i = p->shm_idx;
+  bool success = false;
+
+  lock_acquire (&seg->lock);
+  ASSERT (seg->frames[i] == p->frame);
+  ASSERT (seg->slots[i] == SWAP_ERROR);
+  if (!frame_is_shared (p->frame))
+    {
+      seg->slots[i] = swap_alloc ();
+      if (seg->slots[i] != SWAP_ERROR)
+        {
+          swap_write (seg->slots[i], p->frame->kpage);
+          stats_inc (&p->owner->swap_outs);
+          seg->frames[i] = NULL;
+          success = true;
+        }
+    }
+  lock_release (&seg->lock);
+  return success;
+}
+
+/* Returns the segment named NAME, or a null pointer if there is
+   none.  segments_lock must be held. */
+static struct shm *
+lookup (const char *name)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&segments); e != list_end (&segments);
+       e = list_next (e))
+    {
+      struct shm *seg = list_entry (e, struct shm, elem);
+      if (!strcmp (seg->name, name))
+        return seg;
+    }
+  return NULL;
+}
+
+/* Returns a new segment named NAME of PAGE_CNT pages, all zeros,
+   with no references, or a null pointer if memory is not
+   available. */
+static struct shm *
+create (const char *name, size_t page_cnt)
+{
+  struct shm *seg;
+  size_t i;
+
+  seg = malloc (sizeof *seg);
+  if (seg == NULL)
+    return NULL;
+  seg->frames = calloc (page_cnt, sizeof *seg->frames);
+  seg->slots = malloc (page_cnt * sizeof *seg->slots);
+  if (seg->frames == NULL || seg->slots == NULL)
+    {
+      free (seg->frames);
+      free (seg->slots);
+      free (seg);
+      return NULL;
+    }
+  strlcpy (seg->name, name, sizeof seg->name);
+  seg->page_cnt = page_cnt;
+  seg->ref_cnt = 0;
+  lock_init_named (&seg->lock, "shm-segment");
+  for (i = 0; i < page_cnt; i++)
+    seg->slots[i] = SWAP_ERROR;
+  return seg;
+}
+
+/* Frees SEG, which no page maps any more, with its frames and
+   swap slots. */
+static void
+destroy (struct shm *seg)
+{
+  size_t i;
+
+  for (i = 0; i < seg->page_cnt; i++)
+    {
+      if (seg->frames[i] != NULL)
+        frame_put (seg->frames[i]);
+      if (seg->slots[i] != SWAP_ERROR)
+        swap_free (seg->slots[i]);
+    }
+  free (seg->frames);
+  free (seg->slots);
+  free (seg);
+}
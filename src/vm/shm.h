@@ -0,0 +1,27 @@
+#ifndef VM_SHM_H
+#define VM_SHM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Shared-memory segments.  See shm.c for details. */
+
+struct page;
+struct shm;
+
+/* Longest segment name, in bytes, not counting the null
+   terminator. */
+#define SHM_NAME_MAX 31
+
+void shm_init (void);
+void *shm_map (const char *name, size_t size, void *addr);
+bool shm_unmap (void *addr);
+
+/* For page.c. */
+void shm_ref (struct shm *);
+void shm_unref (struct shm *);
+struct frame *shm_get_frame (struct page *);
+void shm_put_frame (struct page *);
+bool shm_page_out (struct page *);
+
+#endif /* vm/shm.h */
@@ -0,0 +1,275 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "filesys/hibernate.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/zswap.h"
+
+/* Swap area.
+
+   The swap block device is divided into slots of one page each,
+   SLOT_SECTORS consecutive sectors, and a bitmap records which
+   slots are in use.  A page is written or read with a single
+   multi-sector request.
+
+   Allocation is next-fit: the search for a free slot resumes
+   just after the slot allocated last, so it normally succeeds at
+   the first bit it examines, and pages evicted one after another
+   land in consecutive slots, which keeps the disk head moving in
+   one direction when they are written and read back.  A caller
+   that knows a better slot, such as the one next to the slot of
+   a page it wrote just before, can ask for it with
+   swap_alloc_near().
+
+   The slots at the start of the device that hold a warm-start
+   image, if there is one, are kept in use for good, so that the
+   image survives for later boots (see filesys/hibernate.c).
+
+   swap_read_cluster() reads a few slots that lie close together
+   with a single request, through a bounce buffer, so that pages
+   that went out together come back in together cheaply.
+
+   A slot may hold a page shared by several processes after a
+   fork, so each slot has a reference count, and it is only freed
+   when the last reference is dropped.
+
+   With the -zswap option, vm/zswap.c keeps the contents of slots
+   compressed in memory and only writes them here when it runs
+   out of room. */
+
+/* Sectors per swap slot. */
+#define SLOT_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+static struct block *swap_device;       /* Swap device, or null. */
+static struct bitmap *used_slots;       /* One bit per slot. */
+static uint16_t *ref_cnts;              /* References to each slot. */
+static size_t next_slot;                /* Where next search starts. */
+static struct lock swap_lock;           /* Protects the above. */
+
+/* Statistics. */
+static long long write_cnt;             /* Pages written. */
+static long long read_cnt;              /* Pages read. */
+static long long cluster_cnt;           /* Requests for several pages. */
+
+static zswap_spill_func write_slot;
+
+/* Initializes the swap area.  Without a swap device, every
+   swap_alloc() fails. */
+void
+swap_init (void) 
+{
+  size_t slot_cnt = 0;
+  size_t reserved;
+
+  lock_init_named (&swap_lock, "swap");
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device != NULL)
+    slot_cnt = block_size (swap_device) / SLOT_SECTORS;
+  used_slots = bitmap_create_summarized (slot_cnt);
+  ref_cnts = calloc (slot_cnt, sizeof *ref_cnts);
+  if (used_slots == NULL || (ref_cnts == NULL && slot_cnt > 0))
+    PANIC ("bitmap creation failed--swap device is too large");
+
+  /* Keep the slots that hold a warm-start image out of use. */
+  reserved = DIV_ROUND_UP (hibernate_image_size (), SLOT_SECTORS);
+  if (reserved > 0 && reserved <= slot_cnt)
+    bitmap_set_multiple (used_slots, 0, reserved, true);
+  if (slot_cnt > 0)
+    zswap_init (write_slot);
+}
+
+/* Allocates a free swap slot and returns it, or SWAP_ERROR if
+   the swap area is full. */
+size_t
+swap_alloc (void) 
+{
+  size_t slot = BITMAP_ERROR;
+
+  lock_acquire (&swap_lock);
+  if (next_slot < bitmap_size (used_slots))
+    slot = bitmap_scan_and_flip (used_slots, next_slot, 1, false);
+  if (slot == BITMAP_ERROR && next_slot > 0)
+    slot = bitmap_scan_and_flip (used_slots, 0, 1, false);
+  if (slot != BITMAP_ERROR)
+    {
+      next_slot = slot + 1;
+      ref_cnts[slot] = 1;
+    }
+  lock_release (&swap_lock);
+
+  return slot != BITMAP_ERROR ? slot : SWAP_ERROR;
+}
+
+/* Allocates SLOT if it is free, or else any free slot, as
+   swap_alloc() does, and returns it.  SLOT may be SWAP_ERROR or
+   out of range, in which case this is the same as swap_alloc().
+   Returns SWAP_ERROR if the swap area is full. */
+size_t
+swap_alloc_near (size_t slot) 
+{
+  bool got = false;
+
+  lock_acquire (&swap_lock);
+  if (slot < bitmap_size (used_slots) && !bitmap_test (used_slots, slot))
+    {
+      bitmap_mark (used_slots, slot);
+      next_slot = slot + 1;
+      ref_cnts[slot] = 1;
+      got = true;
+    }
+  lock_release (&swap_lock);
+
+  return got ? slot : swap_alloc ();
+}
+
+/* Adds a reference to SLOT, which must be in use, for another
+   page that shares its contents, and returns SLOT.  Returns
+   SWAP_ERROR, adding no reference, if SLOT already has as many
+   references as it can count. */
+size_t
+swap_dup (size_t slot) 
+{
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (used_slots, slot));
+  if (ref_cnts[slot] < UINT16_MAX)
+    ref_cnts[slot]++;
+  else
+    slot = SWAP_ERROR;
+  lock_release (&swap_lock);
+  return slot;
+}
+
+/* Returns true if SLOT has a single reference, so that it may be
+   overwritten. */
+bool
+swap_is_exclusive (size_t slot) 
+{
+  bool exclusive;
+
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (used_slots, slot));
+  exclusive = ref_cnts[slot] == 1;
+  lock_release (&swap_lock);
+  return exclusive;
+}
+
+/* Drops a reference to SLOT, which must have been returned by
+   swap_alloc() or swap_dup(), and frees it if none remain. */
+void
+swap_free (size_t slot) 
+{
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (used_slots, slot));
+  if (--ref_cnts[slot] == 0)
+    {
+      zswap_invalidate (slot);
+      bitmap_reset (used_slots, slot);
+    }
+  lock_release (&swap_lock);
+}
+
+/* Writes the page at KPAGE to SLOT. */
+void
+swap_write (size_t slot, const void *kpage) 
+{
+  ASSERT (slot < bitmap_size (used_slots));
+
+  if (!zswap_store (slot, kpage))
+    write_slot (slot, kpage);
+}
+
+/* Writes the page at KPAGE to SLOT on the swap device. */
+static void
+write_slot (size_t slot, const void *kpage) 
+{
+  block_write_multiple (swap_device, slot * SLOT_SECTORS, SLOT_SECTORS,
+                        kpage);
+  write_cnt++;
+}
+
+/* Reads the page in SLOT into KPAGE. */
+void
+swap_read (size_t slot, void *kpage) 
+{
+  ASSERT (slot < bitmap_size (used_slots));
+
+  if (zswap_load (slot, kpage))
+    return;
+  block_read_multiple (swap_device, slot * SLOT_SECTORS, SLOT_SECTORS,
+                       kpage);
+  read_cnt++;
+}
+
+/* Reads the pages in the CNT slots in SLOTS, which must all lie
+   within SWAP_CLUSTER consecutive slots, into the corresponding
+   pages in KPAGES.  Those on disk are read with one request that
+   spans them all, unless memory for the bounce buffer is not
+   available, in which case they are read one by one. */
+void
+swap_read_cluster (const size_t slots[], void *const kpages[], size_t cnt) 
+{
+  bool on_disk[SWAP_CLUSTER];
+  size_t lo = SIZE_MAX, hi = 0;
+  size_t disk_cnt = 0;
+  uint8_t *buf;
+  size_t i;
+
+  ASSERT (cnt <= SWAP_CLUSTER);
+
+  for (i = 0; i < cnt; i++) 
+    {
+      ASSERT (slots[i] < bitmap_size (used_slots));
+      on_disk[i] = !zswap_load (slots[i], kpages[i]);
+      if (on_disk[i]) 
+        {
+          if (slots[i] < lo)
+            lo = slots[i];
+          if (slots[i] > hi)
+            hi = slots[i];
+          disk_cnt++;
+        }
+    }
+  if (disk_cnt == 0)
+    return;
+  ASSERT (hi - lo < SWAP_CLUSTER);
+
+  buf = disk_cnt > 1 ? palloc_get_multiple (0, hi - lo + 1) : NULL;
+  if (buf == NULL) 
+    {
+      for (i = 0; i < cnt; i++)
+        if (on_disk[i])
+          {
+            block_read_multiple (swap_device, slots[i] * SLOT_SECTORS,
+                                 SLOT_SECTORS, kpages[i]);
+            read_cnt++;
+          }
+      return;
+    }
+
+  block_read_multiple (swap_device, lo * SLOT_SECTORS,
+                       (hi - lo + 1) * SLOT_SECTORS, buf);
+  for (i = 0; i < cnt; i++)
+    if (on_disk[i])
+      memcpy (kpages[i], buf + (slots[i] - lo) * PGSIZE, PGSIZE);
+  palloc_free_multiple (buf, hi - lo + 1);
+  read_cnt += disk_cnt;
+  cluster_cnt++;
+}
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void) 
+{
+  printf ("Swap: %lld pages written, %lld pages read, "
+          "%lld clustered reads\n",
+          write_cnt, read_cnt, cluster_cnt);
+  zswap_print_stats ();
+}
@@ -0,0 +1,25 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Returned by swap_alloc() when no slot is free. */
+#define SWAP_ERROR ((size_t) -1)
+
+/* Most consecutive slots that swap_read_cluster() reads. */
+#define SWAP_CLUSTER 8
+
+void swap_init (void);
+size_t swap_alloc (void);
+size_t swap_alloc_near (size_t slot);
+size_t swap_dup (size_t slot);
+bool swap_is_exclusive (size_t slot);
+void swap_free (size_t slot);
+void swap_write (size_t slot, const void *kpage);
+void swap_read (size_t slot, void *kpage);
+void swap_read_cluster (const size_t slots[], void *const kpages[],
+                        size_t cnt);
+void swap_print_stats (void);
+
+#endif /* vm/swap.h */
@@ -0,0 +1,306 @@
+#include "vm/zswap.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <lz.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/kmem.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Compressed swap.
+
+   A tier in front of the swap device that keeps swapped-out
+   pages in memory, compressed with lib/kernel/lz.c, so that
+   swapping a page out and back in normally involves no disk I/O
+   at all.  A page that is written to a swap slot is compressed
+   into a pool of zswap_page_cnt pages taken from the user pool
+   at boot, and it is only written to the disk when the pool runs
+   out of room: then the least recently stored or loaded pages in
+   the pool are decompressed and written to their slots on disk,
+   oldest first, until the new page fits.  A page that does not
+   compress to MAX_STORED bytes or less goes straight to disk.
+
+   Each pool page is divided into UNIT_CNT units of UNIT_SIZE
+   bytes, with one bit each in a 64-bit mask of units in use, and
+   a compressed page takes a run of consecutive units within a
+   single pool page.
+
+   Loading a page leaves it in the pool, since the swap slot
+   stays the page's backing store until it is freed or
+   rewritten. */
+
+/* Allocation unit within a pool page. */
+#define UNIT_SIZE 64
+#define UNIT_CNT (PGSIZE / UNIT_SIZE)
+
+/* Largest compressed page worth keeping in memory. */
+#define MAX_STORED (PGSIZE * 3 / 4)
+
+/* A compressed page in the pool. */
+struct zentry
+  {
+    struct hash_elem hash_elem;     /* Element in entries. */
+    struct list_elem lru_elem;      /* Element in lru_list. */
+    size_t slot;                    /* Swap slot. */
+    size_t page;                    /* Pool page index. */
+    unsigned unit;                  /* First unit in the pool page. */
+    unsigned unit_cnt;              /* Number of units. */
+    size_t len;                     /* Compressed length in bytes. */
+  };
+
+/* -zswap: Number of user pages to set aside for compressed swap,
+   or 0 to disable it. */
+size_t zswap_page_cnt;
+
+static uint8_t **pool;                  /* Pool pages. */
+static uint64_t *used_units;            /* Units in use per pool page. */
+static size_t pool_cnt;                 /* Number of pool pages. */
+static struct hash entries;             /* Entries by slot. */
+static struct list lru_list;            /* Entries, oldest first. */
+static struct lock zswap_lock;          /* Protects all of the above,
+                                           and the buffers below. */
+static struct kmem_cache *zentry_cache; /* Allocates entries. */
+static zswap_spill_func *spill_func;    /* Writes a page to disk. */
+
+/* Scratch space. */
+static uint16_t lz_work[LZ_WORK_CNT];   /* Compressor's hash table. */
+static uint8_t *zbuf;                   /* Compressed page. */
+static uint8_t *bounce;                 /* Page decompressed to spill. */
+
+/* Statistics. */
+static long long store_cnt;             /* Pages compressed. */
+static long long reject_cnt;            /* Pages too big to keep. */
+static long long load_cnt;              /* Pages decompressed. */
+static long long spill_cnt;             /* Pages written to disk. */
+
+static hash_hash_func zentry_hash;
+static hash_less_func zentry_less;
+static struct zentry *lookup (size_t slot);
+static void remove_entry (struct zentry *);
+static bool alloc_units (unsigned cnt, size_t *page, unsigned *unit);
+
+/* Sets up compressed swap, if zswap_page_cnt is nonzero, with
+   SPILL to write pages that overflow the pool to disk.  The pool
+   may end up smaller if the user pool has too few pages. */
+void
+zswap_init (zswap_spill_func *spill) 
+{
+  if (zswap_page_cnt == 0)
+    return;
+
+  lock_init_named (&zswap_lock, "zswap");
+  list_init (&lru_list);
+  spill_func = spill;
+  pool = calloc (zswap_page_cnt, sizeof *pool);
+  used_units = calloc (zswap_page_cnt, sizeof *used_units);
+  zentry_cache = kmem_cache_create ("zentry", sizeof (struct zentry), 0,
+                                    NULL, NULL);
+  if (pool == NULL || used_units == NULL || zentry_cache == NULL
+      || !hash_init (&entries, zentry_hash, zentry_less, NULL))
+    PANIC ("compressed swap creation failed");
+  zbuf = palloc_get_page (PAL_ASSERT);
+  bounce = palloc_get_page (PAL_ASSERT);
+  for (pool_cnt = 0; pool_cnt < zswap_page_cnt; pool_cnt++) 
+    {
+      pool[pool_cnt] = palloc_get_page (PAL_USER);
+      if (pool[pool_cnt] == NULL)
+        break;
+    }
+}
+
+/* Compresses the page at KPAGE into the pool as the contents of
+   swap slot SLOT, replacing any earlier contents kept there, and
+   writes older pages to disk if that is needed to make room.
+   Returns true if successful, false if compressed swap is
+   disabled or the page does not compress well, in which case the
+   caller must write it to disk itself. */
+bool
+zswap_store (size_t slot, const void *kpage) 
+{
+  struct zentry *e;
+  size_t len;
+  size_t page;
+  unsigned unit, unit_cnt;
+
+  if (pool_cnt == 0)
+    return false;
+
+  lock_acquire (&zswap_lock);
+  e = lookup (slot);
+  if (e != NULL)
+    remove_entry (e);
+
+  len = lz_compress (kpage, PGSIZE, zbuf, MAX_STORED, lz_work);
+  if (len == 0)
+    {
+      reject_cnt++;
+      lock_release (&zswap_lock);
+      return false;
+    }
+
+  /* Spill the oldest pages until the new one fits.  An empty
+     pool page always has room. */
+  unit_cnt = DIV_ROUND_UP (len, UNIT_SIZE);
+  while (!alloc_units (unit_cnt, &page, &unit)) 
+    {
+      e = list_entry (list_front (&lru_list), struct zentry, lru_elem);
+      if (!lz_decompress (pool[e->page] + e->unit * UNIT_SIZE, e->len,
+                          bounce, PGSIZE))
+        PANIC ("compressed swap slot %zu corrupted", e->slot);
+      spill_func (e->slot, bounce);
+      remove_entry (e);
+      spill_cnt++;
+    }
+
+  e = kmem_cache_alloc (zentry_cache);
+  if (e == NULL)
+    {
+      used_units[page] &= ~(((uint64_t) -1 >> (64 - unit_cnt)) << unit);
+      lock_release (&zswap_lock);
+      return false;
+    }
+  memcpy (pool[page] + unit * UNIT_SIZE, zbuf, len);
+  e->slot = slot;
+  e->page = page;
+  e->unit = unit;
+  e->unit_cnt = unit_cnt;
+  e->len = len;
+  hash_insert (&entries, &e->hash_elem);
+  list_push_back (&lru_list, &e->lru_elem);
+  store_cnt++;
+  lock_release (&zswap_lock);
+
+  return true;
+}
+
+/* Decompresses the contents of swap slot SLOT into KPAGE, if
+   they are in the pool.  Returns true if successful, false if
+   the slot's contents are on disk. */
+bool
+zswap_load (size_t slot, void *kpage) 
+{
+  struct zentry *e;
+
+  if (pool_cnt == 0)
+    return false;
+
+  lock_acquire (&zswap_lock);
+  e = lookup (slot);
+  if (e != NULL)
+    {
+      if (!lz_decompress (pool[e->page] + e->unit * UNIT_SIZE, e->len,
+                          kpage, PGSIZE))
+        PANIC ("compressed swap slot %zu corrupted", slot);
+      list_remove (&e->lru_elem);
+      list_push_back (&lru_list, &e->lru_elem);
+      load_cnt++;
+    }
+  lock_release (&zswap_lock);
+
+  return e != NULL;
+}
+
+/* Discards the contents of swap slot SLOT from the pool, if it
+   is there, because the slot has been freed. */
+void
+zswap_invalidate (size_t slot) 
+{
+  struct zentry *e;
+
+  if (pool_cnt == 0)
+    return;
+
+  lock_acquire (&zswap_lock);
+  e = lookup (slot);
+  if (e != NULL)
+    remove_entry (e);
+  lock_release (&zswap_lock);
+}
+
+/* Prints compressed swap statistics. */
+void
+zswap_print_stats (void) 
+{
+  if (pool_cnt > 0)
+    printf ("Zswap: %zu pages, %lld stored, %lld rejected, "
+            "%lld loaded, %lld spilled\n",
+            pool_cnt, store_cnt, reject_cnt, load_cnt, spill_cnt);
+}
+
+/* Finds a run of CNT free units in a pool page, marks them in
+   use, and stores the pool page's index in *PAGE and the run's
+   first unit in *UNIT.  Returns true if successful, false if no
+   pool page has such a run. */
+static bool
+alloc_units (unsigned cnt, size_t *page, unsigned *unit) 
+{
+  uint64_t run = (uint64_t) -1 >> (64 - cnt);
+  size_t i;
+
+  ASSERT (cnt > 0 && cnt <= UNIT_CNT);
+  ASSERT (lock_held_by_current_thread (&zswap_lock));
+
+  for (i = 0; i < pool_cnt; i++)
+    if (used_units[i] != (uint64_t) -1) 
+      {
+        unsigned u;
+
+        for (u = 0; u + cnt <= UNIT_CNT; u++)
+          if ((used_units[i] & (run << u)) == 0) 
+            {
+              used_units[i] |= run << u;
+              *page = i;
+              *unit = u;
+              return true;
+            }
+      }
+  return false;
+}
+
+/* Frees entry E and its units. */
+static void
+remove_entry (struct zentry *e) 
+{
+  ASSERT (lock_held_by_current_thread (&zswap_lock));
+
+  used_units[e->page] &= ~(((uint64_t) -1 >> (64 - e->unit_cnt))
+                           << e->unit);
+  hash_delete (&entries, &e->hash_elem);
+  list_remove (&e->lru_elem);
+  kmem_cache_free (zentry_cache, e);
+}
+
+/* Returns the entry for SLOT, or a null pointer if there is
+   none. */
+static struct zentry *
+lookup (size_t slot) 
+{
+  struct zentry key;
+  struct hash_elem *e;
+
+  key.slot = slot;
+  e = hash_find (&entries, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct zentry, hash_elem) : NULL;
+}
+
+/* Returns a hash value for entry E. */
+static unsigned
+zentry_hash (const struct hash_elem *e, void *aux UNUSED) 
+{
+  return hash_int (hash_entry (e, struct zentry, hash_elem)->slot);
+}
+
+/* Returns true if entry A precedes entry B. */
+static bool
+zentry_less (const struct hash_elem *a, const struct hash_elem *b,
+             void *aux UNUSED) 
+{
+  return (hash_entry (a, struct zentry, hash_elem)->slot
+          < hash_entry (b, struct zentry, hash_elem)->slot);
+}
@@ -0,0 +1,22 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* -zswap: Number of user pages to set aside for compressed swap,
+   or 0 to disable it. */
+extern size_t zswap_page_cnt;
+
+/* Function that zswap_store() calls to write the page at KPAGE
+   to swap slot SLOT on disk, to make room in the compressed
+   pool. */
+typedef void zswap_spill_func (size_t slot, const void *kpage);
+
+void zswap_init (zswap_spill_func *);
+bool zswap_store (size_t slot, const void *kpage);
+bool zswap_load (size_t slot, void *kpage);
+void zswap_invalidate (size_t slot);
+void zswap_print_stats (void);
+
+#endif /* vm/zswap.h */